@@ -3,13 +3,130 @@
 #include "co/fs.h"
 #include "co/flag.h"
 #include "co/cout.h"
+#include "co/hash.h"
 
 DEF_bool(cpp, false, "generate code for C++");
 DEF_bool(go, false, "generate code for golang"); 
- 
+
+// a field of an object: "type name", or "[]type name" for an array
+struct Field {
+    fastring type;
+    fastring name;
+    bool array;
+};
+
+// object Name { fields }
+struct Object {
+    fastring name;
+    co::vector<Field> fields;
+};
+
+// "name" for a json method, or "name(Req) Res" for a method with typed messages
+struct Method {
+    fastring name;
+    fastring req;
+    fastring res;
+    uint32 id; // hash of "pkg.serv.name"
+};
+
+// C++ types of the builtin types, NULL if not builtin
+const char* cpp_type(const fastring& t) {
+    static const char* x[][2] = {
+        { "bool", "bool" }, { "int32", "int32" }, { "uint32", "uint32" },
+        { "int64", "int64" }, { "uint64", "uint64" }, { "double", "double" },
+        { "string", "fastring" },
+    };
+    for (size_t i = 0; i < sizeof(x) / sizeof(x[0]); ++i) {
+        if (t == x[i][0]) return x[i][1];
+    }
+    return 0;
+}
+
+// "hello" -> "kHello", names of method ids
+fastring method_id_name(const fastring& m) {
+    fastring s("k");
+    s.append(m);
+    if ('a' <= s[1] && s[1] <= 'z') s[1] -= 'a' - 'A';
+    return s;
+}
+
+void gen_object(fs::fstream& fs, const Object& o) {
+    fs << "struct " << o.name << " : public rpc::Message {\n";
+
+    // constructor, numbers are initialized with 0
+    fastring init;
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        const Field& f = o.fields[i];
+        const char* t = cpp_type(f.type);
+        if (f.array || !t || f.type == "string") continue;
+        if (!init.empty()) init.append(", ");
+        init << f.name << (f.type == "bool" ? "(false)" : "(0)");
+    }
+    fs << fastring(' ', 4) << o.name << "()";
+    if (!init.empty()) fs << " : " << init;
+    fs << " {}\n\n";
+    fs << fastring(' ', 4) << "virtual ~" << o.name << "() {}\n\n";
+
+    // encode
+    fs << fastring(' ', 4) << "virtual void encode(fastream& s) const {\n";
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        fs << fastring(' ', 8) << "rpc::wire::write(s, " << (i + 1) << ", " << o.fields[i].name << ");\n";
+    }
+    fs << fastring(' ', 4) << "}\n\n";
+
+    // decode
+    fs << fastring(' ', 4) << "virtual bool decode(const char* p, size_t n) {\n"
+       << fastring(' ', 8) << "this->clear();\n"
+       << fastring(' ', 8) << "const char* const e = p + n;\n"
+       << fastring(' ', 8) << "uint64 k;\n"
+       << fastring(' ', 8) << "while (p < e) {\n"
+       << fastring(' ', 12) << "if (!rpc::wire::get_varint(p, e, k)) return false;\n"
+       << fastring(' ', 12) << "const int t = (int)(k & 7);\n"
+       << fastring(' ', 12) << "bool r;\n"
+       << fastring(' ', 12) << "switch (k >> 3) {\n";
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        fs << fastring(' ', 14) << "case " << (i + 1) << ":  r = rpc::wire::read(p, e, t, "
+           << o.fields[i].name << "); break;\n";
+    }
+    fs << fastring(' ', 14) << "default: r = rpc::wire::skip(p, e, t); break;\n"
+       << fastring(' ', 12) << "}\n"
+       << fastring(' ', 12) << "if (!r) return false;\n"
+       << fastring(' ', 8) << "}\n"
+       << fastring(' ', 8) << "return true;\n"
+       << fastring(' ', 4) << "}\n\n";
+
+    // clear
+    fs << fastring(' ', 4) << "void clear() {\n";
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        const Field& f = o.fields[i];
+        const char* t = cpp_type(f.type);
+        fs << fastring(' ', 8) << f.name;
+        if (f.array || !t || f.type == "string") {
+            fs << ".clear();\n";
+        } else {
+            fs << (f.type == "bool" ? " = false;\n" : " = 0;\n");
+        }
+    }
+    fs << fastring(' ', 4) << "}\n\n";
+
+    // fields
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        const Field& f = o.fields[i];
+        const char* t = cpp_type(f.type);
+        fs << fastring(' ', 4);
+        if (f.array) {
+            fs << "co::vector<" << (t ? t : f.type.c_str()) << "> ";
+        } else {
+            fs << (t ? t : f.type.c_str()) << ' ';
+        }
+        fs << f.name << ";\n";
+    }
+    fs << "};\n\n";
+}
+
 void gen_cpp(
     const fastring& gen_file, const fastring& pkg, const fastring& serv, 
-    const co::vector<fastring>& methods
+    const co::vector<Method>& methods, const co::vector<Object>& objects
 ) {
     fs::fstream fs(gen_file.c_str(), 'w');
     if (!fs) {
@@ -17,11 +134,6 @@ void gen_cpp(
         exit(0);
     }
 
-    // service name: pkg.serv or serv
-    fastring serv_name(pkg);
-    if (!serv_name.empty()) serv_name.append('.');
-    serv_name.append(serv);
-
     // packages.  "xx.yy" -> ["xx", "yy"]
     auto pkgs = str::split(pkg, '.');
 
@@ -39,41 +151,115 @@ void gen_cpp(
     }
     if (!pkgs.empty()) fs << "\n";
 
-    // class for service
-    fs << "class " << serv << " : public rpc::Service {\n";
-    fs << "  public:\n";
-    fs << fastring(' ', 4) << "typedef std::function<void(Json&, Json&)> Fun;\n\n";
+    // structs for objects
+    for (size_t i = 0; i < objects.size(); ++i) {
+        gen_object(fs, objects[i]);
+    }
 
-    do {
-        fs << fastring(' ', 4) << serv << "() {\n";
-        fs << fastring(' ', 8) << "using std::placeholders::_1;\n";
-        fs << fastring(' ', 8) << "using std::placeholders::_2;\n";
+    if (!serv.empty()) {
+        bool typed = false, json = false;
         for (size_t i = 0; i < methods.size(); ++i) {
-            fs << fastring(' ', 8) << "_methods[\"" << serv << '.' << methods[i] << "\"] = "
-               << "std::bind(&" << serv << "::" << methods[i] << ", this, _1, _2);\n";
+            methods[i].req.empty() ? (json = true) : (typed = true);
         }
-        fs << fastring(' ', 4) << "}\n\n";
 
-        fs << fastring(' ', 4) << "virtual ~" << serv << "() {}\n\n";
-    } while (0);
+        // class for service
+        fs << "class " << serv << " : public rpc::Service {\n";
+        fs << "  public:\n";
+        fs << fastring(' ', 4) << "typedef std::function<void(Json&, Json&)> Fun;\n\n";
+
+        // ids of methods with typed messages
+        if (typed) {
+            fs << fastring(' ', 4) << "enum : uint32 {\n";
+            for (size_t i = 0; i < methods.size(); ++i) {
+                if (methods[i].req.empty()) continue;
+                fs << fastring(' ', 8) << method_id_name(methods[i].name) << " = "
+                   << methods[i].id << "u,\n";
+            }
+            fs << fastring(' ', 4) << "};\n\n";
+        }
 
-    // virtual const char* name() const
-    fs << fastring(' ', 4) << "virtual const char* name() const {\n"
-       << fastring(' ', 8) << "return \"" << serv << "\";\n"
-       << fastring(' ', 4) << "}\n\n";
+        do {
+            fs << fastring(' ', 4) << serv << "() {\n";
+            if (json) {
+                fs << fastring(' ', 8) << "using std::placeholders::_1;\n";
+                fs << fastring(' ', 8) << "using std::placeholders::_2;\n";
+            }
+            for (size_t i = 0; i < methods.size(); ++i) {
+                const Method& m = methods[i];
+                if (!m.req.empty()) continue;
+                fs << fastring(' ', 8) << "_methods[\"" << serv << '.' << m.name << "\"] = "
+                   << "std::bind(&" << serv << "::" << m.name << ", this, _1, _2);\n";
+            }
+            for (size_t i = 0; i < methods.size(); ++i) {
+                const Method& m = methods[i];
+                if (m.req.empty()) continue;
+                fs << fastring(' ', 8) << "_bin_methods[" << method_id_name(m.name) << "] = "
+                   << "[this](const char* p, size_t n, fastream& s) {\n"
+                   << fastring(' ', 12) << m.req << " req;\n"
+                   << fastring(' ', 12) << m.res << " res;\n"
+                   << fastring(' ', 12) << "if (!req.decode(p, n)) return (int)rpc::kBadRequest;\n"
+                   << fastring(' ', 12) << "this->" << m.name << "(req, res);\n"
+                   << fastring(' ', 12) << "res.encode(s);\n"
+                   << fastring(' ', 12) << "return (int)rpc::kOk;\n"
+                   << fastring(' ', 8) << "};\n";
+            }
+            fs << fastring(' ', 4) << "}\n\n";
 
-    fs << fastring(' ', 4) << "virtual const co::map<const char*, Fun>& methods() const {\n"
-       << fastring(' ', 8) << "return _methods;\n"
-       << fastring(' ', 4) << "}\n\n";
+            fs << fastring(' ', 4) << "virtual ~" << serv << "() {}\n\n";
+        } while (0);
 
-    // virtual void xxx(Json& req, Json& res)
-    for (size_t i = 0; i < methods.size(); ++i) {
-        fs << fastring(' ', 4) << "virtual void " << methods[i] << "(Json& req, Json& res) = 0;\n\n";
-    }
+        // virtual const char* name() const
+        fs << fastring(' ', 4) << "virtual const char* name() const {\n"
+           << fastring(' ', 8) << "return \"" << serv << "\";\n"
+           << fastring(' ', 4) << "}\n\n";
+
+        fs << fastring(' ', 4) << "virtual const co::map<const char*, Fun>& methods() const {\n"
+           << fastring(' ', 8) << "return _methods;\n"
+           << fastring(' ', 4) << "}\n\n";
 
-    fs << "  private:\n";
-    fs << "    co::map<const char*, Fun> _methods;\n";
-    fs << "};\n";
+        if (typed) {
+            fs << fastring(' ', 4) << "virtual const co::map<uint32, BinFun>* bin_methods() const {\n"
+               << fastring(' ', 8) << "return &_bin_methods;\n"
+               << fastring(' ', 4) << "}\n\n";
+        }
+
+        // virtual void xxx(Json& req, Json& res)
+        // virtual void xxx(const Req& req, Res& res)
+        for (size_t i = 0; i < methods.size(); ++i) {
+            const Method& m = methods[i];
+            if (m.req.empty()) {
+                fs << fastring(' ', 4) << "virtual void " << m.name << "(Json& req, Json& res) = 0;\n\n";
+            } else {
+                fs << fastring(' ', 4) << "virtual void " << m.name << "(const " << m.req
+                   << "& req, " << m.res << "& res) = 0;\n\n";
+            }
+        }
+
+        fs << "  private:\n";
+        fs << "    co::map<const char*, Fun> _methods;\n";
+        if (typed) fs << "    co::map<uint32, BinFun> _bin_methods;\n";
+        fs << "};\n";
+
+        // client stub for methods with typed messages
+        if (typed) {
+            fs << "\nclass " << serv << "Client {\n";
+            fs << "  public:\n";
+            fs << fastring(' ', 4) << "explicit " << serv << "Client(rpc::Client& c) : _c(c) {}\n\n";
+            for (size_t i = 0; i < methods.size(); ++i) {
+                const Method& m = methods[i];
+                if (m.req.empty()) continue;
+                fs << fastring(' ', 4) << "// return rpc::kOk on success, see rpc::Client::call()\n"
+                   << fastring(' ', 4) << "int " << m.name << "(const " << m.req << "& req, "
+                   << m.res << "& res) {\n"
+                   << fastring(' ', 8) << "return _c.call(" << serv << "::" << method_id_name(m.name)
+                   << ", req, res);\n"
+                   << fastring(' ', 4) << "}\n\n";
+            }
+            fs << "  private:\n";
+            fs << "    rpc::Client& _c;\n";
+            fs << "};\n";
+        }
+    }
 
     if (!pkgs.empty()) fs << '\n';
 
@@ -88,10 +274,89 @@ void gen_cpp(
 // todo: support golang
 void gen_go(
     const fastring& gen_file, const fastring& pkg, const fastring& serv, 
-    const co::vector<fastring>& methods
+    const co::vector<Method>& methods, const co::vector<Object>& objects
 ) {
 }
 
+inline bool is_name(const fastring& s) {
+    if (s.empty() || ('0' <= s[0] && s[0] <= '9')) return false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        const char c = s[i];
+        if (!(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline const Object* find_object(const co::vector<Object>& objects, const fastring& name) {
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (objects[i].name == name) return &objects[i];
+    }
+    return 0;
+}
+
+// "type name" or "[]type name", objects used MUST be defined before
+void parse_field(const fastring& x, const co::vector<Object>& objects, Object& o) {
+    auto v = str::split(x, ' ');
+    co::vector<fastring> w;
+    for (size_t i = 0; i < v.size(); ++i) {
+        auto s = str::strip(v[i], " \t");
+        if (!s.empty()) w.push_back(s);
+    }
+    if (w.size() != 2) {
+        COUT << "invalid field in object " << o.name << ": " << x;
+        exit(-1);
+    }
+
+    Field f;
+    f.array = w[0].starts_with("[]");
+    f.type = f.array ? w[0].substr(2) : w[0];
+    f.name = w[1];
+    if (!is_name(f.name)) {
+        COUT << "invalid field name in object " << o.name << ": " << f.name;
+        exit(-1);
+    }
+    if (!cpp_type(f.type) && !find_object(objects, f.type)) {
+        COUT << "unknown type " << f.type << " in object " << o.name
+             << ", objects MUST be defined before they are used";
+        exit(-1);
+    }
+    for (size_t i = 0; i < o.fields.size(); ++i) {
+        if (o.fields[i].name == f.name) {
+            COUT << "duplicate field " << f.name << " in object " << o.name;
+            exit(-1);
+        }
+    }
+    o.fields.push_back(f);
+}
+
+// "name" or "name(Req) Res"
+void parse_method(const fastring& x, const co::vector<Object>& objects, co::vector<Method>& methods) {
+    Method m;
+    m.id = 0;
+    const size_t p = x.find('(');
+    m.name = str::strip(x.substr(0, p), " \t"); // the whole line if there is no '('
+    if (p != x.npos) {
+        const size_t q = x.find(')', p);
+        if (q == x.npos) {
+            COUT << "invalid method: " << x;
+            exit(-1);
+        }
+        m.req = str::strip(x.substr(p + 1, q - p - 1), " \t");
+        m.res = str::strip(x.substr(q + 1), " \t");
+        if (!find_object(objects, m.req) || !find_object(objects, m.res)) {
+            COUT << "request and response of method " << m.name << " MUST be objects defined before";
+            exit(-1);
+        }
+    }
+    if (!is_name(m.name)) {
+        COUT << "invalid method name: " << m.name;
+        exit(-1);
+    }
+    methods.push_back(m);
+}
+
 void parse(const char* path) {
     fs::file f;
     if (!f.open(path, 'r')) {
@@ -112,7 +377,8 @@ void parse(const char* path) {
     fastring gen_file(fastring(b, e - b) + ".h");
     fastring pkg;
     fastring serv;
-    co::vector<fastring> methods;
+    co::vector<Method> methods;
+    co::vector<Object> objects;
 
     auto s = f.read(fs::fsize(path));
     char c = '\n';
@@ -138,6 +404,35 @@ void parse(const char* path) {
             continue;
         }
 
+        if (x.starts_with("object ")) {
+            const char* p = strstr(x.c_str(), "//");
+            if (p) x.resize(p - x.data());
+            Object o;
+            o.name = str::strip(fastring(x.c_str() + 7), " \t\r\n{");
+            if (!is_name(o.name) || find_object(objects, o.name) || cpp_type(o.name)) {
+                COUT << "invalid or duplicate object name: " << o.name;
+                exit(-1);
+            }
+
+            size_t k = i + 1;
+            for (; k < l.size(); ++k) {
+                const char* p = strstr(l[k].c_str(), "//");
+                if (p) l[k].resize(p - l[k].data());
+                const bool end = l[k].find('}') != l[k].npos;
+                auto m = str::strip(l[k], " \t\r\n,;{}");
+                if (!m.empty()) parse_field(m, objects, o);
+                if (end) break;
+            }
+            if (k == l.size()) {
+                COUT << "ending '}' not found for object: " << o.name;
+                exit(-1);
+            }
+
+            objects.push_back(o);
+            i = k;
+            continue;
+        }
+
         if (x.starts_with("service ")) {
             if (!serv.empty()) {
                 COUT << "find multiple service in file: " << path;
@@ -149,32 +444,51 @@ void parse(const char* path) {
             serv = x.c_str() + 8;
             serv = str::strip(serv, " \t\r\n{");
 
-            for (size_t k = i + 1; k < l.size(); ++k) {
+            size_t k = i + 1;
+            for (; k < l.size(); ++k) {
                 const char* p = strstr(l[k].c_str(), "//");
                 if (p) l[k].resize(p - l[k].data());
-
-                if (l[k].find('}') != l[k].npos) {
-                    auto m = str::strip(l[k], " \t\r\n,;{}");
-                    if (!m.empty()) methods.push_back(m);
-                    if (methods.empty()) {
-                        COUT << "no method found in service: " << serv;
-                        exit(-1);
-                    }
-
-                    if (!FLG_cpp && !FLG_go) FLG_cpp = true; // gen cpp by default
-                    if (FLG_cpp) gen_cpp(gen_file, pkg, serv, methods);
-                    if (FLG_go) gen_go(gen_file, pkg, serv, methods);
-                    return;
-                } else {
-                    auto m = str::strip(l[k], " \t\r\n,;{");
-                    if (!m.empty()) methods.push_back(m);
-                }
+                const bool end = l[k].find('}') != l[k].npos;
+                auto m = str::strip(l[k], " \t\r\n,;{}");
+                if (!m.empty()) parse_method(m, objects, methods);
+                if (end) break;
+            }
+            if (k == l.size()) {
+                COUT << "ending '}' not found for service: " << serv;
+                exit(-1);
+            }
+            if (methods.empty()) {
+                COUT << "no method found in service: " << serv;
+                exit(-1);
             }
 
-            COUT << "ending '}' not found for service: " << serv;
-            exit(-1);
+            i = k;
+            continue;
+        }
+    }
+
+    if (serv.empty() && objects.empty()) {
+        COUT << "no service or object found in file: " << path;
+        exit(-1);
+    }
+
+    // ids of methods: hash of "pkg.serv.method", they MUST be unique
+    for (size_t i = 0; i < methods.size(); ++i) {
+        fastring n(pkg);
+        if (!n.empty()) n.append('.');
+        n << serv << '.' << methods[i].name;
+        methods[i].id = hash32(n);
+        for (size_t k = 0; k < i; ++k) {
+            if (methods[k].name == methods[i].name || methods[k].id == methods[i].id) {
+                COUT << "duplicate method or method id: " << methods[i].name;
+                exit(-1);
+            }
         }
     }
+
+    if (!FLG_cpp && !FLG_go) FLG_cpp = true; // gen cpp by default
+    if (FLG_cpp) gen_cpp(gen_file, pkg, serv, methods, objects);
+    if (FLG_go) gen_go(gen_file, pkg, serv, methods, objects);
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "def.h"
+
+namespace http { class Router; }
+
+// handlers for live introspection of a running process, like pprof of golang.
+//   - They are opt-in, a program adds them to its own router, or starts them
+//     on a separate admin port with admin::start(), so that they are not
+//     exposed with the public service.
+//   - Every page is plain text, cheap enough to be always on:
+//       /debug/              index of the pages
+//       /debug/sched         coroutines and stats of each scheduler
+//       /debug/mem           stats of co::alloc()
+//       /debug/heap?n=16     co::heap_profile(), ?format=pprof for pprof
+//       /debug/profile?n=16  co::profile_report(), ?reset=1 to clear it
+//       /debug/trace?ms=100  trace coroutines for ms, as chrome trace json
+//       /debug/metrics       metrics in the Prometheus text format
+//       /debug/flags         current values of flags
+//       /debug/flags/<name>  POST the new value of a mutable flag as the body
+//   - The heap profile requires mem_profile_rate > 0, and the cpu profile
+//     requires co_profile = true, or they are empty.
+//
+//   admin::start("127.0.0.1", 6060);
+//   curl 127.0.0.1:6060/debug/sched
+namespace admin {
+
+// add the handlers to @r, with paths under @prefix, e.g. "/debug/sched"
+__coapi void add_handlers(http::Router& r, const char* prefix="/debug");
+
+/**
+ * start a http server serving only the handlers
+ *   - It will not block the calling thread, and the server is never stopped.
+ *   - It listens on 127.0.0.1 by default, expose it with care.
+ */
+__coapi void start(const char* ip="127.0.0.1", int port=6060);
+
+} // admin
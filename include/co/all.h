@@ -11,19 +11,26 @@
 #include "fast.h"
 #include "fastring.h"
 #include "fastream.h"
+#include "iobuf.h"
 #include "str.h"
 #include "stl.h"
+#include "flat_hash_map.h"
 #include "cout.h"
 #include "flag.h"
 #include "log.h"
 #include "json.h"
+#include "json_fields.h"
+#include "json_lines.h"
 #include "co.h"
 #include "so.h"
 #include "fs.h"
 #include "os.h"
+#include "prefork.h"
+#include "tracing.h"
 #include "hash.h"
 #include "path.h"
 #include "lru_map.h"
+#include "concurrent_lru.h"
 #include "random.h"
 #include "time.h"
 #include "thread.h"
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "def.h"
+#include "mem.h"
+
+namespace co {
+
+/**
+ * bump-pointer arena for request-scoped objects
+ *   - alloc() takes memory from the current chunk, and a new chunk is added when
+ *     it is used up. Memory can't be freed one by one, but all at once by reset()
+ *     or the destructor.
+ *   - reset() keeps one chunk for the next round, other chunks are cached in
+ *     the current thread and reused by arenas with the same chunk size.
+ *   - Destructors of objects created by make() are NOT called.
+ *   - It is not thread-safe.
+ */
+class __coapi Arena {
+  public:
+    explicit Arena(uint32 chunk_size=4096);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    void operator=(const Arena&) = delete;
+
+    // @align MUST be power of 2
+    void* alloc(size_t n, size_t align=sizeof(void*)) {
+        char* const p = (char*)(((size_t)_p + align - 1) & ~(align - 1));
+        if (p + n <= _e) { _p = p + n; return p; }
+        return this->_grow(n, align);
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        return new (this->alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // free all memory allocated from this arena, one chunk is kept
+    void reset();
+
+    // bytes allocated from this arena since the last reset
+    size_t size() const { return _size + (_p - _b); }
+
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+
+  private:
+    void* _grow(size_t n, size_t align);
+    void _release(Chunk* c);
+
+    Chunk* _c;
+    char* _b;
+    char* _p;
+    char* _e;
+    size_t _size;
+    uint32 _chunk_size;
+};
+
+// allocator for STL containers, memory is freed by the arena only
+//   - co::Arena a;
+//   - std::vector<int, co::arena_allocator<int>> v(co::arena_allocator<int>(a));
+template <class T>
+struct arena_allocator {
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    arena_allocator(Arena& a) noexcept : arena(&a) {}
+    arena_allocator(const arena_allocator&) noexcept = default;
+    template<class U> arena_allocator(const arena_allocator<U>& x) noexcept : arena(x.arena) {}
+
+    T* allocate(size_type n) {
+        return static_cast<T*>(arena->alloc(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_type) noexcept {}
+
+    template <class U> struct rebind { using other = arena_allocator<U>; };
+
+    Arena* arena;
+};
+
+template<class T1, class T2>
+inline bool operator==(const arena_allocator<T1>& a, const arena_allocator<T2>& b) noexcept {
+    return a.arena == b.arena;
+}
+
+template<class T1, class T2>
+inline bool operator!=(const arena_allocator<T1>& a, const arena_allocator<T2>& b) noexcept {
+    return a.arena != b.arena;
+}
+
+} // co
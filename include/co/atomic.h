@@ -114,6 +114,10 @@ inline T atomic_fetch_xor(T* p, V v, memory_order_t mo = mo_seq_cst) {
     return ((std::atomic<T>*)p)->fetch_xor((T)v, mo);
 }
 
+inline void atomic_fence(memory_order_t mo = mo_seq_cst) {
+    std::atomic_thread_fence(mo);
+}
+
 #else /* gcc/clang */
 
 //     |
@@ -230,6 +234,10 @@ inline T atomic_fetch_xor(T* p, V v, memory_order_t mo = mo_seq_cst) {
     return __atomic_fetch_xor(p, v, mo);
 }
 
+inline void atomic_fence(memory_order_t mo = mo_seq_cst) {
+    __atomic_thread_fence(mo);
+}
+
 #endif
 
 // the same as atomic_compare_swap
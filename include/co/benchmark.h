@@ -0,0 +1,147 @@
+#pragma once
+
+#include "flag.h"
+#include "fastring.h"
+#include "stl.h"
+
+// co/benchmark is a micro benchmark framework, the counterpart of co/unitest.
+//   - Each benchmark is run with an iteration count calibrated to last
+//     -bench_min_ms, after a warmup, -bench_runs times. The median, mean,
+//     min, max and stddev of ns per iteration are reported.
+//   - DEF_bench_threads() runs the body in n threads and DEF_bench_co() in n
+//     coroutines spread over the schedulers, all of them start together.
+//   - Results can be printed as text, json or csv (-bench_format), saved to a
+//     file (-bench_out) and compared with a saved baseline (-bench_baseline).
+//
+//   DEF_bench(fastring_append) {
+//       for (uint64 i = 0; i < bench.n; ++i) {
+//           fastring s;
+//           s.append("hello");
+//           bench::do_not_optimize(s);
+//       }
+//   }
+//
+//   int main(int argc, char** argv) {
+//       flag::init(argc, argv);
+//       return bench::run_all_benchmarks();
+//   }
+
+namespace bench {
+
+// state of a benchmark in a thread or coroutine
+class __coapi State {
+  public:
+    State(uint64 n, uint32 index, uint32 count)
+        : n(n), index(index), count(count), _bytes(0), _paused_ns(0), _pause_beg(0) {}
+
+    // exclude the time between pause() and resume(), e.g. for setup
+    void pause();
+    void resume();
+
+    // bytes processed in each iteration, bytes/s is reported if set
+    void set_bytes(uint64 n) { _bytes = n; }
+
+    uint64 bytes() const { return _bytes; }
+    int64 paused_ns() const { return _paused_ns; }
+
+    const uint64 n;      // iterations to run
+    const uint32 index;  // index of this thread or coroutine
+    const uint32 count;  // number of threads or coroutines
+
+  private:
+    uint64 _bytes;
+    int64 _paused_ns;
+    int64 _pause_beg;
+};
+
+typedef void (*bench_fn_t)(State&);
+
+struct __coapi Bench {
+    // @threads: run in @threads threads if > 0
+    // @coroutines: run in @coroutines coroutines if > 0
+    Bench(const char* name, bench_fn_t f, uint32 threads, uint32 coroutines);
+
+    const char* name;
+    bench_fn_t f;
+    uint32 threads;
+    uint32 coroutines;
+};
+
+struct Result {
+    fastring name;
+    uint32 threads;    // threads or coroutines running it, 1 for a plain one
+    bool co;           // run in coroutines
+    uint64 n;          // iterations of each run
+    uint32 runs;
+    double median;     // ns per iteration
+    double mean;
+    double min;
+    double max;
+    double stddev;
+    double ops;        // iterations per second in all threads, from median
+    double bytes;      // bytes per second, 0 if not set
+    double baseline;   // median of the baseline, 0 if not found
+};
+
+// run the benchmark named @name, false if not found
+__coapi bool run(const char* name, Result& r);
+
+/**
+ * run benchmarks matched by -bench, all of them by default
+ *
+ * @return  number of benchmarks slower than the baseline by more than
+ *          -bench_threshold percent, 0 if there is no baseline
+ */
+__coapi int run_all_benchmarks();
+
+// results as a json array, the format of -bench_out and -bench_baseline
+__coapi fastring to_json(const co::vector<Result>& v);
+
+__coapi fastring to_csv(const co::vector<Result>& v);
+
+// an opaque call for compilers without inline asm
+__coapi void _escape(const void* p);
+
+// prevent the compiler from optimizing out the computation of @v
+template <typename T>
+inline void do_not_optimize(T& v) {
+  #if defined(__GNUC__)
+    __asm__ __volatile__("" : "+m"(v) : : "memory");
+  #else
+    _escape(&v);
+  #endif
+}
+
+template <typename T>
+inline void do_not_optimize(const T& v) {
+  #if defined(__GNUC__)
+    __asm__ __volatile__("" : : "m"(v) : "memory");
+  #else
+    _escape(&v);
+  #endif
+}
+
+// a compiler barrier, memory written before it is regarded as read
+inline void clobber() {
+  #if defined(__GNUC__)
+    __asm__ __volatile__("" : : : "memory");
+  #else
+    _escape(0);
+  #endif
+}
+
+} // bench
+
+#define _CO_DEF_BENCH(_name_, _threads_, _co_) \
+    static void _Bench_##_name_(bench::State& bench); \
+    static bench::Bench _Bench_sav_##_name_(#_name_, &_Bench_##_name_, _threads_, _co_); \
+    static void _Bench_##_name_(bench::State& bench)
+
+// define a benchmark, the body runs bench.n iterations of the work
+#define DEF_bench(_name_) _CO_DEF_BENCH(_name_, 0, 0)
+
+// the body runs in @n threads at the same time, each does bench.n iterations
+#define DEF_bench_threads(_name_, n) _CO_DEF_BENCH(_name_, n, 0)
+
+// the body runs in @n coroutines at the same time, each does bench.n iterations
+#define DEF_bench_co(_name_, n) _CO_DEF_BENCH(_name_, 0, n)
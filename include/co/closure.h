@@ -18,6 +18,34 @@ class __coapi Closure {
 
 namespace xx {
 
+// closures not larger than this are allocated from a cache of blocks in each
+// thread, as go() creates one for every coroutine, larger ones use co::alloc()
+static const size_t closure_block_size = 64;
+
+__coapi void* alloc_closure_block();
+__coapi void free_closure_block(void* p);
+
+template<typename T>
+struct closure_in_block {
+    enum { value = sizeof(T) <= closure_block_size && alignof(T) <= 16 };
+};
+
+template<typename T, typename... Args>
+inline T* make_closure(Args&&... args) {
+    void* p = closure_in_block<T>::value ? alloc_closure_block() : co::alloc(sizeof(T));
+    return new (p) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+inline void del_closure(T* p) {
+    p->~T();
+    if (closure_in_block<T>::value) {
+        free_closure_block((void*)p);
+    } else {
+        co::free((void*)p, sizeof(T));
+    }
+}
+
 template<typename F>
 class Function0 : public Closure {
   public:
@@ -26,7 +54,7 @@ class Function0 : public Closure {
 
     virtual void run() {
         _f();
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -41,7 +69,7 @@ class Function0p : public Closure {
 
     virtual void run() {
         (*_f)();
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -56,7 +84,7 @@ class Function1 : public Closure {
 
     virtual void run() {
         _f(_p);
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -72,7 +100,7 @@ class Function1p : public Closure {
 
     virtual void run() {
         (*_f)(_p);
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -90,7 +118,7 @@ class Method0 : public Closure {
 
     virtual void run() {
         (_o->*_f)();
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -109,7 +137,7 @@ class Method1 : public Closure {
 
     virtual void run() {
         (_o->*_f)(_p);
-        co::del(this);
+        xx::del_closure(this);
     }
 
   private:
@@ -125,7 +153,7 @@ class Method1 : public Closure {
  */
 template<typename F>
 inline Closure* new_closure(F&& f) {
-    return co::make<xx::Function0<F>>(std::forward<F>(f));
+    return xx::make_closure<xx::Function0<F>>(std::forward<F>(f));
 }
 
 /**
@@ -133,7 +161,7 @@ inline Closure* new_closure(F&& f) {
  */
 template<typename F>
 inline Closure* new_closure(F* f) {
-    return co::make<xx::Function0p<F>>(f);
+    return xx::make_closure<xx::Function0p<F>>(f);
 }
 
 /**
@@ -144,7 +172,7 @@ inline Closure* new_closure(F* f) {
  */
 template<typename F, typename P>
 inline Closure* new_closure(F&& f, P&& p) {
-    return co::make<xx::Function1<F, P>>(std::forward<F>(f), std::forward<P>(p));
+    return xx::make_closure<xx::Function1<F, P>>(std::forward<F>(f), std::forward<P>(p));
 }
 
 /**
@@ -155,7 +183,7 @@ inline Closure* new_closure(F&& f, P&& p) {
  */
 template<typename F, typename P>
 inline Closure* new_closure(F* f, P&& p) {
-    return co::make<xx::Function1p<F, P>>(f, std::forward<P>(p));
+    return xx::make_closure<xx::Function1p<F, P>>(f, std::forward<P>(p));
 }
 
 /**
@@ -166,7 +194,7 @@ inline Closure* new_closure(F* f, P&& p) {
  */
 template<typename T>
 inline Closure* new_closure(void (T::*f)(), T* o) {
-    return co::make<xx::Method0<T>>(f, o);
+    return xx::make_closure<xx::Method0<T>>(f, o);
 }
 
 /**
@@ -181,7 +209,7 @@ inline Closure* new_closure(void (T::*f)(), T* o) {
  */
 template<typename F, typename T, typename P>
 inline Closure* new_closure(F&& f, T* o, P&& p) {
-    return co::make<xx::Method1<F, T, P>>(std::forward<F>(f), o, std::forward<P>(p));
+    return xx::make_closure<xx::Method1<F, T, P>>(std::forward<F>(f), o, std::forward<P>(p));
 }
 
 } // co
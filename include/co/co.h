@@ -8,10 +8,15 @@
 #include "./co/sock.h"
 #include "./co/event.h"
 #include "./co/mutex.h"
+#include "./co/cond_var.h"
+#include "./co/semaphore.h"
 #include "./co/pool.h"
 #include "./co/chan.h"
+#include "./co/ring_chan.h"
 #include "./co/io_event.h"
 #include "./co/wait_group.h"
+#include "./co/task_group.h"
+#include "./co/future.h"
 
 namespace co {
 
@@ -23,6 +28,8 @@ namespace co {
  *   - Closure is an abstract base class, users are free to implement their own 
  *     subtype of Closure. This may be useful if users do not want a Closure to 
  *     delete itself. See details in co/closure.h.
+ *   - If co_steal is true, the task may be stolen by an idle scheduler before it 
+ *     starts. Use Scheduler::go() if it MUST run in a specified scheduler.
  * 
  * @param cb  a pointer to a Closure created by new_closure(), or an user-defined Closure.
  */
@@ -85,6 +92,57 @@ inline void go(F&& f, T* t, P&& p) {
     go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
 }
 
+/**
+ * add a batch of tasks, which will run as coroutines 
+ *   - The tasks are distributed to all schedulers, with one lock (or one atomic 
+ *     operation) and one wakeup for each scheduler. 
+ *   - It is much cheaper than calling go() n times, when n is large.
+ * 
+ * @param cbs  an array of Closures created by new_closure(), or user-defined Closures.
+ * @param n    number of Closures in the array.
+ */
+__coapi void go_batch(Closure** cbs, size_t n);
+
+inline void go_batch(const co::vector<Closure*>& cbs) {
+    go_batch((Closure**)cbs.data(), cbs.size());
+}
+
+/**
+ * priority of coroutines 
+ *   - In each round of a scheduler, new and ready coroutines with a higher 
+ *     priority are resumed first. 
+ *   - All coroutines that are ready in a round will be resumed in that round, 
+ *     so coroutines of lower priority will not starve. 
+ */
+enum prio_t {
+    prio_normal = 0,
+    prio_high = 1,
+    prio_low = 2,
+};
+
+/**
+ * add a task with a priority, which will run as a coroutine 
+ *   - eg.
+ *     go(co::prio_high, f);      // void f();
+ *     go(co::prio_high, f, 8);   // void f(int);
+ * 
+ *   - The coroutine keeps the priority until it ends.
+ * 
+ * @param prio  priority of the coroutine.
+ * @param cb    a pointer to a Closure created by new_closure(), or an user-defined Closure.
+ */
+__coapi void go(prio_t prio, Closure* cb);
+
+template<typename F>
+inline void go(prio_t prio, F&& f) {
+    go(prio, new_closure(std::forward<F>(f)));
+}
+
+template<typename F, typename P>
+inline void go(prio_t prio, F&& f, P&& p) {
+    go(prio, new_closure(std::forward<F>(f), std::forward<P>(p)));
+}
+
 /**
  * define main function
  *   - DEF_main can be used to ensure code in main function also runs in coroutine. 
@@ -106,8 +164,42 @@ int main(int argc, char** argv) { \
 int _co_main(int argc, char** argv)
 
 
+/**
+ * statistics of a scheduler
+ *   - Counters are updated by the scheduler thread without any lock, they may be 
+ *     a little out of date when read from other threads. 
+ */
+struct sched_stats_t {
+    uint64 resumes;        // number of coroutine resumes
+    uint64 stack_saves;    // number of times a shared stack was saved
+    uint64 bytes_copied;   // bytes copied for saving and restoring shared stacks
+    uint64 max_stack_size; // max size of the saved stack of a coroutine
+    uint64 idle_us;        // time in microseconds spent waiting in epoll
+    uint64 stalls;         // times the scheduler was found blocked by a coroutine, see co_stall_ms
+    uint64 preempts;       // times a coroutine yielded at co::preempt_point(), see co_preempt_ms
+    uint64 pool_bytes;     // bytes of stack memory held by pooled coroutines
+    uint64 coroutines;     // coroutines alive, running or waiting
+    uint64 pooled;         // coroutines terminated and kept in the pool for reuse
+    uint64 queued;         // tasks (new and ready coroutines) run in the last round, the queue depth
+};
+
+// statistics of the thread pool used by co::offload()
+struct offload_stats_t {
+    uint32 threads;        // number of threads in the pool
+    uint32 idle;           // number of idle threads
+    uint64 queued;         // number of tasks waiting in the queue
+    uint64 max_queued;     // max number of tasks ever waiting in the queue
+    uint64 tasks;          // number of tasks done
+    uint64 wait_us;        // total time in microseconds tasks waited in the queue
+    uint64 run_us;         // total time in microseconds spent running tasks
+    uint64 max_wait_us;    // max time a task waited in the queue
+};
+
+class Histogram;
+
 class __coapi Scheduler {
   public:
+    // tasks added by Scheduler::go() always run in this scheduler.
     void go(Closure* cb);
 
     template<typename F>
@@ -125,6 +217,36 @@ class __coapi Scheduler {
         this->go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
     }
 
+    // add n tasks to this scheduler, with one lock and one wakeup
+    void go_n(Closure** cbs, size_t n);
+
+    void go_n(const co::vector<Closure*>& cbs) {
+        this->go_n((Closure**)cbs.data(), cbs.size());
+    }
+
+    // add a task with a priority to this scheduler
+    void go(prio_t prio, Closure* cb);
+
+    template<typename F>
+    inline void go(prio_t prio, F&& f) {
+        this->go(prio, new_closure(std::forward<F>(f)));
+    }
+
+    template<typename F, typename P>
+    inline void go(prio_t prio, F&& f, P&& p) {
+        this->go(prio, new_closure(std::forward<F>(f), std::forward<P>(p)));
+    }
+
+    // get a snapshot of statistics of this scheduler
+    sched_stats_t stats() const;
+
+    // time in microseconds each round of the scheduler spent running tasks,
+    // the time waiting for events excluded
+    const Histogram& loop_histogram() const;
+
+    // the cpu this scheduler is bound to, see co_sched_cpus, -1 if not bound
+    int cpu() const;
+
   protected:
     Scheduler() = default;
     ~Scheduler() = default;
@@ -132,6 +254,9 @@ class __coapi Scheduler {
 
 /**
  * get all schedulers 
+ *   - If co_sched_min is set, only that many of them run at first, and more 
+ *     are started under sustained load. A scheduler not started yet is started 
+ *     when tasks are added to it by Scheduler::go(). 
  *   
  * @return  a reference of an array, which stores pointers to all the Schedulers
  */
@@ -156,6 +281,24 @@ __coapi Scheduler* scheduler();
  */
 __coapi Scheduler* next_scheduler();
 
+/**
+ * policies of choosing a scheduler for new tasks 
+ *   - go() and next_scheduler() use the policy set by co_sched_policy, round 
+ *     robin by default. It may also be chosen for a call site with 
+ *     next_scheduler(p), or for a tcp::Server with sched_policy(). 
+ *   - The load of a scheduler is read without a lock, tasks added in a burst 
+ *     are counted as soon as they are added, before they start to run. 
+ */
+enum sched_policy_t : int {
+    sched_round_robin = 0,      // in turn, the cheapest one
+    sched_least_queued = 1,     // the one with the least tasks waiting to run, for short tasks
+    sched_least_coroutines = 2, // the one with the least coroutines alive, for long connections
+    sched_two_choices = 3,      // the one with less coroutines alive of two random ones
+};
+
+// get next scheduler chosen by the policy @p
+__coapi Scheduler* next_scheduler(sched_policy_t p);
+
 /**
  * get number of schedulers 
  *   - scheduler id is from 0 to scheduler_num() - 1. 
@@ -187,6 +330,54 @@ __coapi int scheduler_id();
  */
 __coapi int coroutine_id();
 
+/**
+ * get a monotonic timestamp in milliseconds 
+ *   - In a scheduler thread, it returns the time cached by the scheduler, which 
+ *     is refreshed once in each round, and it is much cheaper than now::ms(). 
+ *     Timers of coroutines also use this time. 
+ *   - If co_precise_timer is true, or it is called from a non-scheduler thread, 
+ *     it is the same as now::ms().
+ */
+__coapi int64 now_ms();
+
+/**
+ * get a report of cpu time consumed by coroutines
+ *   - co_profile MUST be true, or the report will be empty.
+ *   - Coroutines are grouped by type of their entry Closure, the n entries that
+ *     cost the most cpu time are reported.
+ *   - If co_profile_stack_us > 0, stack of a coroutine is captured when it runs
+ *     longer than that without yielding, the most frequent one is reported.
+ *   - If co_profile_signal > 0, the report will be written to log on that signal.
+ *
+ * @param n  max number of entries in the report.
+ */
+__coapi fastring profile_report(int n = 16);
+
+// clear profile data of all schedulers
+__coapi void profile_reset();
+
+/**
+ * trace events of coroutines in all schedulers
+ *   - Runs of coroutines, what they waited for (IO or timers), when they were
+ *     made ready and by whom, and idle time of schedulers are recorded with
+ *     timestamps of now::fast_ns().
+ *   - Each scheduler keeps the last co_trace_events events in a ring buffer,
+ *     the cost is an atomic increment and a few stores for each event, and a
+ *     branch when tracing is off.
+ *   - trace_dump() returns the events in the Chrome trace json format, which
+ *     can be opened by chrome://tracing or https://ui.perfetto.dev. Call it
+ *     after trace_stop(), or events being written may be mixed in.
+ *
+ *   co::trace_start();
+ *   run_workload();
+ *   co::trace_stop();
+ *   fs::file f("co.trace.json", 'w');
+ *   f.write(co::trace_dump());
+ */
+__coapi void trace_start();
+__coapi void trace_stop();
+__coapi fastring trace_dump();
+
 /**
  * add a timer for the current coroutine 
  *   - It MUST be called in a coroutine.
@@ -231,6 +422,24 @@ __coapi void del_io_event(sock_t fd);
  */
 __coapi void yield();
 
+/**
+ * a point where the current coroutine may be preempted 
+ *   - If co_preempt_ms > 0, the watchdog thread asks a coroutine running longer 
+ *     than that without yielding to yield. The coroutine yields at its next call 
+ *     of preempt_point(), and it will be resumed in the next round of the scheduler, 
+ *     after other ready coroutines. 
+ *   - It is cheap enough to call in hot loops, a load and a compare if not asked 
+ *     to yield. It does nothing out of coroutines. 
+ *   - NOTE: do not call it while holding a lock that other coroutines in the same 
+ *     scheduler may wait for, e.g. a std::mutex, or a per-thread state in use. 
+ *   - eg. 
+ *     for (size_t i = 0; i < n; ++i) { 
+ *         compute(v[i]); 
+ *         co::preempt_point(); 
+ *     } 
+ */
+__coapi void preempt_point();
+
 /**
  * sleep for milliseconds 
  *   - It is EXPECTED to be called in a coroutine. 
@@ -239,6 +448,31 @@ __coapi void yield();
  */
 __coapi void sleep(uint32 ms);
 
+/**
+ * run a blocking call in a thread pool 
+ *   - Blocking calls like file IO, getaddrinfo or compression block the whole 
+ *     scheduler thread. In a coroutine, offload() runs @cb in a thread of a pool, 
+ *     and suspends the current coroutine until it is done, so that other 
+ *     coroutines can go on in the mean time. 
+ *   - Threads are created on demand, up to co_offload_threads, and exit after 
+ *     idle for co_offload_idle_ms. 
+ *   - If it is called from a non-scheduler thread, @cb just runs in place. 
+ *   - NOTE: @cb runs while other coroutines may be running on the shared stack of 
+ *     the caller when co_dedicated_stack is false, it MUST NOT access variables on 
+ *     the stack of the caller then. 
+ *   - eg. 
+ *     co::offload([&]() { n = f.read(buf, sizeof(buf)); }); // n, f, buf not on the stack
+ */
+__coapi void offload(Closure* cb);
+
+template<typename F>
+inline void offload(F&& f) {
+    co::offload(new_closure(std::forward<F>(f)));
+}
+
+// get a snapshot of statistics of the thread pool used by co::offload()
+__coapi offload_stats_t offload_stats();
+
 /**
  * check whether the current coroutine has timed out 
  *   - It MUST be called in a coroutine.
@@ -255,6 +489,56 @@ __coapi bool timeout();
  */
 __coapi bool on_stack(const void* p);
 
+/**
+ * move the current coroutine to another scheduler 
+ *   - It MUST be called in a coroutine. The coroutine is suspended, and then 
+ *     resumed in the scheduler @s. 
+ *   - Only coroutines on dedicated stacks (co_dedicated_stack is true) can be 
+ *     moved. A shared stack belongs to a scheduler, and data saved from it can 
+ *     not be restored at another address. Tasks of co::TaskGroup can't be moved. 
+ *   - The coroutine gets a new id in the target scheduler. 
+ *   - Do not keep pointers to thread_local data across this call, the coroutine 
+ *     runs in another thread after it returns. 
+ * 
+ * @param s  the target scheduler.
+ * 
+ * @return   true on success, false if the coroutine runs on a shared stack, 
+ *           or it is a task of co::TaskGroup.
+ */
+__coapi bool migrate(Scheduler* s);
+
+/**
+ * create a key for coroutine-local storage 
+ *   - Each coroutine has its own value for a key, NULL by default. 
+ *   - When a coroutine ends, the destructor is called with the non-null value in 
+ *     the scheduler thread. It MUST NOT block or yield. 
+ *   - At most 32 keys can be created, they are usually created once at startup. 
+ *   - eg.
+ *     static int k = co::cls_key([](void* p) { delete (Trace*)p; });
+ *     co::cls_set(k, new Trace(...));
+ *     auto t = (Trace*) co::cls_get(k);
+ * 
+ * @param destructor  called with the value when the coroutine ends, may be NULL.
+ * 
+ * @return            a key for co::cls_get() and co::cls_set().
+ */
+__coapi int cls_key(void (*destructor)(void*));
+
+/**
+ * get the value of a key for the current coroutine 
+ *   - It MUST be called in a coroutine. 
+ * 
+ * @return  the value set by co::cls_set(), or NULL if not set.
+ */
+__coapi void* cls_get(int key);
+
+/**
+ * set the value of a key for the current coroutine 
+ *   - It MUST be called in a coroutine. 
+ *   - The old value, if any, is not destroyed. 
+ */
+__coapi void cls_set(int key, void* value);
+
 } // namespace co
 
 using co::go;
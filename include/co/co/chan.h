@@ -2,10 +2,20 @@
 
 #include "../def.h"
 #include "../atomic.h"
+#include <initializer_list>
 
 namespace co {
 namespace xx {
 
+class Pipe;
+
+// a read or write operation on a pipe, used by co::select()
+struct select_case {
+    const Pipe* p;
+    void* buf;
+    bool write;
+};
+
 class __coapi Pipe {
   public:
     Pipe(uint32 buf_size, uint32 blk_size, uint32 ms);
@@ -27,6 +37,15 @@ class __coapi Pipe {
 
     // write a block
     void write(const void* p) const;
+
+    // read at least 1 and at most n blocks, return number of blocks read
+    uint32 read_n(void* p, uint32 n) const;
+
+    // write n blocks, return number of blocks written
+    uint32 write_n(const void* p, uint32 n) const;
+
+    // wait for the first case to complete, return its index, or -1 on timeout
+    static int select(const select_case* c, size_t n, uint32 ms);
   
   private:
     uint32* _p;
@@ -61,8 +80,62 @@ class Chan {
         _p.read(&x);
     }
 
+    /**
+     * write n elements
+     *   - It blocks until all the elements were written, or timeout. As many 
+     *     elements as possible are moved each time the lock is held, and a 
+     *     waiting reader of read_up_to() may get more than one of them at once.
+     *
+     * @return  number of elements written, less than n on timeout.
+     */
+    uint32 write_n(const T* p, uint32 n) const {
+        return _p.write_n(p, n);
+    }
+
+    /**
+     * read at most @max elements
+     *   - It blocks until at least one element was present, or timeout, and then 
+     *     reads all the elements available, up to @max.
+     *
+     * @return  number of elements read, 0 on timeout.
+     */
+    uint32 read_up_to(T* p, uint32 max) const {
+        return _p.read_n(p, max);
+    }
+
+    // a case of co::select(), that reads an element into @x
+    xx::select_case read_case(T& x) const {
+        return xx::select_case{ &_p, (void*)&x, false };
+    }
+
+    // a case of co::select(), that writes @x into the channel
+    xx::select_case write_case(const T& x) const {
+        return xx::select_case{ &_p, (void*)&x, true };
+    }
+
   private:
     xx::Pipe _p;
 };
 
+/**
+ * wait on several channel operations, and complete the first one that is ready
+ *   - It MUST be called in coroutine.
+ *   - Cases are checked in order, if more than one are ready, the first one wins.
+ *     At most one of the operations will be done.
+ *   - The default timeout of the channels is ignored, @ms is used instead.
+ *
+ *   int v = 0;
+ *   int r = co::select({ ch1.read_case(v), ch2.read_case(v), ch3.write_case(x) }, 100);
+ *   if (r < 0) ... // timeout
+ *
+ * @param cases  cases built by Chan::read_case() or Chan::write_case().
+ * @param ms     timeout in milliseconds, -1 by default for never timed out,
+ *               if ms is 0, it returns immediately if no case is ready.
+ *
+ * @return       index of the case done, or -1 on timeout.
+ */
+inline int select(std::initializer_list<xx::select_case> cases, uint32 ms=(uint32)-1) {
+    return xx::Pipe::select(cases.begin(), cases.size(), ms);
+}
+
 } // co
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "../def.h"
+#include "../atomic.h"
+#include "../time.h"
+#include "mutex.h"
+#include <type_traits>
+
+namespace co {
+
+/**
+ * co::CondVar is a condition variable for coroutines
+ *   - It works with co::Mutex, like std::condition_variable with std::mutex.
+ *   - Waiting coroutines are suspended without a timer, unless a timeout is given.
+ *   - wait() MUST be called in a coroutine, while notify_one() and notify_all() 
+ *     can be called from anywhere.
+ */
+class __coapi CondVar {
+  public:
+    CondVar();
+    ~CondVar();
+
+    CondVar(CondVar&& c) : _p(c._p) { c._p = 0; }
+
+    // copy constructor, allow co::CondVar to be captured by value in lambda.
+    CondVar(const CondVar& c) : _p(c._p) {
+        atomic_inc(_p, mo_relaxed);
+    }
+
+    void operator=(const CondVar&) = delete;
+
+    /**
+     * wait for a notification
+     *   - @m MUST be locked by the calling coroutine. It is unlocked while waiting, 
+     *     and locked again before this method returns.
+     *   - It may return true without a notification, the caller should check the 
+     *     condition again, or use the predicate version below.
+     *
+     * @param ms  timeout in milliseconds, -1 by default for never timed out.
+     *
+     * @return    false on timeout, otherwise true.
+     */
+    bool wait(const co::Mutex& m, uint32 ms=(uint32)-1) const;
+
+    /**
+     * wait until @pred returns true
+     *   - @m MUST be locked by the calling coroutine, and @pred is called with 
+     *     @m locked.
+     *
+     * @return  the last result of pred().
+     */
+    template <typename F, typename std::enable_if<
+        !std::is_integral<typename std::remove_reference<F>::type>::value, int>::type = 0>
+    bool wait(const co::Mutex& m, F&& pred, uint32 ms=(uint32)-1) const {
+        if (ms == (uint32)-1) {
+            while (!pred()) this->wait(m);
+            return true;
+        }
+
+        const int64 deadline = now::ms() + ms;
+        while (!pred()) {
+            const int64 t = deadline - now::ms();
+            if (t <= 0 || !this->wait(m, (uint32)t)) return pred();
+        }
+        return true;
+    }
+
+    // wake up one waiting coroutine
+    void notify_one() const;
+
+    // wake up all the waiting coroutines
+    void notify_all() const;
+
+  private:
+    uint32* _p;
+};
+
+} // co
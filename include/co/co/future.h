@@ -0,0 +1,314 @@
+#pragma once
+
+#include "../def.h"
+#include "../atomic.h"
+#include "../mem.h"
+#include "../stl.h"
+#include "event.h"
+#include <assert.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace co {
+namespace xx {
+
+// a waiter parked on one or more futures, it is waken up when @count reaches 0
+struct Notifier {
+    explicit Notifier(int32 n) : refn(1), count(n) {}
+
+    void notify() {
+        if (atomic_dec(&count, mo_acq_rel) == 0) ev.signal();
+    }
+
+    void ref() { atomic_inc(&refn, mo_relaxed); }
+    void unref() { if (atomic_dec(&refn, mo_acq_rel) == 0) co::del(this); }
+
+    uint32 refn;
+    int32 count;
+    co::Event ev;
+};
+
+/**
+ * shared state of Future and Promise
+ *   - _head is the only atomic word. It is a list of notifiers before the value
+ *     was set, and READY after that. A waiter pushes its notifier with a CAS, and
+ *     the promise swaps in READY and notifies all of them.
+ *   - No event is created if nobody waits for the value before it is ready.
+ */
+template <typename T>
+class FutureState {
+  public:
+    FutureState() : _refn(1), _head(0) {}
+
+    ~FutureState() {
+        Node* h = (Node*) atomic_load(&_head, mo_acquire);
+        if (h == READY) {
+            ((T*)&_v)->~T();
+        } else {
+            this->release(h);
+        }
+    }
+
+    bool ready() const {
+        return atomic_load(&_head, mo_acquire) == READY;
+    }
+
+    T& value() { return *(T*)&_v; }
+
+    template <typename X>
+    void set(X&& x) {
+        new (&_v) T(std::forward<X>(x));
+        Node* h = (Node*) atomic_swap(&_head, READY, mo_acq_rel);
+        assert(h != READY);
+        for (Node* n = h; n; n = n->next) n->n->notify();
+        this->release(h);
+    }
+
+    // push @n to the list, return false if the value is already ready
+    bool listen(Notifier* n) {
+        Node* const x = co::make<Node>();
+        x->n = n;
+        void* h = atomic_load(&_head, mo_relaxed);
+        for (;;) {
+            if (h == READY) { co::del(x); return false; }
+            x->next = (Node*)h;
+            void* const p = atomic_cas(&_head, h, (void*)x, mo_acq_rel, mo_acquire);
+            if (p == h) break;
+            h = p;
+        }
+        n->ref();
+        return true;
+    }
+
+    uint32 ref() { return atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    struct Node {
+        Node* next;
+        Notifier* n;
+    };
+
+    void release(Node* h) {
+        while (h) {
+            Node* const x = h;
+            h = h->next;
+            x->n->unref();
+            co::del(x);
+        }
+    }
+
+    static void* const READY;
+    uint32 _refn;
+    void* _head;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _v;
+};
+
+template <typename T>
+void* const FutureState<T>::READY = (void*)(uintptr_t)1;
+
+} // xx
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+template <typename T>
+bool when_all(const Future<T>* v, size_t n, uint32 ms=(uint32)-1);
+
+template <typename T>
+int when_any(const Future<T>* v, size_t n, uint32 ms=(uint32)-1);
+
+/**
+ * co::Future is the receiving end of a result produced by a co::Promise
+ *   - It can be copied, all the copies share the same result.
+ *   - It can be used anywhere, in or out of coroutines.
+ */
+template <typename T>
+class Future {
+  public:
+    typedef xx::FutureState<T> State;
+
+    Future() : _p(0) {}
+
+    ~Future() {
+        if (_p && _p->unref() == 0) co::del(_p);
+    }
+
+    Future(Future&& f) : _p(f._p) {
+        f._p = 0;
+    }
+
+    // copy constructor, allow co::Future to be captured by value in lambda.
+    Future(const Future& f) : _p(f._p) {
+        if (_p) _p->ref();
+    }
+
+    Future& operator=(Future&& f) {
+        if (&f != this) {
+            this->~Future();
+            _p = f._p;
+            f._p = 0;
+        }
+        return *this;
+    }
+
+    Future& operator=(const Future& f) {
+        if (&f != this) {
+            this->~Future();
+            _p = f._p;
+            if (_p) _p->ref();
+        }
+        return *this;
+    }
+
+    // true if this future is bound to a promise
+    bool valid() const { return _p != 0; }
+
+    // true if the result is ready, it never blocks
+    bool ready() const { return _p->ready(); }
+
+    /**
+     * wait for the result
+     *   - It blocks until the result was ready or timeout.
+     *
+     * @param ms  timeout in milliseconds, if ms is -1, never timed out.
+     *
+     * @return    true if the result is ready, otherwise false.
+     */
+    bool wait(uint32 ms=(uint32)-1) const;
+
+    // wait for the result, and return a reference to it
+    T& get() const {
+        (void) this->wait();
+        return _p->value();
+    }
+
+    /**
+     * wait for the result with a timeout, and copy it to @x
+     *
+     * @return  true on success, false on timeout, @x is untouched then.
+     */
+    bool get(T& x, uint32 ms) const {
+        if (!this->wait(ms)) return false;
+        x = _p->value();
+        return true;
+    }
+
+  private:
+    friend class Promise<T>;
+    explicit Future(State* p) : _p(p) { _p->ref(); }
+
+    friend bool when_all<T>(const Future<T>* v, size_t n, uint32 ms);
+    friend int when_any<T>(const Future<T>* v, size_t n, uint32 ms);
+
+    State* _p;
+};
+
+/**
+ * co::Promise is the producing end of a co::Future
+ *   - It can be moved but not copied, and the value can be set only once.
+ *   - set_value() can be called from anywhere, it wakes up all the waiters of
+ *     the future.
+ */
+template <typename T>
+class Promise {
+  public:
+    typedef xx::FutureState<T> State;
+
+    Promise() : _p(co::make<State>()) {}
+
+    ~Promise() {
+        if (_p && _p->unref() == 0) co::del(_p);
+    }
+
+    Promise(Promise&& p) : _p(p._p) {
+        p._p = 0;
+    }
+
+    Promise(const Promise&) = delete;
+    void operator=(const Promise&) = delete;
+
+    // get the future bound to this promise, it can be called multiple times
+    Future<T> get_future() const { return Future<T>(_p); }
+
+    // set the result, it MUST be called only once
+    void set_value(const T& x) const { _p->set(x); }
+    void set_value(T&& x) const { _p->set(std::move(x)); }
+
+  private:
+    State* _p;
+};
+
+template <typename T>
+bool Future<T>::wait(uint32 ms) const {
+    if (_p->ready()) return true;
+    if (ms == 0) return false;
+
+    xx::Notifier* const n = co::make<xx::Notifier>(1);
+    if (_p->listen(n)) (void) n->ev.wait(ms);
+    n->unref();
+    return _p->ready();
+}
+
+/**
+ * wait for all the futures with a single park
+ *   - It blocks until all the results were ready or timeout.
+ *
+ * @return  true if all the results are ready, otherwise false.
+ */
+template <typename T>
+bool when_all(const Future<T>* v, size_t n, uint32 ms) {
+    // one more count for the caller, so that the event is not signaled before
+    // all the notifiers were pushed.
+    xx::Notifier* const x = co::make<xx::Notifier>((int32)n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (!v[i]._p->listen(x)) x->notify();
+    }
+    if (atomic_dec(&x->count, mo_acq_rel) != 0 && ms != 0) (void) x->ev.wait(ms);
+    x->unref();
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!v[i]._p->ready()) return false;
+    }
+    return true;
+}
+
+/**
+ * wait for any of the futures with a single park
+ *   - It blocks until one of the results was ready or timeout.
+ *
+ * @return  index of the first ready future, or -1 on timeout.
+ */
+template <typename T>
+int when_any(const Future<T>* v, size_t n, uint32 ms) {
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i]._p->ready()) return (int)i;
+    }
+    if (ms == 0 || n == 0) return -1;
+
+    xx::Notifier* const x = co::make<xx::Notifier>(1);
+    bool wait = true;
+    for (size_t i = 0; i < n; ++i) {
+        if (!v[i]._p->listen(x)) { wait = false; break; }
+    }
+    if (wait) (void) x->ev.wait(ms);
+    x->unref();
+
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i]._p->ready()) return (int)i;
+    }
+    return -1;
+}
+
+template <typename T>
+inline bool when_all(const co::vector<Future<T>>& v, uint32 ms=(uint32)-1) {
+    return co::when_all(v.data(), v.size(), ms);
+}
+
+template <typename T>
+inline int when_any(const co::vector<Future<T>>& v, uint32 ms=(uint32)-1) {
+    return co::when_any(v.data(), v.size(), ms);
+}
+
+} // co
@@ -73,4 +73,90 @@ class __coapi MutexGuard {
     DISALLOW_COPY_AND_ASSIGN(MutexGuard);
 };
 
+/**
+ * co::SharedMutex is a read-write lock for coroutines
+ *   - Multiple readers can hold the lock at the same time, while a writer holds 
+ *     it exclusively.
+ *   - It prefers writers. Readers wait if any writer is waiting, so that writers 
+ *     will not starve.
+ *   - Users SHOULD use co::SharedMutex in coroutine environments only.
+ */
+class __coapi SharedMutex {
+  public:
+    /**
+     * @param batch  max number of waiting readers let in when a writer unlocks 
+     *               while other writers are still waiting. If it is 0 (default), 
+     *               the waiting writers always go first.
+     */
+    explicit SharedMutex(uint32 batch=0);
+    ~SharedMutex();
+
+    SharedMutex(SharedMutex&& m) : _p(m._p) { m._p = 0; }
+
+    SharedMutex(const SharedMutex& m) : _p(m._p) {
+        atomic_inc(_p, mo_relaxed);
+    }
+
+    void operator=(const SharedMutex&) = delete;
+
+    /**
+     * acquire the lock exclusively, for writers
+     *   - It MUST be called in a coroutine.
+     */
+    void lock() const;
+
+    // release the exclusive lock
+    void unlock() const;
+
+    // try to acquire the lock exclusively, return true on success
+    bool try_lock() const;
+
+    /**
+     * acquire the lock shared with other readers
+     *   - It MUST be called in a coroutine.
+     */
+    void lock_shared() const;
+
+    // release the shared lock
+    void unlock_shared() const;
+
+    // try to acquire the shared lock, return true on success
+    bool try_lock_shared() const;
+
+  private:
+    uint32* _p;
+};
+
+// guard to acquire and release the shared lock of co::SharedMutex
+class __coapi ReadLockGuard {
+  public:
+    explicit ReadLockGuard(const co::SharedMutex& lock) : _lock(lock) {
+        _lock.lock_shared();
+    }
+
+    ~ReadLockGuard() {
+        _lock.unlock_shared();
+    }
+
+  private:
+    const co::SharedMutex& _lock;
+    DISALLOW_COPY_AND_ASSIGN(ReadLockGuard);
+};
+
+// guard to acquire and release the exclusive lock of co::SharedMutex
+class __coapi WriteLockGuard {
+  public:
+    explicit WriteLockGuard(const co::SharedMutex& lock) : _lock(lock) {
+        _lock.lock();
+    }
+
+    ~WriteLockGuard() {
+        _lock.unlock();
+    }
+
+  private:
+    const co::SharedMutex& _lock;
+    DISALLOW_COPY_AND_ASSIGN(WriteLockGuard);
+};
+
 } // co
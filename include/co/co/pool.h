@@ -33,8 +33,18 @@ class __coapi Pool {
      * @param cap  max capacity of the pool for each thread, -1 for unlimited.
      *             this argument is ignored if dcb is NULL.
      *             default: -1.
+     * @param ttl  time in milliseconds an idle element can stay in the pool, elements
+     *             not used for ttl ms will be destroyed with dcb by the scheduler.
+     *             0 for never. this argument is ignored if dcb is NULL.
+     *             default: 0.
+     * @param borrow  if true, pop() takes an element from pools of other threads
+     *             when the pool of the current thread is empty, before calling ccb.
+     *             a lock is needed for each pool then. default: false.
      */
-    Pool(std::function<void* ()>&& ccb, std::function<void(void*)>&& dcb, size_t cap=(size_t)-1);
+    Pool(
+        std::function<void* ()>&& ccb, std::function<void(void*)>&& dcb,
+        size_t cap=(size_t)-1, uint32 ttl=0, bool borrow=false
+    );
 
     Pool(Pool&& p) : _p(p._p) { p._p = 0; }
 
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "../def.h"
+#include "../atomic.h"
+#include "../mem.h"
+#include "../time.h"
+#include "event.h"
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace co {
+namespace xx {
+
+/**
+ * lock-free bounded ring buffer
+ *   - Each cell has a sequence number, which tells whether the cell is ready for
+ *     writing (seq == pos) or reading (seq == pos + 1). Writers and readers claim
+ *     a position with a CAS, or a plain store if @SPSC is true.
+ *   - Elements are constructed in place, and moved out when they are read.
+ *   - Readers and writers park on a co::Event only when the ring is empty or full.
+ *     _rwait and _wwait count the parked ones, so that the other side calls
+ *     signal() only when someone is waiting.
+ */
+template <typename T, bool SPSC>
+class Ring {
+  public:
+    explicit Ring(uint32 cap, uint32 ms) : _refn(1), _ms(ms), _rwait(0), _wwait(0) {
+        uint32 n = 2;
+        while (n < cap) n <<= 1;
+        _mask = n - 1;
+        _cells = (Cell*) co::alloc(sizeof(Cell) * n);
+        for (uint32 i = 0; i < n; ++i) _cells[i].seq = i;
+        _wpos = _rpos = 0;
+    }
+
+    ~Ring() {
+        T x;
+        while (this->pop(x));
+        co::free(_cells, sizeof(Cell) * (_mask + 1));
+    }
+
+    uint32 capacity() const { return (uint32)(_mask + 1); }
+
+    template <typename X>
+    bool write(X&& x, uint32 ms) {
+        if (!this->push(std::forward<X>(x))) {
+            if (ms == 0) return false;
+            if (!this->park(_wwait, _wev, ms, [&]() { return this->push(std::forward<X>(x)); })) {
+                return false;
+            }
+        }
+        this->notify(_rwait, _rev);
+        return true;
+    }
+
+    bool read(T& x, uint32 ms) {
+        if (!this->pop(x)) {
+            if (ms == 0) return false;
+            if (!this->park(_rwait, _rev, ms, [&]() { return this->pop(x); })) {
+                return false;
+            }
+        }
+        this->notify(_wwait, _wev);
+        return true;
+    }
+
+    uint32 ms() const { return _ms; }
+
+    uint32 ref() { return atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    // @x is untouched if the ring is full
+    template <typename X>
+    bool push(X&& x) {
+        size_t pos = atomic_load(&_wpos, mo_relaxed);
+        Cell* c;
+        for (;;) {
+            c = &_cells[pos & _mask];
+            const size_t seq = atomic_load(&c->seq, mo_acquire);
+            const intptr_t d = (intptr_t)seq - (intptr_t)pos;
+            if (d == 0) {
+                if (SPSC) { atomic_store(&_wpos, pos + 1, mo_relaxed); break; }
+                const size_t p = atomic_cas(&_wpos, pos, pos + 1, mo_relaxed, mo_relaxed);
+                if (p == pos) break;
+                pos = p;
+            } else if (d < 0) {
+                return false; // full
+            } else {
+                pos = atomic_load(&_wpos, mo_relaxed);
+            }
+        }
+        new (&c->v) T(std::forward<X>(x));
+        atomic_store(&c->seq, pos + 1, mo_release);
+        return true;
+    }
+
+    bool pop(T& x) {
+        size_t pos = atomic_load(&_rpos, mo_relaxed);
+        Cell* c;
+        for (;;) {
+            c = &_cells[pos & _mask];
+            const size_t seq = atomic_load(&c->seq, mo_acquire);
+            const intptr_t d = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (d == 0) {
+                if (SPSC) { atomic_store(&_rpos, pos + 1, mo_relaxed); break; }
+                const size_t p = atomic_cas(&_rpos, pos, pos + 1, mo_relaxed, mo_relaxed);
+                if (p == pos) break;
+                pos = p;
+            } else if (d < 0) {
+                return false; // empty
+            } else {
+                pos = atomic_load(&_rpos, mo_relaxed);
+            }
+        }
+        T* p = (T*)&c->v;
+        x = std::move(*p);
+        p->~T();
+        atomic_store(&c->seq, pos + _mask + 1, mo_release);
+        return true;
+    }
+
+    // wake up the other side if anyone is parked on @ev
+    void notify(uint32& waiters, co::Event& ev) {
+        atomic_fence(mo_seq_cst);
+        if (atomic_load(&waiters, mo_relaxed) > 0) ev.signal();
+    }
+
+    template <typename F>
+    bool park(uint32& waiters, co::Event& ev, uint32 ms, F&& f) {
+        const int64 deadline = ms == (uint32)-1 ? 0 : now::ms() + ms;
+        bool r = false;
+        atomic_inc(&waiters, mo_relaxed);
+        for (;;) {
+            atomic_fence(mo_seq_cst);
+            if (f()) { r = true; break; }
+            uint32 t = (uint32)-1;
+            if (ms != (uint32)-1) {
+                const int64 x = deadline - now::ms();
+                if (x <= 0) break;
+                t = (uint32)x;
+            }
+            ev.wait(t);
+        }
+        atomic_dec(&waiters, mo_relaxed);
+
+        // Signals are not counted on co::Event, two signals may wake up only one
+        // waiter. Pass it on to the next one.
+        if (r && atomic_load(&waiters, mo_relaxed) > 0) ev.signal();
+        return r;
+    }
+
+    struct Cell {
+        size_t seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type v;
+    };
+
+    uint32 _refn;
+    uint32 _ms;
+    Cell* _cells;
+    size_t _mask;
+    char _pad0[64];
+    size_t _wpos;
+    char _pad1[64 - sizeof(size_t)];
+    size_t _rpos;
+    char _pad2[64 - sizeof(size_t)];
+    uint32 _rwait;
+    uint32 _wwait;
+    co::Event _rev;
+    co::Event _wev;
+};
+
+} // xx
+
+/**
+ * lock-free bounded channel
+ *   - Unlike co::Chan, elements are stored in place and moved in and out, no lock
+ *     is taken, and nothing is allocated on read or write. The scheduler is
+ *     involved only when a reader finds the channel empty or a writer finds it
+ *     full, and has to wait.
+ *   - If @SPSC is true, there must be at most one reader and one writer at a time,
+ *     which saves a CAS on each operation.
+ *   - It can be used anywhere, in or out of coroutines.
+ *   - T must be default constructible and move assignable.
+ */
+template <typename T, bool SPSC=false>
+class RingChan {
+  public:
+    typedef xx::Ring<T, SPSC> Impl;
+
+    /**
+     * @param cap  capacity of the channel, rounded up to a power of 2.
+     * @param ms   default timeout in milliseconds, -1 by default.
+     */
+    explicit RingChan(uint32 cap=1024, uint32 ms=(uint32)-1) {
+        _p = new (co::alloc(sizeof(Impl))) Impl(cap, ms);
+    }
+
+    ~RingChan() {
+        if (_p && _p->unref() == 0) {
+            _p->~Impl();
+            co::free(_p, sizeof(Impl));
+        }
+    }
+
+    RingChan(RingChan&& c) : _p(c._p) {
+        c._p = 0;
+    }
+
+    // copy constructor, allow co::RingChan to be captured by value in lambda.
+    RingChan(const RingChan& c) : _p(c._p) {
+        _p->ref();
+    }
+
+    void operator=(const RingChan&) = delete;
+
+    uint32 capacity() const { return _p->capacity(); }
+
+    /**
+     * write an element
+     *   - It blocks until the element was written or timeout.
+     *
+     * @return  true on success, false on timeout.
+     */
+    bool write(const T& x, uint32 ms) const { return _p->write(x, ms); }
+    bool write(T&& x, uint32 ms) const { return _p->write(std::move(x), ms); }
+
+    /**
+     * read an element
+     *   - It blocks until an element was read or timeout.
+     *
+     * @return  true on success, false on timeout.
+     */
+    bool read(T& x, uint32 ms) const { return _p->read(x, ms); }
+
+    // write or read without waiting, return false if the channel is full or empty
+    bool try_write(const T& x) const { return _p->write(x, 0); }
+    bool try_write(T&& x) const { return _p->write(std::move(x), 0); }
+    bool try_read(T& x) const { return _p->read(x, 0); }
+
+    // write or read with the default timeout, use write() or read() to check
+    // the result if a timeout was set.
+    void operator<<(const T& x) const { (void) this->write(x, _p->ms()); }
+    void operator<<(T&& x) const { (void) this->write(std::move(x), _p->ms()); }
+    void operator>>(T& x) const { (void) this->read(x, _p->ms()); }
+
+  private:
+    Impl* _p;
+};
+
+} // co
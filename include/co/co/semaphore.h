@@ -0,0 +1,55 @@
+#pragma once
+
+#include "../def.h"
+#include "../atomic.h"
+
+namespace co {
+
+/**
+ * co::Semaphore is a counting semaphore for coroutines
+ *   - Permits are taken with an atomic operation, a coroutine is suspended only 
+ *     when there are not enough permits.
+ *   - Waiting coroutines get permits in the order they came.
+ *   - Users SHOULD use co::Semaphore in coroutine environments only.
+ */
+class __coapi Semaphore {
+  public:
+    // @n  initial number of permits
+    explicit Semaphore(uint32 n=0);
+    ~Semaphore();
+
+    Semaphore(Semaphore&& s) : _p(s._p) { s._p = 0; }
+
+    // copy constructor, allow co::Semaphore to be captured by value in lambda.
+    Semaphore(const Semaphore& s) : _p(s._p) {
+        atomic_inc(_p, mo_relaxed);
+    }
+
+    void operator=(const Semaphore&) = delete;
+
+    /**
+     * acquire n permits
+     *   - It MUST be called in a coroutine.
+     *   - It blocks until n permits were acquired, or timeout.
+     *
+     * @param n   number of permits, 1 by default.
+     * @param ms  timeout in milliseconds, -1 by default for never timed out.
+     *
+     * @return    true if the permits were acquired, otherwise false
+     */
+    bool acquire(uint32 n=1, uint32 ms=(uint32)-1) const;
+
+    // acquire n permits without waiting, return false if there are not enough
+    bool try_acquire(uint32 n=1) const;
+
+    // release n permits, it can be called from anywhere
+    void release(uint32 n=1) const;
+
+    // number of permits available now
+    int64 count() const;
+
+  private:
+    uint32* _p;
+};
+
+} // co
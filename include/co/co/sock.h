@@ -25,12 +25,30 @@ typedef SOCKET sock_t;
 #include <netinet/tcp.h> // for TCP_NODELAY...
 #include <arpa/inet.h>   // for inet_ntop...
 #include <netdb.h>       // getaddrinfo, gethostby...
+#include <sys/uio.h>     // struct iovec
+#include <sys/un.h>      // struct sockaddr_un
+#include <stddef.h>      // offsetof
 
 typedef int sock_t;
 #endif
 
 namespace co {
 
+// buffer for sendv(), struct iovec on linux/mac, or WSABUF on windows
+#ifdef _WIN32
+typedef WSABUF iov_t;
+
+inline iov_t make_iov(const void* p, size_t n) {
+    iov_t x; x.buf = (CHAR*)p; x.len = (ULONG)n; return x;
+}
+#else
+typedef struct iovec iov_t;
+
+inline iov_t make_iov(const void* p, size_t n) {
+    iov_t x; x.iov_base = (void*)p; x.iov_len = n; return x;
+}
+#endif
+
 /** 
  * create a socket suitable for coroutine programing
  * 
@@ -136,6 +154,19 @@ __coapi int listen(sock_t fd, int backlog = 1024);
  */
 __coapi sock_t accept(sock_t fd, void* addr, int* addrlen);
 
+#ifndef _WIN32
+/**
+ * accept a connection on a socket without blocking 
+ *   - It can be called anywhere, usually after accept() returned, to drain the 
+ *     pending connections of a listening socket. 
+ *   - accept4() with SOCK_NONBLOCK | SOCK_CLOEXEC is used where it is available. 
+ * 
+ * @return  a non-blocking socket on success, or -1 on error. errno is EAGAIN 
+ *          or EWOULDBLOCK if there is no pending connection. 
+ */
+__coapi sock_t try_accept(sock_t fd, void* addr, int* addrlen);
+#endif
+
 /**
  * connect to an address 
  *   - It MUST be called in a coroutine. 
@@ -205,6 +236,25 @@ __coapi int recvn(sock_t fd, void* buf, int n, int ms = -1);
  */
 __coapi int recvfrom(sock_t fd, void* buf, int n, void* src_addr, int* addrlen, int ms = -1);
 
+#ifdef __linux__
+/**
+ * recv multiple datagrams from a socket with one syscall, linux only 
+ *   - It MUST be called in a coroutine. 
+ *   - It blocks until any datagram recieved or timeout, or any error occured, 
+ *     and returns the datagrams available, without waiting for more. 
+ *   - msg_len of each element is set to size of the datagram recieved. 
+ * 
+ * @param fd    a non-blocking udp socket.
+ * @param msgs  an array of struct mmsghdr, man recvmmsg for details.
+ * @param n     number of elements in msgs.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ * 
+ * @return      number of datagrams recieved on success, -1 on timeout or error.
+ */
+__coapi int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms = -1);
+#endif
+
 /**
  * send n bytes on a socket 
  *   - It MUST be called in a coroutine. 
@@ -220,6 +270,22 @@ __coapi int recvfrom(sock_t fd, void* buf, int n, void* src_addr, int* addrlen,
  */
 __coapi int send(sock_t fd, const void* buf, int n, int ms = -1);
 
+/**
+ * send data in multiple buffers on a socket, with writev() or WSASend() 
+ *   - It MUST be called in a coroutine. 
+ *   - It blocks until all the data is sent or timeout, or any error occured. 
+ *   - On partial writes, elements of iov will be changed to skip the data sent. 
+ * 
+ * @param fd   a non-blocking (also overlapped on windows) TCP socket.
+ * @param iov  an array of buffers, see co::make_iov().
+ * @param n    number of the buffers.
+ * @param ms   timeout in milliseconds, if ms < 0, it will never time out. 
+ *             default: -1.
+ * 
+ * @return     total size of the buffers on success, or -1 on error. 
+ */
+__coapi int64 sendv(sock_t fd, iov_t* iov, int n, int ms = -1);
+
 /**
  * send n bytes on a socket 
  *   - It MUST be called in a coroutine. 
@@ -238,6 +304,47 @@ __coapi int send(sock_t fd, const void* buf, int n, int ms = -1);
  */
 __coapi int sendto(sock_t fd, const void* buf, int n, const void* dst_addr, int addrlen, int ms = -1);
 
+#ifdef __linux__
+/**
+ * send multiple datagrams on a socket with one syscall, linux only 
+ *   - It MUST be called in a coroutine. 
+ *   - It blocks until all the datagrams are sent or timeout, or any error occured. 
+ *   - msg_len of each element is set to bytes sent for the datagram. 
+ * 
+ * @param fd    a non-blocking udp socket.
+ * @param msgs  an array of struct mmsghdr, the destination address of each 
+ *              datagram is set in msg_hdr.msg_name, man sendmmsg for details.
+ * @param n     number of elements in msgs.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ * 
+ * @return      n on success, or number of datagrams sent before an error, 
+ *              or -1 on timeout or error if nothing was sent.
+ */
+__coapi int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms = -1);
+#endif
+
+/**
+ * send data of a file on a socket 
+ *   - It MUST be called in a coroutine. 
+ *   - sendfile() is used on linux and mac, and TransmitFile() on windows, data 
+ *     of the file will not be copied to the user space. On other platforms, it 
+ *     falls back to pread() and send(). 
+ * 
+ * @param fd    a non-blocking (also overlapped on windows) TCP socket.
+ * @param file  a file descriptor, or a HANDLE on windows, see fs::file::fd().
+ * @param off   offset in the file.
+ * @param n     bytes to send.
+ * @param ms    timeout in milliseconds, -1 for never timeout.
+ * 
+ * @return      n on success, -1 on timeout or error.
+ */
+#ifdef _WIN32
+__coapi int64 sendfile(sock_t fd, void* file, int64 off, int64 n, int ms = -1);
+#else
+__coapi int64 sendfile(sock_t fd, int file, int64 off, int64 n, int ms = -1);
+#endif
+
 #ifdef _WIN32
 // get options on a socket, man getsockopt for details.
 inline int getsockopt(sock_t fd, int lv, int opt, void* optval, int* optlen) {
@@ -273,6 +380,22 @@ inline void set_reuseaddr(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
 }
 
+/**
+ * set option SO_REUSEPORT on a socket 
+ *   - Sockets bound to the same address with this option share the incoming 
+ *     connections, which are balanced by the kernel. 
+ *   - Return false if it is not supported on this platform. 
+ */
+inline bool set_reuseport(sock_t fd) {
+  #ifdef SO_REUSEPORT
+    const int v = 1;
+    return co::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v)) == 0;
+  #else
+    (void)fd;
+    return false;
+  #endif
+}
+
 /**
  * set send buffer size for a socket 
  *   - It MUST be called before the socket is connected. 
@@ -404,13 +527,43 @@ inline fastring to_string(const struct sockaddr_in6* addr) {
     return r;
 }
 
+#ifndef _WIN32
+/**
+ * convert a unix domain socket address to a string 
+ *
+ * @param len  length of the addr.
+ *
+ * @return     a string in format: "unix:path", "unix:@name" for the abstract 
+ *             namespace, or "unix:" for an unnamed socket.
+ */
+inline fastring to_string(const struct sockaddr_un* addr, int len) {
+    const int n = len - (int)offsetof(struct sockaddr_un, sun_path);
+    fastring r(n > 0 ? n + 8 : 8);
+    r.append("unix:");
+    if (n > 0) {
+        if (addr->sun_path[0] == '\0') {
+            r.append('@').append(addr->sun_path + 1, n - 1);
+        } else {
+            r.append(addr->sun_path, strnlen(addr->sun_path, n));
+        }
+    }
+    return r;
+}
+#endif
+
 /**
  * convert an ip address to a string 
  * 
  * @param addr  a pointer to struct sockaddr.
- * @param len   length of the addr, sizeof(sockaddr_in) or sizeof(sockaddr_in6).
+ * @param len   length of the addr, sizeof(sockaddr_in) or sizeof(sockaddr_in6),
+ *              or that of a unix domain socket address.
  */
 inline fastring to_string(const void* addr, int len) {
+  #ifndef _WIN32
+    if (((const sockaddr*)addr)->sa_family == AF_UNIX) {
+        return to_string((const struct sockaddr_un*)addr, len);
+    }
+  #endif
     if (len == sizeof(sockaddr_in)) return to_string((const sockaddr_in*)addr);
     return to_string((const struct sockaddr_in6*)addr);
 }
@@ -424,10 +577,16 @@ inline fastring peer(sock_t fd) {
     union {
         struct sockaddr_in  v4;
         struct sockaddr_in6 v6;
+      #ifndef _WIN32
+        struct sockaddr_un  un;
+      #endif
     } addr;
     int addrlen = sizeof(addr);
     const int r = getpeername(fd, (sockaddr*)&addr, (socklen_t*)&addrlen);
     if (r == 0) {
+      #ifndef _WIN32
+        if (addr.v4.sin_family == AF_UNIX) return co::to_string(&addr.un, addrlen);
+      #endif
         if (addrlen == sizeof(addr.v4)) return co::to_string(&addr.v4);
         if (addrlen == sizeof(addr.v6)) return co::to_string(&addr.v6);
     }
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../def.h"
+#include "../closure.h"
+
+namespace co {
+
+/**
+ * co::TaskGroup runs tasks in coroutines and waits for them, e.g. hedged requests 
+ *   - Tasks are added by go(), and run in coroutines created as co::go() does. 
+ *   - wait() returns when all of them, or the first n of them, have finished. 
+ *   - cancel() cancels the tasks not finished. Waits of a cancelled task return 
+ *     at once as timed out, co::recv(), co::send() and the like return -1 with 
+ *     errno ECANCELED, and so do the waits after that. Waits with a timeout are 
+ *     cancelled, and so are IO waits and co::Event::wait() without a timeout. 
+ *     Other waits, e.g. co::Mutex::lock(), are not interrupted. 
+ *   - The destructor cancels the tasks not finished, and waits for all of them. 
+ * 
+ *   co::TaskGroup g;
+ *   g.go([]() { call(primary); });
+ *   if (g.wait(1, 20) == 0) g.go([]() { call(backup); });
+ *   g.wait(1);
+ *   g.cancel();
+ */
+class __coapi TaskGroup {
+  public:
+    TaskGroup();
+    ~TaskGroup();
+
+    void go(Closure* cb);
+
+    template<typename F>
+    void go(F&& f) {
+        this->go(new_closure(std::forward<F>(f)));
+    }
+
+    template<typename F, typename P>
+    void go(F&& f, P&& p) {
+        this->go(new_closure(std::forward<F>(f), std::forward<P>(p)));
+    }
+
+    template<typename F, typename T, typename P>
+    void go(F&& f, T* t, P&& p) {
+        this->go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
+    }
+
+    /**
+     * wait for the tasks to finish 
+     *   - It can be called anywhere. 
+     * 
+     * @param n   number of tasks to wait for, all of them if it is not less 
+     *            than size(), -1 by default.
+     * @param ms  timeout in milliseconds, -1 by default for never timed out.
+     * 
+     * @return    number of tasks finished, less than n on timeout.
+     */
+    uint32 wait(uint32 n=(uint32)-1, uint32 ms=(uint32)-1) const;
+
+    // wait for any of the tasks, the same as wait(1, ms)
+    uint32 wait_any(uint32 ms=(uint32)-1) const { return this->wait(1, ms); }
+
+    // cancel the tasks not finished, they are not waited for here
+    void cancel() const;
+
+    // number of tasks added
+    uint32 size() const;
+
+    // number of tasks finished
+    uint32 finished() const;
+
+  private:
+    void* _p;
+    DISALLOW_COPY_AND_ASSIGN(TaskGroup);
+};
+
+// whether the current coroutine was cancelled by its co::TaskGroup
+__coapi bool cancelled();
+
+} // co
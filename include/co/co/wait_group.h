@@ -34,4 +34,46 @@ class __coapi WaitGroup {
     uint32* _p;
 };
 
+/**
+ * co::Latch is a one-shot barrier
+ *   - The counter is set on construction, and can not be increased. Once it 
+ *     reaches 0, all the waiters are waken up, and wait() returns immediately 
+ *     from then on.
+ *   - It can be used anywhere.
+ */
+class __coapi Latch {
+  public:
+    explicit Latch(uint32 n);
+    ~Latch();
+
+    Latch(Latch&& l) : _p(l._p) {
+        l._p = 0;
+    }
+
+    // copy constructor, allow Latch to be captured by value in lambda.
+    Latch(const Latch& l) : _p(l._p) {
+        atomic_inc(_p, mo_relaxed);
+    }
+
+    void operator=(const Latch&) = delete;
+
+    // decrease the counter by n (1 by default), n MUST not be greater than the counter
+    void count_down(uint32 n=1) const;
+
+    // return true if the counter has reached 0
+    bool try_wait() const;
+
+    /**
+     * wait until the counter reaches 0
+     *
+     * @param ms  timeout in milliseconds, -1 by default for never timed out.
+     *
+     * @return    true if the counter reached 0 before timeout, otherwise false
+     */
+    bool wait(uint32 ms=(uint32)-1) const;
+
+  private:
+    uint32* _p;
+};
+
 } // co
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "def.h"
+#include "mem.h"
+#include "stl.h"
+#include "time.h"
+#include <mutex>
+
+namespace co {
+
+/**
+ * thread-safe cache, to be shared by threads or schedulers
+ *   - Entries are split into shards by hash of the key, each shard has its own
+ *     lock, so threads working on different shards do not contend.
+ *   - Entries are evicted with the CLOCK algorithm, which approximates LRU. A
+ *     hit only sets the referenced bit of the entry, nothing is relinked.
+ *   - An entry may have a TTL, an expired entry is removed when it is found by
+ *     get(), or when the clock hand comes to it.
+ *   - Values are copied out by get(), as an entry may be evicted by another
+ *     thread at any time. Use a shared pointer as the value for large objects.
+ *   - The lock is a std::mutex and it is held for a short time, so it is fine
+ *     to use the cache in coroutines.
+ */
+template <
+    typename K, typename V,
+    typename Hash = co::_Hash<K>,
+    typename Pred = co::_Eq<K>
+>
+class ConcurrentLru {
+  public:
+    struct stats_t {
+        uint64 hits;
+        uint64 misses;      // expired entries found by get() included
+        uint64 evictions;   // entries evicted as the shard is full
+        uint64 expirations; // expired entries removed
+    };
+
+    /**
+     * @param capacity  max number of entries, it is split evenly into shards.
+     * @param shards    number of shards, it is rounded up to a power of 2.
+     * @param ttl_ms    default TTL in milliseconds, <= 0 for no TTL.
+     */
+    explicit ConcurrentLru(size_t capacity=1024, uint32 shards=16, int64 ttl_ms=0)
+        : _ttl(ttl_ms) {
+        uint32 n = 1;
+        while (n < shards) n <<= 1;
+        _n = n;
+        _s = (_Shard*) co::alloc(sizeof(_Shard) * n);
+        const size_t cap = (capacity + n - 1) / n;
+        for (uint32 i = 0; i < n; ++i) new (&_s[i]) _Shard(cap > 0 ? cap : 1);
+    }
+
+    ~ConcurrentLru() {
+        for (uint32 i = 0; i < _n; ++i) _s[i].~_Shard();
+        co::free(_s, sizeof(_Shard) * _n);
+    }
+
+    ConcurrentLru(const ConcurrentLru&) = delete;
+    void operator=(const ConcurrentLru&) = delete;
+
+    // copy the value of the key to @v, return false if not found or expired
+    bool get(const K& key, V& v) {
+        _Shard& s = this->_shard(key);
+        std::lock_guard<std::mutex> g(s.m);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) { ++s.misses; return false; }
+        _Entry& e = it->second;
+        if (e.expire > 0 && now::ms() >= e.expire) {
+            ++s.misses;
+            ++s.expirations;
+            s.remove(it);
+            return false;
+        }
+        e.ref = 1;
+        ++s.hits;
+        v = e.value;
+        return true;
+    }
+
+    // insert or update an entry with the default TTL
+    template <typename Key, typename Val>
+    void set(Key&& key, Val&& v) {
+        this->set(std::forward<Key>(key), std::forward<Val>(v), _ttl);
+    }
+
+    // insert or update an entry with TTL @ttl_ms, <= 0 for no TTL
+    template <typename Key, typename Val>
+    void set(Key&& key, Val&& v, int64 ttl_ms) {
+        const int64 expire = ttl_ms > 0 ? now::ms() + ttl_ms : 0;
+        _Shard& s = this->_shard(key);
+        std::lock_guard<std::mutex> g(s.m);
+        auto it = s.map.find(key);
+        if (it != s.map.end()) {
+            it->second.value = std::forward<Val>(v);
+            it->second.expire = expire;
+            it->second.ref = 1;
+            return;
+        }
+        if (s.map.size() >= s.cap) s.evict();
+        auto r = s.map.emplace(std::forward<Key>(key), _Entry(std::forward<Val>(v), expire));
+        s.add(&*r.first);
+    }
+
+    // remove an entry, return false if not found
+    bool erase(const K& key) {
+        _Shard& s = this->_shard(key);
+        std::lock_guard<std::mutex> g(s.m);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) return false;
+        s.remove(it);
+        return true;
+    }
+
+    void clear() {
+        for (uint32 i = 0; i < _n; ++i) {
+            std::lock_guard<std::mutex> g(_s[i].m);
+            _s[i].clear();
+        }
+    }
+
+    // number of entries, expired ones not removed yet included
+    size_t size() const {
+        size_t n = 0;
+        for (uint32 i = 0; i < _n; ++i) {
+            std::lock_guard<std::mutex> g(_s[i].m);
+            n += _s[i].map.size();
+        }
+        return n;
+    }
+
+    // counters summed up over the shards
+    stats_t stats() const {
+        stats_t x = { 0, 0, 0, 0 };
+        for (uint32 i = 0; i < _n; ++i) {
+            std::lock_guard<std::mutex> g(_s[i].m);
+            x.hits += _s[i].hits;
+            x.misses += _s[i].misses;
+            x.evictions += _s[i].evictions;
+            x.expirations += _s[i].expirations;
+        }
+        return x;
+    }
+
+  private:
+    struct _Entry {
+        template <typename X>
+        _Entry(X&& x, int64 e) : value(std::forward<X>(x)), expire(e), slot(0), ref(0) {}
+        V value;
+        int64 expire; // expiration time in ms, 0 if no TTL
+        uint32 slot;  // position in the clock
+        uint32 ref;   // referenced since the clock hand passed
+    };
+
+    typedef co::hash_map<K, _Entry, Hash, Pred> map_t;
+    typedef typename map_t::value_type node_t;
+
+    struct _Shard {
+        explicit _Shard(size_t n)
+            : cap(n), hand(0), hits(0), misses(0), evictions(0), expirations(0) {
+        }
+
+        // put the entry into the clock, elements of the map do not move
+        void add(node_t* p) {
+            if (!free.empty()) {
+                p->second.slot = free.back();
+                free.pop_back();
+                clock[p->second.slot] = p;
+            } else {
+                p->second.slot = (uint32) clock.size();
+                clock.push_back(p);
+            }
+        }
+
+        void remove(typename map_t::iterator it) {
+            clock[it->second.slot] = 0;
+            free.push_back(it->second.slot);
+            map.erase(it);
+        }
+
+        // sweep the clock until an entry not referenced, or expired, is found
+        void evict() {
+            const int64 t = now::ms();
+            for (const size_t n = clock.size();; hand = hand + 1 < n ? hand + 1 : 0) {
+                node_t* const p = clock[hand];
+                if (!p) continue;
+                _Entry& e = p->second;
+                const bool expired = e.expire > 0 && t >= e.expire;
+                if (!expired && e.ref) { e.ref = 0; continue; }
+                expired ? ++expirations : ++evictions;
+                this->remove(map.find(p->first));
+                return;
+            }
+        }
+
+        void clear() {
+            map.clear();
+            clock.clear();
+            free.clear();
+            hand = 0;
+        }
+
+        mutable std::mutex m;
+        map_t map;
+        co::vector<node_t*> clock;
+        co::vector<uint32> free; // slots of removed entries in the clock
+        size_t cap;
+        size_t hand;
+        uint64 hits;
+        uint64 misses;
+        uint64 evictions;
+        uint64 expirations;
+    };
+
+    // the map in a shard takes the lower bits of the hash, mix it and use the
+    // higher bits here
+    template <typename Key>
+    _Shard& _shard(const Key& key) {
+        const uint64 h = (uint64) Hash()(key) * 0x9e3779b97f4a7c15ull;
+        return _s[(uint32)(h >> 32) & (_n - 1)];
+    }
+
+  private:
+    _Shard* _s;
+    uint32 _n;
+    int64 _ttl;
+};
+
+} // co
@@ -0,0 +1 @@
+#define COCOYAXI_SHARED 0
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "def.h"
+#include "fastring.h"
+#include "stl.h"
+
+namespace dns {
+
+/**
+ * resolve a host name to ip addresses
+ *   - In a coroutine, names are queried over UDP (TCP if truncated) from the name
+ *     servers in FLG_dns_servers, or those in /etc/resolv.conf, without blocking
+ *     the scheduler. Search domains and ndots in /etc/resolv.conf are respected.
+ *   - Ip addresses and names in /etc/hosts are resolved in place.
+ *   - Results are cached by the TTL of the records, up to FLG_dns_max_ttl seconds.
+ *     Names not found are cached too, up to FLG_dns_negative_ttl seconds.
+ *   - Concurrent lookups of the same name share one query.
+ *   - If there is no name server, or it is called from a non-scheduler thread,
+ *     getaddrinfo() is used, in the thread pool of co::offload() for coroutines.
+ *
+ * @param host  a domain name, or an ip address.
+ * @param ips   ip addresses are appended to it, ipv4 ones first. ipv6 ones are
+ *              resolved only if FLG_dns_ipv6 is true.
+ * @param ms    timeout in milliseconds, -1 for FLG_dns_timeout of each query.
+ *              default: -1.
+ *
+ * @return      true on success, false if the name was not found or on errors.
+ */
+__coapi bool resolve(const char* host, co::vector<fastring>& ips, int ms=-1);
+
+inline bool resolve(const fastring& host, co::vector<fastring>& ips, int ms=-1) {
+    return dns::resolve(host.c_str(), ips, ms);
+}
+
+/**
+ * remove all results in the cache
+ */
+__coapi void clear_cache();
+
+} // dns
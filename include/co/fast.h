@@ -21,10 +21,12 @@ struct maxdp {
 namespace fast {
 
 // double to ascii string, return length of the result
-// @mdp  max decimal places
-inline int dtoa(double v, char* buf, int mdp=324) {
-    return milo::dtoa(v, buf, mdp);
-}
+//   - The digits are the shortest that convert back to @v exactly (Ryu), 
+//     e.g. 0.3 rather than 0.29999999999999999. 
+//   - Digits after @mdp (max decimal places) are truncated. 
+//   - @buf should have at least 25 bytes. NaN and infinity are "nan", "inf" 
+//     and "-inf". 
+__coapi int dtoa(double v, char* buf, int mdp=324);
 
 // unsigned integer to hex string, return length of the result
 //   - 255 -> "0xff"
@@ -82,8 +84,61 @@ template<>
 inline int ptoh<8>(const void* p, char* buf) {
     return u64toh((uint64)p, buf);
 }
+
+// 8 bytes from p, the first byte is the lowest
+inline uint64 load8(const char* p) {
+    uint64 v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// whether the 8 bytes are all '0' to '9', a byte over '9' carries into the
+// high nibble when 6 is added
+inline bool is_8digits(uint64 v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ull) |
+            (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+// value of 8 digits, they are combined into 2, 4 and then 8 digits in the
+// lanes by 3 multiplications
+inline uint32 parse_8digits(uint64 v) {
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return (uint32)v;
+}
 } // xx
 
+// read decimal digits at the beginning of [s, e), return the end of them
+//   - The value of the first 19 digits is stored in @v, it never overflows, 
+//     the caller checks the number of digits, e.g. for more than 19 of them. 
+//   - Digits are read 8 at a time (SWAR), while there are 8 bytes left. 
+inline const char* read_digits(const char* s, const char* e, uint64& v) {
+    const char* p = s;
+    uint64 x = 0;
+    if (e - p >= 8) {
+        uint64 w = xx::load8(p);
+        if (xx::is_8digits(w)) {
+            x = xx::parse_8digits(w);
+            p += 8;
+            if (e - p >= 8 && xx::is_8digits(w = xx::load8(p))) {
+                x = x * 100000000 + xx::parse_8digits(w);
+                p += 8;
+            }
+        }
+    }
+    for (const char* const m = e - s > 19 ? s + 19 : e; p < m && '0' <= *p && *p <= '9'; ++p) {
+        x = x * 10 + (*p - '0');
+    }
+    v = x;
+    while (p < e && '0' <= *p && *p <= '9') ++p;
+    return p;
+}
+
 // signed integer to ascii string
 template<typename V>
 inline int itoa(V v, char* buf) {
@@ -101,6 +156,19 @@ inline int ptoh(const void* p, char* buf) {
     return xx::ptoh<sizeof(p)>(p, buf);
 }
 
+// ascii string to double, inverse to dtoa
+//   - @s is [-]digits[.digits][(e|E)[+-]digits], NOT null-terminated.
+//   - The result is correctly rounded, and it does not depend on the locale.
+//   - Return false if @s is not a valid number, or it overflows, in which
+//     case strtod() returns HUGE_VAL and sets errno to ERANGE.
+__coapi bool atod(const char* s, size_t n, double& v);
+
+// find the first [sub, sub + m) in [s, s + n), return NULL if not found
+//   - It is binary-safe, neither @s nor @sub needs to be null-terminated.
+//   - With SSE2, 16 positions are checked at a time by the first and last
+//     byte of @sub, and memcmp() is only called on candidates.
+__coapi const char* memmem(const void* s, size_t n, const void* sub, size_t m);
+
 class __coapi stream {
   public:
     constexpr stream() noexcept
@@ -115,6 +115,21 @@ class __coapi fastream : public fast::stream {
         return this->append(&v, sizeof(v));
     }
 
+    // append a formatted string, see fastring::format() for details
+    //   - fastream s;
+    //     s.format("{} + {} = {}", 1, 2, 3);  // s -> "1 + 2 = 3"
+    template<size_t N, typename ...X>
+    fastream& format(const char (&fmt)[N], const X& ... x) {
+        fast::xx::format(*this, fmt, N - 1, x...);
+        return *this;
+    }
+
+    template<typename ...X>
+    fastream& format(const fastring& fmt, const X& ... x) {
+        fast::xx::format(*this, fmt.data(), fmt.size(), x...);
+        return *this;
+    }
+
     fastream& cat() { return *this; }
 
     // concatenate fastream to any number of elements
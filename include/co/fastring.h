@@ -7,6 +7,7 @@
 #include "god.h"
 #include "fast.h"
 #include "hash/murmur_hash.h"
+#include "hash/wyhash.h"
 #include <string>
 #include <ostream>
 
@@ -136,6 +137,24 @@ class __coapi fastring : public fast::stream {
         return this->append(c);
     }
 
+    /**
+     * append a formatted string 
+     *   - Each "{}" in fmt is replaced by the next argument, the same as BLOG. 
+     *     Extra arguments are ignored, and "{}" without an argument is kept. 
+     *   - The memory is reserved once by an upper bound of the result, numbers 
+     *     and strings are written without further checks. Other types are 
+     *     written by operator<<. 
+     *   - The length of a literal fmt is known at compile time, it is parsed 
+     *     when called, as constexpr of C++11 can't do it. 
+     * 
+     *   s.format("{}:{}", "127.0.0.1", 7777);  // s -> "127.0.0.1:7777" 
+     */
+    template<size_t N, typename ...X>
+    fastring& format(const char (&fmt)[N], const X& ... x);
+
+    template<typename ...X>
+    fastring& format(const fastring& fmt, const X& ... x);
+
     fastring& cat() { return *this; }
 
     // concatenate fastring to any number of elements
@@ -194,8 +213,8 @@ class __coapi fastring : public fast::stream {
         return fastring(_p + pos, len < n ? len : n);
     }
 
-    // find, rfind, find_xxx_of are implemented based on strrchr, strstr, 
-    // strcspn, strspn, etc. Do not apply them to binary strings.
+    // find, rfind, find_xxx_of are binary-safe, the string may contain '\0'.
+    // Substrings are searched by fast::memmem().
     size_t find(char c) const {
         if (this->empty()) return npos;
         char* p = (char*) memchr(_p, c, _size);
@@ -217,47 +236,34 @@ class __coapi fastring : public fast::stream {
 
     size_t find(const char* s) const {
         if (this->empty()) return npos;
-        const char* p = strstr(this->c_str(), s);
+        const char* p = fast::memmem(_p, _size, s, strlen(s));
         return p ? p - _p : npos;
     }
 
     size_t find(const char* s, size_t pos) const {
         if (this->size() <= pos) return npos;
-        const char* p = strstr(this->c_str() + pos, s);
+        const char* p = fast::memmem(_p + pos, _size - pos, s, strlen(s));
         return p ? p - _p : npos;
     }
 
-    size_t rfind(char c) const {
-        if (this->empty()) return npos;
-        const char* p = strrchr(this->c_str(), c);
+    // find a substring that may contain '\0'
+    size_t find(const fastring& s, size_t pos=0) const {
+        if (this->size() <= pos) return npos;
+        const char* p = fast::memmem(_p + pos, _size - pos, s.data(), s.size());
         return p ? p - _p : npos;
     }
 
-    size_t rfind(const char* s) const;
-
-    size_t find_first_of(const char* s) const {
-        if (this->empty()) return npos;
-        size_t r = strcspn(this->c_str(), s);
-        return _p[r] ? r : npos;
-    }
-
-    size_t find_first_of(const char* s, size_t pos) const {
-        if (this->size() <= pos) return npos;
-        size_t r = strcspn(this->c_str() + pos, s) + pos;
-        return _p[r] ? r : npos;
+    size_t rfind(char c) const {
+        for (size_t i = _size; i > 0; --i) {
+            if (_p[i - 1] == c) return i - 1;
+        }
+        return npos;
     }
 
-    size_t find_first_not_of(const char* s) const {
-        if (this->empty()) return npos;
-        size_t r = strspn(this->c_str(), s);
-        return _p[r] ? r : npos;
-    }
+    size_t rfind(const char* s) const;
 
-    size_t find_first_not_of(const char* s, size_t pos) const {
-        if (this->size() <= pos) return npos;
-        size_t r = strspn(this->c_str() + pos, s) + pos;
-        return _p[r] ? r : npos;
-    }
+    size_t find_first_of(const char* s, size_t pos=0) const;
+    size_t find_first_not_of(const char* s, size_t pos=0) const;
 
     size_t find_first_not_of(char c, size_t pos=0) const {
         char s[2] = { c, '\0' };
@@ -591,11 +597,154 @@ inline std::ostream& operator<<(std::ostream& os, const fastring& s) {
     return os.write(s.data(), s.size());
 }
 
+namespace fast {
+namespace xx {
+
+// max bytes of a value written by format(), 0 for types written by operator<<
+inline size_t fmt_max(bool) { return 5; }
+inline size_t fmt_max(char) { return 1; }
+inline size_t fmt_max(signed char) { return 1; }
+inline size_t fmt_max(unsigned char) { return 1; }
+inline size_t fmt_max(short) { return sizeof(short) * 3; }
+inline size_t fmt_max(unsigned short) { return sizeof(short) * 3; }
+inline size_t fmt_max(int) { return sizeof(int) * 3; }
+inline size_t fmt_max(unsigned int) { return sizeof(int) * 3; }
+inline size_t fmt_max(long) { return sizeof(long) * 3; }
+inline size_t fmt_max(unsigned long) { return sizeof(long) * 3; }
+inline size_t fmt_max(long long) { return sizeof(long long) * 3; }
+inline size_t fmt_max(unsigned long long) { return sizeof(long long) * 3; }
+inline size_t fmt_max(float) { return 24; }
+inline size_t fmt_max(double) { return 24; }
+inline size_t fmt_max(const void*) { return sizeof(void*) * 3; }
+inline size_t fmt_max(const char* s) { return strlen(s); }
+inline size_t fmt_max(char* s) { return strlen(s); }
+inline size_t fmt_max(const fastring& s) { return s.size(); }
+inline size_t fmt_max(const std::string& s) { return s.size(); }
+
+template<typename T>
+inline size_t fmt_max(const T&) { return 0; }
+
+inline size_t fmt_sum() { return 0; }
+
+template<typename X, typename ...V>
+inline size_t fmt_sum(const X& x, const V& ... v) {
+    return fmt_max(x) + fmt_sum(v...);
+}
+
+// write a value to p, the memory has been reserved
+template<typename S> inline void fmt_put(S&, char*& p, bool v, size_t) {
+    v ? (memcpy(p, "true", 4), p += 4) : (memcpy(p, "false", 5), p += 5);
+}
+
+template<typename S> inline void fmt_put(S&, char*& p, char v, size_t) { *p++ = v; }
+template<typename S> inline void fmt_put(S&, char*& p, signed char v, size_t) { *p++ = (char)v; }
+template<typename S> inline void fmt_put(S&, char*& p, unsigned char v, size_t) { *p++ = (char)v; }
+template<typename S> inline void fmt_put(S&, char*& p, short v, size_t) { p += fast::itoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, unsigned short v, size_t) { p += fast::utoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, int v, size_t) { p += fast::itoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, unsigned int v, size_t) { p += fast::utoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, long v, size_t) { p += fast::itoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, unsigned long v, size_t) { p += fast::utoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, long long v, size_t) { p += fast::itoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, unsigned long long v, size_t) { p += fast::utoa(v, p); }
+template<typename S> inline void fmt_put(S&, char*& p, float v, size_t) { p += fast::dtoa(v, p, 6); }
+template<typename S> inline void fmt_put(S&, char*& p, double v, size_t) { p += fast::dtoa(v, p, 6); }
+template<typename S> inline void fmt_put(S&, char*& p, const void* v, size_t) { p += fast::ptoh(v, p); }
+
+template<typename S> inline void fmt_put(S&, char*& p, const char* v, size_t) {
+    const size_t n = strlen(v);
+    memcpy(p, v, n);
+    p += n;
+}
+
+template<typename S> inline void fmt_put(S& s, char*& p, char* v, size_t r) {
+    fmt_put(s, p, (const char*)v, r);
+}
+
+template<typename S> inline void fmt_put(S&, char*& p, const fastring& v, size_t) {
+    memcpy(p, v.data(), v.size());
+    p += v.size();
+}
+
+template<typename S> inline void fmt_put(S&, char*& p, const std::string& v, size_t) {
+    memcpy(p, v.data(), v.size());
+    p += v.size();
+}
+
+// other types are written by operator<<, then r bytes are reserved for the rest
+template<typename S, typename T>
+inline void fmt_put(S& s, char*& p, const T& v, size_t r) {
+    s.resize(p - s.data());
+    s << v;
+    s.ensure(r);
+    p = (char*)s.data() + s.size();
+}
+
+// copy text in [f, e) to p until a "{}" placeholder, return the position
+// after "{}", or NULL at the end
+inline const char* fmt_text(char*& p, const char* f, const char* e) {
+    char* w = p; // a local copy, or it is reloaded after each byte written
+
+    // 8 bytes at a time if there is no '{' in them
+    for (; f + 8 <= e; f += 8, w += 8) {
+        uint64 x;
+        memcpy(&x, f, 8);
+        const uint64 y = x ^ 0x7b7b7b7b7b7b7b7bULL;
+        if ((y - 0x0101010101010101ULL) & ~y & 0x8080808080808080ULL) break;
+        memcpy(w, &x, 8);
+    }
+
+    const char* r = 0;
+    while (f < e) {
+        if (*f == '{' && f + 1 < e && f[1] == '}') { r = f + 2; break; }
+        *w++ = *f++;
+    }
+    p = w;
+    return r;
+}
+
+template<typename S>
+inline void fmt(S&, char*& p, const char* f, const char* e) {
+    if (f) { memcpy(p, f, e - f); p += e - f; } // no more args, "{}" are kept
+}
+
+template<typename S, typename X, typename ...V>
+inline void fmt(S& s, char*& p, const char* f, const char* e, const X& x, const V& ... v) {
+    if (!f || !(f = fmt_text(p, f, e))) return; // no more placeholders, args left are ignored
+    fmt_put(s, p, x, (e - f) + fmt_sum(v...));
+    fmt(s, p, f, e, v...);
+}
+
+// append the format string [f, f + n) with args to s, the memory for the result
+// is reserved once by the upper bound of the size
+template<typename S, typename ...X>
+inline void format(S& s, const char* f, size_t n, const X& ... x) {
+    s.ensure(n + fmt_sum(x...));
+    char* p = (char*)s.data() + s.size();
+    fmt(s, p, f, f + n, x...);
+    s.resize(p - s.data());
+}
+
+} // xx
+} // fast
+
+template<size_t N, typename ...X>
+inline fastring& fastring::format(const char (&fmt)[N], const X& ... x) {
+    fast::xx::format(*this, fmt, N - 1, x...);
+    return *this;
+}
+
+template<typename ...X>
+inline fastring& fastring::format(const fastring& fmt, const X& ... x) {
+    fast::xx::format(*this, fmt.data(), fmt.size(), x...);
+    return *this;
+}
+
 namespace std {
 template<>
 struct hash<fastring> {
     size_t operator()(const fastring& s) const {
-        return murmur_hash(s.data(), s.size());
+        return wyhash(s.data(), s.size());
     }
 };
 } // std
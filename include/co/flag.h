@@ -4,6 +4,7 @@
 #include "mem.h"
 #include "fastring.h"
 #include "stl.h"
+#include <functional>
 
 // co/flag is a library similar to Google's gflags.
 // A flag is in fact a global variable, and value can be passed to it
@@ -26,10 +27,35 @@ __coapi void init(const fastring& path);
 // It is not thread-safe. 
 __coapi fastring set_value(const fastring& name, const fastring& value);
 
+// Mark a flag as mutable, so that it can be changed by flag::update() at runtime.
+//   - String flags can not be mutable, they can not be stored atomically.
+//   - It is not thread-safe and should be used before calling flag::init().
+__coapi bool set_mutable(const char* name);
+
+// Check whether a flag is mutable.
+__coapi bool is_mutable(const fastring& name);
+
+// Update value of a mutable flag at runtime, return error message if failed.
+//   - It is thread-safe. The value is parsed before it is stored, and it is 
+//     stored atomically, readers see either the old value or the new one. 
+//   - Watchers of the flag are called in the calling thread after the value 
+//     is stored. Updates are serialized, watchers see them in order, and a 
+//     watcher MUST NOT call flag::update() itself.
+__coapi fastring update(const fastring& name, const fastring& value);
+
+// Add a watcher for a mutable flag, it is called after each flag::update() 
+// of the flag, so that a subsystem can resize its pools or limits. 
+// Return false if the flag is not defined or not mutable.
+__coapi bool watch(const char* name, std::function<void()>&& cb);
+
 // Add alias for a flag, @new_name must be a literal string.
 // It is not thread-safe and should be used before calling flag::init().
 __coapi bool alias(const char* name, const char* new_name);
 
+// Get name and current value of all flags, sorted by name, aliases and flags 
+// without help info are not included.
+__coapi co::vector<std::pair<fastring, fastring>> values();
+
 namespace xx {
 
 __coapi void add_flag(
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "def.h"
+#include "god.h"
+#include "mem.h"
+#include "stl.h"
+#include <string.h>
+#include <initializer_list>
+#include <tuple>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CO_FLAT_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace co {
+namespace xx {
+
+// control bytes of slots, a full slot stores the 7 high bits of the hash
+static const int8 kCtrlEmpty = -128;
+static const int8 kCtrlDeleted = -2;
+static const uint32 kGroupSize = 16;
+
+#ifdef _MSC_VER
+inline uint32 flat_ctz(uint32 x) { unsigned long r; _BitScanForward(&r, x); return r; }
+#else
+inline uint32 flat_ctz(uint32 x) { return __builtin_ctz(x); }
+#endif
+
+// control bytes of a group of 16 slots, matched together with SSE2
+struct FlatGroup {
+  #ifdef CO_FLAT_SSE2
+    explicit FlatGroup(const int8* p) : c(_mm_loadu_si128((const __m128i*)p)) {}
+
+    // bitmask of slots whose control byte is @h
+    uint32 match(int8 h) const {
+        return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), c));
+    }
+
+    uint32 match_empty() const { return this->match(kCtrlEmpty); }
+
+    // empty and deleted slots have the sign bit set
+    uint32 match_free() const { return (uint32)_mm_movemask_epi8(c); }
+
+    __m128i c;
+  #else
+    explicit FlatGroup(const int8* p) : c(p) {}
+
+    uint32 match(int8 h) const {
+        uint32 m = 0;
+        for (uint32 i = 0; i < kGroupSize; ++i) m |= (uint32)(c[i] == h) << i;
+        return m;
+    }
+
+    uint32 match_empty() const { return this->match(kCtrlEmpty); }
+
+    uint32 match_free() const {
+        uint32 m = 0;
+        for (uint32 i = 0; i < kGroupSize; ++i) m |= (uint32)(c[i] < 0) << i;
+        return m;
+    }
+
+    const int8* c;
+  #endif
+};
+
+// mix the hash, so that identity hashes of integers are spread as well
+inline size_t flat_mix(size_t h) {
+    const uint64 x = (uint64)h * 0x9e3779b97f4a7c15ull;
+    return (size_t)(x ^ (x >> 32));
+}
+
+inline int8 flat_h2(size_t h) { return (int8)(h >> (sizeof(size_t) * 8 - 7)); }
+
+/**
+ * open addressing hash table, the core of flat_hash_map and flat_hash_set
+ *   - Slots are split into groups of 16, the control bytes of a group are
+ *     matched at once. Groups are probed quadratically, and a probe stops at
+ *     a group with an empty slot.
+ *   - Slots and control bytes are in one allocation, an element is stored in
+ *     place, there is no node or pointer chasing.
+ *   - @S is the type stored, @T the type exposed, and @KeyOf gets the key of
+ *     a slot.
+ */
+template <typename K, typename S, typename T, typename KeyOf, typename Hash, typename Pred>
+class FlatTable {
+  public:
+    typedef K key_type;
+    typedef T value_type;
+    typedef size_t size_type;
+
+    template <bool C>
+    class Iter {
+      public:
+        typedef typename std::conditional<C, const T, T>::type V;
+        Iter() noexcept : _c(0), _s(0), _e(0) {}
+        Iter(const int8* c, S* s, const int8* e) noexcept : _c(c), _s(s), _e(e) { this->skip(); }
+        Iter(const Iter<false>& x) noexcept : _c(x._c), _s(x._s), _e(x._e) {}
+
+        V& operator*() const { return *(V*)_s; }
+        V* operator->() const { return (V*)_s; }
+        Iter& operator++() { ++_c; ++_s; this->skip(); return *this; }
+        Iter operator++(int) { Iter r(*this); ++*this; return r; }
+        bool operator==(const Iter& x) const { return _c == x._c; }
+        bool operator!=(const Iter& x) const { return _c != x._c; }
+
+      private:
+        template <typename, typename, typename, typename, typename, typename>
+        friend class FlatTable;
+        friend class Iter<true>;
+        void skip() { while (_c != _e && *_c < 0) { ++_c; ++_s; } }
+        const int8* _c;
+        S* _s;
+        const int8* _e;
+    };
+
+    typedef Iter<false> iterator;
+    typedef Iter<true> const_iterator;
+
+    FlatTable() noexcept : _ctrl(0), _slots(0), _cap(0), _size(0), _deleted(0) {}
+
+    ~FlatTable() { this->_destroy(); }
+
+    FlatTable(const FlatTable& x) : FlatTable() {
+        this->reserve(x._size);
+        for (auto it = x.begin(); it != x.end(); ++it) this->_insert_unique(*(const S*)&*it);
+    }
+
+    FlatTable(FlatTable&& x) noexcept
+        : _ctrl(x._ctrl), _slots(x._slots), _cap(x._cap), _size(x._size), _deleted(x._deleted) {
+        x._ctrl = 0;
+        x._slots = 0;
+        x._cap = x._size = x._deleted = 0;
+    }
+
+    FlatTable& operator=(const FlatTable& x) {
+        if (&x != this) { FlatTable t(x); this->swap(t); }
+        return *this;
+    }
+
+    FlatTable& operator=(FlatTable&& x) noexcept {
+        if (&x != this) { this->_destroy(); new (this) FlatTable(std::move(x)); }
+        return *this;
+    }
+
+    size_t size()         const { return _size; }
+    bool empty()          const { return _size == 0; }
+    size_t bucket_count() const { return _cap; }
+
+    iterator begin() { return iterator(_ctrl, _slots, _ctrl + _cap); }
+    iterator end()   { return iterator(_ctrl + _cap, _slots + _cap, _ctrl + _cap); }
+    const_iterator begin() const { return ((FlatTable*)this)->begin(); }
+    const_iterator end()   const { return ((FlatTable*)this)->end(); }
+
+    template <typename X>
+    iterator find(const X& key) {
+        const size_t i = this->_find(key, flat_mix(Hash()(key)));
+        return i != (size_t)-1 ? this->_at(i) : this->end();
+    }
+
+    template <typename X>
+    const_iterator find(const X& key) const {
+        return ((FlatTable*)this)->find(key);
+    }
+
+    template <typename X>
+    size_t count(const X& key) const {
+        return this->find(key) != this->end() ? 1 : 0;
+    }
+
+    template <typename X>
+    bool contains(const X& key) const { return this->count(key) != 0; }
+
+    // the element is not inserted if the key already exists
+    std::pair<iterator, bool> insert(const T& v) {
+        return this->_emplace(KeyOf()(*(const S*)&v), *(const S*)&v);
+    }
+
+    std::pair<iterator, bool> insert(T&& v) {
+        return this->_emplace(KeyOf()(*(const S*)&v), std::move(*(S*)&v));
+    }
+
+    // erase the element, return iterator of the next one
+    iterator erase(const_iterator it) {
+        const size_t i = it._c - _ctrl;
+        this->_erase(i);
+        return iterator(_ctrl + i + 1, _slots + i + 1, _ctrl + _cap);
+    }
+
+    iterator erase(iterator it) { return this->erase(const_iterator(it)); }
+
+    template <typename X>
+    size_t erase(const X& key) {
+        const size_t i = this->_find(key, flat_mix(Hash()(key)));
+        if (i == (size_t)-1) return 0;
+        this->_erase(i);
+        return 1;
+    }
+
+    // remove all elements, the memory is kept
+    void clear() {
+        for (size_t i = 0; i < _cap; ++i) {
+            if (_ctrl[i] >= 0) _slots[i].~S();
+        }
+        if (_ctrl) memset(_ctrl, kCtrlEmpty, _cap);
+        _size = _deleted = 0;
+    }
+
+    // make room for @n elements without rehash
+    void reserve(size_t n) {
+        size_t cap = kGroupSize;
+        while (cap - cap / 8 < n) cap <<= 1;
+        if (cap > _cap) this->_rehash(cap);
+    }
+
+    void swap(FlatTable& x) noexcept {
+        std::swap(_ctrl, x._ctrl);
+        std::swap(_slots, x._slots);
+        std::swap(_cap, x._cap);
+        std::swap(_size, x._size);
+        std::swap(_deleted, x._deleted);
+    }
+
+    void swap(FlatTable&& x) noexcept { x.swap(*this); }
+
+  protected:
+    iterator _at(size_t i) {
+        iterator it;
+        it._c = _ctrl + i;
+        it._s = _slots + i;
+        it._e = _ctrl + _cap;
+        return it;
+    }
+
+    // index of the key, or -1 if not found
+    template <typename X>
+    size_t _find(const X& key, size_t h) const {
+        if (_cap == 0) return (size_t)-1;
+        const int8 h2 = flat_h2(h);
+        const size_t mask = _cap / kGroupSize - 1;
+        for (size_t g = h & mask, n = 1;; g = (g + n++) & mask) {
+            const FlatGroup x(_ctrl + g * kGroupSize);
+            for (uint32 m = x.match(h2); m; m &= m - 1) {
+                const size_t i = g * kGroupSize + flat_ctz(m);
+                if (Pred()(KeyOf()(_slots[i]), key)) return i;
+            }
+            if (x.match_empty()) return (size_t)-1;
+        }
+    }
+
+    // find the key, or construct a slot with @args for it
+    template <typename X, typename... Args>
+    std::pair<iterator, bool> _emplace(const X& key, Args&&... args) {
+        const size_t h = flat_mix(Hash()(key));
+        size_t i = this->_find(key, h);
+        if (i != (size_t)-1) return std::make_pair(this->_at(i), false);
+        i = this->_prepare(h);
+        new (&_slots[i]) S(std::forward<Args>(args)...);
+        return std::make_pair(this->_at(i), true);
+    }
+
+    void _insert_unique(const S& v) {
+        const size_t i = this->_prepare(flat_mix(Hash()(KeyOf()(v))));
+        new (&_slots[i]) S(v);
+    }
+
+    // get a free slot for a new element with hash @h, grow if necessary
+    size_t _prepare(size_t h) {
+        const size_t growth = _cap - _cap / 8;
+        if (_size + _deleted >= growth) {
+            // rehash to the same size if many slots are deleted
+            this->_rehash(!_cap ? kGroupSize : _size < growth / 2 ? _cap : _cap * 2);
+        }
+        const size_t i = this->_find_free(h);
+        if (_ctrl[i] == kCtrlDeleted) --_deleted;
+        _ctrl[i] = flat_h2(h);
+        ++_size;
+        return i;
+    }
+
+    size_t _find_free(size_t h) const {
+        const size_t mask = _cap / kGroupSize - 1;
+        for (size_t g = h & mask, n = 1;; g = (g + n++) & mask) {
+            const uint32 m = FlatGroup(_ctrl + g * kGroupSize).match_free();
+            if (m) return g * kGroupSize + flat_ctz(m);
+        }
+    }
+
+    // a slot can be marked empty if its group has an empty slot, as probes
+    // stop at the group anyway, otherwise it is marked deleted
+    void _erase(size_t i) {
+        _slots[i].~S();
+        const size_t g = i & ~(size_t)(kGroupSize - 1);
+        if (FlatGroup(_ctrl + g).match_empty()) {
+            _ctrl[i] = kCtrlEmpty;
+        } else {
+            _ctrl[i] = kCtrlDeleted;
+            ++_deleted;
+        }
+        --_size;
+    }
+
+    void _rehash(size_t cap) {
+        int8* const c = _ctrl;
+        S* const s = _slots;
+        const size_t n = _cap;
+        this->_alloc(cap);
+        for (size_t i = 0; i < n; ++i) {
+            if (c[i] < 0) continue;
+            const size_t h = flat_mix(Hash()(KeyOf()(s[i])));
+            const size_t k = this->_find_free(h);
+            _ctrl[k] = flat_h2(h);
+            new (&_slots[k]) S(std::move(s[i]));
+            s[i].~S();
+        }
+        if (c) co::free(c, _bytes(n));
+    }
+
+    // control bytes are followed by the slots in the same block
+    static size_t _bytes(size_t cap) {
+        return god::align_up<16>(cap) + cap * sizeof(S);
+    }
+
+    void _alloc(size_t cap) {
+        _ctrl = (int8*) co::alloc(_bytes(cap));
+        _slots = (S*)(_ctrl + god::align_up<16>(cap));
+        memset(_ctrl, kCtrlEmpty, cap);
+        _cap = cap;
+        _deleted = 0;
+    }
+
+    void _destroy() {
+        if (_ctrl) {
+            this->clear();
+            co::free(_ctrl, _bytes(_cap));
+            _ctrl = 0;
+            _slots = 0;
+            _cap = 0;
+        }
+    }
+
+  protected:
+    int8* _ctrl;
+    S* _slots;
+    size_t _cap; // number of slots, 0 or a power of 2 >= 16
+    size_t _size;
+    size_t _deleted;
+};
+
+template <typename K, typename V>
+struct FlatMapKey {
+    const K& operator()(const std::pair<K, V>& x) const { return x.first; }
+};
+
+template <typename K>
+struct FlatSetKey {
+    const K& operator()(const K& x) const { return x; }
+};
+
+} // xx
+
+/**
+ * hash map with open addressing
+ *   - It is faster than co::hash_map (std::unordered_map) for lookups, and
+ *     uses less memory, as elements are stored in a flat array.
+ *   - Inserting may rehash and move the elements, which invalidates pointers,
+ *     references and iterators to them. Use co::hash_map if elements MUST
+ *     stay where they are.
+ *   - Erasing does not move other elements.
+ */
+template <
+    class K, class V,
+    class Hash = _Hash<K>,
+    class Pred = _Eq<K>
+>
+class flat_hash_map : public xx::FlatTable<
+    K, std::pair<K, V>, std::pair<const K, V>, xx::FlatMapKey<K, V>, Hash, Pred> {
+    typedef xx::FlatTable<
+        K, std::pair<K, V>, std::pair<const K, V>, xx::FlatMapKey<K, V>, Hash, Pred> _Base;
+
+  public:
+    typedef V mapped_type;
+    typedef typename _Base::iterator iterator;
+    typedef typename _Base::const_iterator const_iterator;
+
+    flat_hash_map() noexcept : _Base() {}
+
+    flat_hash_map(std::initializer_list<std::pair<const K, V>> v) : _Base() {
+        this->reserve(v.size());
+        for (auto& x : v) this->insert(x);
+    }
+
+    using _Base::insert;
+
+    template <typename Key, typename Val>
+    std::pair<iterator, bool> insert(Key&& key, Val&& val) {
+        return this->try_emplace(std::forward<Key>(key), std::forward<Val>(val));
+    }
+
+    // insert V(args...) if the key does not exist
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        return this->_emplace(key, std::piecewise_construct,
+            std::forward_as_tuple(std::forward<Key>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> emplace(Key&& key, Args&&... args) {
+        return this->try_emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+    }
+
+    V& operator[](const K& key) { return this->try_emplace(key).first->second; }
+    V& operator[](K&& key) { return this->try_emplace(std::move(key)).first->second; }
+};
+
+// hash set with open addressing, see flat_hash_map for details
+template <
+    class K,
+    class Hash = _Hash<K>,
+    class Pred = _Eq<K>
+>
+class flat_hash_set : public xx::FlatTable<K, K, const K, xx::FlatSetKey<K>, Hash, Pred> {
+    typedef xx::FlatTable<K, K, const K, xx::FlatSetKey<K>, Hash, Pred> _Base;
+
+  public:
+    typedef typename _Base::iterator iterator;
+
+    flat_hash_set() noexcept : _Base() {}
+
+    flat_hash_set(std::initializer_list<K> v) : _Base() {
+        this->reserve(v.size());
+        for (auto& x : v) this->insert(x);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        K k(std::forward<Args>(args)...);
+        return this->insert(std::move(k));
+    }
+};
+
+} // co
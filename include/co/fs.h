@@ -4,6 +4,7 @@
 #include "fastring.h"
 #include "fastream.h"
 #include "stl.h"
+#include <functional>
 
 namespace fs {
 
@@ -109,6 +110,13 @@ class __coapi file {
     static const int seek_cur = 1;
     static const int seek_end = 2;
 
+    // flags of open()
+    //   direct: bypass the page cache, O_DIRECT on linux, F_NOCACHE on mac and
+    //           FILE_FLAG_NO_BUFFERING on windows. The buffer, size and offset
+    //           of reads and writes MUST be aligned to direct_align then.
+    static const int direct = 1;
+    static const size_t direct_align = 4096;
+
     file() : _p(0) {}
     ~file();
 
@@ -138,10 +146,18 @@ class __coapi file {
 
     const char* path() const;
 
+  #ifdef _WIN32
+    // the underlying HANDLE, or INVALID_HANDLE_VALUE if the file is not opened
+    void* fd() const;
+  #else
+    // the underlying file descriptor, or -1 if the file is not opened
+    int fd() const;
+  #endif
+
     int64 size()  const { return fs::fsize (this->path()); }
     bool exists() const { return fs::exists(this->path()); }
 
-    bool open(const char* path, char mode);
+    bool open(const char* path, char mode, int flags=0);
 
     bool open(const fastring& path, char mode) {
         return this->open(path.c_str(), mode);
@@ -153,6 +169,12 @@ class __coapi file {
 
     void close();
 
+    // write data of the file to the disk, fdatasync() on linux
+    bool sync();
+
+    // change size of the file to @n bytes
+    bool truncate(int64 n);
+
     void seek(int64 off, int whence=seek_beg);
 
     size_t read(void* buf, size_t n);
@@ -184,13 +206,30 @@ class __coapi file {
 // open mode:
 //   'a': append       created if not exists
 //   'w': write        created if not exists, truncated if exists
+//
+// flags:
+//   async:  the full buffer is written by a background thread while the caller
+//           fills another one. flush() returns once the buffer is handed over,
+//           close() waits until all data is written.
+//   direct: the file is opened with fs::file::direct in mode 'w', data is
+//           written in aligned blocks, and the file is truncated to its size
+//           on close(). It is ignored in mode 'a', and the file is opened as
+//           usual if the file system does not support it.
 class __coapi fstream {
   public:
-    fstream() : _s(8192) {}
-    explicit fstream(size_t cap) : _s(cap) {}
+    static const int async = 1;
+    static const int direct = 2;
+
+    fstream() : _s(8192), _x(0) {}
+    explicit fstream(size_t cap) : _s(cap), _x(0) {}
 
     fstream(const char* path, char mode, size_t cap=8192)
-        : _s(cap), _f(path, mode == 'w' ? 'w' : 'a') {
+        : _s(cap), _f(path, mode == 'w' ? 'w' : 'a'), _x(0) {
+    }
+
+    fstream(const char* path, char mode, size_t cap, int flags)
+        : _s(cap), _x(0) {
+        this->open(path, mode, flags);
     }
 
     fstream(const fastring& path, char mode, size_t cap=8192)
@@ -202,7 +241,8 @@ class __coapi fstream {
     }
 
     fstream(fstream&& fs)
-        : _s(std::move(fs._s)), _f(std::move(fs._f)) {
+        : _s(std::move(fs._s)), _f(std::move(fs._f)), _x(fs._x) {
+        fs._x = 0;
     }
 
     ~fstream() {
@@ -210,11 +250,11 @@ class __coapi fstream {
     }
 
     explicit operator bool() const {
-        return (bool)_f;
+        return _x || (bool)_f;
     }
 
     bool operator!() const {
-        return !(bool)_f;
+        return !(bool)(*this);
     }
 
     bool open(const char* path, char mode) {
@@ -230,9 +270,17 @@ class __coapi fstream {
         return this->open(path.c_str(), mode);
     }
 
-    void reserve(size_t n) { _s.reserve(n); }
+    // open with flags, async or direct, see above
+    bool open(const char* path, char mode, int flags);
+
+    // call sync() of the file every time @n bytes are written, 0 for never.
+    // It is done in the background thread in async mode.
+    void sync_every(size_t n);
+
+    void reserve(size_t n) { if (!_x) _s.reserve(n); }
 
     void flush() {
+        if (_x) return this->_flush();
         if (!_s.empty()) {
             _f.write(_s.data(), _s.size());
             _s.clear();
@@ -240,6 +288,7 @@ class __coapi fstream {
     }
 
     void close() {
+        if (_x) return this->_close();
         this->flush();
         _f.close();
     }
@@ -249,7 +298,11 @@ class __coapi fstream {
     // n > cap                 ->   flush and write
     fstream& append(const void* s, size_t n) {
         if (_s.capacity() < _s.size() + n) this->flush();
-        n <= _s.capacity() ? ((void)_s.append(s, n)) : ((void)_f.write(s, n));
+        if (n <= _s.capacity()) {
+            _s.append(s, n);
+        } else {
+            _x ? this->_write(s, n) : (void)_f.write(s, n);
+        }
         return *this;
     }
 
@@ -276,13 +329,200 @@ class __coapi fstream {
         return *this;
     }
 
+  private:
+    void _flush();
+    void _close();
+    void _write(const void* s, size_t n);
+
   private:
     fastream _s;
     fs::file _f;
+    void* _x; // for flags and sync_every(), the file is moved there
 
     DISALLOW_COPY_AND_ASSIGN(fstream);
 };
 
+/**
+ * view of a file mapped into memory
+ *   - mode 'r' maps it read-only, the file MUST be opened for reading.
+ *   - mode 'w' maps it read/write, the file MUST be opened with '+'. Changes
+ *     are written back to the file, call sync() to flush them.
+ *   - @off needs no alignment, it is rounded down to the page boundary (the
+ *     allocation granularity on windows) internally.
+ *   - A view of 0 bytes is valid, data() is NULL then.
+ *   - NOTE: accessing the mapped memory after the file is truncated by others
+ *     raises SIGBUS, use fs::file::read() for files that may change in place.
+ */
+class __coapi mapped_view {
+  public:
+    // hints passed to madvise(), ignored on windows
+    enum advice_t {
+        normal = 0,
+        sequential = 1,
+        random = 2,
+        willneed = 3,
+        hugepage = 4,
+    };
+
+    mapped_view() : _base(0), _len(0), _p(0), _n(0), _ok(false) {}
+    ~mapped_view() { this->unmap(); }
+
+    // map @n bytes from @off of the file, to the end if n is -1
+    mapped_view(const file& f, char mode='r', int64 off=0, size_t n=(size_t)-1)
+        : _base(0), _len(0), _p(0), _n(0), _ok(false) {
+        this->map(f, mode, off, n);
+    }
+
+    mapped_view(mapped_view&& v) noexcept
+        : _base(v._base), _len(v._len), _p(v._p), _n(v._n), _ok(v._ok) {
+        v._base = 0;
+        v._len = v._n = 0;
+        v._p = 0;
+        v._ok = false;
+    }
+
+    mapped_view& operator=(mapped_view&& v) noexcept {
+        if (&v != this) {
+            this->unmap();
+            new (this) mapped_view(std::move(v));
+        }
+        return *this;
+    }
+
+    mapped_view(const mapped_view&) = delete;
+    void operator=(const mapped_view&) = delete;
+
+    explicit operator bool() const { return _ok; }
+    bool operator!() const { return !_ok; }
+
+    bool map(const file& f, char mode='r', int64 off=0, size_t n=(size_t)-1);
+
+    void unmap();
+
+    char* data() const { return _p; }
+    size_t size() const { return _n; }
+
+    // give the kernel a hint of how the memory will be accessed
+    bool advise(advice_t a) const;
+
+    // write changes of a read/write view back to the file
+    bool sync() const;
+
+  private:
+    void* _base;   // start of the mapping, aligned
+    size_t _len;   // length of the mapping
+    char* _p;      // _base + (off - aligned off)
+    size_t _n;
+    bool _ok;
+};
+
+/**
+ * file mapped into memory as a whole
+ *   - mode 'r': read-only, the file must exist.
+ *   - mode 'w': read/write, changes are written back to the file. The size of
+ *     the mapping is that of the file when it was opened.
+ *   - The data can be used directly, e.g. parsed by Json::parse_from(), or set
+ *     as the body of a http::Res, without copying it to a buffer.
+ *
+ *   fs::mmap_file m("index.dat");
+ *   if (m) m.advise(fs::mapped_view::willneed);
+ */
+class __coapi mmap_file {
+  public:
+    mmap_file() = default;
+    ~mmap_file() = default;
+
+    mmap_file(const char* path, char mode='r') {
+        this->open(path, mode);
+    }
+
+    mmap_file(const fastring& path, char mode='r')    : mmap_file(path.c_str(), mode) {}
+    mmap_file(const std::string& path, char mode='r') : mmap_file(path.c_str(), mode) {}
+
+    mmap_file(mmap_file&& m) noexcept
+        : _f(std::move(m._f)), _v(std::move(m._v)) {
+    }
+
+    mmap_file(const mmap_file&) = delete;
+    void operator=(const mmap_file&) = delete;
+
+    explicit operator bool() const { return (bool)_v; }
+    bool operator!() const { return !_v; }
+
+    bool open(const char* path, char mode='r') {
+        _v.unmap();
+        return _f.open(path, mode == 'w' ? '+' : 'r') && _v.map(_f, mode);
+    }
+
+    bool open(const fastring& path, char mode='r') {
+        return this->open(path.c_str(), mode);
+    }
+
+    bool open(const std::string& path, char mode='r') {
+        return this->open(path.c_str(), mode);
+    }
+
+    void close() {
+        _v.unmap();
+        _f.close();
+    }
+
+    const char* path() const { return _f.path(); }
+    char* data() const { return _v.data(); }
+    size_t size() const { return _v.size(); }
+
+    bool advise(mapped_view::advice_t a) const { return _v.advise(a); }
+    bool sync() const { return _v.sync(); }
+
+    const mapped_view& view() const { return _v; }
+
+  private:
+    fs::file _f;
+    mapped_view _v;
+};
+
+// entry found by fs::walk()
+struct entry {
+    fastring path; // path of the entry, the root joined with the name
+    int64 size;    // size of a file, -1 if it is not known, see walk() below
+    char type;     // 'f': file, 'd': dir, 'l': symlink, 'o': others, '?': unknown
+};
+
+// callback of fs::walk(), entries come in batches, return false to stop
+typedef std::function<bool(const entry* v, size_t n)> walk_cb_t;
+
+// flags of fs::walk()
+//   walk_recursive: walk into subdirectories, symlinks are not followed
+//   walk_size:      fill in the size of files, it is free on windows, while on
+//                   others it costs a fstatat() for each file
+const int walk_recursive = 1;
+const int walk_size = 2;
+
+/**
+ * walk through a directory, faster than fs::dir for large directories
+ *   - Types come with the entries, getdents64() is called with a large buffer
+ *     on linux, and FindFirstFileEx() with FIND_FIRST_EX_LARGE_FETCH on
+ *     windows. No stat() is needed, unless the file system does not report
+ *     the type.
+ *   - Entries are passed to @f in batches of up to @batch entries, once a
+ *     batch is full or a directory is done.
+ *   - Directories are scanned with @threads threads, @f is called from them
+ *     concurrently if threads > 1.
+ *   - NOTE: . and .. are ignored.
+ *
+ * @return  false if @path can't be opened, or @f returned false.
+ */
+__coapi bool walk(
+    const char* path, const walk_cb_t& f, int flags=walk_recursive,
+    int threads=1, size_t batch=256
+);
+
+inline bool walk(
+    const fastring& path, const walk_cb_t& f, int flags=walk_recursive,
+    int threads=1, size_t batch=256) {
+    return fs::walk(path.c_str(), f, flags, threads, batch);
+}
+
 class __coapi dir {
   public:
     dir() : _p(0) {}
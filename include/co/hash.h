@@ -2,7 +2,9 @@
 
 #include "def.h"
 #include "hash/murmur_hash.h"
+#include "hash/wyhash.h"
 #include "hash/crc16.h"
+#include "hash/crc32c.h"
 #include "hash/md5.h"
 #include "hash/sha256.h"
 #include "hash/base64.h"
@@ -11,6 +13,9 @@
 
 /**
  * 64 bit hash 
+ *   - It is murmur hash, the value is kept stable as it may be stored by users.
+ *     For hash tables, wyhash64() in co/hash/wyhash.h is faster, and it is used
+ *     by std::hash<fastring> and co::hash_map with string keys.
  *
  * @param s  a pointer to the data, it may not work on some systems if s is not 
  *           8-byte aligned.
@@ -4,6 +4,7 @@
 
 /**
  * base64 encode 
+ *   - SIMD (AVX2 or NEON) is used for large inputs if it is available. 
  * 
  * @param s  a pointer to the data to be encoded.
  * @param n  size of the data.
@@ -17,6 +18,7 @@ __coapi fastring base64_encode(const void* s, size_t n);
  *   - This function will return an empty string in two cases:
  *     - Size of the input data is 0. 
  *     - The input data is not a valid base64-encoded string. 
+ *   - "\r\n" is allowed after any 4 characters, as in MIME. 
  * 
  * @param s  a pointer to the data to be decoded.
  * @param n  size of the data.
@@ -25,6 +27,45 @@ __coapi fastring base64_encode(const void* s, size_t n);
  */
 __coapi fastring base64_decode(const void* s, size_t n);
 
+/**
+ * base64 encode into a buffer 
+ * 
+ * @param buf  a buffer with at least base64_encode_size(n) bytes.
+ * 
+ * @return     number of characters written, no '\0' is appended.
+ */
+__coapi size_t base64_encode(const void* s, size_t n, char* buf);
+
+/**
+ * base64 decode into a buffer 
+ * 
+ * @param buf  a buffer with at least base64_decode_size(n) bytes.
+ * 
+ * @return     number of bytes written, or (size_t)-1 on any error.
+ */
+__coapi size_t base64_decode(const void* s, size_t n, char* buf);
+
+/**
+ * base64url (RFC 4648 §5), '-' and '_' are used instead of '+' and '/' 
+ *   - The encoder does not append the padding '='. 
+ *   - The decoder accepts input with or without the padding. 
+ *   - The buffer versions work the same way as base64_encode/base64_decode. 
+ */
+__coapi fastring base64url_encode(const void* s, size_t n);
+__coapi fastring base64url_decode(const void* s, size_t n);
+__coapi size_t base64url_encode(const void* s, size_t n, char* buf);
+__coapi size_t base64url_decode(const void* s, size_t n, char* buf);
+
+// max size of the result of encoding @n bytes
+inline size_t base64_encode_size(size_t n) {
+    return (n + 2) / 3 * 4;
+}
+
+// max size of the result of decoding @n characters
+inline size_t base64_decode_size(size_t n) {
+    return n / 4 * 3 + 2;
+}
+
 inline fastring base64_encode(const char* s) {
     return base64_encode(s, strlen(s));
 }
@@ -48,3 +89,27 @@ inline fastring base64_decode(const fastring& s) {
 inline fastring base64_decode(const std::string& s) {
     return base64_decode(s.data(), s.size());
 }
+
+inline fastring base64url_encode(const char* s) {
+    return base64url_encode(s, strlen(s));
+}
+
+inline fastring base64url_encode(const fastring& s) {
+    return base64url_encode(s.data(), s.size());
+}
+
+inline fastring base64url_encode(const std::string& s) {
+    return base64url_encode(s.data(), s.size());
+}
+
+inline fastring base64url_decode(const char* s) {
+    return base64url_decode(s, strlen(s));
+}
+
+inline fastring base64url_decode(const fastring& s) {
+    return base64url_decode(s.data(), s.size());
+}
+
+inline fastring base64url_decode(const std::string& s) {
+    return base64url_decode(s.data(), s.size());
+}
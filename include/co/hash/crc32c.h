@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../fastring.h"
+
+/**
+ * crc32c, CRC-32 with the Castagnoli polynomial (as used by iSCSI, ext4, etc.) 
+ *   - It is done with the crc32 instruction of SSE4.2 (checked at runtime) on 
+ *     x86_64, or the CRC extension of ARMv8 if it is enabled at compile time. 
+ *     Large buffers are split into 3 parts to be done in parallel. 
+ *   - Otherwise it is done in software, 8 bytes at a time with tables. 
+ * 
+ * @param s    a pointer to the data.
+ * @param n    size of the data.
+ * @param crc  crc32c of the data before, 0 for the beginning. 
+ *             crc32c(b, m, crc32c(a, n)) == crc32c of a + b.
+ */
+__coapi uint32 crc32c(const void* s, size_t n, uint32 crc);
+
+inline uint32 crc32c(const void* s, size_t n) {
+    return crc32c(s, n, 0);
+}
+
+inline uint32 crc32c(const char* s) {
+    return crc32c(s, strlen(s));
+}
+
+inline uint32 crc32c(const fastring& s) {
+    return crc32c(s.data(), s.size());
+}
+
+inline uint32 crc32c(const std::string& s) {
+    return crc32c(s.data(), s.size());
+}
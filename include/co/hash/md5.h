@@ -66,6 +66,18 @@ inline fastring md5digest(const std::string& s) {
     return md5digest(s.data(), s.size());
 }
 
+/**
+ * md5 of @k messages 
+ *   - With AVX2, 8 messages are hashed in parallel, which is several times 
+ *     faster than calling md5digest() one by one for many messages. 
+ * 
+ * @param s    pointers to the messages.
+ * @param n    sizes of the messages.
+ * @param k    number of messages.
+ * @param res  16-byte results of the messages, 16 * k bytes in total.
+ */
+__coapi void md5digest_multi(const void* const* s, const size_t* n, size_t k, char* res);
+
 
 // md5sum, result is stored in @res.
 __coapi void md5sum(const void* s, size_t n, char res[32]);
@@ -4,6 +4,9 @@
 
 /**
  * generate a nanoid with default symbols
+ *   - Random bytes come from co::thread_rand(), which is fast but NOT 
+ *     cryptographically secure. Use secure_nanoid() for IDs that must not be 
+ *     guessed, e.g. session IDs or tokens. 
  * 
  * @param n  length of the nanoid (>0), 15 by default
  */
@@ -30,3 +33,23 @@ inline fastring nanoid(const std::string& s, int n) {
 inline fastring nanoid(const char* s, int n) {
     return nanoid(s, strlen(s), n);
 }
+
+/**
+ * generate a nanoid with random bytes from the CSPRNG of the system 
+ *   - It works the same as nanoid(), but it is slower. 
+ *   - An empty string is returned if the system fails to give random bytes. 
+ */
+__coapi fastring secure_nanoid(int n=15);
+__coapi fastring secure_nanoid(const char* s, size_t len, int n);
+
+inline fastring secure_nanoid(const fastring& s, int n) {
+    return secure_nanoid(s.data(), s.size(), n);
+}
+
+inline fastring secure_nanoid(const std::string& s, int n) {
+    return secure_nanoid(s.data(), s.size(), n);
+}
+
+inline fastring secure_nanoid(const char* s, int n) {
+    return secure_nanoid(s, strlen(s), n);
+}
@@ -0,0 +1,87 @@
+/*
+ * wyhash from https://github.com/wangyi-fudan/wyhash, final version 4.
+ * Written by Wang Yi, and is released into the public domain (The Unlicense).
+ */
+
+#pragma once
+
+#include "../def.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+/**
+ * 64 bit wyhash
+ *   - It is much faster than murmur hash for both short and long keys, and
+ *     passes SMHasher. It is not a cryptographic hash.
+ *   - It reads the data with memcpy, so @s need not be aligned. It does not
+ *     produce the same results on little-endian and big-endian machines.
+ *
+ * @param s     a pointer to the data.
+ * @param n     size of the data.
+ * @param seed  seed of the hash.
+ */
+__coapi uint64 wyhash64(const void* s, size_t n, uint64 seed);
+
+inline uint64 wyhash64(const void* s, size_t n) {
+    return wyhash64(s, n, 0);
+}
+
+// 32 bit wyhash, the lower 32 bit of wyhash64
+inline uint32 wyhash32(const void* s, size_t n, uint64 seed=0) {
+    return (uint32) wyhash64(s, n, seed);
+}
+
+// 128 bit product of a and b, a gets the lower 64 bit and b the higher
+inline void wymum(uint64* a, uint64* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64)r;
+    *b = (uint64)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    const uint64 ha = *a >> 32, hb = *b >> 32, la = (uint32)*a, lb = (uint32)*b;
+    const uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64 t = rl + (rm0 << 32);
+    uint64 c = t < rl;
+    const uint64 lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+// xor of the 2 halves of the 128 bit product
+inline uint64 wymix(uint64 a, uint64 b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+// platform-specific wyhash, a size_t value, see also murmur_hash()
+inline size_t wyhash(const void* s, size_t n) {
+    return (size_t) wyhash64(s, n, 0);
+}
+
+/**
+ * streaming wyhash
+ *   - The result is the same as wyhash64() of all the data updated.
+ *
+ *   wyhash_ctx_t c;
+ *   wyhash_init(&c, seed);
+ *   wyhash_update(&c, s, n);  // may be called many times
+ *   uint64 h = wyhash_final(&c);
+ */
+typedef struct {
+    uint64 s[3];     // seeds of the 3 lanes
+    uint64 len;      // bytes updated
+    uint32 n;        // bytes pending in buf + 16
+    uint8 buf[64];   // the last 16 bytes processed, followed by bytes pending
+} wyhash_ctx_t;
+
+__coapi void wyhash_init(wyhash_ctx_t* ctx, uint64 seed=0);
+__coapi void wyhash_update(wyhash_ctx_t* ctx, const void* s, size_t n);
+__coapi uint64 wyhash_final(const wyhash_ctx_t* ctx);
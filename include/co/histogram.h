@@ -0,0 +1,83 @@
+#pragma once
+
+#include "def.h"
+#include "json.h"
+
+namespace co {
+
+/**
+ * histogram of uint64 values with log-linear buckets, like HdrHistogram
+ *   - Values below 32 have a bucket each, larger values are put in 32 buckets
+ *     for each power of 2, so a value is reported with an error below 1/32.
+ *     There are 1920 buckets covering the whole range of uint64.
+ *   - record() is lock-free, threads record to different shards of counters,
+ *     shards are allocated on first use. Queries sum up the shards, they may
+ *     miss values being recorded at the same time.
+ *   - Values have no unit, instrumentation in co records microseconds.
+ *
+ *   co::Histogram h;
+ *   Timer t(true);
+ *   work();
+ *   h.record(t.us());
+ *   LOG << "p99: " << h.percentile(99) << " us";
+ */
+class __coapi Histogram {
+  public:
+    enum {
+        sub_bits = 5,
+        buckets = (64 - sub_bits + 1) << sub_bits,
+    };
+
+    // @shards: number of shards, 1 if only a single thread records values
+    explicit Histogram(uint32 shards=8);
+    ~Histogram();
+
+    Histogram(Histogram&& h) : _p(h._p) { h._p = 0; }
+    Histogram(const Histogram&) = delete;
+    void operator=(const Histogram&) = delete;
+
+    // record @n times of value @v
+    void record(uint64 v, uint64 n=1);
+
+    // add values of @h to this histogram
+    void merge(const Histogram& h);
+
+    // clear all values, not safe with record() at the same time
+    void reset();
+
+    uint64 count() const;
+    uint64 sum() const;
+    uint64 min() const; // 0 if empty
+    uint64 max() const;
+    double mean() const;
+
+    // the value at percentile @p in [0, 100], 0 if empty
+    uint64 percentile(double p) const;
+
+    // values at percentiles ps[0..n), from one snapshot of the counters
+    void percentiles(const double* ps, uint64* out, size_t n) const;
+
+    /**
+     * serialize to json
+     *   {"count":n,"sum":s,"min":a,"max":b,"mean":m,"p50":..,"p90":..,"p99":..,
+     *    "p999":..,"buckets":[[v,n],...]}
+     *   - @buckets: if true, nonempty buckets are written as pairs of the lowest
+     *     value in the bucket and the count, for from_json().
+     */
+    Json to_json(bool buckets=true) const;
+
+    // add values from the json made by to_json(true), false on bad input
+    bool from_json(const Json& x);
+
+    // index of the bucket for value @v
+    static uint32 bucket_of(uint64 v);
+
+    // the lowest and highest values in bucket @i
+    static uint64 bucket_low(uint32 i);
+    static uint64 bucket_high(uint32 i);
+
+  private:
+    void* _p;
+};
+
+} // co
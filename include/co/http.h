@@ -1,8 +1,11 @@
 #pragma once
 
 #include "fastring.h"
+#include "./co/sock.h"
 #include <functional>
 
+namespace co { class iobuf; class Histogram; enum sched_policy_t : int; }
+
 namespace http {
 
 /**
@@ -19,6 +22,9 @@ struct curl_ctx_t;
  * http client for coroutine programming
  *   - NOTE: It will not url-encode the url passed in. Call url_encode() in 
  *     co/hash/url.h to encode the url if necessary.
+ *   - On linux, requests of all clients in a scheduler are driven by one curl 
+ *     multi handle, which shares the connection cache, unless http_curl_multi 
+ *     is false. curl_easy_perform() is used otherwise.
  */
 class __coapi Client {
   public:
@@ -30,6 +36,8 @@ class __coapi Client {
      *     with [] to distinguish it from the port.
      *   - eg.
      *     "github.com"   "https://github.com"   "http://127.0.0.1:7777"   "http://[::1]:8888"
+     *   - "unix:/path" or "http://unix:/path" for a unix domain socket, "unix:@name" 
+     *     is in the abstract namespace of linux. The Host header is "localhost".
      *
      * @param serv_url  server url in a form of "protocol://host:port".
      *                  - protocol:  http or https.
@@ -194,6 +202,7 @@ class __coapi Client {
   private:
     void append_header(const char* s);
     const char* make_url(const char* url);
+    void resolve();
 
   private:
     curl_ctx_t* _ctx;
@@ -204,12 +213,13 @@ class __coapi Client {
  * ===========================================================================
  * HTTP server 
  *   - openssl required for https. 
- *   - only support HTTP/1.0 & HTTP/1.1 at this moment. 
+ *   - support HTTP/1.0, HTTP/1.1 and HTTP/2. HTTP/2 is negotiated by ALPN on 
+ *     https, or used with prior knowledge (h2c) on http. 
  * ===========================================================================
  */
 
 enum Version {
-    kHTTP10, kHTTP11,
+    kHTTP10, kHTTP11, kHTTP20,
 };
 
 enum Method {
@@ -219,6 +229,37 @@ enum Method {
 struct http_req_t;
 struct http_res_t;
 
+/**
+ * a piece of a string, which is not null-terminated 
+ *   - Params captured by http::Router point to the url of the request, they are 
+ *     valid until the request is done. 
+ */
+class Param {
+  public:
+    Param() : _s(""), _n(0) {}
+    Param(const char* s, size_t n) : _s(s), _n(n) {}
+
+    const char* data() const { return _s; }
+    size_t size()      const { return _n; }
+    bool empty()       const { return _n == 0; }
+    fastring str()     const { return fastring(_s, _n); }
+
+    bool operator==(const char* s) const {
+        return strlen(s) == _n && memcmp(_s, s, _n) == 0;
+    }
+
+    bool operator==(const fastring& s) const {
+        return s.size() == _n && memcmp(_s, s.data(), _n) == 0;
+    }
+
+    bool operator!=(const char* s) const { return !(*this == s); }
+    bool operator!=(const fastring& s) const { return !(*this == s); }
+
+  private:
+    const char* _s;
+    size_t _n;
+};
+
 class __coapi Req {
   public:
     Req() : _p(0) {}
@@ -245,6 +286,12 @@ class __coapi Req {
     // get length of the body
     size_t body_size() const { return ((uint32*)_p)[3]; }
 
+    // get a parameter or wildcard of the path, captured by http::Router
+    //   - For the route "/users/:id/*file", the url "/users/7/a/b.txt" has
+    //     "id" of "7", and "file" of "a/b.txt".
+    //   - An empty Param is returned if there is no such name.
+    Param param(const char* name) const;
+
   private:
     http_req_t* _p;
 };
@@ -278,14 +325,125 @@ class __coapi Res {
     void set_body(const char* s) { this->set_body(s, strlen(s)); }
     void set_body(const fastring& s) { this->set_body(s.data(), s.size()); }
 
+    /**
+     * set body of the response without copying it 
+     *   - The headers and the body are sent together by sendv(). 
+     *   - NOTE: the memory MUST be valid until the response was sent, after the 
+     *     callback returns. It may be a static or long-lived content. 
+     */
+    void set_body_ref(const void* s, size_t n);
+    void set_body_ref(const fastring& s) { this->set_body_ref(s.data(), s.size()); }
+
+    /**
+     * use a co::iobuf as body of the response 
+     *   - The segments are sent after the headers by sendv() without copy, the 
+     *     iobuf is moved into the response, or shares the blocks if copied. 
+     *   - It is not compressed, and it is copied to one buffer on HTTP/2. 
+     */
+    void set_body(co::iobuf&& b);
+    void set_body(const co::iobuf& b);
+
+    /**
+     * use a file as body of the response 
+     *   - The file is sent by co::sendfile() on normal TCP connections, so that 
+     *     the data will not be copied to the user space. On SSL connections, it 
+     *     is read and sent block by block, unless kTLS is used (FLG_ssl_ktls). 
+     *   - It is better for large files than set_body(). 
+     * 
+     * @return  false if the file can't be opened. 
+     */
+    bool set_file(const char* path);
+    bool set_file(const fastring& path) { return this->set_file(path.c_str()); }
+
   private:
     http_res_t* _p;
 };
 
+/**
+ * reader of a request body, for the handler set by Server::on_stream() 
+ *   - The body is received from the connection as it is read, so that the 
+ *     handler can start work early, and memory used is bounded by the buffer 
+ *     of the connection, whatever the size of the body is. 
+ *   - Chunked bodies are decoded chunk by chunk, trailing headers are added 
+ *     to the request when the end of the body is read. 
+ *   - "100 Continue" is sent on the first read if the client expects it. 
+ *   - The rest of the body not read by the handler is discarded after it returns, 
+ *     or the connection is closed if there is more than http_max_body_size. 
+ */
+class __coapi BodyReader {
+  public:
+    /**
+     * read at most n bytes of the body into buf 
+     *   - It waits at most http_recv_timeout ms for data. 
+     * 
+     * @return  bytes read, 0 at the end of the body, or -1 on errors, e.g. the 
+     *          connection was closed, timeout or invalid chunked data. 
+     */
+    int read(void* buf, size_t n);
+
+    // whether the end of the body was read
+    bool done() const;
+
+  private:
+    friend class ServerImpl;
+    explicit BodyReader(void* p) : _p(p) {}
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(BodyReader);
+};
+
+/**
+ * path router for http::Server 
+ *   - Paths are matched segment by segment, the query string is ignored. A 
+ *     segment of a route may be a literal, a parameter ":name" that matches 
+ *     any one segment, or a wildcard "*name" at the end that matches the rest 
+ *     of the path. Literals are tried first, then parameters and wildcards. 
+ *   - Empty segments are ignored, "/a//b/" matches the route "/a/b". 
+ *   - HEAD requests are handled by the GET route if there is no HEAD route. 
+ *   - 404 is responded if no route matches the path, or 405 with an Allow 
+ *     header if routes match the path for other methods only. 
+ *   - Routes MUST be added before the server starts, the router is only read 
+ *     by the server, no lock is needed. 
+ */
+class __coapi Router {
+  public:
+    typedef std::function<void(const Req&, Res&)> F;
+
+    Router();
+    ~Router();
+
+    // add a route, it will be CHECK failed if the path is invalid
+    Router& on(Method m, const char* path, F&& f);
+
+    Router& on(Method m, const char* path, const F& f) {
+        return this->on(m, path, F(f));
+    }
+
+    Router& get(const char* path, F&& f)     { return this->on(kGet, path, std::move(f)); }
+    Router& head(const char* path, F&& f)    { return this->on(kHead, path, std::move(f)); }
+    Router& post(const char* path, F&& f)    { return this->on(kPost, path, std::move(f)); }
+    Router& put(const char* path, F&& f)     { return this->on(kPut, path, std::move(f)); }
+    Router& del(const char* path, F&& f)     { return this->on(kDelete, path, std::move(f)); }
+    Router& options(const char* path, F&& f) { return this->on(kOptions, path, std::move(f)); }
+
+    // find the route for the request and call it, no memory is allocated
+    void operator()(const Req& req, Res& res) const;
+
+  private:
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(Router);
+};
+
 /**
  * http server based on coroutine 
  *   - support both http and https, openssl required for https. 
  *   - support both ipv4 and ipv6. 
+ *   - If http_compress is true, bodies of responses are compressed by the 
+ *     Accept-Encoding of the requests, with gzip, br or zstd, which requires the 
+ *     library built with zlib, brotli or zstd. Bodies with a Content-Encoding 
+ *     set by the user are sent as they are. Files set by Res::set_file() are 
+ *     compressed on the fly if the Content-Type is text, json, xml, etc. 
  *   - NOTE: http::Server will not url-decode the url in the request. The user may 
  *     call url_decode() in co/hash/url.h to decode the url, if necessary. 
  */
@@ -317,11 +475,73 @@ class __coapi Server {
         return on_req(std::bind(f, o, std::placeholders::_1, std::placeholders::_2));
     }
 
+    /**
+     * handle http requests by a router 
+     *   - NOTE: the router is referenced, it MUST be alive while the server is running. 
+     */
+    Server& on_req(const Router& r) {
+        const Router* const p = &r;
+        return on_req([p](const Req& req, Res& res) { (*p)(req, res); });
+    }
+
+    /**
+     * set a callback that reads bodies of requests by itself, instead of on_req() 
+     *   - Bodies are not buffered, Req::body() is empty, and the callback reads 
+     *     them by the BodyReader. See BodyReader for details. 
+     *   - http_max_body_size does not limit the size of bodies read this way. 
+     *   - On HTTP/2, bodies are buffered as before, and read from memory. 
+     * 
+     *   serv.on_stream([](const http::Req& req, http::BodyReader& b, http::Res& res) {
+     *       char buf[8192];
+     *       for (int n; (n = b.read(buf, sizeof(buf))) > 0;) file.write(buf, n);
+     *       res.set_status(b.done() ? 200 : 400);
+     *   });
+     */
+    Server& on_stream(std::function<void(const Req&, BodyReader&, Res&)>&& f);
+
+    /**
+     * cache responses of GET and HEAD requests to a path for a short time 
+     *   - Cached responses, headers and the body, are sent without calling the 
+     *     req callback. Only 200 responses set by Res::set_body() are cached, 
+     *     except those with Set-Cookie or "Cache-Control: no-store". 
+     *   - Responses are keyed by the method and url (with the query string), and 
+     *     values of headers in @vary, Accept-Encoding and Connection. 
+     *   - Concurrent requests missing the cache are coalesced, the req callback 
+     *     is called once, and others wait for its response. 
+     *   - At most http_cache_size responses are cached for the server. 
+     *   - Responses on HTTP/2 are not cached. 
+     * 
+     *   // "/hot", and paths starting with "/static"
+     *   serv.cache("/hot", 500).cache("/static*", 3000, "Accept-Language");
+     * 
+     * @param path    path of requests, a trailing '*' matches any path with the prefix.
+     * @param ttl_ms  time to live of the responses in milliseconds.
+     * @param vary    comma-separated names of headers the response depends on.
+     */
+    Server& cache(const char* path, uint32 ttl_ms, const char* vary="");
+
+    /**
+     * limit connections of the server, see tcp::Server::limit() 
+     *   - Connections rejected get a 503 response before any request is read, 
+     *     they are reset for https. 
+     */
+    Server& limit(uint32 max_conn, uint32 accept_rate=0);
+
+    /**
+     * set a load-shedding callback, see tcp::Server::on_admit() 
+     *   - Connections rejected are handled the same as limit(). 
+     */
+    Server& on_admit(std::function<bool(sock_t)>&& f);
+
+    // choose schedulers for new connections, see tcp::Server::sched_policy()
+    Server& sched_policy(co::sched_policy_t p);
+
     /**
      * start a http server 
      *   - It will not block the calling thread. 
      * 
      * @param ip    server ip, either an ipv4 or ipv6 address, default: "0.0.0.0".
+     *              "unix:/path" for a unix domain socket, see tcp::Server::start().
      * @param port  server port, default: 80.
      */
     void start(const char* ip="0.0.0.0", int port=80);
@@ -331,7 +551,7 @@ class __coapi Server {
      *   - openssl required by this method. 
      *   - It will not block the calling thread. 
      * 
-     * @param ip    server ip, either an ipv4 or ipv6 address.
+     * @param ip    server ip, either an ipv4 or ipv6 address, or "unix:/path".
      * @param port  server port.
      * @param key   path of the private key file for ssl.
      * @param ca    path of the certificate file for ssl.
@@ -346,12 +566,141 @@ class __coapi Server {
      */
     void exit();
 
+    // time in microseconds of the req callback, valid until the server exits
+    const co::Histogram& histogram() const;
+
   private:
     void* _p;
 
     DISALLOW_COPY_AND_ASSIGN(Server);
 };
 
+/**
+ * ===========================================================================
+ * native HTTP/1.1 client 
+ *   - libcurl is not required, openssl required for https. 
+ * ===========================================================================
+ */
+
+// a request for http::Agent
+struct Request {
+    Request() : method(kGet), body(0), body_size(0) {}
+    Request(Method m, const char* u) : method(m), url(u), body(0), body_size(0) {}
+
+    // add a header, "Host" and "Content-Length" are added by the agent
+    void add_header(const char* k, const char* v) {
+        header << k << ": " << v << "\r\n";
+    }
+
+    // set the body, it is referenced, not copied
+    void set_body(const void* s, size_t n) { body = (const char*)s; body_size = n; }
+    void set_body(const fastring& s) { this->set_body(s.data(), s.size()); }
+
+    Method method;
+    fastring url;    // path and query, e.g. "/users/7?x=1"
+    fastring header; // headers, "k: v\r\n"
+    const char* body;
+    size_t body_size;
+};
+
+// a response received by http::Agent
+class __coapi Response {
+  public:
+    Response();
+    ~Response();
+
+    Response(const Response&) = delete;
+    void operator=(const Response&) = delete;
+
+    // status code, 0 if no response was received
+    int status() const;
+
+    // return a null-terminated value of the header, empty if not found
+    const char* header(const char* key) const;
+
+    // body of the response, which may be not null-terminated
+    const char* body() const;
+    size_t body_size() const;
+
+  private:
+    void* _p;
+    friend class Agent;
+};
+
+/**
+ * http client for a host, with a keep-alive connection pool 
+ *   - One agent for a host is shared by coroutines, in any thread. Connections 
+ *     are kept in a co::Pool, each thread has its own idle connections. 
+ *   - A request, except POST, is retried once on a new connection, if a pooled 
+ *     connection was closed by the server before the response began. 
+ *   - Requests are sent with the timeouts http_conn_timeout and http_timeout. 
+ *   - NOTE: methods MUST be called in coroutines. The agent MUST be alive 
+ *     while requests are performed. 
+ * 
+ *   - usage:
+ *     static http::Agent a("http://127.0.0.1:8080");
+ *     http::Response res;
+ *     if (a.get("/hello", res) && res.status() == 200) ...
+ */
+class __coapi Agent {
+  public:
+    /**
+     * @param serv_url  "http://host[:port]" or "https://host[:port]", a host 
+     *                  without scheme is for http. "http://unix:/path" or 
+     *                  "unix:/path" for a unix domain socket, "unix:@name" in the 
+     *                  abstract namespace of linux, the Host header is "localhost".
+     */
+    explicit Agent(const char* serv_url);
+    ~Agent();
+
+    /**
+     * perform a request 
+     * 
+     * @return  true if a response was received, false on error or timeout.
+     */
+    bool perform(const Request& req, Response& res);
+
+    /**
+     * perform n requests on one connection by pipelining 
+     *   - All requests are sent before the responses are read, in order. 
+     * 
+     * @return  true if all responses were received.
+     */
+    bool pipeline(const Request* req, Response* res, size_t n);
+
+    bool get(const char* url, Response& res) {
+        return this->perform(Request(kGet, url), res);
+    }
+
+    bool head(const char* url, Response& res) {
+        return this->perform(Request(kHead, url), res);
+    }
+
+    bool del(const char* url, Response& res) {
+        return this->perform(Request(kDelete, url), res);
+    }
+
+    bool post(const char* url, const void* s, size_t n, Response& res) {
+        Request r(kPost, url);
+        r.set_body(s, n);
+        return this->perform(r, res);
+    }
+
+    bool put(const char* url, const void* s, size_t n, Response& res) {
+        Request r(kPut, url);
+        r.set_body(s, n);
+        return this->perform(r, res);
+    }
+
+    // close idle connections in pools of all threads
+    void close();
+
+  private:
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(Agent);
+};
+
 } // http
 
 namespace so {
@@ -359,6 +708,11 @@ namespace so {
 /**
  * start a static http server 
  *   - This function will block the calling thread. 
+ *   - Small files are cached in memory, and reloaded when they are modified. 
+ *   - ETag and Last-Modified are sent with files, and conditional requests by 
+ *     If-None-Match or If-Modified-Since are answered with 304 if not modified. 
+ *     If http_compress is true, text files are compressed with the best level 
+ *     once for each coding, and the compressed forms are cached with them. 
  * 
  * @param root_dir  docroot, default: the current directory.
  * @param ip        server ip, either an ipv4 or ipv6 address, default: "0.0.0.0"
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "def.h"
+#include "fastring.h"
+
+namespace co {
+
+/**
+ * intern a string
+ *   - Return a pointer to a null-terminated copy of [p, p + n), strings with
+ *     the same contents get the same pointer, so interned strings can be
+ *     compared by pointer.
+ *   - The copy is never freed, the pointer is valid until the program exits.
+ *     Do not intern strings of unbounded variety, e.g. values from the user.
+ *   - The hash and size of the string are stored before it, see intern_hash()
+ *     and intern_size().
+ *   - It is thread-safe. The global table is sharded by hash, and each thread
+ *     caches the strings it has looked up recently, so repeated strings are
+ *     found without locking.
+ */
+__coapi const char* intern(const void* p, size_t n);
+
+inline const char* intern(const char* s) {
+    return co::intern(s, strlen(s));
+}
+
+inline const char* intern(const fastring& s) {
+    return co::intern(s.data(), s.size());
+}
+
+// hash of a string returned by intern(), the same as wyhash32() of the contents
+inline uint32 intern_hash(const char* s) {
+    return ((const uint32*)s)[-2];
+}
+
+// size of a string returned by intern()
+inline uint32 intern_size(const char* s) {
+    return ((const uint32*)s)[-1];
+}
+
+// number of strings interned
+__coapi size_t intern_num();
+
+} // co
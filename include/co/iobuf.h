@@ -0,0 +1,138 @@
+#pragma once
+
+#include "def.h"
+#include "fastring.h"
+#include "./co/sock.h"
+
+namespace co {
+
+/**
+ * chained buffer for network I/O
+ *   - Data is stored in a list of segments, each references a part of a block.
+ *     Appending an iobuf to another, or cutting a part from the front, moves or
+ *     shares the segments, the data is not copied.
+ *   - Blocks are reference counted, a copy of an iobuf shares the blocks with
+ *     the original. A block is only written when it is not shared.
+ *   - A segment may also reference memory of the user by append_ref(), which
+ *     MUST be valid until the data was sent, or a fastring moved into it.
+ *   - Segments are sent together by tcp::Connection::send() with sendv(), see
+ *     also to_iov().
+ *   - An iobuf is not thread-safe, though copies of it can be used in different
+ *     threads. A zero-filled iobuf is a valid empty one.
+ */
+class __coapi iobuf {
+  public:
+    // size of blocks allocated by append(), the block header included
+    static const uint32 kBlockSize = 8192;
+
+    struct Block {
+        uint32 refs;
+        uint32 cap;  // capacity of data
+        uint32 used; // bytes written to data
+        uint32 own;  // data follows the header if 1, or it is adopted from a fastring
+        char* data;
+    };
+
+    // a segment, [p, p + n) in block b, or memory of the user if b is NULL.
+    // Segments are never empty.
+    struct Ref {
+        Block* b;
+        const char* p;
+        size_t n;
+    };
+
+    constexpr iobuf() noexcept : _refs(0), _n(0), _cap(0), _size(0) {}
+    ~iobuf() { this->reset(); }
+
+    // share blocks of b
+    iobuf(const iobuf& b) : iobuf() { this->append(b); }
+
+    iobuf(iobuf&& b) noexcept
+        : _refs(b._refs), _n(b._n), _cap(b._cap), _size(b._size) {
+        b._refs = 0;
+        b._n = b._cap = 0;
+        b._size = 0;
+    }
+
+    iobuf& operator=(const iobuf& b) {
+        if (&b != this) { this->clear(); this->append(b); }
+        return *this;
+    }
+
+    iobuf& operator=(iobuf&& b) noexcept {
+        if (&b != this) {
+            this->~iobuf();
+            new (this) iobuf(std::move(b));
+        }
+        return *this;
+    }
+
+    // total bytes in the buffer
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // number of segments
+    uint32 ref_num() const { return _n; }
+    const Ref& ref(uint32 i) const { return _refs[i]; }
+
+    // release the blocks, the segment array is kept
+    void clear();
+
+    // release the blocks, and free the segment array
+    void reset();
+
+    // copy data to the buffer, the last block is filled first if it is not shared
+    iobuf& append(const void* p, size_t n);
+    iobuf& append(const char* s) { return this->append(s, strlen(s)); }
+    iobuf& append(const fastring& s) { return this->append(s.data(), s.size()); }
+    iobuf& append(char c) { return this->append(&c, 1); }
+
+    // take over the memory of s without copy
+    iobuf& append(fastring&& s);
+
+    // reference [p, p + n) without copy, it MUST be valid while being used
+    iobuf& append_ref(const void* p, size_t n);
+
+    // share the blocks of b
+    iobuf& append(const iobuf& b);
+
+    // move the segments of b to the end, b will be empty
+    iobuf& append(iobuf&& b);
+
+    // add data before the existing data, e.g. a header for framing
+    iobuf& prepend(const void* p, size_t n);
+    iobuf& prepend_ref(const void* p, size_t n);
+
+    // remove n bytes from the front
+    void consume(size_t n);
+
+    // move n bytes at the front to the end of out, without copy
+    // return bytes moved, it is less than n if there are not enough data
+    size_t cut(iobuf& out, size_t n);
+
+    // copy n bytes from offset off to buf, return bytes copied
+    size_t copy_to(void* buf, size_t n, size_t off=0) const;
+
+    // copy the data to a fastring
+    fastring str() const;
+
+    // fill at most n buffers for sendv() with segments from the i-th
+    // return the number of buffers filled
+    int to_iov(co::iov_t* iov, int n, uint32 i=0) const {
+        int k = 0;
+        for (; k < n && i < _n; ++i) iov[k++] = co::make_iov(_refs[i].p, _refs[i].n);
+        return k;
+    }
+
+  private:
+    void _push(const Ref& r);
+    void _reserve(uint32 n);
+
+  private:
+    Ref* _refs;
+    uint32 _n;
+    uint32 _cap;
+    size_t _size;
+};
+
+} // co
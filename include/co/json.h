@@ -6,6 +6,8 @@
 
 #include "fastream.h"
 #include "str.h"
+#include "arena.h"
+#include <functional>
 #include <initializer_list>
 
 namespace json {
@@ -70,9 +72,43 @@ class Array {
 
 __coapi void* alloc();
 __coapi char* alloc_string(const void* p, size_t n);
+struct Sink;
 
 } // xx
 
+// receives output of Json::write() chunk by chunk, returns false to stop
+typedef std::function<bool(const char* s, size_t n)> sink_t;
+
+/**
+ * compiled JSON Pointer (RFC 6901), eg. "/a/b/3/c"
+ *   - The path is split and unescaped ("~1" to '/', "~0" to '~') only once,
+ *     then Json::find() resolves it without allocation.
+ *   - A token is a key for objects, or an index for arrays if it is a number.
+ *   - "" refers to the whole Json. A path not beginning with '/' is invalid,
+ *     and refers to nothing.
+ */
+class __coapi Path {
+  public:
+    explicit Path(const char* s) : Path(s, strlen(s)) {}
+    explicit Path(const fastring& s) : Path(s.data(), s.size()) {}
+    Path(const char* s, size_t n);
+    ~Path() = default;
+
+    bool valid() const { return _ok; }
+
+    // number of tokens
+    uint32 size() const { return _n; }
+
+  private:
+    friend class Json;
+    fastring _s; // |index|len|key with '\0'| of each token
+    uint32 _n;
+    bool _ok;
+};
+
+inline Path path(const char* s) { return Path(s); }
+inline Path path(const fastring& s) { return Path(s); }
+
 class __coapi Json {
   public:
     enum {
@@ -87,19 +123,39 @@ class __coapi Json {
     struct _obj_t {};
     struct _arr_t {};
 
+    // the node, and its string or keys, were allocated from a co::Arena
+    static const uint16 f_arena = 1;
+
+    // the object has a hash index of its keys, _h->p points to the index, and
+    // the array of members is the first field of the index
+    static const uint16 f_index = 2;
+
+    // the string, or the first _h->size keys of the object, refer to the input
+    // of parse_view() or are interned by parse_intern(), and are not freed
+    static const uint16 f_view = 4;
+
+    // the object or array is not parsed yet, it is in [p, p + size) of the
+    // input of parse_lazy()
+    static const uint16 f_lazy = 8;
+
+    // the array of members was allocated from a co::Arena, it is copied to the
+    // heap before it grows, and is not freed by reset()
+    static const uint16 f_fixed = 16;
+
     struct _H {
-        _H(bool v) noexcept : type(t_bool), b(v) {}
-        _H(int64 v) noexcept : type(t_int), i(v) {}
-        _H(double v) noexcept : type(t_double), d(v) {}
-        _H(_obj_t) noexcept : type(t_object), p(0) {}
-        _H(_arr_t) noexcept : type(t_array), p(0) {}
+        _H(bool v) noexcept : type(t_bool), flag(0), b(v) {}
+        _H(int64 v) noexcept : type(t_int), flag(0), i(v) {}
+        _H(double v) noexcept : type(t_double), flag(0), d(v) {}
+        _H(_obj_t) noexcept : type(t_object), flag(0), p(0) {}
+        _H(_arr_t) noexcept : type(t_array), flag(0), p(0) {}
 
         _H(const char* p) : _H(p, strlen(p)) {}
-        _H(const void* p, size_t n) : type(t_string), size((uint32)n) {
+        _H(const void* p, size_t n) : type(t_string), flag(0), size((uint32)n) {
             s = xx::alloc_string(p, n);
         }
 
-        uint32 type;
+        uint16 type;
+        uint16 flag;
         uint32 size;  // size of string
         union {
             bool b;   // for bool
@@ -239,6 +295,13 @@ class __coapi Json {
     Json& get(int i) const { return this->get((uint32)i); }
     Json& get(const char* key) const;
 
+    // get Json by a path, eg. v.find(json::path("/a/b/3/c")).
+    //   - It is a read-only operation, and allocates nothing. Objects and arrays
+    //     from parse_lazy() on the path are parsed as the path is resolved.
+    //   - If the path does not exist, the return value is a reference to a
+    //     null object.
+    Json& find(const Path& path) const;
+
     template <class T,  class ...X>
     inline Json& get(T&& v, X&& ... x) const {
         auto& r = this->get(std::forward<T>(v));
@@ -264,6 +327,7 @@ class __coapi Json {
     Json& push_back(Json&& v) {
         if (_h && (_h->type & t_array)) {
             if (unlikely(!_h->p)) new(&_h->p) xx::Array(8);
+            else if (unlikely(_h->flag & f_fixed)) this->_unfix();
         } else {
             this->reset();
             _h = new(xx::alloc()) _H(_arr_t());
@@ -349,6 +413,7 @@ class __coapi Json {
     Json& add_member(const char* key, Json&& v) {
         if (_h && (_h->type & t_object)) {
             if (unlikely(!_h->p)) new(&_h->p) xx::Array(16);
+            else if (unlikely(_h->flag & f_fixed)) this->_unfix();
         } else {
             this->reset();
             _h = new(xx::alloc()) _H(_obj_t());
@@ -423,25 +488,122 @@ class __coapi Json {
     fastring dbg(int mdp=16)    const { fastring s(256); this->dbg(s, mdp); return s; }
     fastring pretty(int mdp=16) const { fastring s(256); this->pretty(s, mdp); return s; }
 
+    /**
+     * write the same string as str() or pretty() to @f in chunks
+     *   - Output is buffered, and passed to @f when there are at least @chunk
+     *     bytes, a chunk may be a little larger to end the current value.
+     *   - @f may block until it can take more, eg. sending on a connection,
+     *     only one chunk is in memory then.
+     *   - return false if @f returned false.
+     *
+     *   v.write([&](const char* p, size_t n) { return conn.send(p, (int)n) == (int)n; });
+     *   v.write([&](const char* p, size_t n) { return file.write(p, n) == n; });
+     */
+    bool write(const sink_t& f, size_t chunk=8192, int mdp=16) const;
+    bool write_pretty(const sink_t& f, size_t chunk=8192, int mdp=16) const;
+
+    // Convert Json to MessagePack, a compact binary format, which is much faster
+    // to encode and parse than text for numbers.
+    fastream& msgpack(fastream& s) const { return this->_json2mp(s); }
+    fastring& msgpack(fastring& s) const { return (fastring&)this->msgpack((fastream&)s); }
+    fastring msgpack() const { fastring s(256); this->msgpack(s); return s; }
+
     // Parse Json from string, inverse to stringify.
     bool parse_from(const char* s, size_t n);
     bool parse_from(const char* s)        { return this->parse_from(s, strlen(s)); }
     bool parse_from(const fastring& s)    { return this->parse_from(s.data(), s.size()); }
     bool parse_from(const std::string& s) { return this->parse_from(s.data(), s.size()); }
 
+    /**
+     * parse into a co::Arena
+     *   - Nodes, strings, keys and arrays of members are allocated from the
+     *     arena @a, and they are freed all at once by a.reset(). An array of
+     *     members is copied to the heap when members are added to it.
+     *   - See json::Document for parsing messages one after another.
+     *   - The Json MUST be reset or destroyed before the arena is reset.
+     *   - Keys added to an object parsed this way are not freed.
+     */
+    bool parse_from(const char* s, size_t n, co::Arena& a);
+    bool parse_from(const fastring& s, co::Arena& a) { return this->parse_from(s.data(), s.size(), a); }
+
+    /**
+     * parse in situ, without copying strings
+     *   - Keys, and strings that have no escapes, refer to the input @s. Their
+     *     closing quotes are overwritten with '\0', so @s is modified, and it
+     *     MUST outlive the Json. Other strings are copied as usual.
+     *   - It can be used with a co::Arena, see parse_from() above.
+     */
+    bool parse_view(char* s, size_t n);
+    bool parse_view(fastring& s) { return this->parse_view((char*)s.data(), s.size()); }
+    bool parse_view(char* s, size_t n, co::Arena& a);
+
+    /**
+     * parse with the input validated as UTF-8
+     *   - It fails if @s is not valid UTF-8 (RFC 3629), e.g. overlong forms,
+     *     surrogates or code points over 0x10FFFF. ASCII is checked 16 bytes
+     *     at a time, so it costs little for mostly ASCII documents.
+     *   - \u escapes are decoded as in parse_from().
+     */
+    bool parse_strict(const char* s, size_t n);
+    bool parse_strict(const fastring& s) { return this->parse_strict(s.data(), s.size()); }
+
+    /**
+     * parse with keys interned
+     *   - Keys are interned by co::intern(), documents with the same keys share
+     *     the storage of them, and no memory is allocated for known keys.
+     *   - A key interned by the user is found by comparing pointers, e.g.
+     *       static const char* kId = co::intern("id");
+     *       v.get(kId);
+     *   - Interned strings are never freed, use it for documents with a fixed
+     *     set of keys, NOT for keys of unbounded variety.
+     */
+    bool parse_intern(const char* s, size_t n);
+    bool parse_intern(const fastring& s) { return this->parse_intern(s.data(), s.size()); }
+
+    /**
+     * parse on demand
+     *   - Only the top level is parsed, nested objects and arrays are skipped by
+     *     matching brackets, and each of them is parsed the same way when it is
+     *     first accessed.
+     *   - @s MUST outlive the Json, or at least until all of it is accessed.
+     *   - Errors in a nested object or array are found when it is accessed, it
+     *     is empty then.
+     */
+    bool parse_lazy(const char* s, size_t n);
+    bool parse_lazy(const fastring& s) { return this->parse_lazy(s.data(), s.size()); }
+
+    /**
+     * parse MessagePack, inverse to msgpack()
+     *   - bin is parsed as string, float 32 as double, and uint64 greater than
+     *     MAX_INT64 wraps to negative as in parse_from().
+     *   - Keys of maps MUST be strings, ext types are not supported.
+     */
+    bool parse_msgpack(const char* s, size_t n);
+    bool parse_msgpack(const fastring& s) { return this->parse_msgpack(s.data(), s.size()); }
+
     void reset();
     void swap(Json& v) noexcept { auto h = _h; _h = v._h; v._h = h; }
     void swap(Json&& v) noexcept { v.swap(*this); }
 
   private:
     friend class Parser;
+    friend class Shared;
     void* _dup() const;
-    xx::Array& _array() const { return *((xx::Array*)&_h->p); }
+    void _freeze() const;
+    xx::Array& _array() const {
+        if (unlikely(_h->flag & (f_index | f_lazy))) return this->_array_slow();
+        return *(xx::Array*)&_h->p;
+    }
+    xx::Array& _array_slow() const;
+    void _unfix() const;
+    Json* _find(const char* key) const;
     Json& _set(uint32 i);
     Json& _set(int i) { return this->_set((uint32)i); }
     Json& _set(const char* key);
     fastream& _json2str(fastream& fs, bool debug, int mdp) const;
     fastream& _json2pretty(fastream& fs, int indent, int n, int mdp) const;
+    fastream& _json2mp(fastream& fs) const;
+    bool _json2sink(xx::Sink& s, int indent, int n, int mdp) const;
 
   private:
     _H* _h;
@@ -470,6 +632,291 @@ inline Json parse(const char* s)        { return parse(s, strlen(s)); }
 inline Json parse(const fastring& s)    { return parse(s.data(), s.size()); }
 inline Json parse(const std::string& s) { return parse(s.data(), s.size()); }
 
+// parse into a co::Arena, see Json::parse_from() for details
+inline Json parse(const char* s, size_t n, co::Arena& a) {
+    Json r;
+    if (r.parse_from(s, n, a)) return r;
+    r.reset();
+    return r;
+}
+
+/**
+ * reusable document for parsing messages one after another
+ *   - The Json is parsed into an arena, which keeps its memory for the next
+ *     parse(), so parsing messages of similar shapes allocates almost nothing
+ *     after the first few.
+ *   - parse() invalidates the previous Json and everything taken from it.
+ *
+ *   json::Document d;
+ *   while (recv(buf)) {
+ *       if (!d.parse(buf)) continue;
+ *       process(d.value());
+ *   }
+ */
+class Document {
+  public:
+    explicit Document(uint32 chunk_size=4096) : _a(chunk_size) {}
+    ~Document() { _v.reset(); }
+
+    Document(const Document&) = delete;
+    void operator=(const Document&) = delete;
+
+    bool parse(const char* s, size_t n) {
+        this->clear();
+        return _v.parse_from(s, n, _a);
+    }
+
+    bool parse(const fastring& s) { return this->parse(s.data(), s.size()); }
+
+    // parse in situ, see Json::parse_view()
+    bool parse_view(char* s, size_t n) {
+        this->clear();
+        return _v.parse_view(s, n, _a);
+    }
+
+    bool parse_view(fastring& s) { return this->parse_view((char*)s.data(), s.size()); }
+
+    Json& value() { return _v; }
+    const Json& value() const { return _v; }
+
+    // free the Json, memory of the arena is kept
+    void clear() { _v.reset(); _a.reset(); }
+
+  private:
+    co::Arena _a;
+    Json _v;
+};
+
+/**
+ * shared Json with copy-on-write
+ *   - Copies refer to the same tree, copying one costs an atomic increment,
+ *     and the tree is freed with the last copy. It may be copied to and
+ *     released by any thread or coroutine.
+ *   - The tree is read-only through operator* and operator->, and it is safe
+ *     to read it from many threads at once. Lazy objects and arrays are parsed,
+ *     and hash indexes of large objects are built, when it is first shared, so
+ *     that lookups do not modify it. Do NOT use operator[] of Json on it, which
+ *     adds missing keys.
+ *   - mut() returns a Json that can be modified. The tree is copied first if
+ *     it is shared, other copies are not affected.
+ *   - The Json MUST own its memory, NOT one parsed into a co::Arena or in situ.
+ *
+ *   json::Shared body(json::parse(s));
+ *   for (auto& b : backends) go([b, body]() { b->send(body->str()); });
+ */
+class __coapi Shared {
+  public:
+    Shared() noexcept : _r(0) {}
+    explicit Shared(Json&& v);
+    explicit Shared(Json& v) : Shared(std::move(v)) {}
+    ~Shared() { if (_r) this->_unref(); }
+
+    Shared(const Shared& s);
+    Shared(Shared&& s) noexcept : _r(s._r) { s._r = 0; }
+
+    Shared& operator=(const Shared& s) {
+        if (&s != this) { Shared t(s); this->swap(t); }
+        return *this;
+    }
+
+    Shared& operator=(Shared&& s) noexcept {
+        if (&s != this) { Shared t(std::move(s)); this->swap(t); }
+        return *this;
+    }
+
+    // null Json if it is empty
+    const Json& operator*() const;
+    const Json* operator->() const { return &this->operator*(); }
+
+    // the Json to be modified, copied first if it is shared
+    Json& mut();
+
+    // number of copies sharing the tree, 0 if it is empty
+    uint32 use_count() const;
+
+    void reset() { if (_r) { this->_unref(); _r = 0; } }
+    void swap(Shared& s) noexcept { auto r = _r; _r = s._r; s._r = r; }
+
+  private:
+    struct _R;
+    void _unref();
+    _R* _r;
+};
+
+inline Json parse(const fastring& s, co::Arena& a) { return parse(s.data(), s.size(), a); }
+
+// parse in situ, see Json::parse_view() for details
+inline Json parse_view(char* s, size_t n) {
+    Json r;
+    if (r.parse_view(s, n)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json parse_view(fastring& s) { return parse_view((char*)s.data(), s.size()); }
+
+// parse on demand, see Json::parse_lazy() for details
+inline Json parse_lazy(const char* s, size_t n) {
+    Json r;
+    if (r.parse_lazy(s, n)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json parse_lazy(const fastring& s) { return parse_lazy(s.data(), s.size()); }
+
+// parse MessagePack, see Json::parse_msgpack() for details
+inline Json parse_msgpack(const char* s, size_t n) {
+    Json r;
+    if (r.parse_msgpack(s, n)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json parse_msgpack(const fastring& s) { return parse_msgpack(s.data(), s.size()); }
+
+/**
+ * event handler of the SAX parser
+ *   - Methods are called in order of the input, return false to stop parsing.
+ *   - Strings and keys are unescaped, they are NOT null-terminated, and are
+ *     valid only in the call.
+ */
+class __coapi Handler {
+  public:
+    virtual ~Handler() = default;
+    virtual bool on_null() { return true; }
+    virtual bool on_bool(bool) { return true; }
+    virtual bool on_int(int64) { return true; }
+    virtual bool on_double(double) { return true; }
+    virtual bool on_string(const char*, size_t) { return true; }
+    virtual bool on_key(const char*, size_t) { return true; }
+    virtual bool on_object_begin() { return true; }
+    virtual bool on_object_end() { return true; }
+    virtual bool on_array_begin() { return true; }
+    virtual bool on_array_end() { return true; }
+
+    // a top-level value is complete, more values may follow, eg. NDJSON
+    virtual bool on_end() { return true; }
+};
+
+/**
+ * SAX parser, no DOM is built
+ *   - Input can be fed piece by piece as it arrives, a token split across two
+ *     pieces is buffered until it is complete.
+ *   - The input may contain any number of top-level values, separated by white
+ *     spaces, Handler::on_end() is called for each of them.
+ *   - After an error, or the handler stopped, feed() and finish() return false
+ *     until reset() is called.
+ *
+ *   json::SaxParser p(h);
+ *   while ((n = co::recv(fd, buf, sizeof(buf))) > 0) {
+ *       if (!p.feed(buf, n)) break;
+ *   }
+ *   if (n == 0) p.finish();
+ */
+class __coapi SaxParser {
+  public:
+    explicit SaxParser(Handler& h);
+    ~SaxParser() = default;
+
+    SaxParser(const SaxParser&) = delete;
+    void operator=(const SaxParser&) = delete;
+
+    // feed the next piece of input, return false on errors, or if the handler
+    // returned false
+    bool feed(const char* s, size_t n);
+
+    // end of the input, a number at the end is complete now.
+    // return false if the input ends in a value.
+    bool finish();
+
+    // parse a complete input
+    bool parse(const char* s, size_t n) { return this->feed(s, n) && this->finish(); }
+    bool parse(const fastring& s) { return this->parse(s.data(), s.size()); }
+
+    // parse another input with the same handler
+    void reset();
+
+  private:
+    const char* _value(const char* b, const char* e);
+    const char* _token(const char* b, const char* e);
+    const char* _resume(const char* b, const char* e);
+    const char* _close(const char* b);
+    bool _emit_string(const char* b, const char* q, bool key);
+    bool _emit_scalar(const char* b, const char* e);
+    bool _end_value();
+
+  private:
+    Handler& _h;
+    fastream _tok;   // partial token
+    fastream _s;     // unescaped string
+    fastring _stack; // '{' or '[' of containers
+    uint8 _state;
+    uint8 _tk;       // kind of the partial token
+    bool _esc;       // the partial string ends with a backslash
+    bool _err;
+};
+
+/**
+ * pull parser, values are read one by one in order of the input, no DOM is
+ * built. It is used by CO_JSON_FIELDS in co/json_fields.h.
+ *   - Methods return false on errors, and ok() is false then. next_key() and
+ *     array_next() also return false at the end of an object or an array.
+ *   - Keys are NOT null-terminated, they are valid until the next key is read.
+ *
+ *   json::Reader r(s, n);
+ *   if (!r.object_begin()) return false;
+ *   while (r.next_key(k, len)) {
+ *       if (len == 1 && *k == 'x') { if (!r.read(x)) return false; continue; }
+ *       if (!r.skip()) return false;
+ *   }
+ *   return r.ok() && r.end();
+ */
+class __coapi Reader {
+  public:
+    Reader(const char* s, size_t n)
+        : _b(s), _e(s + n), _first(false), _err(false) {
+    }
+    ~Reader() = default;
+
+    // '{' or '[' of an object or an array
+    bool object_begin();
+    bool array_begin();
+
+    // move to the next member, return false at '}' or ']'
+    bool next_key(const char*& key, size_t& n);
+    bool array_next();
+
+    // read null if it is the next value, otherwise nothing is read
+    bool null();
+
+    // read a value, numbers are converted between int and double
+    bool read(bool& v);
+    bool read(int64& v);
+    bool read(double& v);
+    bool read(fastring& v);
+    bool read(Json& v);
+
+    // skip the next value
+    bool skip();
+
+    // only white spaces are left
+    bool end();
+
+    bool ok() const { return !_err; }
+
+  private:
+    bool _fail() { _err = true; return false; }
+    bool _next(char c);
+
+  private:
+    const char* _b;
+    const char* _e;
+    fastream _k; // unescaped key
+    bool _first; // no member of the current object or array was read
+    bool _err;
+};
+
 } // json
 
 typedef json::Json Json;
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "json.h"
+#include <string>
+#include <vector>
+#include <type_traits>
+
+/**
+ * Json serialization of structs without building a Json
+ *   - CO_JSON_FIELDS(T, fields...) MUST be used in the namespace of T, after
+ *     the definition of T. Up to 32 fields are supported.
+ *   - Fields may be bool, integers, float point numbers, fastring, std::string,
+ *     Json, std::vector (co::vector) of them, or structs with CO_JSON_FIELDS.
+ *   - json::dump() writes json text directly to a fastream, json::load() reads
+ *     values directly into fields with json::Reader. Unknown keys are skipped,
+ *     fields missing or null in the input are left unchanged.
+ *
+ *   struct Foo { int a; fastring b; co::vector<double> c; };
+ *   CO_JSON_FIELDS(Foo, a, b, c)
+ *
+ *   fastring s = json::dump(foo);
+ *   Foo x;
+ *   if (!json::load(s, x)) ELOG << "bad input: " << s;
+ */
+#define CO_JSON_FIELDS(T, ...) \
+    inline void co_json_write(fastream& _s, const T& _v) { \
+        _s.append('{'); \
+        _CO_JSON_FOREACH(_CO_JSON_WRITE_FIELD, __VA_ARGS__) \
+        _s.back() == ',' ? (void)(_s.back() = '}') : (void)(_s.append('}')); \
+    } \
+    inline bool co_json_read(::json::Reader& _r, T& _v) { \
+        const char* _k; \
+        size_t _n; \
+        if (!_r.object_begin()) return false; \
+        while (_r.next_key(_k, _n)) { \
+            _CO_JSON_FOREACH(_CO_JSON_READ_FIELD, __VA_ARGS__) \
+            if (!_r.skip()) return false; \
+        } \
+        return _r.ok(); \
+    }
+
+#define _CO_JSON_WRITE_FIELD(f) \
+    _s.append("\"" #f "\":", sizeof(#f) + 2); \
+    ::json::write(_s, _v.f); \
+    _s.append(',');
+
+#define _CO_JSON_READ_FIELD(f) \
+    if (_n == sizeof(#f) - 1 && memcmp(_k, #f, _n) == 0) { \
+        if (!::json::xx::read_field(_r, _v.f)) return false; \
+        continue; \
+    }
+
+#define _CO_JSON_EXPAND(x) x
+#define _CO_JSON_CAT(a, b) _CO_JSON_CAT_(a, b)
+#define _CO_JSON_CAT_(a, b) a##b
+#define _CO_JSON_NARG(...) _CO_JSON_EXPAND(_CO_JSON_ARG_N(__VA_ARGS__, 32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1))
+#define _CO_JSON_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, n, ...) n
+#define _CO_JSON_FOREACH(m, ...) \
+    _CO_JSON_EXPAND(_CO_JSON_CAT(_CO_JSON_FE_, _CO_JSON_NARG(__VA_ARGS__))(m, __VA_ARGS__))
+
+#define _CO_JSON_FE_1(m, x) m(x)
+#define _CO_JSON_FE_2(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_1(m, __VA_ARGS__))
+#define _CO_JSON_FE_3(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_2(m, __VA_ARGS__))
+#define _CO_JSON_FE_4(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_3(m, __VA_ARGS__))
+#define _CO_JSON_FE_5(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_4(m, __VA_ARGS__))
+#define _CO_JSON_FE_6(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_5(m, __VA_ARGS__))
+#define _CO_JSON_FE_7(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_6(m, __VA_ARGS__))
+#define _CO_JSON_FE_8(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_7(m, __VA_ARGS__))
+#define _CO_JSON_FE_9(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_8(m, __VA_ARGS__))
+#define _CO_JSON_FE_10(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_9(m, __VA_ARGS__))
+#define _CO_JSON_FE_11(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_10(m, __VA_ARGS__))
+#define _CO_JSON_FE_12(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_11(m, __VA_ARGS__))
+#define _CO_JSON_FE_13(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_12(m, __VA_ARGS__))
+#define _CO_JSON_FE_14(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_13(m, __VA_ARGS__))
+#define _CO_JSON_FE_15(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_14(m, __VA_ARGS__))
+#define _CO_JSON_FE_16(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_15(m, __VA_ARGS__))
+#define _CO_JSON_FE_17(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_16(m, __VA_ARGS__))
+#define _CO_JSON_FE_18(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_17(m, __VA_ARGS__))
+#define _CO_JSON_FE_19(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_18(m, __VA_ARGS__))
+#define _CO_JSON_FE_20(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_19(m, __VA_ARGS__))
+#define _CO_JSON_FE_21(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_20(m, __VA_ARGS__))
+#define _CO_JSON_FE_22(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_21(m, __VA_ARGS__))
+#define _CO_JSON_FE_23(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_22(m, __VA_ARGS__))
+#define _CO_JSON_FE_24(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_23(m, __VA_ARGS__))
+#define _CO_JSON_FE_25(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_24(m, __VA_ARGS__))
+#define _CO_JSON_FE_26(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_25(m, __VA_ARGS__))
+#define _CO_JSON_FE_27(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_26(m, __VA_ARGS__))
+#define _CO_JSON_FE_28(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_27(m, __VA_ARGS__))
+#define _CO_JSON_FE_29(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_28(m, __VA_ARGS__))
+#define _CO_JSON_FE_30(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_29(m, __VA_ARGS__))
+#define _CO_JSON_FE_31(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_30(m, __VA_ARGS__))
+#define _CO_JSON_FE_32(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_31(m, __VA_ARGS__))
+
+namespace json {
+namespace xx {
+
+__coapi fastream& write_string(fastream& fs, const char* s, size_t n);
+
+} // xx
+
+inline void write(fastream& s, bool v) { s << v; }
+inline void write(fastream& s, double v) { s.maxdp(16) << v; }
+inline void write(fastream& s, float v) { s << v; }
+inline void write(fastream& s, const char* v) { xx::write_string(s, v, strlen(v)); }
+inline void write(fastream& s, const fastring& v) { xx::write_string(s, v.data(), v.size()); }
+inline void write(fastream& s, const std::string& v) { xx::write_string(s, v.data(), v.size()); }
+inline void write(fastream& s, const Json& v) { v.str(s); }
+
+// char and signed char are numbers here
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type
+write(fastream& s, T v) {
+    s << (typename std::conditional<std::is_signed<T>::value, int64, uint64>::type)v;
+}
+
+// structs with CO_JSON_FIELDS
+template <typename T>
+inline auto write(fastream& s, const T& v) -> decltype(co_json_write(s, v)) {
+    co_json_write(s, v);
+}
+
+template <typename T, typename A>
+inline void write(fastream& s, const std::vector<T, A>& v) {
+    s.append('[');
+    for (size_t i = 0; i < v.size(); ++i) {
+        write(s, v[i]);
+        s.append(',');
+    }
+    s.back() == ',' ? (void)(s.back() = ']') : (void)(s.append(']'));
+}
+
+inline bool read(Reader& r, bool& v) { return r.read(v); }
+inline bool read(Reader& r, double& v) { return r.read(v); }
+inline bool read(Reader& r, fastring& v) { return r.read(v); }
+inline bool read(Reader& r, Json& v) { return r.read(v); }
+
+inline bool read(Reader& r, float& v) {
+    double x;
+    if (!r.read(x)) return false;
+    v = (float)x;
+    return true;
+}
+
+inline bool read(Reader& r, std::string& v) {
+    fastring x;
+    if (!r.read(x)) return false;
+    v.assign(x.data(), x.size());
+    return true;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type
+read(Reader& r, T& v) {
+    int64 x;
+    if (!r.read(x)) return false;
+    v = (T)x;
+    return true;
+}
+
+template <typename T>
+inline auto read(Reader& r, T& v) -> decltype(co_json_read(r, v)) {
+    return co_json_read(r, v);
+}
+
+template <typename T, typename A>
+inline bool read(Reader& r, std::vector<T, A>& v) {
+    v.clear();
+    if (!r.array_begin()) return false;
+    while (r.array_next()) {
+        v.emplace_back();
+        if (!read(r, v.back())) return false;
+    }
+    return r.ok();
+}
+
+namespace xx {
+
+// null leaves the field unchanged
+template <typename T>
+inline bool read_field(Reader& r, T& v) {
+    return r.null() || read(r, v);
+}
+
+} // xx
+
+// write @v as json to @s
+template <typename T>
+inline fastream& dump(fastream& s, const T& v) {
+    write(s, v);
+    return s;
+}
+
+template <typename T>
+inline fastring& dump(fastring& s, const T& v) {
+    return (fastring&) dump((fastream&)s, v);
+}
+
+template <typename T>
+inline fastring dump(const T& v) {
+    fastring s(256);
+    dump(s, v);
+    return s;
+}
+
+// parse json in @s into @v, return false on errors
+template <typename T>
+inline bool load(const char* s, size_t n, T& v) {
+    Reader r(s, n);
+    return read(r, v) && r.end();
+}
+
+template <typename T>
+inline bool load(const fastring& s, T& v) {
+    return load(s.data(), s.size(), v);
+}
+
+} // json
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "json.h"
+#include "stl.h"
+#include "fs.h"
+
+namespace json {
+
+/**
+ * parse newline-delimited json (NDJSON) in parallel
+ *   - @s is split into at most @k pieces at newlines, and the pieces are
+ *     parsed in coroutines on all schedulers, @k is the number of schedulers
+ *     if it is 0. A small input is parsed in the calling thread.
+ *   - Results are appended to @v in order of the lines, a line that can't be
+ *     parsed is null there. Empty lines are skipped.
+ *   - It may be called in or out of coroutines.
+ *   - return number of lines that can't be parsed.
+ */
+__coapi size_t parse_lines(const char* s, size_t n, co::vector<Json>& v, uint32 k=0);
+
+inline size_t parse_lines(const fastring& s, co::vector<Json>& v, uint32 k=0) {
+    return parse_lines(s.data(), s.size(), v, k);
+}
+
+/**
+ * parse newline-delimited json from a file in parallel
+ *   - The file is read in pieces of about @batch bytes, lines of each piece
+ *     are parsed by parse_lines() above while the next piece is read.
+ *   - @f is called with each Json in order of the lines, return false to
+ *     stop reading.
+ *   - return number of lines that can't be parsed.
+ *
+ *   fs::file f("data.ndjson", 'r');
+ *   json::parse_lines(f, [](Json& v) { load(v); return true; });
+ */
+__coapi size_t parse_lines(
+    fs::file& f, const std::function<bool(Json&)>& cb, size_t batch=(4 << 20), uint32 k=0
+);
+
+} // json
@@ -8,6 +8,8 @@
 __coapi DEC_bool(cout);
 __coapi DEC_int32(min_log_level);
 
+namespace co { class Histogram; }
+
 namespace ___ {
 namespace log {
 
@@ -52,6 +54,44 @@ __coapi void set_write_cb(const std::function<void(const void*, size_t)>& cb, in
  */
 __coapi void set_write_cb(const std::function<void(const char*, const void*, size_t)>& cb, int flags=0);
 
+/**
+ * ship level logs to a tcp collector, instead of writing them in a callback
+ *   - Logs flushed by the logging thread are pushed to a bounded queue, and sent
+ *     in batches by a coroutine with tcp::Client, so the logging thread is never
+ *     blocked by the network. The connection is re-established on errors.
+ *   - Each batch is sent as |len|data|, len is a big-endian uint32, and the high
+ *     bit of it is set if data was compressed with zlib (see log_ship_compress).
+ *   - When the queue is full, or the collector can't be connected, logs are
+ *     written to the local file instead. They are there anyway with log2local.
+ *     Logs still in the queue at exit are lost.
+ *   - It replaces the callback set by set_write_cb() for level logs.
+ *
+ * @param ip     ip or domain name of the collector.
+ * @param port   port of the collector.
+ * @param flags  formed by ORing any of the following values:
+ *                 - log::log2local: also log to local file
+ */
+__coapi void ship(const char* ip, int port, int flags=0);
+
+/**
+ * push level logs formatted by another process, e.g. a worker in prefork mode 
+ *   - @p holds one or more complete lines, they are written as they are in the 
+ *     next flush, to the local file or the write callback. 
+ */
+__coapi void merge(const void* p, size_t n);
+
+// statistics of level logs, counters are never reset
+struct stats_t {
+    uint64 dropped_logs;  // logs dropped on overflow of the log buffer
+    uint64 dropped_bytes; // bytes of the logs dropped
+    uint64 blocked;       // times a thread waited for a full buffer, log_overflow=block
+};
+
+__coapi stats_t stats();
+
+// time in microseconds the logging thread took to write logs in each round
+__coapi const co::Histogram& flush_histogram();
+
 namespace xx {
 
 enum LogLevel {
@@ -85,9 +125,18 @@ class __coapi FatalLogSaver {
     fastream& _s;
 };
 
+// a topic defined by DEF_TLOG_TOPIC, it is bound to the buffer of the topic
+// on first use
+struct Topic {
+    const char* name;
+    void* slot;
+    int shard;
+};
+
 class __coapi TLogSaver {
   public:
     TLogSaver(const char* file, int len, unsigned int line, const char* topic);
+    TLogSaver(const char* file, int len, unsigned int line, Topic& topic);
     ~TLogSaver();
 
     fastream& stream() const { return _s; }
@@ -96,8 +145,103 @@ class __coapi TLogSaver {
     fastream& _s;
     size_t _n;
     const char* _topic;
+    Topic* _t;
 };
 
+// state of a LOG_EVERY_MS call site, allow() returns 0 if the log should be
+// dropped, or the number of logs dropped since the last one plus 1.
+struct __coapi LogEveryMs {
+    uint32 allow(uint32 ms);
+    int64 t;
+    uint32 n;
+};
+
+// state of a LOG_RATE_LIMITED call site, a token bucket of @rate tokens, which
+// is refilled at @rate tokens per second.
+struct __coapi LogRateLimiter {
+    uint32 allow(uint32 rate);
+    int64 t;
+    int32 k;
+    uint32 n;
+};
+
+// "(suppressed n messages) " is written before a log if n > 0
+struct LogSuppressed {
+    uint32 n;
+};
+
+inline fastream& operator<<(fastream& s, const LogSuppressed& x) {
+    if (x.n > 0) s << "(suppressed " << x.n << " messages) ";
+    return s;
+}
+
+// static data of a BLOG call site
+struct BlogSite {
+    const char* fmt;
+    const char* file;
+    unsigned int line;
+    int level;
+    uint32 id; // id in the binary log file, set by the logging thread
+};
+
+// Arguments of BLOG are saved as raw bytes with a one-byte type tag, they are
+// formatted later by the logging thread, or offline by the decoder.
+inline void blog_arg(fastream& s, bool v) { s.append('b').append((char)v); }
+inline void blog_arg(fastream& s, char v) { s.append('c').append(v); }
+inline void blog_arg(fastream& s, const char* v) {
+    const uint32 n = (uint32)strlen(v);
+    s.append('s').append(n).append(v, n);
+}
+inline void blog_arg(fastream& s, const fastring& v) {
+    s.append('s').append((uint32)v.size()).append(v.data(), v.size());
+}
+inline void blog_arg(fastream& s, const std::string& v) {
+    s.append('s').append((uint32)v.size()).append(v.data(), v.size());
+}
+inline void blog_arg(fastream& s, const void* v) { s.append('p').append((uint64)(size_t)v); }
+
+template <typename T, god::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value, int> = 0>
+inline void blog_arg(fastream& s, T v) { s.append('i').append((int64)v); }
+
+template <typename T, god::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value, int> = 0>
+inline void blog_arg(fastream& s, T v) { s.append('u').append((uint64)v); }
+
+template <typename T, god::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+inline void blog_arg(fastream& s, T v) {
+    const double d = (double)v;
+    s.append('d').append(&d, sizeof(d));
+}
+
+// thread-local buffer for the arguments
+__coapi fastream& blog_stream();
+
+// push a binary log to the buffer of the current thread
+__coapi void blog_push(BlogSite* site, const char* p, size_t n);
+
+template <typename... X>
+inline void blog(BlogSite* site, const X&... x) {
+    fastream& s = blog_stream();
+    s.clear();
+    const int a[] = { 0, (blog_arg(s, x), 0)... }; (void)a;
+    blog_push(site, s.data(), s.size());
+}
+
+/**
+ * format a binary log as a text log
+ *   - "{}" in the format string is replaced by the next argument, arguments
+ *     without a "{}" are ignored.
+ *
+ * @param tid   id of the thread that wrote the log.
+ * @param time  time string of the log, "0723 17:00:00.123".
+ * @param p     arguments encoded by blog_arg().
+ * @param n     size of the arguments.
+ *
+ * @return  false if the arguments are truncated.
+ */
+__coapi bool blog_format(
+    fastream& s, const BlogSite& site, uint32 tid, const char* time, const char* p, size_t n
+);
+
 } // namespace xx
 } // namespace log
 } // namespace ___
@@ -110,6 +254,29 @@ using namespace ___;
 #define TLOG(topic) log::xx::TLogSaver(__FILE__, sizeof(__FILE__) - 1, __LINE__, topic).stream()
 #define TLOG_IF(topic, cond) if (cond) TLOG(topic)
 
+// Topics can be defined once for hot paths, TLOG skips hashing the topic then.
+// DEF_TLOG_TOPIC(access);  // in a source file, DEC_TLOG_TOPIC(access) to use it elsewhere
+// TLOG(TOPIC_access) << "GET /index.html 200";
+#define DEF_TLOG_TOPIC(name) log::xx::Topic TOPIC_##name = { #name, 0, 0 }
+#define DEC_TLOG_TOPIC(name) extern log::xx::Topic TOPIC_##name
+
+// BLOG is a binary log with format arguments, it is cheaper than LOG on hot
+// paths, as the arguments are copied as they are, and formatted later by the
+// logging thread. With -log_binary, they are written to a .blog file without
+// being formatted, and test/blog.cc decodes the file.
+// BLOG("hello {}, x: {}", "world", 23);
+// The format MUST be a literal string.
+#define _CO_BLOG(lv, fmt, ...) \
+    do { \
+        static log::xx::BlogSite _co_blog_site = { fmt, __FILE__, __LINE__, lv, 0 }; \
+        log::xx::blog(&_co_blog_site, ##__VA_ARGS__); \
+    } while (0)
+
+#define DBLOG(fmt, ...) if (FLG_min_log_level <= log::xx::debug)   _CO_BLOG(log::xx::debug, fmt, ##__VA_ARGS__)
+#define  BLOG(fmt, ...) if (FLG_min_log_level <= log::xx::info)    _CO_BLOG(log::xx::info, fmt, ##__VA_ARGS__)
+#define WBLOG(fmt, ...) if (FLG_min_log_level <= log::xx::warning) _CO_BLOG(log::xx::warning, fmt, ##__VA_ARGS__)
+#define EBLOG(fmt, ...) if (FLG_min_log_level <= log::xx::error)   _CO_BLOG(log::xx::error, fmt, ##__VA_ARGS__)
+
 // DLOG  ->  debug log
 // LOG   ->  info log
 // WLOG  ->  warning log
@@ -118,6 +285,7 @@ using namespace ___;
 // CHECK ->  fatal log
 //
 // LOG << "hello world " << 23;
+// LOG.format("hello {} {}", "world", 23);  // reserve once for the whole line
 // WLOG_IF(1 + 1 == 2) << "xx";
 #define _CO_LOG_STREAM(lv)  log::xx::LevelLogSaver(__FILE__, sizeof(__FILE__) - 1, __LINE__, lv).stream()
 #define _CO_FLOG_STREAM     log::xx::FatalLogSaver(__FILE__, sizeof(__FILE__) - 1, __LINE__).stream()
@@ -174,3 +342,22 @@ using namespace ___;
 #define  LOG_FIRST_N(n) _CO_LOG_FIRST_N(n, LOG)
 #define WLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, WLOG)
 #define ELOG_FIRST_N(n) _CO_LOG_FIRST_N(n, ELOG)
+
+// rate limited log, at most one log in n ms, or n logs per second. Logs dropped
+// are counted, and the count is written before the next log.
+//   ELOG_EVERY_MS(1000) << "connect failed";
+//   ELOG_RATE_LIMITED(100) << "bad request";
+#define _CO_LOG_LIMITED(T, n, what) \
+    static log::xx::T _co_log_counter_name; \
+    if (const uint32 _co_log_x_ = _co_log_counter_name.allow(n)) \
+        what << log::xx::LogSuppressed{ _co_log_x_ - 1 }
+
+#define DLOG_EVERY_MS(n) _CO_LOG_LIMITED(LogEveryMs, n, DLOG)
+#define  LOG_EVERY_MS(n) _CO_LOG_LIMITED(LogEveryMs, n, LOG)
+#define WLOG_EVERY_MS(n) _CO_LOG_LIMITED(LogEveryMs, n, WLOG)
+#define ELOG_EVERY_MS(n) _CO_LOG_LIMITED(LogEveryMs, n, ELOG)
+
+#define DLOG_RATE_LIMITED(n) _CO_LOG_LIMITED(LogRateLimiter, n, DLOG)
+#define  LOG_RATE_LIMITED(n) _CO_LOG_LIMITED(LogRateLimiter, n, LOG)
+#define WLOG_RATE_LIMITED(n) _CO_LOG_LIMITED(LogRateLimiter, n, WLOG)
+#define ELOG_RATE_LIMITED(n) _CO_LOG_LIMITED(LogRateLimiter, n, ELOG)
@@ -1,77 +1,171 @@
 #pragma once
 
 #include "stl.h"
+#include "mem.h"
+#include <functional>
+#include <tuple>
 
-template <typename K, typename V>
+/**
+ * LRU map
+ *   - Entries are stored in a single hash table, each of them is allocated
+ *     once, and holds the links of the LRU list. A hit is one hash lookup.
+ *   - Iteration goes from the most recently used entry to the least.
+ *   - When the map is full, inserting a new key evicts the least recently
+ *     used entry, the callback set by on_evict() is called before then.
+ *   - It is not thread-safe.
+ */
+template <
+    typename K, typename V,
+    typename Hash = co::_Hash<K>,
+    typename Pred = co::_Eq<K>
+>
 class LruMap {
   public:
-    typedef typename co::hash_map<K, V>::iterator iterator;
-    typedef typename co::hash_map<K, V>::key_type key_type;
-    typedef typename co::hash_map<K, V>::value_type value_type;
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
 
-    LruMap() : _capacity(1024) {}
+  private:
+    struct _Node {
+        template <typename Key, typename... Args>
+        _Node(size_t h, Key&& key, Args&&... args)
+            : prev(0), next(0), hnext(0), hash(h),
+              kv(std::piecewise_construct,
+                 std::forward_as_tuple(std::forward<Key>(key)),
+                 std::forward_as_tuple(std::forward<Args>(args)...)) {
+        }
+
+        _Node* prev;  // more recently used
+        _Node* next;  // less recently used
+        _Node* hnext; // next node in the bucket
+        size_t hash;
+        value_type kv;
+    };
+
+  public:
+    class iterator {
+      public:
+        iterator() noexcept : _p(0) {}
+        explicit iterator(_Node* p) noexcept : _p(p) {}
+
+        value_type& operator*() const { return _p->kv; }
+        value_type* operator->() const { return &_p->kv; }
+        iterator& operator++() { _p = _p->next; return *this; }
+        iterator operator++(int) { iterator r(_p); _p = _p->next; return r; }
+        bool operator==(const iterator& x) const { return _p == x._p; }
+        bool operator!=(const iterator& x) const { return _p != x._p; }
+
+      private:
+        friend class LruMap;
+        _Node* _p;
+    };
+
+    typedef std::function<void(const K&, V&)> evict_cb_t;
+
+    LruMap() noexcept : LruMap(1024) {}
 
-    explicit LruMap(size_t capacity) {
+    explicit LruMap(size_t capacity) noexcept
+        : _b(0), _nb(0), _size(0), _head(0), _tail(0) {
         _capacity = capacity > 0 ? capacity : 1024;
     }
 
-    ~LruMap() {}
+    LruMap(LruMap&& x) noexcept : LruMap(x._capacity) { this->swap(x); }
 
-    size_t size()    const { return _kv.size(); }
-    bool empty()     const { return this->size() == 0; }
-    iterator begin() const { return ((LruMap*)this)->_kv.begin(); }
-    iterator end()   const { return ((LruMap*)this)->_kv.end(); }
+    LruMap(const LruMap&) = delete;
+    void operator=(const LruMap&) = delete;
 
+    LruMap& operator=(LruMap&& x) noexcept {
+        if (&x != this) { this->clear(); this->swap(x); }
+        return *this;
+    }
+
+    ~LruMap() {
+        this->clear();
+        if (_b) { co::free(_b, _nb * sizeof(_Node*)); _b = 0; }
+    }
+
+    size_t size()     const { return _size; }
+    bool empty()      const { return _size == 0; }
+    size_t capacity() const { return _capacity; }
+    iterator begin()  const { return iterator(_head); }
+    iterator end()    const { return iterator(); }
+
+    // set a callback called with the entry to be evicted, it is not called
+    // by erase() or clear()
+    void on_evict(evict_cb_t&& f) { _on_evict = std::move(f); }
+    void on_evict(const evict_cb_t& f) { _on_evict = f; }
+
+    // find the key, and move it to the front of the LRU list if found
     iterator find(const key_type& key) {
-        iterator it = _kv.find(key);
-        if (it != _kv.end() && _kl.front() != key) {
-            auto ki = _ki.find(key);
-            _kl.splice(_kl.begin(), _kl, ki->second); // move key to the front
-            ki->second = _kl.begin();
-        }
-        return it;
+        _Node* const p = this->_find(_hash(key), key);
+        if (p && p != _head) { this->_unlink(p); this->_push_front(p); }
+        return iterator(p);
     }
 
-    // The key is not inserted if it already exists.
+    // The key is not inserted if it already exists, the existing entry is
+    // moved to the front then. Return iterator of the entry.
     template <typename Key, typename Val>
-    void insert(Key&& key, Val&& value) {
-        if (_kv.size() >= _capacity) {
-            K k = _kl.back();
-            _kl.pop_back();
-            _kv.erase(k);
-            _ki.erase(k);
+    iterator insert(Key&& key, Val&& value) {
+        const size_t h = _hash(key);
+        _Node* p = this->_find(h, key);
+        if (p) {
+            if (p != _head) { this->_unlink(p); this->_push_front(p); }
+            return iterator(p);
         }
-        auto r = _kv.insert(value_type(std::forward<Key>(key), std::forward<Val>(value)));
-        if (r.second) {
-            _kl.push_front(key);
-            _ki[key] = _kl.begin();
+        p = co::make<_Node>(h, std::forward<Key>(key), std::forward<Val>(value));
+        this->_add(p);
+        return iterator(p);
+    }
+
+    // get value of the key, insert V(args...) if it does not exist
+    template <typename Key, typename... Args>
+    V& get_or_insert(Key&& key, Args&&... args) {
+        const size_t h = _hash(key);
+        _Node* p = this->_find(h, key);
+        if (p) {
+            if (p != _head) { this->_unlink(p); this->_push_front(p); }
+            return p->kv.second;
         }
+        p = co::make<_Node>(h, std::forward<Key>(key), std::forward<Args>(args)...);
+        this->_add(p);
+        return p->kv.second;
     }
 
     void erase(iterator it) {
-        if (it != _kv.end()) {
-            auto ki = _ki.find(it->first);
-            _kl.erase(ki->second);
-            _ki.erase(ki);
-            _kv.erase(it);
+        if (it._p) {
+            this->_unlink(it._p);
+            this->_unhash(it._p);
+            co::del(it._p);
+            --_size;
         }
     }
 
     void erase(const key_type& key) {
-        this->erase(_kv.find(key));
+        this->erase(iterator(this->_find(_hash(key), key)));
     }
 
+    // remove all entries, the bucket array is kept
     void clear() {
-        _kv.clear();
-        _ki.clear();
-        _kl.clear();
+        for (_Node* p = _head; p;) {
+            _Node* const x = p;
+            p = p->next;
+            co::del(x);
+        }
+        if (_b) memset(_b, 0, _nb * sizeof(_Node*));
+        _head = _tail = 0;
+        _size = 0;
     }
 
     void swap(LruMap& x) noexcept {
-        _kv.swap(x._kv);
-        _ki.swap(x._ki);
-        _kl.swap(x._kl);
+        std::swap(_b, x._b);
+        std::swap(_nb, x._nb);
+        std::swap(_size, x._size);
         std::swap(_capacity, x._capacity);
+        std::swap(_head, x._head);
+        std::swap(_tail, x._tail);
+        std::swap(_hash, x._hash);
+        std::swap(_eq, x._eq);
+        _on_evict.swap(x._on_evict);
     }
 
     void swap(LruMap&& x) noexcept {
@@ -79,8 +173,70 @@ class LruMap {
     }
 
   private:
-    co::hash_map<K, V> _kv;
-    co::hash_map<K, typename co::list<K>::iterator> _ki;
-    co::list<K> _kl; // key list
+    _Node* _find(size_t h, const key_type& key) const {
+        if (!_b) return 0;
+        for (_Node* p = _b[h & (_nb - 1)]; p; p = p->hnext) {
+            if (p->hash == h && _eq(p->kv.first, key)) return p;
+        }
+        return 0;
+    }
+
+    // add a new node, evict the least recently used one if the map is full
+    void _add(_Node* p) {
+        if (_size >= _capacity && _tail) {
+            _Node* const x = _tail;
+            if (_on_evict) _on_evict(x->kv.first, x->kv.second);
+            this->_unlink(x);
+            this->_unhash(x);
+            co::del(x);
+            --_size;
+        }
+        if (_size >= _nb) this->_rehash(_nb ? _nb << 1 : 16);
+        _Node*& b = _b[p->hash & (_nb - 1)];
+        p->hnext = b;
+        b = p;
+        this->_push_front(p);
+        ++_size;
+    }
+
+    void _rehash(size_t n) {
+        _Node** b = (_Node**) co::zalloc(n * sizeof(_Node*));
+        for (_Node* p = _head; p; p = p->next) {
+            _Node*& x = b[p->hash & (n - 1)];
+            p->hnext = x;
+            x = p;
+        }
+        if (_b) co::free(_b, _nb * sizeof(_Node*));
+        _b = b;
+        _nb = n;
+    }
+
+    void _unhash(_Node* p) {
+        _Node** x = &_b[p->hash & (_nb - 1)];
+        while (*x != p) x = &(*x)->hnext;
+        *x = p->hnext;
+    }
+
+    void _unlink(_Node* p) {
+        p->prev ? (void)(p->prev->next = p->next) : (void)(_head = p->next);
+        p->next ? (void)(p->next->prev = p->prev) : (void)(_tail = p->prev);
+    }
+
+    void _push_front(_Node* p) {
+        p->prev = 0;
+        p->next = _head;
+        _head ? (void)(_head->prev = p) : (void)(_tail = p);
+        _head = p;
+    }
+
+  private:
+    _Node** _b;       // buckets, the number of them is a power of 2
+    size_t _nb;       // number of buckets
+    size_t _size;
     size_t _capacity; // max capacity
+    _Node* _head;     // the most recently used
+    _Node* _tail;     // the least recently used
+    Hash _hash;
+    Pred _eq;
+    evict_cb_t _on_evict;
 };
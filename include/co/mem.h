@@ -9,6 +9,8 @@
 #include <utility>
 #include <type_traits>
 
+class fastring;
+
 namespace co {
 
 // alloc @size bytes
@@ -24,8 +26,59 @@ __coapi void free(void* p, size_t size);
 // realloc the memory allocated by co::alloc() or co::realloc()
 //   - if p is NULL, it is equal to co::alloc(new_size)
 //   - @new_size must be greater than @old_size
+//   - Blocks > 128K are mapped from the OS, and they grow without copying, by 
+//     mremap() on linux, or by committing more of a reservation on windows.
 __coapi void* realloc(void* p, size_t old_size, size_t new_size);
 
+// statistics of co::alloc()
+//   - Memory freed by a thread other than the one allocated it is counted on 
+//     the freeing thread, so values of a single thread may be negative. 
+//   - committed_bytes - small_bytes - large_bytes - span_bytes is memory held
+//     by the allocator but not in use, which is a measure of fragmentation.
+struct mem_stats_t {
+    uint64 allocs;          // number of allocations
+    uint64 frees;           // number of frees
+    int64 bytes;            // bytes requested and not freed yet
+    int64 small_bytes;      // bytes in use by blocks <= 2K, rounded up to 16 bytes
+    int64 large_bytes;      // bytes in use by blocks <= 128K, rounded up to 4K
+    int64 span_bytes;       // bytes in use by blocks <= 32M, rounded up to the size class
+    int64 sys_bytes;        // bytes in use by blocks > 32M, mapped from the OS
+    uint64 static_bytes;    // bytes allocated by co::static_alloc()
+    uint64 reserved_bytes;  // virtual memory reserved, global only
+    uint64 committed_bytes; // memory committed for blocks <= 32M, global only
+    uint64 huge_page_blocks; // number of 2M blocks advised to use huge pages, see mem_huge_page
+};
+
+// get statistics of all threads, counters of each thread are summed up
+__coapi mem_stats_t mem_stats();
+
+// get statistics of the current thread
+__coapi mem_stats_t thread_mem_stats();
+
+// return memory of the current thread not in use to the OS
+//   - Memory not used since the last call in the same thread is decommitted, 
+//     it is usually called periodically, and the period is the idle threshold. 
+//     Schedulers call it every co_mem_trim_ms. 
+//   - At most @keep bytes of idle memory is retained for reuse. 
+//   - It returns bytes decommitted.
+__coapi size_t mem_trim(size_t keep=0);
+
+/**
+ * get a report of the sampling heap profiler
+ *   - mem_profile_rate MUST be > 0, or the report will be empty. A stack is 
+ *     sampled about every that many bytes allocated, and a sampled block is 
+ *     tracked until it is freed. 
+ *   - Stacks are sorted by bytes in use, which are estimated from the samples. 
+ *   - If co_profile_signal > 0, the report is also written to log on that signal.
+ *
+ * @param n  max number of stacks in the report.
+ */
+__coapi fastring heap_profile(int n = 16);
+
+// get the heap profile in the legacy format of gperftools, `pprof <exe> <file>`
+// can read it.
+__coapi fastring heap_profile_pprof();
+
 
 // alloc static memory, do not free or realloc it
 __coapi void* static_alloc(size_t size);
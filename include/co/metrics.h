@@ -0,0 +1,90 @@
+#pragma once
+
+#include "def.h"
+#include "fastream.h"
+#include "histogram.h"
+#include <functional>
+
+namespace http { class Req; class Res; }
+
+// counters, gauges and histograms, rendered in the Prometheus text format.
+//   - Metrics are created once and never freed, a name maps to one metric, so
+//     creating it again returns the same one.
+//   - DEF_counter/DEF_gauge/DEF_histogram define them at static init, like
+//     DEF_* flags, and DEC_* declare them in other files.
+//
+//   DEF_counter(myapp_jobs_total, "jobs done");
+//   MET_myapp_jobs_total.inc();
+//
+//   http::Router r;
+//   r.get("/metrics", metrics::http_handler);
+namespace metrics {
+
+// a counter sharded by threads, inc() from different threads do not contend
+class __coapi Counter {
+  public:
+    Counter();
+    ~Counter() = delete;
+
+    void inc(uint64 n=1);
+    uint64 value() const;
+
+  private:
+    uint64* _v;
+};
+
+class __coapi Gauge {
+  public:
+    Gauge() : _v(0) {}
+    ~Gauge() = delete;
+
+    void set(int64 v);
+    void add(int64 v);
+    void sub(int64 v) { this->add(-v); }
+    int64 value() const;
+
+  private:
+    int64 _v;
+};
+
+__coapi Counter& counter(const char* name, const char* help);
+__coapi Gauge& gauge(const char* name, const char* help);
+
+// a gauge whose value is got by @f when the metrics are rendered
+__coapi void gauge(const char* name, const char* help, std::function<double()>&& f);
+
+// a histogram rendered as a summary, with quantiles 0.5, 0.9, 0.99, 0.999
+__coapi co::Histogram& histogram(const char* name, const char* help);
+
+// a collector writes metrics with labels, or from other stats, when the metrics
+// are rendered, with write_header() and write_value()
+typedef std::function<void(fastream&)> collector_t;
+__coapi void add_collector(collector_t&& f);
+
+// # HELP and # TYPE lines, @type is counter, gauge or summary
+__coapi void write_header(fastream& s, const char* name, const char* help, const char* type);
+
+// a sample, @labels is like `sched="0"` or NULL
+__coapi void write_value(fastream& s, const char* name, const char* labels, double v);
+__coapi void write_value(fastream& s, const char* name, const char* labels, uint64 v);
+__coapi void write_value(fastream& s, const char* name, const char* labels, int64 v);
+
+// samples of the quantiles, _sum and _count of a histogram
+__coapi void write_summary(fastream& s, const char* name, const char* labels, const co::Histogram& h);
+
+// render all metrics in the Prometheus text format
+__coapi void render(fastream& s);
+
+// a handler with render() for http::Server or http::Router
+__coapi void http_handler(const http::Req& req, http::Res& res);
+
+} // metrics
+
+#define DEC_counter(name)    extern ::metrics::Counter& MET_##name
+#define DEC_gauge(name)      extern ::metrics::Gauge& MET_##name
+#define DEC_histogram(name)  extern ::co::Histogram& MET_##name
+
+// DEF_counter(x, "help");  ->  metrics::Counter& MET_x
+#define DEF_counter(name, help)    ::metrics::Counter& MET_##name = ::metrics::counter(#name, help)
+#define DEF_gauge(name, help)      ::metrics::Gauge& MET_##name = ::metrics::gauge(#name, help)
+#define DEF_histogram(name, help)  ::co::Histogram& MET_##name = ::metrics::histogram(#name, help)
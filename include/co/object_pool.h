@@ -0,0 +1,87 @@
+#pragma once
+
+#include "def.h"
+#include "mem.h"
+#include <utility>
+
+namespace co {
+
+/**
+ * typed object pool with thread-local free lists
+ *   - alloc() pops a block from the free list of the current thread, and the 
+ *     list is refilled with B blocks from co::alloc() when it is empty. 
+ *   - free() pushes a block to the free list of the current thread. It can be 
+ *     called in any thread, not only the one allocated the block. 
+ *   - At most N blocks are cached in each thread, others are freed with 
+ *     co::free(). N = 0 for no limit. 
+ *   - Blocks cached by a thread are not freed when the thread exits.
+ *
+ *   - co::object_pool<X>::make(args) and del(p) are like co::make() and co::del().
+ *
+ * @tparam T  type of the objects
+ * @tparam N  max number of blocks cached in a thread
+ * @tparam B  number of blocks allocated at a time to refill the list
+ */
+template <typename T, uint32 N = 1024, uint32 B = 16>
+struct object_pool {
+    static const size_t S = sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*);
+
+    // alloc memory for an object of T, the object is not constructed
+    static void* alloc() {
+        list_t& l = list();
+        if (unlikely(!l.head) && !refill(l)) return 0;
+        void* const p = l.head;
+        l.head = *(void**)p;
+        --l.size;
+        return p;
+    }
+
+    // free memory returned by alloc(), the object is not destructed
+    static void free(void* p) {
+        list_t& l = list();
+        if (N == 0 || l.size < N) {
+            *(void**)p = l.head;
+            l.head = p;
+            ++l.size;
+        } else {
+            co::free(p, S);
+        }
+    }
+
+    template <typename... Args>
+    static T* make(Args&&... args) {
+        void* const p = alloc();
+        return p ? new (p) T(std::forward<Args>(args)...) : 0;
+    }
+
+    static void del(T* p) {
+        if (p) { p->~T(); free(p); }
+    }
+
+    // number of blocks cached in the current thread
+    static uint32 size() { return list().size; }
+
+  private:
+    struct list_t {
+        void* head;
+        uint32 size;
+    };
+
+    static list_t& list() {
+        static __thread list_t l;
+        return l;
+    }
+
+    static bool refill(list_t& l) {
+        for (uint32 i = 0; i < B; ++i) {
+            void* const p = co::alloc(S);
+            if (unlikely(!p)) break;
+            *(void**)p = l.head;
+            l.head = p;
+            ++l.size;
+        }
+        return l.head != 0;
+    }
+};
+
+} // co
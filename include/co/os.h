@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fastring.h"
+#include "stl.h"
 #include <signal.h>
 
 namespace os {
@@ -41,6 +42,49 @@ __coapi int pid();
 // get number of processors
 __coapi int cpunum();
 
+// get number of NUMA nodes, 1 if NUMA is not supported
+__coapi int numa_num();
+
+// get the NUMA node of a cpu, 0 if NUMA is not supported
+__coapi int numa_node(int cpu);
+
+// bind the current thread to a cpu, return false if failed or not supported
+__coapi bool bind_cpu(int cpu);
+
+// bind the current thread to cpus in @cpus, e.g. SMT siblings of a core or
+// cpus of a NUMA node, return false if failed or not supported
+__coapi bool set_affinity(const co::vector<int>& cpus);
+
+struct cpu_info_t {
+    int cpu;     // id of the logical cpu, as used by bind_cpu()
+    int core;    // index of its physical core, in [0, topology_t::cores)
+    int package; // index of its package (socket)
+    int node;    // NUMA node
+};
+
+struct topology_t {
+    int cpus;       // online logical cpus
+    int cores;      // physical cores
+    int packages;
+    int numa_nodes;
+    int smt;        // logical cpus of each core, 1 without SMT
+    int line_size;  // size of a cache line
+    size_t l1d;     // size of a cache at each level, 0 if unknown, a cache
+    size_t l1i;     //   may be shared by cores, e.g. l3 by cores on a package
+    size_t l2;
+    size_t l3;
+    co::vector<cpu_info_t> cpu; // sorted by cpu id
+};
+
+/**
+ * get topology of cpus, parsed once on the first call
+ *   - linux: /sys/devices/system/cpu, windows: GetLogicalProcessorInformationEx,
+ *     in the processor group of the calling thread, macos: sysctl hw.*.
+ *   - If the topology is unknown, every cpu is a core, caches are 0 and
+ *     line_size is 64.
+ */
+__coapi const topology_t& topology();
+
 // run as a daemon
 __coapi void daemon();
 
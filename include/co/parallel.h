@@ -0,0 +1,77 @@
+#pragma once
+
+#include "def.h"
+#include "array.h"
+#include "mem.h"
+#include <functional>
+
+namespace co {
+
+typedef std::function<void(size_t, size_t)> range_fn_t;
+
+/**
+ * run @f on subranges [beg, end) of [0, n) in parallel
+ *   - Jobs run in a work-stealing pool of co_par_threads threads, which is
+ *     created on the first call. The threads are bound to the cpus of the
+ *     schedulers, if co_sched_cpus or co_sched_numa_spread is set.
+ *   - The range is split in halves on demand, each thread pushes the halves
+ *     to its own Chase-Lev deque, and steals from others when it runs out of
+ *     work. The smallest range has @grain elements, 0 for a default that
+ *     gives each thread about 8 ranges.
+ *   - In a coroutine, the caller is suspended until the job is done, and the
+ *     scheduler goes on running other coroutines. In a thread of the pool, as
+ *     in nested loops, the caller takes part in the job. Otherwise, the caller
+ *     blocks until it is done.
+ *   - It is for cpu-bound work, use co::offload() for blocking calls.
+ *   - NOTE: @f is copied and runs in other threads while other coroutines may
+ *     be running on the shared stack of the caller when co_dedicated_stack is
+ *     false, it MUST NOT access variables on the stack of the caller then.
+ *
+ *   double* p = v.data(); // the elements are not on the stack
+ *   co::parallel_for(v.size(), [p](size_t b, size_t e) {
+ *       for (size_t i = b; i < e; ++i) p[i] = score(p[i]);
+ *   });
+ */
+__coapi void parallel_for(size_t n, const range_fn_t& f, size_t grain=0);
+
+// the default grain for a range of @n elements
+__coapi size_t parallel_grain(size_t n);
+
+/**
+ * reduce [0, n) in parallel
+ *   - @map(beg, end) returns the result of a subrange, and @reduce(a, b)
+ *     combines two results. Subranges are reduced in order, @reduce needs not
+ *     be commutative.
+ *   - @init is the result of an empty range.
+ *   - @map is copied, and the same as @f of parallel_for(), it MUST NOT access
+ *     variables on the stack of the caller.
+ *
+ *   const int64* p = v.data();
+ *   int64 sum = co::parallel_reduce(v.size(), (int64)0,
+ *       [p](size_t b, size_t e) { int64 s = 0; for (; b < e; ++b) s += p[b]; return s; },
+ *       [](int64 x, int64 y) { return x + y; }
+ *   );
+ */
+template <typename T, typename M, typename R>
+T parallel_reduce(size_t n, T init, M&& map, R&& reduce, size_t grain=0) {
+    if (n == 0) return init;
+    const size_t g = grain ? grain : co::parallel_grain(n);
+    const size_t k = (n + g - 1) / g;
+
+    // results of the subranges are not on the stack of the caller, they are
+    // all written when parallel_for() returns
+    auto v = co::make<co::array<T>>(k, init);
+    T* const a = v->data();
+    co::parallel_for(k, [a, g, n, map](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            const size_t x = i * g;
+            a[i] = map(x, x + g < n ? x + g : n);
+        }
+    }, 1);
+    T r = init;
+    for (size_t i = 0; i < k; ++i) r = reduce(r, a[i]);
+    co::del(v);
+    return r;
+}
+
+} // co
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "./co/sock.h"
+#include "flag.h"
+#include <functional>
+
+__coapi DEC_uint32(prefork_workers);
+
+// prefork mode, a master process with N worker processes (not for windows)
+//   - The master spawns prefork_workers workers by re-executing the program with
+//     the same arguments, and respawns a worker that crashed. Each worker has its
+//     own schedulers, allocator and logger, so nothing is shared across cores.
+//   - Listening sockets of tcp::Server (and http::Server, rpc::Server) are kept
+//     by the master. On linux, worker i listens on its own SO_REUSEPORT socket of
+//     the port, it gets the same socket back after a respawn. Other systems and
+//     unix domain sockets share one listening socket among the workers.
+//   - Level logs of the workers are sent to the master, and merged into its log
+//     file. TLOG and BLOG files of worker i are named with a "_w<i>" suffix.
+//   - SIGTERM or SIGINT to the master drains the workers: a worker stops
+//     accepting, waits up to prefork_drain_ms for connections to be closed, then
+//     exits. The master exits after all workers exited.
+//   - SIGUSR2 to the master starts a hot restart. It executes the program file,
+//     maybe a new binary, as a new master, and passes the listening sockets to it
+//     over a unix socket. Once every new worker started listening, the old master
+//     drains its workers and exits. Connections waiting in the listening sockets
+//     are not lost, as the sockets are never closed. The upgrade is abandoned if
+//     the new workers are not ready in prefork_ready_ms.
+//
+//   int main(int argc, char** argv) {
+//       flag::init(argc, argv);
+//       prefork::run(argc, argv); // returns in the workers
+//       http::Server().on_req(f).start("0.0.0.0", 80);
+//       while (true) sleep::sec(1024);
+//   }
+namespace prefork {
+
+/**
+ * run the master of prefork mode if prefork_workers > 0
+ *   - It MUST be called in main() after flag::init(), before any coroutine,
+ *     thread or server was started.
+ *   - The master never returns, it exits when the workers are stopped.
+ *
+ * @return  id of the worker in [0, prefork_workers), or -1 if prefork mode is
+ *          off, the caller is the only process then.
+ */
+__coapi int run(int argc, char** argv);
+
+// id of the current worker, or -1 if it is not a worker
+__coapi int worker_id();
+
+/**
+ * add a callback to call when the worker is asked to exit
+ *   - It is called in a separate thread, and it SHOULD return at once, e.g.
+ *     start stopping things without waiting for them. tcp::Server stops
+ *     accepting by itself.
+ */
+__coapi void on_drain(std::function<void()>&& cb);
+
+/**
+ * keep the worker from exiting on drain, until release() is called
+ *   - A worker exits when all holds are released, or prefork_drain_ms passed
+ *     since the drain started.
+ *   - tcp::Server holds its worker until the server and all its connections
+ *     are closed.
+ */
+__coapi void hold();
+__coapi void release();
+
+namespace xx {
+
+/**
+ * get the listening socket @key kept by the master, for tcp::Server
+ *   - @idx is the worker the socket belongs to, -1 if shared by all workers.
+ *   - If the socket is not there, it returns -1, the caller creates the socket
+ *     and passes it to keep(). Others asking for a shared socket wait until
+ *     then.
+ */
+__coapi sock_t listener(const char* key, int idx);
+
+// pass a listening socket to the master
+__coapi void keep(const char* key, int idx, sock_t fd);
+
+} // xx
+} // prefork
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "def.h"
+#include "hash/wyhash.h"
+#include <string.h>
 
+// 31-bit Lehmer generator, it is small and simple, see co::Wyrand for a
+// faster and better one.
 class __coapi Random {
   public:
     Random() : Random(1u) {}
@@ -25,3 +29,71 @@ class __coapi Random {
   private:
     uint32 _seed;
 };
+
+namespace co {
+
+/**
+ * wyrand, a 64-bit generator by Wang Yi 
+ *   - It is very fast and passes BigCrush and PractRand, but it is NOT 
+ *     cryptographically secure, use co::secure_random_bytes() for keys, 
+ *     tokens or IDs that must not be guessed. 
+ *   - It is not thread-safe, co::thread_rand() is the generator of the 
+ *     current thread. 
+ */
+class Wyrand {
+  public:
+    explicit Wyrand(uint64 seed=0) : _s(seed) {}
+
+    void seed(uint64 s) { _s = s; }
+
+    uint64 next() {
+        _s += 0xa0761d6478bd642full;
+        return wymix(_s, _s ^ 0xe7037ed1a0b428dbull);
+    }
+
+    // a value in [0, n), n > 0, the bias is negligible for n much less than 2^64
+    uint64 next(uint64 n) {
+        uint64 a = this->next(), b = n;
+        wymum(&a, &b);
+        return b;
+    }
+
+    // fill @n random bytes to @p
+    void fill(void* p, size_t n) {
+        char* s = (char*)p;
+        for (; n >= 8; n -= 8, s += 8) {
+            const uint64 v = this->next();
+            memcpy(s, &v, 8);
+        }
+        if (n > 0) {
+            const uint64 v = this->next();
+            memcpy(s, &v, n);
+        }
+    }
+
+  private:
+    uint64 _s;
+};
+
+// generator of the current thread, seeded by secure random bytes on first use
+__coapi Wyrand& thread_rand();
+
+inline uint64 rand64() {
+    return thread_rand().next();
+}
+
+// fill @n random bytes by the generator of the current thread
+inline void random_bytes(void* p, size_t n) {
+    thread_rand().fill(p, n);
+}
+
+/**
+ * fill @n random bytes from the CSPRNG of the system 
+ *   - getrandom() or /dev/urandom on linux, arc4random_buf() on mac and BSD, 
+ *     rand_s() on windows. It is much slower than random_bytes(). 
+ * 
+ * @return  false on error.
+ */
+__coapi bool secure_random_bytes(void* p, size_t n);
+
+} // co
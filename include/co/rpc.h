@@ -2,11 +2,341 @@
 
 #include "json.h"
 #include "stl.h"
+#include "./co/sock.h"
 #include <memory>
 #include <functional>
+#include <type_traits>
+
+namespace co { class Histogram; }
 
 namespace rpc {
 
+// status of calls with typed messages
+enum {
+    kNetError = -1,  // send or recv error, timeout, or a bad response
+    kOk = 0,
+    kNoMethod = 1,   // the method was not found on the server
+    kBadRequest = 2, // the server failed to decode the request
+    kOverloaded = 3, // the server rejected the request over a limit, see Server::limit_calls()
+};
+
+/**
+ * base of messages generated by gen from object definitions 
+ *   - Messages are encoded in a compact binary format. Fields are tagged with 
+ *     numbers in the order they are defined, integers are varints, strings, 
+ *     arrays and objects are length-prefixed. Fields of zero values are not 
+ *     encoded, and unknown fields are skipped by decode(). 
+ */
+class Message {
+  public:
+    virtual ~Message() = default;
+
+    // append the encoded message to s
+    virtual void encode(fastream& s) const = 0;
+
+    // fields not present are reset to zero, return false on bad data
+    virtual bool decode(const char* p, size_t n) = 0;
+};
+
+// encoding of messages, used by code generated by gen
+namespace wire {
+
+enum { kVarint = 0, kFixed64 = 1, kBytes = 2 };
+
+inline void put_varint(fastream& s, uint64 v) {
+    s.ensure(10);
+    uint8* const b = (uint8*)s.data() + s.size();
+    size_t i = 0;
+    for (; v >= 0x80; v >>= 7) b[i++] = (uint8)(v | 0x80);
+    b[i++] = (uint8)v;
+    s.resize(s.size() + i);
+}
+
+inline bool get_varint(const char*& p, const char* e, uint64& v) {
+    uint64 x = 0;
+    for (int k = 0; k < 64 && p < e; k += 7) {
+        const uint8 b = (uint8)*p++;
+        x |= (uint64)(b & 0x7f) << k;
+        if (!(b & 0x80)) { v = x; return true; }
+    }
+    return false;
+}
+
+inline void put_key(fastream& s, uint32 field, int type) {
+    put_varint(s, ((uint64)field << 3) | (uint32)type);
+}
+
+// signed integers are zigzag encoded, so that small negatives are small
+inline uint64 zigzag(int64 v) { return ((uint64)v << 1) ^ (uint64)(v >> 63); }
+inline int64 unzigzag(uint64 v) { return (int64)(v >> 1) ^ -(int64)(v & 1); }
+
+// a length-prefixed part, one byte is reserved for the length
+inline size_t begin_len(fastream& s) {
+    s.append('\0');
+    return s.size();
+}
+
+inline void end_len(fastream& s, size_t o) {
+    const size_t n = s.size() - o;
+    if (n < 0x80) { ((char*)s.data())[o - 1] = (char)n; return; }
+    uint8 b[10];
+    size_t k = 0;
+    for (uint64 v = n; ; v >>= 7) {
+        if (v < 0x80) { b[k++] = (uint8)v; break; }
+        b[k++] = (uint8)(v | 0x80);
+    }
+    s.resize(s.size() + k - 1);
+    char* const p = (char*)s.data() + o - 1;
+    memmove(p + k, p + 1, n);
+    memcpy(p, b, k);
+}
+
+// values without keys
+inline void put_value(fastream& s, bool v)   { s.append((char)(v ? 1 : 0)); }
+inline void put_value(fastream& s, int32 v)  { put_varint(s, zigzag(v)); }
+inline void put_value(fastream& s, int64 v)  { put_varint(s, zigzag(v)); }
+inline void put_value(fastream& s, uint32 v) { put_varint(s, v); }
+inline void put_value(fastream& s, uint64 v) { put_varint(s, v); }
+
+inline void put_value(fastream& s, double v) {
+    uint64 x;
+    memcpy(&x, &v, sizeof(x));
+    s.ensure(8);
+    uint8* const b = (uint8*)s.data() + s.size();
+    for (int i = 0; i < 8; ++i) b[i] = (uint8)(x >> (i * 8)); // little endian
+    s.resize(s.size() + 8);
+}
+
+inline bool get_value(const char*& p, const char* e, bool& v) {
+    uint64 x;
+    if (!get_varint(p, e, x)) return false;
+    v = x != 0;
+    return true;
+}
+
+inline bool get_value(const char*& p, const char* e, int32& v) {
+    uint64 x;
+    if (!get_varint(p, e, x)) return false;
+    v = (int32)unzigzag(x);
+    return true;
+}
+
+inline bool get_value(const char*& p, const char* e, int64& v) {
+    uint64 x;
+    if (!get_varint(p, e, x)) return false;
+    v = unzigzag(x);
+    return true;
+}
+
+inline bool get_value(const char*& p, const char* e, uint32& v) {
+    uint64 x;
+    if (!get_varint(p, e, x)) return false;
+    v = (uint32)x;
+    return true;
+}
+
+inline bool get_value(const char*& p, const char* e, uint64& v) {
+    return get_varint(p, e, v);
+}
+
+inline bool get_value(const char*& p, const char* e, double& v) {
+    if (e - p < 8) return false;
+    uint64 x = 0;
+    for (int i = 0; i < 8; ++i) x |= (uint64)(uint8)p[i] << (i * 8);
+    memcpy(&v, &x, sizeof(v));
+    p += 8;
+    return true;
+}
+
+inline bool get_bytes(const char*& p, const char* e, const char*& s, size_t& n) {
+    uint64 x;
+    if (!get_varint(p, e, x) || x > (uint64)(e - p)) return false;
+    s = p;
+    n = (size_t)x;
+    p += n;
+    return true;
+}
+
+// skip a field of unknown number, or of an unexpected type
+inline bool skip(const char*& p, const char* e, int type) {
+    uint64 x;
+    const char* s;
+    size_t n;
+    switch (type) {
+      case kVarint:  return get_varint(p, e, x);
+      case kFixed64: if (e - p < 8) return false; p += 8; return true;
+      case kBytes:   return get_bytes(p, e, s, n);
+      default:       return false;
+    }
+}
+
+template<typename T>
+inline int type_of() { return kVarint; }
+
+template<>
+inline int type_of<double>() { return kFixed64; }
+
+// fields with keys, zero values are not written
+template<typename T, typename std::enable_if<!std::is_base_of<Message, T>::value, int>::type = 0>
+inline void write(fastream& s, uint32 field, T v) {
+    if (v == T()) return;
+    put_key(s, field, type_of<T>());
+    put_value(s, v);
+}
+
+inline void write(fastream& s, uint32 field, const fastring& v) {
+    if (v.empty()) return;
+    put_key(s, field, kBytes);
+    put_varint(s, v.size());
+    s.append(v.data(), v.size());
+}
+
+inline void write(fastream& s, uint32 field, const Message& v) {
+    put_key(s, field, kBytes);
+    const size_t o = begin_len(s);
+    v.encode(s);
+    end_len(s, o);
+}
+
+// arrays of numbers are packed
+template<typename T, typename std::enable_if<!std::is_base_of<Message, T>::value, int>::type = 0>
+inline void write(fastream& s, uint32 field, const co::vector<T>& v) {
+    if (v.empty()) return;
+    put_key(s, field, kBytes);
+    const size_t o = begin_len(s);
+    for (size_t i = 0; i < v.size(); ++i) put_value(s, (T)v[i]);
+    end_len(s, o);
+}
+
+inline void write(fastream& s, uint32 field, const co::vector<fastring>& v) {
+    for (size_t i = 0; i < v.size(); ++i) {
+        put_key(s, field, kBytes);
+        put_varint(s, v[i].size());
+        s.append(v[i].data(), v[i].size());
+    }
+}
+
+template<typename T, typename std::enable_if<std::is_base_of<Message, T>::value, int>::type = 0>
+inline void write(fastream& s, uint32 field, const co::vector<T>& v) {
+    for (size_t i = 0; i < v.size(); ++i) write(s, field, (const Message&)v[i]);
+}
+
+// read a field of type @t, a field of an unexpected type is skipped
+template<typename T, typename std::enable_if<!std::is_base_of<Message, T>::value, int>::type = 0>
+inline bool read(const char*& p, const char* e, int t, T& v) {
+    if (t != type_of<T>()) return skip(p, e, t);
+    return get_value(p, e, v);
+}
+
+inline bool read(const char*& p, const char* e, int t, fastring& v) {
+    if (t != kBytes) return skip(p, e, t);
+    const char* s;
+    size_t n;
+    if (!get_bytes(p, e, s, n)) return false;
+    v.clear();
+    v.append(s, n);
+    return true;
+}
+
+inline bool read(const char*& p, const char* e, int t, Message& v) {
+    if (t != kBytes) return skip(p, e, t);
+    const char* s;
+    size_t n;
+    return get_bytes(p, e, s, n) && v.decode(s, n);
+}
+
+template<typename T, typename std::enable_if<!std::is_base_of<Message, T>::value, int>::type = 0>
+inline bool read(const char*& p, const char* e, int t, co::vector<T>& v) {
+    T x;
+    if (t != kBytes) { /* not packed */
+        if (t != type_of<T>()) return skip(p, e, t);
+        if (!get_value(p, e, x)) return false;
+        v.push_back(x);
+        return true;
+    }
+    const char* s;
+    size_t n;
+    if (!get_bytes(p, e, s, n)) return false;
+    for (const char* const b = s + n; s < b;) {
+        if (!get_value(s, b, x)) return false;
+        v.push_back(x);
+    }
+    return true;
+}
+
+inline bool read(const char*& p, const char* e, int t, co::vector<fastring>& v) {
+    v.push_back(fastring());
+    return read(p, e, t, v.back());
+}
+
+template<typename T, typename std::enable_if<std::is_base_of<Message, T>::value, int>::type = 0>
+inline bool read(const char*& p, const char* e, int t, co::vector<T>& v) {
+    v.push_back(T());
+    return read(p, e, t, (Message&)v.back());
+}
+
+} // wire
+
+/**
+ * a stream of json messages on a connection of rpc::Client 
+ *   - A stream is opened by the client with a request, e.g. {"api":"export"}, 
+ *     and served by a stream method on the server. Both sides can write any 
+ *     number of messages, each of them is limited by rpc_max_msg_size, but not 
+ *     the stream. 
+ *   - Flow control is per stream. A side may have up to rpc_stream_window 
+ *     messages of the peer in flight, and write() blocks when the window of the 
+ *     peer is full, until the peer has read some of them. 
+ *   - The server ends the stream when the stream method returns, and the client 
+ *     can not write any more then. A client that ends its part with finish() can 
+ *     still read messages of the server, e.g. a result of the messages it wrote. 
+ *   - A stream of the client MUST be read to the end of it, see read(), before 
+ *     the connection of rpc::Client can be used again. If it was destroyed before 
+ *     that, the connection is closed, and the call is cancelled. 
+ */
+class __coapi Stream {
+  public:
+    explicit Stream(void* p=0) : _p(p) {}
+    Stream(Stream&& s) noexcept : _p(s._p) { s._p = 0; }
+    ~Stream();
+
+    Stream& operator=(Stream&& s) noexcept;
+
+    Stream(const Stream&) = delete;
+    void operator=(const Stream&) = delete;
+
+    /**
+     * read the next message of the peer 
+     *   - On timeout, it returns false without an error, and it can be called 
+     *     again. Check co::timeout() to tell it from the end of the stream. 
+     * 
+     * @param ms  timeout in milliseconds, -1 for rpc_recv_timeout.
+     * 
+     * @return    false at the end of the stream, or on error or timeout.
+     */
+    bool read(Json& msg, int ms=-1);
+
+    /**
+     * write a message to the peer 
+     *   - It waits at most rpc_send_timeout for the peer to take messages when 
+     *     the window is full. 
+     * 
+     * @return  false on error or timeout, or the stream was ended.
+     */
+    bool write(const Json& msg);
+
+    // end messages of this side, the peer reads the end of the stream then
+    bool finish();
+
+    // false if the stream failed on error or timeout, or it was not opened
+    bool ok() const;
+
+    // the peer has ended its messages
+    bool done() const;
+
+  private:
+    void* _p;
+};
+
 class Service {
   public:
     Service() = default;
@@ -14,10 +344,36 @@ class Service {
 
     typedef std::function<void(Json&, Json&)> Fun;
 
+    // decode the request from [p, p + n), append the encoded response to s,
+    // and return the status, kOk on success
+    typedef std::function<int(const char* p, size_t n, fastream& s)> BinFun;
+
+    // serve a stream opened with the request
+    typedef std::function<void(Json& req, Stream& s)> StreamFun;
+
     virtual const char* name() const = 0;
     virtual const co::map<const char*, Fun>& methods() const = 0;
+
+    // methods with typed messages by method id, generated by gen
+    virtual const co::map<uint32, BinFun>* bin_methods() const { return 0; }
+
+    // methods serving streams by name, e.g. "export"
+    virtual const co::map<const char*, StreamFun>* stream_methods() const { return 0; }
 };
 
+/**
+ * time in ms left before the deadline of the request served in the current coroutine 
+ *   - rpc clients send the timeout of a call as the deadline of the request, if 
+ *     rpc_deadline is true. The server drops requests that have expired before 
+ *     they are served, as the clients have given up. 
+ *   - Calls made by rpc clients while serving a request are bounded by the time 
+ *     left, and pass it on to the next server. A method doing long work may also 
+ *     check it to stop early. 
+ * 
+ * @return  ms left, 0 if it has expired, or -1 if there is no deadline.
+ */
+__coapi int64 time_left();
+
 class __coapi Server {
   public:
     Server();
@@ -36,11 +392,38 @@ class __coapi Server {
         return this->add_service(std::shared_ptr<Service>(s));
     }
 
+    /**
+     * limit connections of the server, see tcp::Server::limit() 
+     *   - Connections rejected are reset at once. 
+     */
+    Server& limit(uint32 max_conn, uint32 accept_rate=0);
+
+    // set a load-shedding callback, see tcp::Server::on_admit()
+    Server& on_admit(std::function<bool(sock_t)>&& f);
+
+    /**
+     * limit requests of a method or a service served at the same time 
+     *   - @name is a method, e.g. "HelloWorld.hello", or a service, e.g. "HelloWorld", 
+     *     whose methods, including those with typed messages, share the limit. A 
+     *     method may have both limits. Streams are not limited. 
+     *   - Requests over the limit wait, up to @max_queue of them, until others are 
+     *     done, or the deadline of the request, see time_left(). Requests not served 
+     *     in the time, or when the queue is full, are rejected at once with the 
+     *     error "overloaded", or kOverloaded for typed messages. 
+     *   - If @adaptive is true, the limit adapts between 1 and @max_concurrency: it 
+     *     is cut when the latency grows well over the lowest seen recently, as 
+     *     requests queue up for something in the method, and it grows by 1 when it 
+     *     was reached with a good latency (AIMD). 
+     *   - It MUST be called before start(). 
+     */
+    Server& limit_calls(const char* name, uint32 max_concurrency, uint32 max_queue=0, bool adaptive=false);
+
     /**
      * start the rpc server 
      *   - By default, key and ca are NULL, and ssl is disabled.
      * 
-     * @param ip    server ip, either an ipv4 or ipv6 address.
+     * @param ip    server ip, either an ipv4 or ipv6 address. "unix:/path" for a 
+     *              unix domain socket, see tcp::Server::start().
      * @param port  server port
      * @param url   the url used to access the HTTP server, MUST begins with '/'
      * @param key   path of ssl private key file.
@@ -57,6 +440,9 @@ class __coapi Server {
      */
     void exit();
 
+    // time in microseconds of the methods called, valid until the server exits
+    const co::Histogram& histogram() const;
+
   private:
     void* _p;
 
@@ -65,6 +451,7 @@ class __coapi Server {
 
 class __coapi Client {
   public:
+    // ip may be "unix:/path" for a unix domain socket, see tcp::Client
     Client(const char* ip, int port, bool use_ssl=false);
     Client(const Client& c);
     ~Client();
@@ -74,6 +461,26 @@ class __coapi Client {
     // perform a rpc request
     void call(const Json& req, Json& res);
 
+    /**
+     * perform a rpc request with typed messages, see code generated by gen 
+     * 
+     * @param method  id of the method.
+     * 
+     * @return        kOk on success, kNetError on error or timeout, or the status 
+     *                returned by the server, e.g. kNoMethod.
+     */
+    int call(uint32 method, const Message& req, Message& res);
+
+    /**
+     * open a stream with a request, the request is served by a stream method 
+     *   - The client MUST NOT be used for other calls until the stream was read 
+     *     to the end, or destroyed. 
+     *   - The stream fails if it is not supported by the server. 
+     * 
+     * @return  a stream, check ok() of it for errors.
+     */
+    Stream stream(const Json& req);
+
     // send a heartbeat
     void ping();
 
@@ -84,4 +491,83 @@ class __coapi Client {
     void* _p;
 };
 
+/**
+ * rpc client that multiplexes calls on a connection 
+ *   - Each scheduler has one connection to the server, shared by all coroutines 
+ *     in it. Calls are tagged with request ids, and many of them can be in flight 
+ *     on the connection at the same time, instead of one per rpc::Client. 
+ *   - Requests from coroutines are sent together when the connection is busy, 
+ *     and a coroutine reads the responses and wakes up the callers, in whatever 
+ *     order the server replies. rpc::Server serves requests on a connection in 
+ *     order by default, so a slow call delays those behind it, unless 
+ *     rpc_conn_concurrency is set > 1 on the server. 
+ *   - The server MUST support request ids, as rpc::Server does. An older server 
+ *     takes the request id as part of the body, and the call fails. 
+ *   - It MUST be used in coroutines. The object is shared rather than copied, 
+ *     and it MUST outlive all the calls on it. 
+ */
+class __coapi MuxClient {
+  public:
+    MuxClient(const char* ip, int port, bool use_ssl=false);
+    ~MuxClient();
+
+    MuxClient(const MuxClient&) = delete;
+    void operator=(const MuxClient&) = delete;
+
+    // perform a rpc request, res is null on error or timeout
+    void call(const Json& req, Json& res);
+
+    // send a heartbeat
+    void ping();
+
+    // close the connection of the current scheduler, calls on it will fail
+    void close();
+
+  private:
+    void* _p;
+};
+
+/**
+ * rpc client for a set of endpoints, e.g. replicas of a service 
+ *   - Each endpoint has a pool of connections for each scheduler, it is shared 
+ *     by all coroutines of the scheduler, and connections are reused by calls. 
+ *   - A call goes to the endpoint with fewer outstanding requests, of two chosen 
+ *     at random (power of two choices). 
+ *   - An endpoint that failed rpc_eject_failures calls in a row is ejected for 
+ *     rpc_eject_ms, longer if it is ejected again. At most half of the endpoints 
+ *     can be ejected at the same time. 
+ *   - It MUST be used in coroutines. The object is shared rather than copied, 
+ *     and it MUST outlive all the calls on it, including hedged requests that 
+ *     are still running after the call returned. 
+ */
+class __coapi Channel {
+  public:
+    /**
+     * @param endpoints  "ip:port" separated by commas, e.g. "10.0.0.1:7788,10.0.0.2:7788", 
+     *                   ipv6 addresses are in brackets, e.g. "[::1]:7788".
+     * @param use_ssl    use ssl for all the endpoints if true.
+     */
+    explicit Channel(const char* endpoints, bool use_ssl=false);
+    ~Channel();
+
+    Channel(const Channel&) = delete;
+    void operator=(const Channel&) = delete;
+
+    /**
+     * perform a rpc request 
+     *   - res is null if the call failed. 
+     * 
+     * @param hedge  if true, the request is sent to another endpoint when there is 
+     *               no response in rpc_hedge_ms, or the first endpoint failed, and 
+     *               the first response wins. Use it for idempotent requests only.
+     */
+    void call(const Json& req, Json& res, bool hedge=false);
+
+    // number of the endpoints
+    size_t size() const;
+
+  private:
+    void* _p;
+};
+
 } // rpc
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "array.h"
+
+namespace co {
+
+/**
+ * array with inline storage for N elements
+ *   - No memory is allocated until the size grows beyond N, then elements are
+ *     moved to the heap, allocated by Alloc like co::array.
+ *   - It has the same methods as co::array. reset() frees the heap memory and
+ *     the array uses the inline storage again.
+ *   - NOTE: moving or swapping an inline array moves the elements one by one,
+ *     pointers to them are not stable as they are for co::array.
+ */
+template <typename T, size_t N, typename Alloc=co::default_allocator>
+class small_array {
+    static_assert(N > 0, "N must be greater than 0");
+
+  public:
+    typedef typename co::array<T, Alloc>::iterator iterator;
+
+    small_array() noexcept
+        : _cap(N), _size(0), _p(this->_buf()) {
+    }
+
+    /**
+     * constructor with a capacity
+     *   - NOTE: size of the array will be 0, which is different from std::vector
+     *
+     * @param cap  capacity of the array, the inline storage is used if cap <= N.
+     */
+    explicit small_array(size_t cap) : small_array() {
+        this->reserve(cap);
+    }
+
+    small_array(size_t n, const T& x) : small_array(n) {
+        for (size_t i = 0; i < n; ++i) new (_p + i) T(x);
+        _size = n;
+    }
+
+    small_array(const small_array& x) : small_array(x.size()) {
+        this->_push_back(x.data(), x.size(), B<god::is_trivially_copyable<T>()>());
+    }
+
+    small_array(small_array&& x) : small_array() {
+        this->_take(x);
+    }
+
+    // co::small_array<int, 4> v = { 1, 2, 3 };
+    small_array(std::initializer_list<T> x) : small_array(x.size()) {
+        for (const auto& e : x) new (_p + _size++) T(e);
+    }
+
+    template <typename It, god::enable_if_t<god::is_class<It>(), int> = 0>
+    small_array(It beg, It end) : small_array() {
+        this->push_back(beg, end);
+    }
+
+    // create array from an array
+    small_array(T* p, size_t n) : small_array(n) {
+        this->_push_back(p, n, B<god::is_trivially_copyable<T>()>());
+    }
+
+    ~small_array() {
+        this->reset();
+    }
+
+    size_t capacity() const { return _cap; }
+    size_t size() const { return _size; }
+    T* data() const { return _p; }
+    bool empty() const { return this->size() == 0; }
+
+    // whether the elements are in the inline storage
+    bool is_inline() const { return _p == this->_buf(); }
+
+    T& back() { return _p[_size - 1]; }
+    const T& back() const { return _p[_size - 1]; }
+
+    T& front() { return _p[0]; }
+    const T& front() const { return _p[0]; }
+
+    T& operator[](size_t n) { return _p[n]; }
+    const T& operator[](size_t n) const { return _p[n]; }
+
+    small_array& operator=(const small_array& x) {
+        if (&x != this) {
+            this->clear();
+            this->reserve(x.size());
+            this->_push_back(x.data(), x.size(), B<god::is_trivially_copyable<T>()>());
+        }
+        return *this;
+    }
+
+    small_array& operator=(small_array&& x) {
+        if (&x != this) {
+            this->reset();
+            this->_take(x);
+        }
+        return *this;
+    }
+
+    small_array& operator=(std::initializer_list<T> x) {
+        this->clear();
+        this->reserve(x.size());
+        for (const auto& e : x) new (_p + _size++) T(e);
+        return *this;
+    }
+
+    void reserve(size_t n) {
+        if (_cap < n) {
+            if (this->is_inline()) {
+                T* const p = (T*) Alloc::alloc(sizeof(T) * n); assert(p);
+                this->_relocate(p, B<god::is_trivially_copyable<T>()>());
+                _p = p;
+            } else {
+                _p = (T*) Alloc::realloc(_p, sizeof(T) * _cap, sizeof(T) * n); assert(_p);
+            }
+            _cap = n;
+        }
+    }
+
+    /**
+     * size -> n
+     *   - Reduced elements will be destroyed if n is less than the current size.
+     *   - NOTE: No element will be created if n is greater than the current size.
+     */
+    void resize(size_t n) {
+        this->reserve(n);
+        this->_resize(n, B<god::is_trivially_destructible<T>()>());
+    }
+
+    // destroy all elements, free the heap memory if any
+    void reset() {
+        this->clear();
+        if (!this->is_inline()) {
+            Alloc::free(_p, sizeof(T) * _cap);
+            _p = this->_buf();
+            _cap = N;
+        }
+    }
+
+    void clear() {
+        this->_resize(0, B<god::is_trivially_destructible<T>()>());
+    }
+
+    void push_back(const T& x) {
+        if (unlikely(_cap == _size)) this->reserve(_cap + (_cap >> 1) + 1);
+        new (_p + _size++) T(x);
+    }
+
+    void push_back(T&& x) {
+        if (unlikely(_cap == _size)) this->reserve(_cap + (_cap >> 1) + 1);
+        new (_p + _size++) T(std::move(x));
+    }
+
+    void push_back(size_t n, const T& x) {
+        const size_t m = n + _size;
+        this->reserve(m);
+        for (size_t i = _size; i < m; ++i) new (_p + i) T(x);
+        _size += n;
+    }
+
+    template <typename It, god::enable_if_t<god::is_class<It>(), int> = 0>
+    void push_back(It beg, It end) {
+        for (auto it = beg; it != end; ++it) {
+            this->push_back(*it);
+        }
+    }
+
+    // append n elements from an array
+    void push_back(T* p, size_t n) {
+        this->reserve(_size + n);
+        this->_push_back(p, n, B<god::is_trivially_copyable<T>()>());
+    }
+
+    T pop_back() {
+        return std::move(_p[--_size]);
+    }
+
+    // remove the last element
+    void remove_back() {
+        this->_remove_back(B<god::is_trivially_destructible<T>()>());
+    }
+
+    /**
+     * remove the nth element, and move the last element to the nth position
+     *  - NOTE: n MUST < size
+     */
+    void remove(size_t n) {
+        assert(n < _size);
+        if (n != _size - 1) {
+            this->_remove(n, B<god::is_trivially_destructible<T>()>());
+        } else {
+            this->remove_back();
+        }
+    }
+
+    void swap(small_array& x) {
+        if (&x == this) return;
+        if (!this->is_inline() && !x.is_inline()) {
+            std::swap(_cap, x._cap);
+            std::swap(_size, x._size);
+            std::swap(_p, x._p);
+        } else {
+            small_array t(std::move(x));
+            x = std::move(*this);
+            *this = std::move(t);
+        }
+    }
+
+    void swap(small_array&& x) {
+        x.swap(*this);
+    }
+
+    iterator begin() const {
+        return iterator(_p);
+    }
+
+    iterator end() const {
+        return iterator(_p + _size);
+    }
+
+  private:
+    template<bool> struct B {};
+
+    T* _buf() const { return (T*)_s; }
+
+    // take the elements of x, which is left empty, *this MUST be empty and inline
+    void _take(small_array& x) {
+        if (x.is_inline()) {
+            x._relocate(_p, B<god::is_trivially_copyable<T>()>());
+            _size = x._size;
+            x._size = 0;
+        } else {
+            _cap = x._cap;
+            _size = x._size;
+            _p = x._p;
+            x._p = x._buf();
+            x._cap = N;
+            x._size = 0;
+        }
+    }
+
+    // move elements to p, the elements here are destroyed
+    void _relocate(T* p, B<true>) {
+        if (_size) memcpy((void*)p, (void*)_p, sizeof(T) * _size);
+    }
+
+    void _relocate(T* p, B<false>) {
+        for (size_t i = 0; i < _size; ++i) {
+            new (p + i) T(std::move(_p[i]));
+            _p[i].~T();
+        }
+    }
+
+    void _push_back(const T* p, size_t n, B<true>) {
+        if (n) memcpy((void*)(_p + _size), (const void*)p, n * sizeof(T));
+        _size += n;
+    }
+
+    void _push_back(const T* p, size_t n, B<false>) {
+        T* const x = _p + _size;
+        for (size_t i = 0; i < n; ++i) new (x + i) T(p[i]);
+        _size += n;
+    }
+
+    void _resize(size_t n, B<true>) {
+        _size = n;
+    }
+
+    void _resize(size_t n, B<false>) {
+        for (size_t i = n; i < _size; ++i) _p[i].~T();
+        _size = n;
+    }
+
+    void _remove_back(B<true>) {
+        --_size;
+    }
+
+    void _remove_back(B<false>) {
+        _p[--_size].~T();
+    }
+
+    void _remove(size_t n, B<true>) {
+        new (_p + n) T(std::move(_p[--_size]));
+    }
+
+    void _remove(size_t n, B<false>) {
+        _p[n].~T();
+        new (_p + n) T(std::move(_p[--_size]));
+    }
+
+  private:
+    size_t _cap;
+    size_t _size;
+    T* _p;
+    alignas(T) char _s[sizeof(T) * N];
+};
+
+} // co
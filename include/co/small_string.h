@@ -0,0 +1,382 @@
+#pragma once
+
+#include "fastring.h"
+
+namespace co {
+
+/**
+ * string with small-string optimization
+ *   - Strings up to 22 bytes are stored inline, without memory allocation.
+ *     Longer ones are on the heap, allocated by co::alloc() like fastring.
+ *   - It is 24 bytes, as fastring. On the heap, the buffer is the same as that
+ *     of fastring, a long string is moved from or to a fastring without copy.
+ *   - The data is always null-terminated, c_str() is the same as data().
+ *   - It has the common methods of fastring. Call str() to get a fastring for
+ *     the others.
+ *
+ *   - Layout: the first byte is (size << 1 | 1) for an inline string, followed
+ *     by the data. Otherwise, the first word is (capacity << 1), it is even,
+ *     and the lowest bit is also 0 in the first byte on big-endian machines,
+ *     as the capacity is far less than 2^55.
+ */
+class small_string {
+  public:
+    static const size_t npos = (size_t)-1;
+    static const size_t kInline = 22; // max bytes stored inline
+
+    small_string() noexcept { this->_set_inline(0); }
+
+    small_string(const void* s, size_t n) {
+        this->_init(n);
+        if (n) memcpy(this->_data(), s, n);
+    }
+
+    small_string(const char* s) : small_string(s, strlen(s)) {}
+    small_string(const fastring& s) : small_string(s.data(), s.size()) {}
+    small_string(const std::string& s) : small_string(s.data(), s.size()) {}
+    small_string(const small_string& s) : small_string(s.data(), s.size()) {}
+
+    small_string(size_t n, char c) {
+        this->_init(n);
+        if (n) memset(this->_data(), c, n);
+    }
+
+    // take over the buffer of a long fastring, a short one is copied inline
+    small_string(fastring&& s) {
+        const size_t n = s.size();
+        if (n <= kInline) {
+            this->_set_inline(n);
+            if (n) memcpy(_s.s, s.data(), n);
+            return;
+        }
+        s.reserve(n + 1); // room for '\0'
+        const size_t cap = s.capacity();
+        void* const p = (void*) s.data();
+        new (&s) fastring(); // s is moved, its buffer is ours now
+        _h.cap2 = cap << 1;
+        _h.size = n;
+        _h.p = (char*)p;
+        _h.p[n] = '\0';
+    }
+
+    small_string(small_string&& s) noexcept {
+        memcpy((void*)this, (void*)&s, sizeof(*this));
+        s._set_inline(0);
+    }
+
+    ~small_string() {
+        if (!this->_is_inline()) co::free(_h.p, _h.cap2 >> 1);
+    }
+
+    small_string& operator=(const small_string& s) {
+        if (&s != this) this->assign(s.data(), s.size());
+        return *this;
+    }
+
+    small_string& operator=(small_string&& s) noexcept {
+        if (&s != this) {
+            this->~small_string();
+            new (this) small_string(std::move(s));
+        }
+        return *this;
+    }
+
+    small_string& operator=(const char* s) { return this->assign(s, strlen(s)); }
+    small_string& operator=(const fastring& s) { return this->assign(s.data(), s.size()); }
+    small_string& operator=(const std::string& s) { return this->assign(s.data(), s.size()); }
+
+    small_string& assign(const void* s, size_t n) {
+        if (n > this->capacity()) {
+            small_string(s, n).swap(*this);
+        } else {
+            memmove(this->_data(), s, n); // s may be inside this string
+            this->_set_size(n);
+        }
+        return *this;
+    }
+
+    bool is_inline() const { return this->_is_inline(); }
+
+    const char* data() const { return _is_inline() ? _s.s : _h.p; }
+    const char* c_str() const { return this->data(); }
+    size_t size() const { return _is_inline() ? (_s.tag >> 1) : _h.size; }
+    bool empty() const { return this->size() == 0; }
+
+    // max bytes without reallocation, '\0' excluded
+    size_t capacity() const { return _is_inline() ? kInline : (_h.cap2 >> 1) - 1; }
+
+    char& operator[](size_t i) const { return ((char*)this->data())[i]; }
+    char& front() const { return (*this)[0]; }
+    char& back() const { return (*this)[this->size() - 1]; }
+
+    void clear() { this->_set_size(0); }
+
+    // free the memory on the heap, and make it an empty string
+    void reset() {
+        this->~small_string();
+        this->_set_inline(0);
+    }
+
+    void reserve(size_t n) {
+        if (n > this->capacity()) this->_grow_to(n);
+    }
+
+    // data in the new part is uninitialized
+    void resize(size_t n) {
+        this->reserve(n);
+        this->_set_size(n);
+    }
+
+    void resize(size_t n, char c) {
+        const size_t x = this->size();
+        this->resize(n);
+        if (n > x) memset(this->_data() + x, c, n - x);
+    }
+
+    small_string& append(const void* p, size_t n) {
+        const size_t x = this->size();
+        if (x + n > this->capacity()) {
+            const char* const d = this->data();
+            if ((const char*)p >= d && (const char*)p < d + x) { // p is inside
+                const size_t off = (const char*)p - d;
+                this->_grow(n);
+                p = this->data() + off;
+            } else {
+                this->_grow(n);
+            }
+        }
+        memcpy(this->_data() + x, p, n);
+        this->_set_size(x + n);
+        return *this;
+    }
+
+    small_string& append(const char* s) { return this->append(s, strlen(s)); }
+    small_string& append(const fastring& s) { return this->append(s.data(), s.size()); }
+    small_string& append(const std::string& s) { return this->append(s.data(), s.size()); }
+    small_string& append(const small_string& s) { return this->append(s.data(), s.size()); }
+
+    small_string& append(size_t n, char c) {
+        const size_t x = this->size();
+        if (x + n > this->capacity()) this->_grow(n);
+        memset(this->_data() + x, c, n);
+        this->_set_size(x + n);
+        return *this;
+    }
+
+    small_string& append(char c) {
+        const size_t x = this->size();
+        if (x == this->capacity()) this->_grow(1);
+        this->_data()[x] = c;
+        this->_set_size(x + 1);
+        return *this;
+    }
+
+    small_string& operator+=(const char* s) { return this->append(s); }
+    small_string& operator+=(const fastring& s) { return this->append(s); }
+    small_string& operator+=(const small_string& s) { return this->append(s); }
+    small_string& operator+=(char c) { return this->append(c); }
+
+    small_string& operator<<(const char* s) { return this->append(s); }
+    small_string& operator<<(const fastring& s) { return this->append(s); }
+    small_string& operator<<(const std::string& s) { return this->append(s); }
+    small_string& operator<<(const small_string& s) { return this->append(s); }
+    small_string& operator<<(char c) { return this->append(c); }
+    small_string& operator<<(bool v) { return v ? this->append("true", 4) : this->append("false", 5); }
+
+    small_string& operator<<(int v) { char b[24]; return this->append(b, fast::itoa(v, b)); }
+    small_string& operator<<(unsigned int v) { char b[24]; return this->append(b, fast::utoa(v, b)); }
+    small_string& operator<<(long v) { char b[24]; return this->append(b, fast::itoa(v, b)); }
+    small_string& operator<<(unsigned long v) { char b[24]; return this->append(b, fast::utoa(v, b)); }
+    small_string& operator<<(long long v) { char b[24]; return this->append(b, fast::itoa(v, b)); }
+    small_string& operator<<(unsigned long long v) { char b[24]; return this->append(b, fast::utoa(v, b)); }
+    small_string& operator<<(double v) { char b[32]; return this->append(b, fast::dtoa(v, b, 6)); }
+
+    small_string substr(size_t pos, size_t len=npos) const {
+        const size_t n = this->size();
+        if (pos >= n) return small_string();
+        const size_t k = n - pos;
+        return small_string(this->data() + pos, len < k ? len : k);
+    }
+
+    size_t find(char c, size_t pos=0) const {
+        const size_t n = this->size();
+        if (pos >= n) return npos;
+        const char* const d = this->data();
+        const char* const p = (const char*) memchr(d + pos, c, n - pos);
+        return p ? p - d : npos;
+    }
+
+    size_t find(const char* s, size_t pos=0) const {
+        const size_t n = this->size();
+        if (pos > n) return npos;
+        const char* const d = this->data();
+        const char* const p = fast::memmem(d + pos, n - pos, s, strlen(s));
+        return p ? p - d : npos;
+    }
+
+    size_t rfind(char c) const {
+        const char* const d = this->data();
+        for (size_t i = this->size(); i > 0; --i) {
+            if (d[i - 1] == c) return i - 1;
+        }
+        return npos;
+    }
+
+    bool starts_with(char c) const { return !this->empty() && this->front() == c; }
+    bool ends_with(char c) const { return !this->empty() && this->back() == c; }
+
+    bool starts_with(const char* s, size_t n) const {
+        return n <= this->size() && memcmp(this->data(), s, n) == 0;
+    }
+
+    bool ends_with(const char* s, size_t n) const {
+        const size_t x = this->size();
+        return n <= x && memcmp(this->data() + x - n, s, n) == 0;
+    }
+
+    bool starts_with(const char* s) const { return this->starts_with(s, strlen(s)); }
+    bool ends_with(const char* s) const { return this->ends_with(s, strlen(s)); }
+
+    // copy to a fastring
+    fastring str() const & { return fastring(this->data(), this->size()); }
+
+    // move to a fastring, without copy if it is on the heap
+    fastring str() && {
+        if (this->_is_inline()) return fastring(_s.s, this->size());
+        fastring s(_h.p, _h.size, _h.cap2 >> 1);
+        this->_set_inline(0);
+        return s;
+    }
+
+    void swap(small_string& s) noexcept {
+        char t[sizeof(*this)];
+        memcpy(t, (void*)&s, sizeof(*this));
+        memcpy((void*)&s, (void*)this, sizeof(*this));
+        memcpy((void*)this, t, sizeof(*this));
+    }
+
+    void swap(small_string&& s) noexcept { s.swap(*this); }
+
+  private:
+    bool _is_inline() const { return _s.tag & 1; }
+    char* _data() { return _is_inline() ? _s.s : _h.p; }
+
+    void _set_inline(size_t n) {
+        _s.tag = (uint8)((n << 1) | 1);
+        _s.s[n] = '\0';
+    }
+
+    void _set_size(size_t n) {
+        if (_is_inline()) {
+            _s.tag = (uint8)((n << 1) | 1);
+            _s.s[n] = '\0';
+        } else {
+            _h.size = n;
+            _h.p[n] = '\0';
+        }
+    }
+
+    // size n, data uninitialized
+    void _init(size_t n) {
+        if (n <= kInline) {
+            this->_set_inline(n);
+        } else {
+            _h.cap2 = (n + 1) << 1;
+            _h.size = n;
+            _h.p = (char*) co::alloc(n + 1);
+            _h.p[n] = '\0';
+        }
+    }
+
+    // room for n more bytes, grow by 1.5x at least
+    void _grow(size_t n) {
+        const size_t x = this->capacity();
+        const size_t m = this->size() + n;
+        this->_grow_to(m > x + (x >> 1) ? m : x + (x >> 1));
+    }
+
+    // capacity to n bytes, n > capacity()
+    void _grow_to(size_t n) {
+        const size_t n1 = n + 1;
+        if (this->_is_inline()) {
+            const size_t x = this->size();
+            char* const p = (char*) co::alloc(n1);
+            memcpy(p, _s.s, x + 1);
+            _h.p = p;
+            _h.size = x;
+        } else {
+            _h.p = (char*) co::realloc(_h.p, _h.cap2 >> 1, n1);
+        }
+        _h.cap2 = n1 << 1;
+        assert(_h.p);
+    }
+
+    struct Heap {
+        size_t cap2;  // capacity << 1, '\0' included
+        size_t size;
+        char* p;
+    };
+
+    struct Inline {
+        uint8 tag;    // size << 1 | 1
+        char s[kInline + 1];
+    };
+
+    union {
+        Heap _h;
+        Inline _s;
+    };
+};
+
+inline bool operator==(const small_string& a, const small_string& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator==(const small_string& a, const fastring& b) {
+    return a.size() == b.size() && (b.size() == 0 || memcmp(a.data(), b.data(), b.size()) == 0);
+}
+
+inline bool operator==(const small_string& a, const char* b) {
+    return a.size() == strlen(b) && memcmp(a.data(), b, a.size()) == 0;
+}
+
+inline bool operator==(const fastring& a, const small_string& b) { return b == a; }
+inline bool operator==(const char* a, const small_string& b) { return b == a; }
+inline bool operator!=(const small_string& a, const small_string& b) { return !(a == b); }
+inline bool operator!=(const small_string& a, const fastring& b) { return !(a == b); }
+inline bool operator!=(const small_string& a, const char* b) { return !(a == b); }
+inline bool operator!=(const fastring& a, const small_string& b) { return !(b == a); }
+inline bool operator!=(const char* a, const small_string& b) { return !(b == a); }
+
+inline bool operator<(const small_string& a, const small_string& b) {
+    const size_t n = a.size() < b.size() ? a.size() : b.size();
+    const int r = memcmp(a.data(), b.data(), n);
+    return r < 0 || (r == 0 && a.size() < b.size());
+}
+
+inline bool operator>(const small_string& a, const small_string& b) { return b < a; }
+inline bool operator<=(const small_string& a, const small_string& b) { return !(b < a); }
+inline bool operator>=(const small_string& a, const small_string& b) { return !(a < b); }
+
+} // co
+
+inline fastream& operator<<(fastream& fs, const co::small_string& s) {
+    return fs.append(s.data(), s.size());
+}
+
+inline fastring& operator<<(fastring& fs, const co::small_string& s) {
+    return fs.append(s.data(), s.size());
+}
+
+inline std::ostream& operator<<(std::ostream& os, const co::small_string& s) {
+    return os.write(s.data(), s.size());
+}
+
+namespace std {
+template<>
+struct hash<co::small_string> {
+    size_t operator()(const co::small_string& s) const {
+        return wyhash(s.data(), s.size());
+    }
+};
+} // std
@@ -4,3 +4,5 @@
 #include "http.h"
 #include "rpc.h"
 #include "ssl.h"
+#include "dns.h"
+#include "udp.h"
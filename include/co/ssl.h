@@ -26,6 +26,10 @@ __coapi const char* strerror(S* s = 0);
 
 /**
  * create a SSL_CTX
+ *   - SSL_MODE_RELEASE_BUFFERS is set on the ctx if FLG_ssl_release_buffers is 
+ *     true (default), so idle connections do not hold their read/write buffers. 
+ *   - The first call makes openssl allocate memory by co::alloc() if 
+ *     FLG_ssl_co_alloc is true (default). 
  * 
  * @param c  's' for server, 'c' for client.
  * 
@@ -122,6 +126,99 @@ __coapi int use_certificate_file(C* c, const char* path);
  */
 __coapi int check_private_key(const C* c);
 
+/**
+ * set ALPN protocols for a server context 
+ *   - The first one in protos that was also offered by the client is selected. 
+ *     No protocol is selected if there is no such one. 
+ * 
+ * @param c       a pointer to SSL_CTX.
+ * @param protos  null-terminated protocols in wire format, e.g. "\x02h2\x08http/1.1". 
+ *                It MUST be valid until the context is freed. 
+ * 
+ * @return        1 on success, otherwise 0.
+ */
+__coapi int set_alpn_protos(C* c, const char* protos);
+
+/**
+ * enable session resumption for a server context 
+ *   - Sessions are cached in the context, which is shared by all connections of 
+ *     the server, see FLG_ssl_session_cache_size and FLG_ssl_session_timeout. 
+ *   - Session tickets are encrypted with random keys shared by all server contexts 
+ *     in the process, they are rotated every FLG_ssl_ticket_key_rotation seconds. 
+ * 
+ * @param c  a pointer to SSL_CTX.
+ * 
+ * @return   1 on success, otherwise 0.
+ */
+__coapi int enable_session_cache(C* c);
+
+/**
+ * get the SSL_CTX shared by clients 
+ *   - Sessions of clients are cached by this context, see ssl::set_session(). 
+ *   - The reference count is increased, call ssl::free_ctx() to release it. 
+ * 
+ * @return  a pointer to SSL_CTX on success, NULL on error.
+ */
+__coapi C* shared_client_ctx();
+
+/**
+ * resume a cached session for a client 
+ *   - It MUST be called before ssl::connect(), on a SSL of ssl::shared_client_ctx(). 
+ *   - Sessions are cached by key, and updated when the server issues new tickets. 
+ * 
+ * @param s    a pointer to SSL.
+ * @param key  key of the session, usually "ip:port" of the server.
+ * 
+ * @return     1 if a session was found, otherwise 0, a full handshake is needed.
+ */
+__coapi int set_session(S* s, const char* key);
+
+/**
+ * check whether the session was resumed in the handshake 
+ * 
+ * @param s  a pointer to SSL.
+ * 
+ * @return   true if it is an abbreviated handshake.
+ */
+__coapi bool session_reused(const S* s);
+
+/**
+ * enable kernel TLS (kTLS) for a context 
+ *   - After the handshake, records are encrypted, and also decrypted for TLS 1.2, 
+ *     by the kernel, if the cipher is supported by it. Otherwise, the connection 
+ *     falls back to openssl in the user space silently. 
+ *   - It requires openssl 3.0+ built with kTLS, and the tls module of linux. 
+ * 
+ * @param c  a pointer to SSL_CTX.
+ * 
+ * @return   1 on success, 0 if kTLS is not supported by openssl.
+ */
+__coapi int enable_ktls(C* c);
+
+/**
+ * check whether records are sent by kTLS on a connection 
+ *   - If true, data can be written to the socket directly, e.g. by co::sendv(). 
+ * 
+ * @param s  a pointer to SSL.
+ */
+__coapi bool ktls_send(const S* s);
+
+/**
+ * send a file on a TLS/SSL connection with kTLS 
+ *   - It MUST be called in a coroutine. 
+ *   - The file is sent by sendfile(), without being copied to the user space. 
+ * 
+ * @param s    a pointer to SSL, kTLS must have been enabled for sending.
+ * @param fd   fd of the file.
+ * @param off  offset of the data in the file.
+ * @param n    bytes to be sent.
+ * @param ms   timeout in milliseconds, -1 for never timeout. 
+ *             default: -1. 
+ * 
+ * @return     n on success, <=0 on any error, or if kTLS is not used. 
+ */
+__coapi int64 sendfile(S* s, int fd, int64 off, int64 n, int ms=-1);
+
 /**
  * shutdown a ssl connection 
  *   - It MUST be called in the coroutine that performed the I/O operation. 
@@ -145,15 +242,20 @@ __coapi int shutdown(S* s, int ms=3000);
 /**
  * wait for a TLS/SSL client to initiate a handshake 
  *   - It MUST be called in the coroutine that performed the I/O operation. 
+ *   - If @offload is true, the handshake steps, which are heavy on CPU for RSA 
+ *     or ECDHE, run in the thread pool of co::offload(), and the scheduler goes 
+ *     on with other coroutines. Only the result code of SSL_get_error() is known 
+ *     by ssl::strerror() on errors then. 
  * 
- * @param s   a pointer to SSL.
- * @param ms  timeout in milliseconds, -1 for never timeout. 
- *            default: -1. 
+ * @param s        a pointer to SSL.
+ * @param ms       timeout in milliseconds, -1 for never timeout. 
+ *                 default: -1. 
+ * @param offload  run the handshake steps in the thread pool, default: false. 
  * 
  * @return    1 on success, a TLS/SSL connection has been established. 
  *          <=0 on any error, call ssl::strerror() to get the error message. 
  */
-__coapi int accept(S* s, int ms=-1);
+__coapi int accept(S* s, int ms=-1, bool offload=false);
 
 /**
  * initiate the handshake with a TLS/SSL server
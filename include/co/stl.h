@@ -2,7 +2,7 @@
 
 #include "array.h"
 #include "table.h"
-#include "hash/murmur_hash.h"
+#include "hash/wyhash.h"
 #include <vector>
 #include <list>
 #include <deque>
@@ -70,7 +70,7 @@ struct _Hash {
 template <>
 struct _Hash<const char*> {
     size_t operator()(const char* x) const noexcept {
-        return murmur_hash(x, strlen(x));
+        return wyhash(x, strlen(x));
     }
 };
 
@@ -22,8 +22,58 @@ __coapi co::vector<fastring> split(const char* s, char c, uint32 n=0);
 __coapi co::vector<fastring> split(const fastring& s, char c, uint32 n=0);
 __coapi co::vector<fastring> split(const char* s, const char* c, uint32 n=0);
 
-inline co::vector<fastring> split(const fastring& s, const char* c, uint32 n=0) {
-    return split(s.c_str(), c, n);
+__coapi co::vector<fastring> split(const fastring& s, const char* c, uint32 n=0);
+
+/**
+ * split a string without memory allocation
+ *   - f(p, k) is called for each part [p, p + k), which points into the string.
+ *     The parts are the same as those returned by split().
+ *   - The string is not required to be null-terminated, and may contain '\0'.
+ *
+ *   split_each(s, n, ',', [](const char* p, size_t k) { ... });
+ *
+ * @param s  the string, [s, s + n), or a reference of fastring.
+ * @param c  the delimiter, either a single character or a null-terminated string.
+ * @param m  max split times, 0 or -1 for unlimited.
+ */
+template<typename F>
+void split_each(const char* s, size_t n, char c, F&& f, uint32 m=0) {
+    const char* from = s;
+    const char* const end = s + n;
+    const char* p;
+    uint32 k = 0;
+    while ((p = (const char*) memchr(from, c, end - from))) {
+        f(from, (size_t)(p - from));
+        from = p + 1;
+        if (++k == m) break;
+    }
+    if (from < end) f(from, (size_t)(end - from));
+}
+
+template<typename F>
+void split_each(const char* s, size_t n, const char* c, F&& f, uint32 m=0) {
+    const size_t x = strlen(c);
+    if (x == 0) { if (n > 0) f(s, n); return; }
+    const char* from = s;
+    const char* const end = s + n;
+    const char* p;
+    uint32 k = 0;
+    while (from < end && (p = fast::memmem(from, end - from, c, x))) {
+        f(from, (size_t)(p - from));
+        from = p + x;
+        if (++k == m) break;
+    }
+    if (from < end) f(from, (size_t)(end - from));
+}
+
+template<typename F>
+inline void split_each(const fastring& s, char c, F&& f, uint32 m=0) {
+    split_each(s.data(), s.size(), c, std::forward<F>(f), m);
+}
+
+template<typename F>
+inline void split_each(const fastring& s, const char* c, F&& f, uint32 m=0) {
+    split_each(s.data(), s.size(), c, std::forward<F>(f), m);
 }
 
 /**
@@ -216,6 +266,23 @@ inline fastring dbg(const co::hash_map<K, V>& v) {
     return xx::dbg(v.begin(), v.end(), '{', '}');
 }
 
+// format a string, "{}" in fmt are replaced by the arguments in order
+//   - str::format("{}:{}", "127.0.0.1", 7777);  ==>  "127.0.0.1:7777"
+//   - See fastring::format() for details.
+template<size_t N, typename ...X>
+inline fastring format(const char (&fmt)[N], const X& ... x) {
+    fastring s;
+    fast::xx::format(s, fmt, N - 1, x...);
+    return s;
+}
+
+template<typename ...X>
+inline fastring format(const fastring& fmt, const X& ... x) {
+    fastring s;
+    fast::xx::format(s, fmt.data(), fmt.size(), x...);
+    return s;
+}
+
 inline fastring cat() { return fastring(); }
 
 // concatenate any number of elements into a string
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "def.h"
+#include "god.h"
+#include "atomic.h"
 #include <assert.h>
 #include <stdlib.h>
-#include <mutex>
 
 namespace co {
 
@@ -10,6 +12,10 @@ namespace co {
  * A fixed-size table.
  *   - It stores elements in a 2-dimensional array.
  *   - Memory of the elements are zero-cleared.
+ *   - Rows are allocated on first access, and published with CAS, so that
+ *     operator[] is lock-free and can be called from any thread.
+ *   - Elements are aligned to alignof(T), also when it is larger than what 
+ *     calloc() guarantees, e.g. a type aligned to the cache line.
  */
 template <typename T>
 class table {
@@ -22,13 +28,13 @@ class table {
     table(int xbits, int ybits)
         : _xbits(xbits),
           _xsize((size_t)(1ULL << xbits)),
-          _ysize((size_t)(1ULL << ybits)), _i(1) {
+          _ysize((size_t)(1ULL << ybits)) {
         _v = (T**) ::calloc(_ysize, sizeof(T*));
-        _v[0] = (T*) ::calloc(_xsize, sizeof(T));
+        _v[0] = _alloc_row(_xsize);
     }
 
     ~table() {
-        for (size_t i = 0; i < _i; ++i) ::free(_v[i]);
+        for (size_t i = 0; i < _ysize; ++i) _free_row(_v[i]);
         ::free(_v);
     }
 
@@ -40,22 +46,41 @@ class table {
         const size_t r = i & (_xsize - 1); // i % _xsize
         assert(q < _ysize);
 
-        if (!_v[q]) {
-            std::lock_guard<std::mutex> g(_mtx);
-            if (!_v[q]) {
-                _v[q] = (T*) ::calloc(_xsize, sizeof(T));
-                if (_i <= q) _i = q + 1;
-            }
-        }
-        return _v[q][r];
+        T* p = atomic_load(&_v[q], mo_acquire);
+        if (unlikely(!p)) p = this->_make_row(q);
+        return p[r];
+    }
+
+  private:
+    // threads may race to allocate the row, the loser frees its own
+    T* _make_row(size_t q) {
+        T* const p = _alloc_row(_xsize);
+        T* const o = atomic_cas(&_v[q], (T*)0, p, mo_acq_rel, mo_acquire);
+        if (o == 0) return p;
+        _free_row(p);
+        return o;
+    }
+
+    // an over-aligned row is allocated with extra bytes, the pointer to free 
+    // is stored right before the row
+    static T* _alloc_row(size_t n) {
+        if (alignof(T) <= 16) return (T*) ::calloc(n, sizeof(T));
+        char* const x = (char*) ::calloc(1, n * sizeof(T) + alignof(T) + sizeof(void*));
+        if (!x) return 0;
+        char* const p = god::align_up(x + sizeof(void*), alignof(T));
+        ((char**)p)[-1] = x;
+        return (T*)p;
+    }
+
+    static void _free_row(T* p) {
+        if (alignof(T) <= 16) { ::free(p); return; }
+        if (p) ::free(((char**)p)[-1]);
     }
 
   private:
-    std::mutex _mtx;
     const size_t _xbits;
     const size_t _xsize;
     const size_t _ysize;
-    size_t _i;
     T** _v;
 };
 
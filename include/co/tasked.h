@@ -3,11 +3,39 @@
 #include "def.h"
 #include <functional>
 
+/**
+ * run tasks at a given time, or periodically
+ *   - Tasks are kept in a timing wheel with a resolution of 1 ms, the timer
+ *     thread sleeps until the next task is due.
+ *   - Tasks run in the timer thread by default, a slow task delays the others
+ *     then. They can run in a pool of threads, or in coroutines by go(), see
+ *     the constructor.
+ *   - A periodic task is not run again while its last run is not done, the
+ *     run is skipped and counted as an overrun.
+ */
 class __coapi Tasked {
   public:
     typedef std::function<void()> F;
 
-    Tasked();
+    // run tasks in coroutines created by go()
+    static const int in_go = -1;
+
+    // statistics of the tasks, times are in microseconds
+    struct stats_t {
+        uint64 runs;           // times tasks have run
+        uint64 overruns;       // runs skipped as the last run was not done in time
+        int64 avg_latency_us;  // from the time a task is due to the time it starts
+        int64 max_latency_us;
+        int64 avg_duration_us; // time a task takes to run
+        int64 max_duration_us;
+    };
+
+    /**
+     * @param workers  0: run tasks in the timer thread.
+     *                 n > 0: run tasks in a pool of n threads.
+     *                 Tasked::in_go: run tasks in coroutines by go().
+     */
+    explicit Tasked(int workers=0);
     ~Tasked();
 
     Tasked(const Tasked&) = delete;
@@ -32,6 +60,20 @@ class __coapi Tasked {
         this->run_every(F(f), sec);
     }
 
+    // run f() once @ms milliseconds later
+    void run_in_ms(F&& f, int64 ms);
+
+    void run_in_ms(const F& f, int64 ms) {
+        this->run_in_ms(F(f), ms);
+    }
+
+    // run f() every @ms milliseconds
+    void run_every_ms(F&& f, int64 ms);
+
+    void run_every_ms(const F& f, int64 ms) {
+        this->run_every_ms(F(f), ms);
+    }
+
     // run_at(f, 23, 0, 0);  -> run f() once at 23:00:00
     void run_at(F&& f, int hour, int minute=0, int second=0);
 
@@ -46,7 +88,10 @@ class __coapi Tasked {
         this->run_daily(F(f), hour, minute, second);
     }
 
-    // stop the task schedule
+    // get a snapshot of the statistics
+    stats_t stats() const;
+
+    // stop the task schedule, it waits for tasks that are running
     void stop();
 
   private:
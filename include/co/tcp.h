@@ -1,10 +1,16 @@
 #pragma once
 
 #include "def.h"
+#include "./co/sock.h"
 #include <functional>
 
+namespace fs { class file; }
+namespace co { class iobuf; enum sched_policy_t : int; }
+
 namespace tcp {
 
+class Client;
+
 /**
  * TCP connection for tcp::Server 
  *   - An object of tcp::Connection will be created by tcp::Server if a connection 
@@ -51,6 +57,36 @@ struct __coapi Connection final {
      */
     int send(const void* buf, int n, int ms=-1);
 
+    /**
+     * send n bytes of a file from offset off 
+     *   - co::sendfile() is used for normal TCP connections, data of the file 
+     *     will not be copied to the user space. For SSL connections, the file is 
+     *     read and sent block by block. 
+     * 
+     * @return  n on success, <=0 on timeout or error.
+     */
+    int64 sendfile(fs::file& f, int64 off, int64 n, int ms=-1);
+
+    /**
+     * send data in multiple buffers 
+     *   - co::sendv() is used for normal TCP connections. For SSL connections, 
+     *     the buffers are sent one by one. 
+     *   - Elements of iov may be changed on partial writes. 
+     * 
+     * @return  total size of the buffers on success, <=0 on timeout or error.
+     */
+    int64 sendv(co::iov_t* iov, int n, int ms=-1);
+
+    /**
+     * send data in a co::iobuf 
+     *   - The segments are sent by sendv() without copy, at most 64 at a time, 
+     *     and ms is the timeout of each sendv(). 
+     *   - The iobuf is not changed. 
+     * 
+     * @return  size of the iobuf on success, <=0 on timeout or error.
+     */
+    int64 send(const co::iobuf& b, int ms=-1);
+
     /**
      * close the connection
      *   - Once a Connection was closed, it can't be used any more.
@@ -77,15 +113,113 @@ struct __coapi Connection final {
 
   private:
     void* _p;
+    friend class Reader;
 
     DISALLOW_COPY_AND_ASSIGN(Connection);
 };
 
+/**
+ * buffered reader for tcp::Connection or tcp::Client 
+ *   - Data is received into an internal buffer with as few recv calls as 
+ *     possible, and read from the buffer by the user. 
+ *   - The buffered data is always contiguous, the buffer is compacted when it 
+ *     is refilled, and grows when it is full. 
+ *   - Data left in the buffer belongs to the next message, e.g. the next 
+ *     pipelined request. 
+ *   - The buffer is taken on the first read, 4k buffers from a pool of the 
+ *     scheduler. A reader of a Connection waits for data before taking it, 
+ *     and release() gives it back, so that idle connections hold no buffer. 
+ */
+class __coapi Reader final {
+  public:
+    explicit Reader(Connection& conn, uint32 cap=4096);
+
+    // read from the connection of a client
+    explicit Reader(Client& cli, uint32 cap=4096);
+
+    // take over the buffered data of r, which MUST NOT be used any more
+    Reader(Connection& conn, Reader&& r);
+    ~Reader();
+
+    // pointer to the buffered data
+    const char* data() const { return _buf + _beg; }
+
+    // size of the buffered data
+    size_t size() const { return _end - _beg; }
+
+    bool empty() const { return _end == _beg; }
+
+    // discard the first n bytes of the buffered data
+    void consume(size_t n);
+
+    /**
+     * recv more data into the buffer, with a single recv call 
+     * 
+     * @return  bytes received, -1 on timeout or error, 0 if the peer closed 
+     *          the connection.
+     */
+    int fill(int ms=-1);
+
+    /**
+     * wait until at least n bytes are buffered, data is not consumed 
+     * 
+     * @return  n on success, -1 on timeout or error, 0 if the peer closed 
+     *          the connection.
+     */
+    int peek(size_t n, int ms=-1);
+
+    /**
+     * wait until delim is found in the buffered data 
+     *   - The data is not consumed, call consume() after it is used. 
+     *   - Data already scanned is not scanned again when more data arrives. 
+     * 
+     * @param max  max bytes to buffer before delim is found.
+     * 
+     * @return  bytes to the end of delim on success, -2 if delim was not found 
+     *          in max bytes, -1 on timeout or error, 0 if the peer closed the 
+     *          connection.
+     */
+    int read_until(const char* delim, size_t max, int ms=-1);
+
+    /**
+     * read n bytes to buf 
+     *   - Buffered data is copied first, the rest is received into buf directly. 
+     * 
+     * @return  n on success, -1 on timeout or error, 0 if the peer closed the 
+     *          connection.
+     */
+    int read_exact(void* buf, size_t n, int ms=-1);
+
+    // discard all buffered data, e.g. when the connection was closed
+    void clear() { _beg = _end = _scan = 0; }
+
+    // give back the buffer if there is no buffered data, e.g. between requests
+    void release();
+
+  private:
+    int _recv(void* buf, int n, int ms);
+    int _recvn(void* buf, int n, int ms);
+    void _alloc();
+    void _free();
+
+    Connection* _conn;
+    Client* _cli;
+    char* _buf;
+    size_t _cap;
+    size_t _init_cap;
+    size_t _beg;
+    size_t _end;
+    size_t _scan; // bytes from _beg scanned by read_until()
+
+    DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
 /**
  * TCP server based on coroutine 
  *   - Support both ipv4 and ipv6. 
  *   - Support ssl (openssl 1.1.0+ required).
- *   - One coroutine per connection. 
+ *   - One coroutine per connection, idle connections can be parked without 
+ *     a coroutine by park(). 
  */
 class __coapi Server final {
   public:
@@ -111,9 +245,85 @@ class __coapi Server final {
     // set a callback to call when the server exits
     Server& on_exit(std::function<void()>&& cb);
 
+    /**
+     * set ALPN protocols for ssl 
+     *   - It MUST be called before start(), and it takes effect on ssl only. 
+     * 
+     * @param protos  null-terminated protocols in wire format, e.g. 
+     *                "\x02h2\x08http/1.1". It MUST be valid while the server 
+     *                is running.
+     */
+    Server& alpn(const char* protos);
+
+    /**
+     * park an idle connection without a coroutine (linux only) 
+     *   - It is called in the connection callback, which SHOULD return at once 
+     *     if the connection was parked. When data arrives, the connection 
+     *     callback will be called again with the connection in a new coroutine. 
+     *   - The connection is closed if no data arrives in sec seconds. 
+     *   - Data MUST NOT be left in a tcp::Reader of the connection. 
+     *   - Connections over ssl are not parked, as ssl may have buffered data. 
+     * 
+     * @return  true if the connection was taken by the server, otherwise false, 
+     *          and the connection is left unchanged.
+     */
+    bool park(Connection& c, uint32 sec);
+
+    /**
+     * limit connections of the server 
+     *   - It MUST be called before start(). By default, the limits are 
+     *     FLG_tcp_max_conn and FLG_tcp_accept_rate. 
+     *   - New connections are rejected once there are max_conn connections, 
+     *     including those parked, see on_reject(). 
+     *   - No more than accept_rate connections are accepted per second, others 
+     *     wait in the backlog of the listening socket. 
+     * 
+     * @param max_conn     max number of connections, 0 for no limit.
+     * @param accept_rate  max connections accepted per second, 0 for no limit.
+     */
+    Server& limit(uint32 max_conn, uint32 accept_rate=0);
+
+    /**
+     * set a load-shedding callback 
+     *   - It is called in the accept loop for each new connection, before a 
+     *     coroutine is created for it. Return false to reject the connection. 
+     *   - It MUST be fast and MUST NOT block, a typical check is the queue depth 
+     *     of the schedulers, e.g. co::scheduler()->stats().queued. 
+     * 
+     * @param f  bool f(sock_t fd), fd is the new connection.
+     */
+    Server& on_admit(std::function<bool(sock_t)>&& f);
+
+    /**
+     * choose schedulers for new connections by the policy @p 
+     *   - It MUST be called before start(). By default, connections are spread 
+     *     as go() does, by co_sched_policy. 
+     *   - co::sched_least_coroutines suits long-lived connections, which would 
+     *     pile up unevenly in a round-robin way. 
+     *   - It is ignored if tcp_reuse_port is true, connections are served in the 
+     *     scheduler that accepted them then. 
+     *   - With tcp_incoming_cpu and schedulers bound by co_sched_cpus, a connection 
+     *     is served by the scheduler on the cpu that received its packets, the 
+     *     policy is used only if that cpu has no scheduler. With tcp_reuse_port, 
+     *     the kernel prefers the listener of that scheduler instead. 
+     */
+    Server& sched_policy(co::sched_policy_t p);
+
+    /**
+     * set a callback for rejected connections 
+     *   - Connections rejected by limit() or on_admit() are reset at once by 
+     *     default. If the callback is set, they are passed to it in a new 
+     *     coroutine instead, e.g. to send an error response before closing. 
+     *   - It takes effect on tcp without ssl only. 
+     */
+    Server& on_reject(std::function<void(Connection)>&& f);
+
     // return number of connections
     uint32 conn_num() const;
 
+    // return number of connections rejected
+    uint64 rejected_num() const;
+
     /**
      * start the server
      *   - The server will loop in a coroutine, and it will not block the calling thread.
@@ -123,7 +333,10 @@ class __coapi Server final {
      *
      * @param ip    server ip, either an ipv4 or ipv6 address.
      *              if ip is NULL or empty, "0.0.0.0" will be used by default.
-     * @param port  server port.
+     *              "unix:/path" for a unix domain socket, the file is removed
+     *              before bind and after the server stopped. "unix:@name" is in
+     *              the abstract namespace of linux. Not supported on windows.
+     * @param port  server port, ignored for unix domain sockets.
      * @param key   path of ssl private key file.
      * @param ca    path of ssl certificate file.
      */
@@ -165,7 +378,8 @@ class __coapi Client final {
      * 
      * @param ip       a domain name, or either an ipv4 or ipv6 address of the server. 
      *                 if ip is NULL or empty, "127.0.0.1" will be used by default. 
-     * @param port     the server port. 
+     *                 "unix:/path" or "unix:@name" for a unix domain socket. 
+     * @param port     the server port, ignored for unix domain sockets. 
      * @param use_ssl  use ssl if it is true.
      */
     Client(const char* ip, int port, bool use_ssl=false);
@@ -216,6 +430,10 @@ class __coapi Client final {
     /**
      * connect to the server 
      *   - It MUST be called in the thread that performed the IO operation. 
+     *   - If tcp_warm_conn > 0, a socket connected in the background is taken 
+     *     if there is one, the ssl handshake is still done here. 
+     *   - If tcp_fastopen is true, the SYN may be sent with the first data, and 
+     *     errors of connecting are reported by the first send or recv. 
      *
      * @param ms  timeout in milliseconds, -1 for never timeout.
      * 
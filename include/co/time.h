@@ -11,6 +11,24 @@ __coapi int64 ms();
 // monotonic timestamp in microseconds
 __coapi int64 us();
 
+// monotonic timestamp in nanoseconds
+__coapi int64 ns();
+
+/**
+ * fast monotonic timestamp in nanoseconds, with the same epoch as now::ns()
+ *   - It reads the cpu counter, rdtsc on x86 with an invariant TSC, or
+ *     cntvct_el0 on arm64, which is much cheaper than clock_gettime().
+ *   - Ticks are converted with a rate calibrated against now::ns(), it is
+ *     recalibrated by the first call every 100 ms, and the error is slewed
+ *     out, so the result stays close to now::ns() and never goes backwards in
+ *     a thread.
+ *   - It is now::ns() on other cpus, see fast_ns_native().
+ */
+__coapi int64 fast_ns();
+
+// true if fast_ns() reads the cpu counter
+__coapi bool fast_ns_native();
+
 // "%Y-%m-%d %H:%M:%S" ==> 2018-08-08 08:08:08
 __coapi fastring str(const char* fm = "%Y-%m-%d %H:%M:%S");
 
@@ -38,24 +56,34 @@ __coapi void sec(uint32 n);
 
 using namespace ___;
 
+// Timer t(true) uses now::fast_ns(), for timing in hot paths
 class __coapi Timer {
   public:
-    Timer() {
-        _start = now::us();
+    explicit Timer(bool fast=false) : _fast(fast) {
+        _start = this->_now();
     }
 
     void restart() {
-        _start = now::us();
+        _start = this->_now();
+    }
+
+    int64 ns() const {
+        return this->_now() - _start;
     }
 
     int64 us() const {
-        return now::us() - _start;
+        return this->ns() / 1000;
     }
 
     int64 ms() const {
-        return this->us() / 1000;
+        return this->ns() / 1000000;
     }
 
   private:
+    int64 _now() const {
+        return _fast ? now::fast_ns() : now::ns();
+    }
+
     int64 _start;
+    bool _fast;
 };
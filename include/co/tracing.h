@@ -0,0 +1,126 @@
+#pragma once
+
+#include "def.h"
+#include "flag.h"
+#include <string.h>
+#include <functional>
+
+__coapi DEC_double(trace_sample_rate);
+
+// distributed tracing with the W3C trace context
+//   - rpc and http carry the context of the caller: the "traceparent" header of
+//     http::Server and http::Agent, and a binary field of rpc requests, which
+//     is sent only if the server supports it.
+//   - Only sampled traces are recorded. A request with a sampled context is
+//     recorded as a child of the caller, a request without a context starts a
+//     new trace, sampled by trace_sample_rate. For an unsampled request, it
+//     costs a parse of the context and a branch, nothing is recorded or sent
+//     to the callees then.
+//   - The current span of a coroutine is kept in coroutine-local storage, spans
+//     made in it, and rpc or http calls made by it, are its children. Times are
+//     taken by now::fast_ns(), which reads the TSC.
+//   - Finished spans go to a buffer of the thread, a background coroutine moves
+//     them to the exporter every trace_flush_ms. The default exporter writes
+//     them as json lines to TLOG("trace").
+//
+//   void f() {
+//       tracing::Span s("load_user"); // child of the request being served
+//       ...
+//   }
+namespace tracing {
+
+// trace context of a request, see https://www.w3.org/TR/trace-context/
+struct context_t {
+    uint64 trace_hi; // trace id, 16 bytes, high part
+    uint64 trace_lo; // trace id, low part
+    uint64 span_id;  // id of the span of the caller
+    uint8 flags;     // 1 for sampled
+
+    bool valid() const { return (trace_hi | trace_lo) != 0 && span_id != 0; }
+    bool sampled() const { return flags & 1; }
+};
+
+// size of a traceparent: 00-<32 hex trace id>-<16 hex span id>-<2 hex flags>
+const size_t kTraceparentSize = 55;
+
+// parse a traceparent, return false if it is not valid
+__coapi bool parse(const char* s, size_t n, context_t& c);
+
+inline bool parse(const char* s, context_t& c) {
+    return parse(s, strlen(s), c);
+}
+
+// write the traceparent of @c to @buf, kTraceparentSize bytes and a '\0'
+__coapi void format(const context_t& c, char* buf);
+
+enum kind_t {
+    kInternal = 0,
+    kServer = 1, // a request served
+    kClient = 2, // a call made to another service
+};
+
+// a finished span passed to the exporter
+struct span_t {
+    uint64 trace_hi;
+    uint64 trace_lo;
+    uint64 id;
+    uint64 parent_id; // 0 for a root span
+    int64 beg_ns;     // nanoseconds since epoch
+    int64 end_ns;
+    int32 status;     // status of the request or the call, 0 by default
+    uint8 kind;       // kind_t
+    char name[51];    // truncated if it is too long
+};
+
+/**
+ * a span from its construction to its destruction
+ *   - It is the current span of the coroutine until it is destroyed, spans
+ *     MUST be destroyed in the reverse order of their construction, as local
+ *     variables are.
+ *   - It does nothing if it is not sampled, check recording() before doing
+ *     anything costly for it.
+ */
+class __coapi Span {
+  public:
+    // a child of the current span, it is not recorded if there is none
+    explicit Span(const char* name, int kind=kInternal);
+
+    // a span of a request with the context @parent of the caller, NULL or an
+    // invalid one starts a new trace
+    Span(const context_t* parent, const char* name, int kind=kServer);
+
+    ~Span();
+
+    bool recording() const { return _rec; }
+
+    void set_name(const char* s, size_t n);
+    void set_name(const char* s) { this->set_name(s, strlen(s)); }
+    void set_status(int32 x) { _s.status = x; }
+
+    // context to pass to callees, with the id of this span
+    context_t context() const {
+        context_t c = { _s.trace_hi, _s.trace_lo, _s.id, 1 };
+        return c;
+    }
+
+  private:
+    void start(const char* name, int kind);
+
+    span_t _s;
+    void* _prev;
+    bool _rec;
+    bool _cur; // set as the current span of the coroutine
+
+    DISALLOW_COPY_AND_ASSIGN(Span);
+};
+
+// the current span of the coroutine, NULL if there is none
+__coapi const Span* current();
+
+// set the exporter of finished spans, it is called in a coroutine
+__coapi void set_exporter(std::function<void(const span_t* s, size_t n)>&& f);
+
+// pass finished spans of all threads to the exporter now
+__coapi void flush();
+
+} // tracing
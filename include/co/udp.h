@@ -0,0 +1,83 @@
+#pragma once
+
+#include "def.h"
+#include "./co/sock.h"
+#include <functional>
+
+namespace udp {
+
+// a datagram received by udp::Server, valid only in the handler
+struct Datagram {
+    const char* data;  // payload of the datagram
+    int size;          // size of the payload, it may be truncated to udp_max_datagram_size
+    const void* addr;  // address of the peer, struct sockaddr_in or sockaddr_in6
+    int addrlen;       // length of addr
+    sock_t sock;       // the socket the datagram was received on
+
+    // send a datagram back to the peer on the same socket
+    int reply(const void* buf, int n, int ms=-1) const {
+        return co::sendto(sock, buf, n, addr, addrlen, ms);
+    }
+};
+
+/**
+ * UDP server based on coroutine
+ *   - Support both ipv4 and ipv6.
+ *   - On linux, there is a socket bound with SO_REUSEPORT in each scheduler,
+ *     and the kernel spreads datagrams over them by the address of the peer.
+ *     Datagrams are received in batches by recvmmsg().
+ *   - On other platforms, there is one socket in one scheduler.
+ *   - The handler is called in the receive loop of the scheduler, without a
+ *     coroutine for each datagram. It SHOULD NOT block for long, or datagrams
+ *     behind it wait. Create a coroutine with go() in the handler for slow work,
+ *     and copy the data and the address it needs.
+ */
+class __coapi Server final {
+  public:
+    Server();
+    ~Server();
+
+    // set a handler for datagrams
+    Server& on_datagram(std::function<void(const Datagram&)>&& f);
+
+    Server& on_datagram(const std::function<void(const Datagram&)>& f) {
+        return this->on_datagram(std::function<void(const Datagram&)>(f));
+    }
+
+    /**
+     * @param f  a pointer to a method in class T.
+     * @param o  a pointer to an object of class T.
+     */
+    template<typename T>
+    Server& on_datagram(void (T::*f)(const Datagram&), T* o) {
+        return this->on_datagram(std::bind(f, o, std::placeholders::_1));
+    }
+
+    // return number of datagrams received
+    uint64 recv_num() const;
+
+    /**
+     * start the server
+     *   - The receive loops run in coroutines, it will not block the calling thread.
+     *   - The user MUST call on_datagram() to set a handler before start() was called.
+     *
+     * @param ip    server ip, either an ipv4 or ipv6 address.
+     *              if ip is NULL or empty, "0.0.0.0" will be used by default.
+     * @param port  server port.
+     */
+    void start(const char* ip, int port);
+
+    /**
+     * exit the server
+     *   - The sockets are closed, and it blocks until all the receive loops exited.
+     *   - It MUST NOT be called in the handler.
+     */
+    void exit();
+
+  private:
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(Server);
+};
+
+} // udp
@@ -0,0 +1,109 @@
+#include "co/arena.h"
+
+namespace co {
+namespace xx {
+
+// chunks cached in the current thread, they are reused by other arenas
+struct ChunkCache {
+    enum { N = 64 };
+    ChunkCache() : head(0), n(0) {}
+    Arena::Chunk* head;
+    uint32 n;
+};
+
+inline ChunkCache& chunk_cache() {
+    static __thread ChunkCache* c = 0;
+    return c ? *c : *(c = co::static_new<ChunkCache>());
+}
+
+} // xx
+
+Arena::Arena(uint32 chunk_size)
+    : _c(0), _b(0), _p(0), _e(0), _size(0) {
+    if (chunk_size < 256) chunk_size = 256;
+    _chunk_size = chunk_size;
+}
+
+Arena::~Arena() {
+    for (Chunk* c = _c; c;) {
+        Chunk* const next = c->next;
+        this->_release(c);
+        c = next;
+    }
+}
+
+void Arena::_release(Chunk* c) {
+    auto& x = xx::chunk_cache();
+    if (c->size == _chunk_size && x.n < xx::ChunkCache::N) {
+        c->next = x.head;
+        x.head = c;
+        ++x.n;
+    } else {
+        co::free(c, c->size);
+    }
+}
+
+void* Arena::_grow(size_t n, size_t align) {
+    const size_t h = sizeof(Chunk);
+    Chunk* c;
+
+    // large block, it has its own chunk, and the current chunk is still in use
+    if (n + align + h > _chunk_size) {
+        const size_t size = n + align + h;
+        c = (Chunk*) co::alloc(size);
+        c->size = size;
+        if (_c) {
+            c->next = _c->next;
+            _c->next = c;
+        } else {
+            c->next = 0;
+            _c = c;  // _p, _e are still NULL, the next alloc() will grow
+        }
+        _size += n;
+        return (void*)(((size_t)(c + 1) + align - 1) & ~(align - 1));
+    }
+
+    auto& x = xx::chunk_cache();
+    if (x.head && x.head->size == _chunk_size) {
+        c = x.head;
+        x.head = c->next;
+        --x.n;
+    } else {
+        c = (Chunk*) co::alloc(_chunk_size);
+        c->size = _chunk_size;
+    }
+
+    c->next = _c;
+    _c = c;
+    _size += _p - _b;
+    _b = (char*)(c + 1);
+    _e = (char*)c + _chunk_size;
+    char* const p = (char*)(((size_t)_b + align - 1) & ~(align - 1));
+    _p = p + n;
+    return p;
+}
+
+void Arena::reset() {
+    Chunk* keep = 0;
+    for (Chunk* c = _c; c;) {
+        Chunk* const next = c->next;
+        if (!keep && c->size == _chunk_size) {
+            keep = c;
+        } else {
+            this->_release(c);
+        }
+        c = next;
+    }
+
+    _c = keep;
+    _size = 0;
+    if (keep) {
+        keep->next = 0;
+        _b = _p = (char*)(keep + 1);
+        _e = (char*)keep + _chunk_size;
+    } else {
+        _b = _p = _e = 0;
+    }
+}
+
+} // co
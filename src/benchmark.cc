@@ -0,0 +1,325 @@
+#include "co/benchmark.h"
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/fs.h"
+#include "co/json.h"
+#include "co/log.h"
+#include "co/str.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <math.h>
+#include <algorithm>
+
+DEF_string(bench, "", "benchmarks to run, names or parts of names separated by commas, all by default");
+DEF_uint32(bench_min_ms, 200, "minimum time in milliseconds of each run of a benchmark");
+DEF_uint32(bench_warmup_ms, 50, "time in milliseconds to run a benchmark before it is measured");
+DEF_uint32(bench_runs, 5, "times to run each benchmark");
+DEF_string(bench_format, "text", "format of results printed: text, json or csv");
+DEF_string(bench_out, "", "save results as json to this file, for -bench_baseline");
+DEF_string(bench_baseline, "", "json file of results saved by -bench_out, to compare with");
+DEF_double(bench_threshold, 5, "a benchmark slower than the baseline by this percent is a regression");
+
+namespace bench {
+
+inline co::vector<Bench*>& benches() {
+    static co::vector<Bench*> v;
+    return v;
+}
+
+Bench::Bench(const char* name, bench_fn_t f, uint32 threads, uint32 coroutines)
+    : name(name), f(f), threads(threads), coroutines(coroutines) {
+    benches().push_back(this);
+}
+
+void State::pause() {
+    _pause_beg = now::ns();
+}
+
+void State::resume() {
+    if (_pause_beg) {
+        _paused_ns += now::ns() - _pause_beg;
+        _pause_beg = 0;
+    }
+}
+
+void _escape(const void*) {}
+
+namespace xx {
+
+struct run_t {
+    int64 ns;     // time of the run, paused time excluded
+    uint64 bytes; // bytes of each iteration
+};
+
+inline const Bench* find(const char* name) {
+    for (auto& b : benches()) {
+        if (strcmp(b->name, name) == 0) return b;
+    }
+    return 0;
+}
+
+// threads or coroutines wait on @start, and the clock starts when all of them
+// are ready, the run ends when the last one is done
+run_t run_parallel(const Bench& b, uint64 n) {
+    const uint32 c = b.threads ? b.threads : b.coroutines;
+    co::vector<State*> states;
+    co::vector<int64> ends(c, 0);
+    states.reserve(c);
+    for (uint32 i = 0; i < c; ++i) states.push_back(co::make<State>(n, i, c));
+
+    co::Latch ready(c), start(1);
+    co::WaitGroup wg;
+    wg.add(c);
+    int64* e = ends.data();
+    auto f = [&b, &states, e, ready, start, wg](uint32 i) {
+        ready.count_down();
+        start.wait();
+        b.f(*states[i]);
+        e[i] = now::ns();
+        wg.done();
+    };
+
+    co::vector<Thread*> threads;
+    threads.reserve(b.threads);
+    if (b.threads) {
+        for (uint32 i = 0; i < c; ++i) threads.push_back(co::make<Thread>([f, i]() { f(i); }));
+    } else {
+        auto& s = co::schedulers();
+        for (uint32 i = 0; i < c; ++i) s[i % s.size()]->go([f, i]() { f(i); });
+    }
+
+    ready.wait();
+    const int64 beg = now::ns();
+    start.count_down();
+    wg.wait();
+    for (auto& t : threads) co::del(t);
+
+    run_t r = { 0, states[0]->bytes() };
+    int64 paused = 0;
+    for (uint32 i = 0; i < c; ++i) {
+        if (ends[i] - beg > r.ns) r.ns = ends[i] - beg;
+        paused += states[i]->paused_ns();
+        co::del(states[i]);
+    }
+    r.ns -= paused / c;
+    if (r.ns < 1) r.ns = 1;
+    return r;
+}
+
+run_t run_once(const Bench& b, uint64 n) {
+    if (b.threads || b.coroutines) return run_parallel(b, n);
+    State s(n, 0, 1);
+    const int64 beg = now::ns();
+    b.f(s);
+    run_t r = { now::ns() - beg - s.paused_ns(), s.bytes() };
+    if (r.ns < 1) r.ns = 1;
+    return r;
+}
+
+// grow n until a run takes 1/10 of the minimum time, then scale it up
+uint64 calibrate(const Bench& b, int64 min_ns) {
+    uint64 n = 1;
+    for (;;) {
+        const int64 ns = run_once(b, n).ns;
+        if (ns >= min_ns / 10 || n >= ((uint64)1 << 40)) {
+            const double x = (double)n * min_ns / ns;
+            return x < 1 ? 1 : (uint64)x;
+        }
+        const double x = ns > 0 ? (double)min_ns / 10 / ns : 100;
+        n = (uint64)(n * (x > 100 ? 100 : (x < 2 ? 2 : x * 1.2)));
+    }
+}
+
+inline co::hash_map<fastring, double>& baseline() {
+    static co::hash_map<fastring, double> m;
+    return m;
+}
+
+void load_baseline() {
+    if (FLG_bench_baseline.empty()) return;
+    fs::file f;
+    if (!f.open(FLG_bench_baseline.c_str(), 'r')) {
+        ELOG << "can't open the baseline file: " << FLG_bench_baseline;
+        return;
+    }
+    Json x = json::parse(f.read((size_t)f.size()));
+    if (!x.is_array()) {
+        ELOG << "bad baseline file: " << FLG_bench_baseline;
+        return;
+    }
+    for (uint32 i = 0; i < x.array_size(); ++i) {
+        const Json& e = x[i];
+        if (e.get("name").is_string() && (e.get("median").is_double() || e.get("median").is_int())) {
+            baseline()[e.get("name").as_c_str()] = e.get("median").as_double();
+        }
+    }
+}
+
+inline bool matched(const char* name, const co::vector<fastring>& v) {
+    if (v.empty()) return true;
+    for (auto& s : v) {
+        if (!s.empty() && strstr(name, s.c_str())) return true;
+    }
+    return false;
+}
+
+// percent slower than the baseline, 0 if there is no baseline
+inline double delta(const Result& r) {
+    return r.baseline > 0 ? (r.median - r.baseline) * 100 / r.baseline : 0;
+}
+
+void print_header() {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%-32s %8s %12s %12s %8s %12s %14s",
+             "benchmark", "threads", "iterations", "ns/op", "+/-", "min ns/op", "ops/s");
+    COUT << buf;
+}
+
+void print_text(const Result& r) {
+    char buf[256];
+    const char* t = r.co ? "co" : "";
+    char threads[16];
+    snprintf(threads, sizeof(threads), "%u%s", r.threads, t);
+    int k = snprintf(buf, sizeof(buf), "%-32s %8s %12llu %12.2f %7.1f%% %12.2f %14.0f",
+                     r.name.c_str(), threads, (unsigned long long)r.n, r.median,
+                     r.median > 0 ? r.stddev * 100 / r.median : 0.0, r.min, r.ops);
+    if (r.bytes > 0 && k > 0 && k < (int)sizeof(buf)) {
+        k += snprintf(buf + k, sizeof(buf) - k, "  %.1f MB/s", r.bytes / (1024 * 1024));
+    }
+    fastream s(256);
+    s << buf;
+    if (r.baseline > 0) {
+        const double d = delta(r);
+        snprintf(buf, sizeof(buf), "  %+.1f%% vs %.2f", d, r.baseline);
+        s << (d > FLG_bench_threshold ? color::red : (d < -FLG_bench_threshold ? color::green : color::deflt))
+          << buf << color::deflt;
+    }
+    COUT << s;
+}
+
+} // xx
+
+bool run(const char* name, Result& r) {
+    const Bench* b = xx::find(name);
+    if (!b) return false;
+
+    const int64 min_ns = (int64)FLG_bench_min_ms * 1000000;
+    const uint64 n = xx::calibrate(*b, min_ns);
+    if (FLG_bench_warmup_ms > 0) {
+        const double x = (double)n * FLG_bench_warmup_ms / (FLG_bench_min_ms ? FLG_bench_min_ms : 1);
+        xx::run_once(*b, x < 1 ? 1 : (uint64)x);
+    }
+
+    const uint32 runs = FLG_bench_runs ? FLG_bench_runs : 1;
+    co::vector<double> v;
+    v.reserve(runs);
+    uint64 bytes = 0;
+    for (uint32 i = 0; i < runs; ++i) {
+        const xx::run_t x = xx::run_once(*b, n);
+        v.push_back((double)x.ns / n);
+        bytes = x.bytes;
+    }
+    std::sort(v.begin(), v.end());
+
+    double sum = 0, sq = 0;
+    for (auto& x : v) sum += x;
+    const double mean = sum / runs;
+    for (auto& x : v) sq += (x - mean) * (x - mean);
+
+    const uint32 c = b->threads ? b->threads : (b->coroutines ? b->coroutines : 1);
+    r.name = b->name;
+    r.threads = c;
+    r.co = b->coroutines > 0;
+    r.n = n;
+    r.runs = runs;
+    r.median = runs & 1 ? v[runs / 2] : (v[runs / 2 - 1] + v[runs / 2]) / 2;
+    r.mean = mean;
+    r.min = v[0];
+    r.max = v[runs - 1];
+    r.stddev = runs > 1 ? sqrt(sq / (runs - 1)) : 0;
+    r.ops = r.median > 0 ? c * 1e9 / r.median : 0;
+    r.bytes = r.median > 0 ? (double)bytes * c * 1e9 / r.median : 0;
+
+    auto it = xx::baseline().find(r.name);
+    r.baseline = it != xx::baseline().end() ? it->second : 0;
+    return true;
+}
+
+fastring to_json(const co::vector<Result>& v) {
+    Json a = json::array();
+    for (auto& r : v) {
+        Json x = json::object();
+        x.add_member("name", r.name);
+        x.add_member("threads", r.threads);
+        x.add_member("co", r.co);
+        x.add_member("iterations", r.n);
+        x.add_member("runs", r.runs);
+        x.add_member("median", r.median);
+        x.add_member("mean", r.mean);
+        x.add_member("min", r.min);
+        x.add_member("max", r.max);
+        x.add_member("stddev", r.stddev);
+        x.add_member("ops_per_sec", r.ops);
+        if (r.bytes > 0) x.add_member("bytes_per_sec", r.bytes);
+        if (r.baseline > 0) {
+            x.add_member("baseline", r.baseline);
+            x.add_member("delta_percent", xx::delta(r));
+        }
+        a.push_back(x);
+    }
+    return a.str();
+}
+
+fastring to_csv(const co::vector<Result>& v) {
+    fastring s(256);
+    s << "name,threads,co,iterations,runs,median,mean,min,max,stddev,ops_per_sec,bytes_per_sec,baseline\n";
+    for (auto& r : v) {
+        s << r.name << ',' << r.threads << ',' << (r.co ? 1 : 0) << ',' << r.n << ',' << r.runs << ','
+          << r.median << ',' << r.mean << ',' << r.min << ',' << r.max << ',' << r.stddev << ','
+          << r.ops << ',' << r.bytes << ',' << r.baseline << '\n';
+    }
+    return s;
+}
+
+int run_all_benchmarks() {
+    xx::load_baseline();
+    const bool text = FLG_bench_format != "json" && FLG_bench_format != "csv";
+    const auto names = str::split(FLG_bench, ',');
+
+    co::vector<Result> v;
+    int regressed = 0;
+    if (text) xx::print_header();
+    for (auto& b : benches()) {
+        if (!xx::matched(b->name, names)) continue;
+        Result r;
+        bench::run(b->name, r);
+        if (text) xx::print_text(r);
+        if (xx::delta(r) > FLG_bench_threshold) ++regressed;
+        v.push_back(std::move(r));
+    }
+
+    if (v.empty()) {
+        COUT << "No benchmark found. Done nothing.";
+        return 0;
+    }
+    if (FLG_bench_format == "json") COUT << to_json(v);
+    if (FLG_bench_format == "csv") cout << to_csv(v) << std::flush;
+
+    if (!FLG_bench_out.empty()) {
+        fs::file f;
+        if (f.open(FLG_bench_out.c_str(), 'w')) {
+            f.write(to_json(v));
+        } else {
+            ELOG << "can't open the output file: " << FLG_bench_out;
+        }
+    }
+
+    if (regressed > 0) {
+        COUT << color::red << regressed << " benchmark" << (regressed > 1 ? "s" : "")
+             << " slower than the baseline by more than " << FLG_bench_threshold << '%'
+             << color::deflt;
+    }
+    return regressed;
+}
+
+} // bench
@@ -0,0 +1,45 @@
+#include "co/closure.h"
+
+namespace co {
+namespace xx {
+
+// blocks of closures freed in the current thread, they are reused by closures
+// created later in the thread. A closure is usually freed by the scheduler
+// running it, so coroutines created by coroutines reuse blocks of the same
+// scheduler, without going through co::alloc().
+struct ClosureCache {
+    enum { N = 256 };
+    ClosureCache() : head(0), n(0) {}
+    void* head;
+    uint32 n;
+};
+
+inline ClosureCache& closure_cache() {
+    static __thread ClosureCache* c = 0;
+    return c ? *c : *(c = co::static_new<ClosureCache>());
+}
+
+void* alloc_closure_block() {
+    auto& x = closure_cache();
+    void* p = x.head;
+    if (p) {
+        x.head = *(void**)p;
+        --x.n;
+        return p;
+    }
+    return co::alloc(closure_block_size);
+}
+
+void free_closure_block(void* p) {
+    auto& x = closure_cache();
+    if (x.n < ClosureCache::N) {
+        *(void**)p = x.head;
+        x.head = p;
+        ++x.n;
+    } else {
+        co::free(p, closure_block_size);
+    }
+}
+
+} // xx
+} // co
@@ -1,8 +1,95 @@
 #include "scheduler.h"
 #include "co/stl.h"
+#include "co/object_pool.h"
 
 namespace co {
 
+/**
+ * list of waiting coroutines, for co::Event and co::CondVar
+ *   - Coroutines are linked by Coroutine::wprev and Coroutine::wnext, and 
+ *     Coroutine::wx is used as the wait info, so waiting allocates nothing. 
+ *   - A coroutine timed out removes itself from the list, unless it was taken 
+ *     away already, which it can tell by wprev and head.
+ *   - It is protected by the mutex of its owner.
+ */
+struct WaitList {
+    WaitList() : head(0), tail(0) {}
+
+    // add the coroutine to the list, and make it wait on Coroutine::wx
+    void push_back(Coroutine* co) {
+        co->wx.co = co;
+        co->wx.state = st_wait;
+        co->waitx = &co->wx;
+        co->wnext = 0;
+        co->wprev = tail;
+        if (tail) {
+            tail->wnext = co;
+        } else {
+            head = co;
+        }
+        tail = co;
+    }
+
+    void unlink(Coroutine* co) {
+        if (co->wprev) {
+            co->wprev->wnext = co->wnext;
+        } else if (head == co) {
+            head = co->wnext;
+        } else {
+            return; /* not in the list */
+        }
+        if (co->wnext) {
+            co->wnext->wprev = co->wprev;
+        } else {
+            tail = co->wprev;
+        }
+        co->wprev = co->wnext = 0;
+    }
+
+    // Take at most n coroutines from the list, that are not timed out. They are 
+    // linked by wnext, and should be woken up by wake() without the lock.
+    Coroutine* take(size_t n) {
+        Coroutine* ready = 0, *last = 0;
+        while (head && n > 0) {
+            Coroutine* co = head;
+            head = co->wnext;
+            co->wprev = co->wnext = 0;
+            // Using atomic operation here, as check_timeout() in the Scheduler 
+            // may also modify the state.
+            // TODO: is mo_relaxed safe here?
+            if (atomic_bool_cas(&co->wx.state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+                if (last) {
+                    last->wnext = co;
+                } else {
+                    ready = co;
+                }
+                last = co;
+                --n;
+            }
+        }
+        if (head) {
+            head->wprev = 0;
+        } else {
+            tail = 0;
+        }
+        return ready;
+    }
+
+    // grouped by scheduler, see ReadyBatch
+    static void wake(Coroutine* ready) {
+        ReadyBatch b;
+        while (ready) {
+            Coroutine* co = ready;
+            ready = co->wnext;
+            co->wnext = 0;
+            b.add(co);
+        }
+    }
+
+    Coroutine* head;
+    Coroutine* tail;
+};
+
 class EventImpl {
   public:
     EventImpl() : _counter(0), _signaled(false), _has_cond(false) {}
@@ -15,7 +102,7 @@ class EventImpl {
   private:
     ::Mutex _mtx;
     co::xx::cond_t _cond;
-    co::hash_set<co::waitx_t*> _co_wait;
+    WaitList _wl; // waiting coroutines
     uint32 _counter;
     bool _signaled;
     bool _has_cond;
@@ -26,24 +113,18 @@ bool EventImpl::wait(uint32 ms) {
     if (s) { /* in coroutine */
         Coroutine* co = s->running();
         if (co->s != s) co->s = s;
+        ms = s->wait_ms(ms);
         {
             ::MutexGuard g(_mtx);
             if (_signaled) { if (_counter == 0) _signaled = false; return true; }
-            co->waitx = co::make_waitx(co);
-            _co_wait.insert(co->waitx);
+            _wl.push_back(co);
         }
 
         if (ms != (uint32)-1) s->add_timer(ms);
         s->yield();
-        if (!s->timeout()) {
-            co::free(co->waitx, sizeof(co::waitx_t));
-        } else {
-            bool erased;
-            {
-                ::MutexGuard g(_mtx);
-                erased = _co_wait.erase(co->waitx) == 1;
-            }
-            if (erased) co::free(co->waitx, sizeof(co::waitx_t));
+        if (s->timeout()) {
+            ::MutexGuard g(_mtx);
+            _wl.unlink(co);
         }
 
         co->waitx = nullptr;
@@ -70,10 +151,10 @@ bool EventImpl::wait(uint32 ms) {
 }
 
 void EventImpl::signal() {
-    co::hash_set<co::waitx_t*> co_wait;
+    Coroutine* ready;
     {
         ::MutexGuard g(_mtx);
-        if (!_co_wait.empty()) _co_wait.swap(co_wait);
+        ready = _wl.take((size_t)-1);
         if (!_signaled) {
             _signaled = true;
             if (_counter > 0) {
@@ -83,17 +164,7 @@ void EventImpl::signal() {
         }
     }
 
-    // Using atomic operation here, as check_timeout() in the Scheduler 
-    // may also modify the state.
-    for (auto it = co_wait.begin(); it != co_wait.end(); ++it) {
-        co::waitx_t* w = *it;
-        // TODO: is mo_relaxed safe here?
-        if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-            ((SchedulerImpl*)(w->co->s))->add_ready_task(w->co);
-        } else { /* timeout */
-            co::free(w, sizeof(*w));
-        }
-    }
+    WaitList::wake(ready);
 }
 
 // memory: |4(refn)|4|EventImpl|
@@ -146,39 +217,289 @@ void WaitGroup::wait() const {
     ((EventImpl*)(_p + 2))->wait((uint32)-1);
 }
 
+// memory: |4(refn)|4(counter)|EventImpl|
+Latch::Latch(uint32 n) {
+    _p = (uint32*) co::alloc(sizeof(EventImpl) + 8);
+    _p[0] = 1; // refn
+    _p[1] = n; // counter
+    new (_p + 2) EventImpl();
+}
+
+Latch::~Latch() {
+    if (_p && atomic_dec(_p, mo_acq_rel) == 0) {
+        ((EventImpl*)(_p + 2))->~EventImpl();
+        co::free(_p, sizeof(EventImpl) + 8);
+    }
+}
+
+void Latch::count_down(uint32 n) const {
+    CHECK_GE(atomic_load(_p + 1, mo_relaxed), n);
+    if (atomic_sub(_p + 1, n, mo_acq_rel) == 0) ((EventImpl*)(_p + 2))->signal();
+}
+
+bool Latch::try_wait() const {
+    return atomic_load(_p + 1, mo_acquire) == 0;
+}
+
+bool Latch::wait(uint32 ms) const {
+    if (atomic_load(_p + 1, mo_acquire) == 0) return true;
+    if (ms == 0) return false;
+    auto ev = (EventImpl*)(_p + 2);
+    const bool r = ev->wait(ms);
+    // A signal may be consumed by one waiter only, pass it on to the others.
+    if (r) ev->signal();
+    return r;
+}
+
+// a task of a TaskGroup, kept until the group is destroyed
+struct group_task_t {
+    group_task_t(Closure* cb) : cb(cb), co(0), s(0), done(false), cancel(false) {}
+    Closure* cb;
+    Coroutine* co;    // the coroutine running the task, set when it starts
+    SchedulerImpl* s; // the scheduler of the coroutine
+    bool done;
+    bool cancel;      // the cancel is posted to the scheduler
+};
+
+/**
+ * tasks of a TaskGroup 
+ *   - The group is referenced by the TaskGroup and the tasks not finished. 
+ *   - A task is cancelled in the scheduler it runs in, by a task posted there, 
+ *     see SchedulerImpl::cancel(). As the task sets done in the same thread 
+ *     before it ends, the coroutine is alive if done is false then. 
+ */
+class TaskGroupImpl {
+  public:
+    TaskGroupImpl() : _refn(1), _ndone(0), _cancelled(false) {}
+
+    ~TaskGroupImpl() {
+        for (size_t i = 0; i < _tasks.size(); ++i) co::del(_tasks[i]);
+    }
+
+    void go(Closure* cb) {
+        group_task_t* const t = co::make<group_task_t>(cb);
+        {
+            ::MutexGuard g(_mtx);
+            _tasks.push_back(t);
+        }
+        this->ref();
+        co::go(&TaskGroupImpl::run, this, t);
+    }
+
+    uint32 wait(uint32 n, uint32 ms);
+    void cancel();
+
+    uint32 size() {
+        ::MutexGuard g(_mtx);
+        return (uint32)_tasks.size();
+    }
+
+    uint32 finished() const { return atomic_load(&_ndone, mo_acquire); }
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+
+    void unref() {
+        if (atomic_dec(&_refn, mo_acq_rel) == 0) co::del(this);
+    }
+
+  private:
+    void run(group_task_t* t);
+    void cancel_task(group_task_t* t);
+
+  private:
+    ::Mutex _mtx;
+    co::vector<group_task_t*> _tasks;
+    EventImpl _ev;
+    uint32 _refn;
+    uint32 _ndone;
+    bool _cancelled;
+};
+
+void TaskGroupImpl::run(group_task_t* t) {
+    SchedulerImpl* const s = gSched;
+    Coroutine* const co = s->running();
+    Closure* const cb = t->cb;
+    {
+        ::MutexGuard g(_mtx);
+        t->cb = 0;
+        t->co = co;
+        t->s = s;
+        co->cancelled = _cancelled;
+    }
+    co->grp = t;
+    cb->run();
+    co->grp = 0;
+    co->cancelled = false;
+    {
+        ::MutexGuard g(_mtx);
+        t->done = true;
+    }
+    atomic_inc(&_ndone, mo_acq_rel);
+    _ev.signal();
+    this->unref();
+}
+
+void TaskGroupImpl::cancel_task(group_task_t* t) {
+    {
+        ::MutexGuard g(_mtx);
+        if (!t->done) gSched->cancel(t->co);
+    }
+    this->unref();
+}
+
+void TaskGroupImpl::cancel() {
+    ::MutexGuard g(_mtx);
+    _cancelled = true;
+    for (size_t i = 0; i < _tasks.size(); ++i) {
+        group_task_t* const t = _tasks[i];
+        if (t->s && !t->done && !t->cancel) {
+            t->cancel = true;
+            this->ref();
+            ((Scheduler*)t->s)->go(&TaskGroupImpl::cancel_task, this, t);
+        }
+    }
+}
+
+uint32 TaskGroupImpl::wait(uint32 n, uint32 ms) {
+    const int64 deadline = ms != (uint32)-1 ? now::ms() + ms : 0;
+    while (true) {
+        const uint32 m = this->size();
+        const uint32 x = this->finished();
+        if (x >= (n < m ? n : m)) return x;
+
+        uint32 t = (uint32)-1;
+        if (ms != (uint32)-1) {
+            const int64 r = deadline - now::ms();
+            if (r <= 0) return x;
+            t = (uint32)r;
+        }
+        if (_ev.wait(t)) {
+            // A signal may be consumed by one waiter only, pass it on to the
+            // others if we are done.
+            const uint32 y = this->finished();
+            if (y >= (n < m ? n : m)) { _ev.signal(); return y; }
+        }
+    }
+}
+
+TaskGroup::TaskGroup() : _p(co::make<TaskGroupImpl>()) {}
+
+TaskGroup::~TaskGroup() {
+    if (_p) {
+        auto p = (TaskGroupImpl*)_p;
+        if (p->finished() < p->size()) p->cancel();
+        p->wait((uint32)-1, (uint32)-1);
+        p->unref();
+        _p = 0;
+    }
+}
+
+void TaskGroup::go(Closure* cb) {
+    ((TaskGroupImpl*)_p)->go(cb);
+}
+
+uint32 TaskGroup::wait(uint32 n, uint32 ms) const {
+    return ((TaskGroupImpl*)_p)->wait(n, ms);
+}
+
+void TaskGroup::cancel() const {
+    ((TaskGroupImpl*)_p)->cancel();
+}
+
+uint32 TaskGroup::size() const {
+    return ((TaskGroupImpl*)_p)->size();
+}
+
+uint32 TaskGroup::finished() const {
+    return ((TaskGroupImpl*)_p)->finished();
+}
+
+bool cancelled() {
+    const auto s = gSched;
+    return s && s->cancelled();
+}
+
+inline void cpu_relax() {
+  #if defined(_MSC_VER)
+    YieldProcessor();
+  #elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+  #elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+  #endif
+}
+
+/**
+ * mutex lock for coroutines
+ *   - _lock is taken with an atomic operation, unlock() always holds _mtx, and 
+ *     hands the lock over to the first waiting coroutine if there is any.
+ *   - Before suspending, lock() spins for a while if the lock is held by 
+ *     another scheduler, as a short critical section may end before the cost of 
+ *     yield() and add_ready_task() is paid. The number of spins adapts to the 
+ *     average spins needed to get the lock, up to co_mutex_spin.
+ *   - Waiting coroutines are linked by Coroutine::wnext, no memory allocation.
+ */
 class MutexImpl {
   public:
-    MutexImpl() : _lock(false) {}
+    MutexImpl() : _head(0), _tail(0), _owner(0), _lock(0), _spin(0) {}
     ~MutexImpl() = default;
 
     void lock();
 
     void unlock();
 
-    bool try_lock();
+    bool try_lock() {
+        return atomic_bool_cas(&_lock, 0, 1, mo_acquire, mo_relaxed);
+    }
 
   private:
+    bool spin(Scheduler* s);
+
     ::Mutex _mtx;
-    co::deque<Coroutine*> _co_wait;
-    bool _lock;
+    Coroutine* _head;  // waiting coroutines
+    Coroutine* _tail;
+    Scheduler* _owner; // scheduler of the coroutine holding the lock
+    uint32 _lock;
+    uint32 _spin;      // average spins needed to get the lock
 };
 
-inline bool MutexImpl::try_lock() {
-    ::MutexGuard g(_mtx);
-    return _lock ? false : (_lock = true);
+inline bool MutexImpl::spin(Scheduler* s) {
+    const uint32 max = FLG_co_mutex_spin;
+    if (max == 0 || atomic_load(&_owner, mo_relaxed) == s) return false;
+
+    const uint32 avg = atomic_load(&_spin, mo_relaxed);
+    const uint32 n = avg * 2 + 10 < max ? avg * 2 + 10 : max;
+    uint32 i = 0;
+    for (; i < n; ++i) {
+        cpu_relax();
+        if (atomic_load(&_lock, mo_relaxed) == 0 && this->try_lock()) break;
+    }
+    atomic_store(&_spin, (uint32)((int)avg + ((int)i - (int)avg) / 8), mo_relaxed);
+    return i < n;
 }
 
 inline void MutexImpl::lock() {
     auto s = gSched;
     CHECK(s) << "must be called in coroutine..";
+    if (this->try_lock() || this->spin(s)) {
+        atomic_store(&_owner, s, mo_relaxed);
+        return;
+    }
+
     _mtx.lock();
-    if (!_lock) {
-        _lock = true;
+    if (this->try_lock()) {
         _mtx.unlock();
+        atomic_store(&_owner, s, mo_relaxed);
     } else {
         Coroutine* co = s->running();
         if (co->s != s) co->s = s;
-        _co_wait.push_back(co);
+        co->wnext = 0;
+        if (_tail) {
+            _tail->wnext = co;
+        } else {
+            _head = co;
+        }
+        _tail = co;
         _mtx.unlock();
         s->yield();
     }
@@ -186,12 +507,15 @@ inline void MutexImpl::lock() {
 
 inline void MutexImpl::unlock() {
     _mtx.lock();
-    if (_co_wait.empty()) {
-        _lock = false;
+    if (!_head) {
+        atomic_store(&_owner, (Scheduler*)0, mo_relaxed);
+        atomic_store(&_lock, 0, mo_release);
         _mtx.unlock();
     } else {
-        Coroutine* co = _co_wait.front();
-        _co_wait.pop_front();
+        Coroutine* co = _head;
+        _head = co->wnext;
+        if (!_head) _tail = 0;
+        atomic_store(&_owner, co->s, mo_relaxed);
         _mtx.unlock();
         ((SchedulerImpl*)co->s)->add_ready_task(co);
     }
@@ -223,20 +547,430 @@ bool Mutex::try_lock() const {
     return ((MutexImpl*)(_p + 2))->try_lock();
 }
 
+// No timer is added for waiting coroutines, unless a timeout is given.
+class CondVarImpl {
+  public:
+    CondVarImpl() = default;
+    ~CondVarImpl() = default;
+
+    bool wait(const co::Mutex& m, uint32 ms);
+
+    void notify(size_t n) {
+        Coroutine* ready;
+        {
+            ::MutexGuard g(_mtx);
+            ready = _wl.take(n);
+        }
+        WaitList::wake(ready);
+    }
+
+  private:
+    ::Mutex _mtx;
+    WaitList _wl; // waiting coroutines
+};
+
+bool CondVarImpl::wait(const co::Mutex& m, uint32 ms) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    Coroutine* co = s->running();
+    if (co->s != s) co->s = s;
+    {
+        ::MutexGuard g(_mtx);
+        _wl.push_back(co);
+    }
+
+    // a notify after this point will not be lost, as we are on the list already
+    m.unlock();
+    if (ms != (uint32)-1) s->add_timer(ms);
+    s->yield();
+    const bool r = !s->timeout();
+    if (!r) {
+        ::MutexGuard g(_mtx);
+        _wl.unlink(co);
+    }
+    co->waitx = nullptr;
+    m.lock();
+    return r;
+}
+
+// memory: |4(refn)|4|CondVarImpl|
+CondVar::CondVar() {
+    _p = (uint32*) co::alloc(sizeof(CondVarImpl) + 8);
+    _p[0] = 1; // refn
+    new (_p + 2) CondVarImpl();
+}
+
+CondVar::~CondVar() {
+    if (_p && atomic_dec(_p, mo_acq_rel) == 0) {
+        ((CondVarImpl*)(_p + 2))->~CondVarImpl();
+        co::free(_p, sizeof(CondVarImpl) + 8);
+    }
+}
+
+bool CondVar::wait(const co::Mutex& m, uint32 ms) const {
+    return ((CondVarImpl*)(_p + 2))->wait(m, ms);
+}
+
+void CondVar::notify_one() const {
+    ((CondVarImpl*)(_p + 2))->notify(1);
+}
+
+void CondVar::notify_all() const {
+    ((CondVarImpl*)(_p + 2))->notify((size_t)-1);
+}
+
+/**
+ * writer-preferring read-write lock
+ *   - Readers wait if the lock is held by a writer, or any writer is waiting.
+ *   - The lock is handed over to the waiting coroutines on unlock, as MutexImpl 
+ *     does. When a writer unlocks, the next writer goes first, unless @batch is 
+ *     not 0, then at most @batch waiting readers are let in before it. All the 
+ *     waiting readers are let in if no writer is waiting.
+ */
+class SharedMutexImpl {
+  public:
+    explicit SharedMutexImpl(uint32 batch) 
+        : _readers(0), _batch(batch), _writer(false) {}
+    ~SharedMutexImpl() = default;
+
+    void lock();
+    void unlock();
+    bool try_lock();
+
+    void lock_shared();
+    void unlock_shared();
+    bool try_lock_shared();
+
+  private:
+    ::Mutex _mtx;
+    co::deque<Coroutine*> _rq; // waiting readers
+    co::deque<Coroutine*> _wq; // waiting writers
+    uint32 _readers;           // number of readers holding the lock
+    uint32 _batch;
+    bool _writer;              // held by a writer
+};
+
+void SharedMutexImpl::lock() {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    _mtx.lock();
+    if (!_writer && _readers == 0) {
+        _writer = true;
+        _mtx.unlock();
+    } else {
+        Coroutine* co = s->running();
+        if (co->s != s) co->s = s;
+        _wq.push_back(co);
+        _mtx.unlock();
+        s->yield();
+    }
+}
+
+bool SharedMutexImpl::try_lock() {
+    ::MutexGuard g(_mtx);
+    return (_writer || _readers > 0) ? false : (_writer = true);
+}
+
+void SharedMutexImpl::unlock() {
+    ReadyBatch b; // the readers are woken after the lock is released
+    ::MutexGuard g(_mtx);
+    if (!_wq.empty() && (_batch == 0 || _rq.empty())) {
+        Coroutine* co = _wq.front(); // the lock goes to the next writer
+        _wq.pop_front();
+        ((SchedulerImpl*)co->s)->add_ready_task(co);
+        return;
+    }
+
+    _writer = false;
+    size_t n = _rq.size();
+    if (!_wq.empty() && n > _batch) n = _batch;
+    _readers = (uint32)n;
+    for (size_t i = 0; i < n; ++i) {
+        b.add(_rq.front());
+        _rq.pop_front();
+    }
+}
+
+void SharedMutexImpl::lock_shared() {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    _mtx.lock();
+    if (!_writer && _wq.empty()) {
+        ++_readers;
+        _mtx.unlock();
+    } else {
+        Coroutine* co = s->running();
+        if (co->s != s) co->s = s;
+        _rq.push_back(co);
+        _mtx.unlock();
+        s->yield();
+    }
+}
+
+bool SharedMutexImpl::try_lock_shared() {
+    ::MutexGuard g(_mtx);
+    if (_writer || !_wq.empty()) return false;
+    ++_readers;
+    return true;
+}
+
+void SharedMutexImpl::unlock_shared() {
+    ::MutexGuard g(_mtx);
+    if (--_readers == 0 && !_wq.empty()) {
+        _writer = true;
+        Coroutine* co = _wq.front();
+        _wq.pop_front();
+        ((SchedulerImpl*)co->s)->add_ready_task(co);
+    }
+}
+
+// memory: |4(refn)|4|SharedMutexImpl|
+SharedMutex::SharedMutex(uint32 batch) {
+    _p = (uint32*) co::alloc(sizeof(SharedMutexImpl) + 8);
+    _p[0] = 1; // refn
+    new (_p + 2) SharedMutexImpl(batch);
+}
+
+SharedMutex::~SharedMutex() {
+    if (_p && atomic_dec(_p, mo_acq_rel) == 0) {
+        ((SharedMutexImpl*)(_p + 2))->~SharedMutexImpl();
+        co::free(_p, sizeof(SharedMutexImpl) + 8);
+    }
+}
+
+void SharedMutex::lock() const {
+    ((SharedMutexImpl*)(_p + 2))->lock();
+}
+
+void SharedMutex::unlock() const {
+    ((SharedMutexImpl*)(_p + 2))->unlock();
+}
+
+bool SharedMutex::try_lock() const {
+    return ((SharedMutexImpl*)(_p + 2))->try_lock();
+}
+
+void SharedMutex::lock_shared() const {
+    ((SharedMutexImpl*)(_p + 2))->lock_shared();
+}
+
+void SharedMutex::unlock_shared() const {
+    ((SharedMutexImpl*)(_p + 2))->unlock_shared();
+}
+
+bool SharedMutex::try_lock_shared() const {
+    return ((SharedMutexImpl*)(_p + 2))->try_lock_shared();
+}
+
+/**
+ * counting semaphore
+ *   - Permits are taken with a CAS on _count. Only when there are not enough 
+ *     permits, the coroutine is put on the wait list and suspended.
+ *   - Waiting coroutines are served in order by release(), and a new comer does 
+ *     not take permits if anyone is waiting. _nwait tells release() whether it 
+ *     needs to lock _mtx.
+ */
+class SemaphoreImpl {
+  public:
+    explicit SemaphoreImpl(uint32 n) : _head(0), _tail(0), _count(n), _nwait(0) {}
+    ~SemaphoreImpl() = default;
+
+    bool acquire(uint32 n, uint32 ms);
+
+    void release(uint32 n);
+
+    bool try_acquire(uint32 n) {
+        int64 c = atomic_load(&_count, mo_relaxed);
+        while (c >= (int64)n) {
+            const int64 x = atomic_cas(&_count, c, c - n, mo_acquire, mo_relaxed);
+            if (x == c) return true;
+            c = x;
+        }
+        return false;
+    }
+
+    int64 count() const { return atomic_load(&_count, mo_relaxed); }
+
+  private:
+    struct semx {
+        Coroutine* co;
+        union {
+            int state;
+            void* dummy;
+        };
+        semx* prev;
+        semx* next;
+        uint32 n; // number of permits wanted
+    };
+
+    void unlink(semx* w) {
+        if (w->prev) {
+            w->prev->next = w->next;
+        } else {
+            _head = w->next;
+        }
+        if (w->next) {
+            w->next->prev = w->prev;
+        } else {
+            _tail = w->prev;
+        }
+        w->prev = w->next = 0;
+    }
+
+    void serve();
+
+    ::Mutex _mtx;
+    semx* _head; // waiting coroutines
+    semx* _tail;
+    int64 _count;
+    uint32 _nwait;
+};
+
+// give permits to the waiting coroutines in order, called with _mtx locked
+void SemaphoreImpl::serve() {
+    ReadyBatch b;
+    while (_head && this->try_acquire(_head->n)) {
+        semx* w = _head;
+        this->unlink(w);
+        atomic_dec(&_nwait, mo_relaxed);
+        // The permits taken above are handed to the waiter if this CAS wins the
+        // race with the timeout in the scheduler, otherwise they are released
+        // for others, just like release() does.
+        if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_acquire, mo_relaxed)) {
+            b.add(w->co);
+        } else { /* timeout, give the permits back */
+            atomic_add(&_count, w->n, mo_release);
+        }
+    }
+}
+
+bool SemaphoreImpl::acquire(uint32 n, uint32 ms) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    if (atomic_load(&_nwait, mo_relaxed) == 0 && this->try_acquire(n)) return true;
+    if (ms == 0) return this->try_acquire(n);
+
+    auto co = s->running();
+    if (co->s != s) co->s = s;
+    semx* w;
+    {
+        ::MutexGuard g(_mtx);
+        atomic_inc(&_nwait, mo_relaxed);
+        atomic_fence(mo_seq_cst);
+        if (!_head && this->try_acquire(n)) {
+            atomic_dec(&_nwait, mo_relaxed);
+            return true;
+        }
+
+        w = (semx*) co::object_pool<semx>::alloc();
+        w->co = co;
+        w->state = st_wait;
+        w->prev = _tail;
+        w->next = 0;
+        w->n = n;
+        if (_tail) {
+            _tail->next = w;
+        } else {
+            _head = w;
+        }
+        _tail = w;
+    }
+
+    co->waitx = (co::waitx_t*)w;
+    if (ms != (uint32)-1) s->add_timer(ms);
+    s->yield();
+    co->waitx = 0;
+
+    const bool r = !s->timeout();
+    if (!r) {
+        ::MutexGuard g(_mtx);
+        if (w->prev || _head == w) { /* still in the list */
+            this->unlink(w);
+            atomic_dec(&_nwait, mo_relaxed);
+            this->serve(); // the next ones may be served now
+        }
+    }
+    co::object_pool<semx>::free(w);
+    return r;
+}
+
+void SemaphoreImpl::release(uint32 n) {
+    atomic_add(&_count, n, mo_release);
+    atomic_fence(mo_seq_cst);
+    if (atomic_load(&_nwait, mo_relaxed) == 0) return;
+    ::MutexGuard g(_mtx);
+    this->serve();
+}
+
+// memory: |4(refn)|4|SemaphoreImpl|
+Semaphore::Semaphore(uint32 n) {
+    _p = (uint32*) co::alloc(sizeof(SemaphoreImpl) + 8);
+    _p[0] = 1; // refn
+    new (_p + 2) SemaphoreImpl(n);
+}
+
+Semaphore::~Semaphore() {
+    if (_p && atomic_dec(_p, mo_acq_rel) == 0) {
+        ((SemaphoreImpl*)(_p + 2))->~SemaphoreImpl();
+        co::free(_p, sizeof(SemaphoreImpl) + 8);
+    }
+}
+
+bool Semaphore::acquire(uint32 n, uint32 ms) const {
+    return ((SemaphoreImpl*)(_p + 2))->acquire(n, ms);
+}
+
+bool Semaphore::try_acquire(uint32 n) const {
+    return ((SemaphoreImpl*)(_p + 2))->try_acquire(n);
+}
+
+void Semaphore::release(uint32 n) const {
+    ((SemaphoreImpl*)(_p + 2))->release(n);
+}
+
+int64 Semaphore::count() const {
+    return ((SemaphoreImpl*)(_p + 2))->count();
+}
+
+/**
+ * pool of each scheduler
+ *   - Elements are pushed to and popped from the back, so the front is the one 
+ *     staying in the pool for the longest time.
+ *   - If ttl is not 0, elements not used for ttl milliseconds are destroyed by 
+ *     a tick of the scheduler. 
+ *   - If borrow is true, a scheduler with an empty pool takes an element from 
+ *     the pools of other schedulers, before creating a new one. The mutex of 
+ *     each pool is used only in this case.
+ */
 class PoolImpl {
   public:
-    typedef co::array<void*> V;
+    struct E {
+        void* p;
+        int64 t; // time in ms it was pushed to the pool
+    };
+
+    struct L {
+        L() : v(64), ticking(false) {}
+        ::Mutex mtx;
+        co::array<E> v;
+        bool ticking;
+    };
 
     PoolImpl()
-        : _pools(co::scheduler_num(), nullptr), _maxcap((size_t)-1) {
+        : _pools(co::scheduler_num(), nullptr), _maxcap((size_t)-1), _ttl(0), _borrow(false) {
     }
 
-    PoolImpl(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap)
+    PoolImpl(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap, uint32 ttl, bool borrow)
         : _pools(co::scheduler_num(), nullptr), _maxcap(cap), 
-          _ccb(std::move(ccb)), _dcb(std::move(dcb)) {
+          _ccb(std::move(ccb)), _dcb(std::move(dcb)), _ttl(_dcb ? ttl : 0), _borrow(borrow) {
+        // pools are created here, as other schedulers may access them
+        if (_borrow) for (auto& l : _pools) l = co::make<L>();
     }
 
-    ~PoolImpl() { this->clear(); }
+    ~PoolImpl() {
+        this->clear();
+        for (auto& l : _pools) if (l) co::del(l);
+    }
 
     void* pop();
 
@@ -247,49 +981,124 @@ class PoolImpl {
     size_t size() const;
 
   private:
-    co::array<V*> _pools;
+    // pool of the current scheduler
+    L* local(SchedulerImpl* s) {
+        L*& l = _pools[s->id()];
+        if (!l) { l = co::make<L>(); assert(l); }
+        if (_ttl > 0 && !l->ticking) {
+            s->add_tick(&PoolImpl::on_tick, this, _ttl / 2 + 1);
+            l->ticking = true;
+        }
+        return l;
+    }
+
+    void* borrow(uint32 id);
+
+    // destroy elements expired in the pool of the current scheduler
+    static void on_tick(void* p);
+
+    co::array<L*> _pools;
     size_t _maxcap;
     std::function<void*()> _ccb;
     std::function<void(void*)> _dcb;
+    uint32 _ttl;
+    bool _borrow;
 };
 
 inline void* PoolImpl::pop() {
-    CHECK(gSched) << "must be called in coroutine..";
-    auto& v = _pools[gSched->id()];
-    if (!v) { v = co::make<V>(1024); assert(v); }
-    if (!v->empty()) {
-        return v->pop_back();
-    } else {
-        return _ccb ? _ccb() : 0;
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    L* l = this->local(s);
+    {
+        if (_borrow) l->mtx.lock();
+        void* p = l->v.empty() ? 0 : l->v.pop_back().p;
+        if (_borrow) l->mtx.unlock();
+        if (p) return p;
+    }
+
+    if (_borrow) {
+        void* p = this->borrow(s->id());
+        if (p) return p;
+    }
+    return _ccb ? _ccb() : 0;
+}
+
+void* PoolImpl::borrow(uint32 id) {
+    for (size_t i = 1; i < _pools.size(); ++i) {
+        L* l = _pools[(id + i) % _pools.size()];
+        ::MutexGuard g(l->mtx);
+        if (!l->v.empty()) return l->v.pop_back().p;
     }
+    return 0;
 }
 
 inline void PoolImpl::push(void* p) {
     if (!p) return; // ignore null pointer
-    CHECK(gSched) << "must be called in coroutine..";
-    auto& v = _pools[gSched->id()];
-    if (!v) { v = co::make<V>(1024); assert(v); }
-    if (v->size() < _maxcap || !_dcb) {
-        v->push_back(p);
-    } else {
-        _dcb(p);
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    L* l = this->local(s);
+    if (_borrow) l->mtx.lock();
+    if (l->v.size() < _maxcap || !_dcb) {
+        E e = { p, _ttl > 0 ? s->now_ms() : 0 };
+        l->v.push_back(e);
+        p = 0;
+    }
+    if (_borrow) l->mtx.unlock();
+    if (p) _dcb(p);
+}
+
+void PoolImpl::on_tick(void* arg) {
+    PoolImpl* const pool = (PoolImpl*)arg;
+    auto s = gSched;
+    L* l = pool->_pools[s->id()];
+    if (!l) return;
+
+    co::vector<void*> x;
+    {
+        if (pool->_borrow) l->mtx.lock();
+        auto& v = l->v;
+        const int64 t = s->now_ms() - pool->_ttl;
+        size_t n = 0;
+        while (n < v.size() && v[n].t <= t) ++n;
+        if (n > 0) {
+            x.reserve(n);
+            for (size_t i = 0; i < n; ++i) x.push_back(v[i].p);
+            memmove(&v[0], &v[n], (v.size() - n) * sizeof(E));
+            v.resize(v.size() - n);
+        }
+        if (pool->_borrow) l->mtx.unlock();
+    }
+
+    // destroy them in a coroutine, as dcb may call coroutine APIs like co::close()
+    if (!x.empty()) {
+        std::function<void(void*)> dcb = pool->_dcb;
+        s->go([x, dcb]() { for (auto& p : x) dcb(p); });
     }
 }
 
 // Create n coroutines to clear all the pools, n is number of schedulers.
 // clear() blocks untils all the coroutines are done.
 void PoolImpl::clear() {
+    auto f = [this](L* l) {
+        if (this->_borrow) l->mtx.lock();
+        if (this->_dcb) for (auto& e : l->v) this->_dcb(e.p);
+        l->v.clear();
+        if (this->_borrow) l->mtx.unlock();
+    };
+
     if (co::is_active()) {
         auto& scheds = co::schedulers();
         WaitGroup wg;
         wg.add((uint32)scheds.size());
 
         for (auto& s : scheds) {
-            s->go([this, wg]() {
-                auto& v = this->_pools[gSched->id()];
-                if (v) {
-                    if (this->_dcb) for (auto& e : *v) this->_dcb(e);
-                    co::del(v); v = nullptr;
+            s->go([this, wg, &f]() {
+                auto s = gSched;
+                auto& l = this->_pools[s->id()];
+                if (l) {
+                    if (l->ticking) { s->del_tick(this); l->ticking = false; }
+                    f(l);
+                    if (!this->_borrow) { co::del(l); l = nullptr; }
                 }
                 wg.done();
             });
@@ -297,19 +1106,24 @@ void PoolImpl::clear() {
 
         wg.wait();
     } else {
-        for (auto& v : _pools) {
-            if (v) {
-                if (this->_dcb) for (auto& e : *v) this->_dcb(e);
-                co::del(v); v = nullptr;
+        for (auto& l : _pools) {
+            if (l) {
+                f(l);
+                if (!_borrow) { co::del(l); l = nullptr; }
             }
         }
     }
 }
 
 inline size_t PoolImpl::size() const {
-    CHECK(gSched) << "must be called in coroutine..";
-    auto& v = _pools[gSched->id()];
-    return v ? v->size() : 0;
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    L* l = _pools[s->id()];
+    if (!l) return 0;
+    if (_borrow) l->mtx.lock();
+    const size_t n = l->v.size();
+    if (_borrow) l->mtx.unlock();
+    return n;
 }
 
 // memory: |4(refn)|4|PoolImpl|
@@ -326,10 +1140,10 @@ Pool::~Pool() {
     }
 }
 
-Pool::Pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap) {
+Pool::Pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap, uint32 ttl, bool borrow) {
     _p = (uint32*) co::alloc(sizeof(PoolImpl) + 8);
     _p[0] = 1;
-    new (_p + 2) PoolImpl(std::move(ccb), std::move(dcb), cap);
+    new (_p + 2) PoolImpl(std::move(ccb), std::move(dcb), cap, ttl, borrow);
 }
 
 void* Pool::pop() const {
@@ -364,6 +1178,18 @@ class PipeImpl {
 
     void read(void* p);
     void write(const void* p);
+    uint32 read_n(void* p, uint32 n);
+    uint32 write_n(const void* p, uint32 n);
+
+    // wait info of select(), shared by all its cases
+    struct selx {
+        co::Coroutine* co;
+        union {
+            int state;
+            void* dummy;
+        };
+        int ready; // index of the case done
+    };
 
     struct waitx {
         co::Coroutine* co;
@@ -373,26 +1199,86 @@ class PipeImpl {
         };
         void* buf;
         size_t len; // total length of the memory
+        selx* sel;  // not NULL if it is a case of select()
+        int idx;    // index of the case in select()
+        uint32 n;   // number of blocks @buf can hold, for readers
+        uint32 k;   // number of blocks written to @buf, for readers
     };
 
-    waitx* create_waitx(co::Coroutine* co, void* buf) {
+    waitx* create_waitx(co::Coroutine* co, void* buf, uint32 n=1) {
         waitx* w;
         const bool on_stack = gSched->on_stack(buf);
         if (on_stack) {
-            w = (waitx*) co::alloc(sizeof(waitx) + _blk_size);
+            w = (waitx*) co::alloc(sizeof(waitx) + _blk_size * n);
             w->buf = (char*)w + sizeof(waitx);
-            w->len = sizeof(waitx) + _blk_size;
+            w->len = sizeof(waitx) + _blk_size * n;
         } else {
-            w = (waitx*) co::alloc(sizeof(waitx));
+            w = (waitx*) co::object_pool<waitx>::alloc();
             w->buf = buf;
             w->len = sizeof(waitx);
         }
         w->co = co;
         w->state = st_wait;
+        w->sel = 0;
+        w->n = n;
+        w->k = 0;
         return w;
     }
 
+    void free_waitx(waitx* w) {
+        if (w->len == sizeof(waitx)) {
+            co::object_pool<waitx>::free(w);
+        } else {
+            co::free(w, w->len);
+        }
+    }
+
+    // called with _m locked
+    bool readable() const { return _rx != _wx || _full; }
+    bool writable() const { return !_full; }
+
+    // read or write a block if readable() or writable(), called with _m locked.
+    // _m will be unlocked if it returns true.
+    bool try_read(void* p);
+    bool try_write(const void* p);
+
+    // read or write at most n blocks without waiting, called with _m locked.
+    // Waiting coroutines are woken up with _m locked.
+    uint32 take(char* p, uint32 n);
+    uint32 put(const char* p, uint32 n);
+
+    // remove a waiting case of select() from the queue
+    void erase(waitx* w) {
+        ::MutexGuard g(_m);
+        for (auto it = _wq.begin(); it != _wq.end(); ++it) {
+            if (*it == w) { _wq.erase(it); break; }
+        }
+    }
+
+    ::Mutex& mutex() { return _m; }
+    co::deque<waitx*>& wait_queue() { return _wq; }
+    uint32 blk_size() const { return _blk_size; }
+
   private:
+    // Mark a waiting coroutine as ready. Using atomic operation here, as 
+    // check_timeout() in the Scheduler, or another case of the select() may 
+    // also modify the state. It returns false if the coroutine had timed out,
+    // and the wait info is freed here, unless it belongs to a select(), which 
+    // will free it itself.
+    bool ready(waitx* w) {
+        if (!w->sel) {
+            // TODO: is mo_relaxed safe here?
+            if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) return true;
+            this->free_waitx(w);
+            return false;
+        }
+        if (atomic_bool_cas(&w->sel->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+            w->sel->ready = w->idx;
+            return true;
+        }
+        return false;
+    }
+
     ::Mutex _m;
     co::deque<waitx*> _wq;
     char* _buf;       // buffer
@@ -404,11 +1290,7 @@ class PipeImpl {
     bool _full;       // 0: not full, 1: full
 };
 
-void PipeImpl::read(void* p) {
-    auto s = gSched;
-    CHECK(s) << "must be called in coroutine..";
-
-    _m.lock();
+bool PipeImpl::try_read(void* p) {
     if (_rx != _wx) { /* buffer is neither empty nor full */
         assert(!_full);
         assert(_wq.empty());
@@ -416,55 +1298,150 @@ void PipeImpl::read(void* p) {
         _rx += _blk_size;
         if (_rx == _buf_size) _rx = 0;
         _m.unlock();
+        return true;
+    }
 
-    } else {
-        if (!_full) { /* buffer is empty */
-            auto co = s->running();
-            waitx* w = this->create_waitx(co, p);
-            _wq.push_back(w);
-            _m.unlock();
+    if (!_full) return false; /* buffer is empty */
 
-            if (co->s != s) co->s = s;
-            co->waitx = (co::waitx_t*)w;
+    /* buffer is full */
+    memcpy(p, _buf + _rx, _blk_size);
+    _rx += _blk_size;
+    if (_rx == _buf_size) _rx = 0;
 
-            if (_ms != (uint32)-1) s->add_timer(_ms);
-            s->yield();
+    while (!_wq.empty()) {
+        waitx* w = _wq.front(); // wait for write
+        _wq.pop_front();
 
-            if (!s->timeout()) {
-                if (w->buf != p) memcpy(p, w->buf, _blk_size);
-                co::free(w, w->len);
-            }
+        if (this->ready(w)) {
+            memcpy(_buf + _wx, w->buf, _blk_size);
+            _wx += _blk_size;
+            if (_wx == _buf_size) _wx = 0;
+            _m.unlock();
 
-            co->waitx = 0;
+            ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
+            return true;
+        }
+    }
+
+    _full = false;
+    _m.unlock();
+    return true;
+}
+
+bool PipeImpl::try_write(const void* p) {
+    if (_rx != _wx) { /* buffer is neither empty nor full */
+        assert(!_full);
+        assert(_wq.empty());
+        memcpy(_buf + _wx, p, _blk_size);
+        _wx += _blk_size;
+        if (_wx == _buf_size) _wx = 0;
+        if (_rx == _wx) _full = true;
+        _m.unlock();
+        return true;
+    }
 
-        } else { /* buffer is full */
-            memcpy(p, _buf + _rx, _blk_size);
-            _rx += _blk_size;
-            if (_rx == _buf_size) _rx = 0;
+    if (_full) return false; /* buffer is full */
 
-            while (!_wq.empty()) {
-                waitx* w = _wq.front(); // wait for write
-                _wq.pop_front();
+    /* buffer is empty */
+    while (!_wq.empty()) {
+        waitx* w = _wq.front(); // wait for read
+        _wq.pop_front();
 
-                // TODO: is mo_relaxed safe here?
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                    memcpy(_buf + _wx, w->buf, _blk_size);
-                    _wx += _blk_size;
-                    if (_wx == _buf_size) _wx = 0;
-                    _m.unlock();
+        if (this->ready(w)) {
+            _m.unlock();
+            memcpy(w->buf, p, _blk_size);
+            w->k = 1;
+            ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
+            return true;
+        }
+    }
 
-                    ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
-                    return;
+    memcpy(_buf + _wx, p, _blk_size);
+    _wx += _blk_size;
+    if (_wx == _buf_size) _wx = 0;
+    if (_rx == _wx) _full = true;
+    _m.unlock();
+    return true;
+}
 
-                } else { /* timeout */
-                    co::free(w, w->len);
-                }
+uint32 PipeImpl::take(char* p, uint32 n) {
+    uint32 k = 0;
+    while (k < n && (_rx != _wx || _full)) {
+        memcpy(p + k * _blk_size, _buf + _rx, _blk_size);
+        _rx += _blk_size;
+        if (_rx == _buf_size) _rx = 0;
+        _full = false;
+        ++k;
+
+        // a slot is free now, move the block of a waiting writer into it
+        while (!_wq.empty()) {
+            waitx* w = _wq.front();
+            _wq.pop_front();
+            if (this->ready(w)) {
+                memcpy(_buf + _wx, w->buf, _blk_size);
+                _wx += _blk_size;
+                if (_wx == _buf_size) _wx = 0;
+                if (_rx == _wx) _full = true;
+                ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
+                break;
             }
+        }
+    }
+    return k;
+}
 
-            _full = false;
-            _m.unlock();
+uint32 PipeImpl::put(const char* p, uint32 n) {
+    uint32 k = 0;
+    ReadyBatch b;
+
+    // buffer is empty, give each waiting reader as many blocks as it can hold
+    while (k < n && _rx == _wx && !_full && !_wq.empty()) {
+        waitx* w = _wq.front(); // wait for read
+        _wq.pop_front();
+        if (this->ready(w)) {
+            const uint32 m = w->n < n - k ? w->n : n - k;
+            memcpy(w->buf, p + k * _blk_size, m * _blk_size);
+            w->k = m;
+            k += m;
+            b.add(w->co);
         }
     }
+
+    while (k < n && !_full) {
+        memcpy(_buf + _wx, p + k * _blk_size, _blk_size);
+        _wx += _blk_size;
+        if (_wx == _buf_size) _wx = 0;
+        if (_rx == _wx) _full = true;
+        ++k;
+    }
+    return k;
+}
+
+void PipeImpl::read(void* p) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+
+    _m.lock();
+    if (this->try_read(p)) return;
+
+    /* buffer is empty */
+    auto co = s->running();
+    waitx* w = this->create_waitx(co, p);
+    _wq.push_back(w);
+    _m.unlock();
+
+    if (co->s != s) co->s = s;
+    co->waitx = (co::waitx_t*)w;
+
+    if (_ms != (uint32)-1) s->add_timer(_ms);
+    s->yield();
+
+    if (!s->timeout()) {
+        if (w->buf != p) memcpy(p, w->buf, _blk_size);
+        this->free_waitx(w);
+    }
+
+    co->waitx = 0;
 }
 
 void PipeImpl::write(const void* p) {
@@ -472,55 +1449,88 @@ void PipeImpl::write(const void* p) {
     CHECK(s) << "must be called in coroutine..";
 
     _m.lock();
-    if (_rx != _wx) { /* buffer is neither empty nor full */
-        assert(!_full);
-        assert(_wq.empty());
-        memcpy(_buf + _wx, p, _blk_size);
-        _wx += _blk_size;
-        if (_wx == _buf_size) _wx = 0;
-        if (_rx == _wx) _full = true;
-        _m.unlock();
+    if (this->try_write(p)) return;
 
-    } else {
-        if (!_full) { /* buffer is empty */
-            while (!_wq.empty()) {
-                waitx* w = _wq.front(); // wait for read
-                _wq.pop_front();
-
-                // TODO: is mo_relaxed safe here?
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                    _m.unlock();
-                    memcpy(w->buf, p, _blk_size);
-                    ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
-                    return;
-                } else { /* timeout */
-                    co::free(w, w->len);
-                }
-            }
+    /* buffer is full */
+    auto co = s->running();
+    waitx* w = this->create_waitx(co, (void*)p);
+    if (w->buf != p) memcpy(w->buf, p, _blk_size);
+    _wq.push_back(w);
+    _m.unlock();
 
-            memcpy(_buf + _wx, p, _blk_size);
-            _wx += _blk_size;
-            if (_wx == _buf_size) _wx = 0;
-            if (_rx == _wx) _full = true;
-            _m.unlock();
+    if (co->s != s) co->s = s;
+    co->waitx = (co::waitx_t*)w;
 
-        } else { /* buffer is full */
-            auto co = s->running();
-            waitx* w = this->create_waitx(co, (void*)p);
-            if (w->buf != p) memcpy(w->buf, p, _blk_size);
-            _wq.push_back(w);
-            _m.unlock();
+    if (_ms != (uint32)-1) s->add_timer(_ms);
+    s->yield();
 
-            if (co->s != s) co->s = s;
-            co->waitx = (co::waitx_t*)w;
+    if (!s->timeout()) this->free_waitx(w);
+    co->waitx = 0;
+}
 
-            if (_ms != (uint32)-1) s->add_timer(_ms);
-            s->yield();
+uint32 PipeImpl::read_n(void* p, uint32 n) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
 
-            if (!s->timeout()) co::free(w, w->len);
-            co->waitx = 0;
-        }
+    if (n == 0) return 0;
+
+    _m.lock();
+    uint32 k = this->take((char*)p, n);
+    if (k > 0) { _m.unlock(); return k; }
+
+    // buffer is empty, wait for a writer to fill up to n blocks for us
+    auto co = s->running();
+    waitx* w = this->create_waitx(co, p, n);
+    _wq.push_back(w);
+    _m.unlock();
+
+    if (co->s != s) co->s = s;
+    co->waitx = (co::waitx_t*)w;
+
+    if (_ms != (uint32)-1) s->add_timer(_ms);
+    s->yield();
+
+    if (!s->timeout()) {
+        k = w->k;
+        if (w->buf != p) memcpy(p, w->buf, k * _blk_size);
+        this->free_waitx(w);
+    }
+
+    co->waitx = 0;
+    return k;
+}
+
+uint32 PipeImpl::write_n(const void* p, uint32 n) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+
+    const char* x = (const char*)p;
+    uint32 k = 0;
+    while (k < n) {
+        _m.lock();
+        k += this->put(x + k * _blk_size, n - k);
+        if (k == n) { _m.unlock(); break; }
+
+        // buffer is full, wait until the next block is taken by a reader
+        auto co = s->running();
+        const char* b = x + k * _blk_size;
+        waitx* w = this->create_waitx(co, (void*)b);
+        if (w->buf != b) memcpy(w->buf, b, _blk_size);
+        _wq.push_back(w);
+        _m.unlock();
+
+        if (co->s != s) co->s = s;
+        co->waitx = (co::waitx_t*)w;
+
+        if (_ms != (uint32)-1) s->add_timer(_ms);
+        s->yield();
+
+        co->waitx = 0;
+        if (s->timeout()) break;
+        this->free_waitx(w);
+        ++k;
     }
+    return k;
 }
 
 Pipe::Pipe(uint32 buf_size, uint32 blk_size, uint32 ms) {
@@ -544,6 +1554,96 @@ void Pipe::write(const void* p) const {
     ((PipeImpl*)(_p + 2))->write(p);
 }
 
+uint32 Pipe::read_n(void* p, uint32 n) const {
+    return ((PipeImpl*)(_p + 2))->read_n(p, n);
+}
+
+uint32 Pipe::write_n(const void* p, uint32 n) const {
+    return ((PipeImpl*)(_p + 2))->write_n(p, n);
+}
+
+/*
+ * select() puts a waitx on the queue of every pipe that is not ready, in the 
+ * order of the cases. They share the same state in a selx, so that only one of 
+ * them, or the timer, can wake up the coroutine. If a pipe becomes ready after 
+ * some waitx were queued, we have to win the state first before doing the job.
+ */
+int Pipe::select(const select_case* c, size_t n, uint32 ms) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    typedef PipeImpl::waitx waitx;
+    typedef PipeImpl::selx selx;
+
+    auto co = s->running();
+    if (co->s != s) co->s = s;
+
+    const size_t size = sizeof(selx) + sizeof(waitx*) * n;
+    selx* x = (selx*) co::alloc(size);
+    x->co = co;
+    x->state = st_wait;
+    x->ready = -1;
+    waitx** w = (waitx**)(x + 1);
+    memset(w, 0, sizeof(waitx*) * n);
+
+    int r = -1;
+    bool queued = false, lost = false;
+    for (size_t i = 0; i < n; ++i) {
+        PipeImpl* p = (PipeImpl*)(c[i].p->_p + 2);
+        p->mutex().lock();
+        if (c[i].write ? p->writable() : p->readable()) {
+            if (queued && !atomic_bool_cas(&x->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+                p->mutex().unlock();
+                lost = true; // another case was done first
+                break;
+            }
+            if (c[i].write) {
+                p->try_write(c[i].buf);
+            } else {
+                p->try_read(c[i].buf);
+            }
+            r = (int)i;
+            break;
+        }
+
+        waitx* e = p->create_waitx(co, c[i].buf);
+        if (c[i].write && e->buf != c[i].buf) memcpy(e->buf, c[i].buf, p->blk_size());
+        e->sel = x;
+        e->idx = (int)i;
+        p->wait_queue().push_back(e);
+        p->mutex().unlock();
+        w[i] = e;
+        queued = true;
+    }
+
+    if (r < 0) {
+        if (ms == 0 && !lost) {
+            lost = !atomic_bool_cas(&x->state, st_wait, st_timeout, mo_relaxed, mo_relaxed);
+        }
+        if (ms != 0 || lost) {
+            co->waitx = (co::waitx_t*)x;
+            if (ms != (uint32)-1 && !lost) s->add_timer(ms);
+            s->yield();
+            co->waitx = 0;
+            r = s->timeout() ? -1 : x->ready;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        waitx* e = w[i];
+        if (!e) continue;
+        PipeImpl* p = (PipeImpl*)(c[i].p->_p + 2);
+        if ((int)i == r) {
+            if (!c[i].write && e->buf != c[i].buf) memcpy(c[i].buf, e->buf, p->blk_size());
+        } else {
+            p->erase(e);
+        }
+        p->free_waitx(e);
+    }
+
+    co::free(x, size);
+    return r;
+}
+
 } // xx
 
 } // co
@@ -2,22 +2,26 @@
 #include "epoll.h"
 #include "../close.h"
 
+DEF_bool(co_epoll_persist, false, ">>#1 if true, register a socket to epoll only once for both read and write, and remove it only when the socket is closed");
+DEF_uint32(co_epoll_events, 8192, ">>#1 max number of events a scheduler gets from epoll at once, the buffer grows up to it under load, default: 8192");
+
 namespace co {
 
-Epoll::Epoll(int sched_id) : _signaled(0), _sched_id(sched_id) {
+static const uint32 kMinEvents = 64;
+
+Epoll::Epoll(int sched_id)
+    : _signaled(0), _sched_id(sched_id), _cap(kMinEvents), _next_cap(kMinEvents), _peak(0), _rounds(0) {
     _ep = epoll_create(1024);
     CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
     co::set_cloexec(_ep);
 
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(_efd, -1) << "create eventfd error: " << co::strerror();
 
-    // register ev_read for _pipe_fds[0] to this epoll.
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], 0));
+    // register ev_read for _efd to this epoll.
+    CHECK(this->add_ev_read(_efd, 0));
 
-    _ev = (epoll_event*) ::calloc(1024, sizeof(epoll_event));
+    _ev = (epoll_event*) ::calloc(_cap, sizeof(epoll_event));
 }
 
 Epoll::~Epoll() {
@@ -25,11 +29,59 @@ Epoll::~Epoll() {
     if (_ev) { ::free(_ev); _ev = 0; }
 }
 
+void Epoll::adapt() {
+    const uint32 max_cap = FLG_co_epoll_events > kMinEvents ? FLG_co_epoll_events : kMinEvents;
+    if (_cap > max_cap) {
+        _next_cap = max_cap;
+    } else if (_peak == _cap) {
+        // the buffer was full, there may be more events in the epoll
+        if (_cap < max_cap) _next_cap = _cap * 2 < max_cap ? _cap * 2 : max_cap;
+    } else if (_peak * 4 < _cap && _cap > kMinEvents) {
+        _next_cap = _cap / 2;
+    }
+    _peak = 0;
+    _rounds = 0;
+}
+
+// events of the last wait have been handled, the buffer can be replaced now.
+void Epoll::resize() {
+    ::free(_ev);
+    _cap = _next_cap;
+    _ev = (epoll_event*) ::calloc(_cap, sizeof(epoll_event));
+}
+
+// register the socket to this epoll for both read and write, edge-triggered.
+bool Epoll::add_persist_event(int fd, SockCtx& ctx) {
+    if (ctx.registered(_sched_id)) return true;
+    if (ctx.registered()) return false; // registered to another scheduler
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+
+    // the socket may have been added by a coroutine in this scheduler, when it 
+    // was registered to another scheduler.
+    int r = epoll_ctl(_ep, EPOLL_CTL_ADD, fd, &ev);
+    if (r != 0 && errno == EEXIST) r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
+    if (r == 0) {
+        ctx.set_registered(_sched_id);
+        return true;
+    } else {
+        ELOG << "epoll add event error: " << co::strerror() << ", fd: " << fd;
+        return false;
+    }
+}
+
 bool Epoll::add_ev_read(int fd, int32 co_id) {
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_read()) return true; // already exists
 
+    if (FLG_co_epoll_persist && co_id != 0 && this->add_persist_event(fd, ctx)) {
+        ctx.add_ev_read(_sched_id, co_id);
+        return true;
+    }
+
     const bool has_ev_write = ctx.has_ev_write(_sched_id);
     epoll_event ev;
     ev.events = has_ev_write ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLET);
@@ -50,6 +102,11 @@ bool Epoll::add_ev_write(int fd, int32 co_id) {
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_write()) return true; // already exists
 
+    if (FLG_co_epoll_persist && co_id != 0 && this->add_persist_event(fd, ctx)) {
+        ctx.add_ev_write(_sched_id, co_id);
+        return true;
+    }
+
     const bool has_ev_read = ctx.has_ev_read(_sched_id);
     epoll_event ev;
     ev.events = has_ev_read ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLOUT | EPOLLET);
@@ -72,6 +129,7 @@ void Epoll::del_ev_read(int fd) {
 
     int r;
     ctx.del_ev_read();
+    if (ctx.registered(_sched_id)) return; // keep it in epoll
     if (!ctx.has_ev_write(_sched_id)) {
         r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
     } else {
@@ -93,6 +151,7 @@ void Epoll::del_ev_write(int fd) {
 
     int r;
     ctx.del_ev_write();
+    if (ctx.registered(_sched_id)) return; // keep it in epoll
     if (!ctx.has_ev_read(_sched_id)) {
         r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
     } else {
@@ -110,10 +169,11 @@ void Epoll::del_ev_write(int fd) {
 void Epoll::del_event(int fd) {
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_event()) {
-        ctx.del_event();
+    const bool has_event = ctx.has_event() || ctx.registered(_sched_id);
+    ctx.del_event(); // always reset the context, as the fd may be reused later
+    if (has_event) {
         const int r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-        if (r != 0) ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        if (r != 0 && errno != ENOENT) ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
     }
 }
 
@@ -126,23 +186,19 @@ inline void closesocket(int& fd) {
 
 void Epoll::close() {
     co::closesocket(_ep);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
+    co::closesocket(_efd);
 }
 
+// reading the eventfd resets its counter to 0
 void Epoll::handle_ev_pipe() {
-    int32 dummy;
+    uint64 v;
     while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
-            break;
-        }
+        int r = (int) __sys_api(read)(_efd, &v, sizeof(v));
+        if (r != -1) break;
+        if (errno == EWOULDBLOCK || errno == EAGAIN) break;
+        if (errno == EINTR) continue;
+        ELOG << "eventfd read error: " << co::strerror() << ", fd: " << _efd;
+        break;
     }
     atomic_store(&_signaled, 0, mo_release);
 }
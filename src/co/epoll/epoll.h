@@ -3,9 +3,13 @@
 
 #include "co/co.h"
 #include "co/log.h"
+#include "co/flag.h"
 #include "../hook.h"
 #include "../sock_ctx.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+DEC_bool(co_epoll_persist);
 
 namespace co {
 
@@ -20,6 +24,19 @@ namespace co {
  * 
  *     When an IO event is present, id in the user data will be used to resume 
  *     the corresponding coroutine.
+ * 
+ *   - With co_epoll_persist, sockets are registered for both EPOLLIN and 
+ *     EPOLLOUT once, and removed only when they are closed. Coroutines waiting 
+ *     on a socket are tracked in SockCtx, so no epoll_ctl is needed for each 
+ *     wait. Sockets already registered to another scheduler fall back to the 
+ *     normal mode.
+ * 
+ *   - An eventfd is used to wake up the epoll, it costs only one fd, and one 
+ *     syscall for each side of a wakeup.
+ * 
+ *   - The event buffer starts small, and it is doubled up to co_epoll_events 
+ *     when a wait fills it. It is halved if no wait of the last 1024 filled a 
+ *     quarter of it, so an idle scheduler does not keep a large buffer hot.
  */
 class Epoll {
   public:
@@ -33,29 +50,44 @@ class Epoll {
     void del_event(int fd);
 
     int wait(int ms) {
-        return __sys_api(epoll_wait)(_ep, _ev, 1024, ms);
+        if (unlikely(_next_cap != _cap)) this->resize();
+        const int n = __sys_api(epoll_wait)(_ep, _ev, (int)_cap, ms);
+        if (n > (int)_peak) _peak = (uint32)n;
+        if (unlikely(n == (int)_cap || ++_rounds == 1024)) this->adapt();
+        return n;
     }
 
-    // write one byte to the pipe to wake up the epoll.
-    void signal(char c = 'x') {
+    // write to the eventfd to wake up the epoll.
+    void signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
-            const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            const uint64 v = 1;
+            const int r = (int) __sys_api(write)(_efd, &v, sizeof(v));
+            ELOG_IF(r != sizeof(v)) << "eventfd write error: " << co::strerror();
         }
     }
 
     const epoll_event& operator[](int i)   const { return _ev[i]; }
     int user_data(const epoll_event& ev)         { return ev.data.fd; }
-    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _pipe_fds[0]; }
+    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _efd; }
     void handle_ev_pipe();
     void close();
 
   private:
+    bool add_persist_event(int fd, SockCtx& ctx);
+
+    // choose the size of the event buffer for the next wait
+    void adapt();
+    void resize();
+
     int _ep;
-    int _pipe_fds[2];
+    int _efd; // eventfd for waking up the epoll
     int _signaled;
     int _sched_id;
     epoll_event* _ev;
+    uint32 _cap;      // size of _ev
+    uint32 _next_cap; // size of _ev for the next wait
+    uint32 _peak;     // max number of events returned by a wait in this period
+    uint32 _rounds;   // number of waits in this period
 };
 
 } // co
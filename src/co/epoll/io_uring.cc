@@ -0,0 +1,123 @@
+#ifdef __linux__
+#include "io_uring.h"
+#include "co/co.h"
+#include "co/log.h"
+#include "../close.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace co {
+
+static inline int io_uring_setup(uint32 entries, io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, uint32 to_submit, uint32 min_complete, uint32 flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+IoUring::IoUring(int sched_id)
+    : _fd(-1), _sched_id(sched_id), _features(0), _pending(0), _sq_ring(MAP_FAILED),
+      _cq_ring(MAP_FAILED), _sqes((io_uring_sqe*)MAP_FAILED) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    _fd = io_uring_setup(1024, &p);
+    if (_fd == -1) {
+        ELOG << "io_uring setup error: " << co::strerror() << ", sched: " << _sched_id;
+        return;
+    }
+
+    // recv/send/accept/connect with internal polling are required
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        ELOG << "io_uring fast poll not supported, sched: " << _sched_id;
+        goto err;
+    }
+
+    _features = p.features;
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (_cq_ring_size > _sq_ring_size) _sq_ring_size = _cq_ring_size;
+        _cq_ring_size = _sq_ring_size;
+    }
+
+    _sq_ring = mmap(0, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) goto map_err;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = mmap(0, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) goto map_err;
+    }
+
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*) mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) goto map_err;
+
+    _sq_head = (uint32*)((char*)_sq_ring + p.sq_off.head);
+    _sq_tail = (uint32*)((char*)_sq_ring + p.sq_off.tail);
+    _sq_array = (uint32*)((char*)_sq_ring + p.sq_off.array);
+    _sq_mask = *(uint32*)((char*)_sq_ring + p.sq_off.ring_mask);
+    _sq_entries = p.sq_entries;
+
+    _cq_head = (uint32*)((char*)_cq_ring + p.cq_off.head);
+    _cq_tail = (uint32*)((char*)_cq_ring + p.cq_off.tail);
+    _cqes = (io_uring_cqe*)((char*)_cq_ring + p.cq_off.cqes);
+    _cq_mask = *(uint32*)((char*)_cq_ring + p.cq_off.ring_mask);
+    co::set_cloexec(_fd);
+    return;
+
+  map_err:
+    ELOG << "io_uring mmap error: " << co::strerror() << ", sched: " << _sched_id;
+  err:
+    this->close();
+}
+
+IoUring::~IoUring() {
+    this->close();
+}
+
+void IoUring::close() {
+    if (_sqes != MAP_FAILED) { munmap(_sqes, _sqes_size); _sqes = (io_uring_sqe*)MAP_FAILED; }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) munmap(_cq_ring, _cq_ring_size);
+    _cq_ring = MAP_FAILED;
+    if (_sq_ring != MAP_FAILED) { munmap(_sq_ring, _sq_ring_size); _sq_ring = MAP_FAILED; }
+    if (_fd != -1) { _close_nocancel(_fd); _fd = -1; }
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    uint32 tail = *_sq_tail;
+    if (tail - atomic_load(_sq_head, mo_acquire) >= _sq_entries) {
+        this->submit();
+        if (tail - atomic_load(_sq_head, mo_acquire) >= _sq_entries) return NULL;
+    }
+
+    const uint32 i = tail & _sq_mask;
+    io_uring_sqe* sqe = &_sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[i] = i;
+    atomic_store(_sq_tail, tail + 1, mo_release);
+    ++_pending;
+    return sqe;
+}
+
+int IoUring::submit() {
+    if (_pending == 0) return 0;
+    while (true) {
+        const int r = io_uring_enter(_fd, _pending, 0, 0);
+        if (r >= 0) {
+            _pending -= r;
+            return r;
+        }
+        if (errno == EINTR) continue;
+        ELOG << "io_uring enter error: " << co::strerror() << ", sched: " << _sched_id;
+        return -1;
+    }
+}
+
+} // co
+
+#endif
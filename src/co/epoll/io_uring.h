@@ -0,0 +1,90 @@
+#ifdef __linux__
+#pragma once
+
+#include "co/def.h"
+#include "co/atomic.h"
+#include <linux/io_uring.h>
+
+namespace co {
+
+/**
+ * io_uring for Linux
+ *   - It is used by co::recv, co::send, co::accept and co::connect, when
+ *     co_io_uring is true. Other IO operations still work with the epoll.
+ *   - It is also used by the hooked read/write of regular files, see hook.cc.
+ *   - The ring is used only in the scheduler thread. SQEs prepared by coroutines
+ *     are submitted in batch by the scheduler, once in each loop.
+ *   - user_data of a SQE is a pointer to the coroutine waiting for it, or 0 if
+ *     nobody cares about the result (e.g. a cancel request).
+ *   - fd of the ring is registered to the epoll, so that the scheduler can be
+ *     woken up when there are completions.
+ */
+class IoUring {
+  public:
+    IoUring(int sched_id);
+    ~IoUring();
+
+    // fd of the ring, -1 if io_uring is not available
+    int fd() const { return _fd; }
+
+    // features of the ring, IORING_FEAT_XXX
+    uint32 features() const { return _features; }
+
+    // get a zero-initialized SQE, return NULL if the submission queue is full
+    // and we failed to submit the pending SQEs.
+    io_uring_sqe* get_sqe();
+
+    // submit all pending SQEs to the kernel
+    int submit();
+
+    // check if there are completions
+    bool has_cqe() const {
+        return *_cq_head != atomic_load(_cq_tail, mo_acquire);
+    }
+
+    // take all the completions, f(user_data, res) will be called for each of them.
+    template<typename F>
+    void reap(F&& f) {
+        uint32 head = *_cq_head;
+        const uint32 tail = atomic_load(_cq_tail, mo_acquire);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+            f(cqe.user_data, cqe.res);
+        }
+        atomic_store(_cq_head, head, mo_release);
+    }
+
+  private:
+    void close();
+
+    int _fd;
+    int _sched_id;
+    uint32 _features;
+    uint32 _pending; // number of SQEs not submitted yet
+
+    void* _sq_ring;
+    void* _cq_ring;
+    size_t _sq_ring_size;
+    size_t _cq_ring_size;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+
+    uint32* _sq_head;
+    uint32* _sq_tail;
+    uint32* _sq_array;
+    uint32 _sq_mask;
+    uint32 _sq_entries;
+
+    uint32* _cq_head;
+    uint32* _cq_tail;
+    io_uring_cqe* _cqes;
+    uint32 _cq_mask;
+};
+
+// wait for the io_uring operation @sqe of the current coroutine (see sock.cc)
+//   - return the result, or -1 with errno set on error.
+int uring_wait(IoUring* u, io_uring_sqe* sqe, uint32 ms);
+
+} // co
+
+#endif
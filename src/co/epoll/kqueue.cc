@@ -4,14 +4,25 @@
 
 namespace co {
 
-Kqueue::Kqueue(int sched_id) : _signaled(0) {
+Kqueue::Kqueue(int sched_id) : _nchanges(0), _signaled(0) {
     _kq = kqueue();
     CHECK_NE(_kq, -1) << "kqueue create error: " << co::strerror();
+  #ifdef EVFILT_USER
+    // EV_CLEAR resets the state of the user event after it was retrieved.
+    struct kevent event;
+    EV_SET(&event, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+    CHECK_EQ(__sys_api(kevent)(_kq, &event, 1, 0, 0, 0), 0) 
+        << "kqueue add user event error: " << co::strerror();
+  #else
     CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
     co::set_cloexec(_pipe_fds[0]);
     co::set_cloexec(_pipe_fds[1]);
     co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], (void*)0));
+    struct kevent event;
+    EV_SET(&event, _pipe_fds[0], EVFILT_READ, EV_ADD, 0, 0, 0);
+    CHECK_EQ(__sys_api(kevent)(_kq, &event, 1, 0, 0, 0), 0)
+        << "kqueue add pipe error: " << co::strerror();
+  #endif
     _ev = (struct kevent*) ::calloc(1024, sizeof(struct kevent));
     (void) sched_id;
 }
@@ -26,16 +37,9 @@ bool Kqueue::add_ev_read(int fd, void* p) {
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_read()) return true; // already exists
 
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, p);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) == 0) {
-        ctx.add_ev_read();
-        return true;
-    } else {
-        ELOG << "kqueue add ev_read error: " << co::strerror() << ", fd: " << fd;
-        return false;
-    }
+    this->add_change(fd, EVFILT_READ, EV_ADD, p);
+    ctx.add_ev_read();
+    return true;
 }
 
 bool Kqueue::add_ev_write(int fd, void* p) {
@@ -43,16 +47,9 @@ bool Kqueue::add_ev_write(int fd, void* p) {
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_write()) return true; // already exists
 
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_WRITE, EV_ADD, 0, 0, p);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) == 0) {
-        ctx.add_ev_write();
-        return true;
-    } else {
-        ELOG << "kqueue add ev_write error: " << co::strerror() << ", fd: " << fd;
-        return false;
-    }
+    this->add_change(fd, EVFILT_WRITE, EV_ADD, p);
+    ctx.add_ev_write();
+    return true;
 }
 
 void Kqueue::del_ev_read(int fd) {
@@ -61,12 +58,7 @@ void Kqueue::del_ev_read(int fd) {
     if (!ctx.has_ev_read()) return;
 
     ctx.del_ev_read();
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) != 0) {
-        ELOG << "kqueue del ev_read error: " << co::strerror() << ", fd: " << fd;
-    }
+    this->add_change(fd, EVFILT_READ, EV_DELETE, 0);
 }
 
 void Kqueue::del_ev_write(int fd) {
@@ -75,12 +67,7 @@ void Kqueue::del_ev_write(int fd) {
     if (!ctx.has_ev_write()) return;
 
     ctx.del_ev_write();
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) != 0) {
-        ELOG << "kqueue del ev_write error: " << co::strerror() << ", fd: " << fd;
-    }
+    this->add_change(fd, EVFILT_WRITE, EV_DELETE, 0);
 }
 
 void Kqueue::del_event(int fd) {
@@ -88,15 +75,60 @@ void Kqueue::del_event(int fd) {
     auto& ctx = co::get_sock_ctx(fd);
     if (!ctx.has_event()) return;
 
-    int i = 0;
-    struct kevent event[2];
-    if (ctx.has_ev_read()) EV_SET(&event[i++], fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-    if (ctx.has_ev_write()) EV_SET(&event[i++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-
+    if (ctx.has_ev_read()) this->add_change(fd, EVFILT_READ, EV_DELETE, 0);
+    if (ctx.has_ev_write()) this->add_change(fd, EVFILT_WRITE, EV_DELETE, 0);
     ctx.del_event();
-    if (__sys_api(kevent)(_kq, event, i, 0, 0, 0) != 0) {
-        ELOG << "kqueue del event error: " << co::strerror() << ", fd: " << fd;
+}
+
+void Kqueue::flush() {
+    const int n = _nchanges;
+    _nchanges = 0;
+    for (int i = 0; i < n; ++i) _changes[i].flags |= EV_RECEIPT;
+
+    // with EV_RECEIPT, there is a receipt for each change, and no event is drained
+    const struct timespec ts = { 0, 0 };
+    const int r = __sys_api(kevent)(_kq, _changes, n, _receipts, n, &ts);
+    if (r < 0) {
+        ELOG << "kqueue submit changes error: " << co::strerror();
+        return;
+    }
+    // the coroutines can't be woken up here, they may wait until timeout
+    this->check_errors(_receipts, r);
+}
+
+int Kqueue::check_errors(struct kevent* ev, int n) {
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        struct kevent& e = ev[i];
+        if (!(e.flags & EV_ERROR)) {
+            if (k != i) ev[k] = e;
+            ++k;
+            continue;
+        }
+        if (e.data == 0) continue; // receipt of a change done
+
+        const int fd = (int)e.ident;
+        const bool rd = e.filter == EVFILT_READ;
+        if (e.flags & EV_DELETE) {
+            // the socket may have been closed, and its events removed by the system
+            if (e.data != ENOENT && e.data != EBADF) {
+                ELOG << "kqueue del " << (rd ? "ev_read" : "ev_write") << " error: "
+                     << co::strerror((int)e.data) << ", fd: " << fd;
+            }
+            continue;
+        }
+
+        ELOG << "kqueue add " << (rd ? "ev_read" : "ev_write") << " error: "
+             << co::strerror((int)e.data) << ", fd: " << fd;
+        auto& ctx = co::get_sock_ctx(fd);
+        rd ? ctx.del_ev_read() : ctx.del_ev_write();
+        if (e.udata) { // wake up the coroutine
+            ev[k] = e;
+            ev[k].flags &= ~EV_ERROR;
+            ++k;
+        }
     }
+    return k;
 }
 
 inline void closesocket(int& fd) {
@@ -107,12 +139,16 @@ inline void closesocket(int& fd) {
 }
 
 void Kqueue::close() {
+    _nchanges = 0;
     co::closesocket(_kq);
+  #ifndef EVFILT_USER
     co::closesocket(_pipe_fds[0]);
     co::closesocket(_pipe_fds[1]);
+  #endif
 }
 
 void Kqueue::handle_ev_pipe() {
+  #ifndef EVFILT_USER
     int32 dummy;
     while (true) {
         int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
@@ -126,6 +162,7 @@ void Kqueue::handle_ev_pipe() {
             break;
         }
     }
+  #endif
     atomic_store(&_signaled, 0, mo_release);
 }
 
@@ -10,6 +10,16 @@
 
 namespace co {
 
+/**
+ * Kqueue for mac and bsd 
+ *   - Changes of events are not submitted at once, they are put in a changelist 
+ *     of the scheduler, and submitted with the next wait(), in one kevent() call. 
+ *     If the changelist is full, it is submitted with EV_RECEIPT, so that no 
+ *     pending event is drained. 
+ *   - Changes failed are returned by kevent() with EV_ERROR. If an event was 
+ *     not added, the coroutine waiting for it is woken up, and it will retry the 
+ *     I/O operation. 
+ */
 class Kqueue {
   public:
     Kqueue(int sched_id);
@@ -28,18 +38,31 @@ class Kqueue {
     void del_event(int fd);
 
     int wait(int ms) {
+        const int n = _nchanges;
+        _nchanges = 0;
+        int r;
         if (ms >= 0) {
             struct timespec ts = { ms / 1000, ms % 1000 * 1000000 };
-            return __sys_api(kevent)(_kq, 0, 0, _ev, 1024, &ts);
+            r = __sys_api(kevent)(_kq, _changes, n, _ev, 1024, &ts);
         } else {
-            return __sys_api(kevent)(_kq, 0, 0, _ev, 1024, 0);
+            r = __sys_api(kevent)(_kq, _changes, n, _ev, 1024, 0);
         }
+        return (r > 0 && n > 0) ? this->check_errors(_ev, r) : r;
     }
 
-    void signal(char c = 'x') {
+    // wake up the kqueue, with EVFILT_USER if it is supported, or a pipe.
+    void signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
+          #ifdef EVFILT_USER
+            struct kevent event;
+            EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+            const int r = __sys_api(kevent)(_kq, &event, 1, 0, 0, 0);
+            ELOG_IF(r != 0) << "kqueue trigger user event error: " << co::strerror();
+          #else
+            const char c = 'x';
             const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
             ELOG_IF(r != 1) << "pipe write error..";
+          #endif
         }
     }
 
@@ -50,8 +73,26 @@ class Kqueue {
     void close();
    
   private:
+    static const int kMaxChanges = 256;
+
+    void add_change(int fd, int16 filter, uint16 flags, void* p) {
+        if (_nchanges == kMaxChanges) this->flush();
+        EV_SET(&_changes[_nchanges++], fd, filter, flags, 0, 0, p);
+    }
+
+    // submit the changelist without waiting for events
+    void flush();
+
+    // remove changes returned with EV_ERROR, return number of events left
+    int check_errors(struct kevent* ev, int n);
+
     int _kq;
+    int _nchanges;
+    struct kevent _changes[kMaxChanges];
+    struct kevent _receipts[kMaxChanges];
+  #ifndef EVFILT_USER
     int _pipe_fds[2];
+  #endif
     int _signaled;
     struct kevent* _ev;
 };
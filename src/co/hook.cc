@@ -23,8 +23,10 @@ void enable_hook_sleep() {}
 #include <stdarg.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <sys/stat.h>
 
 DEF_bool(hook_log, false, ">>#1 enable log for hook");
+DEF_bool(hook_file_io, true, ">>#1 read/write regular files in coroutines with io_uring or in the thread pool of co::offload(), so that the scheduler is not blocked by disk IO");
 
 #define HOOKLOG DLOG_IF(FLG_hook_log)
 
@@ -123,6 +125,253 @@ inline co::Mutex& gDnsMutex_g() {
     return *mtx;
 }
 
+inline void set_non_blocking(int fd, int x) {
+    __sys_api(ioctl)(fd, FIONBIO, (char*)&x);
+}
+
+namespace co {
+
+// Regular files are always "ready" for epoll, but reading or writing them may
+// wait for the disk. In coroutines, we do it with io_uring if the scheduler has
+// one, or in the thread pool of co::offload(), so the scheduler can run other
+// coroutines in the mean time.
+//   - Buffers on a shared stack are replaced with heap memory, as the stack may
+//     be saved and reused by other coroutines once the caller yielded.
+//   - @off is -1 for the current file position.
+inline bool hook_file_io(int fd) {
+    struct stat st;
+    return FLG_hook_file_io && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+struct io_res_t {
+    ssize_t r;
+    int err;
+};
+
+// run f() in the thread pool of co::offload()
+template<typename F>
+static ssize_t offload_io(F&& f) {
+    io_res_t* x = co::make<io_res_t>();
+    co::offload([f, x]() {
+        ssize_t r;
+        do { r = f(); } while (r == -1 && errno == EINTR);
+        x->r = r;
+        x->err = errno;
+    });
+    const ssize_t r = x->r;
+    if (r == -1) errno = x->err;
+    co::del(x);
+    return r;
+}
+
+#ifdef __linux__
+// return -2 if io_uring can't do the job, the caller should offload it then.
+static ssize_t uring_file_io(IoUring* u, uint8 op, int fd, const void* addr, size_t len, int64 off) {
+    if (off < 0 && !(u->features() & IORING_FEAT_RW_CUR_POS)) return -2;
+    io_uring_sqe* sqe = u->get_sqe();
+    if (!sqe) return -2;
+
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = (uint64)off;
+    sqe->addr = (uint64)(size_t)addr;
+    sqe->len = (uint32)len;
+    const ssize_t r = uring_wait(u, sqe, (uint32)-1);
+    // EINVAL if the operation is not supported by the kernel
+    return (r == -1 && errno == EINVAL) ? -2 : r;
+}
+#endif
+
+static ssize_t file_io(bool rd, int fd, void* buf, size_t n, int64 off) {
+    const auto s = gSched;
+    if (n > (1u << 30)) n = 1u << 30; // a short read/write is fine
+    char* p = (char*)buf;
+    if (s->on_shared_stack(buf)) {
+        p = (char*) co::alloc(n);
+        if (!rd) memcpy(p, buf, n);
+    }
+
+    ssize_t r = -2;
+  #ifdef __linux__
+    if (s->io_uring()) {
+        r = uring_file_io(s->io_uring(), rd ? IORING_OP_READ : IORING_OP_WRITE, fd, p, n, off);
+    }
+  #endif
+    if (r == -2) {
+        r = offload_io([rd, fd, p, n, off]() {
+            if (rd) {
+                return off < 0 ? __sys_api(read)(fd, p, n) : __sys_api(pread)(fd, p, n, (off_t)off);
+            }
+            return off < 0 ? __sys_api(write)(fd, p, n) : __sys_api(pwrite)(fd, p, n, (off_t)off);
+        });
+    }
+
+    if (p != buf) {
+        if (rd && r > 0) memcpy(buf, p, r);
+        co::free(p, n);
+    }
+    return r;
+}
+
+static ssize_t file_iov(bool rd, int fd, const struct iovec* iov, int iovcnt) {
+    const auto s = gSched;
+    bool shared = s->on_shared_stack(iov);
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        n += iov[i].iov_len;
+        if (!shared && s->on_shared_stack(iov[i].iov_base)) shared = true;
+    }
+
+    // gather the buffers into heap memory, and read/write it at once
+    if (shared) {
+        char* p = (char*) co::alloc(n);
+        if (!rd) {
+            size_t k = 0;
+            for (int i = 0; i < iovcnt; k += iov[i].iov_len, ++i) {
+                memcpy(p + k, iov[i].iov_base, iov[i].iov_len);
+            }
+        }
+        const ssize_t r = file_io(rd, fd, p, n, -1);
+        if (rd && r > 0) {
+            size_t k = 0;
+            for (int i = 0; i < iovcnt && k < (size_t)r; ++i) {
+                const size_t x = iov[i].iov_len < (size_t)r - k ? iov[i].iov_len : (size_t)r - k;
+                memcpy(iov[i].iov_base, p + k, x);
+                k += x;
+            }
+        }
+        co::free(p, n);
+        return r;
+    }
+
+    ssize_t r = -2;
+  #ifdef __linux__
+    if (s->io_uring()) {
+        r = uring_file_io(s->io_uring(), rd ? IORING_OP_READV : IORING_OP_WRITEV, fd, iov, iovcnt, -1);
+    }
+  #endif
+    if (r == -2) {
+        r = offload_io([rd, fd, iov, iovcnt]() {
+            return rd ? __sys_api(readv)(fd, iov, iovcnt) : __sys_api(writev)(fd, iov, iovcnt);
+        });
+    }
+    return r;
+}
+
+#ifdef __linux__
+// A temporary epoll for the fds of poll() or select(). The coroutine waits on it
+// with the epoll of the scheduler, so it is parked once, however many fds there
+// are. The fds are level-triggered in it, when it is readable, the caller checks
+// the fds again with a zero timeout to get the exact results.
+class PollSet {
+  public:
+    PollSet() : _ep(epoll_create1(EPOLL_CLOEXEC)) {}
+    // co::close() also resets the context of the fd in the scheduler, or a
+    // socket reusing the fd may be taken as registered with co_epoll_persist.
+    ~PollSet() { if (_ep != -1) co::close(_ep); }
+
+    // return false on error, the caller should fall back then
+    bool add(const struct pollfd* fds, nfds_t nfds) {
+        if (_ep == -1) return false;
+        for (nfds_t i = 0; i < nfds; ++i) {
+            if (fds[i].fd < 0) continue; // ignored by poll()
+            uint32 ev = (uint16)fds[i].events; // POLLXXX == EPOLLXXX on linux
+            int r = this->ctl(EPOLL_CTL_ADD, fds[i].fd, ev);
+            if (r != 0 && errno == EEXIST) { // the same fd appears more than once
+                for (nfds_t k = 0; k < i; ++k) {
+                    if (fds[k].fd == fds[i].fd) ev |= (uint16)fds[k].events;
+                }
+                r = this->ctl(EPOLL_CTL_MOD, fds[i].fd, ev);
+            }
+            // EPERM for regular files, they are always ready and have been
+            // reported by the check before.
+            if (r != 0 && errno != EPERM) return false;
+        }
+        return true;
+    }
+
+    bool add(int nfds, const fd_set* rs, const fd_set* ws, const fd_set* es) {
+        if (_ep == -1) return false;
+        for (int fd = 0; fd < nfds; ++fd) {
+            uint32 ev = 0;
+            if (rs && FD_ISSET(fd, rs)) ev |= EPOLLIN;
+            if (ws && FD_ISSET(fd, ws)) ev |= EPOLLOUT;
+            if (es && FD_ISSET(fd, es)) ev |= EPOLLPRI;
+            if (ev && this->ctl(EPOLL_CTL_ADD, fd, ev) != 0 && errno != EPERM) return false;
+        }
+        return true;
+    }
+
+    // wait until check() returns non-zero, or timeout.
+    //   - return the result of check(), 0 on timeout, or -2 on error.
+    template<typename F>
+    int wait(uint32 ms, F&& check) {
+        const int64 deadline = ms == (uint32)-1 ? -1 : now::ms() + ms;
+        IoEvent ev(_ep, ev_read);
+        do {
+            if (!ev.wait(ms)) return errno == ETIMEDOUT ? 0 : -2;
+            const int r = check();
+            if (r != 0) return r;
+            if (deadline != -1) {
+                const int64 x = deadline - now::ms();
+                if (x <= 0) return 0;
+                ms = (uint32)x;
+            }
+        } while (true);
+    }
+
+  private:
+    int ctl(int op, int fd, uint32 events) {
+        struct epoll_event e;
+        e.events = events;
+        e.data.fd = fd;
+        return epoll_ctl(_ep, op, fd, &e);
+    }
+
+    int _ep;
+    DISALLOW_COPY_AND_ASSIGN(PollSet);
+};
+
+// sendfile(), splice() and tee() move data from @in to @out in the kernel, and
+// may block on either side. Sockets and pipes are set to non-blocking as in
+// read() and write(). On EAGAIN, we find out the side that is not ready with a
+// zero timeout poll(), and wait for it with its recv or send timeout.
+//   - Return -1 with EAGAIN if that side is non-blocking by the user.
+//   - Regular files are always ready, f() may still wait for the disk.
+template<typename F>
+static ssize_t duplex_io(int in, int out, F&& f) {
+    HookCtx* x = gHook().get_hook_ctx(in);
+    HookCtx* y = gHook().get_hook_ctx(out);
+    const bool wx = x && x->is_sock_or_pipe() && !x->is_non_blocking();
+    const bool wy = y && y->is_sock_or_pipe() && !y->is_non_blocking();
+    if (!wx && !wy) return f();
+    if (wx && !x->has_nb_mark()) { set_non_blocking(in, 1); x->set_nb_mark(); }
+    if (wy && !y->has_nb_mark()) { set_non_blocking(out, 1); y->set_nb_mark(); }
+
+    IoEvent ev_in(in, ev_read), ev_out(out, ev_write);
+    do {
+        const ssize_t r = f();
+        if (r != -1) return r;
+        if (errno == EINTR) continue;
+        if (errno != EWOULDBLOCK && errno != EAGAIN) return r;
+
+        struct pollfd p[2] = { { in, POLLIN, 0 }, { out, POLLOUT, 0 } };
+        if (__sys_api(poll)(p, 2, 0) < 0) return -1;
+        if (p[0].revents == 0) {
+            if (!wx) { errno = EAGAIN; return -1; }
+            if (!ev_in.wait(x->recv_timeout())) return -1;
+        } else if (p[1].revents == 0) {
+            if (!wy) { errno = EAGAIN; return -1; }
+            if (!ev_out.wait(y->send_timeout())) return -1;
+        } else {
+            co::sleep(1); // both look ready, it is rare, avoid a busy loop
+        }
+    } while (true);
+}
+#endif
+
+} // co
+
 
 extern "C" {
 
@@ -147,6 +396,8 @@ _CO_DEF_SYS_API(recvfrom);
 _CO_DEF_SYS_API(recvmsg);
 _CO_DEF_SYS_API(write);
 _CO_DEF_SYS_API(writev);
+_CO_DEF_SYS_API(pread);
+_CO_DEF_SYS_API(pwrite);
 _CO_DEF_SYS_API(send);
 _CO_DEF_SYS_API(sendto);
 _CO_DEF_SYS_API(sendmsg);
@@ -165,6 +416,14 @@ _CO_DEF_SYS_API(gethostbyname2);
 _CO_DEF_SYS_API(gethostbyname_r);
 _CO_DEF_SYS_API(gethostbyname2_r);
 _CO_DEF_SYS_API(gethostbyaddr_r);
+_CO_DEF_SYS_API(sendfile);
+_CO_DEF_SYS_API(splice);
+_CO_DEF_SYS_API(tee);
+_CO_DEF_SYS_API(recvmmsg);
+_CO_DEF_SYS_API(sendmmsg);
+#ifdef _CO_HOOK_COPY_FILE_RANGE
+_CO_DEF_SYS_API(copy_file_range);
+#endif
 #else
 _CO_DEF_SYS_API(kevent);
 #endif
@@ -197,10 +456,6 @@ _CO_DEF_SYS_API(kevent);
     } while (true)
 
 
-inline void set_non_blocking(int fd, int x) {
-    __sys_api(ioctl)(fd, FIONBIO, (char*)&x);
-}
-
 int _hook(socket)(int domain, int type, int protocol) {
     _hook_api(socket);
     int s = __sys_api(socket)(domain, type, protocol);
@@ -512,10 +767,14 @@ ssize_t _hook(read)(int fd, void* buf, size_t count) {
 
     ssize_t r;
     auto ctx = gHook().get_hook_ctx(fd);
-    if (!co::gSched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
         r = __sys_api(read)(fd, buf, count);
         goto end;
     }
+    if (!ctx->is_sock_or_pipe()) {
+        r = count > 0 && co::hook_file_io(fd) ? co::file_io(true, fd, buf, count, -1) : __sys_api(read)(fd, buf, count);
+        goto end;
+    }
 
     if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
     {
@@ -533,10 +792,14 @@ ssize_t _hook(readv)(int fd, const struct iovec* iov, int iovcnt) {
 
     ssize_t r;
     auto ctx = gHook().get_hook_ctx(fd);
-    if (!co::gSched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
         r = __sys_api(readv)(fd, iov, iovcnt);
         goto end;
     }
+    if (!ctx->is_sock_or_pipe()) {
+        r = iovcnt > 0 && co::hook_file_io(fd) ? co::file_iov(true, fd, iov, iovcnt) : __sys_api(readv)(fd, iov, iovcnt);
+        goto end;
+    }
 
     if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
     {
@@ -617,10 +880,14 @@ ssize_t _hook(write)(int fd, const void* buf, size_t count) {
 
     ssize_t r;
     auto ctx = gHook().get_hook_ctx(fd);
-    if (!co::gSched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
         r = __sys_api(write)(fd, buf, count);
         goto end;
     }
+    if (!ctx->is_sock_or_pipe()) {
+        r = count > 0 && co::hook_file_io(fd) ? co::file_io(false, fd, (void*)buf, count, -1) : __sys_api(write)(fd, buf, count);
+        goto end;
+    }
 
     if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
     {
@@ -638,10 +905,14 @@ ssize_t _hook(writev)(int fd, const struct iovec* iov, int iovcnt) {
 
     ssize_t r;
     auto ctx = gHook().get_hook_ctx(fd);
-    if (!co::gSched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
         r = __sys_api(writev)(fd, iov, iovcnt);
         goto end;
     }
+    if (!ctx->is_sock_or_pipe()) {
+        r = iovcnt > 0 && co::hook_file_io(fd) ? co::file_iov(false, fd, iov, iovcnt) : __sys_api(writev)(fd, iov, iovcnt);
+        goto end;
+    }
 
     if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
     {
@@ -654,6 +925,34 @@ ssize_t _hook(writev)(int fd, const struct iovec* iov, int iovcnt) {
     return r;
 }
 
+ssize_t _hook(pread)(int fd, void* buf, size_t count, off_t offset) {
+    _hook_api(pread);
+
+    ssize_t r;
+    if (co::gSched && count > 0 && offset >= 0 && co::hook_file_io(fd)) {
+        r = co::file_io(true, fd, buf, count, (int64)offset);
+    } else {
+        r = __sys_api(pread)(fd, buf, count, offset);
+    }
+
+    HOOKLOG << "hook pread, fd: " << fd << ", n: " << count << ", off: " << offset << ", r: " << r;
+    return r;
+}
+
+ssize_t _hook(pwrite)(int fd, const void* buf, size_t count, off_t offset) {
+    _hook_api(pwrite);
+
+    ssize_t r;
+    if (co::gSched && count > 0 && offset >= 0 && co::hook_file_io(fd)) {
+        r = co::file_io(false, fd, (void*)buf, count, (int64)offset);
+    } else {
+        r = __sys_api(pwrite)(fd, buf, count, offset);
+    }
+
+    HOOKLOG << "hook pwrite, fd: " << fd << ", n: " << count << ", off: " << offset << ", r: " << r;
+    return r;
+}
+
 ssize_t _hook(send)(int fd, const void* buf, size_t len, int flags) {
     _hook_api(send);
 
@@ -755,6 +1054,19 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
         goto end;
     }
 
+    r = __sys_api(poll)(fds, nfds, 0);
+    if (r != 0) goto end;
+
+  #ifdef __linux__
+    {
+        co::PollSet ps;
+        if (ps.add(fds, nfds)) {
+            r = ps.wait(t, [&]() { return __sys_api(poll)(fds, nfds, 0); });
+            if (r != -2) goto end;
+        }
+    }
+  #endif
+
     // just check poll every x ms
     do {
         r = __sys_api(poll)(fds, nfds, 0);
@@ -803,25 +1115,41 @@ int _hook(select)(int nfds, fd_set* rs, fd_set* ws, fd_set* es, struct timeval*
         goto end;
     }
 
-    // just check select every x ms
     {
         struct timeval o = { 0, 0 };
         fd_set s[3];
         if (rs) s[0] = *rs;
         if (ws) s[1] = *ws;
         if (es) s[2] = *es;
+        auto check = [&]() {
+            if (rs) *rs = s[0];
+            if (ws) *ws = s[1];
+            if (es) *es = s[2];
+            o.tv_sec = o.tv_usec = 0;
+            return __sys_api(select)(nfds, rs, ws, es, &o);
+        };
+
+        r = __sys_api(select)(nfds, rs, ws, es, &o);
+        if (r != 0) goto end;
+
+      #ifdef __linux__
+        {
+            co::PollSet ps;
+            if (ps.add(nfds, rs ? &s[0] : 0, ws ? &s[1] : 0, es ? &s[2] : 0)) {
+                r = ps.wait((uint32)ms, check);
+                if (r != -2) goto end;
+            }
+        }
+      #endif
 
+        // just check select every x ms
         t = ms;
         do {
-            r = __sys_api(select)(nfds, rs, ws, es, &o);
+            r = check();
             if (r != 0 || t == 0) goto end;
             co::gSched->sleep(t > x ? x : t);
             if (t != -1) t = (t > x ? t - x : 0);
             if (x < 16) x <<= 1;
-            if (rs) *rs = s[0];
-            if (ws) *ws = s[1];
-            if (es) *es = s[2];
-            o.tv_sec = o.tv_usec = 0;
         } while (true);
     }
 
@@ -958,6 +1286,127 @@ int _hook(accept4)(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags)
 }
 #endif
 
+// The fd is non-blocking in the hook, so recvmmsg() returns once at least one
+// message is received, as with MSG_WAITFORONE.
+int _hook(recvmmsg)(int fd, struct mmsghdr* msgs, unsigned int n, int flags, struct timespec* tmo) {
+    _hook_api(recvmmsg);
+
+    int r;
+    auto ctx = gHook().get_hook_ctx(fd);
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
+        r = __sys_api(recvmmsg)(fd, msgs, n, flags, tmo);
+        goto end;
+    }
+
+    if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
+    {
+        co::IoEvent ev(fd, co::ev_read);
+        do_hook(__sys_api(recvmmsg)(fd, msgs, n, flags, tmo), ev, ctx->recv_timeout());
+    }
+
+  end:
+    HOOKLOG << "hook recvmmsg, fd: " << fd << ", n: " << n << ", r: " << r;
+    return r;
+}
+
+int _hook(sendmmsg)(int fd, struct mmsghdr* msgs, unsigned int n, int flags) {
+    _hook_api(sendmmsg);
+
+    int r;
+    auto ctx = gHook().get_hook_ctx(fd);
+    if (!co::gSched || !ctx || ctx->is_non_blocking()) {
+        r = __sys_api(sendmmsg)(fd, msgs, n, flags);
+        goto end;
+    }
+
+    if (!ctx->has_nb_mark()) { set_non_blocking(fd, 1); ctx->set_nb_mark(); }
+    {
+        co::IoEvent ev(fd, co::ev_write);
+        do_hook(__sys_api(sendmmsg)(fd, msgs, n, flags), ev, ctx->send_timeout());
+    }
+
+  end:
+    HOOKLOG << "hook sendmmsg, fd: " << fd << ", n: " << n << ", r: " << r;
+    return r;
+}
+
+ssize_t _hook(sendfile)(int out_fd, int in_fd, off_t* offset, size_t count) {
+    _hook_api(sendfile);
+
+    ssize_t r;
+    if (!co::gSched) {
+        r = __sys_api(sendfile)(out_fd, in_fd, offset, count);
+    } else {
+        r = co::duplex_io(in_fd, out_fd, [&]() {
+            return __sys_api(sendfile)(out_fd, in_fd, offset, count);
+        });
+    }
+
+    HOOKLOG << "hook sendfile, out: " << out_fd << ", in: " << in_fd << ", n: " << count << ", r: " << r;
+    return r;
+}
+
+ssize_t _hook(splice)(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags) {
+    _hook_api(splice);
+
+    ssize_t r;
+    if (!co::gSched || (flags & SPLICE_F_NONBLOCK)) {
+        r = __sys_api(splice)(fd_in, off_in, fd_out, off_out, len, flags);
+    } else {
+        r = co::duplex_io(fd_in, fd_out, [&]() {
+            return __sys_api(splice)(fd_in, off_in, fd_out, off_out, len, flags);
+        });
+    }
+
+    HOOKLOG << "hook splice, in: " << fd_in << ", out: " << fd_out << ", n: " << len << ", r: " << r;
+    return r;
+}
+
+ssize_t _hook(tee)(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    _hook_api(tee);
+
+    ssize_t r;
+    if (!co::gSched || (flags & SPLICE_F_NONBLOCK)) {
+        r = __sys_api(tee)(fd_in, fd_out, len, flags);
+    } else {
+        r = co::duplex_io(fd_in, fd_out, [&]() {
+            return __sys_api(tee)(fd_in, fd_out, len, flags);
+        });
+    }
+
+    HOOKLOG << "hook tee, in: " << fd_in << ", out: " << fd_out << ", n: " << len << ", r: " << r;
+    return r;
+}
+
+#ifdef _CO_HOOK_COPY_FILE_RANGE
+// copy_file_range() works on regular files, we do it in the thread pool of
+// co::offload() as read() or write() on files. The offsets are copied to heap
+// memory, as they may be on a shared stack.
+ssize_t _hook(copy_file_range)(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags) {
+    _hook_api(copy_file_range);
+
+    ssize_t r;
+    if (co::gSched && len > 0 && co::hook_file_io(fd_in)) {
+        loff_t* o = (loff_t*) co::alloc(sizeof(loff_t) * 2);
+        o[0] = off_in ? *off_in : 0;
+        o[1] = off_out ? *off_out : 0;
+        loff_t* oi = off_in ? o : 0;
+        loff_t* oo = off_out ? o + 1 : 0;
+        r = co::offload_io([fd_in, oi, fd_out, oo, len, flags]() {
+            return __sys_api(copy_file_range)(fd_in, oi, fd_out, oo, len, flags);
+        });
+        if (off_in) *off_in = o[0];
+        if (off_out) *off_out = o[1];
+        co::free(o, sizeof(loff_t) * 2);
+    } else {
+        r = __sys_api(copy_file_range)(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+
+    HOOKLOG << "hook copy_file_range, in: " << fd_in << ", out: " << fd_out << ", n: " << len << ", r: " << r;
+    return r;
+}
+#endif
+
 int _hook(gethostbyname_r)(
     const char* name,
     struct hostent* ret, char* buf, size_t len,
@@ -1126,6 +1575,8 @@ static bool _init_hooks() {
         r = ::recvmsg(-1, 0, 0);
         r = ::write(-1, 0, 0);
         r = ::writev(-1, 0, 0);
+        r = ::pread(-1, 0, 0, 0);
+        r = ::pwrite(-1, 0, 0, 0);
         r = ::send(-1, 0, 0, 0);
         r = ::sendto(-1, 0, 0, 0, 0, 0);
         r = ::sendmsg(-1, 0, 0);
@@ -1160,6 +1611,8 @@ static bool _init_hooks() {
     hook_api(recvmsg);
     hook_api(write);
     hook_api(writev);
+    hook_api(pread);
+    hook_api(pwrite);
     hook_api(send);
     hook_api(sendto);
     hook_api(sendmsg);
@@ -1180,6 +1633,14 @@ static bool _init_hooks() {
     hook_api(gethostbyname_r);
     hook_api(gethostbyname2_r);
     hook_api(gethostbyaddr_r);
+    hook_api(sendfile);
+    hook_api(splice);
+    hook_api(tee);
+    hook_api(recvmmsg);
+    hook_api(sendmmsg);
+  #ifdef _CO_HOOK_COPY_FILE_RANGE
+    hook_api(copy_file_range);
+  #endif
   #else
     hook_api(kevent);
   #endif
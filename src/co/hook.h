@@ -111,6 +111,11 @@ _CO_DEC_SYS_API(GetQueuedCompletionStatusEx);
 #include <sys/ioctl.h>
 #ifdef __linux__
 #include <sys/epoll.h>   // epoll
+#include <sys/sendfile.h>
+// copy_file_range() is added in glibc 2.27
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define _CO_HOOK_COPY_FILE_RANGE
+#endif
 #else
 #include <time.h>
 #include <sys/event.h>   // kevent
@@ -162,6 +167,8 @@ typedef ssize_t (*recvfrom_fp_t)(int, void*, size_t, int, struct sockaddr*, sock
 typedef ssize_t (*recvmsg_fp_t)(int, struct msghdr*, int);
 typedef ssize_t (*write_fp_t)(int, const void*, size_t);
 typedef ssize_t (*writev_fp_t)(int, const struct iovec*, int);
+typedef ssize_t (*pread_fp_t)(int, void*, size_t, off_t);
+typedef ssize_t (*pwrite_fp_t)(int, const void*, size_t, off_t);
 typedef ssize_t (*send_fp_t)(int, const void*, size_t, int);
 typedef ssize_t (*sendto_fp_t)(int, const void*, size_t, int, const struct sockaddr*, socklen_t);
 typedef ssize_t (*sendmsg_fp_t)(int, const struct msghdr*, int);
@@ -180,6 +187,14 @@ typedef struct hostent* (*gethostbyname2_fp_t)(const char*, int);
 typedef int (*gethostbyname_r_fp_t)(const char*, struct hostent*, char*, size_t, struct hostent**, int*);
 typedef int (*gethostbyname2_r_fp_t)(const char*, int, struct hostent*, char*, size_t, struct hostent**, int*);
 typedef int (*gethostbyaddr_r_fp_t)(const void*, socklen_t, int, struct hostent*, char*, size_t, struct hostent**, int*);
+typedef ssize_t (*sendfile_fp_t)(int, int, off_t*, size_t);
+typedef ssize_t (*splice_fp_t)(int, loff_t*, int, loff_t*, size_t, unsigned int);
+typedef ssize_t (*tee_fp_t)(int, int, size_t, unsigned int);
+typedef int (*recvmmsg_fp_t)(int, struct mmsghdr*, unsigned int, int, struct timespec*);
+typedef int (*sendmmsg_fp_t)(int, struct mmsghdr*, unsigned int, int);
+#ifdef _CO_HOOK_COPY_FILE_RANGE
+typedef ssize_t (*copy_file_range_fp_t)(int, loff_t*, int, loff_t*, size_t, unsigned int);
+#endif
 #else
 typedef int (*kevent_fp_t)(int, const struct kevent*, int, struct kevent*, int, const struct timespec*);
 #endif
@@ -206,6 +221,8 @@ _CO_DEC_SYS_API(recvfrom);
 _CO_DEC_SYS_API(recvmsg);
 _CO_DEC_SYS_API(write);
 _CO_DEC_SYS_API(writev);
+_CO_DEC_SYS_API(pread);
+_CO_DEC_SYS_API(pwrite);
 _CO_DEC_SYS_API(send);
 _CO_DEC_SYS_API(sendto);
 _CO_DEC_SYS_API(sendmsg);
@@ -224,6 +241,14 @@ _CO_DEC_SYS_API(gethostbyname2);
 _CO_DEC_SYS_API(gethostbyname_r);
 _CO_DEC_SYS_API(gethostbyname2_r);
 _CO_DEC_SYS_API(gethostbyaddr_r);
+_CO_DEC_SYS_API(sendfile);
+_CO_DEC_SYS_API(splice);
+_CO_DEC_SYS_API(tee);
+_CO_DEC_SYS_API(recvmmsg);
+_CO_DEC_SYS_API(sendmmsg);
+#ifdef _CO_HOOK_COPY_FILE_RANGE
+_CO_DEC_SYS_API(copy_file_range);
+#endif
 #else
 _CO_DEC_SYS_API(kevent);
 #endif
@@ -86,6 +86,7 @@ bool IoEvent::wait(uint32 ms) {
         }
     }
 
+    ms = s->wait_ms(ms);
     if (ms != (uint32)-1) {
         s->add_timer(ms);
         s->yield();
@@ -93,7 +94,7 @@ bool IoEvent::wait(uint32 ms) {
         if (!_timeout) return true;
 
         CancelIo((HANDLE)_fd);
-        co::error() = ETIMEDOUT;
+        co::error() = s->cancelled() ? ECANCELED : ETIMEDOUT;
         WSASetLastError(WSAETIMEDOUT);
         return false;
     } else {
@@ -141,13 +142,14 @@ bool IoEvent::wait(uint32 ms) {
         if (!_has_ev) return false;
     }
 
+    ms = s->wait_ms(ms);
     if (ms != (uint32)-1) {
         s->add_timer(ms);
         s->yield();
         if (!s->timeout()) {
             return true;
         } else {
-            errno = ETIMEDOUT;
+            errno = s->cancelled() ? ECANCELED : ETIMEDOUT;
             return false;
         }
     } else {
@@ -0,0 +1,119 @@
+#include "scheduler.h"
+#include "co/thread.h"
+#include "co/time.h"
+
+namespace co {
+
+/**
+ * thread pool for blocking calls
+ *   - A coroutine calling co::offload() pushes a task to the queue and yields,
+ *     a worker thread runs the task and resumes the coroutine with
+ *     add_ready_task(), so the scheduler can run other coroutines in the mean
+ *     time.
+ *   - Threads are created on demand, when no thread is idle, up to
+ *     co_offload_threads. A thread exits after it is idle for co_offload_idle_ms.
+ */
+class OffloadPool {
+  public:
+    struct task_t {
+        Closure* cb;
+        Coroutine* co;
+        SchedulerImpl* s;
+        int64 t; // time in us it was queued
+    };
+
+    OffloadPool() : _threads(0), _idle(0) {
+        xx::cond_init(&_cond);
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    ~OffloadPool() = delete;
+
+    void add(const task_t& x) {
+        bool spawn = false;
+        {
+            ::MutexGuard g(_mtx);
+            _q.push_back(x);
+            const uint64 n = _q.size();
+            _stats.queued = n;
+            if (_stats.max_queued < n) _stats.max_queued = n;
+            if (_idle > 0) {
+                xx::cond_notify(&_cond);
+            } else if (_threads < FLG_co_offload_threads || _threads == 0) {
+                ++_threads;
+                spawn = true;
+            }
+        }
+        if (spawn) Thread(&OffloadPool::loop, this).detach();
+    }
+
+    offload_stats_t stats() {
+        ::MutexGuard g(_mtx);
+        offload_stats_t x = _stats;
+        x.threads = _threads;
+        x.idle = _idle;
+        return x;
+    }
+
+  private:
+    void loop();
+
+    ::Mutex _mtx;
+    xx::cond_t _cond;
+    co::deque<task_t> _q;
+    uint32 _threads;
+    uint32 _idle;
+    offload_stats_t _stats;
+};
+
+void OffloadPool::loop() {
+    task_t x;
+    for (;;) {
+        {
+            ::MutexGuard g(_mtx);
+            while (_q.empty()) {
+                ++_idle;
+                const bool r = xx::cond_wait(&_cond, _mtx.mutex(), FLG_co_offload_idle_ms);
+                --_idle;
+                if (!r && _q.empty()) { --_threads; return; }
+            }
+            x = _q.front();
+            _q.pop_front();
+            _stats.queued = _q.size();
+        }
+
+        const int64 t = now::us();
+        x.cb->run();
+        const int64 e = now::us();
+
+        {
+            ::MutexGuard g(_mtx);
+            const uint64 w = (uint64)(t - x.t);
+            ++_stats.tasks;
+            _stats.wait_us += w;
+            _stats.run_us += (uint64)(e - t);
+            if (_stats.max_wait_us < w) _stats.max_wait_us = w;
+        }
+        x.s->add_ready_task(x.co);
+    }
+}
+
+inline OffloadPool* offload_pool() {
+    static auto p = co::static_new<OffloadPool>();
+    return p;
+}
+
+void offload(Closure* cb) {
+    const auto s = gSched;
+    if (!s) return cb->run(); // not in a coroutine, just run it here
+
+    OffloadPool::task_t x = { cb, s->running(), s, now::us() };
+    offload_pool()->add(x);
+    s->yield();
+}
+
+offload_stats_t offload_stats() {
+    return offload_pool()->stats();
+}
+
+} // co
@@ -0,0 +1,289 @@
+#include "scheduler.h"
+#include "co/parallel.h"
+#include "co/os.h"
+#include "co/thread.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace co {
+namespace xx {
+
+/**
+ * a parallel_for() call
+ *   - It is not on the stack of the caller, which may be a shared stack reused
+ *     by other coroutines while the caller is suspended. It is referenced by
+ *     the caller and the pool, the pool drops its reference when the last range
+ *     is done.
+ */
+struct ParJob {
+    ParJob(const range_fn_t& f, size_t grain, size_t n)
+        : f(f), grain(grain), left(n), refn(2), co(0), s(0), ev(0) {}
+
+    range_fn_t f;     // a copy of the function of the caller
+    size_t grain;
+    size_t left;      // elements not done yet
+    uint32 refn;
+    Coroutine* co;    // the caller is a coroutine in scheduler s
+    SchedulerImpl* s;
+    SyncEvent* ev;    // the caller is a thread out of the pool, blocked on ev
+};
+
+inline void unref(ParJob* job) {
+    if (atomic_dec(&job->refn, mo_acq_rel) == 0) co::del(job);
+}
+
+struct ParRange {
+    ParJob* job;
+    size_t beg;
+    size_t end;
+};
+
+/**
+ * Chase-Lev deque of a fixed size
+ *   - The owner pushes and pops at the bottom, other threads steal from the
+ *     top. push() fails if the deque is full, the caller runs the range
+ *     without splitting it then.
+ */
+class WsDeque {
+  public:
+    enum { N = 1024, M = N - 1 };
+
+    WsDeque() : _top(0), _bottom(0), _a() {}
+
+    bool push(ParRange* x) {
+        const int64 b = atomic_load(&_bottom, mo_relaxed);
+        const int64 t = atomic_load(&_top, mo_acquire);
+        if (b - t >= N) return false;
+        atomic_store(&_a[b & M], x, mo_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        atomic_store(&_bottom, b + 1, mo_relaxed);
+        return true;
+    }
+
+    ParRange* pop() {
+        const int64 b = atomic_load(&_bottom, mo_relaxed) - 1;
+        atomic_store(&_bottom, b, mo_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64 t = atomic_load(&_top, mo_relaxed);
+        if (t > b) {
+            atomic_store(&_bottom, b + 1, mo_relaxed);
+            return 0;
+        }
+        ParRange* x = atomic_load(&_a[b & M], mo_relaxed);
+        if (t == b) { // the last one, race with thieves
+            if (!atomic_bool_cas(&_top, t, t + 1, mo_seq_cst, mo_relaxed)) x = 0;
+            atomic_store(&_bottom, b + 1, mo_relaxed);
+        }
+        return x;
+    }
+
+    ParRange* steal() {
+        const int64 t = atomic_load(&_top, mo_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64 b = atomic_load(&_bottom, mo_acquire);
+        if (t >= b) return 0;
+        ParRange* x = atomic_load(&_a[t & M], mo_relaxed);
+        if (!atomic_bool_cas(&_top, t, t + 1, mo_seq_cst, mo_relaxed)) return 0;
+        return x;
+    }
+
+  private:
+    int64 _top;
+    char _pad[64];
+    int64 _bottom;
+    ParRange* _a[N];
+};
+
+// id of the pool thread, -1 for threads out of the pool
+static __thread int g_par_id = -1;
+
+/**
+ * work-stealing pool for parallel_for()
+ *   - Each thread has a deque of ranges, a thread splits a range in halves
+ *     down to the grain, pushes the upper halves to its deque, and runs the
+ *     lower one. When its deque is empty, it takes a range from the queue of
+ *     calls from threads out of the pool, or steals from other threads.
+ *   - Idle threads sleep on a condition variable, _ver is bumped when work is
+ *     added, so a thread checks it before it sleeps and no wakeup is lost.
+ */
+class ParPool {
+  public:
+    ParPool() : _ver(0), _sleeping(0), _ninj(0) {
+        _cpus = co::sched_cpus();
+        _n = FLG_co_par_threads > 0 ? (int)FLG_co_par_threads : os::cpunum();
+        if (_n <= 0) _n = 1;
+        _q = (WsDeque*) co::alloc(sizeof(WsDeque) * _n); assert(_q);
+        for (int i = 0; i < _n; ++i) new (&_q[i]) WsDeque();
+        for (int i = 0; i < _n; ++i) Thread(&ParPool::loop, this, i).detach();
+    }
+
+    ~ParPool() = delete;
+
+    int size() const { return _n; }
+
+    // run the range in the current pool thread, splitting it on the way
+    void run(ParJob* job, size_t beg, size_t end) {
+        WsDeque& q = _q[g_par_id];
+        while (end - beg > job->grain) {
+            const size_t mid = beg + (end - beg) / 2;
+            ParRange* r = co::make<ParRange>();
+            r->job = job; r->beg = mid; r->end = end;
+            if (!q.push(r)) { co::del(r); break; }
+            this->notify();
+            end = mid;
+        }
+        job->f(beg, end);
+        this->finish(job, end - beg);
+    }
+
+    // run ranges until the job is done, for calls in pool threads
+    void help(ParJob* job) {
+        while (atomic_load(&job->left, mo_acquire) != 0) {
+            ParRange* r = this->take();
+            if (r) {
+                this->exec(r);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // a call from threads out of the pool
+    void inject(ParJob* job, size_t n) {
+        ParRange* r = co::make<ParRange>();
+        r->job = job; r->beg = 0; r->end = n;
+        {
+            std::lock_guard<std::mutex> g(_imtx);
+            _inj.push_back(r);
+            atomic_inc(&_ninj, mo_relaxed);
+        }
+        this->notify();
+    }
+
+  private:
+    void loop(int id);
+
+    void exec(ParRange* r) {
+        ParJob* const job = r->job;
+        const size_t beg = r->beg, end = r->end;
+        co::del(r);
+        this->run(job, beg, end);
+    }
+
+    // the last range done wakes up the caller, and drops the reference of the pool
+    void finish(ParJob* job, size_t n) {
+        if (atomic_sub(&job->left, n, mo_acq_rel) != 0) return;
+        if (job->co) {
+            job->s->add_ready_task(job->co);
+        } else if (job->ev) {
+            job->ev->signal();
+        }
+        unref(job);
+    }
+
+    ParRange* take() {
+        const int id = g_par_id;
+        ParRange* r = _q[id].pop();
+        if (r) return r;
+        if (atomic_load(&_ninj, mo_relaxed) > 0) {
+            std::lock_guard<std::mutex> g(_imtx);
+            if (!_inj.empty()) {
+                r = _inj.front();
+                _inj.pop_front();
+                atomic_dec(&_ninj, mo_relaxed);
+                return r;
+            }
+        }
+        for (int i = 1; i < _n; ++i) {
+            r = _q[(id + i) % _n].steal();
+            if (r) return r;
+        }
+        return 0;
+    }
+
+    void notify() {
+        atomic_inc(&_ver, mo_seq_cst);
+        if (atomic_load(&_sleeping, mo_seq_cst) > 0) {
+            std::lock_guard<std::mutex> g(_mtx);
+            _cv.notify_one();
+        }
+    }
+
+  private:
+    int _n;
+    co::vector<int> _cpus;
+    WsDeque* _q;
+    uint32 _ver;
+    int _sleeping;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+
+    // calls from threads out of the pool
+    int _ninj;
+    std::mutex _imtx;
+    co::deque<ParRange*> _inj;
+};
+
+void ParPool::loop(int id) {
+    g_par_id = id;
+    const int cpu = _cpus.empty() ? -1 : _cpus[id % _cpus.size()];
+    if (cpu >= 0 && !os::bind_cpu(cpu)) {
+        ELOG << "bind parallel thread " << id << " to cpu " << cpu << " failed";
+    }
+    for (;;) {
+        const uint32 v = atomic_load(&_ver, mo_seq_cst);
+        ParRange* r = this->take();
+        if (r) { this->exec(r); continue; }
+
+        std::unique_lock<std::mutex> g(_mtx);
+        atomic_inc(&_sleeping, mo_seq_cst);
+        while (atomic_load(&_ver, mo_seq_cst) == v) {
+            _cv.wait_for(g, std::chrono::milliseconds(100));
+        }
+        atomic_dec(&_sleeping, mo_seq_cst);
+    }
+}
+
+inline ParPool* par_pool() {
+    static auto p = co::static_new<ParPool>();
+    return p;
+}
+
+} // xx
+
+size_t parallel_grain(size_t n) {
+    const size_t g = n / ((size_t)xx::par_pool()->size() * 8);
+    return g > 0 ? g : 1;
+}
+
+void parallel_for(size_t n, const range_fn_t& f, size_t grain) {
+    if (n == 0) return;
+    if (grain == 0) grain = parallel_grain(n);
+    if (n <= grain) return f(0, n);
+
+    auto p = xx::par_pool();
+    auto job = co::make<xx::ParJob>(f, grain, n);
+    if (xx::g_par_id >= 0) { // nested call in a pool thread
+        p->run(job, 0, n);
+        p->help(job);
+        return xx::unref(job);
+    }
+
+    const auto s = gSched;
+    if (s && s->running()) {
+        job->co = s->running();
+        job->s = s;
+        p->inject(job, n);
+        s->yield();
+    } else {
+        SyncEvent ev;
+        job->ev = &ev;
+        p->inject(job, n);
+        ev.wait();
+    }
+    xx::unref(job);
+}
+
+} // co
@@ -0,0 +1,82 @@
+#include "profile.h"
+#include "co/fastream.h"
+#include "../log/stack_trace.h"
+#include <algorithm>
+#include <stdlib.h>
+#ifdef HAS_CXXABI_H
+#include <cxxabi.h>
+#endif
+
+namespace co {
+
+void Profiler::merge_to(co::hash_map<const std::type_info*, ProfEntry>& m) {
+    ::MutexGuard g(_mtx);
+    for (auto it = _map.begin(); it != _map.end(); ++it) {
+        const ProfEntry& x = it->second;
+        ProfEntry& e = m[it->first];
+        e.resumes += x.resumes;
+        e.us += x.us;
+        if (e.max_us < x.max_us) e.max_us = x.max_us;
+        e.slow += x.slow;
+        for (auto k = x.stacks.begin(); k != x.stacks.end(); ++k) {
+            e.stacks[k->first] += k->second;
+        }
+    }
+}
+
+void capture_stack(ProfStack& s) {
+    auto st = ___::log::stack_trace();
+    // skip capture_stack() and its caller
+    s.depth = st ? st->get_pcs(s.pcs, ProfStack::D, 2) : 0;
+}
+
+static fastring entry_name(const std::type_info* t) {
+    if (!t) return fastring("???");
+  #ifdef HAS_CXXABI_H
+    int status = 0;
+    char* p = abi::__cxa_demangle(t->name(), NULL, NULL, &status);
+    if (p) {
+        fastring s(p);
+        ::free(p);
+        return s;
+    }
+  #endif
+    return fastring(t->name());
+}
+
+fastring make_profile_report(co::hash_map<const std::type_info*, ProfEntry>& m, int n) {
+    typedef std::pair<const std::type_info*, ProfEntry*> E;
+    co::vector<E> v;
+    v.reserve(m.size());
+    for (auto it = m.begin(); it != m.end(); ++it) v.push_back(E(it->first, &it->second));
+    std::sort(v.begin(), v.end(), [](const E& a, const E& b) { return a.second->us > b.second->us; });
+
+    auto st = ___::log::stack_trace();
+    fastream s(1024);
+    s << "coroutine profile, top " << n << " of " << v.size() << " entries:\n";
+    for (size_t i = 0; i < v.size() && (int)i < n; ++i) {
+        const ProfEntry& e = *v[i].second;
+        s << '#' << i << "  " << entry_name(v[i].first) << '\n'
+          << "    time: " << e.us << " us, resumes: " << e.resumes
+          << ", avg: " << (e.resumes ? e.us / e.resumes : 0) << " us, max: " << e.max_us
+          << " us, slow: " << e.slow << '\n';
+
+        // the most frequent stack of slow runs
+        auto x = e.stacks.end();
+        for (auto k = e.stacks.begin(); k != e.stacks.end(); ++k) {
+            if (x == e.stacks.end() || x->second < k->second) x = k;
+        }
+        if (x != e.stacks.end()) {
+            s << "    stack of slow runs (" << x->second << " times):\n";
+            const ProfStack& k = x->first;
+            for (int d = 0; d < k.depth; ++d) {
+                s << "    #" << d << "  in ";
+                if (st) { st->symbolize(k.pcs[d], &s); } else { s << k.pcs[d]; }
+                s << '\n';
+            }
+        }
+    }
+    return s.str();
+}
+
+} // co
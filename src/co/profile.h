@@ -0,0 +1,96 @@
+#pragma once
+
+#include "co/def.h"
+#include "co/stl.h"
+#include "co/fastring.h"
+#include "co/thread.h"
+#include <string.h>
+#include <typeinfo>
+
+namespace co {
+
+// pcs of a stack, symbolized only when the report is made
+struct ProfStack {
+    static const int D = 32; // max depth of stacks
+
+    bool operator==(const ProfStack& x) const {
+        return depth == x.depth && memcmp(pcs, x.pcs, sizeof(void*) * depth) == 0;
+    }
+
+    void* pcs[D];
+    int depth;
+};
+
+struct ProfStackHash {
+    size_t operator()(const ProfStack& s) const {
+        size_t h = (size_t)s.depth;
+        for (int i = 0; i < s.depth; ++i) h = h * 31 + (size_t)s.pcs[i];
+        return h;
+    }
+};
+
+// profile data of coroutines with the same type of entry Closure
+struct ProfEntry {
+    ProfEntry() : resumes(0), us(0), max_us(0), slow(0) {}
+
+    uint64 resumes; // number of resumes
+    uint64 us;      // total time in microseconds spent running
+    uint64 max_us;  // max time of a single run
+    uint64 slow;    // number of runs longer than co_profile_stack_us
+    co::hash_map<ProfStack, uint64, ProfStackHash> stacks; // sampled stacks of slow runs
+};
+
+/**
+ * coroutine profiler of a scheduler
+ *   - Coroutines are grouped by the type of their entry Closure, which is usually
+ *     a lambda or a function passed to go().
+ *   - Data is written by the scheduler thread, and read by any thread calling
+ *     co::profile_report(), so it is protected by a mutex. The mutex is only
+ *     used when co_profile is true.
+ */
+class Profiler {
+  public:
+    Profiler() = default;
+    ~Profiler() = default;
+
+    // record a run of a coroutine
+    void add_run(const std::type_info* entry, uint64 us) {
+        ::MutexGuard g(_mtx);
+        ProfEntry& e = _map[entry];
+        e.resumes++;
+        e.us += us;
+        if (e.max_us < us) e.max_us = us;
+    }
+
+    // record the stack of a slow run, at most 8 distinct stacks for each entry
+    void add_stack(const std::type_info* entry, const ProfStack& stack) {
+        ::MutexGuard g(_mtx);
+        ProfEntry& e = _map[entry];
+        e.slow++;
+        if (stack.depth == 0) return;
+        auto it = e.stacks.find(stack);
+        if (it != e.stacks.end()) { it->second++; return; }
+        if (e.stacks.size() < 8) e.stacks.emplace(stack, 1);
+    }
+
+    // merge data of this profiler into @m
+    void merge_to(co::hash_map<const std::type_info*, ProfEntry>& m);
+
+    void clear() {
+        ::MutexGuard g(_mtx);
+        _map.clear();
+    }
+
+  private:
+    ::Mutex _mtx;
+    co::hash_map<const std::type_info*, ProfEntry> _map;
+    DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+// capture pcs of the stack of the current coroutine
+void capture_stack(ProfStack& s);
+
+// build a report of the top n entries with the most cpu time
+fastring make_profile_report(co::hash_map<const std::type_info*, ProfEntry>& m, int n);
+
+} // co
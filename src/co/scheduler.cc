@@ -1,40 +1,167 @@
 #include "scheduler.h"
 #include "co/os.h"
+#include "co/random.h"
+#include "co/str.h"
+#include "../log/stack_trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 DEF_uint32(co_sched_num, os::cpunum(), ">>#1 number of coroutine schedulers, default: os::cpunum()");
-DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines, default: 1M");
+DEF_uint32(co_sched_min, 0, ">>#1 if > 0, start with this many schedulers, start more of them up to co_sched_num under "
+    "sustained load, and park idle ones, a parked scheduler gets no new tasks from go()");
+DEF_string(co_sched_cpus, "", ">>#1 cpu list to bind schedulers to, e.g. 0-3,8-11, scheduler i is bound to the i-th cpu in the list");
+DEF_bool(co_sched_numa_spread, false, ">>#1 if true, bind schedulers to cpus spread across NUMA nodes, ignored if co_sched_cpus is not empty");
+DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines, or size of the dedicated stack of each coroutine, default: 1M");
+DEF_uint32(co_shared_stack_num, 8, ">>#1 number of stacks shared by coroutines in each scheduler, default: 8");
+DEF_bool(co_dedicated_stack, false, ">>#1 if true, each coroutine has its own stack, and no stack copy is needed on context switches");
 DEF_bool(co_debug_log, false, ">>#1 enable debug log for coroutine library");
+DEF_bool(co_lockfree_tasks, true, ">>#1 use lock-free lists for tasks of schedulers, or use a mutex if false");
+DEF_uint32(co_busy_poll_us, 0, ">>#1 max time in us a scheduler spins for events before blocking in epoll, 0 to disable busy polling");
+DEF_uint32(co_busy_poll_cpu, 50, ">>#1 max percentage of cpu time a scheduler can spend on busy polling, default: 50");
+DEF_bool(co_io_uring, false, ">>#1 use io_uring for co::recv, co::send, co::accept and co::connect on Linux, fall back to epoll if it is not available");
+DEF_bool(co_precise_timer, false, ">>#1 if true, get the current time for each timer, instead of using the time cached in each round of the scheduler");
+DEF_bool(co_profile, false, ">>#1 if true, record cpu time of coroutines, grouped by their entry functions, see co::profile_report()");
+DEF_uint32(co_profile_stack_us, 0, ">>#1 capture stack of a coroutine when it runs longer than this value(us) without yielding, 0 to disable, work with co_profile");
+DEF_int32(co_profile_signal, 0, ">>#1 if > 0, write the coroutine profile report, and the heap profile if mem_profile_rate > 0, to log on this signal, e.g. 12 for SIGUSR2 on linux");
+DEF_uint32(co_stall_ms, 0, ">>#1 if > 0, a watchdog thread reports schedulers blocked by a coroutine running longer than this value(ms) without yielding");
+DEF_uint32(co_preempt_ms, 0, ">>#1 if > 0, a coroutine running longer than this value(ms) without yielding is asked to yield at the next co::preempt_point()");
+DEF_bool(co_stall_move_tasks, false, ">>#1 if true, the watchdog moves stealable tasks of a blocked scheduler to the others, work with co_stall_ms and co_steal");
+DEF_uint32(co_pool_keep_num, 1024, ">>#1 max number of pooled coroutines that keep their stack memory for reuse, default: 1024");
+DEF_uint32(co_pool_stack_max, 0, ">>#1 if > 0, a pooled coroutine frees its buffer for saving stack data if it is larger than this value");
+DEF_uint32(co_mem_trim_ms, 10000, ">>#1 schedulers return memory of co::alloc() unused for this long to the OS, 0 to disable, default: 10000");
+DEF_uint32(co_mem_keep_kb, 2048, ">>#1 max KB of unused memory a scheduler keeps when trimming memory, work with co_mem_trim_ms");
+DEF_uint32(co_pool_idle_ms, 10000, ">>#1 pooled coroutines unused for this long free their stack memory, 0 to disable, default: 10000");
+DEF_uint32(co_mutex_spin, 128, ">>#1 max number of spins in co::Mutex::lock() before the coroutine is suspended, adjusted by the average spins needed, 0 to disable");
+DEF_uint32(co_offload_threads, 64, ">>#1 max number of threads running blocking calls for co::offload(), default: 64");
+DEF_uint32(co_offload_idle_ms, 30000, ">>#1 a thread of co::offload() exits after it is idle for this long, default: 30000");
+DEF_uint32(co_par_threads, 0, ">>#1 number of threads for co::parallel_for(), default: os::cpunum()");
+DEF_uint32(co_trace_events, 65536, ">>#1 number of events kept by each scheduler for co::trace_start(), the oldest ones are overwritten");
+DEF_string(co_sched_policy, "round_robin", ">>#1 how go() and tcp::Server choose a scheduler for new tasks: round_robin, least_queued, least_coroutines or two_choices");
+DEF_bool(co_steal, false, ">>#1 if true, idle schedulers will steal tasks created by go() from busy ones");
+
+// flags that can be changed at runtime by flag::update()
+static bool _mutable_flags = []() {
+    flag::set_mutable("co_debug_log");
+    return true;
+}();
 
 namespace co {
 
 __thread SchedulerImpl* gSched = 0;
 
-SchedulerImpl::SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size)
+static const size_t g_guard_size = 4096;
+
+#ifdef _WIN32
+inline char* _map_stack(size_t n) {
+    char* p = (char*) VirtualAlloc(NULL, n, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (p) {
+        DWORD x;
+        VirtualProtect(p, g_guard_size, PAGE_NOACCESS, &x);
+    }
+    return p;
+}
+
+inline void _unmap_stack(char* p, size_t) {
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+inline char* _map_stack(size_t n) {
+  #ifdef MAP_NORESERVE
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  #else
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  #endif
+    void* p = ::mmap(NULL, n, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    ::mprotect(p, g_guard_size, PROT_NONE);
+    return (char*)p;
+}
+
+inline void _unmap_stack(char* p, size_t n) {
+    ::munmap(p, n);
+}
+#endif
+
+Stack* make_dedicated_stack(size_t size) {
+    size = (size + g_guard_size - 1) & ~(g_guard_size - 1);
+    char* p = _map_stack(size + g_guard_size);
+    CHECK(p != NULL) << "map stack for coroutine failed: " << co::strerror();
+    Stack* s = (Stack*) co::alloc(sizeof(Stack)); assert(s);
+    s->p = p + g_guard_size;
+    s->top = s->p + size;
+    s->co = 0;
+    return s;
+}
+
+void free_dedicated_stack(Stack* s) {
+    _unmap_stack(s->p - g_guard_size, s->top - s->p + g_guard_size);
+    co::free(s, sizeof(Stack));
+}
+
+SchedulerImpl::SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size, uint32 stack_num)
     : _wait_ms((uint32)-1), _id(id), _sched_num(sched_num), 
-      _stack_size(stack_size), _running(0), _co_pool(), 
-      _stop(false), _timeout(false) {
+      _stack_size(stack_size), _stack_num(stack_num), _nresume(0), _now_ms(now::ms()),
+      _running(0), _migrate_to(0), _co_pool(), _scheds(0), _loop_hist(1),
+      _stop(false), _timeout(false), _idle(false), _started(false), _cpu(-1), _poll_beg(0),
+      _spin_budget(FLG_co_busy_poll_us), _spin_beg(0), _spin_us(0), _run_beg(0), _run_seq(0), _preempt_seq(0), _posted(0), _trim_ms(0), _ticks(4) {
+    memset(&_stats, 0, sizeof(_stats));
+  #ifndef _WIN32
+    _stall_depth = 0;
+    _stall_state = 0;
+  #endif
     _epoll = co::make<Epoll>(id);
-    _stack = (Stack*) co::zalloc(8 * sizeof(Stack));
+  #ifdef __linux__
+    _io_uring = 0;
+    if (FLG_co_io_uring) {
+        _io_uring = co::make<IoUring>(id);
+        if (_io_uring->fd() == -1 || !_epoll->add_ev_read(_io_uring->fd(), 0)) {
+            ELOG << "io_uring is not available, use epoll instead, sched: " << id;
+            co::del(_io_uring);
+            _io_uring = 0;
+        }
+    }
+  #endif
+    _stack = (Stack*) co::zalloc(_stack_num * sizeof(Stack));
     _main_co = _co_pool.pop(); // coroutine with zero id is reserved for _main_co
 }
 
 SchedulerImpl::~SchedulerImpl() {
     this->stop();
+  #ifdef __linux__
+    if (_io_uring) co::del(_io_uring);
+  #endif
     co::del(_epoll);
-    co::free(_stack, 8 * sizeof(Stack));
+    co::free(_stack, _stack_num * sizeof(Stack));
 }
 
 void SchedulerImpl::stop() {
-    if (atomic_swap(&_stop, true, mo_acq_rel) == false) {
+    if (atomic_swap(&_stop, true, mo_acq_rel) == false && this->started()) {
         _epoll->signal();
         _ev.wait(32); // wait at most 32ms
     }
 }
 
+// The coroutine may be moved to another thread by co::migrate(), and a compiler
+// may cache address of the thread-local gSched in a function, so we load it
+// again in a function that is not inlined.
+#ifdef _MSC_VER
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+static SchedulerImpl* current_sched() { return gSched; }
+
 void SchedulerImpl::main_func(tb_context_from_t from) {
     ((Coroutine*)from.priv)->ctx = from.ctx;
     gSched->running()->cb->run(); // run the coroutine function
-    tb_context_jump(from.ctx, 0); // jump back to the from context
+    SchedulerImpl* const s = current_sched();
+    if (unlikely(FLG_co_profile_stack_us > 0)) s->check_slow_run();
+    tb_context_jump(s->_main_co->ctx, 0); // jump back to the main context
 }
 
 /*
@@ -50,8 +177,17 @@ void SchedulerImpl::main_func(tb_context_from_t from) {
  */
 void SchedulerImpl::resume(Coroutine* co) {
     tb_context_from_t from;
-    Stack* s = &_stack[co->sid];
+    if (unlikely(co->migrant)) co = this->adopt(co);
+    if (co->ctx == 0 && !co->ds) co->sid = this->choose_stack();
+    Stack* s = this->stack_of(co);
     _running = co;
+    if (unlikely(g_tracing)) {
+        _tracer.add(tr_resume, co->id, 0, (co->ctx == 0 ? tr_new : 0) | (_timeout ? tr_timeout : 0));
+    }
+    atomic_store(&_run_seq, _run_seq + 1, mo_release); // odd: running a coroutine
+    s->t = ++_nresume;
+    const bool prof = FLG_co_profile;
+    _stats.resumes++;
     if (s->p == 0) {
         s->p = (char*) co::alloc(_stack_size);
         s->top = s->p + _stack_size;
@@ -61,8 +197,9 @@ void SchedulerImpl::resume(Coroutine* co) {
     if (co->ctx == 0) {
         // resume new coroutine
         if (s->co != co) { this->save_stack(s->co); s->co = co; }
-        co->ctx = tb_context_make(s->p, _stack_size, main_func);
+        co->ctx = tb_context_make(s->p, s->top - s->p, main_func);
         CO_DBG_LOG << "resume new co: " << co << " id: " << co->id;
+        if (prof) _run_beg = now::us();
         from = tb_context_jump(co->ctx, _main_co); // jump to main_func(from):  from.priv == _main_co
 
     } else {
@@ -79,30 +216,128 @@ void SchedulerImpl::resume(Coroutine* co) {
             this->save_stack(s->co);
             CHECK(s->top == (char*)co->ctx + co->stack.size());
             memcpy(co->ctx, co->stack.data(), co->stack.size()); // restore stack data
+            _stats.bytes_copied += co->stack.size();
             s->co = co;
         }
+        if (prof) _run_beg = now::us();
         from = tb_context_jump(co->ctx, _main_co); // jump back to where the user called yiled()
     }
 
+    atomic_store(&_run_seq, _run_seq + 1, mo_release);
+    if (prof) _prof.add_run(co->entry, now::us() - _run_beg);
+    if (unlikely(g_tracing)) _tracer.add(from.priv ? tr_yield : tr_end, co->id);
+
     if (from.priv) {
         // yield() was called in the coroutine, update context for it
         assert(_running == from.priv);
         _running->ctx = from.ctx;
         CO_DBG_LOG << "yield co: " << _running << " id: " << _running->id;
+        if (unlikely(_migrate_to)) {
+            // the coroutine is suspended now, it is safe to hand it over
+            SchedulerImpl* const to = _migrate_to;
+            _migrate_to = 0;
+            _running->s = this;
+            _running->migrant = true;
+            to->add_ready_task(_running);
+        }
     } else {
         // the coroutine has terminated, recycle it
         this->recycle();
     }
 }
 
+bool SchedulerImpl::migrate(SchedulerImpl* to) {
+    if (to == this) return true;
+    if (!_running->ds) return false;
+    if (_running->grp) return false; // cancelled in the scheduler it started in
+    _migrate_to = to;
+    tb_context_from_t from = tb_context_jump(_main_co->ctx, _running);
+    ((Coroutine*)from.priv)->ctx = from.ctx; // resumed in @to
+    return true;
+}
+
+Coroutine* SchedulerImpl::adopt(Coroutine* x) {
+    Coroutine* co = _co_pool.pop();
+    CO_DBG_LOG << "adopt co: " << x << " from sched " << ((SchedulerImpl*)x->s)->id() << " as " << co->id;
+
+    // swap the dedicated stacks, a stack kept by the pooled coroutine goes back
+    // to the source scheduler with x.
+    Stack* ds = co->ds;
+    co->ds = x->ds;
+    co->ds->co = co;
+    x->ds = ds;
+    if (ds) ds->co = x;
+
+    void** cls = co->cls;
+    co->cls = x->cls;
+    x->cls = cls;
+
+    co->ctx = x->ctx;
+    co->prio = x->prio;
+    co->entry = x->entry;
+    co->it = _timer_mgr.end();
+    co->s = this;
+    x->migrant = false;
+
+    // x belongs to the pool of the source scheduler, recycle it there
+    auto s = (SchedulerImpl*) x->s;
+    s->add_new_task(co::new_closure([s, x]() { s->_co_pool.push(x); }));
+    return co;
+}
+
+void SchedulerImpl::check_slow_run() {
+    if (FLG_co_profile && now::us() - _run_beg >= (int64)FLG_co_profile_stack_us) {
+        co::ProfStack s;
+        co::capture_stack(s);
+        _prof.add_stack(_running->entry, s);
+    }
+}
+
+// set by the handler of co_profile_signal, the report will be written to log
+// by scheduler 0.
+static bool g_prof_dump = false;
+
 void SchedulerImpl::loop() {
     gSched = this;
+  #ifndef _WIN32
+    _thread = pthread_self();
+  #endif
+    if (_cpu >= 0 && !os::bind_cpu(_cpu)) {
+        ELOG << "bind scheduler " << _id << " to cpu " << _cpu << " failed";
+    }
     co::array<Closure*> new_tasks;
     co::array<Coroutine*> ready_tasks;
+    int64 busy_beg = 0; // time the last round began to run tasks
+    if (FLG_co_mem_trim_ms > 0) {
+        this->add_tick([](void*) { co::mem_trim((size_t)FLG_co_mem_keep_kb << 10); }, 0, FLG_co_mem_trim_ms);
+    }
 
     while (!_stop) {
-        int n = _epoll->wait(_wait_ms);
+      #ifdef __linux__
+        // submit IO operations of this round in batch
+        if (_io_uring) {
+            _io_uring->submit();
+            if (_io_uring->has_cqe()) _wait_ms = 0;
+        }
+      #endif
+        if (FLG_co_steal && _wait_ms != 0) atomic_store(&_idle, true, mo_relaxed);
+        const int64 t = now::us();
+        if (busy_beg > 0) _loop_hist.record((uint64)(t - busy_beg));
+        if (unlikely(g_tracing)) _tracer.add(tr_idle, 0, _wait_ms);
+        atomic_store(&_poll_beg, t, mo_relaxed);
+        int n = this->poll();
+        atomic_store(&_poll_beg, (int64)0, mo_relaxed);
+        if (unlikely(g_tracing)) _tracer.add(tr_wakeup, 0, n > 0 ? (uint32)n : 0);
+        const int64 t1 = now::us();
+        busy_beg = t1;
+        _stats.idle_us += t1 - t;
+        _now_ms = t1 / 1000; // refresh the cached time once in each round
+        if (FLG_co_steal) atomic_store(&_idle, false, mo_relaxed);
         if (_stop) break;
+        if (unlikely(_id == 0 && g_prof_dump) && atomic_swap(&g_prof_dump, false, mo_relaxed)) {
+            LOG << co::profile_report();
+            if (FLG_mem_profile_rate > 0) LOG << co::heap_profile();
+        }
 
         if (unlikely(n == -1)) {
             if (errno != EINTR) {
@@ -111,6 +346,9 @@ void SchedulerImpl::loop() {
             continue;
         }
 
+      #if defined(__linux__)
+        if (n > 0) this->resume_io_tasks(n);
+      #else
         for (int i = 0; i < n; ++i) {
             auto& ev = (*_epoll)[i];
             if (_epoll->is_ev_pipe(ev)) {
@@ -132,21 +370,52 @@ void SchedulerImpl::loop() {
             } else {
                 co::free(info, info->mlen);
             }
-          #elif defined(__linux__)
-            int32 rco = 0, wco = 0;
-            auto& ctx = co::get_sock_ctx(_epoll->user_data(ev));
-            if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
-            if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
-            if (rco) this->resume(_co_pool[rco]);
-            if (wco) this->resume(_co_pool[wco]);
           #else
             this->resume((Coroutine*)_epoll->user_data(ev));
           #endif
         }
+      #endif
+
+      #ifdef __linux__
+        if (_io_uring && _io_uring->has_cqe()) {
+            _io_uring->reap([&ready_tasks](uint64 ud, int32 res) {
+                if (ud) {
+                    Coroutine* co = (Coroutine*)ud;
+                    co->io_res = res;
+                    ready_tasks.push_back(co);
+                }
+            });
+            CO_DBG_LOG << ">> resume io_uring tasks, num: " << ready_tasks.size();
+            for (size_t i = 0; i < ready_tasks.size(); ++i) {
+                this->resume(ready_tasks[i]);
+            }
+            ready_tasks.clear();
+        }
+      #endif
 
         CO_DBG_LOG << "> check tasks ready to resume..";
+        bool stolen = false;
         do {
+            // cleared before taking the tasks, so no task is missed by queue_load()
+            if (atomic_load(&_posted, mo_relaxed)) atomic_store(&_posted, 0u, mo_relaxed);
             _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            if (!_local_new_tasks.empty()) {
+                new_tasks.push_back(_local_new_tasks.data(), _local_new_tasks.size());
+                _local_new_tasks.clear();
+            }
+            if (!_local_ready_tasks.empty()) {
+                ready_tasks.push_back(_local_ready_tasks.data(), _local_ready_tasks.size());
+                _local_ready_tasks.clear();
+            }
+            if (FLG_co_steal && new_tasks.empty() && ready_tasks.empty()) {
+                stolen = this->steal_tasks(new_tasks);
+            }
+            atomic_store(&_stats.queued, (uint64)(new_tasks.size() + ready_tasks.size()), mo_relaxed);
+
+            if (this->has_prio_tasks(new_tasks, ready_tasks)) {
+                this->resume_prio_tasks(new_tasks, ready_tasks);
+                break;
+            }
 
             if (!new_tasks.empty()) {
                 CO_DBG_LOG << ">> resume new tasks, num: " << new_tasks.size();
@@ -167,7 +436,7 @@ void SchedulerImpl::loop() {
 
         CO_DBG_LOG << "> check timedout tasks..";
         do {
-            _wait_ms = _timer_mgr.check_timeout(ready_tasks);
+            _wait_ms = _timer_mgr.check_timeout(ready_tasks, this->now_ms());
 
             if (!ready_tasks.empty()) {
                 CO_DBG_LOG << ">> resume timedout tasks, num: " << ready_tasks.size();
@@ -180,21 +449,294 @@ void SchedulerImpl::loop() {
             }
         } while (0);
 
+        // there may be more tasks to steal, check again without blocking.
+        if (stolen) _wait_ms = 0;
+
+        // tasks were added to the local queues by coroutines of this scheduler.
+        if (!_local_new_tasks.empty() || !_local_ready_tasks.empty()) _wait_ms = 0;
         if (_running) _running = 0;
+
+        if (FLG_co_pool_idle_ms > 0 && _co_pool.bytes() > 0) {
+            if (_now_ms - _trim_ms >= FLG_co_pool_idle_ms) {
+                _co_pool.trim();
+                _trim_ms = _now_ms;
+            }
+            // wake up in time for the next trim
+            const int64 x = _trim_ms + FLG_co_pool_idle_ms - _now_ms;
+            if (_wait_ms > x) _wait_ms = (uint32)x;
+        }
+
+        for (size_t i = 0; i < _ticks.size(); ++i) {
+            if (_now_ms >= _ticks[i].due) {
+                const tick_t t = _ticks[i];
+                _ticks[i].due = _now_ms + t.ms;
+                t.f(t.arg); // it may add or delete ticks
+                if (i >= _ticks.size()) break;
+            }
+            const int64 x = _ticks[i].due - _now_ms;
+            if (_wait_ms > x) _wait_ms = (uint32)x;
+        }
+        if (!_local_new_tasks.empty()) _wait_ms = 0; // tasks added by the ticks
+        _stats.pool_bytes = _co_pool.bytes();
+        _stats.coroutines = _co_pool.alive();
+        _stats.pooled = _co_pool.pooled();
     }
 
     _ev.signal();
 }
 
-uint32 TimerManager::check_timeout(co::array<Coroutine*>& res) {
-    if (_timer.empty()) return (uint32)-1;
+#if defined(__linux__)
+void SchedulerImpl::resume_io_tasks(int n) {
+    Epoll& ep = *_epoll;
+    for (int i = 0; i < n; ++i) {
+        __builtin_prefetch(&co::get_sock_ctx(ep.user_data(ep[i])));
+    }
+
+    _io_tasks.clear();
+    for (int i = 0; i < n; ++i) {
+        auto& ev = ep[i];
+        if (ep.is_ev_pipe(ev)) {
+            ep.handle_ev_pipe();
+            continue;
+        }
+        int32 rco = 0, wco = 0;
+        auto& ctx = co::get_sock_ctx(ep.user_data(ev));
+        if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
+        if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
+        if (rco) {
+            Coroutine* co = _co_pool[rco];
+            __builtin_prefetch(co);
+            _io_tasks.push_back(io_task_t{ 0, co });
+        }
+        if (wco) {
+            Coroutine* co = _co_pool[wco];
+            __builtin_prefetch(co);
+            _io_tasks.push_back(io_task_t{ 0, co });
+        }
+    }
 
-    int64 now_ms = now::ms();
-    auto it = _timer.begin();
-    for (; it != _timer.end(); ++it) {
-        if (it->first > now_ms) break;
-        Coroutine* co = it->second;
-        if (co->it != _timer.end()) co->it = _timer.end();
+    const size_t m = _io_tasks.size();
+    io_task_t* const t = _io_tasks.data();
+    if (m > 1) {
+        // key: stack id + 1, 0 if the stack need not be saved, then 1 bit for 
+        // not owning the stack, and the index to keep the order of the kernel.
+        for (size_t i = 0; i < m; ++i) {
+            Coroutine* co = t[i].co;
+            uint64 k = 0;
+            if (!co->ds && !co->migrant) {
+                k = (uint64)(co->sid + 1) << 33;
+                if (_stack[co->sid].co != co) k |= (uint64)1 << 32;
+            }
+            t[i].key = k | i;
+        }
+        std::sort(t, t + m, [](const io_task_t& a, const io_task_t& b) { return a.key < b.key; });
+    }
+    for (size_t i = 0; i < m; ++i) this->resume(t[i].co);
+}
+#endif
+
+/*
+ * busy polling 
+ *   - Spin with non-blocking epoll wait for at most _spin_budget us, before 
+ *     blocking in epoll. It saves the cost of sleeping and waking up the thread.
+ *   - The budget is doubled (up to co_busy_poll_us) if an event arrived within 
+ *     co_busy_poll_us, otherwise it is halved, so we spin only when events come 
+ *     frequently.
+ *   - Time spent spinning in each second is limited by co_busy_poll_cpu.
+ */
+int SchedulerImpl::poll() {
+    const int64 max_us = FLG_co_busy_poll_us;
+    if (max_us == 0 || _wait_ms == 0) return _epoll->wait(_wait_ms);
+
+    int n = 0;
+    int64 t = 0;
+    const int64 beg = now::us();
+    if (beg - _spin_beg >= 1000000) { _spin_beg = beg; _spin_us = 0; }
+
+    int64 budget = (int64)_wait_ms * 1000;
+    if (budget > _spin_budget) budget = _spin_budget;
+    if (budget > 0 && _spin_us * 100 < (int64)FLG_co_busy_poll_cpu * 1000000) {
+        do {
+            n = _epoll->wait(0);
+            if (n != 0 || !_task_mgr.empty()) break;
+            t = now::us() - beg;
+        } while (t < budget);
+        t = now::us() - beg;
+        _spin_us += t;
+    }
+
+    if (n == 0 && _task_mgr.empty()) {
+        uint32 ms = _wait_ms;
+        if (ms != (uint32)-1) ms = ms > (uint32)(t / 1000) ? ms - (uint32)(t / 1000) : 0;
+        n = _epoll->wait(ms);
+        t = now::us() - beg;
+    }
+
+    if (n > 0 && t <= max_us) {
+        _spin_budget = _spin_budget * 2 + 1;
+        if (_spin_budget > max_us) _spin_budget = max_us;
+    } else {
+        _spin_budget >>= 1;
+    }
+    return n;
+}
+
+bool SchedulerImpl::has_prio_tasks(
+    const co::array<Closure*>& new_tasks, const co::array<Coroutine*>& ready_tasks
+) const {
+    for (size_t i = 0; i < new_tasks.size(); ++i) {
+        if (task_prio(new_tasks[i]) != prio_normal) return true;
+    }
+    for (size_t i = 0; i < ready_tasks.size(); ++i) {
+        if (ready_tasks[i]->prio != prio_normal) return true;
+    }
+    return false;
+}
+
+// For each priority from high to low, resume the new tasks, then the ready tasks.
+void SchedulerImpl::resume_prio_tasks(
+    co::array<Closure*>& new_tasks, co::array<Coroutine*>& ready_tasks
+) {
+    static const int order[] = { prio_high, prio_normal, prio_low };
+    for (size_t i = 0; i < new_tasks.size(); ++i) {
+        _prio_new_tasks[task_prio(new_tasks[i])].push_back(new_tasks[i]);
+    }
+    for (size_t i = 0; i < ready_tasks.size(); ++i) {
+        _prio_ready_tasks[ready_tasks[i]->prio].push_back(ready_tasks[i]);
+    }
+    new_tasks.clear();
+    ready_tasks.clear();
+
+    for (int k = 0; k < 3; ++k) {
+        auto& x = _prio_new_tasks[order[k]];
+        auto& y = _prio_ready_tasks[order[k]];
+        CO_DBG_LOG << ">> resume tasks of priority " << order[k] << ", new: " << x.size() << ", ready: " << y.size();
+        for (size_t i = 0; i < x.size(); ++i) this->resume(this->new_coroutine(x[i]));
+        for (size_t i = 0; i < y.size(); ++i) this->resume(y[i]);
+        x.clear();
+        y.clear();
+    }
+}
+
+bool SchedulerImpl::steal_tasks(co::array<Closure*>& tasks) {
+    const size_t n = _scheds->size();
+    for (size_t i = 1; i < n; ++i) {
+        auto s = (SchedulerImpl*) (*_scheds)[(_id + i) % n];
+        if (!s->idle() && s->_task_mgr.steal_tasks(tasks) > 0) {
+            // the victim may have missed the rest while it was out of its list
+            if (s->_task_mgr.has_lockfree_stealable_tasks()) s->_epoll->signal();
+            CO_DBG_LOG << ">> steal tasks from scheduler " << s->id() << ", num: " << tasks.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+void SchedulerImpl::wake_idle_peer() {
+    const size_t n = _scheds->size();
+    for (size_t i = 1; i < n; ++i) {
+        auto s = (SchedulerImpl*) (*_scheds)[(_id + i) % n];
+        if (s->idle()) { s->_epoll->signal(); return; }
+    }
+}
+
+#ifdef _MSC_VER
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return r;
+}
+#else
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    return __builtin_ctz(x);
+}
+#endif
+
+TimerManager::TimerManager() : _free(0), _now(now::ms()), _count(0), _n0(0) {
+    for (int i = 0; i < SLOT_NUM; ++i) _slots[i].next = _slots[i].prev = &_slots[i];
+    memset(_bits, 0, sizeof(_bits));
+}
+
+TimerManager::~TimerManager() {
+    for (int i = 0; i < SLOT_NUM; ++i) {
+        TimerLink* const h = &_slots[i];
+        for (TimerLink* x = h->next; x != h;) {
+            TimerLink* next = x->next;
+            co::free(x, sizeof(TimerNode));
+            x = next;
+        }
+    }
+    while (_free) {
+        TimerNode* next = (TimerNode*) _free->next;
+        co::free(_free, sizeof(TimerNode));
+        _free = next;
+    }
+}
+
+void TimerManager::add_node(TimerNode* node) {
+    uint32 i;
+    int64 d = node->expire - _now;
+    if (d < 0) {
+        i = DUE_SLOT;
+    } else if (d < L0_SIZE) {
+        i = (uint32)(node->expire & L0_MASK);
+        _bits[i >> 5] |= (1u << (i & 31));
+        ++_n0;
+    } else {
+        const int64 max_d = ((int64)1 << (L0_BITS + LN_BITS * (LEVELS - 1))) - 1;
+        if (d > max_d) d = max_d;
+        const int64 e = _now + d;
+        uint32 level = 1;
+        while (d >= ((int64)1 << (L0_BITS + LN_BITS * level))) ++level;
+        const uint32 shift = L0_BITS + LN_BITS * (level - 1);
+        i = L0_SIZE + LN_SIZE * (level - 1) + (uint32)((e >> shift) & LN_MASK);
+    }
+
+    TimerLink* const h = &_slots[i];
+    node->slot = i;
+    node->next = h;
+    node->prev = h->prev;
+    h->prev->next = node;
+    h->prev = node;
+}
+
+void TimerManager::cascade() {
+    for (uint32 level = 1; level < LEVELS; ++level) {
+        const uint32 shift = L0_BITS + LN_BITS * (level - 1);
+        const uint32 x = (uint32)((_now >> shift) & LN_MASK);
+        TimerLink* const h = &_slots[L0_SIZE + LN_SIZE * (level - 1) + x];
+        if (h->next != h) {
+            TimerLink* p = h->next;
+            h->prev->next = 0;
+            h->next = h->prev = h;
+            while (p) {
+                TimerLink* next = p->next;
+                this->add_node((TimerNode*)p);
+                p = next;
+            }
+        }
+        if (x != 0) break;
+    }
+}
+
+void TimerManager::expire(uint32 i, co::array<Coroutine*>& res) {
+    TimerLink* const h = &_slots[i];
+    if (h->next == h) return;
+
+    TimerLink* p = h->next;
+    h->prev->next = 0;
+    h->next = h->prev = h;
+    const bool l0 = i < L0_SIZE;
+    if (l0) _bits[i >> 5] &= ~(1u << (i & 31));
+
+    while (p) {
+        TimerNode* node = (TimerNode*)p;
+        p = p->next;
+        if (l0) --_n0;
+        --_count;
+
+        Coroutine* co = node->co;
+        if (co->it != this->end()) co->it = this->end();
         if (!co->waitx) {
             res.push_back(co);
         } else {
@@ -204,15 +746,289 @@ uint32 TimerManager::check_timeout(co::array<Coroutine*>& res) {
                 res.push_back(co);
             }
         }
+
+        node->next = _free;
+        _free = node;
     }
+}
 
-    if (it != _timer.begin()) {
-        if (_it != _timer.end() && _it->first <= now_ms) _it = it;
-        _timer.erase(_timer.begin(), it);
+uint32 TimerManager::next_slot(uint32 i) const {
+    uint32 w = i >> 5;
+    uint32 x = _bits[w] & (~0u << (i & 31));
+    for (uint32 k = 0; k <= L0_SIZE / 32; ++k) {
+        if (x) return (((w << 5) + _find_lsb(x)) - i) & L0_MASK;
+        w = (w + 1) & (L0_SIZE / 32 - 1);
+        x = _bits[w];
     }
+    return 0; // never reach here, as _n0 > 0
+}
+
+uint32 TimerManager::check_timeout(co::array<Coroutine*>& res, int64 now_ms) {
+    if (_count == 0) return (uint32)-1;
+
+    this->expire(DUE_SLOT, res);
+    while (_now <= now_ms) {
+        if ((_now & L0_MASK) == 0) this->cascade();
+        if (_n0 == 0) {
+            // no timers on level 0, skip to the next cascade point
+            const int64 x = (_now | L0_MASK) + 1;
+            _now = x <= now_ms ? x : now_ms + 1;
+            continue;
+        }
+        this->expire((uint32)(_now & L0_MASK), res);
+        ++_now;
+    }
+
+    if (_count == 0) return (uint32)-1;
+
+    // wake up at the next cascade point if there are timers in upper levels
+    int64 next = _count > _n0 ? ((_now + L0_MASK) & ~(int64)L0_MASK) : MAX_INT64;
+    if (_n0 > 0) {
+        const int64 x = _now + this->next_slot((uint32)(_now & L0_MASK));
+        if (x < next) next = x;
+    }
+    return (uint32)(next - now_ms);
+}
+
+// parse a cpu list like "0-3,8,10-11"
+static co::vector<int> parse_cpus(const fastring& s) {
+    co::vector<int> cpus;
+    const int ncpu = os::cpunum();
+    auto v = str::split(s, ',');
+    for (size_t i = 0; i < v.size(); ++i) {
+        auto x = str::split(v[i], '-', 1);
+        if (x.empty()) continue;
+        const int beg = str::to_int32(x[0]);
+        const int end = x.size() > 1 ? str::to_int32(x[1]) : beg;
+        for (int k = beg; k <= end; ++k) {
+            if (0 <= k && k < ncpu) cpus.push_back(k);
+        }
+    }
+    return cpus;
+}
+
+// cpus for the schedulers, empty if schedulers are not bound to cpus.
+co::vector<int> sched_cpus() {
+    if (!FLG_co_sched_cpus.empty()) {
+        auto cpus = parse_cpus(FLG_co_sched_cpus);
+        ELOG_IF(cpus.empty()) << "invalid co_sched_cpus: " << FLG_co_sched_cpus;
+        return cpus;
+    }
+
+    co::vector<int> cpus;
+    if (!FLG_co_sched_numa_spread) return cpus;
+
+    // take cpus from each node in turn: n0.c0, n1.c0, n0.c1, n1.c1...
+    const int nnode = os::numa_num();
+    const int ncpu = os::cpunum();
+    co::vector<co::vector<int>> nodes(nnode);
+    for (int i = 0; i < ncpu; ++i) {
+        const int x = os::numa_node(i);
+        nodes[x < nnode ? x : 0].push_back(i);
+    }
+    for (size_t k = 0; cpus.size() < (size_t)ncpu; ++k) {
+        for (int i = 0; i < nnode; ++i) {
+            if (k < nodes[i].size()) cpus.push_back(nodes[i][k]);
+        }
+    }
+    return cpus;
+}
+
+// The handler only sets a flag and wakes up scheduler 0, which is safe in a
+// signal handler, the report is made in the scheduler thread.
+static SchedulerImpl* g_prof_sched = 0;
+
+static void on_prof_signal(int) {
+    atomic_store(&g_prof_dump, true, mo_relaxed);
+    if (g_prof_sched) g_prof_sched->wakeup();
+}
+
+#ifndef _WIN32
+// The watchdog sends this signal to a blocked scheduler thread, the handler 
+// saves pcs of the coroutine running in that thread. They are symbolized and
+// logged later by the watchdog, as the thread goes on running after it, and
+// the coroutine may have been interrupted in malloc() or the logger.
+static const int kStallSignal = SIGURG;
+
+static void on_stall_signal(int) {
+    SchedulerImpl* const s = current_sched();
+    if (s) s->save_stall_stack();
+}
+
+void SchedulerImpl::save_stall_stack() {
+    if (atomic_load(&_stall_state, mo_acquire) != 1) return;
+    auto st = ___::log::stack_trace();
+    // skip save_stall_stack() and the handler
+    _stall_depth = st ? st->get_pcs(_stall_pcs, 32, 2) : 0;
+    atomic_store(&_stall_state, 2u, mo_release);
+}
+
+void SchedulerImpl::log_stall_stack() {
+    if (atomic_load(&_stall_state, mo_acquire) != 2) return;
+    auto st = ___::log::stack_trace();
+    fastream s(1024);
+    s << "stack of the coroutine blocking scheduler " << _id << ":\n";
+    for (int d = 0; d < _stall_depth; ++d) {
+        s << "    #" << d << "  in ";
+        st->symbolize(_stall_pcs[d], &s);
+        s << '\n';
+    }
+    ELOG << s;
+    atomic_store(&_stall_state, 0u, mo_release);
+}
+#endif
+
+void SchedulerImpl::on_stall(int64 ms) {
+    atomic_inc(&_stats.stalls, mo_relaxed);
+    Coroutine* co = atomic_load(&_running, mo_relaxed);
+    ELOG << "scheduler " << _id << " is blocked by coroutine " << (co ? co->id : 0)
+         << " for " << ms << " ms without yielding";
+  #ifndef _WIN32
+    // the stack saved by the handler is logged in the next round of watch()
+    if (atomic_load(&_stall_state, mo_acquire) == 0) {
+        atomic_store(&_stall_state, 1u, mo_release);
+        pthread_kill(_thread, kStallSignal);
+    }
+  #endif
+}
+
+void SchedulerManager::move_tasks(SchedulerImpl* s) {
+    co::array<Closure*> tasks;
+    if (s->take_stealable_tasks(tasks) == 0) return;
+
+    // put them to the other active schedulers that are not blocked
+    const size_t n = this->active_num();
+    for (size_t i = 1; i < n; ++i) {
+        auto x = (SchedulerImpl*) _scheds[(s->id() + i) % n];
+        if (!(x->run_seq() & 1) || x->idle()) {
+            x->add_new_tasks(tasks.data(), tasks.size(), true);
+            ELOG << "move " << tasks.size() << " tasks from scheduler " << s->id() << " to " << x->id();
+            return;
+        }
+    }
+    s->add_new_tasks(tasks.data(), tasks.size(), true); // all blocked, put them back
+}
+
+// The load is read while it may be changed by other threads, it is a hint and
+// needs no lock. For the least ones, the scan starts from the next scheduler in
+// turn, so that ties are broken in a round-robin way.
+size_t SchedulerManager::pick(sched_policy_t p) {
+    const size_t n = this->active_num();
+    if (n == 1) return 0;
+    auto load = [this, p](size_t i) {
+        auto s = (SchedulerImpl*)_scheds[i];
+        return p == sched_least_queued ? s->queue_load() : s->coroutine_load();
+    };
+
+    if (p == sched_two_choices) {
+        auto& r = co::thread_rand();
+        const size_t a = (size_t)r.next(n);
+        size_t b = (size_t)r.next(n - 1);
+        if (b >= a) ++b;
+        return load(b) < load(a) ? b : a;
+    }
+
+    const size_t x = this->next_index();
+    size_t k = x;
+    uint64 min = load(x);
+    for (size_t i = 1; i < n && min > 0; ++i) {
+        const size_t j = x + i < n ? x + i : x + i - n;
+        const uint64 v = load(j);
+        if (v < min) { min = v; k = j; }
+    }
+    return k;
+}
+
+// The watchdog checks run_seq() of the schedulers periodically. If it is odd and
+// not changed for co_stall_ms, the same coroutine is still running. A coroutine
+// running for co_preempt_ms is asked to yield at its next preempt point.
+void SchedulerManager::watch() {
+    struct watch_t {
+        uint32 seq;
+        int64 since;    // time the seq was first seen
+        bool reported;  // report only once for each stall
+        bool preempted; // ask only once for each run
+    };
+
+    const uint32 ms = FLG_co_stall_ms;
+    const uint32 pms = FLG_co_preempt_ms;
+    const int64 bus = 100000; // period of balance() in us
+    uint32 interval = ms >= 4 ? ms / 4 : 1;
+    if (pms > 0) {
+        const uint32 x = pms >= 4 ? pms / 4 : 1;
+        if (ms == 0 || interval > x) interval = x;
+    }
+    if (_elastic && ((ms == 0 && pms == 0) || interval > bus / 1000)) interval = bus / 1000;
+    co::vector<watch_t> w(_scheds.size());
+    memset(w.data(), 0, sizeof(watch_t) * w.size());
+
+    while (!atomic_load(&_watch_stop, mo_relaxed)) {
+        _watch_ev.wait(interval);
+        if (atomic_load(&_watch_stop, mo_relaxed)) break;
+        const int64 now_us = now::us();
+        if (_elastic && now_us - _balance_us >= bus) this->balance(now_us);
+        if (ms == 0 && pms == 0) continue;
+
+        const int64 now = now_us / 1000;
+        for (size_t i = 0; i < _scheds.size(); ++i) {
+            auto s = (SchedulerImpl*) _scheds[i];
+          #ifndef _WIN32
+            if (ms > 0) s->log_stall_stack();
+          #endif
+            const uint32 seq = s->run_seq();
+            if (!(seq & 1) || seq != w[i].seq) {
+                w[i].seq = seq;
+                w[i].since = now;
+                w[i].reported = false;
+                w[i].preempted = false;
+                continue;
+            }
+            if (pms > 0 && !w[i].preempted && now - w[i].since >= pms) {
+                w[i].preempted = true;
+                s->request_preempt(seq);
+            }
+            if (ms > 0 && !w[i].reported && now - w[i].since >= ms) {
+                w[i].reported = true;
+                s->on_stall(now - w[i].since);
+                if (FLG_co_stall_move_tasks) this->move_tasks(s);
+            }
+        }
+    }
+}
 
-    if (_timer.empty()) return (uint32)-1;
-    return (int) (_timer.begin()->first - now_ms);
+// Load of the active schedulers is the share of time they are not waiting for
+// events in each period. One more scheduler is started, or a parked one is used
+// again, if they are busy for over 80% of the time in 3 periods in a row, and 
+// the last one is parked if they are busy for less than 20% of the time in 50 
+// periods in a row. Coroutines of a parked scheduler still run there.
+void SchedulerManager::balance(int64 now_us) {
+    auto idle_sum = [this, now_us](uint32 m) {
+        int64 x = 0;
+        for (uint32 i = 0; i < m; ++i) x += ((SchedulerImpl*)_scheds[i])->idle_us(now_us);
+        return x;
+    };
+
+    uint32 m = _active; // only changed in this thread
+    const int64 idle = idle_sum(m);
+    const int64 t = (now_us - _balance_us) * m;
+    const int64 busy = t > 0 ? 100 - (idle - _idle_sum) * 100 / t : 0;
+    _balance_us = now_us;
+    _idle_sum = idle;
+    _busy_rounds = busy >= 80 ? _busy_rounds + 1 : 0;
+    _lazy_rounds = busy < 20 ? _lazy_rounds + 1 : 0;
+
+    if (_busy_rounds >= 3 && m < _scheds.size()) {
+        ((SchedulerImpl*)_scheds[m])->start();
+        ++m;
+    } else if (_lazy_rounds >= 50 && m > FLG_co_sched_min) {
+        --m;
+    } else {
+        return;
+    }
+    atomic_store(&_active, m, mo_relaxed);
+    _idle_sum = idle_sum(m);
+    _busy_rounds = _lazy_rounds = 0;
+    DLOG << "active schedulers: " << m << ", busy: " << busy << '%';
 }
 
 SchedulerManager::SchedulerManager() {
@@ -220,15 +1036,58 @@ SchedulerManager::SchedulerManager() {
     co::init_hook();
     if (FLG_co_sched_num == 0 || FLG_co_sched_num > (uint32)os::cpunum()) FLG_co_sched_num = os::cpunum();
     if (FLG_co_stack_size == 0) FLG_co_stack_size = 1024 * 1024;
+    if (FLG_co_shared_stack_num == 0) FLG_co_shared_stack_num = 8;
 
     _n = (uint32)-1;
+    _policy = sched_round_robin;
+    if (FLG_co_sched_policy == "least_queued") {
+        _policy = sched_least_queued;
+    } else if (FLG_co_sched_policy == "least_coroutines") {
+        _policy = sched_least_coroutines;
+    } else if (FLG_co_sched_policy == "two_choices") {
+        _policy = sched_two_choices;
+    } else if (FLG_co_sched_policy != "round_robin") {
+        ELOG << "unknown co_sched_policy: " << FLG_co_sched_policy << ", use round_robin";
+    }
     _r = static_cast<uint32>((1ULL << 32) % FLG_co_sched_num);
     _s = _r == 0 ? (FLG_co_sched_num - 1) : -1;
+    _elastic = FLG_co_sched_min > 0 && FLG_co_sched_min < FLG_co_sched_num;
+    _active = _elastic ? FLG_co_sched_min : FLG_co_sched_num;
+    _idle_sum = 0;
+    _balance_us = now::us();
+    _busy_rounds = _lazy_rounds = 0;
 
     for (uint32 i = 0; i < FLG_co_sched_num; ++i) {
-        SchedulerImpl* s = new SchedulerImpl(i, FLG_co_sched_num, FLG_co_stack_size);
-        s->start();
-        _scheds.push_back(s);
+        _scheds.push_back(new SchedulerImpl(
+            i, FLG_co_sched_num, FLG_co_stack_size, FLG_co_shared_stack_num
+        ));
+    }
+
+    if (FLG_co_profile_signal > 0) {
+        g_prof_sched = (SchedulerImpl*)_scheds[0];
+      #ifdef _WIN32
+        os::signal(FLG_co_profile_signal, on_prof_signal);
+      #else
+        os::signal(FLG_co_profile_signal, on_prof_signal, SA_RESTART);
+      #endif
+    }
+
+    // start the schedulers after all of them were created, as a scheduler 
+    // may access the others to steal tasks. Only the active ones are started,
+    // the others are started by balance(), or when tasks are added to them.
+    const co::vector<int> cpus = sched_cpus();
+    for (size_t i = 0; i < _scheds.size(); ++i) {
+        const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        ((SchedulerImpl*)_scheds[i])->init(&_scheds, cpu);
+    }
+    for (uint32 i = 0; i < _active; ++i) ((SchedulerImpl*)_scheds[i])->start();
+
+    _watch_stop = false;
+    if (FLG_co_stall_ms > 0 || FLG_co_preempt_ms > 0 || _elastic) {
+      #ifndef _WIN32
+        if (FLG_co_stall_ms > 0) os::signal(kStallSignal, on_stall_signal, SA_RESTART | SA_ONSTACK);
+      #endif
+        Thread(&SchedulerManager::watch, this).detach();
     }
 
     is_active() = true;
@@ -256,18 +1115,67 @@ struct Cleanup {
 static Cleanup _gc;
 
 void SchedulerManager::stop() {
+    atomic_store(&_watch_stop, true, mo_relaxed);
+    _watch_ev.signal();
     for (size_t i = 0; i < _scheds.size(); ++i) {
         ((SchedulerImpl*)_scheds[i])->stop();
     }
     atomic_swap(&is_active(), false, mo_acq_rel);
 }
 
+// a scheduler not started yet is started on demand, see co_sched_min
 void Scheduler::go(Closure* cb) {
-    ((SchedulerImpl*)this)->add_new_task(cb);
+    auto s = (SchedulerImpl*)this;
+    s->start();
+    s->add_new_task(cb);
+}
+
+void Scheduler::go(prio_t prio, Closure* cb) {
+    auto s = (SchedulerImpl*)this;
+    s->start();
+    s->add_new_task(prio_task(cb, prio));
+}
+
+void Scheduler::go_n(Closure** cbs, size_t n) {
+    auto s = (SchedulerImpl*)this;
+    s->start();
+    s->add_new_tasks(cbs, n);
+}
+
+sched_stats_t Scheduler::stats() const {
+    return ((const SchedulerImpl*)this)->stats();
+}
+
+const Histogram& Scheduler::loop_histogram() const {
+    return ((const SchedulerImpl*)this)->loop_histogram();
+}
+
+int Scheduler::cpu() const {
+    return ((const SchedulerImpl*)this)->cpu();
 }
 
 void go(Closure* cb) {
-    ((SchedulerImpl*) scheduler_manager()->next_scheduler())->add_new_task(cb);
+    auto s = (SchedulerImpl*) scheduler_manager()->next_scheduler();
+    FLG_co_steal ? s->add_stealable_task(cb) : s->add_new_task(cb);
+}
+
+void go(prio_t prio, Closure* cb) {
+    go(prio_task(cb, prio));
+}
+
+// split the tasks into m parts, one for each scheduler from the next one.
+void go_batch(Closure** cbs, size_t n) {
+    if (n == 0) return;
+    auto sm = scheduler_manager();
+    auto& scheds = sm->schedulers();
+    const size_t m = sm->active_num();
+    const size_t k = (n + m - 1) / m;
+    size_t x = sm->next_index(sm->policy());
+    for (size_t i = 0; i < n; i += k) {
+        auto s = (SchedulerImpl*) scheds[x];
+        s->add_new_tasks(cbs + i, n - i < k ? n - i : k, FLG_co_steal);
+        if (++x == m) x = 0;
+    }
 }
 
 const co::vector<Scheduler*>& schedulers() {
@@ -280,11 +1188,65 @@ Scheduler* next_scheduler() {
     return scheduler_manager()->next_scheduler();
 }
 
+Scheduler* next_scheduler(sched_policy_t p) {
+    return scheduler_manager()->next_scheduler(p);
+}
+
 int scheduler_num() {
     if (is_active()) return (int) scheduler_manager()->schedulers().size();
     return os::cpunum();
 }
 
+fastring profile_report(int n) {
+    co::hash_map<const std::type_info*, ProfEntry> m;
+    auto& s = scheduler_manager()->schedulers();
+    for (size_t i = 0; i < s.size(); ++i) ((SchedulerImpl*)s[i])->profiler().merge_to(m);
+    return make_profile_report(m, n);
+}
+
+void trace_start() {
+    auto& s = scheduler_manager()->schedulers();
+    for (size_t i = 0; i < s.size(); ++i) ((SchedulerImpl*)s[i])->tracer().start(FLG_co_trace_events);
+    atomic_store(&g_tracing, true, mo_release);
+}
+
+void trace_stop() {
+    atomic_store(&g_tracing, false, mo_release);
+}
+
+fastring trace_dump() {
+    auto& s = scheduler_manager()->schedulers();
+    int64 base = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        const int64 t = ((SchedulerImpl*)s[i])->tracer().first_ns();
+        if (t > 0 && (base == 0 || t < base)) base = t;
+    }
+
+    fastream r(4096);
+    bool first = true;
+    r << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (!first) r << ",\n";
+        first = false;
+        r << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i
+          << ",\"args\":{\"name\":\"sched " << i << "\"}}";
+    }
+    for (size_t i = 0; i < s.size(); ++i) {
+        ((SchedulerImpl*)s[i])->tracer().dump(r, (uint32)i, (uint32)s.size(), base, first);
+    }
+    r << "\n]}";
+    return r.str();
+}
+
+void profile_reset() {
+    auto& s = scheduler_manager()->schedulers();
+    for (size_t i = 0; i < s.size(); ++i) ((SchedulerImpl*)s[i])->profiler().clear();
+}
+
+int64 now_ms() {
+    return gSched ? gSched->now_ms() : now::ms();
+}
+
 int scheduler_id() {
     return gSched ? ((SchedulerImpl*)gSched)->id() : -1;
 }
@@ -322,6 +1284,10 @@ void sleep(uint32 ms) {
     gSched ? gSched->sleep(ms) : sleep::ms(ms);
 }
 
+void preempt_point() {
+    if (gSched && gSched->preempt_requested()) gSched->preempt();
+}
+
 bool timeout() {
     return gSched && gSched->timeout();
 }
@@ -331,4 +1297,35 @@ bool on_stack(const void* p) {
     return gSched->on_stack(p);
 }
 
+void (*g_cls_dtors[kMaxClsKeys])(void*);
+static int g_cls_keys = 0;
+
+int cls_key(void (*destructor)(void*)) {
+    const int k = atomic_fetch_inc(&g_cls_keys, mo_relaxed);
+    CHECK_LT(k, kMaxClsKeys) << "too many keys for coroutine-local storage";
+    g_cls_dtors[k] = destructor;
+    return k;
+}
+
+void* cls_get(int key) {
+    CHECK(gSched) << "MUST be called in coroutine..";
+    void** const cls = gSched->running()->cls;
+    return cls ? cls[key] : 0;
+}
+
+void cls_set(int key, void* value) {
+    CHECK(gSched) << "MUST be called in coroutine..";
+    Coroutine* const co = gSched->running();
+    if (unlikely(!co->cls)) {
+        co->cls = (void**) co::zalloc(kMaxClsKeys * sizeof(void*)); assert(co->cls);
+    }
+    co->cls[key] = value;
+}
+
+bool migrate(Scheduler* s) {
+    CHECK(gSched) << "MUST be called in coroutine..";
+    ((SchedulerImpl*)s)->start();
+    return gSched->migrate((SchedulerImpl*)s);
+}
+
 } // co
@@ -13,12 +13,16 @@
 #include "co/closure.h"
 #include "co/thread.h"
 #include "co/fastream.h"
+#include "co/histogram.h"
 #include "context/context.h"
+#include "profile.h"
+#include "trace.h"
 
 #if defined(_WIN32)
 #include "epoll/iocp.h"
 #elif defined(__linux__)
 #include "epoll/epoll.h"
+#include "epoll/io_uring.h"
 #else
 #include "epoll/kqueue.h"
 #endif
@@ -26,10 +30,38 @@
 #include <assert.h>
 #include <memory>
 #include <map>
+#include <algorithm>
 
 DEC_uint32(co_sched_num);
+DEC_uint32(co_sched_min);
+DEC_string(co_sched_cpus);
+DEC_bool(co_sched_numa_spread);
 DEC_uint32(co_stack_size);
+DEC_bool(co_dedicated_stack);
+DEC_uint32(co_shared_stack_num);
 DEC_bool(co_debug_log);
+DEC_bool(co_steal);
+DEC_bool(co_lockfree_tasks);
+DEC_bool(co_io_uring);
+DEC_uint32(mem_profile_rate);
+DEC_bool(co_profile);
+DEC_uint32(co_profile_stack_us);
+DEC_uint32(co_stall_ms);
+DEC_uint32(co_preempt_ms);
+DEC_string(co_sched_policy);
+DEC_bool(co_stall_move_tasks);
+DEC_uint32(co_pool_keep_num);
+DEC_uint32(co_pool_stack_max);
+DEC_uint32(co_pool_idle_ms);
+DEC_uint32(co_mem_trim_ms);
+DEC_uint32(co_mem_keep_kb);
+DEC_bool(co_precise_timer);
+DEC_uint32(co_busy_poll_us);
+DEC_uint32(co_busy_poll_cpu);
+DEC_uint32(co_mutex_spin);
+DEC_uint32(co_offload_threads);
+DEC_uint32(co_offload_idle_ms);
+DEC_uint32(co_par_threads);
 
 #define CO_DBG_LOG DLOG_IF(FLG_co_debug_log)
 
@@ -42,7 +74,20 @@ void init_hook();
 void cleanup_hook();
 
 struct Coroutine;
-typedef co::multimap<int64, Coroutine*>::iterator timer_id_t;
+
+struct TimerLink {
+    TimerLink* next;
+    TimerLink* prev;
+};
+
+// timer node in the timing wheel
+struct TimerNode : TimerLink {
+    Coroutine* co;
+    int64 expire; // expiry time in milliseconds
+    uint32 slot;  // index of the slot in the timing wheel
+};
+
+typedef TimerNode* timer_id_t;
 
 /**
  * coroutine state 
@@ -67,48 +112,107 @@ enum co_state_t : uint8 {
     st_timeout = 2,  // timeout
 };
 
-struct waitx_t;
+// header of wait info
+struct waitx_t {
+    Coroutine* co;
+    union { int state; void* dummy; };
+};
 
-struct Coroutine {
+struct Stack {
+    char* p;       // stack pointer 
+    char* top;     // stack top
+    Coroutine* co; // coroutine owns this stack
+    uint64 t;      // when the stack was used last time, in number of resumes
+};
+
+// A dedicated stack is mapped with a guard page below it, and the memory 
+// will be committed by the OS on demand.
+Stack* make_dedicated_stack(size_t size);
+void free_dedicated_stack(Stack* s);
+
+// max number of keys for coroutine-local storage
+const int kMaxClsKeys = 32;
+
+// destructors of coroutine-local storage, indexed by the key
+extern void (*g_cls_dtors[kMaxClsKeys])(void*);
+
+/**
+ * control block of a coroutine
+ *   - Fields touched whenever the coroutine is resumed, suspended or woken up 
+ *     are put together at the beginning. Coroutines are aligned to the cache 
+ *     line, so these fields are in one line, and resuming a coroutine does not 
+ *     pull in the cache lines of data used only on the slow paths. 
+ */
+struct alignas(64) Coroutine {
     Coroutine() { memset(this, 0, sizeof(*this)); }
-    ~Coroutine() { it.~timer_id_t(); stack.~fastream(); }
+    ~Coroutine() {
+        if (ds) free_dedicated_stack(ds);
+        if (cls) co::free(cls, kMaxClsKeys * sizeof(void*));
+        stack.~fastream();
+    }
 
+    // hot fields, in the first cache line
     uint32 id;         // coroutine id
     uint32 sid;        // stack id
-    waitx_t* waitx;    // wait info
     tb_context_t ctx;  // context, a pointer points to the stack bottom
 
-    // for saving stack data of this coroutine
-    union { fastream stack; char _dummy1[sizeof(fastream)]; };
-    union { timer_id_t it;  char _dummy2[sizeof(timer_id_t)]; };
-
     // Once the coroutine starts, we no longer need the cb, and it can
     // be used to store the Scheduler pointer.
     union {
         Closure* cb;   // coroutine function
         Scheduler* s;  // scheduler this coroutine runs in
     };
-};
 
-// header of wait info
-struct waitx_t {
-    Coroutine* co;
-    union { int state; void* dummy; };
+    timer_id_t it;     // timer of this coroutine
+    Coroutine* next;   // next coroutine in the lock-free ready list
+    Stack* ds;         // dedicated stack, NULL if the coroutine uses a shared stack
+    waitx_t* waitx;    // wait info, with the state of the wait
+    int32 prio;        // priority, see co::prio_t
+    bool migrant;      // moving to another scheduler by co::migrate()
+    bool cancelled;    // cancelled by its co::TaskGroup
+
+    // cold fields
+    // for saving stack data of this coroutine
+    union { fastream stack; char _dummy1[sizeof(fastream)]; };
+    int32 io_res;      // result of the io_uring operation of this coroutine
+    const std::type_info* entry; // type of the entry Closure, set if co_profile is true
+    void** cls;        // coroutine-local storage, allocated on the first use
+    Coroutine* wnext;  // next coroutine in the wait list of co::Mutex or co::Event
+    Coroutine* wprev;  // previous coroutine in the wait list of co::Event
+    waitx_t wx;        // wait info for co::Event, so that it needs no allocation
+    void* grp;         // task of the co::TaskGroup this coroutine runs, if any
 };
 
-inline waitx_t* make_waitx(void* co) {
-    waitx_t* w = (waitx_t*) co::alloc(sizeof(waitx_t)); assert(w);
-    w->co = (Coroutine*)co;
-    w->state = st_wait;
-    return w;
+static_assert(offsetof(Coroutine, cancelled) < 64, "hot fields of Coroutine exceed a cache line");
+
+// The priority of a new task is stored in the lowest 2 bits of the Closure 
+// pointer, which are always 0 as a Closure is aligned to at least 4 bytes.
+inline Closure* prio_task(Closure* cb, int prio) {
+    return (Closure*)((size_t)cb | (size_t)prio);
+}
+
+inline int task_prio(Closure* cb) {
+    return (int)((size_t)cb & 3);
+}
+
+inline Closure* task_closure(Closure* cb) {
+    return (Closure*)((size_t)cb & ~(size_t)3);
 }
 
-// pool of Coroutine, using index as the coroutine id.
+/**
+ * pool of Coroutine, using index as the coroutine id. 
+ *   - A pooled coroutine keeps its buffer for saving stack data and its dedicated 
+ *     stack for reuse, unless there are already co_pool_keep_num coroutines in 
+ *     the pool, or the buffer is larger than co_pool_stack_max. 
+ *   - The scheduler calls trim() every co_pool_idle_ms. Coroutines that stayed 
+ *     in the pool during the whole period, which are at the bottom of _ids as it 
+ *     is used as a stack, release the memory they hold.
+ */
 class Copool {
   public:
     // _tb(14, 14) can hold 2^28=256M coroutines.
     Copool()
-        : _tb(14, 14), _ids(1u << 14), _id(0) {
+        : _tb(14, 14), _ids(1u << 14), _id(0), _low(0), _trimmed(0), _bytes(0) {
     }
 
     ~Copool() {
@@ -118,116 +222,525 @@ class Copool {
     Coroutine* pop() {
         if (!_ids.empty()) {
             auto& co = _tb[_ids.pop_back()];
+            const size_t n = _ids.size();
+            if (_low > n) _low = n;
+            if (_trimmed > n) _trimmed = n;
+            _bytes -= held_bytes(&co);
             co.ctx = 0;
             co.stack.clear();
             return &co;
         } else {
             auto& co = _tb[_id];
             co.id = _id++;
-            co.sid = (co.id & 7);
             return &co;
         }
     }
 
     void push(Coroutine* co) {
         _ids.push_back(co->id);
-        if (_ids.size() >= 1024) co->stack.reset();
+        if (_ids.size() >= FLG_co_pool_keep_num) {
+            co->stack.reset();
+            if (co->ds) { free_dedicated_stack(co->ds); co->ds = 0; }
+        } else if (FLG_co_pool_stack_max > 0 && co->stack.capacity() > FLG_co_pool_stack_max) {
+            co->stack.reset();
+        }
+        _bytes += held_bytes(co);
+    }
+
+    // release memory held by coroutines not used since the last trim
+    void trim() {
+        for (size_t i = _trimmed; i < _low; ++i) {
+            Coroutine* co = &_tb[_ids[i]];
+            _bytes -= held_bytes(co);
+            co->stack.reset();
+            if (co->ds) { free_dedicated_stack(co->ds); co->ds = 0; }
+        }
+        if (_trimmed < _low) _trimmed = _low;
+        _low = _ids.size();
     }
 
+    // bytes of memory held by coroutines in the pool
+    size_t bytes() const { return _bytes; }
+
+    // number of coroutines alive
+    size_t alive() const { return _id - _ids.size(); }
+
+    // number of coroutines in the pool
+    size_t pooled() const { return _ids.size(); }
+
     Coroutine* operator[](size_t i) {
         return &_tb[i];
     }
 
+  private:
+    static size_t held_bytes(Coroutine* co) {
+        return co->stack.capacity() + (co->ds ? co->ds->top - co->ds->p : 0);
+    }
+
   private:
     co::table<Coroutine> _tb;
     co::array<int> _ids; // id of available coroutines in the table
     int _id;
+    size_t _low;         // min size of _ids since the last trim
+    size_t _trimmed;     // coroutines in _ids[0, _trimmed) hold no memory
+    size_t _bytes;       // see bytes()
 };
 
-// Tasks may be added from any thread. We need a Mutex here.
+/**
+ * a lock-free list for multiple producers 
+ *   - T MUST have a member `T* next`, which is used to link the nodes. 
+ *   - Any thread can push nodes into the list, and take all nodes at once with 
+ *     pop_all(). As nodes are never popped one by one, there is no ABA problem, 
+ *     and it is safe to call pop_all() from multiple threads.
+ */
+template <typename T>
+class LockFreeList {
+  public:
+    LockFreeList() : _head(0) {}
+    ~LockFreeList() = default;
+
+    bool empty() const { return atomic_load(&_head, mo_relaxed) == 0; }
+
+    void push(T* x) { this->push(x, x); }
+
+    // push a list linked from @first to @last
+    void push(T* first, T* last) {
+        T* h = atomic_load(&_head, mo_relaxed);
+        while (true) {
+            last->next = h;
+            T* o = atomic_cas(&_head, h, first, mo_seq_cst, mo_relaxed);
+            if (o == h) return;
+            h = o;
+        }
+    }
+
+    // take all nodes in the list, return them in FIFO order.
+    T* pop_all() {
+        if (this->empty()) return 0;
+        T* h = atomic_swap(&_head, (T*)0, mo_seq_cst);
+        T* r = 0;
+        while (h) { T* x = h->next; h->next = r; r = h; h = x; }
+        return r;
+    }
+
+  private:
+    T* _head;
+    DISALLOW_COPY_AND_ASSIGN(LockFreeList);
+};
+
+/**
+ * manage tasks of a scheduler 
+ *   - Tasks may be added from any thread. By default, they are pushed into 
+ *     lock-free lists, set co_lockfree_tasks to false to use a Mutex instead. 
+ *   - Tasks added by co::go() are stealable when co_steal is true, while tasks 
+ *     added by Scheduler::go() always run in the specified scheduler.
+ */
 class TaskManager {
   public:
-    TaskManager() = default;
+    TaskManager() : _lockfree(FLG_co_lockfree_tasks) {}
     ~TaskManager() = default;
 
     void add_new_task(Closure* cb) {
+        if (_lockfree) return _xnew_tasks.push(make_task_node(cb));
         ::MutexGuard g(_mtx);
         _new_tasks.push_back(cb);
     }
 
+    void add_stealable_task(Closure* cb) {
+        if (_lockfree) return _xstealable_tasks.push(make_task_node(cb));
+        ::MutexGuard g(_mtx);
+        _stealable_tasks.push_back(cb);
+    }
+
+    // add n tasks with one push or one lock
+    void add_new_tasks(Closure** cbs, size_t n, bool stealable) {
+        if (n == 0) return;
+        if (_lockfree) {
+            // the list is linked from the newest to the oldest
+            TaskNode* first = make_task_node(cbs[n - 1]);
+            TaskNode* last = first;
+            for (size_t i = n - 1; i > 0; --i) {
+                last->next = make_task_node(cbs[i - 1]);
+                last = last->next;
+            }
+            return stealable ? _xstealable_tasks.push(first, last) : _xnew_tasks.push(first, last);
+        }
+        ::MutexGuard g(_mtx);
+        (stealable ? _stealable_tasks : _new_tasks).push_back(cbs, n);
+    }
+
     void add_ready_task(Coroutine* co) {
+        if (_lockfree) return _xready_tasks.push(co);
         ::MutexGuard g(_mtx);
         _ready_tasks.push_back(co);
     }
 
+    // add n coroutines with one push or one lock
+    void add_ready_tasks(Coroutine** cos, size_t n) {
+        if (n == 0) return;
+        if (_lockfree) {
+            // the list is linked from the newest to the oldest
+            Coroutine* const first = cos[n - 1];
+            Coroutine* last = first;
+            for (size_t i = n - 1; i > 0; --i) {
+                last->next = cos[i - 1];
+                last = last->next;
+            }
+            return _xready_tasks.push(first, last);
+        }
+        ::MutexGuard g(_mtx);
+        _ready_tasks.push_back(cos, n);
+    }
+
     void get_all_tasks(
         co::array<Closure*>& new_tasks,
         co::array<Coroutine*>& ready_tasks
     ) {
+        if (_lockfree) {
+            take_tasks(_xnew_tasks.pop_all(), new_tasks);
+            take_tasks(_xstealable_tasks.pop_all(), new_tasks);
+            for (Coroutine* co = _xready_tasks.pop_all(); co;) {
+                ready_tasks.push_back(co);
+                co = co->next;
+            }
+            return;
+        }
+
         ::MutexGuard g(_mtx);
         if (!_new_tasks.empty()) _new_tasks.swap(new_tasks);
+        if (!_stealable_tasks.empty()) {
+            if (new_tasks.empty()) {
+                _stealable_tasks.swap(new_tasks);
+            } else {
+                new_tasks.push_back(_stealable_tasks.data(), _stealable_tasks.size());
+                _stealable_tasks.clear();
+            }
+        }
         if (!_ready_tasks.empty()) _ready_tasks.swap(ready_tasks);
     }
- 
+
+    // check if there is no task, without taking them out.
+    bool empty() {
+        if (_lockfree) {
+            return _xnew_tasks.empty() && _xstealable_tasks.empty() && _xready_tasks.empty();
+        }
+        ::MutexGuard g(_mtx);
+        return _new_tasks.empty() && _stealable_tasks.empty() && _ready_tasks.empty();
+    }
+
+    // steal about half of the stealable tasks, they will be pushed into @tasks.
+    // return number of tasks stolen.
+    size_t steal_tasks(co::array<Closure*>& tasks) {
+        if (_lockfree) return this->steal_lockfree_tasks(tasks);
+        ::MutexGuard g(_mtx);
+        const size_t n = (_stealable_tasks.size() + 1) >> 1;
+        for (size_t i = 0; i < n; ++i) tasks.push_back(_stealable_tasks.pop_back());
+        return n;
+    }
+
+    // whether stealable tasks are left in the lock-free list, a thief checks it
+    // after the steal, see steal_lockfree_tasks().
+    bool has_lockfree_stealable_tasks() const {
+        return _lockfree && !_xstealable_tasks.empty();
+    }
+
+    // take all the stealable tasks, return number of tasks taken.
+    size_t take_stealable_tasks(co::array<Closure*>& tasks) {
+        const size_t n = tasks.size();
+        if (_lockfree) {
+            take_tasks(_xstealable_tasks.pop_all(), tasks);
+            return tasks.size() - n;
+        }
+        ::MutexGuard g(_mtx);
+        tasks.push_back(_stealable_tasks.data(), _stealable_tasks.size());
+        _stealable_tasks.clear();
+        return tasks.size() - n;
+    }
+
+  private:
+    struct TaskNode {
+        TaskNode* next;
+        Closure* cb;
+    };
+
+    static TaskNode* make_task_node(Closure* cb) {
+        TaskNode* x = (TaskNode*) co::alloc(sizeof(TaskNode)); assert(x);
+        x->cb = cb;
+        return x;
+    }
+
+    static void take_tasks(TaskNode* x, co::array<Closure*>& tasks) {
+        while (x) {
+            TaskNode* next = x->next;
+            tasks.push_back(x->cb);
+            co::free(x, sizeof(TaskNode));
+            x = next;
+        }
+    }
+
+    // take the older half, and push the rest back to the list. The list is
+    // empty for a moment, the owner may find nothing and go to sleep, so the
+    // thief MUST wake it up if tasks are left, see SchedulerImpl::steal_tasks().
+    size_t steal_lockfree_tasks(co::array<Closure*>& tasks) {
+        TaskNode* x = _xstealable_tasks.pop_all();
+        if (!x) return 0;
+
+        size_t m = 0;
+        for (TaskNode* p = x; p; p = p->next) ++m;
+
+        TaskNode* rest = x;
+        const size_t n = (m + 1) >> 1;
+        for (size_t i = 0; i < n; ++i) rest = rest->next;
+
+        // pop_all() returns nodes from the oldest to the newest, while the list
+        // links them from the newest, so we reverse the rest before pushing
+        // them back.
+        TaskNode* first = 0;
+        TaskNode* last = rest;
+        while (rest) { TaskNode* p = rest->next; rest->next = first; first = rest; rest = p; }
+        if (first) _xstealable_tasks.push(first, last);
+
+        for (size_t i = 0; i < n; ++i) {
+            TaskNode* next = x->next;
+            tasks.push_back(x->cb);
+            co::free(x, sizeof(TaskNode));
+            x = next;
+        }
+        return n;
+    }
+
   private:
+    const bool _lockfree;
+    LockFreeList<TaskNode> _xnew_tasks;
+    LockFreeList<TaskNode> _xstealable_tasks;
+    LockFreeList<Coroutine> _xready_tasks;
+
     ::Mutex _mtx;
     co::array<Closure*> _new_tasks;
+    co::array<Closure*> _stealable_tasks;
     co::array<Coroutine*> _ready_tasks;
 };
 
 inline fastream& operator<<(fastream& fs, const timer_id_t& id) {
-    return fs << *(void**)(&id);
+    return fs << (void*)id;
 }
 
-// Timer must be added in the scheduler thread. We need no lock here.
+/**
+ * hierarchical timing wheel with a resolution of 1 ms 
+ *   - Timer must be added in the scheduler thread. We need no lock here. 
+ *   - Level 0 has 256 slots of 1 ms. Level 1, 2, 3 have 64 slots each, and 
+ *     cover about 16 s, 17 min, 18 h. A timer beyond that is put in the last 
+ *     level, and it will be added again when its slot is cascaded. 
+ *   - Timers already due when added, eg. sleep(0), are put in a special slot, 
+ *     which will be checked first by check_timeout(). 
+ *   - add_timer() and del_timer() are O(1), and the nodes are reused.
+ */
 class TimerManager {
   public:
-    TimerManager() : _timer(), _it(_timer.end()) {}
-    ~TimerManager() {}
+    TimerManager();
+    ~TimerManager();
+
+    // add a timer for @co, which will expire at (now_ms + ms)
+    timer_id_t add_timer(uint32 ms, Coroutine* co, int64 now_ms) {
+        TimerNode* node = _free;
+        if (node) {
+            _free = (TimerNode*) node->next;
+        } else {
+            node = (TimerNode*) co::alloc(sizeof(TimerNode)); assert(node);
+        }
 
-    timer_id_t add_timer(uint32 ms, Coroutine* co) {
-        return _it = _timer.insert(_it, std::make_pair(now::ms() + ms, co));
+        if (_count++ == 0) _now = now_ms;
+        node->co = co;
+        node->expire = now_ms + ms;
+        this->add_node(node);
+        return node;
     }
 
     void del_timer(const timer_id_t& it) {
-        if (_it == it) ++_it;
-        _timer.erase(it);
+        this->unlink(it);
+        --_count;
+        it->next = _free;
+        _free = it;
     }
 
     timer_id_t end() {
-        return _timer.end();
+        return 0;
     }
 
     // return time(ms) to wait for the next timeout.
     // all timedout coroutines will be pushed into @res.
-    uint32 check_timeout(co::array<Coroutine*>& res);
+    uint32 check_timeout(co::array<Coroutine*>& res, int64 now_ms);
 
   private:
-    co::multimap<int64, Coroutine*> _timer;        // timed-wait tasks: <time_ms, co>
-    co::multimap<int64, Coroutine*>::iterator _it; // make insert faster with this hint
-};
+    enum {
+        L0_BITS = 8,
+        LN_BITS = 6,
+        LEVELS = 4,
+        L0_SIZE = 1 << L0_BITS,
+        LN_SIZE = 1 << LN_BITS,
+        L0_MASK = L0_SIZE - 1,
+        LN_MASK = LN_SIZE - 1,
+        DUE_SLOT = L0_SIZE + LN_SIZE * (LEVELS - 1), // for timers already due
+        SLOT_NUM = DUE_SLOT + 1,
+    };
 
-struct Stack {
-    char* p;       // stack pointer 
-    char* top;     // stack top
-    Coroutine* co; // coroutine owns this stack
+    // put the node into a slot according to its expiry time
+    void add_node(TimerNode* node);
+
+    // remove the node from its slot
+    void unlink(TimerNode* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (node->slot < L0_SIZE) {
+            --_n0;
+            const uint32 i = node->slot;
+            if (_slots[i].next == &_slots[i]) _bits[i >> 5] &= ~(1u << (i & 31));
+        }
+    }
+
+    // move timers in the upper levels down, called when _now % 256 == 0
+    void cascade();
+
+    // expire all timers in the slot
+    void expire(uint32 i, co::array<Coroutine*>& res);
+
+    // offset from slot @i to the next non-empty slot on level 0
+    uint32 next_slot(uint32 i) const;
+
+  private:
+    TimerLink _slots[SLOT_NUM];
+    uint32 _bits[L0_SIZE / 32]; // bitmap of non-empty slots on level 0
+    TimerNode* _free;           // free nodes for reuse
+    int64 _now;                 // the next tick(ms) to process
+    size_t _count;              // number of timers
+    size_t _n0;                 // number of timers on level 0
 };
 
+class SchedulerImpl;
+
+// the scheduler running in the current thread
+extern __thread SchedulerImpl* gSched;
+
+// cpus for the schedulers by co_sched_cpus or co_sched_numa_spread, empty if
+// they are not bound to cpus, threads of co::parallel_for() use them too.
+co::vector<int> sched_cpus();
+
 /**
  * coroutine scheduler 
  *   - A scheduler will loop in a single thread.
  */
 class SchedulerImpl : public co::Scheduler {
   public:
-    SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size);
+    SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size, uint32 stack_num);
     ~SchedulerImpl();
 
+    // time of each round running tasks, it is safe to call from any thread.
+    const Histogram& loop_histogram() const { return _loop_hist; }
+
+    // get a snapshot of the statistics, it is safe to call from any thread.
+    sched_stats_t stats() const {
+        sched_stats_t x;
+        x.resumes = atomic_load(&_stats.resumes, mo_relaxed);
+        x.stack_saves = atomic_load(&_stats.stack_saves, mo_relaxed);
+        x.bytes_copied = atomic_load(&_stats.bytes_copied, mo_relaxed);
+        x.max_stack_size = atomic_load(&_stats.max_stack_size, mo_relaxed);
+        x.idle_us = atomic_load(&_stats.idle_us, mo_relaxed);
+        x.stalls = atomic_load(&_stats.stalls, mo_relaxed);
+        x.preempts = atomic_load(&_stats.preempts, mo_relaxed);
+        x.pool_bytes = atomic_load(&_stats.pool_bytes, mo_relaxed);
+        x.coroutines = atomic_load(&_stats.coroutines, mo_relaxed);
+        x.pooled = atomic_load(&_stats.pooled, mo_relaxed);
+        x.queued = atomic_load(&_stats.queued, mo_relaxed);
+        return x;
+    }
+
     // id of this scheduler
     uint32 id() const { return _id; }
 
+    // the cpu bound to, -1 for none
+    int cpu() const { return _cpu; }
+
+    // whether the scheduler thread was started, see co_sched_min
+    bool started() const { return atomic_load(&_started, mo_acquire); }
+
+    // start the scheduler thread, it is started only once.
+    void start() {
+        if (!atomic_load(&_started, mo_relaxed) && atomic_bool_cas(&_started, false, true)) {
+            Thread(&SchedulerImpl::loop, this).detach();
+        }
+    }
+
+    // idle time in us so far, including the current wait for events, as
+    // _stats.idle_us is updated only after the wait.
+    int64 idle_us(int64 now_us) const {
+        const int64 b = atomic_load(&_poll_beg, mo_relaxed);
+        const int64 x = atomic_load(&_stats.idle_us, mo_relaxed);
+        return b > 0 && now_us > b ? x + (now_us - b) : x;
+    }
+
+    // time in milliseconds cached in each round of the scheduler, or the 
+    // current time if co_precise_timer is true.
+    int64 now_ms() const {
+        return FLG_co_precise_timer ? now::ms() : _now_ms;
+    }
+
     // the current running coroutine
     Coroutine* running() const { return _running; }
 
+    // Add a callback called every @ms milliseconds by the scheduler thread, out 
+    // of coroutines, e.g. to release idle resources. It MUST be called in the 
+    // scheduler thread, so does del_tick().
+    void add_tick(void (*f)(void*), void* arg, uint32 ms) {
+        tick_t t = { f, arg, ms, _now_ms + ms };
+        _ticks.push_back(t);
+    }
+
+    // remove callbacks added with @arg
+    void del_tick(void* arg) {
+        for (size_t i = _ticks.size(); i > 0; --i) {
+            if (_ticks[i - 1].arg == arg) _ticks.remove(i - 1);
+        }
+    }
+
+    // sequence number of coroutine runs, it is odd while a coroutine is running.
+    // The watchdog uses it to find schedulers blocked by a coroutine.
+    uint32 run_seq() const { return atomic_load(&_run_seq, mo_acquire); }
+
+    // called by the watchdog thread, when the current coroutine has run for 
+    // @ms milliseconds without yielding.
+    void on_stall(int64 ms);
+
+  #ifndef _WIN32
+    // called in the scheduler thread by the signal handler, only pcs of the 
+    // current stack are saved, nothing is allocated or locked here. 
+    void save_stall_stack();
+
+    // called by the watchdog thread, log the stack saved by save_stall_stack().
+    void log_stall_stack();
+  #endif
+
+    // called by the watchdog thread, when the coroutine of run @seq has run for
+    // co_preempt_ms milliseconds without yielding.
+    void request_preempt(uint32 seq) { atomic_store(&_preempt_seq, seq, mo_relaxed); }
+
+    // whether the current coroutine was asked to yield by the watchdog, it is
+    // never true out of coroutines as the run_seq() is even then.
+    bool preempt_requested() const {
+        return atomic_load(&_preempt_seq, mo_relaxed) == _run_seq;
+    }
+
+    // yield the current coroutine, and resume it in the next round
+    void preempt() {
+        _stats.preempts++;
+        this->add_ready_task(_running);
+        this->yield();
+    }
+
+    // take all stealable tasks not started yet, called by the watchdog thread.
+    size_t take_stealable_tasks(co::array<Closure*>& tasks) {
+        return _task_mgr.take_stealable_tasks(tasks);
+    }
+
     // id of the current running coroutine
     int coroutine_id() const {
         return _sched_num * (_running->id - 1) + _id;
@@ -235,52 +748,151 @@ class SchedulerImpl : public co::Scheduler {
 
     // check whether a pointer is on the stack of the coroutine
     bool on_stack(const void* p) const {
-        Stack* const s =  &_stack[_running->sid];
+        Stack* const s = this->stack_of(_running);
         return (s->p <= (char*)p) && ((char*)p < s->top);
     }
 
+    // check whether a pointer is on the shared stack of the current coroutine,
+    // which may be saved and reused by other coroutines once it yielded.
+    bool on_shared_stack(const void* p) const {
+        return !_running->ds && this->on_stack(p);
+    }
+
+    // the stack a coroutine runs on
+    Stack* stack_of(Coroutine* co) const {
+        return co->ds ? co->ds : &_stack[co->sid];
+    }
+
     // resume a coroutine
     void resume(Coroutine* co);
 
     // suspend the current coroutine
     void yield() {
         if (_running->s != this) _running->s = this;
-        tb_context_jump(_main_co->ctx, _running);
+        if (unlikely(FLG_co_profile_stack_us > 0)) this->check_slow_run();
+        tb_context_from_t from = tb_context_jump(_main_co->ctx, _running);
+        // from.priv is the main coroutine of the scheduler resuming this one,
+        // which may not be this scheduler after co::migrate().
+        ((Coroutine*)from.priv)->ctx = from.ctx;
     }
 
+    // move the current coroutine to scheduler @to, see co::migrate()
+    bool migrate(SchedulerImpl* to);
+
     // add a new task will run in a coroutine later (thread-safe)
+    //   - Tasks added from the scheduler thread itself go into a local queue,
+    //     with no lock and no syscall.
     void add_new_task(Closure* cb) {
+        if (gSched == this) return _local_new_tasks.push_back(cb);
         _task_mgr.add_new_task(cb);
+        atomic_inc(&_posted, mo_relaxed);
+        _epoll->signal();
+    }
+
+    // add a new task that may be stolen by an idle scheduler (thread-safe)
+    void add_stealable_task(Closure* cb) {
+        _task_mgr.add_stealable_task(cb);
+        atomic_inc(&_posted, mo_relaxed);
         _epoll->signal();
+        if (!this->idle()) this->wake_idle_peer();
+    }
+
+    // add n new tasks, with one lock and one wakeup (thread-safe)
+    void add_new_tasks(Closure** cbs, size_t n, bool stealable=false) {
+        if (n == 0) return;
+        if (gSched == this) return _local_new_tasks.push_back(cbs, n);
+        _task_mgr.add_new_tasks(cbs, n, stealable);
+        atomic_add(&_posted, (uint32)n, mo_relaxed);
+        _epoll->signal();
+        if (stealable && !this->idle()) this->wake_idle_peer();
     }
 
     // add a coroutine ready to resume (thread-safe)
     void add_ready_task(Coroutine* co) {
+        if (unlikely(g_tracing)) _tracer.add(tr_ready, co->id, gSched ? gSched->id() + 1 : 0);
+        if (gSched == this) return _local_ready_tasks.push_back(co);
         _task_mgr.add_ready_task(co);
+        atomic_inc(&_posted, mo_relaxed);
+        _epoll->signal();
+    }
+
+    // add n coroutines ready to resume with one wakeup (thread-safe)
+    void add_ready_tasks(Coroutine** cos, size_t n) {
+        if (unlikely(g_tracing)) {
+            for (size_t i = 0; i < n; ++i) _tracer.add(tr_ready, cos[i]->id, gSched ? gSched->id() + 1 : 0);
+        }
+        if (gSched == this) return _local_ready_tasks.push_back(cos, n);
+        _task_mgr.add_ready_tasks(cos, n);
+        atomic_add(&_posted, (uint32)n, mo_relaxed);
         _epoll->signal();
     }
 
+    // tasks waiting to run, those queued in the last round and those added by
+    // other threads since then, see co::sched_least_queued.
+    uint64 queue_load() const {
+        return atomic_load(&_stats.queued, mo_relaxed) + atomic_load(&_posted, mo_relaxed);
+    }
+
+    // coroutines alive and new tasks added since the last round, see 
+    // co::sched_least_coroutines.
+    uint64 coroutine_load() const {
+        return atomic_load(&_stats.coroutines, mo_relaxed) + atomic_load(&_posted, mo_relaxed);
+    }
+
     // sleep for milliseconds in the current coroutine 
     void sleep(uint32 ms) {
+        if (unlikely(_running->cancelled)) ms = 0;
         if (_wait_ms > ms) _wait_ms = ms;
-        (void) _timer_mgr.add_timer(ms, _running);
+        if (unlikely(g_tracing)) _tracer.add(tr_timer, _running->id, ms);
+        _running->it = _timer_mgr.add_timer(ms, _running, this->now_ms());
         this->yield();
     }
 
     // Add a timer for the current coroutine. Users should call yield() to suspend 
     // the coroutine. When the timer expires, the scheduler will resume it again.
     void add_timer(uint32 ms) {
+        if (unlikely(_running->cancelled)) ms = 0;
         if (_wait_ms > ms) _wait_ms = ms;
-        _running->it = _timer_mgr.add_timer(ms, _running);
+        if (unlikely(g_tracing)) _tracer.add(tr_timer, _running->id, ms);
+        _running->it = _timer_mgr.add_timer(ms, _running, this->now_ms());
         CO_DBG_LOG << "co(" << _running << ") add timer " << _running->it << " (" << ms << " ms)" ;
     }
 
+    // wake up the scheduler thread if it is waiting in epoll, it is also safe
+    // to call in a signal handler on linux.
+    void wakeup() { _epoll->signal(); }
+
     // check whether the current coroutine has timed out
     bool timeout() const { return _timeout; }
 
+    // timeout for a wait of the current coroutine. A coroutine of a co::TaskGroup 
+    // always waits with a timer, about 49 days if no timeout is given, so that 
+    // it can be cancelled by expiring the timer.
+    uint32 wait_ms(uint32 ms) const {
+        return (ms != (uint32)-1 || !_running->grp) ? ms : (uint32)-2;
+    }
+
+    // whether the current coroutine was cancelled by its co::TaskGroup
+    bool cancelled() const { return _running && _running->cancelled; }
+
+    // cancel a coroutine of this scheduler, its timer is moved to the slot 
+    // of timers already due, so it times out in this round as it would by then
+    void cancel(Coroutine* co) {
+        co->cancelled = true;
+        if (co->it != _timer_mgr.end()) {
+            _timer_mgr.del_timer(co->it);
+            co->it = _timer_mgr.add_timer(0, co, this->now_ms());
+            _wait_ms = 0;
+        }
+    }
+
+    // whether the scheduler is blocking in epoll wait
+    bool idle() const { return atomic_load(&_idle, mo_relaxed); }
+
     // add an IO event on a socket to epoll for the current coroutine.
     bool add_io_event(sock_t fd, io_event_t ev) {
         CO_DBG_LOG << "co(" << _running << ") add io event fd: " << fd << " ev: " << (int)ev;
+        if (unlikely(g_tracing)) _tracer.add(tr_io_wait, _running->id, (uint32)fd, ev == ev_write);
       #if defined(_WIN32)
         (void) ev; // we do not care what the event is on windows
         return _epoll->add_event(fd);
@@ -299,6 +911,18 @@ class SchedulerImpl : public co::Scheduler {
         ev == ev_read ? _epoll->del_ev_read(fd) : _epoll->del_ev_write(fd);
     }
 
+    // profile data of coroutines in this scheduler
+    Profiler& profiler() { return _prof; }
+
+    // events of this scheduler, recorded while co::trace_start() is in effect
+    Tracer& tracer() { return _tracer; }
+
+  #ifdef __linux__
+    // io_uring of this scheduler, NULL if co_io_uring is false or io_uring 
+    // is not available.
+    IoUring* io_uring() const { return _io_uring; }
+  #endif
+
     // delete all IO events on a socket from the epoll.
     void del_io_event(sock_t fd) {
         CO_DBG_LOG << "co(" << _running << ") del io event, fd: " << fd;
@@ -313,12 +937,27 @@ class SchedulerImpl : public co::Scheduler {
 
     // push a coroutine back to the pool, so it can be reused later.
     void recycle() {
-        _stack[_running->sid].co = 0;
+        if (!_running->ds) _stack[_running->sid].co = 0;
+        if (_running->cls) clear_cls(_running);
         _co_pool.push(_running);
     }
 
-    // start the scheduler thread
-    void start() { Thread(&SchedulerImpl::loop, this).detach(); }
+    // destroy values in coroutine-local storage, the slots are kept for reuse
+    static void clear_cls(Coroutine* co) {
+        for (int i = 0; i < kMaxClsKeys; ++i) {
+            void* const v = co->cls[i];
+            if (v) {
+                co->cls[i] = 0;
+                if (g_cls_dtors[i]) g_cls_dtors[i](v);
+            }
+        }
+    }
+
+    // set the schedulers, and the cpu to bind to if cpu >= 0, before start()
+    void init(const co::vector<Scheduler*>* scheds, int cpu) {
+        _scheds = scheds;
+        _cpu = cpu;
+    }
 
     // stop the scheduler thread
     void stop();
@@ -326,39 +965,184 @@ class SchedulerImpl : public co::Scheduler {
     // the thread function
     void loop();
 
-    // save stack for the coroutine
+    // save stack for the coroutine, not needed for dedicated stacks
     void save_stack(Coroutine* co) {
         if (co) {
+            const size_t n = _stack[co->sid].top - (char*)co->ctx;
             co->stack.clear();
-            co->stack.append(co->ctx, _stack[co->sid].top - (char*)co->ctx);
+            co->stack.append(co->ctx, n);
+            _stats.stack_saves++;
+            _stats.bytes_copied += n;
+            if (_stats.max_stack_size < n) _stats.max_stack_size = n;
+        }
+    }
+
+    // check if there are tasks whose priority is not prio_normal
+    bool has_prio_tasks(
+        const co::array<Closure*>& new_tasks, const co::array<Coroutine*>& ready_tasks
+    ) const;
+
+    // resume tasks in the order of their priorities
+    void resume_prio_tasks(co::array<Closure*>& new_tasks, co::array<Coroutine*>& ready_tasks);
+
+    // take over a coroutine moved from another scheduler, return a Coroutine
+    // of this scheduler with the same context and dedicated stack.
+    Coroutine* adopt(Coroutine* x);
+
+    // capture stack of the current coroutine if it has run longer than
+    // co_profile_stack_us since it was resumed.
+    void check_slow_run();
+
+    // wait for IO events, may spin for a while before blocking in epoll.
+    int poll();
+
+  #if defined(__linux__)
+    // resume coroutines waiting for the @n IO events got by poll(). They are
+    // collected first, and resumed in the order of their shared stacks, the 
+    // owner of a stack first, so that fewer stacks are saved in a batch.
+    void resume_io_tasks(int n);
+  #endif
+
+    // steal tasks from busy schedulers, return true if any task was stolen.
+    bool steal_tasks(co::array<Closure*>& tasks);
+
+    // wake up an idle scheduler, so that it can steal tasks from this one.
+    void wake_idle_peer();
+
+    // choose a shared stack for a coroutine on its first run:
+    //   a free stack first, or the least recently used one.
+    uint32 choose_stack() const {
+        uint32 x = 0;
+        for (uint32 i = 0; i < _stack_num; ++i) {
+            if (_stack[i].co == 0) return i;
+            if (_stack[i].t < _stack[x].t) x = i;
         }
+        return x;
     }
 
     // pop a Coroutine from the pool
     Coroutine* new_coroutine(Closure* cb) {
         Coroutine* co = _co_pool.pop();
-        co->cb = cb;
+        co->cb = task_closure(cb);
+        co->prio = task_prio(cb);
+        co->entry = FLG_co_profile ? &typeid(*co->cb) : 0;
         co->it = _timer_mgr.end();
+        if (FLG_co_dedicated_stack && !co->ds) {
+            co->ds = make_dedicated_stack(_stack_size);
+            co->ds->co = co;
+        }
         return co;
     }
 
   private:
     Epoll* _epoll;
+  #ifdef __linux__
+    IoUring* _io_uring;
+  #endif
     uint32 _wait_ms;     // time in milliseconds the epoll to wait for
     uint32 _id;          // scheduler id
     uint32 _sched_num;   // scheduler num
     uint32 _stack_size;  // size of stack
+    uint32 _stack_num;   // number of shared stacks
+    uint64 _nresume;     // number of resumes, used as time for LRU of stacks
+    int64 _now_ms;       // time cached in each round of the scheduler
     Stack* _stack;       // pointer to stack list
     Coroutine* _main_co; // save the main context
     Coroutine* _running; // the current running coroutine
+    SchedulerImpl* _migrate_to; // target of the coroutine calling migrate()
 
     Copool _co_pool;
     TaskManager _task_mgr;
     TimerManager _timer_mgr;
+    const co::vector<Scheduler*>* _scheds; // all the schedulers
+    sched_stats_t _stats; // statistics, updated by the scheduler thread, except stalls
+    Histogram _loop_hist; // time of each round, recorded by the scheduler thread
+    co::array<Closure*> _local_new_tasks;     // new tasks added in this thread
+    co::array<Coroutine*> _local_ready_tasks; // ready tasks added in this thread
+    co::array<Closure*> _prio_new_tasks[3];     // new tasks of each priority
+    co::array<Coroutine*> _prio_ready_tasks[3]; // ready tasks of each priority
 
     SyncEvent _ev;
     bool _stop;
     bool _timeout;
+    bool _idle;
+    bool _started;       // the thread was started, see start()
+    int _cpu;            // cpu the scheduler thread is bound to, -1 for none
+    int64 _poll_beg;     // time in us the current wait for events began, 0 if not waiting
+
+    int64 _spin_budget;  // time in us to spin in poll(), adjusted adaptively
+    int64 _spin_beg;     // start time of the current period of spin accounting
+    int64 _spin_us;      // time in us spent spinning in the current period
+
+    Profiler _prof;      // profile data of coroutines, used if co_profile is true
+    Tracer _tracer;      // events of coroutines, used if g_tracing is true
+    int64 _run_beg;      // time in us the current coroutine was resumed
+    uint32 _run_seq;     // see run_seq()
+    uint32 _preempt_seq; // run_seq() of the coroutine asked to yield, see co_preempt_ms
+    uint32 _posted;      // tasks added by other threads since the last round, see queue_load()
+    int64 _trim_ms;      // time the coroutine pool was trimmed last time
+
+    struct tick_t {
+        void (*f)(void*);
+        void* arg;
+        uint32 ms;
+        int64 due;
+    };
+    co::array<tick_t> _ticks; // see add_tick()
+  #if defined(__linux__)
+    struct io_task_t {
+        uint64 key; // stack id and whether it owns the stack, see resume_io_tasks()
+        Coroutine* co;
+    };
+    co::array<io_task_t> _io_tasks;
+  #endif
+  #ifndef _WIN32
+    pthread_t _thread;   // the scheduler thread, the watchdog signals it for stack trace
+    void* _stall_pcs[32]; // pcs of the blocking coroutine, see save_stall_stack()
+    int _stall_depth;
+    uint32 _stall_state;  // 1: the signal was sent, 2: pcs were saved
+  #endif
+};
+
+/**
+ * coroutines made ready at once, e.g. by a broadcast of co::Event 
+ *   - They are grouped by scheduler in flush(), each scheduler takes its group 
+ *     with one push (or lock) and one wakeup, instead of one for each of them. 
+ *   - The order of coroutines in the same scheduler is kept. 
+ */
+class ReadyBatch {
+  public:
+    ReadyBatch() : _one(0) {}
+    ~ReadyBatch() { this->flush(); }
+
+    void add(Coroutine* co) {
+        if (!_one) { _one = co; return; }
+        if (_v.empty()) _v.push_back(_one);
+        _v.push_back(co);
+    }
+
+    void flush() {
+        if (_v.empty()) {
+            if (_one) { ((SchedulerImpl*)_one->s)->add_ready_task(_one); _one = 0; }
+            return;
+        }
+
+        std::stable_sort(_v.data(), _v.data() + _v.size(), [](Coroutine* a, Coroutine* b) {
+            return ((SchedulerImpl*)a->s)->id() < ((SchedulerImpl*)b->s)->id();
+        });
+        for (size_t i = 0, j; i < _v.size(); i = j) {
+            Scheduler* const s = _v[i]->s;
+            for (j = i + 1; j < _v.size() && _v[j]->s == s; ++j);
+            ((SchedulerImpl*)s)->add_ready_tasks(&_v[i], j - i);
+        }
+        _v.clear();
+        _one = 0;
+    }
+
+  private:
+    Coroutine* _one;
+    co::array<Coroutine*> _v; // used if there are more than one
+    DISALLOW_COPY_AND_ASSIGN(ReadyBatch);
 };
 
 class SchedulerManager {
@@ -367,10 +1151,35 @@ class SchedulerManager {
     ~SchedulerManager();
 
     Scheduler* next_scheduler() {
-        if (_s != (uint32)-1) return _scheds[atomic_inc(&_n, mo_relaxed) & _s];
+        return _scheds[this->next_index(_policy)];
+    }
+
+    // number of schedulers given new tasks, the first ones of schedulers(), 
+    // it changes with the load if co_sched_min is set.
+    size_t active_num() const {
+        return _elastic ? atomic_load(&_active, mo_relaxed) : _scheds.size();
+    }
+
+    Scheduler* next_scheduler(sched_policy_t p) {
+        return _scheds[this->next_index(p)];
+    }
+
+    // the global policy, see co_sched_policy
+    sched_policy_t policy() const { return _policy; }
+
+    // index of the next scheduler chosen by the policy @p
+    size_t next_index(sched_policy_t p) {
+        if (p == sched_round_robin || this->active_num() == 1) return this->next_index();
+        return this->pick(p);
+    }
+
+    // index of the next scheduler, in a round-robin way
+    size_t next_index() {
+        if (unlikely(_elastic)) return atomic_inc(&_n, mo_relaxed) % atomic_load(&_active, mo_relaxed);
+        if (_s != (uint32)-1) return atomic_inc(&_n, mo_relaxed) & _s;
         uint32 n = atomic_inc(&_n, mo_relaxed);
-        if (n <= ~_r) return _scheds[n % _scheds.size()]; // n <= (2^32 - 1 - r)
-        return _scheds[now::us() % _scheds.size()];
+        if (n <= ~_r) return n % _scheds.size(); // n <= (2^32 - 1 - r)
+        return now::us() % _scheds.size();
     }
 
     const co::vector<Scheduler*>& schedulers() const {
@@ -379,11 +1188,33 @@ class SchedulerManager {
 
     void stop();
 
+  private:
+    // the watchdog thread, see co_stall_ms
+    void watch();
+
+    // move stealable tasks of a blocked scheduler to the others
+    void move_tasks(SchedulerImpl* s);
+
+    // choose a scheduler by the load, for policies other than round robin
+    size_t pick(sched_policy_t p);
+
+    // start or park a scheduler by the load of the active ones, see co_sched_min
+    void balance(int64 now_us);
+
   private:
     co::vector<Scheduler*> _scheds;
     uint32 _n;  // index, initialized as -1
     uint32 _r;  // 2^32 % sched_num
     uint32 _s;  // _r = 0, _s = sched_num-1;  _r != 0, _s = -1;
+    SyncEvent _watch_ev; // wake up the watchdog when stopping
+    bool _watch_stop;
+    sched_policy_t _policy; // see co_sched_policy
+    bool _elastic;       // co_sched_min is set, see balance()
+    uint32 _active;      // number of active schedulers, see active_num()
+    int64 _idle_sum;     // idle time of the active schedulers at the last balance()
+    int64 _balance_us;   // time of the last balance()
+    int _busy_rounds;    // balance() rounds in a row the active schedulers were busy
+    int _lazy_rounds;    // balance() rounds in a row the active schedulers were mostly idle
 };
 
 inline bool& is_active() {
@@ -391,6 +1222,4 @@ inline bool& is_active() {
     return ka;
 }
 
-extern __thread SchedulerImpl* gSched;
-
 } // co
@@ -3,6 +3,33 @@
 #include "close.h"
 #include "scheduler.h"
 #include <unordered_map>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#elif defined(__APPLE__)
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+DEF_uint32(co_zerocopy_min_size, 0, ">>#1 co::send and co::sendv use MSG_ZEROCOPY on linux for data "
+    "of at least this many bytes, 0 to disable, values below 64K are not recommended");
+#endif
 
 namespace co {
 
@@ -79,6 +106,154 @@ int shutdown(sock_t fd, char c) {
     return __sys_api(shutdown)(fd, how);
 }
 
+#ifdef __linux__
+// The kernel may access buffers of an io_uring operation after the coroutine
+// yielded, buffers on a shared stack can't be used then, as the stack may be
+// saved and reused by other coroutines.
+inline bool on_shared_stack(const void* p) {
+    return gSched->on_shared_stack(p);
+}
+
+// wait for the io_uring operation of the current coroutine.
+//   - If it timed out, we cancel it and wait until it is done, so that the
+//     buffers of the operation are not used by the kernel after this call.
+//   - return the result, or -1 with errno set on error. errno is EAGAIN if the 
+//     socket is not ready, the caller should fall back to epoll then.
+int uring_wait(IoUring* u, io_uring_sqe* sqe, uint32 ms) {
+    auto s = gSched;
+    Coroutine* co = s->running();
+    sqe->user_data = (uint64)(size_t)co;
+
+    ms = s->wait_ms(ms);
+    if (ms != (uint32)-1) {
+        s->add_timer(ms);
+        s->yield();
+        if (s->timeout()) {
+            io_uring_sqe* x = u->get_sqe();
+            if (x) {
+                x->opcode = IORING_OP_ASYNC_CANCEL;
+                x->addr = (uint64)(size_t)co;
+            } else {
+                ELOG << "io_uring submission queue is full, can't cancel the operation..";
+            }
+            s->yield();
+            if (co->io_res == -ECANCELED || co->io_res == -EINTR) {
+                errno = s->cancelled() ? ECANCELED : ETIMEDOUT;
+                return -1;
+            }
+        }
+    } else {
+        s->yield();
+    }
+
+    if (co->io_res >= 0) return co->io_res;
+    errno = -co->io_res;
+    return -1;
+}
+
+static sock_t uring_accept(IoUring* u, sock_t fd, void* addr, int* addrlen) {
+    io_uring_sqe* sqe = u->get_sqe();
+    if (!sqe) { errno = EAGAIN; return -1; }
+
+    void* a = addr;
+    int* len = addrlen;
+    char* buf = 0;
+    const int n = addrlen ? *addrlen : 0;
+    if (addr && addrlen && (on_shared_stack(addr) || on_shared_stack(addrlen))) {
+        buf = (char*) co::alloc(sizeof(int) + n);
+        len = (int*)buf;
+        *len = n;
+        a = buf + sizeof(int);
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64)(size_t)a;
+    sqe->addr2 = (uint64)(size_t)len;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    const int r = uring_wait(u, sqe, (uint32)-1);
+
+    if (buf) {
+        if (r >= 0) {
+            memcpy(addr, a, *len < n ? *len : n);
+            *addrlen = *len;
+        }
+        co::free(buf, sizeof(int) + n);
+    }
+    return r;
+}
+
+static int uring_connect(IoUring* u, sock_t fd, const void* addr, int addrlen, int ms) {
+    io_uring_sqe* sqe = u->get_sqe();
+    if (!sqe) { errno = EAGAIN; return -1; }
+
+    void* a = (void*)addr;
+    if (on_shared_stack(addr)) {
+        a = co::alloc(addrlen);
+        memcpy(a, addr, addrlen);
+    }
+
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64)(size_t)a;
+    sqe->off = (uint64)addrlen;
+    const int r = uring_wait(u, sqe, (uint32)ms);
+
+    if (a != addr) co::free(a, addrlen);
+    return r;
+}
+
+static int uring_recv(IoUring* u, sock_t fd, void* buf, int n, int ms) {
+    io_uring_sqe* sqe = u->get_sqe();
+    if (!sqe) { errno = EAGAIN; return -1; }
+
+    char* p = on_shared_stack(buf) ? (char*) co::alloc(n) : (char*)buf;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64)(size_t)p;
+    sqe->len = (uint32)n;
+    const int r = uring_wait(u, sqe, (uint32)ms);
+
+    if (p != buf) {
+        if (r > 0) memcpy(buf, p, r);
+        co::free(p, n);
+    }
+    return r;
+}
+
+// bytes sent will be stored in @sent, even if an error occured.
+static int uring_send(IoUring* u, sock_t fd, const void* buf, int n, int ms, int* sent) {
+    char* p = (char*)buf;
+    if (on_shared_stack(buf)) {
+        p = (char*) co::alloc(n);
+        memcpy(p, buf, n);
+    }
+
+    int r;
+    *sent = 0;
+    do {
+        io_uring_sqe* sqe = u->get_sqe();
+        if (!sqe) { errno = EAGAIN; r = -1; break; }
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64)(size_t)(p + *sent);
+        sqe->len = (uint32)(n - *sent);
+        r = uring_wait(u, sqe, (uint32)ms);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        *sent += r;
+        if (*sent == n) { r = n; break; }
+    } while (true);
+
+    if (p != buf) co::free(p, n);
+    return r;
+}
+#endif
+
 int bind(sock_t fd, const void* addr, int addrlen) {
     return ::bind(fd, (const struct sockaddr*)addr, (socklen_t)addrlen);
 }
@@ -89,6 +264,12 @@ int listen(sock_t fd, int backlog) {
 
 sock_t accept(sock_t fd, void* addr, int* addrlen) {
     CHECK(gSched) << "must be called in coroutine..";
+  #ifdef __linux__
+    if (gSched->io_uring()) {
+        sock_t r = uring_accept(gSched->io_uring(), fd, addr, addrlen);
+        if (r != -1 || errno != EAGAIN) return r;
+    }
+  #endif
     IoEvent ev(fd, ev_read);
 
     do {
@@ -112,8 +293,30 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
     } while (true);
 }
 
+sock_t try_accept(sock_t fd, void* addr, int* addrlen) {
+    sock_t connfd;
+    do {
+      #ifdef SOCK_NONBLOCK
+        connfd = __sys_api(accept4)(fd, (sockaddr*)addr, (socklen_t*)addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      #else
+        connfd = __sys_api(accept)(fd, (sockaddr*)addr, (socklen_t*)addrlen);
+        if (connfd != -1) {
+            co::set_nonblock(connfd);
+            co::set_cloexec(connfd);
+        }
+      #endif
+    } while (connfd == -1 && errno == EINTR);
+    return connfd;
+}
+
 int connect(sock_t fd, const void* addr, int addrlen, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
+  #ifdef __linux__
+    if (gSched->io_uring()) {
+        int r = uring_connect(gSched->io_uring(), fd, addr, addrlen, ms);
+        if (r != -1 || errno != EAGAIN) return r;
+    }
+  #endif
     do {
         int r = __sys_api(connect)(fd, (const sockaddr*)addr, (socklen_t)addrlen);
         if (r == 0) return 0;
@@ -137,6 +340,12 @@ int connect(sock_t fd, const void* addr, int addrlen, int ms) {
 
 int recv(sock_t fd, void* buf, int n, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
+  #ifdef __linux__
+    if (gSched->io_uring()) {
+        int r = uring_recv(gSched->io_uring(), fd, buf, n, ms);
+        if (r != -1 || errno != EAGAIN) return r;
+    }
+  #endif
     IoEvent ev(fd, ev_read);
 
     do {
@@ -189,10 +398,152 @@ int recvfrom(sock_t fd, void* buf, int n, void* addr, int* addrlen, int ms) {
     } while (true);
 }
 
+#ifdef __linux__
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    IoEvent ev(fd, ev_read);
+    do {
+        int r = ::recvmmsg(fd, msgs, (unsigned int)n, 0, NULL);
+        if (r != -1) return r;
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (true);
+}
+
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int sent = 0;
+    IoEvent ev(fd, ev_write);
+    do {
+        int r = ::sendmmsg(fd, msgs + sent, (unsigned int)(n - sent), 0);
+        if (r != -1) {
+            sent += r;
+            if (sent == n) return n;
+            continue;
+        }
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return sent > 0 ? sent : -1;
+        } else if (errno != EINTR) {
+            return sent > 0 ? sent : -1;
+        }
+    } while (true);
+}
+
+// read completion notifications of MSG_ZEROCOPY sends from the error queue,
+// return the number of sends completed
+static uint32 zc_reap(sock_t fd) {
+    uint32 done = 0;
+    char control[128];
+    for (;;) {
+        struct msghdr m;
+        memset(&m, 0, sizeof(m));
+        m.msg_control = control;
+        m.msg_controllen = sizeof(control);
+        if (__sys_api(recvmsg)(fd, &m, MSG_ERRQUEUE) == -1) {
+            if (errno == EINTR) continue;
+            return done;
+        }
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+            if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                  (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) continue;
+            const struct sock_extended_err* e = (const struct sock_extended_err*) CMSG_DATA(c);
+            // sends numbered from ee_info to ee_data (inclusive) are completed
+            if (e->ee_errno == 0 && e->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                done += e->ee_data - e->ee_info + 1;
+            }
+        }
+    }
+}
+
+/**
+ * send with MSG_ZEROCOPY 
+ *   - The kernel sends the data from the user buffer. Coroutines waiting on the 
+ *     socket are woken up by EPOLLERR when there are completion notifications 
+ *     in the error queue, and it returns after all the sends are completed, so 
+ *     that the buffer can be reused or freed by the caller as usual. 
+ *   - Return -2 if MSG_ZEROCOPY is not supported on the socket. 
+ */
+static int64 zc_sendv(sock_t fd, iov_t* iov, int n, int64 total, int ms) {
+    const int v = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) != 0) return -2;
+
+    IoEvent ev(fd, ev_write);
+    uint32 pending = 0; // sends not completed
+    int64 r = total;
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+
+    while (n > 0) {
+        m.msg_iov = iov;
+        m.msg_iovlen = n < IOV_MAX ? n : IOV_MAX;
+        const ssize_t k = __sys_api(sendmsg)(fd, &m, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (k == -1) {
+            const int e = errno;
+            if (e == EINTR) continue;
+            if (e == EWOULDBLOCK || e == EAGAIN) {
+                if (!ev.wait(ms)) { r = -1; break; }
+            } else if (e == ENOBUFS && pending > 0) {
+                // too many pages pinned by the socket, wait for completions
+                pending -= zc_reap(fd);
+                if (pending > 0) ev.wait(1);
+            } else {
+                r = -1;
+                break;
+            }
+            continue;
+        }
+
+        ++pending;
+        size_t x = (size_t)k;
+        while (n > 0 && x >= iov->iov_len) { x -= iov->iov_len; ++iov; --n; }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + x;
+            iov->iov_len -= x;
+        }
+    }
+
+    // The buffer can't be released before the sends are completed. The event
+    // stays registered until ev is destroyed, so it MUST NOT yield in any other
+    // way here. As epoll is edge-triggered, a new notification wakes it up with
+    // EPOLLERR, and the timeout makes it recheck in case of a missed edge.
+    const int64 deadline = ms >= 0 ? now::ms() + ms : 0;
+    while (pending > 0) {
+        pending -= zc_reap(fd);
+        if (pending == 0) break;
+        if (ms >= 0 && now::ms() > deadline) { errno = ETIMEDOUT; r = -1; break; }
+        ev.wait(10);
+    }
+    return r;
+}
+
+static inline bool use_zerocopy(int64 n) {
+    return FLG_co_zerocopy_min_size > 0 && n >= (int64)FLG_co_zerocopy_min_size;
+}
+#endif
+
 int send(sock_t fd, const void* buf, int n, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     const char* s = (const char*) buf;
     int remain = n;
+  #ifdef __linux__
+    if (use_zerocopy(n)) {
+        iov_t v = co::make_iov(buf, n);
+        const int64 r = zc_sendv(fd, &v, 1, n, ms);
+        if (r != -2) return r == -1 ? -1 : n;
+    }
+    if (gSched->io_uring()) {
+        int sent;
+        int r = uring_send(gSched->io_uring(), fd, buf, n, ms, &sent);
+        if (r != -1 || errno != EAGAIN) return r;
+        s += sent;
+        remain -= sent;
+    }
+  #endif
     IoEvent ev(fd, ev_write);
 
     do {
@@ -212,6 +563,82 @@ int send(sock_t fd, const void* buf, int n, int ms) {
     } while (true);
 }
 
+int64 sendv(sock_t fd, iov_t* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int64 total = 0;
+    for (int i = 0; i < n; ++i) total += (int64)iov[i].iov_len;
+    while (n > 0 && iov->iov_len == 0) { ++iov; --n; }
+  #ifdef __linux__
+    if (use_zerocopy(total)) {
+        const int64 r = zc_sendv(fd, iov, n, total, ms);
+        if (r != -2) return r;
+    }
+  #endif
+    IoEvent ev(fd, ev_write);
+
+    while (n > 0) {
+        const ssize_t r = __sys_api(writev)(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) return -1;
+            } else if (errno != EINTR) {
+                return -1;
+            }
+            continue;
+        }
+
+        // skip buffers that have been sent
+        size_t k = (size_t)r;
+        while (n > 0 && k >= iov->iov_len) { k -= iov->iov_len; ++iov; --n; }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + k;
+            iov->iov_len -= k;
+        }
+    }
+    return total;
+}
+
+int64 sendfile(sock_t fd, int file, int64 off, int64 n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int64 remain = n;
+  #if !defined(__linux__) && !defined(__APPLE__)
+    char buf[16 * 1024];
+    while (remain > 0) {
+        const ssize_t r = ::pread(file, buf, remain < (int64)sizeof(buf) ? (size_t)remain : sizeof(buf), (off_t)off);
+        if (r <= 0) { if (r == 0) errno = EIO; return -1; }
+        if (co::send(fd, buf, (int)r, ms) != (int)r) return -1;
+        off += r;
+        remain -= r;
+    }
+    return n;
+  #else
+    IoEvent ev(fd, ev_write);
+    while (remain > 0) {
+      #ifdef __linux__
+        off_t o = (off_t)off;
+        const ssize_t r = ::sendfile(fd, file, &o, remain < 0x7ffff000 ? (size_t)remain : 0x7ffff000);
+        const int64 k = r > 0 ? (int64)r : 0;
+        if (r == 0) { errno = EIO; return -1; } // the file was truncated
+      #else
+        off_t len = (off_t)remain; // bytes sent on return, even if it fails with EAGAIN
+        const int r = ::sendfile(file, fd, (off_t)off, &len, NULL, 0);
+        const int64 k = (int64)len;
+        if (r == 0 && len == 0) { errno = EIO; return -1; }
+      #endif
+        off += k;
+        remain -= k;
+        if (r != -1 || remain == 0) continue;
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return n;
+  #endif
+}
+
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     const char* s = (const char*) buf;
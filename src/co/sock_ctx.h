@@ -54,10 +54,16 @@ class SockCtx {
         _wev.c = co_id;
     }
 
-    void del_event() { _r64 = 0; _w64 = 0; }
+    void del_event() { _r64 = 0; _w64 = 0; _reg = 0; }
     void del_ev_read()  { _r64 = 0; }
     void del_ev_write() { _w64 = 0; }
 
+    // With co_epoll_persist, a socket is registered to the epoll of a scheduler
+    // only once, and it is removed from the epoll when the socket is closed.
+    bool registered() const { return _reg != 0; }
+    bool registered(int sched_id) const { return _reg == sched_id + 1; }
+    void set_registered(int sched_id) { _reg = sched_id + 1; }
+
     bool has_ev_read()  const { return _rev.c != 0; }
     bool has_ev_write() const { return _wev.c != 0; }
 
@@ -88,6 +94,7 @@ class SockCtx {
     };
     union { event_t _rev; uint64 _r64; };
     union { event_t _wev; uint64 _w64; };
+    int32 _reg; // 1 + id of the scheduler the socket is registered to, or 0
 };
 
 #else
@@ -8,6 +8,7 @@ namespace co {
 LPFN_CONNECTEX connect_ex = 0;
 LPFN_ACCEPTEX accept_ex = 0;
 LPFN_GETACCEPTEXSOCKADDRS get_accept_ex_addrs = 0;
+LPFN_TRANSMITFILE transmit_file = 0;
 bool can_skip_iocp_on_success = false;
 
 inline void set_skip_iocp_on_success(sock_t fd) {
@@ -296,6 +297,68 @@ int send(sock_t fd, const void* buf, int n, int ms) {
     } while (true);
 }
 
+int64 sendv(sock_t fd, iov_t* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int64 total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].len;
+    while (n > 0 && iov->len == 0) { ++iov; --n; }
+    IoEvent ev(fd, ev_write);
+    int r, e;
+    DWORD k;
+
+    while (n > 0) {
+        r = __sys_api(WSASend)(fd, iov, (DWORD)n, &k, 0, 0, 0);
+        if (r != 0) {
+            e = WSAGetLastError();
+            if (e == WSAEWOULDBLOCK) {
+                if (!ev.wait(ms)) return -1;
+                continue;
+            }
+            co::error() = e;
+            return -1;
+        }
+
+        // skip buffers that have been sent
+        while (n > 0 && k >= iov->len) { k -= iov->len; ++iov; --n; }
+        if (n > 0) {
+            iov->buf += k;
+            iov->len -= k;
+        }
+    }
+    return total;
+}
+
+int64 sendfile(sock_t fd, void* file, int64 off, int64 n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int64 remain = n;
+    int r, e;
+
+    while (remain > 0) {
+        // TransmitFile() can't send more than 2^31 - 1 bytes at once
+        const DWORD k = remain < (1 << 30) ? (DWORD)remain : (1 << 30);
+        IoEvent ev(fd);
+        ev->ol.Offset = (DWORD)off;
+        ev->ol.OffsetHigh = (DWORD)(off >> 32);
+
+        r = transmit_file(fd, (HANDLE)file, k, 0, &ev->ol, 0, 0);
+        if (r == FALSE) {
+            e = WSAGetLastError();
+            if (e != ERROR_IO_PENDING) {
+                co::error() = e;
+                return -1;
+            }
+            if (!ev.wait(ms)) return -1;
+        } else {
+            if (!can_skip_iocp_on_success) ev.wait();
+        }
+
+        // all k bytes are sent if the operation succeeded
+        off += k;
+        remain -= k;
+    }
+    return n;
+}
+
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     int r, e;
@@ -395,6 +458,15 @@ void init_sock() {
     );
     CHECK_EQ(r, 0) << "get GetAccpetExSockAddrs failed: " << co::strerror();
 
+    guid = WSAID_TRANSMITFILE;
+    r = WSAIoctl(
+        fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
+        &guid, sizeof(guid),
+        &transmit_file, sizeof(transmit_file),
+        &n, 0, 0
+    );
+    CHECK_EQ(r, 0) << "get TransmitFile failed: " << co::strerror();
+
     ::closesocket(fd);
     can_skip_iocp_on_success = co::_can_skip_iocp_on_success();
 }
@@ -0,0 +1,152 @@
+#include "trace.h"
+#include "co/mem.h"
+#include "co/stl.h"
+#include <algorithm>
+
+namespace co {
+
+bool g_tracing = false;
+
+void Tracer::start(uint32 n) {
+    if (!_buf) {
+        uint64 x = 1024;
+        while (x < n) x <<= 1;
+        auto b = (TraceEvent*) co::zalloc(sizeof(TraceEvent) * x); assert(b);
+        _mask = x - 1;
+        atomic_store(&_buf, b, mo_release);
+    }
+    atomic_store(&_pos, (uint64)0, mo_relaxed);
+}
+
+int64 Tracer::first_ns() const {
+    if (!_buf) return 0;
+    const uint64 p = atomic_load(&_pos, mo_acquire);
+    if (p == 0) return 0;
+    const uint64 m = p > _mask ? _mask + 1 : p;
+    int64 r = 0;
+    for (uint64 i = p - m; i < p; ++i) {
+        const int64 t = _buf[i & _mask].ns;
+        if (t > 0 && (r == 0 || t < r)) r = t;
+    }
+    return r;
+}
+
+namespace xx {
+
+inline void ts(fastream& s, int64 ns, int64 base) {
+    s << ",\"ts\":" << ((ns - base) / 1000.0);
+}
+
+inline void sep(fastream& s, bool& first) {
+    if (!first) s << ",\n";
+    first = false;
+}
+
+const char* wait_name(const TraceEvent& e) {
+    switch (e.type) {
+      case tr_io_wait: return e.x ? "wait write" : "wait read";
+      case tr_timer:   return "wait timer";
+      default:         return "wait event";
+    }
+}
+
+} // xx
+
+// A run of a coroutine, from tr_resume to tr_yield or tr_end, is a complete
+// event "co <id>", with what it waited for before the run in args. Idle time
+// of the scheduler is a complete event "idle", others are instant events.
+void Tracer::dump(fastream& s, uint32 sched, uint32 sched_num, int64 base, bool& first) const {
+    if (!_buf) return;
+    const uint64 p = atomic_load(&_pos, mo_acquire);
+    const uint64 m = p > _mask ? _mask + 1 : p;
+    co::vector<TraceEvent> v;
+    v.reserve((size_t)m);
+    for (uint64 i = p - m; i < p; ++i) {
+        const TraceEvent& e = _buf[i & _mask];
+        if (e.type != 0 && e.ns >= base) v.push_back(e);
+    }
+    std::stable_sort(v.begin(), v.end(), [](const TraceEvent& a, const TraceEvent& b) {
+        return a.ns < b.ns;
+    });
+
+    // the last wait and ready event of each coroutine, taken by its next run
+    co::hash_map<uint32, TraceEvent> waits, readies;
+    TraceEvent wait = TraceEvent(), ready = TraceEvent();
+    const TraceEvent* run = 0;
+    const TraceEvent* idle = 0;
+    auto gid = [sched, sched_num](uint32 id) { return (uint64)sched_num * (id - 1) + sched; };
+
+    for (size_t i = 0; i < v.size(); ++i) {
+        const TraceEvent& e = v[i];
+        switch (e.type) {
+          case tr_resume:
+            run = &e;
+            wait.type = ready.type = 0;
+            {
+                auto w = waits.find(e.co);
+                if (w != waits.end()) { wait = w->second; waits.erase(w); }
+                auto r = readies.find(e.co);
+                if (r != readies.end()) { ready = r->second; readies.erase(r); }
+            }
+            break;
+
+          case tr_yield:
+          case tr_end:
+            if (run && run->co == e.co) {
+                xx::sep(s, first);
+                s << "{\"name\":\"co " << gid(e.co) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << sched;
+                xx::ts(s, run->ns, base);
+                s << ",\"dur\":" << ((e.ns - run->ns) / 1000.0) << ",\"args\":{";
+                s << "\"co\":" << gid(e.co);
+                if (run->x & tr_new) s << ",\"new\":true";
+                if (run->x & tr_timeout) s << ",\"timeout\":true";
+                if (wait.type) {
+                    s << ",\"waited\":\"" << xx::wait_name(wait) << "\",\"wait_us\":"
+                      << ((run->ns - wait.ns) / 1000.0);
+                    if (wait.type == tr_io_wait) s << ",\"fd\":" << wait.arg;
+                }
+                if (ready.type) {
+                    s << ",\"ready_to_run_us\":" << ((run->ns - ready.ns) / 1000.0);
+                }
+                s << (e.type == tr_end ? ",\"end\":true}}" : "}}");
+            }
+            run = 0;
+            break;
+
+          case tr_io_wait:
+          case tr_timer:
+            {
+                // an IO wait usually has a timeout, the IO is what it waits for
+                TraceEvent& w = waits[e.co];
+                if (!(w.type == tr_io_wait && e.type == tr_timer)) w = e;
+            }
+            break;
+
+          case tr_ready:
+            readies[e.co] = e;
+            xx::sep(s, first);
+            s << "{\"name\":\"ready\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << sched;
+            xx::ts(s, e.ns, base);
+            s << ",\"args\":{\"co\":" << gid(e.co) << ",\"by\":";
+            if (e.arg) { s << "\"sched " << (e.arg - 1) << "\"}}"; } else { s << "\"thread\"}}"; }
+            break;
+
+          case tr_idle:
+            idle = &e;
+            break;
+
+          case tr_wakeup:
+            if (idle) {
+                xx::sep(s, first);
+                s << "{\"name\":\"idle\",\"ph\":\"X\",\"pid\":0,\"tid\":" << sched;
+                xx::ts(s, idle->ns, base);
+                s << ",\"dur\":" << ((e.ns - idle->ns) / 1000.0)
+                  << ",\"args\":{\"events\":" << e.arg << "}}";
+            }
+            idle = 0;
+            break;
+        }
+    }
+}
+
+} // co
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "co/def.h"
+#include "co/atomic.h"
+#include "co/fastream.h"
+#include "co/time.h"
+
+namespace co {
+
+// true while co::trace_start() is in effect, checked before each event
+extern bool g_tracing;
+
+enum trace_ev_t {
+    tr_resume = 1, // a coroutine is resumed, x: tr_new or tr_timeout
+    tr_yield,      // the coroutine yielded
+    tr_end,        // the coroutine terminated
+    tr_ready,      // a coroutine is made ready, arg: scheduler id + 1 of the waker, 0 if not a scheduler
+    tr_io_wait,    // wait for an IO event, arg: fd, x: 0 for read, 1 for write
+    tr_timer,      // wait for a timer, arg: ms
+    tr_idle,       // the scheduler begins to wait for events
+    tr_wakeup,     // the scheduler wakes up, arg: number of events
+};
+
+enum { tr_new = 1, tr_timeout = 2 };
+
+struct TraceEvent {
+    int64 ns;
+    uint32 co;  // id of the coroutine in its scheduler
+    uint32 arg;
+    uint8 type;
+    uint8 x;
+};
+
+/**
+ * ring buffer of events of a scheduler
+ *   - Events are mostly added by the scheduler thread, tr_ready may be added by
+ *     any thread, so a slot is taken by an atomic increment.
+ *   - The ring is allocated on the first co::trace_start() and never freed, as
+ *     events may still be added when tracing stops.
+ */
+class Tracer {
+  public:
+    Tracer() : _buf(0), _mask(0), _pos(0) {}
+    ~Tracer() = default;
+
+    // allocate the ring if not allocated, and drop events recorded before
+    void start(uint32 n);
+
+    void add(uint8 type, uint32 co, uint32 arg=0, uint8 x=0) {
+        TraceEvent* const b = atomic_load(&_buf, mo_acquire);
+        if (!b) return;
+        TraceEvent& e = b[atomic_fetch_inc(&_pos, mo_relaxed) & _mask];
+        e.ns = now::fast_ns();
+        e.co = co;
+        e.arg = arg;
+        e.type = type;
+        e.x = x;
+    }
+
+    // append events, from the oldest one kept, as chrome trace events of
+    // thread @sched to @s, @base is subtracted from the time
+    void dump(fastream& s, uint32 sched, uint32 sched_num, int64 base, bool& first) const;
+
+    // time of the oldest event kept, 0 if there is none
+    int64 first_ns() const;
+
+  private:
+    TraceEvent* _buf;
+    uint64 _mask;
+    uint64 _pos;
+    DISALLOW_COPY_AND_ASSIGN(Tracer);
+};
+
+} // co
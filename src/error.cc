@@ -1,6 +1,6 @@
 #include "co/error.h"
 #include "co/fastream.h"
-#include "co/stl.h"
+#include "co/flat_hash_map.h"
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -15,7 +15,7 @@ struct Error {
     Error() : e(0), s(4096) {}
     int e;
     fastream s;
-    co::hash_map<int, uint32> pos;
+    co::flat_hash_map<int, uint32> pos;
 };
 
 inline Error& error() {
@@ -69,7 +69,7 @@ namespace xx {
 struct Error {
     Error() : s(4096) {}
     fastream s;
-    co::hash_map<int, uint32> pos;
+    co::flat_hash_map<int, uint32> pos;
 };
 
 inline Error& error() {
@@ -1,6 +1,14 @@
 #include "co/fast.h"
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAST_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 namespace fast {
 
 static void init_itoh_table(uint16* p) {
@@ -161,4 +169,47 @@ int u64toa(uint64 v, char* buf) {
     return len;
 }
 
+#ifdef FAST_SSE2
+#ifdef _MSC_VER
+inline uint32 _ctz(uint32 x) { unsigned long r; _BitScanForward(&r, x); return r; }
+#else
+inline uint32 _ctz(uint32 x) { return __builtin_ctz(x); }
+#endif
+#endif
+
+const char* memmem(const void* s, size_t n, const void* sub, size_t m) {
+    const char* const b = (const char*)s;
+    const char* const p = (const char*)sub;
+    if (m == 0) return b;
+    if (n < m) return 0;
+    if (m == 1) return (const char*) memchr(b, *p, n);
+
+    const size_t e = n - m; // the last position
+    size_t i = 0;
+  #ifdef FAST_SSE2
+    const __m128i vf = _mm_set1_epi8(p[0]);
+    const __m128i vl = _mm_set1_epi8(p[m - 1]);
+    for (; i + 16 <= e + 1; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i + m - 1));
+        uint32 mask = (uint32) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(x, vf), _mm_cmpeq_epi8(y, vl))
+        );
+        while (mask) {
+            const size_t k = i + _ctz(mask);
+            if (memcmp(b + k + 1, p + 1, m - 2) == 0) return b + k;
+            mask &= mask - 1;
+        }
+    }
+  #endif
+
+    for (; i <= e;) {
+        const char* const q = (const char*) memchr(b + i, *p, e - i + 1);
+        if (!q) return 0;
+        if (q[m - 1] == p[m - 1] && memcmp(q + 1, p + 1, m - 2) == 0) return q;
+        i = q - b + 1;
+    }
+    return 0;
+}
+
 } // namespace fast
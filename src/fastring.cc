@@ -68,6 +68,33 @@ size_t fastring::rfind(const char* sub) const {
     }
 }
 
+size_t fastring::find_first_of(const char* s, size_t pos) const {
+    if (this->size() <= pos || !*s) return npos;
+    if (!s[1]) return this->find(*s, pos);
+
+    typedef unsigned char u8;
+    char bs[256] = { 0 };
+    while (*s) bs[(const u8)(*s++)] = 1;
+
+    for (size_t i = pos; i < _size; ++i) {
+        if (bs[(u8)(_p[i])]) return i;
+    }
+    return npos;
+}
+
+size_t fastring::find_first_not_of(const char* s, size_t pos) const {
+    if (this->size() <= pos) return npos;
+
+    typedef unsigned char u8;
+    char bs[256] = { 0 };
+    while (*s) bs[(const u8)(*s++)] = 1;
+
+    for (size_t i = pos; i < _size; ++i) {
+        if (!bs[(u8)(_p[i])]) return i;
+    }
+    return npos;
+}
+
 size_t fastring::find_last_of(const char* s, size_t pos) const {
     if (this->empty()) return npos;
 
@@ -112,11 +139,13 @@ size_t fastring::find_last_not_of(char c, size_t pos) const {
 fastring& fastring::replace(const char* sub, const char* to, size_t maxreplace) {
     if (this->empty()) return *this;
 
-    const char* from = this->c_str();
-    const char* p = strstr(from, sub);
+    const char* from = _p;
+    const char* const end = _p + _size;
+    const size_t n = strlen(sub);
+    if (n == 0) return *this;
+    const char* p = fast::memmem(from, _size, sub, n);
     if (!p) return *this;
 
-    size_t n = strlen(sub);
     size_t m = strlen(to);
 
     fastring s(_size);
@@ -125,9 +154,9 @@ fastring& fastring::replace(const char* sub, const char* to, size_t maxreplace)
         s.append(from, p - from).append(to, m);
         from = p + n;
         if (maxreplace && --maxreplace == 0) break;
-    } while ((p = strstr(from, sub)));
+    } while ((p = fast::memmem(from, end - from, sub, n)));
 
-    if (from < _p + _size) s.append(from);
+    if (from < end) s.append(from, end - from);
 
     this->swap(s);
     return *this;
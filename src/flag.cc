@@ -3,6 +3,8 @@
 #include "co/fs.h"
 #include "co/os.h"
 #include "co/str.h"
+#include "co/atomic.h"
+#include "co/thread.h"
 
 DEF_string(help, "", ">>.help info");
 DEF_string(config, "", ">>.path of config file", conf);
@@ -18,12 +20,15 @@ struct Flag {
          const char* file, int line, void* addr);
 
     fastring set_value(const fastring& v);
+    fastring parse_value(const fastring& v, void* x) const;
+    fastring update(const fastring& v);
     fastring get_value() const;
     void print() const;
     const char* type_str() const;
 
     char type;
     bool inco;          // flag inside co (comment starts with >>)
+    bool mut;           // mutable at runtime, see flag::set_mutable()
     const char* name;
     const char* alias;  // alias for this flag
     const char* value;  // default value
@@ -49,7 +54,7 @@ const char TYPE_double = 'd';
 
 Flag::Flag(char type, const char* name, const char* alias, const char* value, 
            const char* help, const char* file, int line, void* addr)
-    : type(type), inco(false), name(name), alias(alias), value(value),
+    : type(type), inco(false), mut(false), name(name), alias(alias), value(value),
       help(help), file(file), line(line), lv(5), addr(addr) {
     // flag defined in co
     if (help[0] == '>' && help[1] == '>') {
@@ -66,27 +71,33 @@ Flag::Flag(char type, const char* name, const char* alias, const char* value,
 }
 
 fastring Flag::set_value(const fastring& v) {
-    switch (this->type) {
-      case TYPE_string:
+    if (this->type == TYPE_string) {
         *static_cast<fastring*>(this->addr) = v;
         return fastring();
+    }
+    return this->parse_value(v, this->addr);
+}
+
+// parse @v to @x, @x points to a value of the type of this flag
+fastring Flag::parse_value(const fastring& v, void* x) const {
+    switch (this->type) {
       case TYPE_bool:
-        *static_cast<bool*>(this->addr) = str::to_bool(v);
+        *static_cast<bool*>(x) = str::to_bool(v);
         break;
       case TYPE_int32:
-        *static_cast<int32*>(this->addr) = str::to_int32(v);
+        *static_cast<int32*>(x) = str::to_int32(v);
         break;
       case TYPE_uint32:
-        *static_cast<uint32*>(this->addr) = str::to_uint32(v);
+        *static_cast<uint32*>(x) = str::to_uint32(v);
         break;
       case TYPE_int64:
-        *static_cast<int64*>(this->addr) = str::to_int64(v);
+        *static_cast<int64*>(x) = str::to_int64(v);
         break;
       case TYPE_uint64:
-        *static_cast<uint64*>(this->addr) = str::to_uint64(v);
+        *static_cast<uint64*>(x) = str::to_uint64(v);
         break;
       case TYPE_double:
-        *static_cast<double*>(this->addr) = str::to_double(v);
+        *static_cast<double*>(x) = str::to_double(v);
         break;
       default:
         return "unknown flag type";
@@ -102,6 +113,33 @@ fastring Flag::set_value(const fastring& v) {
     }
 }
 
+// the value is parsed to a local variable first, and a bad value changes nothing
+fastring Flag::update(const fastring& v) {
+    union { bool b; int32 i; uint32 u; int64 I; uint64 U; double d; } x;
+    fastring err = this->parse_value(v, &x);
+    if (!err.empty()) return err;
+
+    switch (this->type) {
+      case TYPE_bool:
+        atomic_store(static_cast<bool*>(this->addr), x.b);
+        break;
+      case TYPE_int32:
+        atomic_store(static_cast<int32*>(this->addr), x.i);
+        break;
+      case TYPE_uint32:
+        atomic_store(static_cast<uint32*>(this->addr), x.u);
+        break;
+      case TYPE_int64:
+        atomic_store(static_cast<int64*>(this->addr), x.I);
+        break;
+      case TYPE_uint64:
+      case TYPE_double: // stored as the bits of it
+        atomic_store(static_cast<uint64*>(this->addr), x.U);
+        break;
+    }
+    return fastring();
+}
+
 template<typename T>
 fastring int_to_string(T t) {
     if ((0 <= t && t <= 8192) || (t < 0 && t >= -8192)) return str::from(t);
@@ -194,6 +232,17 @@ inline Flag* find_flag(const fastring& name) {
     return it != gFlags().end() ? it->second : NULL;
 }
 
+// watchers of mutable flags, the mutex also serializes flag::update()
+struct Watchers {
+    ::Mutex mtx;
+    co::map<Flag*, co::vector<std::function<void()>>> cbs;
+};
+
+inline Watchers& gWatchers() {
+    static auto w = co::static_new<Watchers>();
+    return *w;
+}
+
 // Return error message on any error.
 fastring set_flag_value(const fastring& name, const fastring& value) {
     Flag* flag = find_flag(name);
@@ -611,6 +660,45 @@ fastring set_value(const fastring& name, const fastring& value) {
     return xx::set_flag_value(name, value);
 }
 
+bool set_mutable(const char* name) {
+    auto flag = xx::find_flag(name);
+    if (!flag || flag->type == xx::TYPE_string) return false;
+    flag->mut = true;
+    return true;
+}
+
+bool is_mutable(const fastring& name) {
+    auto flag = xx::find_flag(name);
+    return flag && flag->mut;
+}
+
+fastring update(const fastring& name, const fastring& value) {
+    auto flag = xx::find_flag(name);
+    if (!flag) return "flag not defined: " + name;
+    if (!flag->mut) return "flag not mutable: " + name;
+
+    auto& w = xx::gWatchers();
+    ::MutexGuard g(w.mtx);
+    fastring err = flag->update(value);
+    if (!err.empty()) return err.append(": ").append(value);
+
+    auto it = w.cbs.find(flag);
+    if (it != w.cbs.end()) {
+        for (auto& cb : it->second) cb();
+    }
+    return fastring();
+}
+
+bool watch(const char* name, std::function<void()>&& cb) {
+    auto flag = xx::find_flag(name);
+    if (!flag || !flag->mut) return false;
+
+    auto& w = xx::gWatchers();
+    ::MutexGuard g(w.mtx);
+    w.cbs[flag].push_back(std::move(cb));
+    return true;
+}
+
 bool alias(const char* name, const char* new_name) {
     auto flag = xx::find_flag(name);
     if (!flag || !*new_name) return false;
@@ -622,4 +710,15 @@ bool alias(const char* name, const char* new_name) {
     return true;
 }
 
+co::vector<std::pair<fastring, fastring>> values() {
+    co::vector<std::pair<fastring, fastring>> v;
+    for (auto it = xx::gFlags().begin(); it != xx::gFlags().end(); ++it) {
+        const auto& f = *it->second;
+        if (*f.help && (!*f.alias || it->first == f.name)) {
+            v.push_back(std::make_pair(it->first, f.get_value()));
+        }
+    }
+    return v;
+}
+
 } // namespace flag
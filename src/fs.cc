@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 namespace fs {
 
@@ -97,21 +98,36 @@ bool symlink(const char* dst, const char* lnk) {
 #define nullfd -1
 
 namespace xx {
-int open(const char* path, char mode) {
+int open(const char* path, char mode, int flags) {
+  #ifdef O_DIRECT
+    const int d = (flags & file::direct) ? O_DIRECT : 0;
+  #else
+    const int d = 0;
+  #endif
+    int fd;
     switch (mode) {
       case 'r':
-        return ::open(path, O_RDONLY);
+        fd = ::open(path, O_RDONLY | d);
+        break;
       case 'a':
-        return ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | d, 0644);
+        break;
       case 'w':
-        return ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | d, 0644);
+        break;
       case 'm':
-        return ::open(path, O_WRONLY | O_CREAT, 0644);
+        fd = ::open(path, O_WRONLY | O_CREAT | d, 0644);
+        break;
       case '+':
-        return ::open(path, O_RDWR | O_CREAT, 0644);
+        fd = ::open(path, O_RDWR | O_CREAT | d, 0644);
+        break;
       default:
         return nullfd;
     }
+  #if defined(__APPLE__) && defined(F_NOCACHE)
+    if (fd != nullfd && (flags & file::direct)) ::fcntl(fd, F_NOCACHE, 1);
+  #endif
+    return fd;
 }
 } // xx
 
@@ -146,7 +162,11 @@ const char* file::path() const {
     return _p ? ((char*)_p + sizeof(fctx)) : "";
 }
 
-bool file::open(const char* path, char mode) {
+int file::fd() const {
+    return _p ? ((fctx*)_p)->fd : nullfd;
+}
+
+bool file::open(const char* path, char mode, int flags) {
     // make sure __sys_api(close, read, write) are not NULL
     static bool kx = []() {
         if (__sys_api(close) == 0) ::close(-1);
@@ -172,7 +192,7 @@ bool file::open(const char* path, char mode) {
         memcpy(p + 1, path, n);
     }
 
-    p->fd = xx::open(path, mode);
+    p->fd = xx::open(path, mode, flags);
     return p->fd != nullfd;
 }
 
@@ -184,6 +204,24 @@ void file::close() {
     }
 }
 
+bool file::sync() {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+  #if defined(__linux__)
+    return ::fdatasync(p->fd) == 0;
+  #elif defined(__APPLE__) && defined(F_FULLFSYNC)
+    return ::fcntl(p->fd, F_FULLFSYNC) != -1 || ::fsync(p->fd) == 0;
+  #else
+    return ::fsync(p->fd) == 0;
+  #endif
+}
+
+bool file::truncate(int64 n) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+    return ::ftruncate(p->fd, (off_t)n) == 0;
+}
+
 void file::seek(int64 off, int whence) {
     static int seekfrom[3] = { SEEK_SET, SEEK_CUR, SEEK_END };
     fctx* p = (fctx*)_p;
@@ -203,7 +241,8 @@ size_t file::read(void* s, size_t n) {
 
     while (true) {
         size_t toread = (remain < N ? remain : N);
-        auto r = __sys_api(read)(p->fd, c, toread);
+        // ::read is hooked, in coroutines it won't block the scheduler
+        auto r = ::read(p->fd, c, toread);
         if (r > 0) {
             remain -= (size_t)r;
             if (remain == 0) return n;
@@ -232,7 +271,7 @@ size_t file::write(const void* s, size_t n) {
 
     while (true) {
         size_t towrite = (remain < N ? remain : N);
-        auto r = __sys_api(write)(p->fd, c, towrite);
+        auto r = ::write(p->fd, c, towrite); // hooked as ::read
         if (r >= 0) {
             remain -= (size_t)r;
             if (remain == 0) return n;
@@ -245,6 +284,72 @@ size_t file::write(const void* s, size_t n) {
 
 #undef nullfd
 
+bool mapped_view::map(const file& f, char mode, int64 off, size_t n) {
+    this->unmap();
+    const int fd = f.fd();
+    struct stat st;
+    if (fd < 0 || off < 0 || ::fstat(fd, &st) != 0 || off > st.st_size) return false;
+
+    const size_t m = (size_t)(st.st_size - off);
+    if (n > m) n = m;
+    if (n == 0) return _ok = true;
+
+    static const int64 kPage = ::sysconf(_SC_PAGESIZE);
+    const int64 x = off & ~(kPage - 1);
+    const size_t len = n + (size_t)(off - x);
+    const int prot = mode == 'w' ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* p = ::mmap(0, len, prot, MAP_SHARED, fd, (off_t)x);
+    if (p == MAP_FAILED) return false;
+
+    _base = p;
+    _len = len;
+    _p = (char*)p + (off - x);
+    _n = n;
+    return _ok = true;
+}
+
+void mapped_view::unmap() {
+    if (_base) {
+        ::munmap(_base, _len);
+        _base = 0;
+        _len = 0;
+    }
+    _p = 0;
+    _n = 0;
+    _ok = false;
+}
+
+bool mapped_view::advise(advice_t a) const {
+    if (!_base) return _ok;
+    int x;
+    switch (a) {
+      case sequential:
+        x = MADV_SEQUENTIAL;
+        break;
+      case random:
+        x = MADV_RANDOM;
+        break;
+      case willneed:
+        x = MADV_WILLNEED;
+        break;
+      case hugepage:
+      #ifdef MADV_HUGEPAGE
+        x = MADV_HUGEPAGE;
+        break;
+      #else
+        return false;
+      #endif
+      default:
+        x = MADV_NORMAL;
+    }
+    return ::madvise(_base, _len, x) == 0;
+}
+
+bool mapped_view::sync() const {
+    if (!_base) return _ok;
+    return ::msync(_base, _len, MS_SYNC) == 0;
+}
+
 struct dctx {
     size_t n;
     DIR* d;
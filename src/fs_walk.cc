@@ -0,0 +1,309 @@
+#include "co/fs.h"
+#include "co/mem.h"
+#include "co/thread.h"
+#include <condition_variable>
+#include <mutex>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace fs {
+namespace xx {
+
+struct item {
+    const char* name;
+    size_t len;
+    int64 size;
+    char type;
+};
+
+inline bool is_dot(const char* p) {
+    return p[0] == '.' && (!p[1] || (p[1] == '.' && !p[2]));
+}
+
+#if defined(_WIN32)
+// FindFirstFileEx() with the basic info and the large fetch
+class dir_reader {
+  public:
+    dir_reader() : _h(INVALID_HANDLE_VALUE), _first(false) {}
+    ~dir_reader() { if (_h != INVALID_HANDLE_VALUE) FindClose(_h); }
+
+    bool open(const fastring& path) {
+        fastring s(path.size() + 3);
+        s.append(path);
+        if (!s.ends_with('/') && !s.ends_with('\\')) s.append('\\');
+        s.append('*');
+        _h = FindFirstFileExA(
+            s.c_str(), FindExInfoBasic, &_e, FindExSearchNameMatch, 0,
+            FIND_FIRST_EX_LARGE_FETCH
+        );
+        _first = true;
+        return _h != INVALID_HANDLE_VALUE;
+    }
+
+    bool next(item& x, bool) {
+        do {
+            if (_first) {
+                _first = false;
+            } else if (!FindNextFileA(_h, &_e)) {
+                return false;
+            }
+        } while (is_dot(_e.cFileName));
+
+        const DWORD a = _e.dwFileAttributes;
+        x.name = _e.cFileName;
+        x.len = strlen(x.name);
+        x.type = (a & FILE_ATTRIBUTE_REPARSE_POINT) ? 'l' : (a & FILE_ATTRIBUTE_DIRECTORY) ? 'd' : 'f';
+        x.size = x.type == 'f' ? (int64)(((uint64)_e.nFileSizeHigh << 32) | _e.nFileSizeLow) : -1;
+        return true;
+    }
+
+  private:
+    HANDLE _h;
+    WIN32_FIND_DATAA _e;
+    bool _first;
+};
+
+#else
+inline char type_of(mode_t m) {
+    return S_ISREG(m) ? 'f' : S_ISDIR(m) ? 'd' : S_ISLNK(m) ? 'l' : 'o';
+}
+
+#if defined(__linux__)
+struct linux_dirent64 {
+    uint64 d_ino;
+    int64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// read entries by getdents64() with a buffer of 32K, hundreds at a time
+class dir_reader {
+  public:
+    static const size_t N = 32 * 1024;
+
+    dir_reader() : _fd(-1), _b(0), _pos(0), _end(0) {}
+
+    ~dir_reader() {
+        if (_fd >= 0) ::close(_fd);
+        if (_b) co::free(_b, N);
+    }
+
+    bool open(const fastring& path) {
+        _fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (_fd < 0) return false;
+        _b = (char*) co::alloc(N); assert(_b);
+        return true;
+    }
+
+    bool next(item& x, bool size) {
+        linux_dirent64* d;
+        do {
+            if (_pos >= _end) {
+                const long r = syscall(SYS_getdents64, _fd, _b, N);
+                if (r <= 0) return false;
+                _pos = 0;
+                _end = (size_t)r;
+            }
+            d = (linux_dirent64*)(_b + _pos);
+            _pos += d->d_reclen;
+        } while (is_dot(d->d_name));
+
+        x.name = d->d_name;
+        x.len = strlen(x.name);
+        x.size = -1;
+        switch (d->d_type) {
+          case DT_REG: x.type = 'f'; break;
+          case DT_DIR: x.type = 'd'; break;
+          case DT_LNK: x.type = 'l'; break;
+          case DT_UNKNOWN: x.type = '?'; break;
+          default: x.type = 'o';
+        }
+        if (x.type == '?' || (size && x.type == 'f')) this->stat(x);
+        return true;
+    }
+
+  private:
+    void stat(item& x) {
+        struct stat st;
+        if (::fstatat(_fd, x.name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            x.type = type_of(st.st_mode);
+            if (x.type == 'f') x.size = st.st_size;
+        }
+    }
+
+    int _fd;
+    char* _b;
+    size_t _pos;
+    size_t _end;
+};
+
+#else
+// readdir() with d_type, which is there on mac and the BSDs
+class dir_reader {
+  public:
+    dir_reader() : _d(0) {}
+    ~dir_reader() { if (_d) ::closedir(_d); }
+
+    bool open(const fastring& path) {
+        _d = ::opendir(path.c_str());
+        return _d != 0;
+    }
+
+    bool next(item& x, bool size) {
+        struct dirent* e;
+        do {
+            if (!(e = ::readdir(_d))) return false;
+        } while (is_dot(e->d_name));
+
+        x.name = e->d_name;
+        x.len = strlen(x.name);
+        x.size = -1;
+        x.type = '?';
+      #ifdef DT_UNKNOWN
+        switch (e->d_type) {
+          case DT_REG: x.type = 'f'; break;
+          case DT_DIR: x.type = 'd'; break;
+          case DT_LNK: x.type = 'l'; break;
+          case DT_UNKNOWN: break;
+          default: x.type = 'o';
+        }
+      #endif
+        if (x.type == '?' || (size && x.type == 'f')) {
+            struct stat st;
+            if (::fstatat(::dirfd(_d), x.name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                x.type = type_of(st.st_mode);
+                if (x.type == 'f') x.size = st.st_size;
+            }
+        }
+        return true;
+    }
+
+  private:
+    DIR* _d;
+};
+#endif
+#endif
+
+class walker {
+  public:
+    walker(const walk_cb_t& f, int flags, size_t batch)
+        : _f(f), _flags(flags), _batch(batch ? batch : 1), _stop(false),
+          _active(0) {
+    }
+
+    // scan the directory @path, subdirectories are added to @dirs
+    bool scan(const fastring& path, co::vector<entry>& v, co::vector<fastring>& dirs) {
+        dir_reader r;
+        if (!r.open(path)) return false;
+
+        const bool rec = _flags & walk_recursive;
+        const bool sep = path.ends_with('/') || path.ends_with('\\');
+        item x;
+        while (!atomic_load(&_stop, mo_relaxed) && r.next(x, _flags & walk_size)) {
+            v.emplace_back();
+            entry& e = v.back();
+            e.path.reserve(path.size() + x.len + 2);
+            e.path.append(path);
+            if (!sep) e.path.append('/');
+            e.path.append(x.name, x.len);
+            e.size = x.size;
+            e.type = x.type;
+            if (rec && x.type == 'd') dirs.push_back(e.path);
+            if (v.size() >= _batch) this->emit(v);
+        }
+        this->emit(v);
+        return true;
+    }
+
+    bool run(const fastring& root, int threads) {
+        co::vector<entry> v;
+        co::vector<fastring> dirs;
+        v.reserve(_batch);
+        if (!this->scan(root, v, dirs)) return false;
+        if (threads <= 1 || dirs.empty()) {
+            while (!dirs.empty() && !_stop) {
+                fastring d(std::move(dirs.back()));
+                dirs.pop_back();
+                this->scan(d, v, dirs);
+            }
+            return !_stop;
+        }
+
+        _q.swap(dirs);
+        co::vector<Thread*> ts;
+        for (int i = 0; i < threads; ++i) {
+            ts.push_back(co::make<Thread>(&walker::work, this));
+        }
+        for (auto& t : ts) co::del(t);
+        return !_stop;
+    }
+
+  private:
+    void emit(co::vector<entry>& v) {
+        if (v.empty()) return;
+        if (!atomic_load(&_stop, mo_relaxed) && !_f(v.data(), v.size())) {
+            atomic_store(&_stop, true, mo_relaxed);
+        }
+        v.clear();
+    }
+
+    // take directories from the queue until it is empty and no one is
+    // scanning, as a directory being scanned may add more
+    void work() {
+        co::vector<entry> v;
+        co::vector<fastring> dirs;
+        v.reserve(_batch);
+        std::unique_lock<std::mutex> g(_mtx);
+        while (true) {
+            while (_q.empty() && _active > 0 && !_stop) _cv.wait(g);
+            if (_q.empty() || _stop) break;
+            fastring d(std::move(_q.back()));
+            _q.pop_back();
+            ++_active;
+            g.unlock();
+
+            this->scan(d, v, dirs);
+
+            g.lock();
+            --_active;
+            for (auto& x : dirs) _q.push_back(std::move(x));
+            dirs.clear();
+            _cv.notify_all();
+        }
+        _cv.notify_all();
+    }
+
+  private:
+    const walk_cb_t& _f;
+    const int _flags;
+    const size_t _batch;
+    bool _stop;
+    int _active; // threads scanning a directory
+    co::vector<fastring> _q;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+};
+
+} // xx
+
+bool walk(const char* path, const walk_cb_t& f, int flags, int threads, size_t batch) {
+    if (!path || !*path) return false;
+    xx::walker w(f, flags, batch);
+    return w.run(fastring(path), threads);
+}
+
+} // fs
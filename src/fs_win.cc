@@ -102,18 +102,19 @@ bool symlink(const char* dst, const char* lnk) {
 #define nullfd INVALID_HANDLE_VALUE
 
 namespace xx {
-HANDLE open(const char* path, char mode) {
+HANDLE open(const char* path, char mode, int flags) {
+    const DWORD d = (flags & file::direct) ? (FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH) : 0;
     switch (mode) {
       case 'r':
-        return CreateFileA(path, GENERIC_READ, 7, 0, OPEN_EXISTING, 0, 0);
+        return CreateFileA(path, GENERIC_READ, 7, 0, OPEN_EXISTING, d, 0);
       case 'a':
-        return CreateFileA(path, FILE_APPEND_DATA, 7, 0, OPEN_ALWAYS, 0, 0);
+        return CreateFileA(path, FILE_APPEND_DATA, 7, 0, OPEN_ALWAYS, d, 0);
       case 'w':
-        return CreateFileA(path, GENERIC_WRITE, 7, 0, CREATE_ALWAYS, 0, 0);
+        return CreateFileA(path, GENERIC_WRITE, 7, 0, CREATE_ALWAYS, d, 0);
       case 'm':
-        return CreateFileA(path, GENERIC_WRITE, 7, 0, OPEN_ALWAYS, 0, 0);
+        return CreateFileA(path, GENERIC_WRITE, 7, 0, OPEN_ALWAYS, d, 0);
       case '+':
-        return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 7, 0, OPEN_ALWAYS, 0, 0);
+        return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 7, 0, OPEN_ALWAYS, d, 0);
       default:
         return nullfd;
     }
@@ -154,7 +155,11 @@ const char* file::path() const {
     return _p ? ((char*)_p + sizeof(fctx)) : "";
 }
 
-bool file::open(const char* path, char mode) {
+void* file::fd() const {
+    return _p ? ((fctx*)_p)->fd : nullfd;
+}
+
+bool file::open(const char* path, char mode, int flags) {
     this->close();
     if (!path || !*path) return false;
 
@@ -171,10 +176,28 @@ bool file::open(const char* path, char mode) {
         memcpy(p + 1, path, n);
     }
 
-    p->fd = xx::open(path, mode);
+    p->fd = xx::open(path, mode, flags);
     return p->fd != nullfd;
 }
 
+bool file::sync() {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+    return FlushFileBuffers(p->fd) == TRUE;
+}
+
+bool file::truncate(int64 n) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+    LARGE_INTEGER li, cur;
+    li.QuadPart = 0;
+    if (!SetFilePointerEx(p->fd, li, &cur, FILE_CURRENT)) return false;
+    li.QuadPart = n;
+    const bool r = SetFilePointerEx(p->fd, li, 0, FILE_BEGIN) && SetEndOfFile(p->fd);
+    SetFilePointerEx(p->fd, cur, 0, FILE_BEGIN);
+    return r;
+}
+
 void file::close() {
     fctx* p = (fctx*)_p;
     if (p && p->fd != nullfd) {
@@ -248,6 +271,60 @@ size_t file::write(const void* s, size_t n) {
 
 #undef nullfd
 
+bool mapped_view::map(const file& f, char mode, int64 off, size_t n) {
+    this->unmap();
+    HANDLE fd = (HANDLE) f.fd();
+    LARGE_INTEGER size;
+    if (fd == INVALID_HANDLE_VALUE || off < 0) return false;
+    if (!GetFileSizeEx(fd, &size) || off > size.QuadPart) return false;
+
+    const size_t m = (size_t)(size.QuadPart - off);
+    if (n > m) n = m;
+    if (n == 0) return _ok = true;
+
+    static const int64 kGran = []() {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (int64)info.dwAllocationGranularity;
+    }();
+    const int64 x = off & ~(kGran - 1);
+    const size_t len = n + (size_t)(off - x);
+    const bool w = mode == 'w';
+
+    // the view keeps the mapping object alive, the handle is closed here
+    HANDLE h = CreateFileMappingA(fd, 0, w ? PAGE_READWRITE : PAGE_READONLY, 0, 0, 0);
+    if (h == NULL) return false;
+    void* p = MapViewOfFile(h, w ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(x >> 32), (DWORD)x, len);
+    CloseHandle(h);
+    if (p == NULL) return false;
+
+    _base = p;
+    _len = len;
+    _p = (char*)p + (off - x);
+    _n = n;
+    return _ok = true;
+}
+
+void mapped_view::unmap() {
+    if (_base) {
+        UnmapViewOfFile(_base);
+        _base = 0;
+        _len = 0;
+    }
+    _p = 0;
+    _n = 0;
+    _ok = false;
+}
+
+bool mapped_view::advise(advice_t) const {
+    return _ok;
+}
+
+bool mapped_view::sync() const {
+    if (!_base) return _ok;
+    return FlushViewOfFile(_base, _len) == TRUE;
+}
+
 struct dctx {
     size_t n;
     HANDLE d;
@@ -0,0 +1,190 @@
+#include "co/fs.h"
+#include "co/god.h"
+#include "co/mem.h"
+#include "co/thread.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace fs {
+namespace xx {
+
+// state of a fstream with flags or sync_every(), the file is moved here
+class fsx {
+  public:
+    fsx(fs::file&& f, int flags, size_t cap)
+        : _f(std::move(f)), _sync(0), _unsynced(0), _size(0),
+          _b(0), _raw(0), _cap(0), _len(0), _job(cap), _busy(false), _stop(false), _t(0) {
+        if (flags & fstream::direct) {
+            const size_t a = fs::file::direct_align;
+            _cap = god::align_up(cap < a ? a : cap, a);
+            _raw = (char*) co::alloc(_cap + a); assert(_raw);
+            _b = god::align_up(_raw, a);
+        }
+        if (flags & fstream::async) {
+            _t = co::make<::Thread>(&fsx::loop, this);
+        }
+    }
+
+    ~fsx() {
+        if (_t) {
+            {
+                std::lock_guard<std::mutex> g(_mtx);
+                _stop = true;
+            }
+            _cv.notify_all();
+            co::del(_t);
+        }
+        this->finish();
+        if (_raw) co::free(_raw, _cap + fs::file::direct_align);
+    }
+
+    bool async() const { return _t != 0; }
+
+    void set_sync(size_t n) { atomic_store(&_sync, n, mo_relaxed); }
+
+    // hand over the buffer @s to the background thread, s is empty then
+    void post(fastream& s) {
+        std::unique_lock<std::mutex> g(_mtx);
+        while (_busy) _cv.wait(g);
+        _job.swap(s);
+        _busy = true;
+        g.unlock();
+        _cv.notify_all();
+    }
+
+    // write data, copied to the aligned buffer in direct mode
+    void put(const char* p, size_t n) {
+        _size += n;
+        if (!_b) return this->out(p, n);
+        while (n > 0) {
+            const size_t k = _cap - _len < n ? _cap - _len : n;
+            memcpy(_b + _len, p, k);
+            _len += k;
+            p += k;
+            n -= k;
+            if (_len == _cap) {
+                this->out(_b, _cap);
+                _len = 0;
+            }
+        }
+    }
+
+  private:
+    void out(const char* p, size_t n) {
+        _f.write(p, n);
+        const size_t s = atomic_load(&_sync, mo_relaxed);
+        if (s > 0 && (_unsynced += n) >= s) {
+            _f.sync();
+            _unsynced = 0;
+        }
+    }
+
+    // write the tail padded to a whole block, and cut the padding off
+    void finish() {
+        if (_b && _len > 0) {
+            const size_t m = god::align_up(_len, fs::file::direct_align);
+            memset(_b + _len, 0, m - _len);
+            this->out(_b, m);
+            _len = 0;
+            _f.truncate(_size);
+        }
+        if (_unsynced > 0) _f.sync();
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> g(_mtx);
+        while (true) {
+            while (!_busy && !_stop) _cv.wait(g);
+            if (!_busy) break;
+            g.unlock();
+            this->put(_job.data(), _job.size());
+            _job.clear();
+            g.lock();
+            _busy = false;
+            _cv.notify_all();
+        }
+    }
+
+  private:
+    fs::file _f;
+    size_t _sync;     // sync the file every _sync bytes
+    size_t _unsynced; // bytes written since the last sync
+    int64 _size;      // bytes of data written
+
+    // aligned buffer for direct mode
+    char* _b;
+    char* _raw;
+    size_t _cap;
+    size_t _len;
+
+    // async mode
+    fastream _job; // buffer being written by the background thread
+    bool _busy;
+    bool _stop;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    ::Thread* _t;
+};
+
+} // xx
+
+bool fstream::open(const char* path, char mode, int flags) {
+    this->close();
+    const char m = mode == 'w' ? 'w' : 'a';
+    if (m != 'w') flags &= ~direct;
+
+    bool ok = false;
+    if (flags & direct) ok = _f.open(path, m, fs::file::direct);
+    if (!ok) {
+        flags &= ~direct;
+        if (!_f.open(path, m)) return false;
+    }
+    if (flags) _x = co::make<xx::fsx>(std::move(_f), flags, _s.capacity());
+    return true;
+}
+
+void fstream::sync_every(size_t n) {
+    if (!_x) {
+        if (!_f) return;
+        this->flush();
+        _x = co::make<xx::fsx>(std::move(_f), 0, _s.capacity());
+    }
+    ((xx::fsx*)_x)->set_sync(n);
+}
+
+void fstream::_flush() {
+    if (_s.empty()) return;
+    xx::fsx* x = (xx::fsx*)_x;
+    if (x->async()) {
+        x->post(_s);
+    } else {
+        x->put(_s.data(), _s.size());
+        _s.clear();
+    }
+}
+
+void fstream::_close() {
+    this->_flush();
+    xx::fsx* x = (xx::fsx*)_x;
+    _x = 0;
+    co::del(x); // wait for the background thread and close the file
+}
+
+// data larger than the buffer, it goes through the buffer in async mode, as
+// the caller may reuse @s once this returns
+void fstream::_write(const void* s, size_t n) {
+    xx::fsx* x = (xx::fsx*)_x;
+    if (!x->async()) return x->put((const char*)s, n);
+
+    const char* p = (const char*)s;
+    const size_t cap = _s.capacity();
+    while (n > 0) {
+        const size_t k = cap - _s.size() < n ? cap - _s.size() : n;
+        _s.append(p, k);
+        p += k;
+        n -= k;
+        if (_s.size() == cap) this->_flush();
+    }
+}
+
+} // fs
@@ -1,75 +1,309 @@
 #include "co/hash/base64.h"
 
-fastring base64_encode(const void* p, size_t n) {
-    const size_t k = n / 3;
-    const int r = (int) (n - k * 3); // r = n % 3
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B64_AVX2 // runtime dispatch
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define B64_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const char kStdTab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kUrlTab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+const int8 kStdDetab[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+const int8 kUrlDetab[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+typedef const unsigned char* S;
+
+/**
+ * SIMD codecs, based on the work of Wojciech Muła and Daniel Lemire
+ *   - With AVX2, 24 bytes are encoded to 32 characters at a time, and 32
+ *     characters are decoded to 24 bytes. The cpu is checked at runtime.
+ *   - With NEON, 48 bytes are encoded to 64 characters at a time, and the
+ *     other way for decoding.
+ *   - They return bytes of the input consumed, the rest is done by the scalar
+ *     code. Decoding stops at the first block with any character not in the
+ *     alphabet, e.g. '=' or "\r\n", which is left to the scalar code.
+ */
+#ifdef B64_AVX2
+inline bool _has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// false before it is initialized, the scalar code is used then
+static const bool g_has_avx2 = _has_avx2();
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(S s, size_t n, char* x, bool url) {
+    // the 12 bytes in each lane are split to 16 bytes, 6 bits in each
+    const __m256i shuf = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+    );
+    const __m256i m0 = _mm256_set1_epi32(0x0fc0fc00);
+    const __m256i k0 = _mm256_set1_epi32(0x04000040);
+    const __m256i m1 = _mm256_set1_epi32(0x003f03f0);
+    const __m256i k1 = _mm256_set1_epi32(0x01000010);
+
+    // offsets from the 6-bit values to the characters, for A-Z, a-z, 0-9, +, /
+    const int8 c62 = url ? '-' - 62 : '+' - 62;
+    const int8 c63 = url ? '_' - 63 : '/' - 63;
+    const __m256i lut = _mm256_setr_epi8(
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, c62, c63, 0, 0,
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, c62, c63, 0, 0
+    );
+
+    size_t i = 0;
+    for (; i + 28 <= n; i += 24, x += 32) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(s + i))),
+            _mm_loadu_si128((const __m128i*)(s + i + 12)), 1
+        );
+        v = _mm256_shuffle_epi8(v, shuf);
+        const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, m0), k0);
+        const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, m1), k1);
+        const __m256i d = _mm256_or_si256(t0, t1);
+
+        __m256i r = _mm256_subs_epu8(d, _mm256_set1_epi8(51));
+        r = _mm256_sub_epi8(r, _mm256_cmpgt_epi8(d, _mm256_set1_epi8(25)));
+        r = _mm256_add_epi8(d, _mm256_shuffle_epi8(lut, r));
+        _mm256_storeu_si256((__m256i*)x, r);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(S s, size_t n, char* x, bool url) {
+    // a character is valid if its bits in lut_lo and lut_hi do not overlap
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+    );
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+    );
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+    );
+    const __m256i m2f = _mm256_set1_epi8(0x2f);
+    const __m256i shuf = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+    );
+    const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 0, 0);
+
+    // at least 4 characters are left to the scalar code for the last quantum
+    size_t i = 0;
+    for (; i + 36 <= n; i += 32, x += 24) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        if (url) {
+            // '-' and '_' are translated to '+' and '/', which are invalid here
+            const __m256i bad = _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')),
+                _mm256_cmpeq_epi8(v, m2f)
+            );
+            if (!_mm256_testz_si256(bad, bad)) break;
+            v = _mm256_blendv_epi8(v, _mm256_set1_epi8('+'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+            v = _mm256_blendv_epi8(v, m2f, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        }
+
+        const __m256i hn = _mm256_and_si256(_mm256_srli_epi32(v, 4), m2f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(v, m2f));
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hn);
+        if (!_mm256_testz_si256(lo, hi)) break;
 
-    fastring v;
-    v.resize((k + !!r) * 4); // size: 4k or 4k + 4
-    char* x = (char*) v.data();
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, m2f), hn));
+        v = _mm256_add_epi8(v, roll);
 
+        // pack 4 6-bit values to 3 bytes
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, shuf);
+        v = _mm256_permutevar8x32_epi32(v, perm);
+        _mm_storeu_si128((__m128i*)x, _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i*)(x + 16), _mm256_extracti128_si256(v, 1));
+    }
+    return i;
+}
+#endif
+
+#ifdef B64_NEON
+inline uint8x16x4_t load_table(const void* p) {
+    const uint8* s = (const uint8*)p;
+    uint8x16x4_t t;
+    t.val[0] = vld1q_u8(s);
+    t.val[1] = vld1q_u8(s + 16);
+    t.val[2] = vld1q_u8(s + 32);
+    t.val[3] = vld1q_u8(s + 48);
+    return t;
+}
+
+static size_t encode_neon(S s, size_t n, char* x, const char* tab) {
+    const uint8x16x4_t t = load_table(tab);
+    const uint8x16_t m = vdupq_n_u8(0x3f);
+    size_t i = 0;
+    for (; i + 48 <= n; i += 48, x += 64) {
+        const uint8x16x3_t v = vld3q_u8(s + i);
+        uint8x16x4_t r;
+        r.val[0] = vqtbl4q_u8(t, vshrq_n_u8(v.val[0], 2));
+        r.val[1] = vqtbl4q_u8(t, vandq_u8(vorrq_u8(vshrq_n_u8(v.val[1], 4), vshlq_n_u8(v.val[0], 4)), m));
+        r.val[2] = vqtbl4q_u8(t, vandq_u8(vorrq_u8(vshrq_n_u8(v.val[2], 6), vshlq_n_u8(v.val[1], 2)), m));
+        r.val[3] = vqtbl4q_u8(t, vandq_u8(v.val[2], m));
+        vst4q_u8((uint8*)x, r);
+    }
+    return i;
+}
+
+// invalid characters are 0xff in the table, or >= 0x80
+static size_t decode_neon(S s, size_t n, char* x, const int8* detab) {
+    const uint8x16x4_t t0 = load_table(detab);
+    const uint8x16x4_t t1 = load_table(detab + 64);
+    const uint8x16_t k64 = vdupq_n_u8(64);
+    const uint8x16_t k80 = vdupq_n_u8(0x80);
+    size_t i = 0;
+    for (; i + 68 <= n; i += 64, x += 48) {
+        const uint8x16x4_t v = vld4q_u8(s + i);
+        uint8x16_t d[4];
+        uint8x16_t bad = vdupq_n_u8(0);
+        for (int k = 0; k < 4; ++k) {
+            d[k] = vorrq_u8(vqtbl4q_u8(t0, v.val[k]), vqtbl4q_u8(t1, vsubq_u8(v.val[k], k64)));
+            bad = vorrq_u8(bad, vorrq_u8(d[k], vandq_u8(v.val[k], k80)));
+        }
+        if (vmaxvq_u8(bad) > 63) break;
+
+        uint8x16x3_t r;
+        r.val[0] = vorrq_u8(vshlq_n_u8(d[0], 2), vshrq_n_u8(d[1], 4));
+        r.val[1] = vorrq_u8(vshlq_n_u8(d[1], 4), vshrq_n_u8(d[2], 2));
+        r.val[2] = vorrq_u8(vshlq_n_u8(d[2], 6), d[3]);
+        vst3q_u8((uint8*)x, r);
+    }
+    return i;
+}
+#endif
+
+size_t encode(S s, size_t n, char* x, bool url) {
+    const char* const tab = url ? kUrlTab : kStdTab;
+    char* const x0 = x;
+#if defined(B64_AVX2)
+    if (n >= 64 && g_has_avx2) {
+        const size_t k = encode_avx2(s, n, x, url);
+        s += k, n -= k, x += k / 3 * 4;
+    }
+#elif defined(B64_NEON)
+    if (n >= 48) {
+        const size_t k = encode_neon(s, n, x, tab);
+        s += k, n -= k, x += k / 3 * 4;
+    }
+#endif
+
+    const size_t k = n / 3;
+    const int r = (int) (n - k * 3); // r = n % 3
     unsigned char a, b, c;
-    const unsigned char* s = (const unsigned char*) p;
     const unsigned char* e = s + n - r;
-    static const char* entab = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
     for (; s < e; s += 3, x += 4) {
         a = s[0];
         b = s[1];
         c = s[2];
-        x[0] = entab[a >> 2];
-        x[1] = entab[((a << 4) | (b >> 4)) & 0x3f];
-        x[2] = entab[((b << 2) | (c >> 6)) & 0x3f];
-        x[3] = entab[c & 0x3f];
+        x[0] = tab[a >> 2];
+        x[1] = tab[((a << 4) | (b >> 4)) & 0x3f];
+        x[2] = tab[((b << 2) | (c >> 6)) & 0x3f];
+        x[3] = tab[c & 0x3f];
     }
 
+    // no padding for the URL-safe encoding
     switch (r) {
       case 1:
         c = s[0];
-        x[0] = entab[c >> 2];
-        x[1] = entab[(c & 0x03) << 4];
+        x[0] = tab[c >> 2];
+        x[1] = tab[(c & 0x03) << 4];
+        if (url) { x += 2; break; }
         x[2] = '=';
         x[3] = '=';
+        x += 4;
         break;
       case 2:
         a = s[0];
         b = s[1];
-        x[0] = entab[a >> 2];
-        x[1] = entab[((a & 0x03) << 4) | (b >> 4)];
-        x[2] = entab[(b & 0x0f) << 2];
+        x[0] = tab[a >> 2];
+        x[1] = tab[((a & 0x03) << 4) | (b >> 4)];
+        x[2] = tab[(b & 0x0f) << 2];
+        if (url) { x += 3; break; }
         x[3] = '=';
+        x += 4;
         break;
     }
 
-    return v;
+    return x - x0;
 }
 
-fastring base64_decode(const void* p, size_t n) {
-    if (unlikely(n < 4)) return fastring();
+// return size of the result, or -1 on any error
+size_t decode(S s, size_t n, char* x, bool url) {
+    if (unlikely(n < 4)) {
+        if (n == 0) return 0;
+        if (!url || n == 1) return (size_t)-1;
+    }
 
-    fastring v(n * 3 >> 2); // size <= n * 3/4
-    char* x = (char*) v.data();
+    const int8* const detab = url ? kUrlDetab : kStdDetab;
+    char* const x0 = x;
+    S e = s + n;
     int m = 0;
-    const unsigned char* s = (const unsigned char*) p;
-    const unsigned char* e = s + n;
-    static const int8 detab[256] = {
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
-        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
-        -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
-        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
-        -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    };
+#if defined(B64_AVX2)
+    if (n >= 64 && g_has_avx2) {
+        const size_t k = decode_avx2(s, n, x, url);
+        s += k, x += k / 4 * 3;
+    }
+#elif defined(B64_NEON)
+    if (n >= 68) {
+        const size_t k = decode_neon(s, n, x, detab);
+        s += k, x += k / 4 * 3;
+    }
+#endif
 
     while (s + 8 <= e) {
         m = (detab[s[0]] << 18) | (detab[s[1]] << 12) | (detab[s[2]] << 6) | (detab[s[3]]);
@@ -86,24 +320,30 @@ fastring base64_decode(const void* p, size_t n) {
         }
     }
 
-    switch ((int)(e - s)) { /* 0 < e - s < 8 */
-      case 4:
-        break;
-      case 6:
-        if (e[-2] != '\r' && e[-1] != '\n') goto err;
-        e -= 2;
-        break;
-      default:
-        goto err;
+    if (e - s >= 6 && e[-2] == '\r' && e[-1] == '\n') e -= 2;
+
+    // the padding is optional for the URL-safe encoding, the last quantum may
+    // have 2 to 4 characters
+    if (url && e - s > 4) {
+        m = (detab[s[0]] << 18) | (detab[s[1]] << 12) | (detab[s[2]] << 6) | (detab[s[3]]);
+        if (unlikely(m < 0)) goto err;
+        x[0] = (char) ((m & 0x00ff0000) >> 16);
+        x[1] = (char) ((m & 0x0000ff00) >> 8);
+        x[2] = (char) (m & 0x000000ff);
+        s += 4, x += 3;
     }
 
-    do {
-        m = (detab[s[0]] << 18) | (detab[s[1]] << 12);// (a | b);
+    {
+        const int r = (int)(e - s);
+        if (url ? (r < 2 || r > 4) : r != 4) goto err;
+
+        m = (detab[s[0]] << 18) | (detab[s[1]] << 12);
         if (unlikely(m < 0)) goto err;
         *x++ = (char) ((m & 0x00ff0000) >> 16);
+        if (r == 2) goto end;
 
         if (s[2] == '=') {
-            if (s[3] == '=') break;
+            if (r == 4 && s[3] == '=') goto end;
             goto err;
         }
 
@@ -111,16 +351,64 @@ fastring base64_decode(const void* p, size_t n) {
         if (unlikely(m < 0)) goto err;
         *x++ = (char) ((m & 0x0000ff00) >> 8);
 
-        if (s[3] != '=') {
+        if (r == 4 && s[3] != '=') {
             m |= detab[s[3]];
             if (unlikely(m < 0)) goto err;
             *x++ = (char) (m & 0x000000ff);
         }
-    } while (0);
+    }
 
-    v.resize(x - v.data());
-    return v;
+  end:
+    return x - x0;
 
   err:
-    return fastring();
+    return (size_t)-1;
+}
+
+inline fastring encode(const void* s, size_t n, bool url) {
+    fastring v(base64_encode_size(n) + 1);
+    v.resize(encode((S)s, n, (char*)v.data(), url));
+    return v;
+}
+
+inline fastring decode(const void* s, size_t n, bool url) {
+    fastring v(base64_decode_size(n));
+    const size_t r = decode((S)s, n, (char*)v.data(), url);
+    if (r == (size_t)-1) return fastring();
+    v.resize(r);
+    return v;
+}
+
+} // namespace
+
+fastring base64_encode(const void* s, size_t n) {
+    return encode(s, n, false);
+}
+
+fastring base64_decode(const void* s, size_t n) {
+    return decode(s, n, false);
+}
+
+size_t base64_encode(const void* s, size_t n, char* buf) {
+    return encode((S)s, n, buf, false);
+}
+
+size_t base64_decode(const void* s, size_t n, char* buf) {
+    return decode((S)s, n, buf, false);
+}
+
+fastring base64url_encode(const void* s, size_t n) {
+    return encode(s, n, true);
+}
+
+fastring base64url_decode(const void* s, size_t n) {
+    return decode(s, n, true);
+}
+
+size_t base64url_encode(const void* s, size_t n, char* buf) {
+    return encode((S)s, n, buf, true);
+}
+
+size_t base64url_decode(const void* s, size_t n, char* buf) {
+    return decode((S)s, n, buf, true);
 }
@@ -0,0 +1,186 @@
+#include "co/hash/crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC_SSE42 // runtime dispatch
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC_ARM
+#include <arm_acle.h>
+#endif
+
+/*
+ * The hardware version follows crc32c.c by Mark Adler (zlib license). The
+ * buffer is split into 3 blocks, which are done in parallel as the crc32
+ * instruction has a latency of 3 cycles, and the results are combined by
+ * shifting the crc over the zeros of the following blocks with tables.
+ */
+namespace {
+
+const uint32 kPoly = 0x82f63b78; // reflected 0x1edc6f41
+
+// blocks of the 3-way parallel crc, in bytes
+const size_t kLong = 8192;
+const size_t kShort = 256;
+
+inline uint32 load32(const unsigned char* p) {
+    return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// multiply a 32x32 matrix over GF(2) by the vector @v
+inline uint32 gf2_times(const uint32* m, uint32 v) {
+    uint32 r = 0;
+    for (; v; v >>= 1, ++m) if (v & 1) r ^= *m;
+    return r;
+}
+
+inline void gf2_square(uint32* sq, const uint32* m) {
+    for (int i = 0; i < 32; ++i) sq[i] = gf2_times(m, m[i]);
+}
+
+// make in @even the operator that applies @n zero bytes to a crc
+void zeros_op(uint32* even, size_t n) {
+    uint32 odd[32];
+    odd[0] = kPoly; // operator for one zero bit
+    for (int i = 1; i < 32; ++i) odd[i] = 1u << (i - 1);
+    gf2_square(even, odd); // 2 zero bits
+    gf2_square(odd, even); // 4 zero bits
+
+    // the first square makes the operator for one zero byte
+    do {
+        gf2_square(even, odd);
+        n >>= 1;
+        if (n == 0) return;
+        gf2_square(odd, even);
+        n >>= 1;
+    } while (n);
+    for (int i = 0; i < 32; ++i) even[i] = odd[i];
+}
+
+void zeros_table(uint32 (*t)[256], size_t n) {
+    uint32 op[32];
+    zeros_op(op, n);
+    for (uint32 i = 0; i < 256; ++i) {
+        t[0][i] = gf2_times(op, i);
+        t[1][i] = gf2_times(op, i << 8);
+        t[2][i] = gf2_times(op, i << 16);
+        t[3][i] = gf2_times(op, i << 24);
+    }
+}
+
+struct Tables {
+    Tables() {
+        for (uint32 i = 0; i < 256; ++i) {
+            uint32 c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ kPoly : c >> 1;
+            sw[0][i] = c;
+        }
+        for (uint32 i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                sw[k][i] = (sw[k - 1][i] >> 8) ^ sw[0][sw[k - 1][i] & 0xff];
+            }
+        }
+        zeros_table(lz, kLong);
+        zeros_table(sz, kShort);
+    }
+
+    uint32 sw[8][256]; // slicing-by-8 tables
+    uint32 lz[4][256]; // shift over kLong zero bytes
+    uint32 sz[4][256]; // shift over kShort zero bytes
+};
+
+inline const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline uint32 shift(const uint32 (*t)[256], uint32 c) {
+    return t[0][c & 0xff] ^ t[1][(c >> 8) & 0xff] ^ t[2][(c >> 16) & 0xff] ^ t[3][c >> 24];
+}
+
+uint32 crc32c_sw(const unsigned char* p, size_t n, uint32 crc) {
+    const Tables& t = tables();
+    uint32 c = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        c ^= load32(p);
+        const uint32 h = load32(p + 4);
+        c = t.sw[7][c & 0xff] ^ t.sw[6][(c >> 8) & 0xff] ^
+            t.sw[5][(c >> 16) & 0xff] ^ t.sw[4][c >> 24] ^
+            t.sw[3][h & 0xff] ^ t.sw[2][(h >> 8) & 0xff] ^
+            t.sw[1][(h >> 16) & 0xff] ^ t.sw[0][h >> 24];
+    }
+    for (; n > 0; --n) c = t.sw[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+#if defined(CRC_SSE42) || defined(CRC_ARM)
+#if defined(CRC_SSE42)
+#define CRC_TARGET __attribute__((target("sse4.2")))
+#define _crc_u8(c, p)  _mm_crc32_u8(c, *(p))
+#define _crc_u64(c, p) crc_u64(c, p)
+
+CRC_TARGET inline uint32 crc_u64(uint32 c, const unsigned char* p) {
+    uint64 v;
+    memcpy(&v, p, 8);
+    return (uint32) _mm_crc32_u64(c, v);
+}
+
+inline bool _has_sse42() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static const bool g_has_crc = _has_sse42();
+#else
+#define CRC_TARGET
+#define _crc_u8(c, p)  __crc32cb(c, *(p))
+#define _crc_u64(c, p) crc_u64(c, p)
+
+inline uint32 crc_u64(uint32 c, const unsigned char* p) {
+    uint64 v;
+    memcpy(&v, p, 8);
+    return __crc32cd(c, v);
+}
+
+static const bool g_has_crc = true;
+#endif
+
+// 3 blocks of @b bytes each time, @z shifts a crc over @b zero bytes
+#define _CRC_3WAY(b, z) \
+    for (; n >= (b) * 3; n -= (b) * 3) { \
+        uint32 c1 = 0, c2 = 0; \
+        const unsigned char* const e = p + (b); \
+        do { \
+            c0 = _crc_u64(c0, p); \
+            c1 = _crc_u64(c1, p + (b)); \
+            c2 = _crc_u64(c2, p + (b) * 2); \
+            p += 8; \
+        } while (p < e); \
+        c0 = shift(z, c0) ^ c1; \
+        c0 = shift(z, c0) ^ c2; \
+        p += (b) * 2; \
+    }
+
+CRC_TARGET uint32 crc32c_hw(const unsigned char* p, size_t n, uint32 crc) {
+    uint32 c0 = ~crc;
+    for (; n > 0 && ((size_t)p & 7); --n) c0 = _crc_u8(c0, p++);
+
+    const Tables& t = tables();
+    _CRC_3WAY(kLong, t.lz);
+    _CRC_3WAY(kShort, t.sz);
+
+    for (; n >= 8; n -= 8, p += 8) c0 = _crc_u64(c0, p);
+    for (; n > 0; --n) c0 = _crc_u8(c0, p++);
+    return ~c0;
+}
+
+#undef _CRC_3WAY
+#endif
+
+} // namespace
+
+uint32 crc32c(const void* s, size_t n, uint32 crc) {
+#if defined(CRC_SSE42) || defined(CRC_ARM)
+    if (g_has_crc) return crc32c_hw((const unsigned char*)s, n, crc);
+#endif
+    return crc32c_sw((const unsigned char*)s, n, crc);
+}
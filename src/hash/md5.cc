@@ -313,3 +313,241 @@ void md5sum(const void* s, size_t n, char res[32]) {
         #undef hex_tb
     }
 }
+
+/*
+ * Multi-buffer md5, 8 messages are hashed in parallel with AVX2, one in each
+ * 32-bit lane. A lane takes the next message when it is done with one, so
+ * messages of different sizes keep all lanes busy. The blocks of the lanes
+ * are transposed so that a vector holds the same word of the 8 blocks.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+
+namespace {
+
+inline bool _has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// false before it is initialized, messages are hashed one by one then
+static const bool g_has_avx2 = _has_avx2();
+
+// a message in a lane, blocks after the full ones come from the tail with
+// the padding
+struct Lane {
+    const uint8* p;
+    size_t full;  // number of full blocks in the message
+    size_t nb;    // number of blocks, the padding included
+    size_t j;     // the next block
+    size_t idx;   // index of the message, -1 if the lane is empty
+    uint8 tail[128];
+
+    void set(const void* s, size_t n, size_t i) {
+        p = (const uint8*)s;
+        full = n >> 6;
+        const size_t r = n & 63;
+        nb = full + (r + 9 > 64 ? 2 : 1);
+        j = 0;
+        idx = i;
+        memcpy(tail, p + (full << 6), r);
+        tail[r] = 0x80;
+        const size_t e = (nb - full) << 6;
+        memset(tail + r + 1, 0, e - r - 9);
+        const uint64 bits = (uint64)n << 3;
+        memcpy(tail + e - 8, &bits, 8); // little-endian
+    }
+
+    const uint8* block() const {
+        return j < full ? p + (j << 6) : tail + ((j - full) << 6);
+    }
+};
+
+#define _MB_F(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define _MB_G(x, y, z) _mm256_xor_si256(y, _mm256_and_si256(z, _mm256_xor_si256(x, y)))
+#define _MB_H(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define _MB_I(x, y, z) _mm256_xor_si256(y, _mm256_or_si256(x, _mm256_xor_si256(z, ones)))
+#define _MB_STEP(f, a, b, c, d, i, t, s) \
+    a = _mm256_add_epi32(a, _mm256_add_epi32(f(b, c, d), \
+        _mm256_add_epi32(w[i], _mm256_set1_epi32((int)(t))))); \
+    a = _mm256_or_si256(_mm256_slli_epi32(a, s), _mm256_srli_epi32(a, 32 - (s))); \
+    a = _mm256_add_epi32(a, b)
+
+// transpose 8 rows of 8 words
+__attribute__((target("avx2")))
+inline void transpose8(__m256i* r) {
+    const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+    const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+    r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// a block of each lane, @st is the state of the lanes, a, b, c, d
+__attribute__((target("avx2")))
+void md5_body8(uint32 (*st)[8], const uint8* const* p) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i w[16];
+    for (int i = 0; i < 8; ++i) {
+        w[i] = _mm256_loadu_si256((const __m256i*)p[i]);
+        w[i + 8] = _mm256_loadu_si256((const __m256i*)(p[i] + 32));
+    }
+    transpose8(w);
+    transpose8(w + 8);
+
+    __m256i a = _mm256_loadu_si256((const __m256i*)st[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)st[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)st[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i*)st[3]);
+    const __m256i sa = a, sb = b, sc = c, sd = d;
+
+    _MB_STEP(_MB_F, a, b, c, d, 0, 0xd76aa478, 7);
+    _MB_STEP(_MB_F, d, a, b, c, 1, 0xe8c7b756, 12);
+    _MB_STEP(_MB_F, c, d, a, b, 2, 0x242070db, 17);
+    _MB_STEP(_MB_F, b, c, d, a, 3, 0xc1bdceee, 22);
+    _MB_STEP(_MB_F, a, b, c, d, 4, 0xf57c0faf, 7);
+    _MB_STEP(_MB_F, d, a, b, c, 5, 0x4787c62a, 12);
+    _MB_STEP(_MB_F, c, d, a, b, 6, 0xa8304613, 17);
+    _MB_STEP(_MB_F, b, c, d, a, 7, 0xfd469501, 22);
+    _MB_STEP(_MB_F, a, b, c, d, 8, 0x698098d8, 7);
+    _MB_STEP(_MB_F, d, a, b, c, 9, 0x8b44f7af, 12);
+    _MB_STEP(_MB_F, c, d, a, b, 10, 0xffff5bb1, 17);
+    _MB_STEP(_MB_F, b, c, d, a, 11, 0x895cd7be, 22);
+    _MB_STEP(_MB_F, a, b, c, d, 12, 0x6b901122, 7);
+    _MB_STEP(_MB_F, d, a, b, c, 13, 0xfd987193, 12);
+    _MB_STEP(_MB_F, c, d, a, b, 14, 0xa679438e, 17);
+    _MB_STEP(_MB_F, b, c, d, a, 15, 0x49b40821, 22);
+
+    _MB_STEP(_MB_G, a, b, c, d, 1, 0xf61e2562, 5);
+    _MB_STEP(_MB_G, d, a, b, c, 6, 0xc040b340, 9);
+    _MB_STEP(_MB_G, c, d, a, b, 11, 0x265e5a51, 14);
+    _MB_STEP(_MB_G, b, c, d, a, 0, 0xe9b6c7aa, 20);
+    _MB_STEP(_MB_G, a, b, c, d, 5, 0xd62f105d, 5);
+    _MB_STEP(_MB_G, d, a, b, c, 10, 0x02441453, 9);
+    _MB_STEP(_MB_G, c, d, a, b, 15, 0xd8a1e681, 14);
+    _MB_STEP(_MB_G, b, c, d, a, 4, 0xe7d3fbc8, 20);
+    _MB_STEP(_MB_G, a, b, c, d, 9, 0x21e1cde6, 5);
+    _MB_STEP(_MB_G, d, a, b, c, 14, 0xc33707d6, 9);
+    _MB_STEP(_MB_G, c, d, a, b, 3, 0xf4d50d87, 14);
+    _MB_STEP(_MB_G, b, c, d, a, 8, 0x455a14ed, 20);
+    _MB_STEP(_MB_G, a, b, c, d, 13, 0xa9e3e905, 5);
+    _MB_STEP(_MB_G, d, a, b, c, 2, 0xfcefa3f8, 9);
+    _MB_STEP(_MB_G, c, d, a, b, 7, 0x676f02d9, 14);
+    _MB_STEP(_MB_G, b, c, d, a, 12, 0x8d2a4c8a, 20);
+
+    _MB_STEP(_MB_H, a, b, c, d, 5, 0xfffa3942, 4);
+    _MB_STEP(_MB_H, d, a, b, c, 8, 0x8771f681, 11);
+    _MB_STEP(_MB_H, c, d, a, b, 11, 0x6d9d6122, 16);
+    _MB_STEP(_MB_H, b, c, d, a, 14, 0xfde5380c, 23);
+    _MB_STEP(_MB_H, a, b, c, d, 1, 0xa4beea44, 4);
+    _MB_STEP(_MB_H, d, a, b, c, 4, 0x4bdecfa9, 11);
+    _MB_STEP(_MB_H, c, d, a, b, 7, 0xf6bb4b60, 16);
+    _MB_STEP(_MB_H, b, c, d, a, 10, 0xbebfbc70, 23);
+    _MB_STEP(_MB_H, a, b, c, d, 13, 0x289b7ec6, 4);
+    _MB_STEP(_MB_H, d, a, b, c, 0, 0xeaa127fa, 11);
+    _MB_STEP(_MB_H, c, d, a, b, 3, 0xd4ef3085, 16);
+    _MB_STEP(_MB_H, b, c, d, a, 6, 0x04881d05, 23);
+    _MB_STEP(_MB_H, a, b, c, d, 9, 0xd9d4d039, 4);
+    _MB_STEP(_MB_H, d, a, b, c, 12, 0xe6db99e5, 11);
+    _MB_STEP(_MB_H, c, d, a, b, 15, 0x1fa27cf8, 16);
+    _MB_STEP(_MB_H, b, c, d, a, 2, 0xc4ac5665, 23);
+
+    _MB_STEP(_MB_I, a, b, c, d, 0, 0xf4292244, 6);
+    _MB_STEP(_MB_I, d, a, b, c, 7, 0x432aff97, 10);
+    _MB_STEP(_MB_I, c, d, a, b, 14, 0xab9423a7, 15);
+    _MB_STEP(_MB_I, b, c, d, a, 5, 0xfc93a039, 21);
+    _MB_STEP(_MB_I, a, b, c, d, 12, 0x655b59c3, 6);
+    _MB_STEP(_MB_I, d, a, b, c, 3, 0x8f0ccc92, 10);
+    _MB_STEP(_MB_I, c, d, a, b, 10, 0xffeff47d, 15);
+    _MB_STEP(_MB_I, b, c, d, a, 1, 0x85845dd1, 21);
+    _MB_STEP(_MB_I, a, b, c, d, 8, 0x6fa87e4f, 6);
+    _MB_STEP(_MB_I, d, a, b, c, 15, 0xfe2ce6e0, 10);
+    _MB_STEP(_MB_I, c, d, a, b, 6, 0xa3014314, 15);
+    _MB_STEP(_MB_I, b, c, d, a, 13, 0x4e0811a1, 21);
+    _MB_STEP(_MB_I, a, b, c, d, 4, 0xf7537e82, 6);
+    _MB_STEP(_MB_I, d, a, b, c, 11, 0xbd3af235, 10);
+    _MB_STEP(_MB_I, c, d, a, b, 2, 0x2ad7d2bb, 15);
+    _MB_STEP(_MB_I, b, c, d, a, 9, 0xeb86d391, 21);
+
+    _mm256_storeu_si256((__m256i*)st[0], _mm256_add_epi32(a, sa));
+    _mm256_storeu_si256((__m256i*)st[1], _mm256_add_epi32(b, sb));
+    _mm256_storeu_si256((__m256i*)st[2], _mm256_add_epi32(c, sc));
+    _mm256_storeu_si256((__m256i*)st[3], _mm256_add_epi32(d, sd));
+}
+
+#undef _MB_F
+#undef _MB_G
+#undef _MB_H
+#undef _MB_I
+#undef _MB_STEP
+
+void md5_multi8(const void* const* s, const size_t* n, size_t k, char* res) {
+    static const uint8 kZero[64] = { 0 };
+    Lane lane[8];
+    uint32 st[4][8];
+    const uint8* p[8];
+    size_t next = 0, busy = 0;
+
+    for (int i = 0; i < 8; ++i) lane[i].idx = (size_t)-1;
+    for (;;) {
+        // empty lanes take the next messages
+        for (int i = 0; i < 8; ++i) {
+            if (lane[i].idx != (size_t)-1) continue;
+            if (next == k) continue;
+            lane[i].set(s[next], n[next], next);
+            ++next;
+            ++busy;
+            st[0][i] = 0x67452301;
+            st[1][i] = 0xefcdab89;
+            st[2][i] = 0x98badcfe;
+            st[3][i] = 0x10325476;
+        }
+        if (busy == 0) break;
+
+        for (int i = 0; i < 8; ++i) {
+            p[i] = lane[i].idx != (size_t)-1 ? lane[i].block() : kZero;
+        }
+        md5_body8(st, p);
+
+        for (int i = 0; i < 8; ++i) {
+            Lane& l = lane[i];
+            if (l.idx == (size_t)-1 || ++l.j < l.nb) continue;
+            char* const r = res + (l.idx << 4);
+            for (int x = 0; x < 4; ++x) memcpy(r + x * 4, &st[x][i], 4); // little-endian
+            l.idx = (size_t)-1;
+            --busy;
+        }
+    }
+}
+
+} // namespace
+
+void md5digest_multi(const void* const* s, const size_t* n, size_t k, char* res) {
+    if (k > 1 && g_has_avx2) return md5_multi8(s, n, k, res);
+    for (size_t i = 0; i < k; ++i) md5digest(s[i], n[i], res + (i << 4));
+}
+
+#else
+void md5digest_multi(const void* const* s, const size_t* n, size_t k, char* res) {
+    for (size_t i = 0; i < k; ++i) md5digest(s[i], n[i], res + (i << 4));
+}
+#endif
@@ -2,9 +2,9 @@
 // It is inspired by github.com/mcmikecreations/nanoid_cpp.
 // Also see https://github.com/ai/nanoid for details.
 #include "co/hash/nanoid.h"
+#include "co/random.h"
 #include "co/god.h"
 #include <math.h>
-#include <random>
 
 #ifdef _WIN32
 #include <intrin.h>
@@ -21,41 +21,38 @@ inline uint32 _get_mask(uint32 x) { /* x > 1 */
 }
 #endif
 
-inline std::mt19937& _random() {
-    static thread_local std::mt19937 r(std::random_device{}());
-    return r;
-}
-
-inline void gen_random_bytes(uint8* p, uint32 n) {
-    auto& random = _random();
-    const uint32 x = (n >> 2) << 2;
-    uint32 i = 0;
-    for (; i < x; i += 4) {
-        *(uint32*)(p + i) = random();
-    }
-
-    if (i < n) {
-        *(uint32*)(p + i) = random();
-    }
+inline bool gen_random_bytes(uint8* p, uint32 n, bool secure) {
+    if (secure) return co::secure_random_bytes(p, n);
+    co::random_bytes(p, n);
+    return true;
 }
 
 // 2 <= len <= 255, n > 0
-fastring nanoid(const char* s, size_t len, int n) {
+static fastring gen_nanoid(const char* s, size_t len, int n, bool secure) {
     if (unlikely(len < 2 || len > 255 || n <= 0)) return fastring();
 
     const uint32 L = static_cast<uint32>(len);
     const uint32 mask = _get_mask(L);
-    const uint32 step = (uint32)::ceil(1.6 * (mask * n) / L);
-    fastring bytes(god::align_up(step, 4));
     fastring res(n);
-    int pos = 0;
-
     res.resize(n);
+
+    // all bytes are used if len is a power of 2
+    if (mask + 1 == L) {
+        uint8* const p = (uint8*)res.data();
+        if (!gen_random_bytes(p, n, secure)) return fastring();
+        for (int i = 0; i < n; ++i) p[i] = s[p[i] & mask];
+        return res;
+    }
+
+    uint8 buf[256];
+    const uint32 step = (uint32)::ceil(1.6 * (mask * n) / L);
+    const uint32 m = step < sizeof(buf) ? step : (uint32)sizeof(buf);
+    int pos = 0;
     while (true) {
-        gen_random_bytes((uint8*)bytes.data(), step);
-        for (size_t i = 0; i < step; ++i) {
-            const size_t index = bytes[i] & mask;
-            if (index < len) {
+        if (!gen_random_bytes(buf, m, secure)) return fastring();
+        for (uint32 i = 0; i < m; ++i) {
+            const uint32 index = buf[i] & mask;
+            if (index < L) {
                 res[pos] = s[index];
                 if (++pos == n) return res;
             }
@@ -65,23 +62,20 @@ fastring nanoid(const char* s, size_t len, int n) {
 
 const char* const kSymbols = "_-0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
+fastring nanoid(const char* s, size_t len, int n) {
+    return gen_nanoid(s, len, n, false);
+}
+
 fastring nanoid(int n) {
     if (unlikely(n <= 0)) n = 15;
-    const uint32 mask = 63;
-    const uint32 p = mask * n;
-    const uint32 r = p / 40;
-    const uint32 step = r + !!(p - r * 40); // ceil(1.6 * mask * n / 64)
-    fastring bytes(god::align_up(step, 4));
-    fastring res(n);
-    int pos = 0;
+    return gen_nanoid(kSymbols, 64, n, false);
+}
 
-    res.resize(n);
-    while (true) {
-        gen_random_bytes((uint8*)bytes.data(), step);
-        for (size_t i = 0; i < step; ++i) {
-            const size_t index = bytes[i] & mask;
-            res[pos] = kSymbols[index];
-            if (++pos == n) return res;
-        }
-    }
+fastring secure_nanoid(const char* s, size_t len, int n) {
+    return gen_nanoid(s, len, n, true);
+}
+
+fastring secure_nanoid(int n) {
+    if (unlikely(n <= 0)) n = 15;
+    return gen_nanoid(kSymbols, 64, n, true);
 }
@@ -7,6 +7,15 @@
 
 #include "co/hash/sha256.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA_NI // runtime dispatch
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#define SHA_ARM
+#include <arm_neon.h>
+#endif
+
 void sha256_init(sha256_ctx_t* p) {
     p->state[0] = 0x6a09e667;
     p->state[1] = 0xbb67ae85;
@@ -83,30 +92,160 @@ inline void sha256_transform(uint32* state, const uint32* data) {
 #undef s0
 #undef s1
 
-inline void sha256_write_byte_block(sha256_ctx_t* p) {
+// process @n 64-byte blocks, the words are in big-endian
+static void sha256_blocks_c(uint32* state, const uint8* p, size_t n) {
     uint32 data32[16];
-    unsigned i;
-    for (i = 0; i < 16; i++)
-        data32[i] =
-        ((uint32)(p->buffer[i * 4]) << 24) +
-        ((uint32)(p->buffer[i * 4 + 1]) << 16) +
-        ((uint32)(p->buffer[i * 4 + 2]) << 8) +
-        ((uint32)(p->buffer[i * 4 + 3]));
-    sha256_transform(p->state, data32);
+    for (; n > 0; --n, p += 64) {
+        for (unsigned i = 0; i < 16; i++)
+            data32[i] =
+            ((uint32)(p[i * 4]) << 24) +
+            ((uint32)(p[i * 4 + 1]) << 16) +
+            ((uint32)(p[i * 4 + 2]) << 8) +
+            ((uint32)(p[i * 4 + 3]));
+        sha256_transform(state, data32);
+    }
+}
+
+/*
+ * The SHA-NI version follows the public domain code of Sean Gulley (Intel) and
+ * Jeffrey Walton. The cpu is checked at runtime. The ARMv8 version is used if
+ * the crypto extension is enabled at compile time, e.g. -march=armv8-a+crypto.
+ */
+#if defined(SHA_NI)
+inline bool _has_sha_ni() {
+    unsigned a, b, c, d;
+    if (__get_cpuid_max(0, 0) < 7) return false;
+    __cpuid(1, a, b, c, d);
+    if (!(c & bit_SSSE3) || !(c & bit_SSE4_1)) return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 29) & 1;
+}
+
+// false before it is initialized, the C version is used then
+static const bool g_has_sha_ni = _has_sha_ni();
+
+// 4 rounds, @cur is the 4 words of the message, @nxt and @prv for the rounds
+// after and before, the message schedule is done by sha256msg1/sha256msg2
+#define _SHA_NI_R4(i, cur, nxt, prv) \
+    msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*)(K + (i) * 4))); \
+    s1 = _mm_sha256rnds2_epu32(s1, s0, msg); \
+    if ((i) >= 3 && (i) <= 14) { \
+        nxt = _mm_sha256msg2_epu32(_mm_add_epi32(nxt, _mm_alignr_epi8(cur, prv, 4)), cur); \
+    } \
+    msg = _mm_shuffle_epi32(msg, 0x0e); \
+    s0 = _mm_sha256rnds2_epu32(s0, s1, msg); \
+    if ((i) >= 1 && (i) <= 12) prv = _mm_sha256msg1_epu32(prv, cur)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_ni(uint32* state, const uint8* p, size_t n) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i s0, s1, msg, m0, m1, m2, m3;
+
+    // the state is kept as ABEF and CDGH
+    msg = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xb1);  // CDAB
+    s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b); // EFGH
+    s0 = _mm_alignr_epi8(msg, s1, 8);    // ABEF
+    s1 = _mm_blend_epi16(s1, msg, 0xf0); // CDGH
+
+    for (; n > 0; --n, p += 64) {
+        const __m128i x0 = s0, x1 = s1;
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 0)), mask);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), mask);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), mask);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), mask);
+
+        _SHA_NI_R4(0, m0, m1, m3);
+        _SHA_NI_R4(1, m1, m2, m0);
+        _SHA_NI_R4(2, m2, m3, m1);
+        _SHA_NI_R4(3, m3, m0, m2);
+        _SHA_NI_R4(4, m0, m1, m3);
+        _SHA_NI_R4(5, m1, m2, m0);
+        _SHA_NI_R4(6, m2, m3, m1);
+        _SHA_NI_R4(7, m3, m0, m2);
+        _SHA_NI_R4(8, m0, m1, m3);
+        _SHA_NI_R4(9, m1, m2, m0);
+        _SHA_NI_R4(10, m2, m3, m1);
+        _SHA_NI_R4(11, m3, m0, m2);
+        _SHA_NI_R4(12, m0, m1, m3);
+        _SHA_NI_R4(13, m1, m2, m0);
+        _SHA_NI_R4(14, m2, m3, m1);
+        _SHA_NI_R4(15, m3, m0, m2);
+
+        s0 = _mm_add_epi32(s0, x0);
+        s1 = _mm_add_epi32(s1, x1);
+    }
+
+    msg = _mm_shuffle_epi32(s0, 0x1b); // FEBA
+    s1 = _mm_shuffle_epi32(s1, 0xb1);  // DCHG
+    _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(msg, s1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(s1, msg, 8)); // HGFE
+}
+
+#undef _SHA_NI_R4
+
+#elif defined(SHA_ARM)
+static void sha256_blocks_arm(uint32* state, const uint8* p, size_t n) {
+    uint32x4_t s0 = vld1q_u32(state);
+    uint32x4_t s1 = vld1q_u32(state + 4);
+    uint32x4_t m[4];
+
+    for (; n > 0; --n, p += 64) {
+        const uint32x4_t x0 = s0, x1 = s1;
+        for (int i = 0; i < 4; ++i) {
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + i * 16)));
+        }
+        for (int i = 0; i < 16; ++i) {
+            const uint32x4_t t = vaddq_u32(m[i & 3], vld1q_u32(K + i * 4));
+            if (i < 12) {
+                m[i & 3] = vsha256su1q_u32(
+                    vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]
+                );
+            }
+            const uint32x4_t x = s0;
+            s0 = vsha256hq_u32(s0, s1, t);
+            s1 = vsha256h2q_u32(s1, x, t);
+        }
+        s0 = vaddq_u32(s0, x0);
+        s1 = vaddq_u32(s1, x1);
+    }
+
+    vst1q_u32(state, s0);
+    vst1q_u32(state + 4, s1);
+}
+#endif
+
+inline void sha256_blocks(uint32* state, const uint8* p, size_t n) {
+#if defined(SHA_NI)
+    if (g_has_sha_ni) return sha256_blocks_ni(state, p, n);
+#elif defined(SHA_ARM)
+    return sha256_blocks_arm(state, p, n);
+#endif
+    sha256_blocks_c(state, p, n);
 }
 
 void sha256_update(sha256_ctx_t* p, const void* s, size_t n) {
     const uint8* data = (const uint8*)s;
-    uint32 pos = (uint32)p->count & 0x3F;
-    while (n > 0) {
-        p->buffer[pos++] = *data++;
-        ++p->count;
-        --n;
-        if (pos == 64) {
-            pos = 0;
-            sha256_write_byte_block(p);
+    const uint32 pos = (uint32)p->count & 0x3F;
+    p->count += n;
+
+    if (pos) {
+        const size_t k = 64 - pos;
+        if (n < k) {
+            memcpy(p->buffer + pos, data, n);
+            return;
         }
+        memcpy(p->buffer + pos, data, k);
+        sha256_blocks(p->state, p->buffer, 1);
+        data += k;
+        n -= k;
+    }
+
+    if (n >= 64) {
+        sha256_blocks(p->state, data, n >> 6);
+        data += n & ~(size_t)0x3F;
+        n &= 0x3F;
     }
+    if (n > 0) memcpy(p->buffer, data, n);
 }
 
 void sha256_final(sha256_ctx_t* p, uint8 res[32]) {
@@ -117,14 +256,14 @@ void sha256_final(sha256_ctx_t* p, uint8 res[32]) {
     p->buffer[pos++] = 0x80;
     while (pos != (64 - 8)) {
         pos &= 0x3F;
-        if (pos == 0) sha256_write_byte_block(p);
+        if (pos == 0) sha256_blocks(p->state, p->buffer, 1);
         p->buffer[pos++] = 0;
     }
     for (i = 0; i < 8; ++i) {
         p->buffer[pos++] = (uint8)(nbits >> 56);
         nbits <<= 8;
     }
-    sha256_write_byte_block(p);
+    sha256_blocks(p->state, p->buffer, 1);
 
     for (i = 0; i < 8; ++i) {
         *res++ = (uint8)(p->state[i] >> 24);
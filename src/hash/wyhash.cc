@@ -0,0 +1,126 @@
+/*
+ * wyhash from https://github.com/wangyi-fudan/wyhash, final version 4.
+ * Written by Wang Yi, and is released into the public domain (The Unlicense).
+ */
+
+#include "co/hash/wyhash.h"
+#include <string.h>
+
+namespace {
+
+const uint64 kSecret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+inline uint64 wyr8(const uint8* p) { uint64 v; memcpy(&v, p, 8); return v; }
+inline uint64 wyr4(const uint8* p) { uint32 v; memcpy(&v, p, 4); return v; }
+inline uint64 wyr3(const uint8* p, size_t k) {
+    return (((uint64)p[0]) << 16) | (((uint64)p[k >> 1]) << 8) | p[k - 1];
+}
+
+inline uint64 wyseed(uint64 seed) {
+    return seed ^ wymix(seed ^ kSecret[0], kSecret[1]);
+}
+
+// a 48-byte block, in 3 lanes
+inline void wyblock(uint64* s, const uint8* p) {
+    s[0] = wymix(wyr8(p) ^ kSecret[1], wyr8(p + 8) ^ s[0]);
+    s[1] = wymix(wyr8(p + 16) ^ kSecret[2], wyr8(p + 24) ^ s[1]);
+    s[2] = wymix(wyr8(p + 32) ^ kSecret[3], wyr8(p + 40) ^ s[2]);
+}
+
+// hash the last @i (< 48) bytes at @p, @len > 16, 16 bytes before @p are
+// readable if @i < 16
+inline uint64 wytail(uint64 seed, const uint8* p, size_t i, uint64 len) {
+    while (i > 16) {
+        seed = wymix(wyr8(p) ^ kSecret[1], wyr8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+    }
+    uint64 a = wyr8(p + i - 16) ^ kSecret[1];
+    uint64 b = wyr8(p + i - 8) ^ seed;
+    wymum(&a, &b);
+    return wymix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+inline uint64 wyshort(uint64 seed, const uint8* p, size_t len) {
+    uint64 a, b;
+    if (len >= 4) {
+        a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+        b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+        a = wyr3(p, len);
+        b = 0;
+    } else {
+        a = b = 0;
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+} // namespace
+
+uint64 wyhash64(const void* s, size_t n, uint64 seed) {
+    const uint8* p = (const uint8*)s;
+    seed = wyseed(seed);
+    if (n <= 16) return wyshort(seed, p, n);
+
+    size_t i = n;
+    if (unlikely(i >= 48)) {
+        uint64 x[3] = { seed, seed, seed };
+        do {
+            wyblock(x, p);
+            p += 48;
+            i -= 48;
+        } while (i >= 48);
+        seed = x[0] ^ x[1] ^ x[2];
+    }
+    return wytail(seed, p, i, n);
+}
+
+void wyhash_init(wyhash_ctx_t* ctx, uint64 seed) {
+    ctx->s[0] = ctx->s[1] = ctx->s[2] = wyseed(seed);
+    ctx->len = 0;
+    ctx->n = 0;
+}
+
+// blocks are processed as soon as 48 bytes are available, the same as
+// wyhash64(), as later data can only make the total size larger
+void wyhash_update(wyhash_ctx_t* ctx, const void* s, size_t n) {
+    const uint8* p = (const uint8*)s;
+    uint8* const q = ctx->buf + 16;
+    ctx->len += n;
+    if (ctx->n > 0) {
+        const size_t k = 48 - ctx->n < n ? 48 - ctx->n : n;
+        memcpy(q + ctx->n, p, k);
+        ctx->n += (uint32)k;
+        p += k;
+        n -= k;
+        if (ctx->n < 48) return;
+        wyblock(ctx->s, q);
+        memcpy(ctx->buf, q + 32, 16);
+        ctx->n = 0;
+    }
+    if (n >= 48) {
+        do {
+            wyblock(ctx->s, p);
+            p += 48;
+            n -= 48;
+        } while (n >= 48);
+        memcpy(ctx->buf, p - 16, 16);
+    }
+    if (n > 0) {
+        memcpy(q, p, n);
+        ctx->n = (uint32)n;
+    }
+}
+
+uint64 wyhash_final(const wyhash_ctx_t* ctx) {
+    const uint8* const q = ctx->buf + 16;
+    if (ctx->len <= 16) return wyshort(ctx->s[0], q, (size_t)ctx->len);
+    const uint64 seed = ctx->len >= 48 ? ctx->s[0] ^ ctx->s[1] ^ ctx->s[2] : ctx->s[0];
+    return wytail(seed, q, ctx->n, ctx->len);
+}
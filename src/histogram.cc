@@ -0,0 +1,308 @@
+#include "co/histogram.h"
+#include "co/atomic.h"
+#include "co/mem.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace co {
+namespace xx {
+
+inline int find_msb64(uint64 x) { /* x != 0 */
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long r;
+    _BitScanReverse64(&r, x);
+    return (int)r;
+#elif defined(_MSC_VER)
+    unsigned long r;
+    if (_BitScanReverse(&r, (uint32)(x >> 32))) return 32 + (int)r;
+    _BitScanReverse(&r, (uint32)x);
+    return (int)r;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+struct hist_shard {
+    uint64 sum;
+    uint64 min;
+    uint64 max;
+    uint64 b[Histogram::buckets];
+};
+
+struct hist_t {
+    uint32 n;
+    hist_shard** s;
+};
+
+inline hist_shard* new_shard() {
+    hist_shard* s = (hist_shard*) co::zalloc(sizeof(hist_shard)); assert(s);
+    s->min = (uint64)-1;
+    return s;
+}
+
+// shard of the current thread, threads are spread over shards in turn
+inline hist_shard* get_shard(hist_t* h) {
+    static uint32 g_next = 0;
+    static __thread uint32 t = (uint32)-1;
+    if (t == (uint32)-1) t = atomic_fetch_inc(&g_next, mo_relaxed);
+    hist_shard** const p = &h->s[t % h->n];
+    hist_shard* s = atomic_load(p, mo_acquire);
+    if (s) return s;
+
+    s = new_shard();
+    hist_shard* x = 0;
+    if (atomic_bool_cas(p, x, s, mo_acq_rel, mo_acquire)) return s;
+    co::free(s, sizeof(hist_shard));
+    return atomic_load(p, mo_acquire);
+}
+
+inline void update_min(uint64* p, uint64 v) {
+    uint64 x = atomic_load(p, mo_relaxed);
+    while (v < x && !atomic_bool_cas(p, x, v, mo_relaxed, mo_relaxed)) {
+        x = atomic_load(p, mo_relaxed);
+    }
+}
+
+inline void update_max(uint64* p, uint64 v) {
+    uint64 x = atomic_load(p, mo_relaxed);
+    while (v > x && !atomic_bool_cas(p, x, v, mo_relaxed, mo_relaxed)) {
+        x = atomic_load(p, mo_relaxed);
+    }
+}
+
+// sum up the shards to @r
+inline void snapshot(const hist_t* h, hist_shard& r) {
+    memset(&r, 0, sizeof(r));
+    r.min = (uint64)-1;
+    for (uint32 k = 0; k < h->n; ++k) {
+        const hist_shard* s = atomic_load(&h->s[k], mo_acquire);
+        if (!s) continue;
+        r.sum += atomic_load(&s->sum, mo_relaxed);
+        const uint64 a = atomic_load(&s->min, mo_relaxed);
+        const uint64 b = atomic_load(&s->max, mo_relaxed);
+        if (a < r.min) r.min = a;
+        if (b > r.max) r.max = b;
+        for (uint32 i = 0; i < Histogram::buckets; ++i) {
+            r.b[i] += atomic_load(&s->b[i], mo_relaxed);
+        }
+    }
+}
+
+inline uint64 count_of(const hist_shard& r) {
+    uint64 n = 0;
+    for (uint32 i = 0; i < Histogram::buckets; ++i) n += r.b[i];
+    return n;
+}
+
+} // xx
+
+#define _hist ((xx::hist_t*)_p)
+
+Histogram::Histogram(uint32 shards) {
+    if (shards == 0) shards = 1;
+    _p = co::alloc(sizeof(xx::hist_t)); assert(_p);
+    _hist->n = shards;
+    _hist->s = (xx::hist_shard**) co::zalloc(sizeof(xx::hist_shard*) * shards);
+    assert(_hist->s);
+}
+
+Histogram::~Histogram() {
+    if (_p) {
+        for (uint32 i = 0; i < _hist->n; ++i) {
+            if (_hist->s[i]) co::free(_hist->s[i], sizeof(xx::hist_shard));
+        }
+        co::free(_hist->s, sizeof(xx::hist_shard*) * _hist->n);
+        co::free(_p, sizeof(xx::hist_t));
+        _p = 0;
+    }
+}
+
+uint32 Histogram::bucket_of(uint64 v) {
+    if (v < (1u << sub_bits)) return (uint32)v;
+    const int h = xx::find_msb64(v);
+    return ((uint32)(h - sub_bits + 1) << sub_bits) |
+           ((uint32)(v >> (h - sub_bits)) & ((1u << sub_bits) - 1));
+}
+
+uint64 Histogram::bucket_low(uint32 i) {
+    if (i < (1u << sub_bits)) return i;
+    const uint32 e = (i >> sub_bits) - 1;
+    const uint64 m = (i & ((1u << sub_bits) - 1)) | (1u << sub_bits);
+    return m << e;
+}
+
+uint64 Histogram::bucket_high(uint32 i) {
+    if (i < (1u << sub_bits)) return i;
+    const uint32 e = (i >> sub_bits) - 1;
+    return bucket_low(i) + ((uint64(1) << e) - 1);
+}
+
+void Histogram::record(uint64 v, uint64 n) {
+    if (n == 0) return;
+    xx::hist_shard* s = xx::get_shard(_hist);
+    atomic_add(&s->b[bucket_of(v)], n, mo_relaxed);
+    atomic_add(&s->sum, v * n, mo_relaxed);
+    xx::update_min(&s->min, v);
+    xx::update_max(&s->max, v);
+}
+
+void Histogram::merge(const Histogram& h) {
+    if (&h == this) return;
+    xx::hist_shard* r = (xx::hist_shard*) co::alloc(sizeof(xx::hist_shard)); assert(r);
+    xx::snapshot((const xx::hist_t*)h._p, *r);
+    if (xx::count_of(*r) > 0) {
+        xx::hist_shard* s = xx::get_shard(_hist);
+        for (uint32 i = 0; i < buckets; ++i) {
+            if (r->b[i]) atomic_add(&s->b[i], r->b[i], mo_relaxed);
+        }
+        atomic_add(&s->sum, r->sum, mo_relaxed);
+        xx::update_min(&s->min, r->min);
+        xx::update_max(&s->max, r->max);
+    }
+    co::free(r, sizeof(xx::hist_shard));
+}
+
+void Histogram::reset() {
+    for (uint32 k = 0; k < _hist->n; ++k) {
+        xx::hist_shard* s = _hist->s[k];
+        if (!s) continue;
+        memset(s, 0, sizeof(*s));
+        s->min = (uint64)-1;
+    }
+}
+
+uint64 Histogram::count() const {
+    uint64 n = 0;
+    for (uint32 k = 0; k < _hist->n; ++k) {
+        const xx::hist_shard* s = atomic_load(&_hist->s[k], mo_acquire);
+        if (!s) continue;
+        for (uint32 i = 0; i < buckets; ++i) n += atomic_load(&s->b[i], mo_relaxed);
+    }
+    return n;
+}
+
+uint64 Histogram::sum() const {
+    uint64 n = 0;
+    for (uint32 k = 0; k < _hist->n; ++k) {
+        const xx::hist_shard* s = atomic_load(&_hist->s[k], mo_acquire);
+        if (s) n += atomic_load(&s->sum, mo_relaxed);
+    }
+    return n;
+}
+
+uint64 Histogram::min() const {
+    uint64 x = (uint64)-1;
+    for (uint32 k = 0; k < _hist->n; ++k) {
+        const xx::hist_shard* s = atomic_load(&_hist->s[k], mo_acquire);
+        if (s) {
+            const uint64 v = atomic_load(&s->min, mo_relaxed);
+            if (v < x) x = v;
+        }
+    }
+    return x == (uint64)-1 ? 0 : x;
+}
+
+uint64 Histogram::max() const {
+    uint64 x = 0;
+    for (uint32 k = 0; k < _hist->n; ++k) {
+        const xx::hist_shard* s = atomic_load(&_hist->s[k], mo_acquire);
+        if (s) {
+            const uint64 v = atomic_load(&s->max, mo_relaxed);
+            if (v > x) x = v;
+        }
+    }
+    return x;
+}
+
+double Histogram::mean() const {
+    const uint64 n = this->count();
+    return n ? (double)this->sum() / (double)n : 0;
+}
+
+uint64 Histogram::percentile(double p) const {
+    uint64 x;
+    this->percentiles(&p, &x, 1);
+    return x;
+}
+
+// the value at rank ceil(p * count / 100), the highest value of its bucket,
+// which is limited to [min, max]
+static void _percentiles(const xx::hist_shard& r, const double* ps, uint64* out, size_t n) {
+    const uint64 total = xx::count_of(r);
+    for (size_t k = 0; k < n; ++k) {
+        if (total == 0) { out[k] = 0; continue; }
+        const double p = ps[k] < 0 ? 0 : (ps[k] > 100 ? 100 : ps[k]);
+        uint64 rank = (uint64)(p * total / 100);
+        if ((double)rank * 100 < p * total) ++rank;
+        if (rank == 0) { out[k] = r.min; continue; }
+
+        uint64 c = 0, v = r.max;
+        for (uint32 i = 0; i < Histogram::buckets; ++i) {
+            c += r.b[i];
+            if (c >= rank) { v = Histogram::bucket_high(i); break; }
+        }
+        out[k] = v > r.max ? r.max : (v < r.min ? r.min : v);
+    }
+}
+
+void Histogram::percentiles(const double* ps, uint64* out, size_t n) const {
+    xx::hist_shard* r = (xx::hist_shard*) co::alloc(sizeof(xx::hist_shard)); assert(r);
+    xx::snapshot(_hist, *r);
+    _percentiles(*r, ps, out, n);
+    co::free(r, sizeof(xx::hist_shard));
+}
+
+Json Histogram::to_json(bool buckets) const {
+    xx::hist_shard* r = (xx::hist_shard*) co::alloc(sizeof(xx::hist_shard)); assert(r);
+    xx::snapshot(_hist, *r);
+    const uint64 n = xx::count_of(*r);
+    static const double ps[] = { 50, 90, 99, 99.9 };
+    uint64 v[4];
+    _percentiles(*r, ps, v, 4);
+
+    Json x = json::object();
+    x.add_member("count", n);
+    x.add_member("sum", r->sum);
+    x.add_member("min", n ? r->min : 0);
+    x.add_member("max", r->max);
+    x.add_member("mean", n ? (double)r->sum / (double)n : 0.0);
+    x.add_member("p50", v[0]);
+    x.add_member("p90", v[1]);
+    x.add_member("p99", v[2]);
+    x.add_member("p999", v[3]);
+    if (buckets) {
+        Json a = json::array();
+        for (uint32 i = 0; i < Histogram::buckets; ++i) {
+            if (r->b[i]) a.push_back(Json({ bucket_low(i), r->b[i] }));
+        }
+        x.add_member("buckets", a);
+    }
+    co::free(r, sizeof(xx::hist_shard));
+    return x;
+}
+
+bool Histogram::from_json(const Json& x) {
+    const Json& a = x.get("buckets");
+    if (!a.is_array()) return false;
+    for (uint32 i = 0; i < a.array_size(); ++i) {
+        const Json& e = a[i];
+        if (!e.is_array() || e.array_size() != 2 || !e[0].is_int() || !e[1].is_int()) return false;
+    }
+    if (a.array_size() == 0) return true;
+
+    xx::hist_shard* s = xx::get_shard(_hist);
+    for (uint32 i = 0; i < a.array_size(); ++i) {
+        const Json& e = a[i];
+        atomic_add(&s->b[bucket_of((uint64)e[0].as_int64())], (uint64)e[1].as_int64(), mo_relaxed);
+    }
+    atomic_add(&s->sum, (uint64)x.get("sum").as_int64(), mo_relaxed);
+    xx::update_min(&s->min, (uint64)x.get("min").as_int64());
+    xx::update_max(&s->max, (uint64)x.get("max").as_int64());
+    return true;
+}
+
+#undef _hist
+
+} // co
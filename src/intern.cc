@@ -0,0 +1,118 @@
+#include "co/intern.h"
+#include "co/atomic.h"
+#include "co/god.h"
+#include "co/hash.h"
+#include "co/mem.h"
+#include <mutex>
+
+namespace co {
+namespace xx {
+
+// a string is stored as [hash:4][size:4][contents]['\0'], the pointer
+// returned refers to the contents
+inline bool intern_eq(const char* s, uint32 h, const void* p, size_t n) {
+    return intern_hash(s) == h && intern_size(s) == n && memcmp(s, p, n) == 0;
+}
+
+// a shard of the global table, open addressing with linear probing
+class InternShard {
+  public:
+    InternShard() : _s(0), _cap(0), _n(0), _p(0), _left(0) {}
+
+    const char* find_or_add(uint32 h, const void* p, size_t n) {
+        std::lock_guard<std::mutex> g(_mtx);
+        if (_n * 4 >= _cap * 3) this->grow();
+        uint32 i = h & (_cap - 1);
+        for (const char* s; (s = _s[i]) != 0; i = (i + 1) & (_cap - 1)) {
+            if (intern_eq(s, h, p, n)) return s;
+        }
+        return _s[i] = this->make(h, p, n);
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> g(_mtx);
+        return _n;
+    }
+
+  private:
+    // strings are copied to chunks of static memory, they are never freed
+    const char* make(uint32 h, const void* p, size_t n) {
+        const size_t x = god::align_up<8>(n + 9);
+        char* b;
+        if (x > 1024) {
+            b = (char*) co::static_alloc(x);
+        } else {
+            if (x > _left) {
+                _p = (char*) co::static_alloc(16 * 1024);
+                _left = 16 * 1024;
+            }
+            b = _p;
+            _p += x;
+            _left -= x;
+        }
+        ((uint32*)b)[0] = h;
+        ((uint32*)b)[1] = (uint32)n;
+        memcpy(b + 8, p, n);
+        b[8 + n] = '\0';
+        ++_n;
+        return b + 8;
+    }
+
+    void grow() {
+        const uint32 cap = _cap ? _cap << 1 : 256;
+        const char** s = (const char**) co::zalloc(cap * sizeof(char*));
+        for (uint32 k = 0; k < _cap; ++k) {
+            if (!_s[k]) continue;
+            uint32 i = intern_hash(_s[k]) & (cap - 1);
+            while (s[i]) i = (i + 1) & (cap - 1);
+            s[i] = _s[k];
+        }
+        if (_s) co::free(_s, _cap * sizeof(char*));
+        _s = s;
+        _cap = cap;
+    }
+
+    std::mutex _mtx;
+    const char** _s;
+    uint32 _cap;
+    uint32 _n;
+    char* _p;     // free space in the current chunk
+    size_t _left; // bytes left in the current chunk
+};
+
+const uint32 kShards = 16;
+const uint32 kCacheSize = 512;
+
+struct InternTable {
+    InternShard s[kShards];
+};
+
+inline InternShard* intern_shards() {
+    static InternTable* t = co::static_new<InternTable>();
+    return t->s;
+}
+
+// strings looked up recently by the current thread, indexed by hash
+inline const char** intern_cache() {
+    static __thread const char** kC = 0;
+    return kC ? kC : (kC = (const char**) co::zalloc(kCacheSize * sizeof(char*)));
+}
+
+} // xx
+
+const char* intern(const void* p, size_t n) {
+    const uint32 h = wyhash32(p, n);
+    const char*& c = xx::intern_cache()[h & (xx::kCacheSize - 1)];
+    if (c && xx::intern_eq(c, h, p, n)) return c;
+    // the lower bits index the slots of a shard, use the higher bits here
+    return c = xx::intern_shards()[h >> 28].find_or_add(h, p, n);
+}
+
+size_t intern_num() {
+    size_t n = 0;
+    auto s = xx::intern_shards();
+    for (uint32 i = 0; i < xx::kShards; ++i) n += s[i].size();
+    return n;
+}
+
+} // co
@@ -0,0 +1,247 @@
+#include "co/iobuf.h"
+#include "co/atomic.h"
+#include "co/mem.h"
+
+namespace co {
+namespace {
+
+typedef iobuf::Block Block;
+
+inline Block* new_block(size_t n) {
+    const size_t x = sizeof(Block) + n;
+    const size_t cap = x < iobuf::kBlockSize ? iobuf::kBlockSize : x;
+    Block* b = (Block*) co::alloc(cap);
+    b->refs = 1;
+    b->cap = (uint32)(cap - sizeof(Block));
+    b->used = 0;
+    b->own = 1;
+    b->data = (char*)(b + 1);
+    return b;
+}
+
+inline void ref_block(Block* b) {
+    if (b) atomic_inc(&b->refs, mo_relaxed);
+}
+
+inline void unref_block(Block* b) {
+    if (b && atomic_dec(&b->refs, mo_acq_rel) == 0) {
+        if (b->own) {
+            co::free(b, sizeof(Block) + b->cap);
+        } else {
+            co::free(b->data, b->cap);
+            co::free(b, sizeof(Block));
+        }
+    }
+}
+
+} // namespace
+
+void iobuf::_reserve(uint32 n) {
+    if (n > _cap) {
+        uint32 cap = _cap ? _cap : 8;
+        while (cap < n) cap <<= 1;
+        _refs = (Ref*) co::realloc(_refs, _cap * sizeof(Ref), cap * sizeof(Ref));
+        assert(_refs);
+        _cap = cap;
+    }
+}
+
+void iobuf::_push(const Ref& r) {
+    this->_reserve(_n + 1);
+    _refs[_n++] = r;
+    _size += r.n;
+}
+
+void iobuf::clear() {
+    for (uint32 i = 0; i < _n; ++i) unref_block(_refs[i].b);
+    _n = 0;
+    _size = 0;
+}
+
+void iobuf::reset() {
+    this->clear();
+    if (_refs) {
+        co::free(_refs, _cap * sizeof(Ref));
+        _refs = 0;
+        _cap = 0;
+    }
+}
+
+iobuf& iobuf::append(const void* p, size_t n) {
+    if (n == 0) return *this;
+    const char* s = (const char*)p;
+
+    // fill the last block, if the last segment ends where the block is written
+    if (_n > 0) {
+        Ref& r = _refs[_n - 1];
+        Block* const b = r.b;
+        if (b && atomic_load(&b->refs, mo_acquire) == 1 && r.p + r.n == b->data + b->used) {
+            const size_t x = b->cap - b->used;
+            const size_t k = x < n ? x : n;
+            if (k > 0) {
+                memcpy(b->data + b->used, s, k);
+                b->used += (uint32)k;
+                r.n += k;
+                _size += k;
+                s += k;
+                n -= k;
+                if (n == 0) return *this;
+            }
+        }
+    }
+
+    Block* const b = new_block(n);
+    memcpy(b->data, s, n);
+    b->used = (uint32)n;
+    Ref r = { b, b->data, n };
+    this->_push(r);
+    return *this;
+}
+
+iobuf& iobuf::append(fastring&& s) {
+    const size_t n = s.size();
+    if (n == 0) return *this;
+    if (n < 256) return this->append(s.data(), n); // not worth a block for it
+
+    Block* const b = (Block*) co::alloc(sizeof(Block));
+    b->refs = 1;
+    b->cap = (uint32)s.capacity();
+    b->used = (uint32)n;
+    b->own = 0;
+    b->data = (char*)s.data();
+    new (&s) fastring(); // the memory belongs to the block now
+    Ref r = { b, b->data, n };
+    this->_push(r);
+    return *this;
+}
+
+iobuf& iobuf::append_ref(const void* p, size_t n) {
+    if (n > 0) {
+        Ref r = { 0, (const char*)p, n };
+        this->_push(r);
+    }
+    return *this;
+}
+
+iobuf& iobuf::append(const iobuf& b) {
+    if (&b == this) {
+        iobuf x(b);
+        return this->append(std::move(x));
+    }
+    this->_reserve(_n + b._n);
+    for (uint32 i = 0; i < b._n; ++i) {
+        ref_block(b._refs[i].b);
+        _refs[_n++] = b._refs[i];
+    }
+    _size += b._size;
+    return *this;
+}
+
+iobuf& iobuf::append(iobuf&& b) {
+    if (&b == this || b._n == 0) return *this;
+    if (_n == 0) {
+        this->reset();
+        new (this) iobuf(std::move(b));
+        return *this;
+    }
+    this->_reserve(_n + b._n);
+    memcpy(_refs + _n, b._refs, b._n * sizeof(Ref));
+    _n += b._n;
+    _size += b._size;
+    b._n = 0;
+    b._size = 0;
+    return *this;
+}
+
+iobuf& iobuf::prepend(const void* p, size_t n) {
+    if (n == 0) return *this;
+    Block* const b = new_block(n);
+    memcpy(b->data, p, n);
+    b->used = (uint32)n;
+    Ref r = { b, b->data, n };
+    this->_push(r);
+    memmove(_refs + 1, _refs, (_n - 1) * sizeof(Ref));
+    _refs[0] = r;
+    return *this;
+}
+
+iobuf& iobuf::prepend_ref(const void* p, size_t n) {
+    if (n == 0) return *this;
+    Ref r = { 0, (const char*)p, n };
+    this->_push(r);
+    memmove(_refs + 1, _refs, (_n - 1) * sizeof(Ref));
+    _refs[0] = r;
+    return *this;
+}
+
+void iobuf::consume(size_t n) {
+    if (n >= _size) { this->clear(); return; }
+
+    uint32 i = 0;
+    for (; n > 0 && n >= _refs[i].n; ++i) {
+        n -= _refs[i].n;
+        _size -= _refs[i].n;
+        unref_block(_refs[i].b);
+    }
+    if (n > 0) {
+        _refs[i].p += n;
+        _refs[i].n -= n;
+        _size -= n;
+    }
+    if (i > 0) {
+        _n -= i;
+        memmove(_refs, _refs + i, _n * sizeof(Ref));
+    }
+}
+
+size_t iobuf::cut(iobuf& out, size_t n) {
+    if (&out == this) return 0;
+    if (n > _size) n = _size;
+
+    size_t x = n;
+    uint32 i = 0;
+    out._reserve(out._n + _n);
+    for (; x > 0 && x >= _refs[i].n; ++i) { // whole segments are moved
+        x -= _refs[i].n;
+        out._refs[out._n++] = _refs[i];
+        out._size += _refs[i].n;
+        _size -= _refs[i].n;
+    }
+    if (x > 0) { // part of a segment is shared
+        Ref r = { _refs[i].b, _refs[i].p, x };
+        ref_block(r.b);
+        out._refs[out._n++] = r;
+        out._size += x;
+        _refs[i].p += x;
+        _refs[i].n -= x;
+        _size -= x;
+    }
+    if (i > 0) {
+        _n -= i;
+        memmove(_refs, _refs + i, _n * sizeof(Ref));
+    }
+    return n;
+}
+
+size_t iobuf::copy_to(void* buf, size_t n, size_t off) const {
+    char* p = (char*)buf;
+    size_t k = 0;
+    for (uint32 i = 0; i < _n && k < n; ++i) {
+        const Ref& r = _refs[i];
+        if (off >= r.n) { off -= r.n; continue; }
+        const size_t x = r.n - off < n - k ? r.n - off : n - k;
+        memcpy(p + k, r.p + off, x);
+        k += x;
+        off = 0;
+    }
+    return k;
+}
+
+fastring iobuf::str() const {
+    fastring s(_size + 1);
+    s.resize(_size);
+    this->copy_to((void*)s.data(), _size);
+    return s;
+}
+
+} // co
@@ -1,6 +1,23 @@
 #include "co/json.h"
+#include "co/byte_order.h"
+#include "co/intern.h"
 #include <algorithm>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_AVX2 // runtime dispatch
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define JSON_NEON
+#include <arm_neon.h>
+#endif
+
 namespace json {
 namespace xx {
 
@@ -105,14 +122,305 @@ inline void* alloc_array(void** p, uint32 n) {
     return h;
 }
 
+// objects with at least this many members are looked up by a hash index
+static const uint32 g_index_min = 32;
+
+/**
+ * hash index of keys for large objects
+ *   - It is built by the first lookup on an object with g_index_min members or
+ *     more. Members added after that are indexed by the next lookup, so that
+ *     add_member() and the parser need not know about it.
+ *   - Open addressing with linear probing, a slot keeps hash of the key and
+ *     1-based position of the member, 0 for empty slots.
+ *   - Only the first one of repeated keys is indexed, the same as what a linear
+ *     search finds.
+ */
+struct Index {
+    struct slot_t {
+        uint32 hash;
+        uint32 pos;
+    };
+    void* a;     // array of the members, MUST be the first field
+    uint32 n;    // number of members indexed
+    uint32 mask; // number of slots - 1
+    slot_t s[];
+};
+
+inline uint32 key_hash(const char* s) {
+    uint32 h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (uint8)*s) * 16777619u;
+    return h;
+}
+
+inline size_t index_bytes(uint32 slots) {
+    return sizeof(Index) + sizeof(Index::slot_t) * slots;
+}
+
+inline Index* make_index(void* a, uint32 n) {
+    uint32 slots = 64;
+    while (slots < (n << 1)) slots <<= 1; // load factor <= 0.5
+    auto x = (Index*) co::alloc(index_bytes(slots));
+    x->a = a;
+    x->n = 0;
+    x->mask = slots - 1;
+    memset(x->s, 0, sizeof(Index::slot_t) * slots);
+    return x;
+}
+
+inline void free_index(Index* x) {
+    co::free(x, index_bytes(x->mask + 1));
+}
+
+// @m: members of the object, @i: position of the member to add
+inline void index_add(Index* x, void** m, uint32 i) {
+    const char* const k = (const char*)m[i << 1];
+    const uint32 h = key_hash(k);
+    for (uint32 p = h & x->mask;; p = (p + 1) & x->mask) {
+        auto& s = x->s[p];
+        if (s.pos == 0) { s.hash = h; s.pos = i + 1; return; }
+        if (s.hash == h && strcmp(k, (const char*)m[(s.pos - 1) << 1]) == 0) return;
+    }
+}
+
+inline Json* index_find(Index* x, void** m, const char* k) {
+    const uint32 h = key_hash(k);
+    for (uint32 p = h & x->mask;; p = (p + 1) & x->mask) {
+        auto& s = x->s[p];
+        if (s.pos == 0) return 0;
+        const uint32 i = (s.pos - 1) << 1;
+        if (s.hash == h && (k == m[i] || strcmp(k, (const char*)m[i]) == 0)) return (Json*)&m[i + 1];
+    }
+}
+
+// get index of the object @h with @n members, build or grow it if necessary,
+// and add members not indexed yet.
+inline Index* get_index(Json::_H* h, uint32 n) {
+    Index* x;
+    if (!(h->flag & Json::f_index)) {
+        x = make_index(h->p, n);
+        h->p = x;
+        h->flag |= Json::f_index;
+    } else {
+        x = (Index*)h->p;
+        if ((n << 1) > x->mask + 1) {
+            Index* const y = make_index(x->a, n);
+            void** const m = ((Array*)&x->a)->data();
+            for (uint32 i = 0; i < x->n; ++i) index_add(y, m, i);
+            y->n = x->n;
+            free_index(x);
+            h->p = x = y;
+        }
+    }
+    if (x->n < n) {
+        void** const m = ((Array*)&x->a)->data();
+        for (uint32 i = x->n; i < n; ++i) index_add(x, m, i);
+        x->n = n;
+    }
+    return x;
+}
+
 } // xx
 
 using _H = Json::_H;
 using _A = xx::Alloc;
 typedef const char* S;
 typedef void* void_ptr_t;
-inline S find_quote(S b, S e) { return (S) memchr(b, '"', e - b); }
-inline S find_slash(S b, S e) { return (S) memchr(b, '\\', e - b); }
+inline bool is_white_space(char c) {
+    return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+}
+
+/**
+ * SIMD scanning for the parser and the writer
+ *   - find_special() finds the first quote or backslash in a string.
+ *   - skip_ws() skips white spaces.
+ *   - valid_utf8() skips ASCII in blocks, and checks other bytes one by one.
+ *   - find_escapse() finds the first character to be escaped on output. Quotes,
+ *     backslashes and control characters are candidates, and they are checked
+ *     against the escape table.
+ *   - 16 bytes at a time with SSE2 or NEON, and 32 bytes with AVX2 for long
+ *     strings if the cpu supports it. The tail, and the whole string on other
+ *     platforms, is scanned byte by byte.
+ *   - Control characters are accepted in strings as before, they need no
+ *     classification.
+ */
+#if defined(JSON_SSE2) || defined(JSON_NEON)
+#ifdef _MSC_VER
+inline uint32 _ctz(uint32 x) { unsigned long r; _BitScanForward(&r, x); return r; }
+#else
+inline uint32 _ctz(uint32 x) { return __builtin_ctz(x); }
+#endif
+#endif
+
+#ifdef JSON_AVX2
+inline bool _has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// false before it is initialized, SSE2 is used then
+static const bool g_has_avx2 = _has_avx2();
+
+// returns the first quote or backslash, or the position where less than 32
+// bytes are left
+__attribute__((target("avx2")))
+static S find_special_avx2(S b, S e) {
+    const __m256i q = _mm256_set1_epi8('"');
+    const __m256i s = _mm256_set1_epi8('\\');
+    for (; b + 32 <= e; b += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const uint32 m = (uint32)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, q), _mm256_cmpeq_epi8(x, s))
+        );
+        if (m) return b + _ctz(m);
+    }
+    return b;
+}
+
+// returns the first character to be escaped with @c set to its escape, or the
+// position where less than 32 bytes are left with @c set to 0
+__attribute__((target("avx2")))
+static S find_escapse_avx2(S b, S e, const char* tb, char& c) {
+    const __m256i q = _mm256_set1_epi8('"');
+    const __m256i s = _mm256_set1_epi8('\\');
+    const __m256i x1f = _mm256_set1_epi8(0x1f);
+    for (; b + 32 <= e; b += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const __m256i w = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, q), _mm256_cmpeq_epi8(x, s)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(x, x1f), x)
+        );
+        for (uint32 m = (uint32)_mm256_movemask_epi8(w); m; m &= m - 1) {
+            S p = b + _ctz(m);
+            if ((c = tb[(uint8)*p])) return p;
+        }
+    }
+    c = 0;
+    return b;
+}
+#endif
+
+#ifdef JSON_NEON
+// 4 bits for each byte of a compare result
+inline uint64 _neon_mask(uint8x16_t c) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(c), 4)), 0);
+}
+#endif
+
+// find the first quote or backslash in [b, e), NULL if not found
+inline S find_special(S b, S e) {
+#if defined(JSON_AVX2)
+    if (e - b >= 64 && g_has_avx2) b = find_special_avx2(b, e);
+#endif
+#if defined(JSON_SSE2)
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i s = _mm_set1_epi8('\\');
+    for (; b + 16 <= e; b += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const uint32 m = (uint32)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(x, q), _mm_cmpeq_epi8(x, s))
+        );
+        if (m) return b + _ctz(m);
+    }
+#elif defined(JSON_NEON)
+    const uint8x16_t q = vdupq_n_u8('"');
+    const uint8x16_t s = vdupq_n_u8('\\');
+    for (; b + 16 <= e; b += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8*)b);
+        const uint64 m = _neon_mask(vorrq_u8(vceqq_u8(x, q), vceqq_u8(x, s)));
+        if (m) return b + (__builtin_ctzll(m) >> 2);
+    }
+#endif
+    for (; b < e; ++b) {
+        if (*b == '"' || *b == '\\') return b;
+    }
+    return 0;
+}
+
+// skip white spaces in [b, e), return the first non-white-space or e
+inline S skip_ws(S b, S e) {
+#if defined(JSON_SSE2)
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i ht = _mm_set1_epi8('\t');
+    for (; b + 16 <= e; b += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const __m128i w = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, nl)),
+            _mm_or_si128(_mm_cmpeq_epi8(x, cr), _mm_cmpeq_epi8(x, ht))
+        );
+        const uint32 m = ~(uint32)_mm_movemask_epi8(w) & 0xffff;
+        if (m) return b + _ctz(m);
+    }
+#elif defined(JSON_NEON)
+    const uint8x16_t sp = vdupq_n_u8(' ');
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t ht = vdupq_n_u8('\t');
+    for (; b + 16 <= e; b += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8*)b);
+        const uint8x16_t w = vorrq_u8(
+            vorrq_u8(vceqq_u8(x, sp), vceqq_u8(x, nl)),
+            vorrq_u8(vceqq_u8(x, cr), vceqq_u8(x, ht))
+        );
+        const uint64 m = _neon_mask(vmvnq_u8(w));
+        if (m) return b + (__builtin_ctzll(m) >> 2);
+    }
+#endif
+    while (b < e && is_white_space(*b)) ++b;
+    return b;
+}
+
+// whether [b, e) is valid UTF-8 (RFC 3629), overlong forms, surrogates and
+// code points over 0x10FFFF are rejected
+static bool valid_utf8(S b, S e) {
+    const uint8* p = (const uint8*)b;
+    const uint8* const end = (const uint8*)e;
+    while (p < end) {
+#if defined(JSON_SSE2)
+        if (end - p >= 16) {
+            const uint32 m = (uint32)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+            if (m == 0) { p += 16; continue; }
+            p += _ctz(m);
+        }
+#elif defined(JSON_NEON)
+        if (end - p >= 16) {
+            const uint8x16_t x = vld1q_u8(p);
+            const uint64 m = _neon_mask(vcgeq_u8(x, vdupq_n_u8(0x80)));
+            if (m == 0) { p += 16; continue; }
+            p += __builtin_ctzll(m) >> 2;
+        }
+#endif
+        const uint32 c = *p;
+        if (c < 0x80) { ++p; continue; }
+
+        // the range of the second byte, and the number of bytes after the first
+        uint32 lo = 0x80, hi = 0xBF, n;
+        if (c < 0xC2) {
+            return false;
+        } else if (c < 0xE0) {
+            n = 1;
+        } else if (c < 0xF0) {
+            n = 2;
+            if (c == 0xE0) lo = 0xA0;
+            if (c == 0xED) hi = 0x9F;
+        } else if (c < 0xF5) {
+            n = 3;
+            if (c == 0xF0) lo = 0x90;
+            if (c == 0xF4) hi = 0x8F;
+        } else {
+            return false;
+        }
+
+        if ((size_t)(end - p) <= n) return false;
+        if (p[1] < lo || p[1] > hi) return false;
+        for (uint32 i = 2; i <= n; ++i) {
+            if ((p[i] & 0xC0) != 0x80) return false;
+        }
+        p += n + 1;
+    }
+    return true;
+}
 
 inline char* make_key(_A& a, const void* p, size_t n) {
     char* s = (char*) a.alloc((uint32)n + 1);
@@ -141,32 +449,109 @@ inline _H* make_array(_A& a)  { return new(a.alloc()) _H(Json::_arr_t()); }
 // return the current position, or NULL on any error
 class Parser {
   public:
-    Parser() : _a(xx::jalloc()) {}
+    explicit Parser(co::Arena* r=0, bool view=false, bool lazy=false, bool intern=false)
+        : _a(xx::jalloc()), _r(r), _v(view), _l(lazy), _i(intern) {
+    }
     ~Parser() = default;
 
     bool parse(S b, S e, void_ptr_t& v);
     S parse_string(S b, S e, void_ptr_t& v);
-    S parse_unicode(S b, S e, fastream& s);
+    static S parse_unicode(S b, S e, fastream& s);
+    static S unescape(S b, S q, S e, fastream& s);
     S parse_number(S b, S e, void_ptr_t& v);
     S parse_key(S b, S e, void_ptr_t& k);
     S parse_false(S b, S e, void_ptr_t& v);
     S parse_true(S b, S e, void_ptr_t& v);
     S parse_null(S b, S e, void_ptr_t& v);
+    S parse_lazy(S b, S e, void_ptr_t& v);
 
   private:
+    // nodes, strings and keys are allocated from the arena if it is not NULL
+    template <typename X>
+    _H* make(X x) {
+        if (!_r) return new(_a.alloc()) _H(x);
+        _H* h = new(_r->alloc(sizeof(_H))) _H(x);
+        h->flag = Json::f_arena;
+        return h;
+    }
+
+    char* make_key(const void* p, size_t n) {
+        if (_i) return (char*) co::intern(p, n);
+        if (!_r) return json::make_key(_a, p, n);
+        char* s = (char*) _r->alloc(n + 1, 1);
+        memcpy(s, p, n);
+        s[n] = '\0';
+        return s;
+    }
+
+    _H* make_string(const void* p, size_t n) {
+        if (!_r) return json::make_string(_a, p, n);
+        _H* h = (_H*) _r->alloc(sizeof(_H));
+        h->type = Json::t_string;
+        h->flag = Json::f_arena;
+        h->size = (uint32)n;
+        h->s = this->make_key(p, n);
+        return h;
+    }
+
+    // string in [p, e) of the input for parse_view(), @e is the closing quote
+    _H* make_view(S p, S e) {
+        *(char*)e = '\0';
+        _H* h = (_H*) (_r ? _r->alloc(sizeof(_H)) : _a.alloc());
+        h->type = Json::t_string;
+        h->flag = Json::f_view | (_r ? Json::f_arena : 0);
+        h->size = (uint32)(e - p);
+        h->s = (char*)p;
+        return h;
+    }
+
+    // keys of the object refer to the input for parse_view(), or are interned
+    // for parse_intern(), the number of keys is set when the object ends
+    _H* make_object() {
+        _H* h = this->make(Json::_obj_t());
+        if (_v || _i) { h->flag |= Json::f_view; h->size = 0; }
+        return h;
+    }
+
+    // set number of members for an object from parse_view() or parse_intern()
+    void end_object(_H* h, uint32 n) {
+        if (_v || _i) h->size = n >> 1;
+    }
+
+    // array of members, from the arena if it is not NULL
+    void* make_members(void** p, uint32 n) {
+        if (!_r) return xx::alloc_array(p, n);
+        auto a = (xx::Array::_H*) _r->alloc(sizeof(xx::Array::_H) + sizeof(void*) * n);
+        a->cap = n;
+        a->size = n;
+        memcpy(a->p, p, sizeof(void*) * n);
+        return a;
+    }
+
     xx::Alloc& _a;
+    co::Arena* _r;
+    bool _v; // parse_view()
+    bool _l; // parse_lazy(), nested objects and arrays are not parsed
+    bool _i; // parse_intern(), keys are interned
 };
 
 inline S Parser::parse_key(S b, S e, void_ptr_t& key) {
     if (*b++ != '"') return 0;
     S p = (S) memchr(b, '"', e - b);
-    if (p) key = make_key(_a, b, p - b);
+    if (p) {
+        if (!_v) {
+            key = this->make_key(b, p - b);
+        } else {
+            *(char*)p = '\0';
+            key = (void*)b;
+        }
+    }
     return p;
 }
 
 inline S Parser::parse_false(S b, S e, void_ptr_t& v) {
     if (e - b >= 5 && b[1] == 'a' && b[2] == 'l' && b[3] == 's' && b[4] == 'e') {
-        v = make_bool(_a, false);
+        v = this->make(false);
         return b + 4;
     }
     return 0;
@@ -174,7 +559,7 @@ inline S Parser::parse_false(S b, S e, void_ptr_t& v) {
 
 inline S Parser::parse_true(S b, S e, void_ptr_t& v) {
     if (e - b >= 4 && b[1] == 'r' && b[2] == 'u' && b[3] == 'e') {
-        v = make_bool(_a, true);
+        v = this->make(true);
         return b + 3;
     }
     return 0;
@@ -188,11 +573,52 @@ inline S Parser::parse_null(S b, S e, void_ptr_t& v) {
     return 0;
 }
 
-inline bool is_white_space(char c) {
-    return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+// skip the object or array beginning at @b, return its last character, or
+// NULL if it does not end
+inline S skip_container(S b, S e) {
+    int depth = 0;
+    for (S p = b; p < e; ++p) {
+        switch (*p) {
+          case '"':
+            for (++p;;) {
+                S q = find_special(p, e);
+                if (q == 0) return 0;
+                if (*q == '"') { p = q; break; }
+                p = q + 2; // skip the escaped character
+            }
+            break;
+          case '{':
+          case '[':
+            ++depth;
+            break;
+          case '}':
+          case ']':
+            if (--depth == 0) return p;
+            break;
+        }
+    }
+    return 0;
+}
+
+inline S Parser::parse_lazy(S b, S e, void_ptr_t& v) {
+    S p = skip_container(b, e);
+    if (p == 0) return 0;
+    _H* h = *b == '{' ? this->make_object() : this->make(Json::_arr_t());
+    S x = b + 1;
+    while (x < p && is_white_space(*x)) ++x;
+    if (x < p) { // not empty
+        h->flag |= Json::f_lazy;
+        h->p = (void*)b;
+        h->size = (uint32)(p - b + 1);
+    }
+    v = h;
+    return p;
 }
 
-#if 1
+#if defined(JSON_SSE2) || defined(JSON_NEON)
+#define skip_white_space(b, e) \
+    if (++b < e && is_white_space(*b)) b = skip_ws(b + 1, e);
+#else
 #define skip_white_space(b, e) \
     if (++b < e && is_white_space(*b)) { \
         for (++b;;) { \
@@ -221,9 +647,6 @@ inline bool is_white_space(char c) {
             } \
         } \
     }
-#else
-#define skip_white_space(b, e) \
-    while (++b < e && is_white_space(*b));
 #endif
 
 // This is a non-recursive implement of json parser.
@@ -245,7 +668,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   obj_beg:
     u.push_back(psize);  // prev size
     u.push_back(pstate); // prev state
-    s.push_back(make_object(_a));
+    s.push_back(this->make_object());
     size = s.size(); // current size
     state = '{';
 
@@ -269,8 +692,10 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
         b = parse_string(b, e, val);
         break;
       case '{':
+        if (_l) { b = this->parse_lazy(b, e, val); break; }
         goto obj_beg;
       case '[':
+        if (_l) { b = this->parse_lazy(b, e, val); break; }
         goto arr_beg;
       case 'f':
         b = parse_false(b, e, val);
@@ -297,7 +722,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   arr_beg:
     u.push_back(psize);  // prev size
     u.push_back(pstate); // prev state
-    s.push_back(make_array(_a));
+    s.push_back(this->make(Json::_arr_t()));
     size = s.size(); // current size
     state = '[';
 
@@ -311,8 +736,10 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
         b = parse_string(b, e, val);
         break;
       case '{':
+        if (_l) { b = this->parse_lazy(b, e, val); break; }
         goto obj_beg;
       case '[':
+        if (_l) { b = this->parse_lazy(b, e, val); break; }
         goto arr_beg;
       case 'f':
         b = parse_false(b, e, val);
@@ -339,9 +766,12 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
   arr_end:
   obj_end:
     if (s.size() > size) {
-        void* p = xx::alloc_array(s.data() + size, s.size() - size);
+        const uint32 n = s.size() - size;
+        void* p = this->make_members(s.data() + size, n);
         s.resize(size);
         ((_H*)s.back())->p = p;
+        if (_r) ((_H*)s.back())->flag |= Json::f_fixed;
+        if (state == '{') this->end_object((_H*)s.back(), n);
     }
 
     pstate = u.pop_back(); // prev state
@@ -380,9 +810,11 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
     while (s.size() > 0) {
         if (s.size() > size) {
             if (state == '{' && ((s.size() - size) & 1)) s.push_back(0);
-            void* p = xx::alloc_array(s.data() + size, s.size() - size);
+            const uint32 n = s.size() - size;
+            void* p = xx::alloc_array(s.data() + size, n);
             s.resize(size);
             ((_H*)s.back())->p = p;
+            if (state == '{') this->end_object((_H*)s.back(), n);
         }
 
         pstate = u.pop_back();
@@ -412,15 +844,22 @@ static inline const char* init_s2e_table() {
 }
 
 S Parser::parse_string(S b, S e, void_ptr_t& v) {
-    S p, q;
-    if ((p = find_quote(++b, e)) == 0) return 0;
-    q = find_slash(b, p);
-    if (q == 0) {
-        v = make_string(_a, b, p - b);
-        return p;
+    S q = find_special(++b, e);
+    if (q == 0) return 0;
+    if (*q == '"') {
+        v = _v ? this->make_view(b, q) : this->make_string(b, q - b);
+        return q;
     }
 
     fastream& s = _a.stream();
+    q = unescape(b, q, e, s);
+    if (q) v = this->make_string(s.data(), s.size());
+    return q;
+}
+
+// unescape the string from @b to @s, @q is the first backslash.
+// return the closing quote, or NULL on any error.
+S Parser::unescape(S b, S q, S e, fastream& s) {
     do {
         s.append(b, q - b);
         if (++q == e) return 0;
@@ -437,16 +876,11 @@ S Parser::parse_string(S b, S e, void_ptr_t& v) {
         }
 
         b = q + 1;
-        if (b > p) {
-            p = find_quote(b, e);
-            if (p == 0) return 0;
-        }
-        
-        q = find_slash(b, p);
-        if (q == 0) {
-            s.append(b, p - b);
-            v = make_string(_a, s.data(), s.size());
-            return p;
+        q = find_special(b, e);
+        if (q == 0) return 0;
+        if (*q == '"') {
+            s.append(b, q - b);
+            return q;
         }
     } while (true);
 }
@@ -502,23 +936,29 @@ S Parser::parse_unicode(S b, S e, fastream& s) {
         u = 0x10000 + (((u - 0xD800) << 10) | (v - 0xDC00));
     }
 
-    // encode to UTF8
+    // encode to UTF8, the space is reserved once for all bytes
+    s.reserve(s.size() + 4);
+    char* p = (char*)s.data() + s.size();
     if (u <= 0x7F) {
-        s.append((char)u);
+        p[0] = (char)u;
+        s.resize(s.size() + 1);
     } else if (u <= 0x7FF) {
-        s.append((char) (0xC0 | (0xFF & (u >> 6))));
-        s.append((char) (0x80 | (0x3F & u)));
+        p[0] = (char) (0xC0 | (0xFF & (u >> 6)));
+        p[1] = (char) (0x80 | (0x3F & u));
+        s.resize(s.size() + 2);
     } else if (u <= 0xFFFF) {
-        s.append((char) (0xE0 | (0xFF & (u >> 12))));
-        s.append((char) (0x80 | (0x3F & (u >> 6))));
-        s.append((char) (0x80 | (0x3F & u)));
+        p[0] = (char) (0xE0 | (0xFF & (u >> 12)));
+        p[1] = (char) (0x80 | (0x3F & (u >> 6)));
+        p[2] = (char) (0x80 | (0x3F & u));
+        s.resize(s.size() + 3);
     } else {
         assert(u <= 0x10FFFF);
-        s.append((char) (0xF0 | (0xFF & (u >> 18))));
-        s.append((char) (0x80 | (0x3F & (u >> 12))));
-        s.append((char) (0x80 | (0x3F & (u >>  6))));
-        s.append((char) (0x80 | (0x3F & u)));
-    } 
+        p[0] = (char) (0xF0 | (0xFF & (u >> 18)));
+        p[1] = (char) (0x80 | (0x3F & (u >> 12)));
+        p[2] = (char) (0x80 | (0x3F & (u >>  6)));
+        p[3] = (char) (0x80 | (0x3F & u));
+        s.resize(s.size() + 4);
+    }
 
     return b;
 }
@@ -531,18 +971,16 @@ inline int64 str2int(S b, S e) {
     return *b != '-' ? v : -(int64)v;
 }
 
-inline bool str2double(S b, double& d) {
-    errno = 0;
-    d = strtod(b, 0);
-    return !(errno == ERANGE && (d == HUGE_VAL || d == -HUGE_VAL));
-}
-
 inline bool is_digit(char c) {
     return '0' <= c && c <= '9';
 }
 
-S Parser::parse_number(S b, S e, void_ptr_t& v) {
+// read a number in [b, e), @dbl is true for doubles, the value is in @d then,
+// or in @i otherwise. Return the last character of the number, or NULL on error.
+// Digits of the integer part are added up as they are scanned, 8 at a time.
+inline S read_number(S b, S e, int64& i, double& d, bool& dbl) {
     bool is_double = false;
+    uint64 u = 0; // value of the first 19 digits of the integer part
     S p = b;
 
     if (*p == '-' && ++p == e) return 0;
@@ -551,7 +989,7 @@ S Parser::parse_number(S b, S e, void_ptr_t& v) {
         if (++p == e) goto digit_end;
     } else {
         if (*p < '1' || *p > '9') return 0; // must be 1 to 9
-        while (++p < e && is_digit(*p));
+        p = fast::read_digits(p, e, u);
         if (p == e) goto digit_end;
     }
 
@@ -583,26 +1021,33 @@ S Parser::parse_number(S b, S e, void_ptr_t& v) {
         int m = memcmp(b, (*b != '-' ? "18446744073709551615" : "-9223372036854775808"), 20);
         if (m < 0) goto to_int;
         if (m > 0) goto to_dbl;
-        v = make_int(_a, *b != '-' ? MAX_UINT64 : MIN_INT64);
+        i = (int64)(*b != '-' ? MAX_UINT64 : MIN_INT64);
+        dbl = false;
         return p - 1;
     }
 
   to_int:
-    v = make_int(_a, str2int(b, p));
+    // @u holds the whole value unless it is a positive number of 20 digits
+    if (*b != '-') {
+        i = p - b <= 19 ? (int64)u : str2int(b, p);
+    } else {
+        i = -(int64)u;
+    }
+    dbl = false;
     return p - 1;
 
   to_dbl:
+    dbl = true;
+    return fast::atod(b, p - b, d) ? p - 1 : 0;
+}
+
+S Parser::parse_number(S b, S e, void_ptr_t& v) {
+    int64 i;
     double d;
-    if (p == e && *p != '\0') {
-        fastream& fs = _a.stream();
-        fs.append(b, p - b);
-        b = fs.c_str();
-    }
-    if (str2double(b, d)) {
-        v = make_double(_a, d);
-        return p - 1;
-    }
-    return 0;
+    bool dbl;
+    S p = read_number(b, e, i, d, dbl);
+    if (p) v = dbl ? this->make(d) : this->make(i);
+    return p;
 }
 
 bool Json::parse_from(const char* s, size_t n) {
@@ -613,6 +1058,797 @@ bool Json::parse_from(const char* s, size_t n) {
     return r;
 }
 
+bool Json::parse_from(const char* s, size_t n, co::Arena& a) {
+    if (_h) this->reset();
+    Parser parser(&a);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_strict(const char* s, size_t n) {
+    if (_h) this->reset();
+    if (!valid_utf8(s, s + n)) return false;
+    Parser parser;
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_intern(const char* s, size_t n) {
+    if (_h) this->reset();
+    Parser parser(0, false, false, true);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_lazy(const char* s, size_t n) {
+    if (_h) this->reset();
+    Parser parser(0, false, true);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+// parse the object or array from parse_lazy() when it is accessed
+xx::Array& Json::_array_slow() const {
+    if (_h->flag & f_lazy) {
+        S b = (S)_h->p;
+        S e = b + _h->size;
+        _h->flag &= ~f_lazy;
+        _h->p = 0;
+        _h->size = 0;
+
+        Parser parser(0, false, true);
+        Json v;
+        if (parser.parse(b, e, *(void**)&v._h) && v._h->p) {
+            _h->p = v._h->p;
+            v._h->p = 0;
+        } else {
+            new(&_h->p) xx::Array(8); // errors
+        }
+    }
+    return *(xx::Array*)((_h->flag & f_index) ? _h->p : (void*)&_h->p);
+}
+
+// copy the array of members from the arena to the heap, before it grows
+void Json::_unfix() const {
+    auto& a = _array();
+    const uint32 n = a.size();
+    void** p = a.data();
+    new(&a) xx::Array(n < 8 ? 8 : n * 2);
+    memcpy(a.data(), p, sizeof(void*) * n);
+    a.resize(n);
+    _h->flag &= ~f_fixed;
+}
+
+bool Json::parse_view(char* s, size_t n) {
+    if (_h) this->reset();
+    Parser parser(0, true);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_view(char* s, size_t n, co::Arena& a) {
+    if (_h) this->reset();
+    Parser parser(&a, true);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+// MessagePack, see https://github.com/msgpack/msgpack/blob/master/spec.md
+//   - Integers are written in the smallest format, doubles in float 64.
+//   - bin is parsed as string, and float 32 as double.
+fastream& Json::_json2mp(fastream& fs) const {
+    if (!_h) return fs.append((char)0xc0);
+
+    switch (_h->type) {
+      case t_string: {
+        const uint32 n = _h->size;
+        if (n < 32) {
+            fs.append((char)(0xa0 | n));
+        } else if (n <= 0xff) {
+            fs.append((char)0xd9).append((char)n);
+        } else if (n <= 0xffff) {
+            fs.append((char)0xda).append(hton16((uint16)n));
+        } else {
+            fs.append((char)0xdb).append(hton32(n));
+        }
+        fs.append(_h->s, n);
+        break;
+      }
+
+      case t_object:
+      case t_array: {
+        xx::Array* a = _h->p ? &_array() : 0;
+        const bool obj = _h->type == t_object;
+        const uint32 n = a ? (obj ? a->size() >> 1 : a->size()) : 0;
+        if (n < 16) {
+            fs.append((char)((obj ? 0x80 : 0x90) | n));
+        } else if (n <= 0xffff) {
+            fs.append((char)(obj ? 0xde : 0xdc)).append(hton16((uint16)n));
+        } else {
+            fs.append((char)(obj ? 0xdf : 0xdd)).append(hton32(n));
+        }
+        if (!a) break;
+
+        if (obj) {
+            for (uint32 i = 0; i < a->size(); i += 2) {
+                S k = (S)(*a)[i];
+                const size_t m = strlen(k);
+                if (m < 32) {
+                    fs.append((char)(0xa0 | m));
+                } else if (m <= 0xff) {
+                    fs.append((char)0xd9).append((char)m);
+                } else if (m <= 0xffff) {
+                    fs.append((char)0xda).append(hton16((uint16)m));
+                } else {
+                    fs.append((char)0xdb).append(hton32((uint32)m));
+                }
+                fs.append(k, m);
+                ((Json*)&(*a)[i + 1])->_json2mp(fs);
+            }
+        } else {
+            for (uint32 i = 0; i < a->size(); ++i) {
+                ((Json*)&(*a)[i])->_json2mp(fs);
+            }
+        }
+        break;
+      }
+
+      case t_int: {
+        const int64 v = _h->i;
+        if (v >= 0) {
+            if (v < 128) {
+                fs.append((char)v);
+            } else if (v <= 0xff) {
+                fs.append((char)0xcc).append((char)v);
+            } else if (v <= 0xffff) {
+                fs.append((char)0xcd).append(hton16((uint16)v));
+            } else if (v <= 0xffffffffLL) {
+                fs.append((char)0xce).append(hton32((uint32)v));
+            } else {
+                fs.append((char)0xcf).append(hton64((uint64)v));
+            }
+        } else {
+            if (v >= -32) {
+                fs.append((char)v);
+            } else if (v >= -128) {
+                fs.append((char)0xd0).append((char)v);
+            } else if (v >= -32768) {
+                fs.append((char)0xd1).append(hton16((uint16)v));
+            } else if (v >= INT32_MIN) {
+                fs.append((char)0xd2).append(hton32((uint32)v));
+            } else {
+                fs.append((char)0xd3).append(hton64((uint64)v));
+            }
+        }
+        break;
+      }
+
+      case t_bool:
+        fs.append((char)(_h->b ? 0xc3 : 0xc2));
+        break;
+
+      case t_double: {
+        uint64 u;
+        memcpy(&u, &_h->d, 8);
+        fs.append((char)0xcb).append(hton64(u));
+        break;
+      }
+    }
+
+    return fs;
+}
+
+inline uint16 mp_u16(S b) { uint16 x; memcpy(&x, b, 2); return ntoh16(x); }
+inline uint32 mp_u32(S b) { uint32 x; memcpy(&x, b, 4); return ntoh32(x); }
+inline uint64 mp_u64(S b) { uint64 x; memcpy(&x, b, 8); return ntoh64(x); }
+
+// parse a MessagePack value at @b
+//   - For a non-empty map or array, the node is created with an array of
+//     members reserved, and @m is set to the number of keys and values to
+//     be filled.
+//   - return the position after the value, or NULL on any error
+inline S mp_value(S b, S e, void_ptr_t& v, uint32& m) {
+    auto& a = xx::jalloc();
+    uint32 n;
+    m = 0;
+    if (b == e) return 0;
+
+    const uint8 c = (uint8)*b++;
+    if (c <= 0x7f) { v = make_int(a, c); return b; }
+    if (c >= 0xe0) { v = make_int(a, (int8)c); return b; }
+    if (c <= 0x8f) { n = c & 0x0f; goto map; }
+    if (c <= 0x9f) { n = c & 0x0f; goto arr; }
+    if (c <= 0xbf) { n = c & 0x1f; goto str; }
+
+    switch (c) {
+      case 0xc0:
+        v = 0;
+        return b;
+      case 0xc2:
+      case 0xc3:
+        v = make_bool(a, c == 0xc3);
+        return b;
+      case 0xc4:
+      case 0xd9:
+        if (e - b < 1) return 0;
+        n = (uint8)*b++;
+        goto str;
+      case 0xc5:
+      case 0xda:
+        if (e - b < 2) return 0;
+        n = mp_u16(b); b += 2;
+        goto str;
+      case 0xc6:
+      case 0xdb:
+        if (e - b < 4) return 0;
+        n = mp_u32(b); b += 4;
+        goto str;
+      case 0xca: {
+        if (e - b < 4) return 0;
+        const uint32 u = mp_u32(b);
+        float f;
+        memcpy(&f, &u, 4);
+        v = make_double(a, f);
+        return b + 4;
+      }
+      case 0xcb: {
+        if (e - b < 8) return 0;
+        const uint64 u = mp_u64(b);
+        double d;
+        memcpy(&d, &u, 8);
+        v = make_double(a, d);
+        return b + 8;
+      }
+      case 0xcc:
+      case 0xd0:
+        if (e - b < 1) return 0;
+        v = make_int(a, c == 0xcc ? (int64)(uint8)*b : (int64)(int8)*b);
+        return b + 1;
+      case 0xcd:
+      case 0xd1:
+        if (e - b < 2) return 0;
+        v = make_int(a, c == 0xcd ? (int64)mp_u16(b) : (int64)(int16)mp_u16(b));
+        return b + 2;
+      case 0xce:
+      case 0xd2:
+        if (e - b < 4) return 0;
+        v = make_int(a, c == 0xce ? (int64)mp_u32(b) : (int64)(int32)mp_u32(b));
+        return b + 4;
+      case 0xcf: // values > MAX_INT64 wrap, the same as parse_from()
+      case 0xd3:
+        if (e - b < 8) return 0;
+        v = make_int(a, (int64)mp_u64(b));
+        return b + 8;
+      case 0xdc:
+        if (e - b < 2) return 0;
+        n = mp_u16(b); b += 2;
+        goto arr;
+      case 0xdd:
+        if (e - b < 4) return 0;
+        n = mp_u32(b); b += 4;
+        goto arr;
+      case 0xde:
+        if (e - b < 2) return 0;
+        n = mp_u16(b); b += 2;
+        goto map;
+      case 0xdf:
+        if (e - b < 4) return 0;
+        n = mp_u32(b); b += 4;
+        goto map;
+      default: // 0xc1 and ext types
+        return 0;
+    }
+
+  str:
+    if (n > (size_t)(e - b)) return 0;
+    v = make_string(a, b, n);
+    return b + n;
+
+  arr: // each member takes at least one byte, check it before allocating
+    if (n > (size_t)(e - b)) return 0;
+    v = make_array(a);
+    if (n > 0) { new(&((_H*)v)->p) xx::Array(n); m = n; }
+    return b;
+
+  map:
+    if ((uint64)n * 2 > (size_t)(e - b)) return 0;
+    v = make_object(a);
+    if (n > 0) { new(&((_H*)v)->p) xx::Array(n * 2); m = n * 2; }
+    return b;
+}
+
+// keys MUST be strings
+inline S mp_key(S b, S e, void_ptr_t& k) {
+    uint32 n;
+    if (b == e) return 0;
+    const uint8 c = (uint8)*b++;
+    if (0xa0 <= c && c <= 0xbf) {
+        n = c & 0x1f;
+    } else if (c == 0xd9) {
+        if (e - b < 1) return 0;
+        n = (uint8)*b++;
+    } else if (c == 0xda) {
+        if (e - b < 2) return 0;
+        n = mp_u16(b); b += 2;
+    } else if (c == 0xdb) {
+        if (e - b < 4) return 0;
+        n = mp_u32(b); b += 4;
+    } else {
+        return 0;
+    }
+    if (n > (size_t)(e - b)) return 0;
+    k = make_key(xx::jalloc(), b, n);
+    return b + n;
+}
+
+// Non-recursive, the stack holds maps and arrays being filled, and numbers of
+// keys and values left in them. Members are added as soon as they are created,
+// so a partial result can be freed by reset() on errors.
+bool Json::parse_msgpack(const char* s, size_t n) {
+    if (_h) this->reset();
+    auto& u = xx::jalloc().ustack();
+    const uint32 z = u.size();
+    S b = s, e = s + n;
+    void_ptr_t v;
+    uint32 m;
+
+    b = mp_value(b, e, v, m);
+    if (b == 0) return false;
+    _h = (_H*)v;
+    if (m > 0) { u.push_back(v); u.push_back((void*)(size_t)m); }
+
+    while (u.size() > z) {
+        uint32 left = (uint32)(size_t)u.back();
+        if (left == 0) { u.resize(u.size() - 2); continue; }
+
+        _H* h = (_H*)u[u.size() - 2];
+        auto& a = *(xx::Array*)&h->p;
+        u.back() = (void*)(size_t)(left - 1);
+        if (h->type == t_object && !(left & 1)) {
+            b = mp_key(b, e, v);
+            if (b == 0) goto err;
+            a.push_back(v);
+            continue;
+        }
+
+        b = mp_value(b, e, v, m);
+        if (b == 0) goto err;
+        a.push_back(v);
+        if (m > 0) { u.push_back(v); u.push_back((void*)(size_t)m); }
+    }
+    if (b == e) return true;
+    this->reset();
+    return false;
+
+  err:
+    // the innermost object may be waiting for the value of a key
+    for (uint32 i = z; i < u.size(); i += 2) {
+        _H* h = (_H*)u[i];
+        auto& a = *(xx::Array*)&h->p;
+        if (h->type == t_object && (a.size() & 1)) a.push_back(0);
+    }
+    u.resize(z);
+    this->reset();
+    return false;
+}
+
+// states of the SAX parser
+enum {
+    s_value,     // a value is expected
+    s_arr_first, // a value or ']'
+    s_obj_first, // a key or '}'
+    s_key,       // a key
+    s_colon,     // ':' after a key
+    s_after,     // ',' or end of the container after a value
+};
+
+// kinds of a partial token
+enum {
+    tk_none,
+    tk_string,
+    tk_key,
+    tk_scalar, // number, true, false or null
+};
+
+inline bool is_scalar_char(char c) {
+    return is_digit(c) || ('a' <= c && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+SaxParser::SaxParser(Handler& h)
+    : _h(h), _tok(64), _s(64), _state(s_value), _tk(tk_none), _esc(false), _err(false) {
+}
+
+void SaxParser::reset() {
+    _tok.clear();
+    _s.clear();
+    _stack.clear();
+    _state = s_value;
+    _tk = tk_none;
+    _esc = false;
+    _err = false;
+}
+
+inline bool SaxParser::_end_value() {
+    _state = s_after;
+    return !_stack.empty() || _h.on_end();
+}
+
+// string or key in [b, q), @q is the closing quote
+bool SaxParser::_emit_string(S b, S q, bool key) {
+    S x = find_special(b, q + 1);
+    if (x != q) {
+        _s.clear();
+        if (Parser::unescape(b, x, q + 1, _s) != q) return false;
+        b = _s.data();
+        q = b + _s.size();
+    }
+    if (key) {
+        _state = s_colon;
+        return _h.on_key(b, q - b);
+    }
+    return _h.on_string(b, q - b) && this->_end_value();
+}
+
+bool SaxParser::_emit_scalar(S b, S e) {
+    const size_t n = e - b;
+    bool r;
+    switch (*b) {
+      case 't':
+        r = n == 4 && memcmp(b, "true", 4) == 0 && _h.on_bool(true);
+        break;
+      case 'f':
+        r = n == 5 && memcmp(b, "false", 5) == 0 && _h.on_bool(false);
+        break;
+      case 'n':
+        r = n == 4 && memcmp(b, "null", 4) == 0 && _h.on_null();
+        break;
+      default:
+        int64 i;
+        double d;
+        bool dbl;
+        if (read_number(b, e, i, d, dbl) != e - 1) return false;
+        r = dbl ? _h.on_double(d) : _h.on_int(i);
+    }
+    return r && this->_end_value();
+}
+
+// a string, a key or a scalar begins at @b, it is buffered if not complete
+S SaxParser::_token(S b, S e) {
+    if (*b == '"') {
+        const bool key = _state == s_obj_first || _state == s_key;
+        _esc = false;
+        for (S p = b + 1;;) {
+            S q = find_special(p, e);
+            if (q == 0) break;
+            if (*q == '"') return this->_emit_string(b + 1, q, key) ? q + 1 : 0;
+            if (q + 1 == e) { _esc = true; break; }
+            p = q + 2; // skip the escaped character
+        }
+        _tk = key ? tk_key : tk_string;
+        _tok.clear();
+        _tok.append(b + 1, e - b - 1);
+        return e;
+    }
+
+    S p = b;
+    while (p < e && is_scalar_char(*p)) ++p;
+    if (p == e) {
+        _tk = tk_scalar;
+        _tok.clear();
+        _tok.append(b, e - b);
+        return e;
+    }
+    return this->_emit_scalar(b, p) ? p : 0;
+}
+
+// continue the partial token with the next piece of input
+S SaxParser::_resume(S b, S e) {
+    if (_tk == tk_scalar) {
+        S p = b;
+        while (p < e && is_scalar_char(*p)) ++p;
+        _tok.append(b, p - b);
+        if (p == e) return e;
+        _tk = tk_none;
+        return this->_emit_scalar(_tok.data(), _tok.data() + _tok.size()) ? p : 0;
+    }
+
+    S p = b;
+    if (_esc) {
+        if (p == e) return e;
+        _esc = false;
+        ++p;
+    }
+    for (;;) {
+        S q = find_special(p, e);
+        if (q == 0) break;
+        if (*q == '"') {
+            _tok.append(b, q - b + 1);
+            const bool key = _tk == tk_key;
+            _tk = tk_none;
+            S x = _tok.data();
+            return this->_emit_string(x, x + _tok.size() - 1, key) ? q + 1 : 0;
+        }
+        if (q + 1 == e) { _esc = true; break; }
+        p = q + 2;
+    }
+    _tok.append(b, e - b);
+    return e;
+}
+
+S SaxParser::_value(S b, S e) {
+    switch (*b) {
+      case '{':
+        _stack.append('{');
+        _state = s_obj_first;
+        return _h.on_object_begin() ? b + 1 : 0;
+      case '[':
+        _stack.append('[');
+        _state = s_arr_first;
+        return _h.on_array_begin() ? b + 1 : 0;
+      default:
+        return (*b == '"' || is_scalar_char(*b)) ? this->_token(b, e) : 0;
+    }
+}
+
+// end of the current container at @b
+S SaxParser::_close(S b) {
+    const char c = _stack.back();
+    _stack.resize(_stack.size() - 1);
+    const bool r = c == '{' ? _h.on_object_end() : _h.on_array_end();
+    return r && this->_end_value() ? b + 1 : 0;
+}
+
+bool SaxParser::feed(const char* s, size_t n) {
+    if (_err) return false;
+    S b = s, e = s + n;
+    if (_tk != tk_none) {
+        b = this->_resume(b, e);
+        if (b == 0) goto err;
+    }
+
+    while (b < e) {
+        if (is_white_space(*b)) {
+            b = skip_ws(b + 1, e);
+            if (b == e) break;
+        }
+
+        switch (_state) {
+          case s_value:
+            b = this->_value(b, e);
+            break;
+          case s_arr_first:
+            b = *b == ']' ? this->_close(b) : this->_value(b, e);
+            break;
+          case s_obj_first:
+            if (*b == '}') { b = this->_close(b); break; }
+            if (*b != '"') goto err;
+            b = this->_token(b, e);
+            break;
+          case s_key:
+            if (*b != '"') goto err;
+            b = this->_token(b, e);
+            break;
+          case s_colon:
+            if (*b != ':') goto err;
+            _state = s_value;
+            ++b;
+            break;
+          default: // s_after
+            if (_stack.empty()) { _state = s_value; break; } // next top-level value
+            if (*b == ',') {
+                _state = _stack.back() == '{' ? s_key : s_value;
+                ++b;
+            } else if (*b == (_stack.back() == '{' ? '}' : ']')) {
+                b = this->_close(b);
+            } else {
+                goto err;
+            }
+        }
+        if (b == 0) goto err;
+    }
+    return true;
+
+  err:
+    _err = true;
+    return false;
+}
+
+bool SaxParser::finish() {
+    if (_err) return false;
+    if (_tk == tk_scalar) {
+        _tk = tk_none;
+        if (!this->_emit_scalar(_tok.data(), _tok.data() + _tok.size())) goto err;
+    }
+    if (_tk != tk_none || !_stack.empty()) goto err;
+    if (_state != s_value && _state != s_after) goto err;
+    return true;
+
+  err:
+    _err = true;
+    return false;
+}
+
+bool Reader::object_begin() {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e || *_b != '{') return this->_fail();
+    ++_b;
+    _first = true;
+    return true;
+}
+
+bool Reader::array_begin() {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e || *_b != '[') return this->_fail();
+    ++_b;
+    _first = true;
+    return true;
+}
+
+// go to the next member, or past the closing @c of the object or array
+bool Reader::_next(char c) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e) return this->_fail();
+    if (*_b == c) { ++_b; _first = false; return false; }
+    if (!_first) {
+        if (*_b != ',') return this->_fail();
+        _b = skip_ws(_b + 1, _e);
+        if (_b == _e) return this->_fail();
+    }
+    _first = false;
+    return true;
+}
+
+bool Reader::next_key(const char*& key, size_t& n) {
+    if (!this->_next('}')) return false;
+    if (*_b != '"') return this->_fail();
+
+    S b = _b + 1;
+    S q = find_special(b, _e);
+    if (q == 0) return this->_fail();
+    if (*q == '"') {
+        key = b;
+        n = q - b;
+    } else {
+        _k.clear();
+        q = Parser::unescape(b, q, _e, _k);
+        if (q == 0) return this->_fail();
+        key = _k.data();
+        n = _k.size();
+    }
+
+    _b = skip_ws(q + 1, _e);
+    if (_b == _e || *_b != ':') return this->_fail();
+    ++_b;
+    return true;
+}
+
+bool Reader::array_next() {
+    return this->_next(']');
+}
+
+bool Reader::null() {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_e - _b >= 4 && memcmp(_b, "null", 4) == 0) { _b += 4; return true; }
+    return false;
+}
+
+bool Reader::read(bool& v) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_e - _b >= 4 && memcmp(_b, "true", 4) == 0) { _b += 4; v = true; return true; }
+    if (_e - _b >= 5 && memcmp(_b, "false", 5) == 0) { _b += 5; v = false; return true; }
+    return this->_fail();
+}
+
+bool Reader::read(int64& v) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e) return this->_fail();
+
+    double d;
+    bool dbl;
+    S p = read_number(_b, _e, v, d, dbl);
+    if (p == 0) return this->_fail();
+    if (dbl) v = (int64)d;
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::read(double& v) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e) return this->_fail();
+
+    int64 i;
+    bool dbl;
+    S p = read_number(_b, _e, i, v, dbl);
+    if (p == 0) return this->_fail();
+    if (!dbl) v = (double)i;
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::read(fastring& v) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e || *_b != '"') return this->_fail();
+
+    S b = _b + 1;
+    S q = find_special(b, _e);
+    if (q == 0) return this->_fail();
+    if (*q == '"') {
+        v.clear();
+        v.append(b, q - b);
+    } else {
+        auto& s = xx::jalloc().stream();
+        q = Parser::unescape(b, q, _e, s);
+        if (q == 0) return this->_fail();
+        v.clear();
+        v.append(s.data(), s.size());
+    }
+    _b = q + 1;
+    return true;
+}
+
+bool Reader::read(Json& v) {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    S b = _b;
+    if (!this->skip()) return false;
+    return v.parse_from(b, _b - b) || this->_fail();
+}
+
+bool Reader::skip() {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    if (_b == _e) return this->_fail();
+
+    S p;
+    switch (*_b) {
+      case '{':
+      case '[':
+        p = skip_container(_b, _e);
+        if (p == 0) return this->_fail();
+        _b = p + 1;
+        return true;
+      case '"':
+        for (p = _b + 1;;) {
+            S q = find_special(p, _e);
+            if (q == 0) return this->_fail();
+            if (*q == '"') { _b = q + 1; return true; }
+            p = q + 2; // skip the escaped character
+            if (p >= _e) return this->_fail();
+        }
+      case 't':
+      case 'f': {
+        bool v;
+        return this->read(v);
+      }
+      case 'n':
+        return this->null() || this->_fail();
+      default: {
+        double v;
+        return this->read(v);
+      }
+    }
+}
+
+bool Reader::end() {
+    if (_err) return false;
+    _b = skip_ws(_b, _e);
+    return _b == _e;
+}
+
 static inline const char* init_e2s_table() {
     static char tb[256] = { 0 };
     tb[(unsigned char)'\r'] = 'r';
@@ -627,6 +1863,41 @@ static inline const char* init_e2s_table() {
 
 inline const char* find_escapse(const char* b, const char* e, char& c) {
     static const char* tb = init_e2s_table();
+#if defined(JSON_AVX2)
+    if (e - b >= 64 && g_has_avx2) {
+        b = find_escapse_avx2(b, e, tb, c);
+        if (c) return b;
+    }
+#endif
+#if defined(JSON_SSE2)
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i s = _mm_set1_epi8('\\');
+    const __m128i x1f = _mm_set1_epi8(0x1f);
+    for (; b + 16 <= e; b += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const __m128i w = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, q), _mm_cmpeq_epi8(x, s)),
+            _mm_cmpeq_epi8(_mm_min_epu8(x, x1f), x)
+        );
+        for (uint32 m = (uint32)_mm_movemask_epi8(w); m; m &= m - 1) {
+            const char* p = b + _ctz(m);
+            if ((c = tb[(uint8)*p])) return p;
+        }
+    }
+#elif defined(JSON_NEON)
+    const uint8x16_t q = vdupq_n_u8('"');
+    const uint8x16_t s = vdupq_n_u8('\\');
+    const uint8x16_t sp = vdupq_n_u8(0x20);
+    for (; b + 16 <= e; b += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8*)b);
+        const uint8x16_t w = vorrq_u8(vorrq_u8(vceqq_u8(x, q), vceqq_u8(x, s)), vcltq_u8(x, sp));
+        // one bit for each byte
+        for (uint64 m = _neon_mask(w) & 0x8888888888888888ull; m; m &= m - 1) {
+            const char* p = b + (__builtin_ctzll(m) >> 2);
+            if ((c = tb[(uint8)*p])) return p;
+        }
+    }
+#endif
   #if 1
     char c0, c1, c2, c3, c4, c5, c6, c7;
     for (;;) {
@@ -662,6 +1933,23 @@ inline const char* find_escapse(const char* b, const char* e, char& c) {
   #endif
 }
 
+namespace xx {
+
+// write a string with quotes, special characters are escaped
+fastream& write_string(fastream& fs, const char* s, size_t n) {
+    const char* const e = s + n;
+    fs << '"';
+    char c;
+    for (S p; (p = find_escapse(s, e, c)) < e;) {
+        fs.append(s, p - s).append('\\').append(c);
+        s = p + 1;
+    }
+    if (s != e) fs.append(s, e - s);
+    return fs << '"';
+}
+
+} // xx
+
 fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
     if (!_h) return fs.append("null", 4);
 
@@ -688,7 +1976,7 @@ fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
       case t_object: {
         fs << '{';
         if (_h->p) {
-            auto& a = *(xx::Array*)&_h->p;
+            auto& a = _array();
             for (uint32 i = 0; i < a.size(); i += 2) {
                 fs << '"' << (S)a[i] << '"' << ':';
                 ((Json*)&a[i + 1])->_json2str(fs, debug, mdp) << ',';
@@ -701,7 +1989,7 @@ fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
       case t_array: {
         fs << '[';
         if (_h->p) {
-            auto& a = *(xx::Array*)&_h->p;
+            auto& a = _array();
             for (uint32 i = 0; i < a.size(); ++i) {
                 ((Json*)&a[i])->_json2str(fs, debug, mdp) << ',';
             }
@@ -733,7 +2021,7 @@ fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
       case t_object: {
         fs << '{';
         if (_h->p) {
-            auto& a = *(xx::Array*)&_h->p;
+            auto& a = _array();
             for (uint32 i = 0; i < a.size(); i += 2) {
                 fs.append('\n').append(n, ' ');
                 fs << '"' << (S)a[i] << '"' << ": ";
@@ -751,7 +2039,7 @@ fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
       case t_array: {
         fs << '[';
         if (_h->p) {
-            auto& a = *(xx::Array*)&_h->p;
+            auto& a = _array();
             for (uint32 i = 0; i < a.size(); ++i) {
                 fs.append('\n').append(n, ' ');
                 ((Json*)&a[i])->_json2pretty(fs, indent, n + indent, mdp) << ',';
@@ -772,19 +2060,95 @@ fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
     return fs;
 }
 
-bool Json::has_member(const char* key) const {
-    if (this->is_object()) {
-        for (auto it = this->begin(); it != this->end(); ++it) {
-            if (strcmp(key, it.key()) == 0) return true;
+namespace xx {
+
+struct Sink {
+    Sink(const sink_t& f, size_t chunk) : f(f), fs(chunk + 64), chunk(chunk) {}
+
+    bool flush() {
+        bool r = fs.empty() || f(fs.data(), fs.size());
+        fs.clear();
+        return r;
+    }
+
+    // pass the buffer to f if it is full
+    bool check() { return fs.size() < chunk || this->flush(); }
+
+    const sink_t& f;
+    fastream fs;
+    size_t chunk;
+};
+
+} // xx
+
+// the same as _json2str() with indent 0, or _json2pretty(), but members are
+// separated without looking back at the buffer, which may have been flushed
+bool Json::_json2sink(xx::Sink& s, int indent, int n, int mdp) const {
+    fastream& fs = s.fs;
+    if (!_h || !(_h->type & (t_array | t_object))) {
+        this->_json2str(fs, false, mdp);
+        return s.check();
+    }
+
+    const bool obj = _h->type == t_object;
+    bool empty = true;
+    fs << (obj ? '{' : '[');
+    if (!s.check()) return false;
+    if (_h->p) {
+        auto& a = _array();
+        for (uint32 i = 0; i < a.size(); i += (obj ? 2 : 1)) {
+            if (!empty) fs << ',';
+            empty = false;
+            if (indent) fs.append('\n').append(n, ' ');
+            if (obj) {
+                fs << '"' << (S)a[i] << '"' << ':';
+                if (indent) fs << ' ';
+            }
+            if (!((Json*)&a[obj ? i + 1 : i])->_json2sink(s, indent, n + indent, mdp)) return false;
         }
     }
-    return false;
+    if (indent && !empty) {
+        fs.append('\n');
+        if (n > indent) fs.append(n - indent, ' ');
+    }
+    fs << (obj ? '}' : ']');
+    return s.check();
+}
+
+bool Json::write(const sink_t& f, size_t chunk, int mdp) const {
+    xx::Sink s(f, chunk);
+    return this->_json2sink(s, 0, 0, mdp) && s.flush();
+}
+
+bool Json::write_pretty(const sink_t& f, size_t chunk, int mdp) const {
+    xx::Sink s(f, chunk);
+    return this->_json2sink(s, 4, 4, mdp) && s.flush();
+}
+
+// find value of @key in the object, NULL if not found
+Json* Json::_find(const char* key) const {
+    if (!_h->p) return 0;
+    const uint32 n = _array().size() >> 1;
+    if (n < xx::g_index_min) {
+        auto& a = _array();
+        for (uint32 i = 0; i < a.size(); i += 2) {
+            if (key == a[i] || strcmp(key, (S)a[i]) == 0) return (Json*)&a[i + 1];
+        }
+        return 0;
+    }
+    auto x = xx::get_index(_h, n);
+    return xx::index_find(x, ((xx::Array*)&x->a)->data(), key);
+}
+
+bool Json::has_member(const char* key) const {
+    return this->is_object() && this->_find(key);
 }
 
 Json& Json::operator[](const char* key) const {
     assert(!_h || _h->type & t_object);
-    for (auto it = this->begin(); it != this->end(); ++it) {
-        if (strcmp(key, it.key()) == 0) return it.value();
+    if (this->is_object()) {
+        Json* const v = this->_find(key);
+        if (v) return *v;
     }
 
     if (!_h) {
@@ -792,6 +2156,7 @@ Json& Json::operator[](const char* key) const {
         new (&_h->p) xx::Array(8);
     }
     if (!_h->p) new (&_h->p) xx::Array(8);
+    else if (unlikely(_h->flag & f_fixed)) this->_unfix();
 
     auto& a = _array();
     a.push_back(make_key(xx::jalloc(), key));
@@ -808,13 +2173,77 @@ Json& Json::get(uint32 i) const {
 
 Json& Json::get(const char* key) const {
     if (this->is_object()) {
-        for (auto it = this->begin(); it != this->end(); ++it) {
-            if (strcmp(key, it.key()) == 0) return it.value();
-        }
+        Json* const v = this->_find(key);
+        if (v) return *v;
     }
     return xx::jalloc().null();
 }
 
+Path::Path(const char* s, size_t n) : _n(0), _ok(true) {
+    if (n == 0) return;
+    if (*s != '/') { _ok = false; return; }
+
+    const char* const e = s + n;
+    for (const char* p = s + 1;; ++p) {
+        const char* q = (const char*) memchr(p, '/', e - p);
+        if (!q) q = e;
+
+        // |index|len|key|, len and key are filled after unescaping
+        const size_t pos = _s.size();
+        _s.resize(pos + 8);
+        for (; p < q; ++p) {
+            if (*p != '~') { _s.append(*p); continue; }
+            if (p + 1 < q && (p[1] == '0' || p[1] == '1')) {
+                _s.append(p[1] == '0' ? '~' : '/');
+                ++p;
+            } else {
+                _ok = false;
+                return;
+            }
+        }
+        const uint32 len = (uint32)(_s.size() - pos - 8);
+        _s.append('\0');
+
+        // an index is "0", or a number not beginning with '0'
+        const char* k = _s.data() + pos + 8;
+        uint64 x = len > 0 && len <= 10 && (len == 1 || *k != '0') ? 0 : (uint64)-1;
+        for (uint32 i = 0; i < len && x <= (uint32)-1; ++i) {
+            x = (k[i] >= '0' && k[i] <= '9') ? x * 10 + (k[i] - '0') : (uint64)-1;
+        }
+        const uint32 index = x < (uint32)-1 ? (uint32)x : (uint32)-1;
+        memcpy((char*)_s.data() + pos, &index, 4);
+        memcpy((char*)_s.data() + pos + 4, &len, 4);
+        ++_n;
+        if (q == e) break;
+        p = q;
+    }
+}
+
+Json& Json::find(const Path& path) const {
+    if (!path._ok) return xx::jalloc().null();
+
+    const Json* v = this;
+    const char* p = path._s.data();
+    for (uint32 i = 0; i < path._n; ++i) {
+        uint32 index, len;
+        memcpy(&index, p, 4);
+        memcpy(&len, p + 4, 4);
+        const char* key = p + 8;
+        p = key + len + 1;
+
+        if (v->is_object()) {
+            v = v->_find(key);
+            if (!v) return xx::jalloc().null();
+        } else if (v->is_array()) {
+            if (!v->_h->p || index >= v->_array().size()) return xx::jalloc().null();
+            v = (Json*)&v->_array()[index];
+        } else {
+            return xx::jalloc().null();
+        }
+    }
+    return *(Json*)v;
+}
+
 Json& Json::_set(uint32 i) {
   beg:
     if (this->is_null()) {
@@ -854,9 +2283,8 @@ Json& Json::_set(const char* key) {
         goto beg;
     }
 
-    for (auto it = this->begin(); it != this->end(); ++it) {
-        if (strcmp(key, it.key()) == 0) return it.value();
-    }
+    Json* const v = this->_find(key);
+    if (v) return *v;
 
     this->add_member(key, Json());
     return *(Json*)&_array().back();
@@ -865,33 +2293,109 @@ Json& Json::_set(const char* key) {
 void Json::reset() {
     if (_h) {
         auto& a = xx::jalloc();
+        const bool arena = _h->flag & f_arena;
         switch (_h->type) {
-          case t_object:
+          case t_object: {
+            if (_h->flag & f_lazy) break;
+            uint32 v = (_h->flag & f_view) ? _h->size : 0; // keys not owned
             for (auto it = this->begin(); it != this->end(); ++it) {
-                a.free((void*)it.key(), (uint32)strlen(it.key()) + 1);
+                if (v > 0) {
+                    --v;
+                } else if (!arena) {
+                    a.free((void*)it.key(), (uint32)strlen(it.key()) + 1);
+                }
                 it.value().reset();
             }
-            if (_h->p) _array().~Array();
+            if (_h->p) {
+                if (!(_h->flag & f_fixed)) _array().~Array();
+                if (_h->flag & f_index) xx::free_index((xx::Index*)_h->p);
+            }
             break;
+          }
 
           case t_array:
+            if (_h->flag & f_lazy) break;
             for (auto it = this->begin(); it != this->end(); ++it) {
                 (*it).reset();
             }
-            if (_h->p) _array().~Array();
+            if (_h->p && !(_h->flag & f_fixed)) _array().~Array();
             break;
           
           case t_string:
-            if (_h->s) a.free(_h->s, _h->size + 1);
+            if (_h->s && !arena && !(_h->flag & f_view)) a.free(_h->s, _h->size + 1);
             break;
         }
-        a.free(_h);
+        if (!arena) a.free(_h);
         _h = 0;
     }
 }
 
+// parse lazy nodes and build hash indexes, lookups will not modify it then
+void Json::_freeze() const {
+    if (!_h || !(_h->type & (t_object | t_array)) || !_h->p) return;
+    if (_h->flag & f_lazy) this->_array_slow(); // parse it now
+    if (_h->type == t_object) {
+        // the array of members is moved into the index
+        const uint32 n = _array().size() >> 1;
+        if (n >= xx::g_index_min) xx::get_index(_h, n);
+        auto& a = _array();
+        for (uint32 i = 1; i < a.size(); i += 2) ((Json*)&a[i])->_freeze();
+    } else {
+        auto& a = _array();
+        for (uint32 i = 0; i < a.size(); ++i) ((Json*)&a[i])->_freeze();
+    }
+}
+
+// @n is the number of copies, the tree is frozen when it is first shared, and
+// it stays so while n > 1, as mut() copies a shared tree.
+struct Shared::_R {
+    explicit _R(Json&& v) : n(1), frozen(false), v(std::move(v)) {}
+    uint32 n;
+    bool frozen;
+    Json v;
+};
+
+Shared::Shared(Json&& v) : _r(co::make<_R>(std::move(v))) {}
+
+Shared::Shared(const Shared& s) : _r(s._r) {
+    if (_r) {
+        // only the owner sees frozen == false, as n is 1 then
+        if (!_r->frozen) { _r->v._freeze(); _r->frozen = true; }
+        atomic_inc(&_r->n, mo_relaxed);
+    }
+}
+
+void Shared::_unref() {
+    if (atomic_dec(&_r->n, mo_acq_rel) == 0) co::del(_r);
+}
+
+const Json& Shared::operator*() const {
+    return _r ? _r->v : xx::jalloc().null();
+}
+
+Json& Shared::mut() {
+    if (!_r) {
+        _r = co::make<_R>(Json());
+    } else if (atomic_load(&_r->n, mo_acquire) > 1) {
+        Json v = _r->v.dup();
+        this->_unref();
+        _r = co::make<_R>(std::move(v));
+    }
+    _r->frozen = false;
+    return _r->v;
+}
+
+uint32 Shared::use_count() const {
+    return _r ? atomic_load(&_r->n, mo_relaxed) : 0;
+}
+
 void* Json::_dup() const {
     _H* h = 0;
+    if (_h && (_h->flag & f_lazy)) { // not parsed yet, refer to the same input
+        h = (_H*) xx::jalloc().alloc();
+        *h = *_h;
+        return h;
+    }
     if (_h) {
         switch (_h->type) {
           case t_object:
@@ -919,12 +2423,22 @@ void* Json::_dup() const {
           default:
             h = (_H*) xx::jalloc().alloc();
             h->type = _h->type;
+            h->flag = 0;
             h->i = _h->i;
         }
     }
     return h;
 }
 
+// take the string of @h as key of an object, the string is copied if it
+// belongs to an arena or the input of parse_view()
+inline char* take_key(_H* h) {
+    char* s = h->s;
+    if (h->flag & (Json::f_arena | Json::f_view)) s = make_key(xx::jalloc(), s, h->size);
+    h->s = 0;
+    return s;
+}
+
 Json::Json(std::initializer_list<Json> v) {
     const bool is_obj = std::all_of(v.begin(), v.end(), [](const Json& x) {
         return x.is_array() && x.array_size() == 2 && x[0].is_string();
@@ -936,7 +2450,7 @@ Json::Json(std::initializer_list<Json> v) {
         if (n > 0) {
             auto& a = *new(&_h->p) xx::Array(n);
             for (auto& x : v) {
-                a.push_back(x[0]._h->s); x[0]._h->s = 0;
+                a.push_back(take_key(x[0]._h));
                 a.push_back(x[1]._h); x[1]._h = 0;
             }
         }
@@ -975,8 +2489,7 @@ Json object(std::initializer_list<Json> v) {
         auto& a = *new(&h->p) xx::Array(n);
         for (auto& x : v) {
             assert(x.is_array() && x.size() == 2 && x[0].is_string());
-            a.push_back((*(Json::_H**)&x[0])->s);
-            (*(_H**)&x[0])->s = 0;
+            a.push_back(take_key(*(_H**)&x[0]));
             a.push_back(*(_H**)&x[1]);
             *(_H**)&x[1] = 0;
         }
@@ -0,0 +1,151 @@
+#include "co/json_lines.h"
+#include "co/co.h"
+#include <utility>
+
+namespace json {
+namespace {
+
+// inputs smaller than this are parsed in the calling thread
+const size_t g_min_parallel = 64 * 1024;
+
+struct piece_t {
+    const char* b;
+    const char* e;
+    co::vector<Json> v;
+    size_t err;
+};
+
+inline bool is_blank(const char* b, const char* e) {
+    for (; b < e; ++b) {
+        if (*b != ' ' && *b != '\t' && *b != '\r') return false;
+    }
+    return true;
+}
+
+void parse_piece(piece_t& p) {
+    p.err = 0;
+    for (const char* b = p.b; b < p.e;) {
+        const char* q = (const char*) memchr(b, '\n', p.e - b);
+        if (!q) q = p.e;
+        if (!is_blank(b, q)) {
+            p.v.emplace_back();
+            if (!p.v.back().parse_from(b, q - b)) ++p.err;
+        }
+        b = q + 1;
+    }
+}
+
+// parse lines in [s, s + n) on schedulers, wait for them by done()
+class Batch {
+  public:
+    Batch() = default;
+    ~Batch() = default;
+
+    void start(const char* s, size_t n, uint32 k) {
+        const auto& ss = co::schedulers();
+        if (k == 0) k = (uint32)ss.size();
+        if (n < g_min_parallel) k = 1;
+        _p.clear();
+        _p.reserve(k);
+
+        // split at newlines into k pieces of about the same size
+        const char* const e = s + n;
+        const size_t m = n / k + 1;
+        for (const char* b = s; b < e;) {
+            const char* q = b + m < e ? (const char*) memchr(b + m, '\n', e - b - m) : 0;
+            q = q ? q + 1 : e;
+            _p.push_back(piece_t{ b, q, co::vector<Json>(), 0 });
+            b = q;
+        }
+
+        if (_p.size() <= 1) {
+            if (_p.size() == 1) parse_piece(_p[0]);
+            return;
+        }
+        _wg.add((uint32)_p.size());
+        for (size_t i = 0; i < _p.size(); ++i) {
+            piece_t* p = &_p[i];
+            co::WaitGroup wg = _wg;
+            ss[i % ss.size()]->go([p, wg]() { parse_piece(*p); wg.done(); });
+        }
+    }
+
+    // wait for the pieces, and move the results to @v
+    size_t done(co::vector<Json>& v) {
+        if (_p.size() > 1) _wg.wait();
+        size_t err = 0, n = 0;
+        for (auto& p : _p) n += p.v.size();
+        v.reserve(v.size() + n);
+        for (auto& p : _p) {
+            for (auto& x : p.v) v.push_back(std::move(x));
+            err += p.err;
+        }
+        _p.clear();
+        return err;
+    }
+
+  private:
+    co::vector<piece_t> _p;
+    co::WaitGroup _wg;
+};
+
+} // namespace
+
+size_t parse_lines(const char* s, size_t n, co::vector<Json>& v, uint32 k) {
+    Batch b;
+    b.start(s, n, k);
+    return b.done(v);
+}
+
+size_t parse_lines(fs::file& f, const std::function<bool(Json&)>& cb, size_t batch, uint32 k) {
+    fastring x(batch + 4096), y(batch + 4096);
+    fastring* cur = &x; // complete lines being parsed
+    fastring* nxt = &y; // being read, begins with the partial line left
+    co::vector<Json> v;
+    Batch b;
+    size_t err = 0;
+    bool running = false;
+
+    for (;;) {
+        // read the next batch while the previous one is parsed
+        nxt->reserve(nxt->size() + batch);
+        const size_t r = f.read((char*)nxt->data() + nxt->size(), batch);
+        nxt->resize(nxt->size() + r);
+
+        if (running) {
+            running = false;
+            err += b.done(v);
+            for (auto& e : v) {
+                if (!cb(e)) return err;
+            }
+            v.clear();
+        }
+
+        // parse complete lines only, unless it is the end of the file
+        size_t end = nxt->size();
+        if (r > 0) {
+            while (end > 0 && (*nxt)[end - 1] != '\n') --end;
+        }
+        cur->clear();
+        cur->append(nxt->data() + end, nxt->size() - end);
+        nxt->resize(end);
+        std::swap(cur, nxt);
+
+        if (!cur->empty()) {
+            b.start(cur->data(), cur->size(), k);
+            running = true;
+        }
+
+        if (r == 0) {
+            if (running) {
+                err += b.done(v);
+                for (auto& e : v) {
+                    if (!cb(e)) break;
+                }
+            }
+            return err;
+        }
+    }
+}
+
+} // json
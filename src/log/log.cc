@@ -6,15 +6,24 @@
 #include "co/array.h"
 #include "co/time.h"
 #include "co/thread.h"
+#include "co/hash/crc32c.h"
+#include "co/histogram.h"
 #include "../co/hook.h"
 #include "stack_trace.h"
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/select.h>
 #endif
 #include <time.h>
 
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma warning (disable:4722)
 #endif
@@ -26,10 +35,26 @@ DEF_int32(max_log_size, 4096, ">>#0 max size of a single log");
 DEF_int64(max_log_file_size, 256 << 20, ">>#0 max size of log file, default: 256MB");
 DEF_uint32(max_log_file_num, 8, ">>#0 max number of log files");
 DEF_uint32(max_log_buffer_size, 32 << 20, ">>#0 max size of log buffer, default: 32MB");
-DEF_uint32(log_flush_ms, 128, ">>#0 flush the log buffer every n ms");
+DEF_uint32(log_flush_ms, 128, ">>#0 flush the log buffer every n ms, up to 8n ms while there are few logs");
+DEF_string(log_overflow, "oldest", ">>#0 what to do when the log buffer is full: oldest, newest, block or severity. "
+    "oldest: drop the older half, newest: drop the new log, block: wait up to log_block_us, then drop the new log, "
+    "severity: like newest, but errors are always kept");
+DEF_uint32(log_block_us, 1000, ">>#0 max time in us a thread waits for a full log buffer, for log_overflow=block");
 DEF_bool(cout, false, ">>#0 also logging to terminal");
 DEF_bool(log_daily, false, ">>#0 if true, enable daily log rotation");
-DEF_bool(log_compress, false, ">>#0 if true, compress rotated log files with xz");
+DEF_bool(log_compress, false, ">>#0 if true, compress rotated log files with xz, or compress logs on the fly if built with zlib");
+DEF_int32(log_compress_level, 1, ">>#0 zlib compression level 1-9 of log files, for log_compress");
+DEF_bool(log_binary, false, ">>#0 if true, write BLOG logs to log_dir/xx.blog without formatting them");
+DEF_bool(log_checksum, false, ">>#0 if true, each batch of logs written to the .blog file is followed by its crc32c, for log_binary");
+DEF_bool(log_mmap, false, ">>#0 if true, write log files through a sliding mmap window instead of write(), not for windows");
+
+// flags that can be changed at runtime by flag::update()
+static bool _mutable_flags = []() {
+    flag::set_mutable("min_log_level");
+    flag::set_mutable("log_flush_ms");
+    flag::set_mutable("log_block_us");
+    return true;
+}();
 
 // Detect if it is safe to start the logging thread.
 // When this value is true, the flag log_dir and log_file_name should have been 
@@ -99,32 +124,181 @@ class LogTime {
 };
 
 // the local file that logs will be written to
+#ifndef _WIN32
+// Append-only file written through a sliding mmap window. The file is extended
+// a window ahead of the logs, so it is truncated to the real size on close, and
+// trailing zeros left by a crash are removed on open.
+class MmapFile {
+  public:
+    enum { window = 8 << 20 }; // MUST be a multiple of the page size
+
+    MmapFile() : _fd(-1), _map(0), _off(0), _end(0), _size(0) {}
+    ~MmapFile() { this->close(); }
+
+    bool open(const char* path);
+    void write(const char* p, size_t n);
+    void close();
+
+    explicit operator bool() const { return _fd != -1; }
+    uint64 size() const { return _size; }
+
+  private:
+    bool remap();
+
+    int _fd;
+    char* _map;  // window [_off, _off + window) of the file
+    uint64 _off;
+    uint64 _end; // file size on disk
+    uint64 _size; // bytes written
+};
+
+bool MmapFile::open(const char* path) {
+    this->close();
+    _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd == -1) return false;
+
+    struct stat st;
+    _end = fstat(_fd, &st) == 0 ? (uint64)st.st_size : 0;
+    _size = _end;
+
+    // find the last non-zero byte, at most a window back from the end
+    char buf[4096];
+    const uint64 lim = _end > window ? _end - window : 0;
+    while (_size > lim) {
+        const uint64 n = _size - lim < sizeof(buf) ? _size - lim : sizeof(buf);
+        if (pread(_fd, buf, (size_t)n, (off_t)(_size - n)) != (ssize_t)n) break;
+        uint64 i = n;
+        while (i > 0 && buf[i - 1] == 0) --i;
+        _size -= n - i;
+        if (i > 0) break;
+    }
+    if (_size != _end && ftruncate(_fd, (off_t)_size) == 0) _end = _size;
+    return true;
+}
+
+inline bool MmapFile::remap() {
+    if (_map) {
+        msync(_map, window, MS_ASYNC);
+        munmap(_map, window);
+        _map = 0;
+    }
+
+    _off = _size & ~((uint64)window - 1);
+    if (_end < _off + window) {
+      #ifdef __linux__
+        // reserve blocks, or writing to the map may raise SIGBUS when disk is full
+        if (posix_fallocate(_fd, (off_t)_end, (off_t)(_off + window - _end)) != 0) return false;
+      #else
+        if (ftruncate(_fd, (off_t)(_off + window)) != 0) return false;
+      #endif
+        _end = _off + window;
+    }
+
+    void* x = mmap(NULL, window, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, (off_t)_off);
+    if (x == MAP_FAILED) return false;
+    _map = (char*)x;
+    return true;
+}
+
+void MmapFile::write(const char* p, size_t n) {
+    const uint64 beg = _size;
+    while (n > 0) {
+        if (!_map || _size >= _off + window) {
+            if (!this->remap()) { // fall back to write()
+                _map = 0;
+                if (pwrite(_fd, p, n, (off_t)_size) == (ssize_t)n) _size += n;
+                if (_end < _size) _end = _size;
+                return;
+            }
+        }
+        const uint64 m = _off + window - _size;
+        const size_t k = n < m ? n : (size_t)m;
+        memcpy(_map + (_size - _off), p, k);
+        _size += k; p += k; n -= k;
+    }
+
+    // schedule writeback of the dirty pages, without waiting for it
+    if (_map && _size > beg) {
+        static const uint64 page = (uint64)sysconf(_SC_PAGESIZE);
+        const uint64 x = (beg > _off ? beg : _off) & ~(page - 1);
+        msync(_map + (x - _off), (size_t)(_size - x), MS_ASYNC);
+    }
+}
+
+void MmapFile::close() {
+    if (_fd == -1) return;
+    if (_map) {
+        msync(_map, window, MS_ASYNC);
+        munmap(_map, window);
+        _map = 0;
+    }
+    if (_end != _size) (void) ftruncate(_fd, (off_t)_size);
+    ::close(_fd);
+    _fd = -1;
+    _off = _end = _size = 0;
+}
+#endif
+
 class LogFile {
   public:
     LogFile()
         : _file(256), _path(256), _path_base(256),
           _day(0), _checked(false) {
         _file.open("", 'a');
+      #ifdef HAS_ZLIB
+        _gz = _zinit = false;
+        memset(&_zs, 0, sizeof(_zs));
+      #endif
     }
 
     fs::file& open(const char* topic, int level, LogTime* t);
     void write(const char* p, size_t n, LogTime* t);
     void write(const char* topic, const char* p, size_t n, LogTime* t);
+    void close();
 
   private:
     bool check_config(const char* topic, int level, LogTime* t);
     uint32 day_in_path(const fastring& path);
     void compress_file(const fastring& path);
+    void write(const char* p, size_t n);
+    void raw_write(const char* p, size_t n);
+    bool is_open() const;
+    uint64 size() const;
+
+  #ifdef HAS_ZLIB
+    void gz_begin();
+    void gz_write(const char* p, size_t n, int flush);
+  #endif
 
   private:
     fs::file _file;
+  #ifndef _WIN32
+    MmapFile _mmap; // used instead of _file if log_mmap is true
+  #endif
     fastring _path;
     fastring _path_base; // prefix of the log path: log_dir/log_file_name 
     co::deque<fastring> _old_paths; // paths of old log files
     uint32 _day;
     bool _checked;
+  #ifdef HAS_ZLIB
+    bool _gz;    // compressing logs to _file
+    bool _zinit; // _zs was initialized
+    z_stream _zs;
+    fastring _zbuf;
+  #endif
 };
 
+// Logs are compressed on the fly to xx.log.gz when it is built with zlib, so
+// rotation is a rename. Each write ends with a sync flush, and each open of a
+// file starts a new gzip member, so the file is readable at any time.
+inline const char* log_ext() {
+  #ifdef HAS_ZLIB
+    return FLG_log_compress ? ".log.gz" : ".log";
+  #else
+    return ".log";
+  #endif
+}
+
 void on_signal(int sig);  // handler for SIGINT SIGTERM SIGQUIT
 void on_failure(int sig); // handler for SIGSEGV SIGABRT SIGFPE SIGBUS SIGILL
 
@@ -157,7 +331,19 @@ class Logger {
     static const uint32 N = 128 * 1024;
     static const int A = 8; // array size
 
-    Logger() : _log_event(true, false), _log_thread(0), _stop(0) {}
+    // policies on overflow of the log buffer
+    enum {
+        drop_oldest = 0,
+        drop_newest = 1,
+        block = 2,
+        by_severity = 3,
+    };
+
+    Logger()
+        : _log_event(true, false), _log_thread(0), _stop(0), _overflow(drop_oldest),
+          _flush_ms(0), _flush_hist(1) {
+        memset(&_stats, 0, sizeof(_stats));
+    }
     ~Logger() = delete;
 
     bool start();
@@ -165,7 +351,12 @@ class Logger {
 
     void push(char* s, size_t n);
     void push(const char* topic, char* s, size_t n);
+    void push(Topic* topic, char* s, size_t n);
     void push_fatal_log(char* s, size_t n);
+    void push_merged(const char* s, size_t n);
+    void push_blog(BlogSite* site, const char* p, size_t n);
+    stats_t stats();
+    const co::Histogram& flush_histogram() const { return _flush_hist; }
 
     void set_write_cb(const std::function<void(const void*, size_t)>& cb, int flags) {
         _llog.write_cb = cb;
@@ -178,11 +369,29 @@ class Logger {
     }
 
   private:
-    struct LevelLog {
-        LevelLog() : bytes(0), counter(0), write_cb(NULL), write_flags(0) {}
+    // level logs of a thread, only the thread and the logging thread lock it
+    struct ThreadLog {
+        ThreadLog() : buf(4096), next(0), busy(1) {}
         ::Mutex mtx;
         fastream buf;      // logs will be pushed to this buffer
-        fastream logs;     // to swap out logs in buf
+        fastream bin;      // binary logs (BLOG): |site|tid|n|args|
+        fastream bout;     // to swap out logs in bin
+        char time_str[24]; // "0723 17:00:00.123"
+        ThreadLog* next;
+        int busy;          // 0 if the thread has exited, it can be reused
+    };
+
+    struct ThreadLogRef {
+        ThreadLogRef() : p(0) {}
+        ~ThreadLogRef() { if (p) atomic_store(&p->busy, 0, mo_release); }
+        ThreadLog* p;
+    };
+
+    struct LevelLog {
+        LevelLog() : head(0), bytes(0), counter(0), write_cb(NULL), write_flags(0) {}
+        ::Mutex mtx;       // for time_str
+        ThreadLog* head;   // logs of all threads, never removed
+        fastream logs;     // logs collected from all threads
         char time_str[24]; // "0723 17:00:00.123"
         size_t bytes;
         size_t counter;
@@ -203,28 +412,55 @@ class Logger {
     typedef const char* Key;
 
     struct TLog {
-        TLog() : pts(8), write_cb(NULL), write_flags(0) {}
-        struct {
+        struct Shard {
             ::Mutex mtx;
             co::hash_map<Key, PerTopic> mp;
             LogTime log_time;
             char time_str[24];
-        } v[A];
+        };
+
+        TLog() : pts(8), write_cb(NULL), write_flags(0) {}
+        Shard v[A];
         co::array<PerTopic*> pts;
         std::function<void(const char*, const void*, size_t)> write_cb;
         int write_flags;
     };
 
+    struct BinLog {
+        BinLog() : id(0) {}
+        fastream raw;  // binary logs to be written to the .blog file
+        fs::file file;
+        uint32 id;     // id of the last site written to the file
+    };
+
+    ThreadLog* thread_log();
+    ThreadLog* new_thread_log();
+    void wait_for_room(ThreadLog* x, const fastream& buf, size_t n);
+    bool make_room(fastream& buf, size_t n, bool important, bool bin);
+    void drop_logs(fastream& buf, bool keep_errors);
+    void drop_blogs(fastream& buf);
+    void append_tlog(TLog::Shard& v, PerTopic& x, char* s, size_t n);
+    void collect_logs(bool signal_safe);
+    void collect_blogs(const fastream& b, const char* t);
+    void write_blogs();
     void write_logs(const char* p, size_t n, LogTime* t);
     void write_tlogs(co::array<PerTopic*>& v, LogTime* t);
+    void write_cout();
+    uint32 next_flush_ms(size_t bytes);
     void thread_fun();
 
   private:
     LevelLog _llog;
     TLog _tlog;
+    BinLog _blog;
     SyncEvent _log_event;
     Thread* _log_thread;
     int _stop; // 0: init, 1: stopping, 2: logging thread stopped, 3: final
+    int _overflow;
+    uint32 _flush_ms;   // current flush interval, see next_flush_ms()
+    fastream _cout;     // logs of a flush to stderr, written at once
+    stats_t _stats;
+    co::Histogram _flush_hist;
 };
 
 Global::Global()
@@ -260,7 +496,6 @@ bool Logger::start() {
     if (atomic_bool_cas(&_log_thread, (void*)0, (void*)8)) {
         global().log_time->update();
         memcpy(_llog.time_str, global().log_time->get(), 24);
-        _llog.buf.reserve(N);
         _llog.logs.reserve(N);
         for (int i = 0; i < A; ++i) {
             memcpy(_tlog.v[i].time_str, global().log_time->get(), 24);
@@ -303,13 +538,12 @@ void Logger::stop(bool signal_safe) {
         }
 
         // it may be not safe if logs are still being pushed to the buffer 
-        !signal_safe ? _llog.mtx.lock() : signal_safe_sleep(1);
-        if (!_llog.buf.empty()) {
-            _llog.buf.swap(_llog.logs);
+        if (signal_safe) signal_safe_sleep(1);
+        this->collect_logs(signal_safe);
+        if (!_llog.logs.empty()) {
             this->write_logs(_llog.logs.data(), _llog.logs.size(), global().log_time);
             _llog.logs.clear();
         }
-        if (!signal_safe) _llog.mtx.unlock();
 
         for (int i = 0; i < A; ++i) {
             auto& v = _tlog.v[i];
@@ -327,8 +561,13 @@ void Logger::stop(bool signal_safe) {
                 this->write_tlogs(_tlog.pts, &v.log_time);
                 _tlog.pts.clear();
             }
+
+            // end of the compressed stream is written on close
+            for (auto it = v.mp.begin(); it != v.mp.end(); ++it) it->second.file.close();
             if (!signal_safe) v.mtx.unlock();
         }
+        this->write_cout();
+        global().log_file->close();
 
         atomic_swap(&_stop, 3);
     } else {
@@ -336,20 +575,43 @@ void Logger::stop(bool signal_safe) {
     }
 }
 
+// flags may be changed after the logging thread started, check it every round
+inline int overflow_policy() {
+    auto& o = FLG_log_overflow;
+    return o == "newest" ? Logger::drop_newest :
+           o == "block" ? Logger::block :
+           o == "severity" ? Logger::by_severity :
+           Logger::drop_oldest;
+}
+
+// Rounds that write less than 4K bytes back off the flush interval, doubling
+// it up to 8x log_flush_ms, and a busier round restores it. The logging thread
+// is also woken up when a buffer is half full, so a longer wait drops no logs.
+inline uint32 Logger::next_flush_ms(size_t bytes) {
+    const uint32 ms = FLG_log_flush_ms > 0 ? FLG_log_flush_ms : 1;
+    if (bytes >= 4096 || _flush_ms < ms) return ms;
+    return _flush_ms < (ms << 3) ? (_flush_ms << 1) : (ms << 3);
+}
+
 void Logger::thread_fun() {
     while (!_is_safe_to_start) _log_event.wait(8);
+    _flush_ms = FLG_log_flush_ms;
     while (!_stop) {
-        bool signaled = _log_event.wait(FLG_log_flush_ms);
+        bool signaled = _log_event.wait(_flush_ms);
         if (_stop) break;
+        _overflow = overflow_policy();
 
         global().log_time->update();
         {
             ::MutexGuard g(_llog.mtx);
             memcpy(_llog.time_str, global().log_time->get(), LogTime::t_len);
-            if (!_llog.buf.empty()) _llog.buf.swap(_llog.logs);
         }
 
+        Timer timer(true);
+        size_t bytes = 0;
+        this->collect_logs(false);
         if (!_llog.logs.empty()) {
+            bytes += _llog.logs.size();
             this->write_logs(_llog.logs.data(), _llog.logs.size(), global().log_time);
             _llog.logs.clear();
         }
@@ -366,6 +628,7 @@ void Logger::thread_fun() {
                         pt->buf.swap(pt->logs);
                         if (!pt->topic) pt->topic = it->first;
                         _tlog.pts.push_back(pt);
+                        bytes += pt->logs.size();
                     }
                 }
             }
@@ -375,6 +638,9 @@ void Logger::thread_fun() {
                 _tlog.pts.clear();
             }
         }
+        this->write_cout();
+        if (bytes > 0) _flush_hist.record((uint64)timer.us());
+        _flush_ms = this->next_flush_ms(bytes);
 
         if (signaled) _log_event.reset();
     }
@@ -382,6 +648,115 @@ void Logger::thread_fun() {
     atomic_swap(&_stop, 2);
 }
 
+// Logs pushed by the current thread, a thread takes no lock shared with other
+// threads but the logging thread. Buffers of exited threads are reused.
+inline Logger::ThreadLog* Logger::thread_log() {
+    static __thread ThreadLog* p = 0;
+    if (p) return p;
+    static thread_local ThreadLogRef r; // releases the buffer on thread exit
+    return p = r.p = this->new_thread_log();
+}
+
+Logger::ThreadLog* Logger::new_thread_log() {
+    ThreadLog* x = atomic_load(&_llog.head, mo_acquire);
+    for (; x; x = x->next) {
+        if (atomic_load(&x->busy, mo_relaxed) == 0 && atomic_bool_cas(&x->busy, 0, 1)) return x;
+    }
+
+    x = co::static_new<ThreadLog>();
+    {
+        ::MutexGuard g(_llog.mtx);
+        memcpy(x->time_str, _llog.time_str, LogTime::t_len);
+    }
+    do {
+        x->next = atomic_load(&_llog.head, mo_relaxed);
+    } while (!atomic_bool_cas(&_llog.head, x->next, x, mo_release, mo_relaxed));
+    return x;
+}
+
+// Move logs of all threads to _llog.logs, and update their time. Logs of the
+// same round carry the time of the previous round, so they are still in order
+// of time after they are concatenated.
+void Logger::collect_logs(bool signal_safe) {
+    const char* const t = _llog.time_str;
+    char bt[24];
+    for (ThreadLog* x = atomic_load(&_llog.head, mo_acquire); x; x = x->next) {
+        if (!signal_safe) x->mtx.lock();
+        if (!x->buf.empty()) {
+            _llog.logs.append(x->buf.data(), x->buf.size());
+            x->buf.clear();
+        }
+        if (!x->bin.empty()) {
+            memcpy(bt, x->time_str, LogTime::t_len);
+            x->bin.swap(x->bout);
+        }
+        memcpy(x->time_str, t, LogTime::t_len);
+        if (!signal_safe) x->mtx.unlock();
+
+        // binary logs are formatted out of the lock
+        if (!x->bout.empty()) {
+            this->collect_blogs(x->bout, bt);
+            x->bout.clear();
+        }
+    }
+    if (!_blog.raw.empty()) this->write_blogs();
+}
+
+// Binary logs in @b were pushed with time @t. They are formatted as text logs,
+// or written in binary with -log_binary. In binary mode, a site is written to
+// the .blog file before its first log, so the file can be decoded offline.
+void Logger::collect_blogs(const fastream& b, const char* t) {
+    const char* p = b.data();
+    const char* const e = p + b.size();
+    BlogSite* site;
+    uint32 tid, n;
+    while (p < e) {
+        memcpy(&site, p, sizeof(site));
+        memcpy(&tid, p + sizeof(site), 4);
+        memcpy(&n, p + sizeof(site) + 4, 4);
+        p += sizeof(site) + 8;
+
+        if (!FLG_log_binary) {
+            blog_format(_llog.logs, *site, tid, t, p, n);
+        } else {
+            auto& s = _blog.raw;
+            if (site->id == 0) {
+                site->id = ++_blog.id;
+                const uint32 fl = (uint32)strlen(site->file);
+                const uint32 ml = (uint32)strlen(site->fmt);
+                s.append('S').append(site->id).append((char)site->level).append(site->line);
+                s.append(fl).append(site->file, fl).append(ml).append(site->fmt, ml);
+            }
+            s.append('L').append(site->id).append(tid).append(t, LogTime::t_len);
+            s.append(n).append(p, n);
+        }
+        p += n;
+    }
+}
+
+// write binary logs to log_dir/xx.blog, the file is not rotated
+void Logger::write_blogs() {
+    if (!_blog.file) {
+        fastring s(FLG_log_dir);
+        if (!s.empty() && s.back() != '/') s << '/';
+        fastring name(FLG_log_file_name.empty() ? *global().exename : FLG_log_file_name);
+        name.remove_tail(".log");
+        name.remove_tail(".exe");
+        s << name << ".blog";
+        if (!FLG_log_dir.empty() && !fs::exists(FLG_log_dir)) fs::mkdir(FLG_log_dir, true);
+        _blog.file.open(s, 'a');
+    }
+    // a checksum record |'C'|n|crc| for the n bytes before it
+    if (FLG_log_checksum) {
+        const uint32 n = (uint32)_blog.raw.size();
+        const uint32 crc = crc32c(_blog.raw.data(), n);
+        _blog.raw.append('C').append(n).append(crc);
+    }
+    if (_blog.file) _blog.file.write(_blog.raw.data(), _blog.raw.size());
+    _blog.raw.clear();
+}
+
+
 void Logger::write_logs(const char* p, size_t n, LogTime* t) {
     // log to local file
     if (!_llog.write_cb || (_llog.write_flags & log::log2local)) {
@@ -391,8 +766,8 @@ void Logger::write_logs(const char* p, size_t n, LogTime* t) {
     // write logs through the write callback
     if (_llog.write_cb) _llog.write_cb(p, n);
 
-    // log to stderr
-    if (FLG_cout) fwrite(p, 1, n, stderr);
+    // log to stderr, see write_cout()
+    if (FLG_cout) _cout.append(p, n);
 
     _llog.bytes += n;
     if (++_llog.counter == 32) {
@@ -407,6 +782,14 @@ void Logger::write_logs(const char* p, size_t n, LogTime* t) {
     }
 }
 
+// logs of a flush, level logs and logs of all topics, go to stderr in one write
+void Logger::write_cout() {
+    if (!_cout.empty()) {
+        fwrite(_cout.data(), 1, _cout.size(), stderr);
+        _cout.clear();
+    }
+}
+
 void Logger::write_tlogs(co::array<PerTopic*>& v, LogTime* t) {
     for (size_t i = 0; i < v.size(); ++i) {
         auto pt = v[i];
@@ -418,7 +801,7 @@ void Logger::write_tlogs(co::array<PerTopic*>& v, LogTime* t) {
             _tlog.write_cb(pt->topic, pt->logs.data(), pt->logs.size());
         }
 
-        if (FLG_cout) fwrite(pt->logs.data(), 1, pt->logs.size(), stderr);
+        if (FLG_cout) _cout.append(pt->logs.data(), pt->logs.size());
 
         pt->bytes += pt->logs.size();
         if (++pt->counter == 32) {
@@ -446,17 +829,15 @@ void Logger::push(char* s, size_t n) {
             p[2] = '.';
             p[3] = '\n';
         }
+        ThreadLog* const x = this->thread_log();
+        if (unlikely(_overflow == block)) this->wait_for_room(x, x->buf, n);
         {
-            ::MutexGuard g(_llog.mtx);
-            memcpy(s + 1, _llog.time_str, LogTime::t_len); // log time
+            ::MutexGuard g(x->mtx);
+            memcpy(s + 1, x->time_str, LogTime::t_len); // log time
 
-            auto& buf = _llog.buf;
+            auto& buf = x->buf;
             if (unlikely(buf.size() + n >= FLG_max_log_buffer_size)) {
-                const char* p = strchr(buf.data() + (buf.size() >> 1) + 7, '\n');
-                const size_t len = buf.data() + buf.size() - p - 1;
-                memcpy((char*)(buf.data()), "......\n", 7);
-                memcpy((char*)(buf.data()) + 7, p + 1, len);
-                buf.resize(len + 7);
+                if (!this->make_room(buf, n, s[0] == 'E', false)) return;
             }
 
             buf.append(s, n);
@@ -465,6 +846,157 @@ void Logger::push(char* s, size_t n) {
     }
 }
 
+// logs from other processes, they have been formatted with their own time
+void Logger::push_merged(const char* s, size_t n) {
+    static bool ks = this->start(); (void)ks;
+    if (!_stop) {
+        ThreadLog* const x = this->thread_log();
+        if (unlikely(_overflow == block)) this->wait_for_room(x, x->buf, n);
+        {
+            ::MutexGuard g(x->mtx);
+            auto& buf = x->buf;
+            if (unlikely(buf.size() + n >= FLG_max_log_buffer_size)) {
+                if (!this->make_room(buf, n, false, false)) return;
+            }
+
+            buf.append(s, n);
+            if (buf.size() > (buf.capacity() >> 1)) _log_event.signal();
+        }
+    }
+}
+
+void Logger::push_blog(BlogSite* site, const char* p, size_t n) {
+    static bool ks = this->start(); (void)ks;
+    if (!_stop) {
+        ThreadLog* const x = this->thread_log();
+        const uint32 tid = (uint32)co::thread_id();
+        if (unlikely(_overflow == block)) this->wait_for_room(x, x->bin, n + 16);
+        {
+            ::MutexGuard g(x->mtx);
+            auto& buf = x->bin;
+            if (unlikely(buf.size() + n + 16 >= FLG_max_log_buffer_size)) {
+                if (!this->make_room(buf, n + 16, site->level >= error, true)) return;
+            }
+
+            buf.append(&site, sizeof(site)).append(tid).append((uint32)n).append(p, n);
+            if (buf.size() > (buf.capacity() >> 1)) _log_event.signal();
+        }
+    }
+}
+
+// wait for the logging thread to take logs away from a full buffer, buffer
+// of the thread is not locked while waiting.
+void Logger::wait_for_room(ThreadLog* x, const fastream& buf, size_t n) {
+    for (uint32 us = 0;; us += 1000) {
+        {
+            ::MutexGuard g(x->mtx);
+            if (buf.size() + n < FLG_max_log_buffer_size) return;
+        }
+        if (us >= FLG_log_block_us) return;
+        if (us == 0) atomic_inc(&_stats.blocked, mo_relaxed);
+        _log_event.signal();
+        sleep::ms(1);
+    }
+}
+
+// Called when @buf is full, return false if the new log of @n bytes should be
+// dropped. With log_overflow=severity, errors are always kept unless the buffer
+// is full of errors.
+bool Logger::make_room(fastream& buf, size_t n, bool important, bool bin) {
+    if (_overflow == drop_oldest || (_overflow == by_severity && important)) {
+        if (bin) {
+            this->drop_blogs(buf);
+        } else {
+            this->drop_logs(buf, _overflow == by_severity);
+            if (buf.size() + n >= FLG_max_log_buffer_size) this->drop_logs(buf, false);
+        }
+        return true;
+    }
+    atomic_inc(&_stats.dropped_logs, mo_relaxed);
+    atomic_add(&_stats.dropped_bytes, n, mo_relaxed);
+    return false;
+}
+
+// Drop logs in the older half of the buffer, errors are kept if @keep_errors is
+// true, and "......" is written in place of the logs dropped.
+void Logger::drop_logs(fastream& buf, bool keep_errors) {
+    char* const b = (char*)buf.data();
+    char* const e = b + buf.size();
+    char* h = (char*)memchr(b + (buf.size() >> 1), '\n', e - b - (buf.size() >> 1));
+    h = h ? h + 1 : e; // logs in [b, h) may be dropped
+
+    char* w = b;
+    uint64 logs = 0, bytes = 0;
+    for (char* p = b; p < h;) {
+        char* q = (char*)memchr(p, '\n', h - p);
+        q = q ? q + 1 : h;
+        if (q - p == 7 && memcmp(p, "......\n", 7) == 0) {
+            // dropped before
+        } else if (keep_errors && *p == 'E') {
+            if (w != p) memmove(w, p, q - p);
+            w += q - p;
+        } else {
+            ++logs;
+            bytes += q - p;
+        }
+        p = q;
+    }
+
+    if (h - w >= 7) {
+        memcpy(w, "......\n", 7);
+        w += 7;
+    }
+    if (w != h) {
+        memmove(w, h, e - h);
+        buf.resize(w - b + (e - h));
+    }
+    atomic_add(&_stats.dropped_logs, logs, mo_relaxed);
+    atomic_add(&_stats.dropped_bytes, bytes, mo_relaxed);
+}
+
+// drop records in the older half of a buffer of binary logs
+void Logger::drop_blogs(fastream& buf) {
+    const char* q = buf.data();
+    const char* const h = q + (buf.size() >> 1);
+    uint64 logs = 0;
+    uint32 m;
+    while (q < h) {
+        memcpy(&m, q + sizeof(void*) + 4, 4);
+        q += sizeof(void*) + 8 + m;
+        ++logs;
+    }
+    const size_t len = buf.data() + buf.size() - q;
+    atomic_add(&_stats.dropped_logs, logs, mo_relaxed);
+    atomic_add(&_stats.dropped_bytes, buf.size() - len, mo_relaxed);
+    memmove((char*)buf.data(), q, len);
+    buf.resize(len);
+}
+
+stats_t Logger::stats() {
+    stats_t x;
+    x.dropped_logs = atomic_load(&_stats.dropped_logs, mo_relaxed);
+    x.dropped_bytes = atomic_load(&_stats.dropped_bytes, mo_relaxed);
+    x.blocked = atomic_load(&_stats.blocked, mo_relaxed);
+    return x;
+}
+
+// append a topic log to the buffer of the topic, v.mtx MUST be locked
+inline void Logger::append_tlog(TLog::Shard& v, PerTopic& x, char* s, size_t n) {
+    memcpy(s, v.time_str, LogTime::t_len);
+
+    auto& buf = x.buf;
+    if (unlikely(buf.size() + n >= FLG_max_log_buffer_size)) {
+        const char* p = strchr(buf.data() + (buf.size() >> 1) + 7, '\n');
+        const size_t len = buf.data() + buf.size() - p - 1;
+        memcpy((char*)(buf.data()), "......\n", 7);
+        memcpy((char*)(buf.data()) + 7, p + 1, len);
+        buf.resize(len + 7);
+    }
+
+    buf.append(s, n);
+    if (buf.size() > (buf.capacity() >> 1)) _log_event.signal();
+}
+
 void Logger::push(const char* topic, char* s, size_t n) {
     static bool ks = this->start(); (void)ks;
     if (!_stop) {
@@ -477,24 +1009,42 @@ void Logger::push(const char* topic, char* s, size_t n) {
             p[3] = '\n';
         }
 
-        auto& v = _tlog.v[murmur_hash(topic, strlen(topic)) & (A - 1)];
-        {
-            ::MutexGuard g(v.mtx);
-            memcpy(s, v.time_str, LogTime::t_len);
+        auto& v = _tlog.v[wyhash(topic, strlen(topic)) & (A - 1)];
+        ::MutexGuard g(v.mtx);
+        this->append_tlog(v, v.mp[topic], s, n);
+    }
+}
 
-            auto& x = v.mp[topic];
-            auto& buf = x.buf;
-            if (unlikely(buf.size() + n >= FLG_max_log_buffer_size)) {
-                const char* p = strchr(buf.data() + (buf.size() >> 1) + 7, '\n');
-                const size_t len = buf.data() + buf.size() - p - 1;
-                memcpy((char*)(buf.data()), "......\n", 7);
-                memcpy((char*)(buf.data()) + 7, p + 1, len);
-                buf.resize(len + 7);
-            }
+// The topic is resolved to its buffer on first use, the buffer is never removed
+// from the map, so later logs of the topic skip hashing and lookup.
+void Logger::push(Topic* topic, char* s, size_t n) {
+    static bool ks = this->start(); (void)ks;
+    if (!_stop) {
+        if (unlikely(n > (uint32)FLG_max_log_size)) {
+            n = FLG_max_log_size;
+            char* const p = s + n - 4;
+            p[0] = '.';
+            p[1] = '.';
+            p[2] = '.';
+            p[3] = '\n';
+        }
 
-            buf.append(s, n);
-            if (buf.size() > (buf.capacity() >> 1)) _log_event.signal();
+        PerTopic* pt = (PerTopic*) atomic_load(&topic->slot, mo_acquire);
+        if (unlikely(!pt)) {
+            const char* const t = topic->name;
+            const int i = (int)(wyhash(t, strlen(t)) & (A - 1));
+            auto& v = _tlog.v[i];
+            ::MutexGuard g(v.mtx);
+            pt = &v.mp[t];
+            topic->shard = i;
+            atomic_store(&topic->slot, (void*)pt, mo_release);
+            this->append_tlog(v, *pt, s, n);
+            return;
         }
+
+        auto& v = _tlog.v[topic->shard];
+        ::MutexGuard g(v.mtx);
+        this->append_tlog(v, *pt, s, n);
     }
 }
 
@@ -504,7 +1054,8 @@ void Logger::push_fatal_log(char* s, size_t n) {
     memcpy(s + 1, t->get(), LogTime::t_len);
 
     this->write_logs(s, n, t);
-    if (!FLG_cout) fwrite(s, 1, n, stderr);
+    if (FLG_cout) this->write_cout();
+    else fwrite(s, 1, n, stderr);
     if (global().log_file->open(NULL, fatal, t)) global().log_file->write(s, n, t);
 
     atomic_swap(&global().check_failed, true);
@@ -519,10 +1070,10 @@ inline void log2stderr(const char* s, size_t n) {
   #endif
 }
 
-// get day from xx_0808_15_30_08.123.log
+// get day from xx_0808_15_30_08.123.log or xx_0808_15_30_08.123.log.gz
 inline uint32 LogFile::day_in_path(const fastring& path) {
     uint32 x = 0;
-    const int n = LogTime::t_len + 4;
+    const int n = LogTime::t_len + 4 + (path.ends_with(".gz") ? 3 : 0);
     if (path.size() > n) god::byte_cp<4>(&x, path.data() + path.size() - n);
     return x;
 }
@@ -577,6 +1128,7 @@ bool LogFile::check_config(const char* topic, int level, LogTime* t) {
 }
 
 fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
+    this->close();
     if (!_checked) {
         this->check_config(topic, level, t);
         _checked = true;
@@ -596,7 +1148,7 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
 
     _path.clear();
     if (level != xx::fatal) {
-        _path.append(_path_base).append(".log");
+        _path.append(_path_base).append(log_ext());
 
         bool new_file = !fs::exists(_path);
         if (!new_file) {
@@ -605,7 +1157,9 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
                 if (fs::fsize(_path) >= FLG_max_log_file_size || (
                     FLG_log_daily && this->day_in_path(path) != _day)) {
                     fs::rename(_path, path); // rename xx.log to xx_0808_15_30_08.123.log
+                  #ifndef HAS_ZLIB
                     if (FLG_log_compress) this->compress_file(path);
+                  #endif
                     new_file = true;
                 }
             } else {
@@ -613,7 +1167,12 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
             }
         }
       
-        if (_file.open(_path.c_str(), 'a') && new_file) {
+      #ifndef _WIN32
+        const bool ok = FLG_log_mmap ? _mmap.open(_path.c_str()) : _file.open(_path.c_str(), 'a');
+      #else
+        const bool ok = _file.open(_path.c_str(), 'a');
+      #endif
+        if (ok && new_file) {
             char x[24] = { 0 }; // 0723 17:00:00.123
             memcpy(x, t->get(), LogTime::t_len);
             for (int i = 0; i < LogTime::t_len; ++i) {
@@ -621,11 +1180,13 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
             }
 
             s.clear();
-            s << _path_base << '_' << x << ".log";
+            s << _path_base << '_' << x << log_ext();
             _old_paths.push_back(s);
 
             while (!_old_paths.empty() && _old_paths.size() > FLG_max_log_file_num) {
+              #ifndef HAS_ZLIB
                 if (FLG_log_compress) _old_paths.front().append(".xz");
+              #endif
                 fs::remove(_old_paths.front());
                 _old_paths.pop_front();
             }
@@ -639,13 +1200,16 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
                 f.write(s);
             }
         }
+      #ifdef HAS_ZLIB
+        if (this->is_open() && FLG_log_compress) this->gz_begin();
+      #endif
 
     } else {
         _path.append(_path_base).append(".fatal");
         _file.open(_path.c_str(), 'a');
     }
 
-    if (!_file) {
+    if (!this->is_open()) {
         s.clear();
         s << "cann't open the file: " << _path << '\n';
         log2stderr(s.data(), s.size());
@@ -656,28 +1220,101 @@ fs::file& LogFile::open(const char* topic, int level, LogTime* t) {
 void LogFile::write(const char* p, size_t n, LogTime* t) {
     if (FLG_log_daily) {
         const uint32 day = t->day();
-        if (_day != day) { _day = day; _file.close(); }
+        if (_day != day) { _day = day; this->close(); }
     }
 
-    if (_file || this->open(NULL, 0, t)) {
-        _file.write(p, n);
-        const uint64 size = _file.size(); // -1 if not exists
-        if (size >= (uint64)FLG_max_log_file_size) _file.close();
+    if (!this->is_open()) this->open(NULL, 0, t);
+    if (this->is_open()) {
+        this->write(p, n);
+        const uint64 size = this->size(); // -1 if not exists
+        if (size >= (uint64)FLG_max_log_file_size) this->close();
     }
 }
 
 void LogFile::write(const char* topic, const char* p, size_t n, LogTime* t) {
     if (FLG_log_daily) {
         const uint32 day = t->day();
-        if (_day != day) { _day = day; _file.close(); }
+        if (_day != day) { _day = day; this->close(); }
+    }
+
+    if (!this->is_open()) this->open(topic, 0, t);
+    if (this->is_open()) {
+        this->write(p, n);
+        const uint64 size = this->size(); // -1 if not exists
+        if (size >= (uint64)FLG_max_log_file_size) this->close();
+    }
+}
+
+inline void LogFile::write(const char* p, size_t n) {
+  #ifdef HAS_ZLIB
+    if (_gz) return this->gz_write(p, n, Z_SYNC_FLUSH);
+  #endif
+    this->raw_write(p, n);
+}
+
+inline void LogFile::raw_write(const char* p, size_t n) {
+  #ifndef _WIN32
+    if (_mmap) return _mmap.write(p, n);
+  #endif
+    _file.write(p, n);
+}
+
+inline bool LogFile::is_open() const {
+  #ifndef _WIN32
+    if (_mmap) return true;
+  #endif
+    return (bool)_file;
+}
+
+inline uint64 LogFile::size() const {
+  #ifndef _WIN32
+    if (_mmap) return _mmap.size();
+  #endif
+    return _file.size();
+}
+
+void LogFile::close() {
+  #ifdef HAS_ZLIB
+    if (_gz) {
+        if (this->is_open()) this->gz_write(NULL, 0, Z_FINISH);
+        _gz = false;
     }
+  #endif
+  #ifndef _WIN32
+    _mmap.close();
+  #endif
+    _file.close();
+}
 
-    if (_file || this->open(topic, 0, t)) {
-        _file.write(p, n);
-        const uint64 size = _file.size(); // -1 if not exists
-        if (size >= (uint64)FLG_max_log_file_size) _file.close();
+#ifdef HAS_ZLIB
+void LogFile::gz_begin() {
+    if (!_zinit) {
+        int lv = FLG_log_compress_level;
+        if (lv < 1) lv = 1;
+        if (lv > 9) lv = 9;
+        // 15 + 16: max window size with a gzip header
+        if (deflateInit2(&_zs, lv, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+        _zbuf.reserve(32 * 1024);
+        _zinit = true;
+    } else {
+        deflateReset(&_zs);
     }
+    _gz = true;
+}
+
+void LogFile::gz_write(const char* p, size_t n, int flush) {
+    const uInt cap = (uInt)_zbuf.capacity();
+    _zs.next_in = (Bytef*)p;
+    _zs.avail_in = (uInt)n;
+    do {
+        _zs.next_out = (Bytef*)_zbuf.data();
+        _zs.avail_out = cap;
+        if (deflate(&_zs, flush) == Z_STREAM_ERROR) break;
+        const size_t m = cap - _zs.avail_out;
+        if (m > 0) this->raw_write(_zbuf.data(), m);
+    } while (_zs.avail_out == 0);
 }
+#endif
 
 FailureHandler::FailureHandler()
     : _stack_trace(log::stack_trace()) {
@@ -946,7 +1583,14 @@ FatalLogSaver::~FatalLogSaver() {
 }
 
 TLogSaver::TLogSaver(const char* file, int len, unsigned int line, const char* topic)
-    : _s(log_stream()), _topic(topic) {
+    : _s(log_stream()), _topic(topic), _t(0) {
+    _n = _s.size();
+    _s.resize(_n + (LogTime::t_len)); // make room for: "0523 17:00:00.123"
+    (_s << ' ' << co::thread_id() << ' ').append(file, len) << ':' << line << ']' << ' ';
+}
+
+TLogSaver::TLogSaver(const char* file, int len, unsigned int line, Topic& topic)
+    : _s(log_stream()), _topic(0), _t(&topic) {
     _n = _s.size();
     _s.resize(_n + (LogTime::t_len)); // make room for: "0523 17:00:00.123"
     (_s << ' ' << co::thread_id() << ' ').append(file, len) << ':' << line << ']' << ' ';
@@ -954,16 +1598,148 @@ TLogSaver::TLogSaver(const char* file, int len, unsigned int line, const char* t
 
 TLogSaver::~TLogSaver() {
     _s << '\n';
-    global().logger->push(_topic, (char*)_s.data() + _n, _s.size() - _n);
+    if (_t) {
+        global().logger->push(_t, (char*)_s.data() + _n, _s.size() - _n);
+    } else {
+        global().logger->push(_topic, (char*)_s.data() + _n, _s.size() - _n);
+    }
     _s.resize(_n);
 }
 
+uint32 LogEveryMs::allow(uint32 ms) {
+    const int64 now = now::ms();
+    const int64 x = atomic_load(&t, mo_relaxed);
+    if ((x == 0 || now - x >= ms) && atomic_bool_cas(&t, x, now, mo_relaxed, mo_relaxed)) {
+        return atomic_swap(&n, 0u, mo_relaxed) + 1;
+    }
+    atomic_inc(&n, mo_relaxed);
+    return 0;
+}
+
+uint32 LogRateLimiter::allow(uint32 rate) {
+    const int64 now = now::ms();
+    const int64 x = atomic_load(&t, mo_relaxed);
+    int64 d = x == 0 ? 1000 : now - x;
+    if (d > 0) {
+        // refill for the time elapsed, the bucket holds at most @rate tokens
+        if (d > 1000) d = 1000;
+        const int64 add = d * rate / 1000;
+        if (add > 0) {
+            const int64 nt = d == 1000 ? now : x + add * 1000 / rate;
+            if (atomic_bool_cas(&t, x, nt, mo_relaxed, mo_relaxed)) {
+                int32 v = atomic_load(&k, mo_relaxed);
+                for (;;) {
+                    const int32 w = (int32)(v + add > rate ? rate : v + add);
+                    const int32 o = atomic_compare_swap(&k, v, w, mo_relaxed, mo_relaxed);
+                    if (o == v) break;
+                    v = o;
+                }
+            }
+        }
+    }
+
+    // take a token
+    int32 v = atomic_load(&k, mo_relaxed);
+    while (v > 0) {
+        const int32 o = atomic_compare_swap(&k, v, v - 1, mo_relaxed, mo_relaxed);
+        if (o == v) return atomic_swap(&n, 0u, mo_relaxed) + 1;
+        v = o;
+    }
+    atomic_inc(&n, mo_relaxed);
+    return 0;
+}
+
+// write logs to the local file, for sinks running in the logging thread
+void write_local(const char* p, size_t n) {
+    global().log_file->write(p, n, global().log_time);
+}
+
+fastream& blog_stream() {
+    static __thread fastream* kbs = 0;
+    return kbs ? *kbs : *(kbs = new fastream(128));
+}
+
+void blog_push(BlogSite* site, const char* p, size_t n) {
+    global().logger->push_blog(site, p, n);
+}
+
+// format an argument encoded by blog_arg(), return NULL if it is truncated
+static const char* blog_arg_to_text(fastream& s, const char* p, const char* e) {
+    const char c = *p++;
+    switch (c) {
+      case 'b':
+      case 'c':
+        if (p >= e) return NULL;
+        c == 'b' ? (void)(s << (*p != 0)) : (void)s.append(*p);
+        return p + 1;
+      case 'i':
+      case 'u':
+      case 'd':
+      case 'p':
+        {
+            if (e - p < 8) return NULL;
+            uint64 v;
+            memcpy(&v, p, 8);
+            if (c == 'i') {
+                s << (int64)v;
+            } else if (c == 'u') {
+                s << v;
+            } else if (c == 'd') {
+                double d;
+                memcpy(&d, &v, 8);
+                s << d;
+            } else {
+                s << (const void*)(size_t)v;
+            }
+            return p + 8;
+        }
+      case 's':
+        {
+            uint32 n;
+            if (e - p < 4) return NULL;
+            memcpy(&n, p, 4);
+            p += 4;
+            if ((size_t)(e - p) < n) return NULL;
+            s.append(p, n);
+            return p + n;
+        }
+      default:
+        return NULL;
+    }
+}
+
+bool blog_format(
+    fastream& s, const BlogSite& site, uint32 tid, const char* time, const char* p, size_t n
+) {
+    const char* const e = p + n;
+    s.append("DIWE"[site.level & 3]).append(time, LogTime::t_len);
+    s << ' ' << tid << ' ' << site.file << ':' << site.line << ']' << ' ';
+    for (const char* f = site.fmt; *f; ++f) {
+        if (f[0] == '{' && f[1] == '}' && p < e) {
+            if (!(p = blog_arg_to_text(s, p, e))) { s << '\n'; return false; }
+            ++f;
+        } else {
+            s.append(*f);
+        }
+    }
+    s << '\n';
+    return true;
+}
+
 } // namespace xx
 
 void exit() {
     xx::global().logger->stop();
 }
 
+stats_t stats() {
+    return xx::global().logger->stats();
+}
+
+const co::Histogram& flush_histogram() {
+    return xx::global().logger->flush_histogram();
+}
+
 void set_write_cb(const std::function<void(const void*, size_t)>& cb, int flags) {
     xx::global().logger->set_write_cb(cb, flags);
 }
@@ -972,5 +1748,9 @@ void set_write_cb(const std::function<void(const char*, const void*, size_t)>& c
     xx::global().logger->set_write_cb(cb, flags);
 }
 
+void merge(const void* p, size_t n) {
+    if (n > 0) xx::global().logger->push_merged((const char*)p, n);
+}
+
 } // namespace log
 } // namespace ___
@@ -0,0 +1,150 @@
+#include "co/log.h"
+#include "co/co.h"
+#include "co/tcp.h"
+#include "co/time.h"
+#include "co/thread.h"
+#include "co/byte_order.h"
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+DEF_uint32(log_ship_queue_size, 32 << 20, ">>#0 max bytes of logs waiting to be shipped by log::ship()");
+DEF_uint32(log_ship_batch_size, 1 << 20, ">>#0 max bytes of logs sent in one batch by log::ship()");
+DEF_bool(log_ship_compress, false, ">>#0 compress logs shipped by log::ship() with zlib, if built with zlib");
+
+namespace ___ {
+namespace log {
+namespace xx {
+
+void write_local(const char* p, size_t n); // in log.cc
+
+class Shipper {
+  public:
+    Shipper(const char* ip, int port) : _bytes(0), _down(false), _cli(ip, port) {}
+    ~Shipper() = delete;
+
+    // called by the logging thread, return false if the queue is full, or
+    // the collector is not reachable
+    bool push(const void* p, size_t n);
+
+    // called by the logging thread, write logs in the queue to the local file
+    void spill();
+
+    // the coroutine sending logs to the collector
+    void loop();
+
+  private:
+    void take();
+    bool send();
+
+  private:
+    ::Mutex _mtx;
+    co::deque<fastring> _q;
+    size_t _bytes; // bytes in _q
+    bool _down;    // failed to connect the collector
+    co::Event _ev;
+    tcp::Client _cli;
+    fastream _buf; // the batch being sent, it is kept until it was sent
+    fastream _z;   // compressed batch with the header
+};
+
+bool Shipper::push(const void* p, size_t n) {
+    {
+        ::MutexGuard g(_mtx);
+        if (_down || _bytes + n > FLG_log_ship_queue_size) return false;
+        _q.push_back(fastring(p, n));
+        _bytes += n;
+    }
+    _ev.signal();
+    return true;
+}
+
+void Shipper::spill() {
+    co::deque<fastring> q;
+    {
+        ::MutexGuard g(_mtx);
+        if (!_down || _q.empty()) return;
+        q.swap(_q);
+        _bytes = 0;
+    }
+    for (auto& x : q) write_local(x.data(), x.size());
+}
+
+// move logs in the queue to the batch, up to log_ship_batch_size
+void Shipper::take() {
+    ::MutexGuard g(_mtx);
+    while (!_q.empty() && (_buf.empty() || _buf.size() + _q.front().size() <= FLG_log_ship_batch_size)) {
+        _buf.append(_q.front());
+        _bytes -= _q.front().size();
+        _q.pop_front();
+    }
+}
+
+bool Shipper::send() {
+    uint32 len = (uint32)_buf.size();
+    _z.clear();
+    _z.append(len); // make room for the header
+
+  #ifdef HAS_ZLIB
+    if (FLG_log_ship_compress) {
+        uLongf n = compressBound((uLong)_buf.size());
+        _z.reserve(n + 4);
+        if (compress2((Bytef*)_z.data() + 4, &n, (const Bytef*)_buf.data(), (uLong)_buf.size(), 1) == Z_OK) {
+            _z.resize(n + 4);
+            len = (uint32)n | 0x80000000u;
+        }
+    }
+  #endif
+    if (!(len & 0x80000000u)) _z.append(_buf);
+    len = hton32(len);
+    memcpy((char*)_z.data(), &len, 4);
+
+    const int r = _cli.send(_z.data(), (int)_z.size(), 8000);
+    return r == (int)_z.size();
+}
+
+void Shipper::loop() {
+    int backoff = 0; // in ms
+    for (;;) {
+        if (_buf.empty()) {
+            this->take();
+            if (_buf.empty()) { _ev.wait(1000); continue; }
+        }
+
+        if (!_cli.connected() && !_cli.connect(3000)) {
+            // wait 100ms, 200ms, ... up to 6.4s before the next try
+            backoff = backoff == 0 ? 100 : (backoff < 6400 ? backoff * 2 : backoff);
+            ELOG_EVERY_MS(60000) << "failed to connect the log collector: " << _cli.strerror();
+            if (!_down) { ::MutexGuard g(_mtx); _down = true; }
+            co::sleep(backoff);
+            continue;
+        }
+        if (_down) { ::MutexGuard g(_mtx); _down = false; }
+        backoff = 0;
+
+        if (this->send()) {
+            _buf.clear();
+        } else {
+            _cli.disconnect();
+        }
+    }
+}
+
+} // xx
+
+void ship(const char* ip, int port, int flags) {
+    auto s = co::static_new<xx::Shipper>(ip, port);
+    go(&xx::Shipper::loop, s);
+
+    const bool local = (flags & log2local) != 0;
+    set_write_cb([s, local](const void* p, size_t n) {
+        if (!s->push(p, n) && !local) {
+            s->spill();
+            xx::write_local((const char*)p, n);
+        }
+    }, flags);
+}
+
+} // log
+} // ___
@@ -20,6 +20,8 @@ StackTrace* stack_trace() { return 0; }
 #include "co/os.h"
 #include "co/mem.h"
 #include "co/fastream.h"
+#include "co/stl.h"
+#include "co/thread.h"
 #include "../co/hook.h"
 #include <string.h>
 #include <stdio.h>
@@ -48,6 +50,10 @@ class StackTraceImpl : public StackTrace {
         memset((char*)_fs.data(), 0, _fs.capacity());
         (void) _exe.c_str();
         if (__sys_api(write) == 0) { auto r = ::write(-1, 0, 0); (void)r; }
+        // create the state and load the unwinder now, get_pcs() may be called
+        // in signal handlers and must not allocate
+        void* pcs[4];
+        (void) this->get_pcs(pcs, 4, 0);
     }
 
     virtual ~StackTraceImpl() {
@@ -56,6 +62,15 @@ class StackTraceImpl : public StackTrace {
 
     virtual void dump_stack(void* f, int skip);
 
+    virtual void get_stack(void* s, int skip);
+
+    virtual int get_pcs(void** pcs, int n, int skip);
+
+    virtual void symbolize(void* pc, void* s);
+
+    // the state is created once, and it can be shared by threads
+    struct backtrace_state* state();
+
     char* demangle(const char* name);
 
     char* buf() const { return _buf; }
@@ -72,6 +87,8 @@ class StackTraceImpl : public StackTrace {
     char* _buf;   // for demangle
     fastream _fs; // for stack trace
     fastring _exe;
+    ::Mutex _mtx; // for _syms
+    co::hash_map<void*, fastring> _syms; // symbols of pcs by symbolize()
 };
 
 StackTrace* stack_trace() {
@@ -102,6 +119,11 @@ struct user_data_t {
     int count;
 };
 
+struct stream_data_t {
+    fastream* s;
+    int count;
+};
+
 void error_cb(void* data, const char* msg, int errnum) {
     write_to_stderr(msg, strlen(msg));
     write_to_stderr("\n", 1);
@@ -128,6 +150,102 @@ int backtrace_cb(void* data, uintptr_t pc, const char* filename, int lineno, con
     return 0;
 }
 
+// the output buffer and the demangle buffer of StackTraceImpl are not used
+// here, so that it can be called in multiple threads at the same time.
+int stream_cb(void* data, uintptr_t pc, const char* filename, int lineno, const char* function) {
+    struct stream_data_t* sd = (struct stream_data_t*) data;
+    if (!filename && !function) return 0;
+
+    char* p = NULL;
+#ifdef HAS_CXXABI_H
+    if (function) {
+        int status = 0;
+        p = abi::__cxa_demangle(function, NULL, NULL, &status);
+        if (p) function = p;
+    }
+#endif
+
+    *sd->s << '#' << (sd->count++) << "  in " << (function ? function : "???") << " at " 
+           << (filename ? filename : "???") << ':' << lineno << '\n';
+    if (p) ::free(p);
+    return 0;
+}
+
+void silent_error_cb(void*, const char*, int) {}
+
+struct backtrace_state* StackTraceImpl::state() {
+    static struct backtrace_state* x = backtrace_create_state(
+        _exe.c_str(), 1, silent_error_cb, NULL
+    );
+    return x;
+}
+
+void StackTraceImpl::get_stack(void* s, int skip) {
+    struct stream_data_t sd = { (fastream*)s, 0 };
+    backtrace_full(this->state(), skip, stream_cb, silent_error_cb, (void*)&sd);
+}
+
+struct pcs_data_t {
+    void** pcs;
+    int n;
+    int count;
+};
+
+int pcs_cb(void* data, uintptr_t pc) {
+    struct pcs_data_t* pd = (struct pcs_data_t*) data;
+    if (pd->count >= pd->n || pc == (uintptr_t)-1) return 1;
+    pd->pcs[pd->count++] = (void*)pc;
+    return 0;
+}
+
+int StackTraceImpl::get_pcs(void** pcs, int n, int skip) {
+    struct pcs_data_t pd = { pcs, n, 0 };
+    backtrace_simple(this->state(), skip + 1, pcs_cb, silent_error_cb, (void*)&pd);
+    return pd.count;
+}
+
+// only the innermost function of inlined calls is appended
+int symbolize_cb(void* data, uintptr_t pc, const char* filename, int lineno, const char* function) {
+    struct stream_data_t* sd = (struct stream_data_t*) data;
+    if (!filename && !function) return 0;
+
+    char* p = NULL;
+#ifdef HAS_CXXABI_H
+    if (function) {
+        int status = 0;
+        p = abi::__cxa_demangle(function, NULL, NULL, &status);
+        if (p) function = p;
+    }
+#endif
+
+    *sd->s << (function ? function : "???") << " at " << (filename ? filename : "???") << ':' << lineno;
+    if (p) ::free(p);
+    ++sd->count;
+    return 1;
+}
+
+// DWARF is parsed once by libbacktrace, but resolving a pc still walks its
+// tables and demangles the name, so results are cached. The cache is cleared
+// when it is full, pcs of profiles are usually far fewer.
+void StackTraceImpl::symbolize(void* pc, void* s) {
+    fastream& out = *(fastream*)s;
+    {
+        ::MutexGuard g(_mtx);
+        auto it = _syms.find(pc);
+        if (it != _syms.end()) { out << it->second; return; }
+    }
+
+    fastream x(128);
+    struct stream_data_t sd = { &x, 0 };
+    backtrace_pcinfo(this->state(), (uintptr_t)pc, symbolize_cb, silent_error_cb, (void*)&sd);
+    if (sd.count == 0) x << pc;
+    out << x;
+
+    ::MutexGuard g(_mtx);
+    if (_syms.size() >= 65536) _syms.clear();
+    _syms.emplace(pc, x.str());
+}
+
 void StackTraceImpl::dump_stack(void* f, int skip) {
     _f = (fs::file*) f;
     struct user_data_t ud = { this, 0 };
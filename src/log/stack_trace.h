@@ -1,5 +1,7 @@
 #pragma once
 
+#include "co/fastream.h"
+
 namespace ___ {
 namespace log {
 
@@ -11,6 +13,34 @@ class StackTrace {
      */
     virtual void dump_stack(void* f, int skip) = 0;
 
+    /**
+     * append stack of the current thread to a stream, it is thread-safe.
+     * 
+     * @param s     a pointer to fastream
+     * @param skip  number of frames to skip
+     */
+    virtual void get_stack(void* s, int skip) = 0;
+
+    /**
+     * get program counters of the current stack, it is thread-safe, and much 
+     * cheaper than get_stack() as no symbol is resolved. Nothing is allocated
+     * once stack_trace() was created, so it can be called by profilers in
+     * signal handlers, with symbolize() deferred to report time.
+     * 
+     * @return  number of pcs stored in @pcs, 0 if it is not supported.
+     */
+    virtual int get_pcs(void** pcs, int n, int skip) { return 0; }
+
+    /**
+     * append function, file and line of @pc to a stream without a newline, 
+     * it is thread-safe. Results are cached, so symbolizing the same pcs of
+     * hot stacks again is a lookup. The pc itself is appended if symbols are
+     * not supported.
+     * 
+     * @param s  a pointer to fastream
+     */
+    virtual void symbolize(void* pc, void* s) { *(fastream*)s << pc; }
+
   protected:
     StackTrace() = default;
     virtual ~StackTrace() = default;
@@ -4,6 +4,8 @@
 #include "StackWalker.hpp"
 #include "co/fs.h"
 #include "co/mem.h"
+#include "co/fastream.h"
+#include "co/thread.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -19,7 +21,7 @@ class StackTraceImpl : public StackTrace, StackWalker {
         StackWalker::RetrieveLine |
         StackWalker::RetrieveModuleInfo;
 
-    StackTraceImpl() : StackTrace(), StackWalker(kOptions), _f(0), _skip(0) {}
+    StackTraceImpl() : StackTrace(), StackWalker(kOptions), _f(0), _s(0), _skip(0) {}
 
     virtual ~StackTraceImpl() = default;
 
@@ -29,10 +31,23 @@ class StackTraceImpl : public StackTrace, StackWalker {
         this->ShowCallstack(GetCurrentThread());
     }
 
+    virtual void get_stack(void* s, int skip) {
+        ::MutexGuard g(_mtx);
+        _s = (fastream*) s;
+        _skip = skip;
+        this->ShowCallstack(GetCurrentThread());
+        _s = 0;
+    }
+
+    virtual int get_pcs(void** pcs, int n, int skip) {
+        return (int) CaptureStackBackTrace((DWORD)(skip + 1), (DWORD)n, pcs, NULL);
+    }
+
   private:
     virtual void OnOutput(LPCSTR s) {
         if (_skip > 0) { --_skip; return; }
         const size_t n = strlen(s);
+        if (_s) { _s->append(s, n); return; }
         if (_f && *_f) _f->write(s, n);
         auto r = ::fwrite(s, 1, n, stderr); (void)r;
     }
@@ -43,6 +58,8 @@ class StackTraceImpl : public StackTrace, StackWalker {
 
   private:
     fs::file* _f; // file
+    fastream* _s; // for get_stack()
+    ::Mutex _mtx;
     int _skip;
 };
 
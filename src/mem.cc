@@ -1,8 +1,16 @@
 #include "co/mem.h"
 #include "co/atomic.h"
 #include "co/god.h"
+#include "co/flag.h"
 #include "co/log.h"
+#include "co/fastring.h"
+#include "co/fastream.h"
+#include "log/stack_trace.h"
 #include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdio.h>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -34,6 +42,46 @@ inline void _vm_free(void* p, size_t n) {
     VirtualFree(p, 0, MEM_RELEASE);
 }
 
+// reserve and commit @n bytes
+inline void* _vm_alloc(size_t n) {
+    return VirtualAlloc(NULL, n, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+// reserve more address space than @n bytes, and commit @n bytes of it, so 
+// that the block can grow in place by _vm_realloc()
+inline void* _vm_alloc_growable(size_t n) {
+  #if __arch64
+    void* p = VirtualAlloc(NULL, n << 2, MEM_RESERVE, PAGE_READWRITE);
+    if (p) {
+        if (VirtualAlloc(p, n, MEM_COMMIT, PAGE_READWRITE)) return p;
+        VirtualFree(p, 0, MEM_RELEASE);
+    }
+  #endif
+    return _vm_alloc(n);
+}
+
+// commit more of the reservation if there is enough, or move to a new one
+inline void* _vm_realloc(void* p, size_t o, size_t n) {
+    const size_t k = god::align_up<4096>(o);
+    if (n <= k) return p;
+
+    MEMORY_BASIC_INFORMATION m;
+    if (VirtualQuery((char*)p + k, &m, sizeof(m)) == sizeof(m) &&
+        m.State == MEM_RESERVE && m.AllocationBase == p && k + m.RegionSize >= n) {
+        if (VirtualAlloc((char*)p + k, n - k, MEM_COMMIT, PAGE_READWRITE)) return p;
+    }
+
+    void* x = _vm_alloc_growable(n);
+    if (x) { memcpy(x, p, o); _vm_free(p, o); }
+    return x;
+}
+
+// Large pages on windows must be committed when they are reserved, and the
+// process needs SeLockMemoryPrivilege, which does not fit the allocator.
+inline bool _vm_huge_page(void*, size_t) {
+    return false;
+}
+
 #if __arch64
 inline int _find_msb(size_t x) { /* x != 0 */
     unsigned long i;
@@ -96,6 +144,39 @@ inline void _vm_free(void* p, size_t n) {
     ::munmap(p, n);
 }
 
+// reserve and commit @n bytes
+inline void* _vm_alloc(size_t n) {
+    void* p = ::mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p != MAP_FAILED ? p : NULL;
+}
+
+// the block grows by mremap() on linux, no reservation is needed
+inline void* _vm_alloc_growable(size_t n) {
+    return _vm_alloc(n);
+}
+
+inline void* _vm_realloc(void* p, size_t o, size_t n) {
+  #ifdef __linux__
+    void* x = ::mremap(p, o, n, MREMAP_MAYMOVE);
+    return x != MAP_FAILED ? x : NULL;
+  #else
+    void* x = _vm_alloc(n);
+    if (x) { memcpy(x, p, o < n ? o : n); _vm_free(p, o); }
+    return x;
+  #endif
+}
+
+// advise the kernel to back the memory with transparent huge pages, @p MUST
+// be aligned to the huge page size.
+inline bool _vm_huge_page(void* p, size_t n) {
+  #ifdef MADV_HUGEPAGE
+    return ::madvise(p, n, MADV_HUGEPAGE) == 0;
+  #else
+    (void)p; (void)n;
+    return false;
+  #endif
+}
+
 #if __arch64
 inline int _find_msb(size_t x) { /* x != 0 */
     return 63 - __builtin_clzll(x);
@@ -122,6 +203,9 @@ inline uint32 _pow2_align(uint32 n) {
 #endif
 
 
+DEF_bool(mem_huge_page, false, ">>#0 if true, advise the kernel to back 2M blocks of co::alloc() with transparent huge pages, linux only");
+DEF_uint32(mem_profile_rate, 0, ">>#0 if > 0, sample a stack about every this many bytes allocated by co::alloc(), see co::heap_profile()");
+
 namespace co {
 namespace xx {
 
@@ -168,6 +252,18 @@ static const uint32 g_sb_bits = 15;            // bit size of small block
 static const uint32 g_lb_bits = g_sb_bits + B; // bit size of large block
 static const uint32 g_hb_bits = g_lb_bits + B; // bit size of huge block
 static const size_t g_max_alloc_size = 1u << 17; // 128k
+static const size_t g_max_span_size = 1u << 25;  // 32M
+
+// size class of spans, 4 classes in each power of 2, 160K, 192K, 224K, 256K,
+// 320K, ... 32M. @n MUST be in (128K, 32M].
+inline uint32 _span_class(size_t n) {
+    const int m = _find_msb(n - 1);
+    return (uint32)(((m - 17) << 2) + ((n - 1) >> (m - 2)) - 4);
+}
+
+inline size_t _span_size(uint32 c) {
+    return ((size_t)(c & 3) + 5) << ((c >> 2) + 15);
+}
 
 class Bitset {
   public:
@@ -225,29 +321,54 @@ class GlobalAlloc;
 // thread-local allocator
 class ThreadAlloc;
 
+#ifdef CO_OVERRIDE_MALLOC
+#ifdef CO_USE_SYS_MALLOC
+#error "CO_OVERRIDE_MALLOC can't be used with CO_USE_SYS_MALLOC"
+#endif
+// malloc() may be called to allocate TLS blocks in the global-dynamic model
+__thread ThreadAlloc* g_thread_alloc __attribute__((tls_model("initial-exec"))) = NULL;
+#else
 __thread ThreadAlloc* g_thread_alloc = NULL;
+#endif
+
+// all the thread allocators, they are never freed
+ThreadAlloc* g_thread_allocs = NULL;
 
 class HugeBlock {
   public:
-    explicit HugeBlock(void* p) : _p((char*)p), _bits(0) {
+    explicit HugeBlock(void* p) : _p((char*)p), _bits(0), _hbits(0) {
         (void)_next; (void)_prev;
     }
 
     void* alloc(); // alloc a sub block
     bool free(void* p);
 
+    // mark the sub block @p as backed by huge pages
+    void set_huge(void* p) {
+        atomic_or(&_hbits, C << this->index(p), mo_relaxed);
+    }
+
+    // clear the mark, return true if it was set
+    bool unset_huge(void* p) {
+        const size_t x = C << this->index(p);
+        return atomic_and(&_hbits, ~x, mo_relaxed) & x;
+    }
+
   private:
+    uint32 index(void* p) const { return (uint32)(((char*)p - _p) >> g_lb_bits); }
+
     HugeBlock* _next;
     HugeBlock* _prev;
     char* _p; // beginning address to alloc
     size_t _bits;
+    size_t _hbits; // sub blocks backed by huge pages
     DISALLOW_COPY_AND_ASSIGN(HugeBlock);
 };
 
 class LargeBlock {
   public:
     explicit LargeBlock(HugeBlock* parent)
-        : _parent(parent), _p((char*)this + (1u << g_sb_bits)), _bits(0) {
+        : _parent(parent), _p((char*)this + (1u << g_sb_bits)), _bits(0), _dbits(0), _fbits(0) {
         (void)_next; (void)_prev;
     }
 
@@ -256,23 +377,35 @@ class LargeBlock {
     SmallAlloc* make_small_alloc();
     HugeBlock* parent() const { return _parent; }
 
+    // bytes of sub blocks free since the last trim()
+    size_t idle_bytes() const;
+
+    // decommit sub blocks free since the last trim() if @decommit is true,
+    // return bytes decommitted.
+    size_t trim(bool decommit);
+
+    // bytes of sub blocks decommitted
+    size_t decommitted() const;
+
   private:
     LargeBlock* _next;
     LargeBlock* _prev;
     HugeBlock* _parent;
     char* _p; // beginning address to alloc
     size_t _bits;
+    size_t _dbits; // decommitted sub blocks
+    size_t _fbits; // free sub blocks at the last trim()
     DISALLOW_COPY_AND_ASSIGN(LargeBlock);
 };
 
 class LargeAlloc {
   public:
     static const uint32 BS_BITS = 1u << (g_lb_bits - 12);
-    static const uint32 LA_SIZE = 64;
+    static const uint32 LA_SIZE = 128;
     static const uint32 MAX_bIT = BS_BITS - 1;
 
     explicit LargeAlloc(HugeBlock* parent)
-        : _parent(parent), _ta(g_thread_alloc), _cur_bit(0) {
+        : _parent(parent), _ta(g_thread_alloc), _cur_bit(0), _cbit(MAX_bIT), _hbit(0) {
         static_assert(sizeof(*this) <= LA_SIZE, "");
         _p = (char*)this + 4096;
         _pbs = (char*)this + LA_SIZE;
@@ -290,7 +423,24 @@ class LargeAlloc {
     HugeBlock* parent() const { return _parent; }
     ThreadAlloc* thread_alloc() const { return _ta; }
 
+    // bytes of pages not used since the last trim()
+    size_t idle_bytes() const {
+        const uint32 x = _cur_bit > _hbit ? _cur_bit : _hbit;
+        return x < _cbit ? ((size_t)(_cbit - x) << 12) : 0;
+    }
+
+    // decommit pages not used since the last trim() if @decommit is true,
+    // return bytes decommitted.
+    size_t trim(bool decommit);
+
+    // bytes of pages decommitted
+    size_t decommitted() const { return (size_t)(MAX_bIT - _cbit) << 12; }
+
   private:
+    // alloc n units from _cur_bit, pages after _cbit are committed if necessary
+    void* bump(uint32 n);
+    void commit(uint32 e);
+
     LargeAlloc* _next;
     LargeAlloc* _prev;
     HugeBlock* _parent;
@@ -305,6 +455,8 @@ class LargeAlloc {
         char* _xpbs;
     };
     uint32 _cur_bit;
+    uint32 _cbit; // pages before _cbit are committed
+    uint32 _hbit; // max _cur_bit since the last trim()
     DISALLOW_COPY_AND_ASSIGN(LargeAlloc);
 };
 
@@ -359,45 +511,249 @@ class GlobalAlloc {
         HugeBlock* hb;
     };
 
+    GlobalAlloc() : _reserved(0), _committed(0), _huge(0) {}
+
     void* alloc(uint32 alloc_id, HugeBlock** parent);
     LargeBlock* make_large_block(uint32 alloc_id);
     LargeAlloc* make_large_alloc(uint32 alloc_id);
     void free(void* p, HugeBlock* hb, uint32 alloc_id);
 
+    size_t reserved() const { return atomic_load(&_reserved, mo_relaxed); }
+    size_t committed() const { return atomic_load(&_committed, mo_relaxed); }
+    size_t huge() const { return atomic_load(&_huge, mo_relaxed); }
+
+    // pages committed or decommitted by the thread allocators
+    void add_committed(size_t n) { atomic_add(&_committed, n, mo_relaxed); }
+    void sub_committed(size_t n) { atomic_sub(&_committed, n, mo_relaxed); }
+
   private:
     _X _x[g_array_size];
+    size_t _reserved;  // bytes of huge blocks
+    size_t _committed; // bytes of large blocks
+    size_t _huge;      // number of large blocks backed by huge pages
+};
+
+// free spans cached by a thread, for blocks in (128K, 32M].
+//   - Each span is mapped from the OS directly, they are not bound to any 
+//     thread, and a span freed in a thread is cached in that thread. 
+//   - At most 4 spans of each class, and no more than 64M in total, are cached.
+class SpanCache {
+  public:
+    static const uint32 N = 32;
+    static const uint32 M = 4;
+    static const size_t S = (size_t)64 << 20;
+
+    SpanCache() : _bytes(0) {
+        memset(_h, 0, sizeof(_h));
+        memset(_n, 0, sizeof(_n));
+        memset(_lo, 0, sizeof(_lo));
+    }
+
+    void* alloc(uint32 c);
+    void free(void* p, uint32 c);
+
+    // bytes of spans not used since the last trim()
+    size_t idle_bytes() const;
+
+    // release spans not used since the last trim() while @idle > @keep,
+    // return bytes released.
+    size_t trim(size_t& idle, size_t keep);
+
+  private:
+    struct _S { _S* next; };
+    _S* _h[N];
+    uint32 _n[N];
+    uint32 _lo[N]; // min _n[] since the last trim()
+    size_t _bytes;
+};
+
+// sampling heap profiler of co::alloc()
+//   - A thread samples an allocation after about mem_profile_rate bytes were
+//     allocated since its last sample. The stack is recorded, and the block is
+//     tracked until it is freed.
+//   - A counting filter of sampled addresses is checked on free, the lock is
+//     taken only if the block may be sampled.
+//   - Containers here use the system allocator, so that they never reenter
+//     co::alloc().
+class HeapProfiler {
+  public:
+    static const int D = 32;          // max depth of stacks
+    static const uint32 F = 1u << 14; // size of the filter
+
+    struct Stack {
+        void* pcs[D];
+        int depth;
+        bool operator==(const Stack& x) const {
+            return depth == x.depth && memcmp(pcs, x.pcs, sizeof(void*) * depth) == 0;
+        }
+    };
+
+    struct StackHash {
+        size_t operator()(const Stack& s) const {
+            size_t h = (size_t)s.depth;
+            for (int i = 0; i < s.depth; ++i) h = h * 31 + (size_t)s.pcs[i];
+            return h;
+        }
+    };
+
+    // counters of sampled blocks of a stack, est_* are bytes estimated from the samples
+    struct Bucket {
+        uint64 allocs;
+        uint64 alloc_bytes;
+        uint64 frees;
+        uint64 free_bytes;
+        uint64 est_alloc_bytes;
+        uint64 est_free_bytes;
+    };
+
+    HeapProfiler() : _sampled(false) { memset(_filter, 0, sizeof(_filter)); }
+
+    // record a sampled block @p of @n bytes, @w is the estimated bytes it stands for
+    void add(void* p, size_t n, size_t w, int skip);
+
+    // called on free if the block may be sampled
+    void del(void* p);
+
+    bool maybe_sampled(void* p) const {
+        return atomic_load(&_sampled, mo_relaxed) && atomic_load(&_filter[_slot(p)], mo_relaxed) != 0;
+    }
+
+    void snapshot(std::vector<std::pair<Stack, Bucket>>& v);
+
+  private:
+    struct Sample {
+        Bucket* b;
+        size_t n;
+        size_t w;
+    };
+
+    static uint32 _slot(void* p) {
+        return (uint32)(((uint64)(size_t)p * 11400714819323198485ull) >> 50);
+    }
+
+    std::mutex _mtx;
+    std::unordered_map<Stack, Bucket, StackHash> _buckets;
+    std::unordered_map<void*, Sample> _samples;
+    bool _sampled;
+    uint32 _filter[F];
 };
 
 class ThreadAlloc {
   public:
     ThreadAlloc()
-        : _lb(0), _la(0), _sa(0) {
+        : _lb(0), _la(0), _sa(0), _sample_left(0), _sampling(false) {
         static uint32 g_alloc_id = (uint32)-1;
         _id = atomic_inc(&g_alloc_id, mo_relaxed);
+        _seed = _id * 2654435761u + 1;
+        memset(&_stats, 0, sizeof(_stats));
+        _next = atomic_load(&g_thread_allocs, mo_relaxed);
+        for (;;) {
+            auto x = atomic_cas(&g_thread_allocs, _next, this, mo_release, mo_relaxed);
+            if (x == _next) break;
+            _next = x;
+        }
     }
 
     uint32 id() const { return _id; }
-    void* static_alloc(size_t n) { return _ka.alloc(n); }
     void* alloc(size_t n);
     void free(void* p, size_t n);
     void* realloc(void* p, size_t o, size_t n);
 
+    void* static_alloc(size_t n) {
+        _stats.static_bytes += god::align_up<8>(n);
+        return _ka.alloc(n);
+    }
+
+    // add statistics of this thread to @x, it is safe to call from any thread.
+    void add_stats(mem_stats_t& x) const;
+
+    // decommit memory not used since the last trim(), see co::mem_trim()
+    size_t trim(size_t keep);
+    ThreadAlloc* next() const { return _next; }
+
+    // pause the heap profiler in this thread if @x is true, return the old state.
+    // It is paused while the profiler is locked, as its containers may use 
+    // co::alloc() if malloc() was replaced.
+    bool pause_sampling(bool x) { const bool r = _sampling; _sampling = x; return r; }
+
   private:
+    // Counters are updated by the owner thread without any lock or atomic 
+    // operation, and read by other threads with relaxed atomic loads.
+    void on_alloc(void* p, size_t n) {
+        ++_stats.allocs;
+        this->add_bytes(n, 1);
+        if (unlikely((_sample_left -= (int64)n) < 0)) this->sample(p, n);
+    }
+
+    void on_free(void* p, size_t n) {
+        ++_stats.frees;
+        this->add_bytes(n, -1);
+        this->unsample(p);
+    }
+
+    // see HeapProfiler
+    void sample(void* p, size_t n);
+    void unsample(void* p);
+
+    // memory of @o bytes was resized to @n bytes in place
+    void on_resize(size_t o, size_t n) {
+        this->add_bytes(o, -1);
+        this->add_bytes(n, 1);
+    }
+
+    // memory of @o bytes at @p was remapped to @n bytes at @x
+    void on_vm_resize(void* p, void* x, size_t o, size_t n) {
+        this->on_resize(o, n);
+        if (x != p) this->unsample(p);
+    }
+
+    void add_bytes(size_t n, int64 sign) {
+        _stats.bytes += sign * (int64)n;
+        if (n <= 2048) {
+            _stats.small_bytes += sign * (n > 16 ? god::align_up<16>((int64)n) : 16);
+        } else if (n <= g_max_alloc_size) {
+            _stats.large_bytes += sign * god::align_up<4096>((int64)n);
+        } else if (n <= g_max_span_size) {
+            _stats.span_bytes += sign * (int64)_span_size(_span_class(n));
+        } else {
+            _stats.sys_bytes += sign * (int64)n;
+        }
+    }
+
     LargeBlock* _lb;
     LargeAlloc* _la;
     SmallAlloc* _sa;
     uint32 _id;
     StaticAllocator _ka;
+    SpanCache _spans;
+    mem_stats_t _stats;
+    int64 _sample_left; // bytes to allocate before the next sample
+    uint32 _seed;
+    bool _sampling;
+    ThreadAlloc* _next;
 };
 
 
+// objects of the allocator itself are mapped from the OS, as malloc() may be
+// replaced by co::alloc(), see CO_OVERRIDE_MALLOC.
+template <typename T>
+inline T* _vm_new() {
+    void* p = _vm_alloc(god::align_up<4096>(sizeof(T))); assert(p);
+    return new (p) T();
+}
+
 inline GlobalAlloc* galloc() {
-    static GlobalAlloc* ga = new GlobalAlloc();
+    static GlobalAlloc* ga = _vm_new<GlobalAlloc>();
     return ga;
 }
 
+inline HeapProfiler* heap_profiler() {
+    static HeapProfiler* hp = _vm_new<HeapProfiler>();
+    return hp;
+}
+
 inline ThreadAlloc* thread_alloc() {
-    return g_thread_alloc ? g_thread_alloc : (g_thread_alloc = new ThreadAlloc());
+    return g_thread_alloc ? g_thread_alloc : (g_thread_alloc = _vm_new<ThreadAlloc>());
 }
 
 
@@ -507,6 +863,7 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
         {
             auto hb = make_huge_block();
             if (hb) {
+                atomic_add(&_reserved, (size_t)1 << g_hb_bits, mo_relaxed);
                 list_push_front((list_t&)x.hb, (DoubleLink*)hb);
                 p = hb->alloc();
                 *parent = hb;
@@ -515,7 +872,17 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
     } while (0);
 
   end:
-    if (p) _vm_commit(p, 1u << g_lb_bits);
+    if (p) {
+        _vm_commit(p, 1u << g_lb_bits);
+        atomic_add(&_committed, (size_t)1 << g_lb_bits, mo_relaxed);
+      #if __arch64
+        // large blocks are 2M aligned on arch64, the size of a huge page
+        if (FLG_mem_huge_page && _vm_huge_page(p, 1u << g_lb_bits)) {
+            (*parent)->set_huge(p);
+            atomic_inc(&_huge, mo_relaxed);
+        }
+      #endif
+    }
     return p;
 }
 
@@ -533,6 +900,8 @@ inline LargeAlloc* GlobalAlloc::make_large_alloc(uint32 alloc_id) {
 
 inline void GlobalAlloc::free(void* p, HugeBlock* hb, uint32 alloc_id) {
     _vm_decommit(p, 1u << g_lb_bits);
+    atomic_sub(&_committed, (size_t)1 << g_lb_bits, mo_relaxed);
+    if (hb->unset_huge(p)) atomic_dec(&_huge, mo_relaxed);
     auto& x = _x[alloc_id & (g_array_size - 1)];
     bool r;
     {
@@ -540,7 +909,10 @@ inline void GlobalAlloc::free(void* p, HugeBlock* hb, uint32 alloc_id) {
         r = hb->free(p) && hb != x.hb;
         if (r) list_erase((list_t&)x.hb, (DoubleLink*)hb);
     }
-    if (r) _vm_free(hb, 1u << g_hb_bits);
+    if (r) {
+        _vm_free(hb, 1u << g_hb_bits);
+        atomic_sub(&_reserved, (size_t)1 << g_hb_bits, mo_relaxed);
+    }
 }
 
 
@@ -550,6 +922,11 @@ inline void* LargeBlock::alloc() {
     if (i < R) {
         _bits |= (C << i);
         p = _p + (((size_t)i) << g_sb_bits);
+        if (unlikely(_dbits & (C << i))) {
+            _dbits &= ~(C << i);
+            _vm_commit(p, 1u << g_sb_bits);
+            galloc()->add_committed(1u << g_sb_bits);
+        }
     }
     return p;
 }
@@ -564,6 +941,36 @@ inline SmallAlloc* LargeBlock::make_small_alloc() {
     return x ? new (x) SmallAlloc(this) : NULL;
 }
 
+inline uint32 _bit_count(size_t x) {
+    uint32 n = 0;
+    for (; x; x &= x - 1) ++n;
+    return n;
+}
+
+inline size_t LargeBlock::idle_bytes() const {
+    const size_t x = ~_bits & _fbits & ~_dbits & ((C << R) - 1);
+    return (size_t)_bit_count(x) << g_sb_bits;
+}
+
+size_t LargeBlock::trim(bool decommit) {
+    size_t n = 0;
+    if (decommit) {
+        size_t x = ~_bits & _fbits & ~_dbits & ((C << R) - 1);
+        _dbits |= x;
+        for (; x; x &= x - 1) {
+            _vm_decommit(_p + ((size_t)_find_lsb(x) << g_sb_bits), 1u << g_sb_bits);
+            n += (1u << g_sb_bits);
+        }
+        if (n > 0) galloc()->sub_committed(n);
+    }
+    _fbits = ~_bits;
+    return n;
+}
+
+inline size_t LargeBlock::decommitted() const {
+    return (size_t)_bit_count(_dbits) << g_sb_bits;
+}
+
 
 void* LargeAlloc::try_hard_alloc(uint32 n) {
     size_t* const p = (size_t*)_pbs;
@@ -583,19 +990,43 @@ void* LargeAlloc::try_hard_alloc(uint32 n) {
         }
     }
 
-    if (_cur_bit + n <= MAX_bIT) {
-        _bs.set(_cur_bit);
-        return _p + (god::fetch_add(&_cur_bit, n) << 12);
-    }
-    return NULL;
+    return _cur_bit + n <= MAX_bIT ? this->bump(n) : NULL;
+}
+
+void LargeAlloc::commit(uint32 e) {
+    // commit at least 16 pages at a time
+    if (e < _cbit + 16) e = _cbit + 16 < MAX_bIT ? _cbit + 16 : MAX_bIT;
+    const size_t n = (size_t)(e - _cbit) << 12;
+    _vm_commit(_p + ((size_t)_cbit << 12), n);
+    galloc()->add_committed(n);
+    _cbit = e;
+}
+
+inline void* LargeAlloc::bump(uint32 n) {
+    const uint32 e = _cur_bit + n;
+    if (unlikely(e > _cbit)) this->commit(e);
+    if (_hbit < e) _hbit = e;
+    _bs.set(_cur_bit);
+    return _p + (god::fetch_add(&_cur_bit, n) << 12);
 }
 
 inline void* LargeAlloc::alloc(uint32 n) {
-    if (_cur_bit + n <= MAX_bIT) {
-        _bs.set(_cur_bit);
-        return _p + (god::fetch_add(&_cur_bit, n) << 12);
+    return _cur_bit + n <= MAX_bIT ? this->bump(n) : NULL;
+}
+
+size_t LargeAlloc::trim(bool decommit) {
+    size_t n = 0;
+    if (decommit) {
+        const uint32 x = _cur_bit > _hbit ? _cur_bit : _hbit;
+        if (x < _cbit) {
+            n = (size_t)(_cbit - x) << 12;
+            _vm_decommit(_p + ((size_t)x << 12), n);
+            galloc()->sub_committed(n);
+            _cbit = x;
+        }
     }
-    return NULL;
+    _hbit = _cur_bit;
+    return n;
 }
 
 inline bool LargeAlloc::free(void* p) {
@@ -614,6 +1045,8 @@ inline void LargeAlloc::xfree(void* p) {
 inline void* LargeAlloc::realloc(void* p, uint32 o, uint32 n) {
     uint32 i = (uint32)(((char*)p - _p) >> 12);
     if (_cur_bit == i + o && i + n <= MAX_bIT) {
+        if (unlikely(i + n > _cbit)) this->commit(i + n);
+        if (_hbit < i + n) _hbit = i + n;
         _cur_bit = i + n;
         return p;
     }
@@ -676,6 +1109,58 @@ inline void* SmallAlloc::realloc(void* p, uint32 o, uint32 n) {
     return NULL;
 }
 
+inline void* SpanCache::alloc(uint32 c) {
+    _S* const s = _h[c];
+    if (s) {
+        _h[c] = s->next;
+        if (--_n[c] < _lo[c]) _lo[c] = _n[c];
+        _bytes -= _span_size(c);
+        return s;
+    }
+    const size_t size = _span_size(c);
+    void* p = _vm_alloc(size);
+    if (p) galloc()->add_committed(size);
+    return p;
+}
+
+inline void SpanCache::free(void* p, uint32 c) {
+    const size_t size = _span_size(c);
+    if (_n[c] < M && _bytes + size <= S) {
+        _S* const s = (_S*)p;
+        s->next = _h[c];
+        _h[c] = s;
+        ++_n[c];
+        _bytes += size;
+    } else {
+        _vm_free(p, size);
+        galloc()->sub_committed(size);
+    }
+}
+
+size_t SpanCache::idle_bytes() const {
+    size_t r = 0;
+    for (uint32 c = 0; c < N; ++c) r += _lo[c] * _span_size(c);
+    return r;
+}
+
+size_t SpanCache::trim(size_t& idle, size_t keep) {
+    size_t r = 0;
+    for (uint32 c = 0; c < N; ++c) {
+        const size_t size = _span_size(c);
+        for (; _lo[c] > 0 && idle > keep; --_lo[c]) {
+            _S* const s = _h[c];
+            _h[c] = s->next;
+            --_n[c];
+            _bytes -= size;
+            _vm_free(s, size);
+            galloc()->sub_committed(size);
+            idle -= size;
+            r += size;
+        }
+        _lo[c] = _n[c];
+    }
+    return r;
+}
 
 inline void* ThreadAlloc::alloc(size_t n) {
     void* p = 0;
@@ -710,6 +1195,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
                 _try_alloc(l, 4) {
                     if ((sa = ((LargeBlock*)k)->make_small_alloc())) {
                         list_move_front(l, k);
+                        list_push_front((list_t&)_sa, (DoubleLink*)sa);
                         p = sa->alloc(u);
                         goto end;
                     }
@@ -749,16 +1235,21 @@ inline void* ThreadAlloc::alloc(size_t n) {
             goto end;
         }
 
+    } else if (n <= g_max_span_size) {
+        p = _spans.alloc(_span_class(n));
+
     } else {
-        p = ::malloc(n);
+        p = _vm_alloc_growable(n);
     }
 
   end:
+    if (p) this->on_alloc(p, n);
     return p;
 }
 
 inline void ThreadAlloc::free(void* p, size_t n) {
     if (p) {
+        this->on_free(p, n);
         if (n <= 2048) {
             const auto sa = (SmallAlloc*) god::align_down<1u << g_sb_bits>(p);
             const auto ta = sa->thread_alloc();
@@ -768,6 +1259,7 @@ inline void ThreadAlloc::free(void* p, size_t n) {
                     const auto lb = sa->parent();
                     if (lb->free(sa) && lb != _lb) {
                         list_erase((list_t&)_lb, (DoubleLink*)lb);
+                        galloc()->add_committed(lb->decommitted());
                         galloc()->free(lb, lb->parent(), _id);
                     }
                 }
@@ -781,43 +1273,81 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             if (ta == this) {
                 if (la->free(p) && la != _la) {
                     list_erase((list_t&)_la, (DoubleLink*)la);
+                    galloc()->add_committed(la->decommitted());
                     galloc()->free(la, la->parent(), _id);
                 }
             } else {
                 la->xfree(p);
             }
 
+        } else if (n <= g_max_span_size) {
+            _spans.free(p, _span_class(n));
+
         } else {
-            ::free(p);
+            _vm_free(p, n);
         }
     }
 }
 
 inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
     if (unlikely(!p)) return this->alloc(n);
-    if (unlikely(o > g_max_alloc_size)) return ::realloc(p, n);
+    if (unlikely(o > g_max_span_size)) {
+        if (n > g_max_span_size) {
+            auto x = _vm_realloc(p, o, n);
+            if (x) this->on_vm_resize(p, x, o, n);
+            return x;
+        }
+        auto x = this->alloc(n);
+        if (x) { memcpy(x, p, n < o ? n : o); this->free(p, o); }
+        return x;
+    }
+    if (unlikely(o > g_max_alloc_size)) {
+        // done in place if it is still in the same size class
+        if (n > g_max_alloc_size && n <= g_max_span_size && _span_class(n) == _span_class(o)) {
+            this->on_resize(o, n);
+            return p;
+        }
+      #ifdef __linux__
+        // a span is a mapping of its own, it grows by mremap() without copying, 
+        // to the span of the new size class, or to a block mapped from the OS.
+        if (n > o) {
+            const size_t so = _span_size(_span_class(o));
+            const size_t sn = n <= g_max_span_size ? _span_size(_span_class(n)) : n;
+            auto x = _vm_realloc(p, so, sn);
+            if (x) {
+                galloc()->sub_committed(so);
+                if (n <= g_max_span_size) galloc()->add_committed(sn);
+                this->on_vm_resize(p, x, o, n);
+            }
+            return x;
+        }
+      #endif
+        auto x = this->alloc(n);
+        if (x) { memcpy(x, p, n < o ? n : o); this->free(p, o); }
+        return x;
+    }
     CHECK_LT(o, n) << "realloc error, new size must be greater than old size..";
 
     if (o <= 2048) {
         const uint32 k = (o > 16 ? god::align_up<16>((uint32)o) : 16);
-        if (n <= (size_t)k) return p;
+        if (n <= (size_t)k) { this->on_resize(o, n); return p; }
 
         const auto sa = (SmallAlloc*) god::align_down<1u << g_sb_bits>(p);
         if (sa == _sa && n <= 2048) {
             const uint32 l = god::align_up<16>((uint32)n);
             auto x = sa->realloc(p, k >> 4, l >> 4);
-            if (x) return x;
+            if (x) { this->on_resize(o, n); return x; }
         }
 
     } else {
         const uint32 k = god::align_up<4096>((uint32)o);
-        if (n <= (size_t)k) return p;
+        if (n <= (size_t)k) { this->on_resize(o, n); return p; }
 
         const auto la = (LargeAlloc*) god::align_down<1u << g_lb_bits>(p);
         if (la == _la && n <= g_max_alloc_size) {
             const uint32 l = god::align_up<4096>((uint32)n);
             auto x = la->realloc(p, k >> 12, l >> 12);
-            if (x) return x;
+            if (x) { this->on_resize(o, n); return x; }
         }
     }
 
@@ -826,6 +1356,97 @@ inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
     return x;
 }
 
+void ThreadAlloc::add_stats(mem_stats_t& x) const {
+    x.allocs += atomic_load(&_stats.allocs, mo_relaxed);
+    x.frees += atomic_load(&_stats.frees, mo_relaxed);
+    x.bytes += atomic_load(&_stats.bytes, mo_relaxed);
+    x.small_bytes += atomic_load(&_stats.small_bytes, mo_relaxed);
+    x.large_bytes += atomic_load(&_stats.large_bytes, mo_relaxed);
+    x.span_bytes += atomic_load(&_stats.span_bytes, mo_relaxed);
+    x.sys_bytes += atomic_load(&_stats.sys_bytes, mo_relaxed);
+    x.static_bytes += atomic_load(&_stats.static_bytes, mo_relaxed);
+}
+
+size_t ThreadAlloc::trim(size_t keep) {
+    size_t idle = _spans.idle_bytes(), r = 0, n;
+    for (auto k = (DoubleLink*)_la; k; k = k->next) idle += ((LargeAlloc*)k)->idle_bytes();
+    for (auto k = (DoubleLink*)_lb; k; k = k->next) idle += ((LargeBlock*)k)->idle_bytes();
+
+    // memory is decommitted until no more than @keep bytes idle are left,
+    // cached spans are released first.
+    r = _spans.trim(idle, keep);
+    for (auto k = (DoubleLink*)_la; k; k = k->next) {
+        n = ((LargeAlloc*)k)->trim(idle > keep);
+        idle -= n; r += n;
+    }
+    for (auto k = (DoubleLink*)_lb; k; k = k->next) {
+        n = ((LargeBlock*)k)->trim(idle > keep);
+        idle -= n; r += n;
+    }
+    return r;
+}
+
+void HeapProfiler::add(void* p, size_t n, size_t w, int skip) {
+    Stack s;
+    auto st = ___::log::stack_trace();
+    s.depth = st ? st->get_pcs(s.pcs, D, skip + 1) : 0;
+    memset(s.pcs + s.depth, 0, sizeof(void*) * (D - s.depth));
+
+    std::lock_guard<std::mutex> g(_mtx);
+    Bucket& b = _buckets[s];
+    ++b.allocs;
+    b.alloc_bytes += n;
+    b.est_alloc_bytes += w;
+    Sample& x = _samples[p];
+    x.b = &b;
+    x.n = n;
+    x.w = w;
+    atomic_inc(&_filter[_slot(p)], mo_relaxed);
+    atomic_store(&_sampled, true, mo_relaxed);
+}
+
+void HeapProfiler::del(void* p) {
+    std::lock_guard<std::mutex> g(_mtx);
+    auto it = _samples.find(p);
+    if (it == _samples.end()) return;
+    Sample& x = it->second;
+    ++x.b->frees;
+    x.b->free_bytes += x.n;
+    x.b->est_free_bytes += x.w;
+    _samples.erase(it);
+    atomic_dec(&_filter[_slot(p)], mo_relaxed);
+}
+
+void HeapProfiler::snapshot(std::vector<std::pair<Stack, Bucket>>& v) {
+    std::lock_guard<std::mutex> g(_mtx);
+    v.reserve(_buckets.size());
+    for (auto it = _buckets.begin(); it != _buckets.end(); ++it) v.push_back(*it);
+}
+
+void ThreadAlloc::sample(void* p, size_t n) {
+    const uint32 rate = FLG_mem_profile_rate;
+    if (rate == 0) { _sample_left = 1 << 20; return; } // check the flag later
+    
+    // the interval is random in [rate/2, rate*3/2), to avoid bias from
+    // periodic allocation patterns
+    _seed ^= _seed << 13; _seed ^= _seed >> 17; _seed ^= _seed << 5;
+    _sample_left = (int64)(rate >> 1) + (int64)(_seed % (rate | 1));
+    if (_sampling) return;
+
+    _sampling = true;
+    heap_profiler()->add(p, n, n < rate ? rate : n, 2);
+    _sampling = false;
+}
+
+inline void ThreadAlloc::unsample(void* p) {
+    const auto hp = heap_profiler();
+    if (unlikely(hp->maybe_sampled(p)) && !_sampling) {
+        _sampling = true;
+        hp->del(p);
+        _sampling = false;
+    }
+}
+
 } // xx
 
 #ifndef CO_USE_SYS_MALLOC
@@ -845,11 +1466,123 @@ void* realloc(void* p, size_t o, size_t n) {
     return xx::thread_alloc()->realloc(p, o, n);
 }
 
+mem_stats_t mem_stats() {
+    mem_stats_t x;
+    memset(&x, 0, sizeof(x));
+    auto ta = atomic_load(&xx::g_thread_allocs, mo_acquire);
+    for (; ta; ta = ta->next()) ta->add_stats(x);
+    x.reserved_bytes = xx::galloc()->reserved();
+    x.committed_bytes = xx::galloc()->committed();
+    x.huge_page_blocks = xx::galloc()->huge();
+    return x;
+}
+
+mem_stats_t thread_mem_stats() {
+    mem_stats_t x;
+    memset(&x, 0, sizeof(x));
+    xx::thread_alloc()->add_stats(x);
+    return x;
+}
+
+size_t mem_trim(size_t keep) {
+    return xx::thread_alloc()->trim(keep);
+}
+
+typedef std::pair<xx::HeapProfiler::Stack, xx::HeapProfiler::Bucket> heap_entry_t;
+
+inline uint64 inuse_est(const heap_entry_t& e) {
+    return e.second.est_alloc_bytes - e.second.est_free_bytes;
+}
+
+fastring heap_profile(int n) {
+    std::vector<heap_entry_t> v;
+    {
+        const auto ta = xx::thread_alloc();
+        const bool x = ta->pause_sampling(true);
+        xx::heap_profiler()->snapshot(v);
+        ta->pause_sampling(x);
+    }
+    std::sort(v.begin(), v.end(), [](const heap_entry_t& a, const heap_entry_t& b) {
+        return inuse_est(a) > inuse_est(b);
+    });
+
+    uint64 total = 0;
+    for (auto& e : v) total += inuse_est(e);
+
+    auto st = ___::log::stack_trace();
+    fastream s(1024);
+    s << "heap profile, rate: " << FLG_mem_profile_rate << " bytes, in use: ~" << total
+      << " bytes, top " << n << " of " << v.size() << " stacks:\n";
+    for (size_t i = 0; i < v.size() && (int)i < n; ++i) {
+        const auto& b = v[i].second;
+        s << '#' << i << "  in use: ~" << inuse_est(v[i]) << " bytes, " << (b.allocs - b.frees)
+          << " sampled blocks, allocated: ~" << b.est_alloc_bytes << " bytes, "
+          << b.allocs << " sampled blocks\n";
+        const auto& x = v[i].first;
+        for (int k = 0; k < x.depth; ++k) {
+            s << "    ";
+            if (st) { st->symbolize(x.pcs[k], &s); } else { s << x.pcs[k]; }
+            s << '\n';
+        }
+    }
+    return s.str();
+}
+
+fastring heap_profile_pprof() {
+    std::vector<heap_entry_t> v;
+    {
+        const auto ta = xx::thread_alloc();
+        const bool x = ta->pause_sampling(true);
+        xx::heap_profiler()->snapshot(v);
+        ta->pause_sampling(x);
+    }
+
+    uint64 u[4] = { 0 };
+    for (auto& e : v) {
+        const auto& b = e.second;
+        u[0] += b.allocs - b.frees;
+        u[1] += b.alloc_bytes - b.free_bytes;
+        u[2] += b.allocs;
+        u[3] += b.alloc_bytes;
+    }
+
+    fastream s(4096);
+    s << "heap profile: " << u[0] << ": " << u[1] << " [" << u[2] << ": " << u[3]
+      << "] @ heap_v2/" << FLG_mem_profile_rate << '\n';
+    for (auto& e : v) {
+        const auto& b = e.second;
+        s << (b.allocs - b.frees) << ": " << (b.alloc_bytes - b.free_bytes) << " ["
+          << b.allocs << ": " << b.alloc_bytes << "] @";
+        for (int k = 0; k < e.first.depth; ++k) s << ' ' << e.first.pcs[k];
+        s << '\n';
+    }
+
+  #ifdef __linux__
+    // pprof resolves symbols with the address map
+    s << "\nMAPPED_LIBRARIES:\n";
+    FILE* f = fopen("/proc/self/maps", "r");
+    if (f) {
+        char buf[4096];
+        size_t r;
+        while ((r = fread(buf, 1, sizeof(buf), f)) > 0) s.append(buf, r);
+        fclose(f);
+    }
+  #endif
+    return s.str();
+}
+
 #else
 void* static_alloc(size_t n) { return ::malloc(n); }
 void* alloc(size_t n) { return ::malloc(n); }
 void free(void* p, size_t) { ::free(p); }
 void* realloc(void* p, size_t, size_t n) { return ::realloc(p, n); }
+
+// no statistics with the system allocator
+mem_stats_t mem_stats() { mem_stats_t x; memset(&x, 0, sizeof(x)); return x; }
+mem_stats_t thread_mem_stats() { return mem_stats(); }
+size_t mem_trim(size_t) { return 0; }
+fastring heap_profile(int) { return fastring(); }
+fastring heap_profile_pprof() { return fastring(); }
 #endif
 
 void* zalloc(size_t size) {
@@ -859,3 +1592,191 @@ void* zalloc(size_t size) {
 }
 
 } // co
+
+#ifdef CO_OVERRIDE_MALLOC
+#include <malloc.h>
+#include <errno.h>
+
+namespace co {
+namespace xx {
+
+// Blocks of the malloc family have a 16 bytes header before the user data,
+// so that free() can find the size. @size is size of the whole block got from
+// co::alloc(), @off is offset of the user data in it.
+struct mhead_t {
+    size_t size;
+    size_t off;
+};
+
+static const size_t g_mhead_size = 16;
+
+inline mhead_t* _mhead(void* p) { return (mhead_t*)p - 1; }
+
+// @align MUST be power of 2
+inline void* _malloc(size_t n, size_t align) {
+    // blocks from co::alloc() are 16 bytes aligned, align bytes are enough for
+    // the header and the padding
+    const size_t x = align <= g_mhead_size ? g_mhead_size : align;
+    if (unlikely(n > (size_t)-1 - x)) { errno = ENOMEM; return 0; }
+
+    char* const p = (char*) co::alloc(n + x);
+    if (unlikely(!p)) { errno = ENOMEM; return 0; }
+    char* const u = align <= g_mhead_size ? p + g_mhead_size :
+        (char*)god::align_up((size_t)p + g_mhead_size, align);
+    mhead_t* const h = _mhead(u);
+    h->size = n + x;
+    h->off = u - p;
+    return u;
+}
+
+inline void _free(void* p) {
+    if (p) {
+        mhead_t* const h = _mhead(p);
+        co::free((char*)p - h->off, h->size);
+    }
+}
+
+inline void* _realloc(void* p, size_t n) {
+    if (!p) return _malloc(n, g_mhead_size);
+    if (n == 0) { _free(p); return 0; }
+
+    mhead_t* const h = _mhead(p);
+    const size_t k = h->size - h->off;
+    if (n <= k) return p;
+    if (unlikely(n > (size_t)-1 - g_mhead_size)) { errno = ENOMEM; return 0; }
+
+    if (h->off == g_mhead_size) {
+        char* x = (char*) co::realloc((char*)p - g_mhead_size, h->size, n + g_mhead_size);
+        if (unlikely(!x)) { errno = ENOMEM; return 0; }
+        x += g_mhead_size;
+        _mhead(x)->size = n + g_mhead_size;
+        return x;
+    }
+
+    void* x = _malloc(n, g_mhead_size);
+    if (x) { memcpy(x, p, k); _free(p); }
+    return x;
+}
+
+inline bool _is_pow2(size_t x) { return x && !(x & (x - 1)); }
+
+} // xx
+} // co
+
+extern "C" {
+
+void* malloc(size_t n) __THROW {
+    return co::xx::_malloc(n, co::xx::g_mhead_size);
+}
+
+void free(void* p) __THROW {
+    co::xx::_free(p);
+}
+
+void* realloc(void* p, size_t n) __THROW {
+    return co::xx::_realloc(p, n);
+}
+
+void* calloc(size_t m, size_t n) __THROW {
+    if (n && m > (size_t)-1 / n) { errno = ENOMEM; return 0; }
+    void* p = co::xx::_malloc(m * n, co::xx::g_mhead_size);
+    if (p) memset(p, 0, m * n);
+    return p;
+}
+
+void* reallocarray(void* p, size_t m, size_t n) __THROW {
+    if (n && m > (size_t)-1 / n) { errno = ENOMEM; return 0; }
+    return co::xx::_realloc(p, m * n);
+}
+
+void* memalign(size_t align, size_t n) __THROW {
+    if (!co::xx::_is_pow2(align)) { errno = EINVAL; return 0; }
+    return co::xx::_malloc(n, align);
+}
+
+void* aligned_alloc(size_t align, size_t n) __THROW {
+    return memalign(align, n);
+}
+
+int posix_memalign(void** r, size_t align, size_t n) __THROW {
+    if (!co::xx::_is_pow2(align) || align % sizeof(void*) != 0) return EINVAL;
+    void* p = co::xx::_malloc(n, align);
+    if (!p) return ENOMEM;
+    *r = p;
+    return 0;
+}
+
+void* valloc(size_t n) __THROW {
+    return co::xx::_malloc(n, 4096);
+}
+
+void* pvalloc(size_t n) __THROW {
+    return co::xx::_malloc(god::align_up<4096>(n), 4096);
+}
+
+size_t malloc_usable_size(void* p) __THROW {
+    if (!p) return 0;
+    co::xx::mhead_t* const h = co::xx::_mhead(p);
+    return h->size - h->off;
+}
+
+} // extern "C"
+
+void* operator new(size_t n) {
+    void* p = co::xx::_malloc(n, co::xx::g_mhead_size);
+    if (unlikely(!p)) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t n) {
+    void* p = co::xx::_malloc(n, co::xx::g_mhead_size);
+    if (unlikely(!p)) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t n, const std::nothrow_t&) noexcept {
+    return co::xx::_malloc(n, co::xx::g_mhead_size);
+}
+
+void* operator new[](size_t n, const std::nothrow_t&) noexcept {
+    return co::xx::_malloc(n, co::xx::g_mhead_size);
+}
+
+void operator delete(void* p) noexcept { co::xx::_free(p); }
+void operator delete[](void* p) noexcept { co::xx::_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { co::xx::_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { co::xx::_free(p); }
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* p, size_t) noexcept { co::xx::_free(p); }
+void operator delete[](void* p, size_t) noexcept { co::xx::_free(p); }
+#endif
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t n, std::align_val_t a) {
+    void* p = co::xx::_malloc(n, (size_t)a);
+    if (unlikely(!p)) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t n, std::align_val_t a) {
+    void* p = co::xx::_malloc(n, (size_t)a);
+    if (unlikely(!p)) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return co::xx::_malloc(n, (size_t)a);
+}
+
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return co::xx::_malloc(n, (size_t)a);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept { co::xx::_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { co::xx::_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { co::xx::_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { co::xx::_free(p); }
+#endif
+
+#endif // CO_OVERRIDE_MALLOC
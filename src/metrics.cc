@@ -0,0 +1,282 @@
+#include "co/metrics.h"
+#include "co/atomic.h"
+#include "co/co.h"
+#include "co/http.h"
+#include "co/log.h"
+#include "co/mem.h"
+#include "co/thread.h"
+
+namespace metrics {
+namespace xx {
+
+enum { kShards = 16, kStride = 8 }; // a cache line for each shard
+
+inline uint32 shard_id() {
+    static uint32 g_next = 0;
+    static __thread uint32 t = (uint32)-1;
+    if (t == (uint32)-1) t = atomic_fetch_inc(&g_next, mo_relaxed) % kShards;
+    return t;
+}
+
+struct family {
+    fastring name;
+    fastring help;
+    char type; // c: counter, g: gauge, f: gauge by a function, h: histogram
+    void* p;
+    std::function<double()> f;
+};
+
+void write_sched(fastream& s);
+void write_mem(fastream& s);
+void write_log(fastream& s);
+
+class Registry {
+  public:
+    Registry() {
+        _c.push_back(&write_sched);
+        _c.push_back(&write_mem);
+        _c.push_back(&write_log);
+    }
+
+    ~Registry() = delete;
+
+    // find the metric by name, or create it by f()
+    template <typename F>
+    void* get(const char* name, const char* help, char type, F&& f) {
+        ::MutexGuard g(_mtx);
+        for (size_t i = 0; i < _v.size(); ++i) {
+            if (_v[i]->name == name) {
+                CHECK_EQ(_v[i]->type, type) << "metric " << name << " redefined with another type";
+                return _v[i]->p;
+            }
+        }
+        _v.push_back(co::static_new<family>());
+        family& x = *_v.back();
+        x.name = name;
+        x.help = help;
+        x.type = type;
+        x.p = f(x);
+        return x.p;
+    }
+
+    void add_collector(collector_t&& f) {
+        ::MutexGuard g(_mtx);
+        _c.push_back(std::move(f));
+    }
+
+    void render(fastream& s);
+
+  private:
+    ::Mutex _mtx;
+    co::vector<family*> _v; // families are never freed
+    co::vector<collector_t> _c;
+};
+
+// metrics are rendered out of the lock, a collector may create metrics
+void Registry::render(fastream& s) {
+    co::vector<family*> v;
+    co::vector<collector_t> c;
+    {
+        ::MutexGuard g(_mtx);
+        v = _v;
+        c = _c;
+    }
+    for (size_t i = 0; i < v.size(); ++i) {
+        const family& x = *v[i];
+        switch (x.type) {
+          case 'c':
+            write_header(s, x.name.c_str(), x.help.c_str(), "counter");
+            write_value(s, x.name.c_str(), 0, ((Counter*)x.p)->value());
+            break;
+          case 'g':
+            write_header(s, x.name.c_str(), x.help.c_str(), "gauge");
+            write_value(s, x.name.c_str(), 0, ((Gauge*)x.p)->value());
+            break;
+          case 'f':
+            write_header(s, x.name.c_str(), x.help.c_str(), "gauge");
+            write_value(s, x.name.c_str(), 0, x.f());
+            break;
+          default:
+            write_header(s, x.name.c_str(), x.help.c_str(), "summary");
+            write_summary(s, x.name.c_str(), 0, *(co::Histogram*)x.p);
+        }
+    }
+    for (size_t i = 0; i < c.size(); ++i) c[i](s);
+}
+
+inline Registry& registry() {
+    static auto r = co::static_new<Registry>();
+    return *r;
+}
+
+// write a sample of each scheduler
+template <typename F>
+void write_per_sched(fastream& s, const co::vector<co::Scheduler*>& v, const char* name, F&& f) {
+    char labels[32];
+    for (size_t i = 0; i < v.size(); ++i) {
+        snprintf(labels, sizeof(labels), "sched=\"%u\"", (uint32)i);
+        write_value(s, name, labels, (uint64)f(v[i]->stats()));
+    }
+}
+
+void write_sched(fastream& s) {
+    const auto& v = co::schedulers();
+    write_header(s, "co_sched_resumes_total", "coroutine resumes", "counter");
+    write_per_sched(s, v, "co_sched_resumes_total", [](const co::sched_stats_t& x) { return x.resumes; });
+    write_header(s, "co_sched_idle_us_total", "time in microseconds waiting for events", "counter");
+    write_per_sched(s, v, "co_sched_idle_us_total", [](const co::sched_stats_t& x) { return x.idle_us; });
+    write_header(s, "co_sched_stalls_total", "times the scheduler was blocked by a coroutine", "counter");
+    write_per_sched(s, v, "co_sched_stalls_total", [](const co::sched_stats_t& x) { return x.stalls; });
+    write_header(s, "co_sched_preempts_total", "times a coroutine yielded at co::preempt_point()", "counter");
+    write_per_sched(s, v, "co_sched_preempts_total", [](const co::sched_stats_t& x) { return x.preempts; });
+    write_header(s, "co_sched_queued", "tasks run in the last round", "gauge");
+    write_per_sched(s, v, "co_sched_queued", [](const co::sched_stats_t& x) { return x.queued; });
+    write_header(s, "co_sched_pool_bytes", "stack memory held by pooled coroutines", "gauge");
+    write_per_sched(s, v, "co_sched_pool_bytes", [](const co::sched_stats_t& x) { return x.pool_bytes; });
+    write_header(s, "co_sched_coroutines", "coroutines alive", "gauge");
+    write_per_sched(s, v, "co_sched_coroutines", [](const co::sched_stats_t& x) { return x.coroutines; });
+
+    char labels[32];
+    write_header(s, "co_sched_loop_us", "time in microseconds of each round running tasks", "summary");
+    for (size_t i = 0; i < v.size(); ++i) {
+        snprintf(labels, sizeof(labels), "sched=\"%u\"", (uint32)i);
+        write_summary(s, "co_sched_loop_us", labels, v[i]->loop_histogram());
+    }
+}
+
+void write_mem(fastream& s) {
+    const co::mem_stats_t m = co::mem_stats();
+    write_header(s, "co_mem_allocs_total", "allocations by co::alloc()", "counter");
+    write_value(s, "co_mem_allocs_total", 0, m.allocs);
+    write_header(s, "co_mem_frees_total", "frees by co::free()", "counter");
+    write_value(s, "co_mem_frees_total", 0, m.frees);
+    write_header(s, "co_mem_bytes", "bytes allocated and not freed", "gauge");
+    write_value(s, "co_mem_bytes", 0, m.bytes);
+    write_header(s, "co_mem_reserved_bytes", "virtual memory reserved", "gauge");
+    write_value(s, "co_mem_reserved_bytes", 0, m.reserved_bytes);
+    write_header(s, "co_mem_committed_bytes", "memory committed", "gauge");
+    write_value(s, "co_mem_committed_bytes", 0, m.committed_bytes);
+}
+
+void write_log(fastream& s) {
+    const log::stats_t x = log::stats();
+    write_header(s, "co_log_dropped_total", "logs dropped on overflow of the buffer", "counter");
+    write_value(s, "co_log_dropped_total", 0, x.dropped_logs);
+    write_header(s, "co_log_dropped_bytes_total", "bytes of logs dropped", "counter");
+    write_value(s, "co_log_dropped_bytes_total", 0, x.dropped_bytes);
+    write_header(s, "co_log_blocked_total", "times a thread waited for a full buffer", "counter");
+    write_value(s, "co_log_blocked_total", 0, x.blocked);
+    write_header(s, "co_log_flush_us", "time in microseconds of writing logs in each round", "summary");
+    write_summary(s, "co_log_flush_us", 0, log::flush_histogram());
+}
+
+inline void write_name(fastream& s, const char* name, const char* suffix, const char* labels, const char* more) {
+    s << name << suffix;
+    const bool a = labels && *labels;
+    if (a || more) {
+        s << '{';
+        if (a) s << labels;
+        if (a && more) s << ',';
+        if (more) s << more;
+        s << '}';
+    }
+    s << ' ';
+}
+
+} // xx
+
+Counter::Counter() {
+    _v = (uint64*) co::zalloc(sizeof(uint64) * xx::kShards * xx::kStride); assert(_v);
+}
+
+void Counter::inc(uint64 n) {
+    atomic_add(&_v[xx::shard_id() * xx::kStride], n, mo_relaxed);
+}
+
+uint64 Counter::value() const {
+    uint64 x = 0;
+    for (int i = 0; i < xx::kShards; ++i) x += atomic_load(&_v[i * xx::kStride], mo_relaxed);
+    return x;
+}
+
+void Gauge::set(int64 v) { atomic_store(&_v, v, mo_relaxed); }
+void Gauge::add(int64 v) { atomic_add(&_v, v, mo_relaxed); }
+int64 Gauge::value() const { return atomic_load(&_v, mo_relaxed); }
+
+Counter& counter(const char* name, const char* help) {
+    return *(Counter*) xx::registry().get(name, help, 'c', [](xx::family&) {
+        return (void*) co::static_new<Counter>();
+    });
+}
+
+Gauge& gauge(const char* name, const char* help) {
+    return *(Gauge*) xx::registry().get(name, help, 'g', [](xx::family&) {
+        return (void*) co::static_new<Gauge>();
+    });
+}
+
+void gauge(const char* name, const char* help, std::function<double()>&& f) {
+    xx::registry().get(name, help, 'f', [&f](xx::family& x) {
+        x.f = std::move(f);
+        return (void*)0;
+    });
+}
+
+co::Histogram& histogram(const char* name, const char* help) {
+    return *(co::Histogram*) xx::registry().get(name, help, 'h', [](xx::family&) {
+        return (void*) co::static_new<co::Histogram>();
+    });
+}
+
+void add_collector(collector_t&& f) {
+    xx::registry().add_collector(std::move(f));
+}
+
+void write_header(fastream& s, const char* name, const char* help, const char* type) {
+    s << "# HELP " << name << ' ' << help << '\n';
+    s << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void write_value(fastream& s, const char* name, const char* labels, double v) {
+    xx::write_name(s, name, "", labels, 0);
+    s << v << '\n';
+}
+
+void write_value(fastream& s, const char* name, const char* labels, uint64 v) {
+    xx::write_name(s, name, "", labels, 0);
+    s << v << '\n';
+}
+
+void write_value(fastream& s, const char* name, const char* labels, int64 v) {
+    xx::write_name(s, name, "", labels, 0);
+    s << v << '\n';
+}
+
+void write_summary(fastream& s, const char* name, const char* labels, const co::Histogram& h) {
+    static const double ps[] = { 50, 90, 99, 99.9 };
+    static const char* qs[] = { "quantile=\"0.5\"", "quantile=\"0.9\"", "quantile=\"0.99\"", "quantile=\"0.999\"" };
+    uint64 v[4];
+    h.percentiles(ps, v, 4);
+    for (int i = 0; i < 4; ++i) {
+        xx::write_name(s, name, "", labels, qs[i]);
+        s << v[i] << '\n';
+    }
+    xx::write_name(s, name, "_sum", labels, 0);
+    s << h.sum() << '\n';
+    xx::write_name(s, name, "_count", labels, 0);
+    s << h.count() << '\n';
+}
+
+void render(fastream& s) {
+    xx::registry().render(s);
+}
+
+void http_handler(const http::Req&, http::Res& res) {
+    fastream s(8192);
+    render(s);
+    res.set_status(200);
+    res.add_header("Content-Type", "text/plain; version=0.0.4");
+    res.set_body(s.data(), s.size());
+}
+
+} // metrics
@@ -3,12 +3,66 @@
 #include "co/os.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
+#include <sys/sysctl.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 namespace os {
+namespace xx {
+
+// every cpu is a core, with no cache info
+inline void default_topology(topology_t& t) {
+    t.cpus = t.cores = cpunum();
+    t.packages = t.numa_nodes = t.smt = 1;
+    t.line_size = 64;
+    t.l1d = t.l1i = t.l2 = t.l3 = 0;
+    t.cpu.clear();
+    for (int i = 0; i < t.cpus; ++i) {
+        cpu_info_t x = { i, i, 0, 0 };
+        t.cpu.push_back(x);
+    }
+}
+
+// core and package in t.cpu are ids of the system, map them to indexes, and
+// count cores, packages and smt
+inline void index_topology(topology_t& t) {
+    typedef std::pair<int, int> P; // <package, core>
+    co::vector<P> cores;
+    co::vector<int> pkgs;
+    for (auto& x : t.cpu) {
+        cores.push_back(P(x.package, x.core));
+        pkgs.push_back(x.package);
+    }
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+    std::sort(pkgs.begin(), pkgs.end());
+    pkgs.erase(std::unique(pkgs.begin(), pkgs.end()), pkgs.end());
+
+    co::vector<int> n(cores.size(), 0);
+    t.smt = 1;
+    for (auto& x : t.cpu) {
+        const size_t c = std::lower_bound(cores.begin(), cores.end(), P(x.package, x.core)) - cores.begin();
+        x.core = (int)c;
+        x.package = (int)(std::lower_bound(pkgs.begin(), pkgs.end(), x.package) - pkgs.begin());
+        if (++n[c] > t.smt) t.smt = n[c];
+    }
+    t.cpus = (int)t.cpu.size();
+    t.cores = (int)cores.size();
+    t.packages = (int)pkgs.size();
+}
+
+} // xx
 
 fastring env(const char* name) {
     char* x = ::getenv(name);
@@ -60,6 +114,140 @@ int cpunum() {
 }
 
 #ifdef __linux__
+// NUMA nodes are listed as /sys/devices/system/node/node<N>
+int numa_num() {
+    static int n = []() {
+        char path[64];
+        int i = 0;
+        for (;; ++i) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", i);
+            if (::access(path, F_OK) != 0) break;
+        }
+        return i > 0 ? i : 1;
+    }();
+    return n;
+}
+
+// /sys/devices/system/cpu/cpu<N> contains an entry node<M> for its NUMA node
+int numa_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* d = ::opendir(path);
+    if (d == NULL) return 0;
+
+    int node = 0;
+    for (struct dirent* e; (e = ::readdir(d)) != NULL;) {
+        if (strncmp(e->d_name, "node", 4) == 0 && '0' <= e->d_name[4] && e->d_name[4] <= '9') {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    ::closedir(d);
+    return node;
+}
+
+bool bind_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool set_affinity(const co::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto& c : cpus) {
+        if (c < 0 || c >= CPU_SETSIZE) return false;
+        CPU_SET(c, &set);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+namespace xx {
+
+// the integer at the beginning of a file, -1 on error
+inline long read_long(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return -1;
+    long v = -1;
+    if (fscanf(f, "%ld", &v) != 1) v = -1;
+    fclose(f);
+    return v;
+}
+
+// size of a cache, like 32K or 2048K
+inline size_t read_size(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return 0;
+    unsigned long v = 0;
+    char u = 0;
+    const int r = fscanf(f, "%lu%c", &v, &u);
+    fclose(f);
+    if (r < 1) return 0;
+    if (u == 'K') v <<= 10;
+    if (u == 'M') v <<= 20;
+    if (u == 'G') v <<= 30;
+    return (size_t)v;
+}
+
+// cpus offline have no topology directory
+void linux_topology(topology_t& t) {
+    char path[128];
+    t.cpu.clear();
+    for (int i = 0;; ++i) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", i);
+        if (::access(path, F_OK) != 0) break;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        const long core = read_long(path);
+        if (core < 0) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        const long pkg = read_long(path);
+        cpu_info_t x = { i, (int)core, pkg < 0 ? 0 : (int)pkg, numa_node(i) };
+        t.cpu.push_back(x);
+    }
+    if (t.cpu.empty()) return;
+    index_topology(t);
+    t.numa_nodes = numa_num();
+
+    // caches of the first cpu, /sys/devices/system/cpu/cpuN/cache/index<K>
+    const int c = t.cpu[0].cpu;
+    for (int k = 0;; ++k) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", c, k);
+        const long level = read_long(path);
+        if (level < 0) break;
+
+        char type[16] = { 0 };
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", c, k);
+        FILE* f = fopen(path, "r");
+        if (f) { if (fscanf(f, "%15s", type) != 1) type[0] = 0; fclose(f); }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", c, k);
+        const size_t size = read_size(path);
+        if (level == 1 && type[0] == 'I') { t.l1i = size; continue; }
+        if (level == 1) {
+            t.l1d = size;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/coherency_line_size", c, k);
+            const long n = read_long(path);
+            if (n > 0) t.line_size = (int)n;
+        }
+        if (level == 2) t.l2 = size;
+        if (level == 3) t.l3 = size;
+    }
+}
+
+} // xx
+
+const topology_t& topology() {
+    static topology_t* t = []() {
+        topology_t* t = co::static_new<topology_t>();
+        xx::default_topology(*t);
+        xx::linux_topology(*t);
+        if (t->cpu.empty()) xx::default_topology(*t);
+        return t;
+    }();
+    return *t;
+}
+
 fastring exepath() {
     char buf[4096] = { 0 };
     int r = (int) readlink("/proc/self/exe", buf, 4096);
@@ -79,6 +267,64 @@ fastring exepath() {
 }
 
 void daemon() {}
+
+int numa_num() { return 1; }
+
+int numa_node(int) { return 0; }
+
+bool bind_cpu(int) { return false; }
+
+bool set_affinity(const co::vector<int>&) { return false; }
+
+#ifdef __APPLE__
+namespace xx {
+
+inline int64 sysctl_int(const char* name) {
+    int64 v = 0; // values of 4 bytes are stored in the low bytes
+    size_t n = sizeof(v);
+    return sysctlbyname(name, &v, &n, NULL, 0) == 0 ? v : 0;
+}
+
+} // xx
+
+// macos does not tell which cpus are siblings, cpus of a core are assumed to
+// be numbered next to each other
+const topology_t& topology() {
+    static topology_t* t = []() {
+        topology_t* t = co::static_new<topology_t>();
+        xx::default_topology(*t);
+        const int cores = (int) xx::sysctl_int("hw.physicalcpu");
+        const int pkgs = (int) xx::sysctl_int("hw.packages");
+        if (cores > 0 && cores <= t->cpus) {
+            t->cores = cores;
+            t->smt = (t->cpus + cores - 1) / cores;
+            t->packages = pkgs > 0 ? pkgs : 1;
+            for (auto& x : t->cpu) {
+                x.core = x.cpu / t->smt;
+                x.package = x.core * t->packages / cores;
+            }
+        }
+        const int64 line = xx::sysctl_int("hw.cachelinesize");
+        if (line > 0) t->line_size = (int)line;
+        t->l1d = (size_t) xx::sysctl_int("hw.l1dcachesize");
+        t->l1i = (size_t) xx::sysctl_int("hw.l1icachesize");
+        t->l2 = (size_t) xx::sysctl_int("hw.l2cachesize");
+        t->l3 = (size_t) xx::sysctl_int("hw.l3cachesize");
+        return t;
+    }();
+    return *t;
+}
+
+#else
+const topology_t& topology() {
+    static topology_t* t = []() {
+        topology_t* t = co::static_new<topology_t>();
+        xx::default_topology(*t);
+        return t;
+    }();
+    return *t;
+}
+#endif
 #endif
 
 sig_handler_t signal(int sig, sig_handler_t handler, int flag) {
@@ -2,6 +2,7 @@
 
 #include "co/os.h"
 #include <signal.h>
+#include <stdlib.h>
 #include <algorithm>
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -104,6 +105,120 @@ int cpunum() {
     return ncpu;
 }
 
+int numa_num() {
+    static int n = []() {
+        ULONG x = 0;
+        return GetNumaHighestNodeNumber(&x) ? (int)x + 1 : 1;
+    }();
+    return n;
+}
+
+int numa_node(int cpu) {
+    UCHAR x = 0;
+    return GetNumaProcessorNode((UCHAR)cpu, &x) && x != 0xff ? (int)x : 0;
+}
+
+bool bind_cpu(int cpu) {
+    if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
+bool set_affinity(const co::vector<int>& cpus) {
+    DWORD_PTR mask = 0;
+    for (auto& c : cpus) {
+        if (c < 0 || c >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+        mask |= (DWORD_PTR)1 << c;
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+namespace xx {
+
+// mark cpus of @group in @masks with index @v, return true if any is marked
+inline bool mark_cpus(const GROUP_AFFINITY* masks, WORD n, WORD group, int v, int* out) {
+    bool r = false;
+    for (WORD g = 0; g < n; ++g) {
+        if (masks[g].Group != group) continue;
+        for (int b = 0; b < (int)(sizeof(KAFFINITY) * 8); ++b) {
+            if (masks[g].Mask & ((KAFFINITY)1 << b)) { out[b] = v; r = true; }
+        }
+    }
+    return r;
+}
+
+} // xx
+
+// cpus in the processor group of the calling thread, as cpunum() and
+// bind_cpu() only work in one group
+const topology_t& topology() {
+    static topology_t* t = []() {
+        const int N = (int)(sizeof(KAFFINITY) * 8);
+        topology_t* t = co::static_new<topology_t>();
+        t->cpus = t->cores = t->packages = t->numa_nodes = t->smt = 1;
+        t->line_size = 64;
+        t->l1d = t->l1i = t->l2 = t->l3 = 0;
+
+        WORD group = 0;
+        GROUP_AFFINITY ga;
+        if (GetThreadGroupAffinity(GetCurrentThread(), &ga)) group = ga.Group;
+
+        int core_of[N], pkg_of[N];
+        for (int i = 0; i < N; ++i) { core_of[i] = -1; pkg_of[i] = 0; }
+        int cores = 0, pkgs = 0;
+
+        DWORD n = 0;
+        GetLogicalProcessorInformationEx(RelationAll, NULL, &n);
+        char* buf = n > 0 ? (char*) ::malloc(n) : NULL;
+        if (buf && GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buf, &n)) {
+            for (DWORD off = 0; off < n;) {
+                auto x = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buf + off);
+                off += x->Size;
+                if (x->Relationship == RelationProcessorCore) {
+                    if (xx::mark_cpus(x->Processor.GroupMask, x->Processor.GroupCount, group, cores, core_of)) ++cores;
+                } else if (x->Relationship == RelationProcessorPackage) {
+                    if (xx::mark_cpus(x->Processor.GroupMask, x->Processor.GroupCount, group, pkgs, pkg_of)) ++pkgs;
+                } else if (x->Relationship == RelationCache) {
+                    const CACHE_RELATIONSHIP& c = x->Cache;
+                    if (c.Level == 1 && c.Type == CacheInstruction) {
+                        t->l1i = c.CacheSize;
+                    } else if (c.Level == 1) {
+                        t->l1d = c.CacheSize;
+                        if (c.LineSize > 0) t->line_size = c.LineSize;
+                    } else if (c.Level == 2) {
+                        t->l2 = c.CacheSize;
+                    } else if (c.Level == 3) {
+                        t->l3 = c.CacheSize;
+                    }
+                }
+            }
+        }
+        ::free(buf);
+
+        co::vector<int> n_of(cores > 0 ? cores : 1, 0);
+        for (int i = 0; i < N; ++i) {
+            if (core_of[i] < 0) continue;
+            cpu_info_t x = { i, core_of[i], pkg_of[i], numa_node(i) };
+            t->cpu.push_back(x);
+            if (++n_of[core_of[i]] > t->smt) t->smt = n_of[core_of[i]];
+        }
+
+        if (t->cpu.empty()) { // every cpu is a core
+            t->smt = 1;
+            for (int i = 0; i < cpunum(); ++i) {
+                cpu_info_t x = { i, i, 0, 0 };
+                t->cpu.push_back(x);
+            }
+            cores = cpunum();
+        }
+        t->cpus = (int)t->cpu.size();
+        t->cores = cores;
+        t->packages = pkgs > 0 ? pkgs : 1;
+        t->numa_nodes = numa_num();
+        return t;
+    }();
+    return *t;
+}
+
 void daemon() {}
 
 sig_handler_t signal(int sig, sig_handler_t handler, int) {
@@ -0,0 +1,93 @@
+#ifdef _WIN32
+#define _CRT_RAND_S // for rand_s()
+#include <stdlib.h>
+#endif
+
+#include "co/random.h"
+#include "co/time.h"
+#include "co/mem.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#else
+#include <stdlib.h> // arc4random_buf
+#endif
+#endif
+
+namespace co {
+
+#if defined(_WIN32)
+bool secure_random_bytes(void* p, size_t n) {
+    char* s = (char*)p;
+    unsigned int v;
+    for (; n > 0; ) {
+        if (rand_s(&v) != 0) return false;
+        const size_t k = n < sizeof(v) ? n : sizeof(v);
+        memcpy(s, &v, k);
+        s += k;
+        n -= k;
+    }
+    return true;
+}
+
+#elif defined(__linux__)
+// read /dev/urandom if getrandom() is not supported by the kernel
+static bool read_urandom(char* s, size_t n) {
+    const int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    while (n > 0) {
+        const ssize_t r = ::read(fd, s, n);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            ::close(fd);
+            return false;
+        }
+        s += r;
+        n -= (size_t)r;
+    }
+    ::close(fd);
+    return true;
+}
+
+bool secure_random_bytes(void* p, size_t n) {
+    char* s = (char*)p;
+  #ifdef SYS_getrandom
+    while (n > 0) {
+        const long r = ::syscall(SYS_getrandom, s, n, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOSYS) break;
+            return false;
+        }
+        s += r;
+        n -= (size_t)r;
+    }
+    if (n == 0) return true;
+  #endif
+    return read_urandom(s, n);
+}
+
+#else
+bool secure_random_bytes(void* p, size_t n) {
+    ::arc4random_buf(p, n);
+    return true;
+}
+#endif
+
+Wyrand& thread_rand() {
+    static __thread Wyrand* r = 0;
+    if (unlikely(!r)) {
+        uint64 seed;
+        if (!secure_random_bytes(&seed, sizeof(seed))) {
+            seed = wymix((uint64)now::us(), (uint64)(size_t)&seed);
+        }
+        r = co::make<Wyrand>(seed);
+    }
+    return *r;
+}
+
+} // co
@@ -0,0 +1,172 @@
+#include "co/admin.h"
+#include "co/atomic.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/http.h"
+#include "co/mem.h"
+#include "co/metrics.h"
+#include "co/str.h"
+
+namespace admin {
+namespace xx {
+
+// value of @key in the query string of the url, empty if not found
+fastring query(const http::Req& req, const char* key) {
+    const fastring& url = req.url();
+    const size_t p = url.find('?');
+    if (p == url.npos) return fastring();
+    const size_t n = strlen(key);
+    auto v = str::split(url.c_str() + p + 1, '&');
+    for (auto& x : v) {
+        if (x.size() > n && x[n] == '=' && memcmp(x.data(), key, n) == 0) return x.substr(n + 1);
+        if (x.size() == n && x == key) return fastring("1");
+    }
+    return fastring();
+}
+
+int query_int(const http::Req& req, const char* key, int v) {
+    const fastring s = query(req, key);
+    if (s.empty()) return v;
+    const int x = atoi(s.c_str());
+    return x > 0 ? x : v;
+}
+
+inline void reply(http::Res& res, const fastring& s, const char* type="text/plain") {
+    res.set_status(200);
+    res.add_header("Content-Type", type);
+    res.set_body(s);
+}
+
+void sched(const http::Req&, http::Res& res) {
+    fastring s(4096);
+    const auto& v = co::schedulers();
+    uint64 alive = 0, pooled = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        const co::sched_stats_t x = v[i]->stats();
+        alive += x.coroutines;
+        pooled += x.pooled;
+        s << "sched " << i << ": coroutines " << x.coroutines << ", pooled " << x.pooled
+          << ", pool_bytes " << x.pool_bytes << ", queued " << x.queued
+          << ", resumes " << x.resumes << ", idle_us " << x.idle_us << ", stalls " << x.stalls
+          << ", preempts " << x.preempts
+          << ", stack_saves " << x.stack_saves << ", bytes_copied " << x.bytes_copied
+          << ", max_stack_size " << x.max_stack_size << '\n';
+    }
+    const co::offload_stats_t o = co::offload_stats();
+    s << "total: coroutines " << alive << ", pooled " << pooled << '\n';
+    s << "offload: threads " << o.threads << ", idle " << o.idle << ", queued " << o.queued
+      << ", max_queued " << o.max_queued << ", tasks " << o.tasks << ", wait_us " << o.wait_us
+      << ", run_us " << o.run_us << ", max_wait_us " << o.max_wait_us << '\n';
+    reply(res, s);
+}
+
+void mem(const http::Req&, http::Res& res) {
+    const co::mem_stats_t m = co::mem_stats();
+    fastring s(512);
+    s << "allocs " << m.allocs << '\n'
+      << "frees " << m.frees << '\n'
+      << "bytes " << m.bytes << '\n'
+      << "small_bytes " << m.small_bytes << '\n'
+      << "large_bytes " << m.large_bytes << '\n'
+      << "span_bytes " << m.span_bytes << '\n'
+      << "sys_bytes " << m.sys_bytes << '\n'
+      << "static_bytes " << m.static_bytes << '\n'
+      << "reserved_bytes " << m.reserved_bytes << '\n'
+      << "committed_bytes " << m.committed_bytes << '\n'
+      << "huge_page_blocks " << m.huge_page_blocks << '\n';
+    reply(res, s);
+}
+
+void heap(const http::Req& req, http::Res& res) {
+    if (query(req, "format") == "pprof") {
+        reply(res, co::heap_profile_pprof());
+    } else {
+        reply(res, co::heap_profile(query_int(req, "n", 16)));
+    }
+}
+
+void profile(const http::Req& req, http::Res& res) {
+    fastring s = co::profile_report(query_int(req, "n", 16));
+    if (!query(req, "reset").empty()) co::profile_reset();
+    reply(res, s);
+}
+
+// only one trace at a time, tracing is global
+void trace(const http::Req& req, http::Res& res) {
+    static int running = 0;
+    if (atomic_bool_cas(&running, 0, 1)) {
+        const int ms = query_int(req, "ms", 100);
+        co::trace_start();
+        co::sleep(ms > 10000 ? 10000 : ms);
+        co::trace_stop();
+        fastring s = co::trace_dump();
+        atomic_store(&running, 0);
+        reply(res, s, "application/json");
+    } else {
+        res.set_status(503);
+        res.set_body("another trace is running");
+    }
+}
+
+void metrics(const http::Req& req, http::Res& res) {
+    ::metrics::http_handler(req, res);
+}
+
+void flags(const http::Req&, http::Res& res) {
+    fastring s(4096);
+    const auto v = flag::values();
+    for (auto& x : v) {
+        s << x.first << " = " << x.second;
+        if (flag::is_mutable(x.first)) s << "  (mutable)";
+        s << '\n';
+    }
+    reply(res, s);
+}
+
+// update a mutable flag, the body is the new value
+void update_flag(const http::Req& req, http::Res& res) {
+    const fastring name = req.param("name").str();
+    fastring value(req.body(), req.body_size());
+    value.strip();
+    const fastring err = flag::update(name, value);
+    if (!err.empty()) {
+        res.set_status(400);
+        res.set_body(err);
+        return;
+    }
+    fastring s(64);
+    s << name << " = " << value << '\n';
+    reply(res, s);
+}
+
+} // xx
+
+void add_handlers(http::Router& r, const char* prefix) {
+    fastring p(prefix);
+    if (p.ends_with('/')) p.resize(p.size() - 1);
+
+    static const char* pages[] = { "sched", "mem", "heap", "profile", "trace", "metrics", "flags" };
+    fastring index(256);
+    for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); ++i) {
+        index << p << '/' << pages[i] << '\n';
+    }
+    r.get(p.empty() ? "/" : p.c_str(), [index](const http::Req&, http::Res& res) {
+        xx::reply(res, index);
+    });
+    r.get((p + "/sched").c_str(), &xx::sched);
+    r.get((p + "/mem").c_str(), &xx::mem);
+    r.get((p + "/heap").c_str(), &xx::heap);
+    r.get((p + "/profile").c_str(), &xx::profile);
+    r.get((p + "/trace").c_str(), &xx::trace);
+    r.get((p + "/metrics").c_str(), &xx::metrics);
+    r.get((p + "/flags").c_str(), &xx::flags);
+    r.post((p + "/flags/:name").c_str(), &xx::update_flag);
+}
+
+void start(const char* ip, int port) {
+    auto r = co::static_new<http::Router>();
+    add_handlers(*r);
+    http::Server().on_req(*r).start(ip, port);
+}
+
+} // admin
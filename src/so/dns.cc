@@ -0,0 +1,575 @@
+#include "co/dns.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/log.h"
+#include "co/random.h"
+#include "co/str.h"
+#include "co/time.h"
+#include <mutex>
+
+DEF_string(dns_servers, "", ">>#2 name servers of dns::resolve(), \"ip[:port]\" separated by commas, "
+    "those in /etc/resolv.conf are used if empty");
+DEF_uint32(dns_timeout, 1000, ">>#2 timeout in ms of a dns query to a name server");
+DEF_uint32(dns_attempts, 2, ">>#2 times to query the name servers before a dns lookup fails");
+DEF_bool(dns_ipv6, false, ">>#2 resolve ipv6 addresses (AAAA records) too");
+DEF_uint32(dns_max_ttl, 300, ">>#2 max seconds to cache a dns result, 0 for no cache");
+DEF_uint32(dns_negative_ttl, 30, ">>#2 max seconds to cache a name that was not found");
+DEF_uint32(dns_cache_size, 4096, ">>#2 max names in the dns cache");
+
+namespace dns {
+
+const uint16 kA = 1;
+const uint16 kCname = 5;
+const uint16 kSoa = 6;
+const uint16 kAAAA = 28;
+
+union Addr {
+    struct sockaddr_in  v4;
+    struct sockaddr_in6 v6;
+};
+
+inline int addr_len(const Addr& a) {
+    return a.v4.sin_family == AF_INET ? (int)sizeof(a.v4) : (int)sizeof(a.v6);
+}
+
+inline bool addr_eq(const Addr& a, const Addr& b) {
+    if (a.v4.sin_family != b.v4.sin_family) return false;
+    if (a.v4.sin_family == AF_INET) {
+        return a.v4.sin_port == b.v4.sin_port &&
+               memcmp(&a.v4.sin_addr, &b.v4.sin_addr, sizeof(a.v4.sin_addr)) == 0;
+    }
+    return a.v6.sin6_port == b.v6.sin6_port &&
+           memcmp(&a.v6.sin6_addr, &b.v6.sin6_addr, sizeof(a.v6.sin6_addr)) == 0;
+}
+
+// "ip", "ip:port" or "[ipv6]:port"
+static bool parse_server(const fastring& s, Addr& a) {
+    fastring ip(s);
+    int port = 53;
+    const size_t p = s.rfind(':');
+    if (s.starts_with('[')) {
+        const size_t e = s.find(']');
+        if (e == s.npos) return false;
+        ip = s.substr(1, e - 1);
+        if (p != s.npos && p > e) port = atoi(s.data() + p + 1);
+    } else if (p != s.npos && s.find(':') == p) {
+        ip = s.substr(0, p);
+        port = atoi(s.data() + p + 1);
+    }
+    if (port <= 0 || port > 65535) return false;
+    return co::init_ip_addr(&a.v4, ip.c_str(), port) || co::init_ip_addr(&a.v6, ip.c_str(), port);
+}
+
+// words of a line in [b, e), till a comment
+static co::vector<fastring> words(const char* b, const char* e) {
+    co::vector<fastring> v;
+    while (b < e) {
+        while (b < e && (*b == ' ' || *b == '\t' || *b == '\r')) ++b;
+        if (b == e || *b == '#' || *b == ';') break;
+        const char* p = b;
+        while (p < e && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+        v.push_back(fastring(b, p - b));
+        b = p;
+    }
+    return v;
+}
+
+template<typename F>
+static void for_lines(const char* path, F&& f) {
+    fs::file x(path, 'r');
+    if (!x) return;
+    const fastring s = x.read((size_t)x.size());
+    for (const char* p = s.data(), *end = p + s.size(); p < end;) {
+        const char* q = (const char*) memchr(p, '\n', end - p);
+        if (!q) q = end;
+        const co::vector<fastring> v = words(p, q);
+        if (!v.empty()) f(v);
+        p = q + 1;
+    }
+}
+
+// name servers, search domains and hosts, loaded once
+struct Conf {
+    Conf() : ndots(1) {
+        Addr a;
+        if (!FLG_dns_servers.empty()) {
+            for (auto& s : str::split(FLG_dns_servers, ',')) {
+                fastring x(s); x.strip();
+                if (x.empty()) continue;
+                if (parse_server(x, a)) {
+                    servers.push_back(a);
+                } else {
+                    ELOG << "invalid dns server: " << x;
+                }
+            }
+        }
+
+        for_lines("/etc/resolv.conf", [&](const co::vector<fastring>& v) {
+            if (v[0] == "nameserver" && v.size() > 1) {
+                if (FLG_dns_servers.empty() && parse_server(v[1], a)) servers.push_back(a);
+            } else if ((v[0] == "search" || v[0] == "domain")) {
+                search.clear();
+                for (size_t i = 1; i < v.size(); ++i) search.push_back(v[i].lower().strip('.'));
+            } else if (v[0] == "options") {
+                for (size_t i = 1; i < v.size(); ++i) {
+                    if (v[i].starts_with("ndots:")) ndots = atoi(v[i].data() + 6);
+                }
+            }
+        });
+
+        for_lines("/etc/hosts", [&](const co::vector<fastring>& v) {
+            if (v.size() < 2) return;
+            const bool v6 = v[0].find(':') != v[0].npos;
+            if (v6 && !FLG_dns_ipv6) return;
+            for (size_t i = 1; i < v.size(); ++i) {
+                auto& ips = hosts[v[i].lower()];
+                bool dup = false;
+                for (auto& x : ips) if (x == v[0]) { dup = true; break; }
+                if (dup) continue;
+                // ipv4 addresses first
+                if (v6) {
+                    ips.push_back(v[0]);
+                } else {
+                    size_t k = 0;
+                    while (k < ips.size() && ips[k].find(':') == ips[k].npos) ++k;
+                    ips.insert(ips.begin() + k, v[0]);
+                }
+            }
+        });
+    }
+
+    co::vector<Addr> servers;
+    co::vector<fastring> search;
+    int ndots;
+    co::hash_map<fastring, co::vector<fastring>> hosts;
+};
+
+// No lock is held while the files are read, as reading a file may yield in a
+// coroutine (see FLG_hook_file_io). Callers racing for the first load may all
+// build one, only the first one published is kept.
+inline Conf& conf() {
+    static Conf* c = 0;
+    Conf* p = atomic_load(&c, mo_acquire);
+    if (p) return *p;
+
+    Conf* x = co::make<Conf>();
+    p = atomic_cas(&c, (Conf*)0, x, mo_acq_rel, mo_acquire);
+    if (p) { co::del(x); return *p; }
+    return *x;
+}
+
+inline uint16 next_id() {
+    static thread_local Random r((uint32)(now::us() * 2654435761u));
+    return (uint16)r.next();
+}
+
+inline uint16 get16(const uint8* p) { return (uint16)((p[0] << 8) | p[1]); }
+
+inline uint32 get32(const uint8* p) {
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+}
+
+// a query of type A or AAAA, and its result
+struct Query {
+    fastring msg;
+    uint16 id;
+    uint16 type;
+    int r; // 1: addresses found, 0: no such name or no address, <0: error
+    uint32 ttl;
+    co::vector<fastring> ips;
+};
+
+static bool make_query(const fastring& name, uint16 type, Query& q) {
+    if (name.empty() || name.size() > 253) return false;
+    q.id = next_id();
+    q.type = type;
+    q.r = -1;
+    q.ttl = 0;
+    q.ips.clear();
+
+    fastring& m = q.msg;
+    m.clear();
+    m.reserve(name.size() + 18);
+    m.append((char)(q.id >> 8)).append((char)q.id);
+    m.append("\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10); // RD, one question
+    for (size_t b = 0; b < name.size();) {
+        size_t e = name.find('.', b);
+        if (e == name.npos) e = name.size();
+        if (e == b || e - b > 63) return false;
+        m.append((char)(e - b)).append(name.data() + b, e - b);
+        b = e + 1;
+    }
+    m.append('\0');
+    m.append((char)(type >> 8)).append((char)type).append("\x00\x01", 2); // class IN
+    return true;
+}
+
+// read a name at @off, return offset after it, or -1 on error
+static int read_name(const uint8* s, int n, int off, fastring* out) {
+    int end = -1, jumps = 0;
+    while (true) {
+        if (off >= n) return -1;
+        const uint8 l = s[off];
+        if (l == 0) { ++off; break; }
+        if ((l & 0xc0) == 0xc0) {
+            if (off + 1 >= n || ++jumps > 32) return -1;
+            if (end < 0) end = off + 2;
+            off = ((l & 0x3f) << 8) | s[off + 1];
+            continue;
+        }
+        if ((l & 0xc0) || off + 1 + l > n) return -1;
+        if (out) {
+            if (!out->empty()) out->append('.');
+            out->append((const char*)s + off + 1, l);
+        }
+        off += 1 + l;
+    }
+    return end >= 0 ? end : off;
+}
+
+// parse the response to @q, return -2 if it is truncated
+static int parse(const char* p, int n, Query& q, const fastring& name) {
+    const uint8* s = (const uint8*)p;
+    q.ips.clear();
+    if (n < 12 || get16(s) != q.id || !(s[2] & 0x80)) return -1;
+    if (s[2] & 0x02) return -2;
+    const int rcode = s[3] & 0x0f;
+    if (rcode != 0 && rcode != 3) return -1; // SERVFAIL, REFUSED...
+    const int qd = get16(s + 4), an = get16(s + 6), ns = get16(s + 8);
+    if (qd != 1) return -1;
+
+    fastring x;
+    int off = read_name(s, n, 12, &x);
+    if (off < 0 || off + 4 > n || get16(s + off) != q.type) return -1;
+    if (x.size() != name.size() || x.lower() != name) return -1;
+    off += 4;
+
+    uint32 ttl = (uint32)-1;
+    for (int i = 0; i < an + ns; ++i) {
+        if ((off = read_name(s, n, off, 0)) < 0 || off + 10 > n) return -1;
+        const uint16 type = get16(s + off);
+        const uint32 t = get32(s + off + 4);
+        const int len = get16(s + off + 8);
+        const int rd = off + 10;
+        if (rd + len > n) return -1;
+        off = rd + len;
+
+        if (i < an) {
+            // addresses, and CNAMEs leading to them
+            if (type == kA && q.type == kA && len == 4) {
+                char ip[INET_ADDRSTRLEN] = { 0 };
+                inet_ntop(AF_INET, (void*)(s + rd), ip, sizeof(ip));
+                q.ips.push_back(fastring(ip));
+            } else if (type == kAAAA && q.type == kAAAA && len == 16) {
+                char ip[INET6_ADDRSTRLEN] = { 0 };
+                inet_ntop(AF_INET6, (void*)(s + rd), ip, sizeof(ip));
+                q.ips.push_back(fastring(ip));
+            } else if (type != kCname) {
+                continue;
+            }
+            if (t < ttl) ttl = t;
+        } else if (type == kSoa && q.ips.empty()) {
+            // TTL of negative results is the min of the SOA and its MINIMUM field
+            int k = read_name(s, n, rd, 0);
+            if (k > 0) k = read_name(s, n, k, 0);
+            if (k > 0 && k + 20 <= rd + len) {
+                const uint32 m = get32(s + k + 16);
+                if (t < ttl) ttl = t;
+                if (m < ttl) ttl = m;
+            }
+        }
+    }
+
+    q.r = q.ips.empty() ? 0 : 1;
+    q.ttl = ttl != (uint32)-1 ? ttl : 0;
+    if (q.r == 0 && ttl == (uint32)-1) q.ttl = FLG_dns_negative_ttl;
+    return q.r;
+}
+
+// query over TCP, for truncated responses
+static int tcp_exchange(const Addr& srv, Query& q, const fastring& name, int ms) {
+    sock_t fd = co::tcp_socket(srv.v4.sin_family);
+    if (fd == (sock_t)-1) return -1;
+
+    int r = -1;
+    const int64 end = now::ms() + ms;
+    if (co::connect(fd, &srv, addr_len(srv), ms) == 0) {
+        fastring m(q.msg.size() + 2);
+        m.append((char)(q.msg.size() >> 8)).append((char)q.msg.size()).append(q.msg);
+        uint8 h[2];
+        int t = (int)(end - now::ms());
+        if (t > 0 && co::send(fd, m.data(), (int)m.size(), t) == (int)m.size() &&
+            (t = (int)(end - now::ms())) > 0 && co::recvn(fd, h, 2, t) == 2) {
+            const int n = get16(h);
+            fastring buf(n);
+            buf.resize(n);
+            if ((t = (int)(end - now::ms())) > 0 && co::recvn(fd, (void*)buf.data(), n, t) == n) {
+                r = parse(buf.data(), n, q, name);
+            }
+        }
+    }
+    co::close(fd);
+    return r < 0 ? -1 : r;
+}
+
+// send queries of all types to a server, and wait for the responses
+static bool exchange(const Addr& srv, Query* qs, int nq, const fastring& name, int ms) {
+    sock_t fd = co::udp_socket(srv.v4.sin_family);
+    if (fd == (sock_t)-1) return false;
+
+    const int64 end = now::ms() + ms;
+    int left = 0;
+    for (int i = 0; i < nq; ++i) {
+        if (qs[i].r >= 0) continue;
+        if (co::sendto(fd, qs[i].msg.data(), (int)qs[i].msg.size(), &srv, addr_len(srv), ms) <= 0) break;
+        ++left;
+    }
+
+    char buf[1536];
+    while (left > 0) {
+        const int t = (int)(end - now::ms());
+        if (t <= 0) break;
+        Addr from;
+        int len = (int)sizeof(from);
+        const int n = co::recvfrom(fd, buf, sizeof(buf), &from, &len, t);
+        if (n < 0) break;
+        if (n < 12 || !addr_eq(from, srv)) continue; // not from the server
+
+        const uint16 id = get16((const uint8*)buf);
+        for (int i = 0; i < nq; ++i) {
+            Query& q = qs[i];
+            if (q.r >= 0 || q.id != id) continue;
+            int r = parse(buf, n, q, name);
+            if (r == -2) r = tcp_exchange(srv, q, name, (int)(end - now::ms()));
+            if (r < 0) {
+                left = -1; // error of the server, try another one
+            } else {
+                --left;
+            }
+            break;
+        }
+        if (left < 0) break;
+    }
+
+    co::close(fd);
+    return left == 0;
+}
+
+// look up a full name, 1: found, 0: not found, -1: error
+static int ask(const Conf& c, const fastring& name, co::vector<fastring>& ips, uint32& ttl, int64 deadline) {
+    Query qs[2];
+    const int nq = FLG_dns_ipv6 ? 2 : 1;
+    if (!make_query(name, kA, qs[0])) return 0;
+    if (nq > 1 && !make_query(name, kAAAA, qs[1])) return 0;
+
+    for (uint32 a = 0; a < FLG_dns_attempts || a == 0; ++a) {
+        for (size_t i = 0; i < c.servers.size(); ++i) {
+            int t = (int)FLG_dns_timeout;
+            if (deadline >= 0) {
+                const int64 x = deadline - now::ms();
+                if (x <= 0) return -1;
+                if (x < t) t = (int)x;
+            }
+            if (!exchange(c.servers[i], qs, nq, name, t)) continue;
+
+            int r = 0;
+            ttl = (uint32)-1;
+            for (int k = 0; k < nq; ++k) {
+                if (qs[k].r == 1) r = 1;
+            }
+            for (int k = 0; k < nq; ++k) {
+                if (qs[k].r != r) continue;
+                ips.insert(ips.end(), qs[k].ips.begin(), qs[k].ips.end());
+                if (qs[k].ttl < ttl) ttl = qs[k].ttl;
+            }
+            return r;
+        }
+    }
+    return -1;
+}
+
+// look up a name with the search domains
+static int query(const Conf& c, const fastring& name, co::vector<fastring>& ips, uint32& ttl, int64 deadline) {
+    co::vector<fastring> names;
+    if (name.ends_with('.')) {
+        names.push_back(name.substr(0, name.size() - 1));
+    } else {
+        int dots = 0;
+        for (size_t i = 0; i < name.size(); ++i) if (name[i] == '.') ++dots;
+        if (dots >= c.ndots || c.search.empty()) names.push_back(name);
+        for (size_t i = 0; i < c.search.size(); ++i) {
+            names.push_back(fastring(name.size() + c.search[i].size() + 1).append(name).append('.').append(c.search[i]));
+        }
+        if (dots < c.ndots && !c.search.empty()) names.push_back(name);
+    }
+
+    uint32 neg = FLG_dns_negative_ttl;
+    for (size_t i = 0; i < names.size(); ++i) {
+        uint32 t = 0;
+        const int r = ask(c, names[i], ips, t, deadline);
+        if (r < 0) return -1;
+        if (r == 1) { ttl = t; return 1; }
+        if (t < neg) neg = t;
+    }
+    ttl = neg;
+    return 0;
+}
+
+// getaddrinfo() of the system, in the thread pool for coroutines
+static bool sys_resolve(const fastring& name, co::vector<fastring>& ips) {
+    struct R {
+        fastring name;
+        co::vector<fastring> ips;
+    };
+    // not on the stack, which may be used by others while the coroutine waits
+    R* x = co::make<R>();
+    x->name = name;
+    auto f = [x]() {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = FLG_dns_ipv6 ? AF_UNSPEC : AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* info = 0;
+        if (getaddrinfo(x->name.c_str(), NULL, &hints, &info) != 0) return;
+        for (auto p = info; p; p = p->ai_next) {
+            if (p->ai_family == AF_INET) {
+                x->ips.push_back(co::ip_str((struct sockaddr_in*)p->ai_addr));
+            } else if (p->ai_family == AF_INET6) {
+                x->ips.push_back(co::ip_str((struct sockaddr_in6*)p->ai_addr));
+            }
+        }
+        freeaddrinfo(info);
+    };
+    co::scheduler() ? co::offload(f) : f();
+
+    const bool ok = !x->ips.empty();
+    ips.insert(ips.end(), x->ips.begin(), x->ips.end());
+    co::del(x);
+    return ok;
+}
+
+struct Entry {
+    co::vector<fastring> ips; // empty if the name was not found
+    int64 expire;             // in ms, by now::ms()
+};
+
+class Cache {
+  public:
+    Cache() = default;
+    ~Cache() = delete;
+
+    bool resolve(const Conf& c, const fastring& name, co::vector<fastring>& ips, int ms);
+
+    void clear() {
+        std::lock_guard<std::mutex> g(_m);
+        _map.clear();
+    }
+
+  private:
+    // copy the result to @ips
+    static bool get(const Entry& e, co::vector<fastring>& ips) {
+        ips.insert(ips.end(), e.ips.begin(), e.ips.end());
+        return !e.ips.empty();
+    }
+
+    void put(const fastring& name, const co::vector<fastring>& ips, uint32 ttl);
+
+    std::mutex _m;
+    co::hash_map<fastring, Entry> _map;
+    co::hash_map<fastring, co::Event> _pending; // names being queried
+};
+
+bool Cache::resolve(const Conf& c, const fastring& name, co::vector<fastring>& ips, int ms) {
+    const int64 deadline = ms < 0 ? -1 : now::ms() + ms;
+    std::unique_lock<std::mutex> g(_m);
+    auto it = _map.find(name);
+    if (it != _map.end()) {
+        if (it->second.expire > now::ms()) return get(it->second, ips);
+        _map.erase(it);
+    }
+
+    // join the query in progress
+    auto p = _pending.find(name);
+    if (p != _pending.end()) {
+        co::Event ev(p->second);
+        g.unlock();
+        ev.wait(ms < 0 ? (uint32)-1 : (uint32)ms);
+        g.lock();
+        it = _map.find(name);
+        return it != _map.end() ? get(it->second, ips) : false;
+    }
+
+    co::Event ev;
+    _pending.emplace(name, ev);
+    g.unlock();
+
+    co::vector<fastring> v;
+    uint32 ttl = 0;
+    const int r = query(c, name, v, ttl, deadline);
+    if (r < 0) DLOG << "dns query " << name << " failed";
+
+    g.lock();
+    if (r >= 0) this->put(name, v, ttl);
+    _pending.erase(name);
+    g.unlock();
+    ev.signal();
+
+    ips.insert(ips.end(), v.begin(), v.end());
+    return r == 1;
+}
+
+void Cache::put(const fastring& name, const co::vector<fastring>& ips, uint32 ttl) {
+    const uint32 max = ips.empty() ? FLG_dns_negative_ttl : FLG_dns_max_ttl;
+    if (ttl > max) ttl = max;
+    const int64 now = now::ms();
+
+    if (_map.size() >= FLG_dns_cache_size && _map.find(name) == _map.end()) {
+        for (auto it = _map.begin(); it != _map.end();) {
+            if (it->second.expire <= now) {
+                it = _map.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!_map.empty() && _map.size() >= FLG_dns_cache_size) _map.erase(_map.begin());
+    }
+
+    // it is kept even if ttl is 0, for coroutines waiting for the query
+    Entry& e = _map[name];
+    e.ips = ips;
+    e.expire = now + (int64)ttl * 1000;
+}
+
+inline Cache& cache() {
+    static auto c = co::static_new<Cache>();
+    return *c;
+}
+
+bool resolve(const char* host, co::vector<fastring>& ips, int ms) {
+    if (!host || !*host) return false;
+
+    Addr a;
+    if (co::init_ip_addr(&a.v4, host, 0) || co::init_ip_addr(&a.v6, host, 0)) {
+        ips.push_back(fastring(host));
+        return true;
+    }
+
+    fastring name(host);
+    name.tolower();
+    const Conf& c = conf();
+    auto it = c.hosts.find(name.ends_with('.') ? name.substr(0, name.size() - 1) : name);
+    if (it != c.hosts.end()) {
+        ips.insert(ips.end(), it->second.begin(), it->second.end());
+        return true;
+    }
+
+    if (c.servers.empty() || !co::scheduler()) return sys_resolve(name, ips);
+    return cache().resolve(c, name, ips, ms);
+}
+
+void clear_cache() {
+    cache().clear();
+}
+
+} // dns
@@ -1,17 +1,45 @@
 #include "./http.h"
 #include "co/http.h"
 #include "co/tcp.h"
+#include "co/dns.h"
 #include "co/co.h"
 #include "co/god.h"
 #include "co/fastream.h"
 #include "co/stl.h"
+#include "co/flat_hash_map.h"
 #include "co/time.h"
+#include "co/histogram.h"
+#include "co/metrics.h"
 #include "co/fs.h"
 #include "co/path.h"
 #include "co/lru_map.h"
+#include "co/concurrent_lru.h"
+#include "co/str.h"
+#include "co/tracing.h"
+#include <mutex>
 
 #ifdef HAS_LIBCURL
 #include <curl/curl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HTTP_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_AVX2 // runtime dispatch
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define HTTP_NEON
+#include <arm_neon.h>
 #endif
 
 DEF_uint32(http_max_header_size, 4096, ">>#2 max size of http header");
@@ -23,6 +51,26 @@ DEF_uint32(http_send_timeout, 3000, ">>#2 send timeout in ms for http server");
 DEF_uint32(http_conn_idle_sec, 180, ">>#2 if a connection was idle for this seconds, the server may reset it");
 DEF_uint32(http_max_idle_conn, 128, ">>#2 max idle connections for http server");
 DEF_bool(http_log, true, ">>#2 enable http server log if true");
+DEF_uint32(http_park_idle_ms, 0, ">>#2 if > 0, a keep-alive connection idle for this many ms is parked "
+    "in epoll without a coroutine, until the next request arrives, or it is closed after http_conn_idle_sec, linux only");
+DEF_bool(http_curl_multi, true, ">>#2 http::Client drives libcurl by a curl multi handle of each scheduler, linux only");
+DEF_uint32(http_cache_size, 1024, ">>#2 max responses cached by http::Server::cache()");
+DEF_bool(http2, true, ">>#2 support HTTP/2 in http::Server, by ALPN on https or with prior knowledge on http");
+
+// flags that can be changed at runtime by flag::update()
+static bool _mutable_flags = []() {
+    flag::set_mutable("http_timeout");
+    flag::set_mutable("http_conn_timeout");
+    flag::set_mutable("http_recv_timeout");
+    flag::set_mutable("http_send_timeout");
+    flag::set_mutable("http_max_idle_conn");
+    return true;
+}();
+DEF_counter(co_http_requests_total, "requests served by http::Server");
+DEF_counter(co_http_cache_hits_total, "responses served from the cache of http::Server");
+DEF_histogram(co_http_request_us, "time in microseconds of the req callback of http::Server");
+DEC_bool(http_compress);
+DEC_uint32(http_compress_min_size);
 
 #define HTTPLOG LOG_IF(FLG_http_log)
 
@@ -52,6 +100,7 @@ struct curl_ctx_t {
 
     ~curl_ctx_t() {
         if (l) { curl_slist_free_all(l); l = 0; }
+        if (resolve_l) { curl_slist_free_all(resolve_l); resolve_l = 0; }
         if (easy) { curl_easy_cleanup(easy); easy = 0; }
         if (arr) { co::free(arr, arr_cap << 2); arr = 0; }
     }
@@ -84,6 +133,9 @@ struct curl_ctx_t {
     CURL* easy;
     struct curl_slist* l;
     fs::file upfile; // for PUT, the file to upload
+    fastring host;   // name of the server, empty if it is an ip
+    fastring resolved; // "host:port:ip,ip..." set by CURLOPT_RESOLVE
+    struct curl_slist* resolve_l;
     bool header_updated;
     char err[CURL_ERROR_SIZE];
 };
@@ -130,9 +182,59 @@ void Client::close() {
     if (_ctx) { _ctx->~curl_ctx_t(); co::free(_ctx, sizeof(*_ctx)); _ctx = 0; }
 }
 
+// "unix:/path" or "http://unix:/path" is a unix domain socket, requests are sent to
+// "http://localhost" over it then. "@name" is in the abstract namespace of linux.
+static bool set_unix_socket(curl_ctx_t* ctx) {
+    fastring& u = ctx->serv_url;
+    size_t b = u.find("://");
+    b = b == u.npos ? 0 : b + 3;
+    fastring path;
+    if (u.size() > b + 5 && memcmp(u.data() + b, "unix:", 5) == 0) {
+        path = u.substr(b + 5);
+        u.resize(b);
+        u.append("localhost");
+    }
+
+    CURL* const e = ctx->easy;
+    if (!path.empty() && path[0] == '@') {
+        curl_easy_setopt(e, CURLOPT_UNIX_SOCKET_PATH, (char*)0);
+        curl_easy_setopt(e, CURLOPT_ABSTRACT_UNIX_SOCKET, path.c_str() + 1);
+    } else {
+        curl_easy_setopt(e, CURLOPT_ABSTRACT_UNIX_SOCKET, (char*)0);
+        curl_easy_setopt(e, CURLOPT_UNIX_SOCKET_PATH, path.empty() ? (char*)0 : path.c_str());
+    }
+    return !path.empty();
+}
+
+// get host:port out of the server url, so that the name is resolved by dns::resolve()
+static void parse_host(curl_ctx_t* ctx) {
+    const fastring& u = ctx->serv_url;
+    ctx->host.clear();
+    if (set_unix_socket(ctx)) return;
+    size_t b = u.find("://");
+    b = b == u.npos ? 0 : b + 3;
+    size_t e = u.find('/', b);
+    if (e == u.npos) e = u.size();
+    if (b < e && u[b] == '[') return; // ipv6
+
+    const size_t p = u.find(':', b);
+    const fastring name = u.substr(b, (p < e ? p : e) - b);
+    struct sockaddr_in a;
+    if (name.empty() || co::init_ip_addr(&a, name.c_str(), 0)) return;
+
+    const char* port = u.starts_with("https://") ? "443" : "80";
+    ctx->host << name << ':';
+    if (p < e) {
+        ctx->host.append(u.data() + p + 1, e - p - 1);
+    } else {
+        ctx->host.append(port);
+    }
+}
+
 void Client::reset(const char* serv_url) {
     if (_ctx) {
         _ctx->serv_url = serv_url;
+        parse_host(_ctx);
     } else {
         static curl_global g;
         _ctx = (curl_ctx_t*) co::zalloc(sizeof(curl_ctx_t));
@@ -149,6 +251,7 @@ void Client::reset(const char* serv_url) {
         s.strip('/', 'r'); // remove '/' at the right side
 
         init_easy_opts(_ctx->easy, _ctx);
+        parse_host(_ctx);
     }
 }
 
@@ -238,6 +341,221 @@ void* Client::easy_handle() const {
     return (void*)_ctx->easy;
 }
 
+// resolve the server by dns::resolve(), rather than the blocking resolver of libcurl
+void Client::resolve() {
+    if (_ctx->host.empty()) return;
+    const size_t p = _ctx->host.rfind(':');
+    co::vector<fastring> ips;
+    if (!dns::resolve(_ctx->host.substr(0, p), ips, FLG_http_conn_timeout)) return;
+
+    fastring s(_ctx->host.size() + ips.size() * 16);
+    s << _ctx->host << ':';
+    for (size_t i = 0; i < ips.size(); ++i) {
+        if (i > 0) s << ',';
+        if (ips[i].find(':') != ips[i].npos) {
+            s << '[' << ips[i] << ']';
+        } else {
+            s << ips[i];
+        }
+    }
+    if (s == _ctx->resolved) return;
+
+    // remove the old addresses in the dns cache of libcurl, and add the new ones
+    struct curl_slist* l = 0;
+    const fastring& r = _ctx->resolved;
+    if (!r.empty()) {
+        const size_t k = r.find(':', r.find(':') + 1);
+        l = curl_slist_append(l, (fastring("-") << r.substr(0, k)).c_str());
+        if (!l) return;
+    }
+    struct curl_slist* x = curl_slist_append(l, s.c_str());
+    if (!x) {
+        if (l) curl_slist_free_all(l);
+        return;
+    }
+    curl_easy_setopt(_ctx->easy, CURLOPT_RESOLVE, x);
+    if (_ctx->resolve_l) curl_slist_free_all(_ctx->resolve_l);
+    _ctx->resolve_l = x;
+    _ctx->resolved.swap(s);
+}
+
+#ifdef __linux__
+/**
+ * a curl multi handle of a scheduler, for all the http::Clients in it 
+ *   - Sockets of libcurl are added to a private epoll by the socket callback, 
+ *     and a coroutine waits for the epoll in the scheduler, the same as the 
+ *     hooked epoll_wait() does. Timers of libcurl are the timeout of the wait, 
+ *     and an eventfd wakes it up when libcurl wants an earlier timeout. 
+ *   - The coroutine runs only while there are transfers. Transfers share the 
+ *     connection cache of the multi handle. 
+ *   - Everything runs in the scheduler, no lock is needed. 
+ */
+class MultiClient {
+  public:
+    MultiClient();
+    ~MultiClient() = delete;
+
+    // perform the request of the easy handle, it blocks the coroutine until done
+    CURLcode perform(CURL* e);
+
+  private:
+    struct waiter_t {
+        co::Event ev;
+        CURLcode rc;
+    };
+
+    void loop();
+    void check_done();
+    void wakeup() { const uint64 x = 1; (void)::write(_efd, &x, sizeof(x)); }
+    static int on_socket(CURL* e, curl_socket_t s, int what, void* userp, void* socketp);
+    static int on_timer(CURLM* m, long ms, void* userp);
+
+    CURLM* _m;
+    int _ep;
+    int _efd;
+    uint32 _n;       // transfers in progress
+    int64 _deadline; // time in ms of the timer of libcurl, -1 if not set
+    int64 _wake_at;  // time in ms the loop wakes up, while it is waiting
+    bool _running;   // whether the loop is running
+    bool _waiting;   // whether the loop is waiting for the epoll
+};
+
+MultiClient::MultiClient()
+    : _n(0), _deadline(-1), _wake_at(0), _running(false), _waiting(false) {
+    _m = curl_multi_init();
+    CHECK(_m) << "curl multi init failed..";
+    _ep = epoll_create1(EPOLL_CLOEXEC);
+    CHECK(_ep >= 0) << "epoll create failed: " << co::strerror();
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK(_efd >= 0) << "eventfd create failed: " << co::strerror();
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _efd;
+    CHECK_EQ(epoll_ctl(_ep, EPOLL_CTL_ADD, _efd, &ev), 0);
+    curl_multi_setopt(_m, CURLMOPT_SOCKETFUNCTION, &MultiClient::on_socket);
+    curl_multi_setopt(_m, CURLMOPT_SOCKETDATA, (void*)this);
+    curl_multi_setopt(_m, CURLMOPT_TIMERFUNCTION, &MultiClient::on_timer);
+    curl_multi_setopt(_m, CURLMOPT_TIMERDATA, (void*)this);
+}
+
+int MultiClient::on_socket(CURL*, curl_socket_t s, int what, void* userp, void*) {
+    MultiClient* const m = (MultiClient*)userp;
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(m->_ep, EPOLL_CTL_DEL, s, 0);
+        return 0;
+    }
+    epoll_event ev;
+    ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+    ev.data.fd = s;
+    if (epoll_ctl(m->_ep, EPOLL_CTL_MOD, s, &ev) != 0) {
+        if (errno != ENOENT || epoll_ctl(m->_ep, EPOLL_CTL_ADD, s, &ev) != 0) {
+            ELOG << "curl multi epoll_ctl error: " << co::strerror() << ", fd: " << s;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int MultiClient::on_timer(CURLM*, long ms, void* userp) {
+    MultiClient* const m = (MultiClient*)userp;
+    m->_deadline = ms < 0 ? -1 : now::ms() + ms;
+    if (m->_waiting && m->_deadline >= 0 && m->_deadline < m->_wake_at) m->wakeup();
+    return 0;
+}
+
+CURLcode MultiClient::perform(CURL* e) {
+    // on the heap, as stacks of coroutines may be shared
+    waiter_t* const w = co::make<waiter_t>();
+    w->rc = CURLE_OK;
+    curl_easy_setopt(e, CURLOPT_PRIVATE, (void*)w);
+    const CURLMcode r = curl_multi_add_handle(_m, e);
+    if (r != CURLM_OK) {
+        ELOG << "curl multi add handle error: " << curl_multi_strerror(r);
+        co::del(w);
+        return CURLE_FAILED_INIT;
+    }
+    ++_n;
+    if (!_running) {
+        _running = true;
+        co::scheduler()->go(&MultiClient::loop, this);
+    }
+    w->ev.wait();
+    const CURLcode rc = w->rc;
+    co::del(w);
+    return rc;
+}
+
+// signal the waiters of finished transfers
+void MultiClient::check_done() {
+    int left = 0;
+    CURLMsg* msg;
+    while ((msg = curl_multi_info_read(_m, &left))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL* const e = msg->easy_handle;
+        const CURLcode rc = msg->data.result;
+        waiter_t* w = 0;
+        curl_easy_getinfo(e, CURLINFO_PRIVATE, (char**)&w);
+        curl_multi_remove_handle(_m, e);
+        --_n;
+        w->rc = rc;
+        w->ev.signal();
+    }
+}
+
+void MultiClient::loop() {
+    co::IoEvent ev(_ep, co::ev_read);
+    epoll_event evs[64];
+    int running = 0;
+    bool busy = false; // events may be left in the epoll
+    while (_n > 0) {
+        // wait at most 1s, in case a timer is missed
+        const int64 t = now::ms();
+        int64 ms = busy ? 0 : (_deadline < 0 ? 1000 : _deadline - t);
+        if (ms < 0) ms = 0;
+        if (ms > 1000) ms = 1000;
+        _wake_at = t + ms;
+        _waiting = true;
+        ev.wait((uint32)ms);
+        _waiting = false;
+
+        busy = true;
+        for (int i = 0; i < 8; ++i) {
+            const int n = epoll_wait(_ep, evs, 64, 0);
+            if (n <= 0) { busy = false; break; }
+            for (int k = 0; k < n; ++k) {
+                const int fd = evs[k].data.fd;
+                if (fd == _efd) {
+                    uint64 x;
+                    (void)::read(_efd, &x, sizeof(x));
+                    continue;
+                }
+                const uint32 x = evs[k].events;
+                const int f = ((x & EPOLLIN) ? CURL_CSELECT_IN : 0) | ((x & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                    ((x & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+                curl_multi_socket_action(_m, fd, f, &running);
+            }
+        }
+
+        if (_deadline >= 0 && now::ms() >= _deadline) {
+            _deadline = -1;
+            curl_multi_socket_action(_m, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        this->check_done();
+    }
+    _running = false;
+}
+
+// null if it is not called in a scheduler
+inline MultiClient* multi_client() {
+    static auto v = co::static_new<co::vector<MultiClient*>>(co::scheduler_num(), (MultiClient*)0);
+    const int i = co::scheduler_id();
+    if (i < 0) return 0;
+    MultiClient*& m = (*v)[i];
+    if (!m) m = co::static_new<MultiClient>();
+    return m;
+}
+#endif
+
 void Client::perform() {
     CHECK(co::scheduler()) << "must be called in coroutine..";
     _ctx->clear();
@@ -245,6 +563,13 @@ void Client::perform() {
         curl_easy_setopt(_ctx->easy, CURLOPT_HTTPHEADER, _ctx->l);
         _ctx->header_updated = false;
     }
+    this->resolve();
+#ifdef __linux__
+    if (FLG_http_curl_multi) {
+        multi_client()->perform(_ctx->easy);
+        return;
+    }
+#endif
     curl_easy_perform(_ctx->easy);
 }
 
@@ -382,8 +707,8 @@ inline const char* method_str(int m) {
     return s[m];
 }
 
-static co::hash_map<fastring, int>* create_method_map() {
-    static co::hash_map<fastring, int> m;
+static co::flat_hash_map<fastring, int>* create_method_map() {
+    static co::flat_hash_map<fastring, int> m;
     m["GET"]     = kGet;
     m["POST"]    = kPost;
     m["HEAD"]    = kHead;
@@ -445,7 +770,42 @@ inline const char* status_str(int n) {
 }
 
 
-inline void http_req_t::add_header(uint32 k, uint32 v) {
+// case-insensitive compare of n bytes, @b is in lower case, letters and '-' only
+inline bool lower_eq(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (b[i] == '-' ? a[i] != '-' : (a[i] | 0x20) != b[i]) return false;
+    }
+    return true;
+}
+
+inline bool icase_eq(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i] && ::tolower((uint8)a[i]) != ::tolower((uint8)b[i])) return false;
+    }
+    return true;
+}
+
+// index of a known header, -1 if @k is not a known header
+inline int known_header(const char* k, size_t n) {
+    switch (n) {
+      case 4:
+        return lower_eq(k, "host", 4) ? kHost : -1;
+      case 6:
+        return lower_eq(k, "expect", 6) ? kExpect : -1;
+      case 10:
+        return lower_eq(k, "connection", 10) ? kConnection : -1;
+      case 12:
+        return lower_eq(k, "content-type", 12) ? kContentType : -1;
+      case 14:
+        return lower_eq(k, "content-length", 14) ? kContentLength : -1;
+      case 17:
+        return lower_eq(k, "transfer-encoding", 17) ? kTransferEncoding : -1;
+      default:
+        return -1;
+    }
+}
+
+void http_req_t::add_header(uint32 k, uint32 n, uint32 v) {
     if (arr_cap < arr_size + 2) {
         arr = (uint32*) co::realloc(arr, arr_cap << 2, (arr_cap + 32) << 2);
         assert(arr);
@@ -453,34 +813,76 @@ inline void http_req_t::add_header(uint32 k, uint32 v) {
     }
     arr[arr_size++] = k;
     arr[arr_size++] = v;
+
+    // the first one is used if a header appears more than once
+    const int i = known_header(buf->data() + k, n);
+    if (i >= 0 && known[i] == 0) known[i] = v;
 }
 
 const char* http_req_t::header(const char* key) const {
-    fastring& s = fastring_cache();
-    fastring x(key);
-    x.toupper();
+    static const char* e = "";
+    const size_t n = strlen(key);
+    const int x = known_header(key, n);
+    if (x >= 0) return known[x] ? buf->data() + known[x] : e;
 
     for (uint32 i = 0; i < arr_size; i += 2) {
-        s.clear();
-        s.append(buf->data() + arr[i]).toupper();
-        if (s == x) return buf->data() + arr[i + 1];
+        const char* const k = buf->data() + arr[i];
+        if (icase_eq(k, key, n) && k[n] == '\0') return buf->data() + arr[i + 1];
     }
-
-    static const char* e = "";
     return e;
 }
 
 
-void http_res_t::set_body(const void* s, size_t n) {
-    body_size = n;
+// status line and headers, for a body of n bytes
+void http_res_t::make_header(int64 n) {
     if (status == 0) status = 200;
     buf->clear();
-    (*buf) << version_str(version) << ' ' << status << ' ' << status_str(status) << "\r\n"
-           << "Content-Length: " << n << "\r\n"
-           << header << "\r\n";
+    (*buf) << version_str(version) << ' ' << status << ' ' << status_str(status) << "\r\n";
+    if (status == 204 || status == 304) {
+        /* no body, and no Content-Length */
+    } else if (n >= 0) {
+        (*buf) << "Content-Length: " << n << "\r\n";
+    } else {
+        (*buf) << "Transfer-Encoding: chunked\r\n";
+    }
+    (*buf) << header << "\r\n";
+}
+
+void http_res_t::set_body(const void* s, size_t n) {
+    body_size = n;
+    body = 0;
+    iob.clear();
+    this->make_header(n);
     buf->append(s, n);
 }
 
+void http_res_t::set_body_ref(const void* s, size_t n) {
+    body_size = n;
+    body = (const char*)s;
+    iob.clear();
+    this->make_header(n);
+}
+
+void http_res_t::set_body(co::iobuf&& b) {
+    body_size = b.size();
+    body = 0;
+    iob = std::move(b);
+    this->make_header(body_size);
+}
+
+bool http_res_t::set_file(const char* path) {
+    if (!file.open(path, 'r')) return false;
+    const int64 n = file.size();
+    if (n < 0) { file.close(); return false; }
+
+    file_size = n;
+    body_size = 0;
+    body = 0;
+    iob.clear();
+    this->make_header(n);
+    return true;
+}
+
 const char* Req::header(const char* key) const {
     return _p->header(key);
 }
@@ -491,9 +893,7 @@ const char* Req::body() const {
 
 Req::~Req() {
     if (_p) {
-        _p->url.~fastring();
-        co::free(_p->arr, _p->arr_cap << 2);
-        co::free(_p, sizeof(*_p));
+        free_http_req(_p);
         _p = 0;
     }
 }
@@ -510,38 +910,143 @@ void Res::set_body(const void* s, size_t n) {
     _p->set_body(s, n);
 }
 
+void Res::set_body_ref(const void* s, size_t n) {
+    _p->set_body_ref(s, n);
+}
+
+void Res::set_body(co::iobuf&& b) {
+    _p->set_body(std::move(b));
+}
+
+void Res::set_body(const co::iobuf& b) {
+    _p->set_body(co::iobuf(b));
+}
+
+bool Res::set_file(const char* path) {
+    return _p->set_file(path);
+}
+
 Res::~Res() {
     if (_p) {
-        _p->header.~fastring();
-        co::free(_p, sizeof(*_p));
+        free_http_res(_p);
         _p = 0;
     }
 }
 
+/**
+ * SIMD scanning for the header parser
+ *   - find_eol() finds the '\r' at the end of a header line, and the first ':'
+ *     before it, in one pass.
+ *   - 16 bytes at a time with SSE2 or NEON, and 32 bytes with AVX2 for long
+ *     lines if the cpu supports it. The tail, and the whole line on other
+ *     platforms, is scanned byte by byte.
+ */
+#if defined(HTTP_SSE2) || defined(HTTP_NEON)
+#ifdef _MSC_VER
+inline uint32 _ctz(uint32 x) { unsigned long r; _BitScanForward(&r, x); return r; }
+#else
+inline uint32 _ctz(uint32 x) { return __builtin_ctz(x); }
+#endif
+#endif
+
+typedef const char* S;
+
+#ifdef HTTP_AVX2
+inline bool _has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// false before it is initialized, SSE2 is used then
+static const bool g_has_avx2 = _has_avx2();
+
+// returns the first '\r', or the position where less than 32 bytes are left
+__attribute__((target("avx2")))
+static S find_eol_avx2(S b, S e, S* colon) {
+    const __m256i r = _mm256_set1_epi8('\r');
+    const __m256i c = _mm256_set1_epi8(':');
+    for (; b + 32 <= e; b += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const uint32 mc = *colon ? 0 : (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, c));
+        const uint32 mr = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, r));
+        if (mc && (!mr || _ctz(mc) < _ctz(mr))) *colon = b + _ctz(mc);
+        if (mr) return b + _ctz(mr);
+    }
+    return b;
+}
+#endif
+
+#ifdef HTTP_NEON
+// 4 bits for each byte of a compare result
+inline uint64 _neon_mask(uint8x16_t c) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(c), 4)), 0);
+}
+#endif
+
+// find the first '\r' in [b, e), NULL if not found. @colon is set to the first
+// ':' before it, or NULL if there is no ':'.
+inline S find_eol(S b, S e, S* colon) {
+    *colon = 0;
+#if defined(HTTP_AVX2)
+    if (e - b >= 64 && g_has_avx2) {
+        b = find_eol_avx2(b, e, colon);
+        if (b + 32 <= e) return b; // found before the tail
+    }
+#endif
+#if defined(HTTP_SSE2)
+    const __m128i r = _mm_set1_epi8('\r');
+    const __m128i c = _mm_set1_epi8(':');
+    for (; b + 16 <= e; b += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const uint32 mc = *colon ? 0 : (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, c));
+        const uint32 mr = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, r));
+        if (mc && (!mr || _ctz(mc) < _ctz(mr))) *colon = b + _ctz(mc);
+        if (mr) return b + _ctz(mr);
+    }
+#elif defined(HTTP_NEON)
+    const uint8x16_t r = vdupq_n_u8('\r');
+    const uint8x16_t c = vdupq_n_u8(':');
+    for (; b + 16 <= e; b += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8*)b);
+        const uint64 mc = *colon ? 0 : _neon_mask(vceqq_u8(x, c));
+        const uint64 mr = _neon_mask(vceqq_u8(x, r));
+        if (mc && (!mr || __builtin_ctzll(mc) < __builtin_ctzll(mr))) {
+            *colon = b + (__builtin_ctzll(mc) >> 2);
+        }
+        if (mr) return b + (__builtin_ctzll(mr) >> 2);
+    }
+#endif
+    for (; b < e; ++b) {
+        if (*b == '\r') return b;
+        if (*b == ':' && !*colon) *colon = b;
+    }
+    return 0;
+}
+
 // @x  beginning of http header
 int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req) {
     fastring& m = *buf;
-    size_t p, k, v;
+    S const s = m.data();
+    S p, v;
 
     while (x < size) {
-        p = m.find('\r', x, size - x); // header end
-        if (p == m.npos || m[p + 1] != '\n') return 400;
-        m[p] = '\0'; // make value null-terminated
-
-        k = x; // key
-        v = m.find(':', x, p - x);
-        if (v == m.npos) return 400;
-        m[v] = '\0'; // make key null-terminated
-        while (m[++v] == ' ');
-        req->add_header((uint32)k, (uint32)v);
-
-        x = p + 2;
+        p = find_eol(s + x, s + size, &v); // header end
+        if (p == 0 || p[1] != '\n') return 400;
+        if (v == 0) return 400;
+        m[p - s] = '\0'; // make value null-terminated
+        m[v - s] = '\0'; // make key null-terminated
+
+        const size_t k = x; // key
+        const size_t n = v - s - k;
+        while (*++v == ' ');
+        req->add_header((uint32)k, (uint32)n, (uint32)(v - s));
+        x = p - s + 2;
     }
     return 0;
 }
 
-int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
-    static co::hash_map<fastring, int>* mm = create_method_map();
+int parse_http_req(fastring* buf, size_t size, http_req_t* req, bool stream) {
+    static co::flat_hash_map<fastring, int>* mm = create_method_map();
     fastring& m = *buf;
     req->buf = buf;
 
@@ -593,6 +1098,12 @@ int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
         if (*v == '\0' || *v == '0') {
             req->body_size = 0;
             return 0;
+        } else if (stream) {
+            const char* p = v;
+            while ('0' <= *p && *p <= '9') ++p;
+            if (*p == '\0') return 0; // body_size is 0, as it is not buffered
+            ELOG << "http parse error, invalid content-length: " << v;
+            return 400;
         } else {
             int n = atoi(v);
             if (n >= 0) {
@@ -606,19 +1117,167 @@ int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
     }
 }
 
+// responses of GET and HEAD requests cached by Server::cache()
+//   - Responses are keyed by the method, version and url of the request, and
+//     values of the vary headers, Accept-Encoding and Connection.
+//   - Requests missing the cache at the same time are coalesced, the first
+//     one runs the handler, others wait for its response.
+class ResCache {
+  public:
+    struct route_t {
+        fastring path;
+        bool prefix; // path ends with '*'
+        uint32 ttl;
+        co::vector<fastring> vary;
+    };
+
+    struct flight_t {
+        flight_t() : done(false) {}
+        co::Event ev;
+        co::shared_ptr<fastring> res;
+        bool done;
+    };
+
+    // a request missing the cache, the response is to be added by done()
+    struct miss_t {
+        miss_t() : ttl(0) {}
+        fastring key;
+        co::shared_ptr<flight_t> f;
+        uint32 ttl;
+    };
+
+    ResCache() : _lru(FLG_http_cache_size, 16) {}
+
+    void add(const char* path, uint32 ttl_ms, const char* vary) {
+        _routes.push_back(route_t());
+        route_t& r = _routes.back();
+        r.path = path;
+        r.prefix = r.path.ends_with('*');
+        if (r.prefix) r.path.resize(r.path.size() - 1);
+        r.ttl = ttl_ms;
+        if (vary && *vary) {
+            auto v = str::split(vary, ',');
+            for (auto& x : v) {
+                x.strip();
+                if (!x.empty()) r.vary.push_back(std::move(x));
+            }
+        }
+    }
+
+    // get the cached response of the request, or NULL on a miss
+    //   - @m is set if the caller is to run the handler and call done().
+    co::shared_ptr<fastring> get(http_req_t* req, miss_t& m);
+
+    void done(miss_t& m, http_res_t* res);
+
+  private:
+    const route_t* find_route(const fastring& url) const;
+
+  private:
+    co::vector<route_t> _routes;
+    co::ConcurrentLru<fastring, co::shared_ptr<fastring>> _lru;
+    co::hash_map<fastring, co::shared_ptr<flight_t>> _flights;
+    std::mutex _m;
+};
+
+inline const ResCache::route_t* ResCache::find_route(const fastring& url) const {
+    size_t n = url.find('?');
+    if (n == url.npos) n = url.size();
+    for (const route_t& r : _routes) {
+        if (r.prefix ? (n >= r.path.size() && memcmp(url.data(), r.path.data(), r.path.size()) == 0) :
+            (n == r.path.size() && memcmp(url.data(), r.path.data(), n) == 0)) {
+            return &r;
+        }
+    }
+    return NULL;
+}
+
+co::shared_ptr<fastring> ResCache::get(http_req_t* req, miss_t& m) {
+    co::shared_ptr<fastring> res;
+    if (req->method != kGet && req->method != kHead) return res;
+    const route_t* const r = this->find_route(req->url);
+    if (!r) return res;
+
+    fastring key(req->url.size() + 64);
+    key << req->method << ' ' << req->version << ' ' << req->url;
+    for (const fastring& h : r->vary) key << '\n' << req->header(h.c_str());
+    key << '\n' << req->header("Accept-Encoding") << '\n' << req->header("Connection");
+    if (_lru.get(key, res)) return res;
+
+    co::shared_ptr<flight_t> f;
+    {
+        std::lock_guard<std::mutex> g(_m);
+        auto it = _flights.find(key);
+        if (it == _flights.end()) {
+            f.reset(co::make<flight_t>());
+            _flights.insert(std::make_pair(key, f));
+            m.key = std::move(key);
+            m.f = std::move(f);
+            m.ttl = r->ttl;
+            return res;
+        }
+        f = it->second;
+    }
+
+    // the signal is passed on to the next waiter, as only one of the waiting
+    // coroutines may consume it
+    while (!atomic_load(&f->done, mo_acquire)) {
+        const bool x = f->ev.wait(FLG_http_recv_timeout);
+        f->ev.signal();
+        if (!x) break;
+    }
+    if (atomic_load(&f->done, mo_acquire)) res = f->res;
+    return res;
+}
+
+// only 200 responses in the buffer are cached, except those with a cookie or 
+// "Cache-Control: no-store"
+void ResCache::done(miss_t& m, http_res_t* res) {
+    if (!m.f) return;
+    if (res->status == 200 && res->body_in_buf() && res->file_size <= 0 &&
+        res->header.find("Set-Cookie") == res->header.npos &&
+        res->header.find("no-store") == res->header.npos) {
+        m.f->res.reset(co::make<fastring>(*res->buf));
+        _lru.set(m.key, m.f->res, m.ttl);
+    }
+    {
+        std::lock_guard<std::mutex> g(_m);
+        _flights.erase(m.key);
+    }
+    atomic_store(&m.f->done, true, mo_release);
+    m.f->ev.signal();
+    m.f.reset();
+}
+
 class ServerImpl {
   public:
     ServerImpl() : _started(false), _stopped(false) {}
     ~ServerImpl() = default;
 
     void on_req(std::function<void(const Req&, Res&)>&& f) {
-        _on_req = std::move(f);
+        _cb = std::move(f);
     }
 
+    void on_stream(std::function<void(const Req&, BodyReader&, Res&)>&& f) {
+        _scb = std::move(f);
+    }
+
+    void cache(const char* path, uint32 ttl_ms, const char* vary) {
+        if (!_cache) _cache.reset(co::make<ResCache>());
+        _cache->add(path, ttl_ms, vary);
+    }
+
+    void limit(uint32 max_conn, uint32 accept_rate) { _serv.limit(max_conn, accept_rate); }
+    void on_admit(std::function<bool(sock_t)>&& f) { _serv.on_admit(std::move(f)); }
+    void sched_policy(co::sched_policy_t p) { _serv.sched_policy(p); }
+
     void start(const char* ip, int port, const char* key, const char* ca);
 
     void on_connection(tcp::Connection conn);
 
+    // wait for the next request on a keep-alive connection, -2 if it was parked
+    int wait_next(tcp::Connection& conn, tcp::Reader& rd);
+
     void exit() {
         atomic_store(&_stopped, true);
         _serv.exit();
@@ -626,11 +1285,17 @@ class ServerImpl {
 
     bool started() const { return _started; }
 
+    const co::Histogram& histogram() const { return _hist; }
+
   private:
     bool _started;
     bool _stopped;
     tcp::Server _serv;
-    std::function<void(const Req&, Res&)> _on_req;
+    std::function<void(const Req&, Res&)> _cb;     // set by on_req()
+    std::function<void(const Req&, BodyReader&, Res&)> _scb; // set by on_stream()
+    std::function<void(const Req&, Res&)> _on_req; // _cb timed, for http/1 and http/2
+    co::unique_ptr<ResCache> _cache;               // set by cache()
+    co::Histogram _hist;
 };
 
 Server::Server() {
@@ -650,6 +1315,31 @@ Server& Server::on_req(std::function<void(const Req&, Res&)>&& f) {
     return *this;
 }
 
+Server& Server::on_stream(std::function<void(const Req&, BodyReader&, Res&)>&& f) {
+    ((ServerImpl*)_p)->on_stream(std::move(f));
+    return *this;
+}
+
+Server& Server::cache(const char* path, uint32 ttl_ms, const char* vary) {
+    ((ServerImpl*)_p)->cache(path, ttl_ms, vary);
+    return *this;
+}
+
+Server& Server::limit(uint32 max_conn, uint32 accept_rate) {
+    ((ServerImpl*)_p)->limit(max_conn, accept_rate);
+    return *this;
+}
+
+Server& Server::on_admit(std::function<bool(sock_t)>&& f) {
+    ((ServerImpl*)_p)->on_admit(std::move(f));
+    return *this;
+}
+
+Server& Server::sched_policy(co::sched_policy_t p) {
+    ((ServerImpl*)_p)->sched_policy(p);
+    return *this;
+}
+
 void Server::start(const char* ip, int port) {
     ((ServerImpl*)_p)->start(ip, port, NULL, NULL);
 }
@@ -662,11 +1352,62 @@ void Server::exit() {
     ((ServerImpl*)_p)->exit();
 }
 
+const co::Histogram& Server::histogram() const {
+    return ((const ServerImpl*)_p)->histogram();
+}
+
+// reply 503 to a connection rejected by the tcp server, without reading the
+// request. We shut down the writing side and drain the input for a while, so
+// that the client can read the response before the connection is closed.
+static void on_rejected(tcp::Connection conn) {
+    static const char s[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    if (conn.send(s, sizeof(s) - 1, FLG_http_send_timeout) == sizeof(s) - 1) {
+        co::shutdown(conn.socket(), 'w');
+        char buf[512];
+        for (int i = 0; i < 8 && conn.recv(buf, sizeof(buf), 100) > 0; ++i);
+    }
+    conn.reset();
+}
+
 void ServerImpl::start(const char* ip, int port, const char* key, const char* ca) {
-    CHECK(_on_req != NULL) << "req callback not set..";
+    CHECK(_cb != NULL || _scb != NULL) << "req callback not set..";
+    _on_req = [this](const Req& req, Res& res) {
+        Timer t(true);
+        {
+            tracing::context_t tc;
+            const char* const tp = req.header("traceparent");
+            const bool has = *tp && tracing::parse(tp, tc);
+            tracing::Span sp(has ? &tc : 0, "http", tracing::kServer);
+            if (sp.recording()) {
+                fastring s(req.url().size() + 8);
+                s << method_str(req.method()) << ' ' << req.url();
+                sp.set_name(s.data(), s.size());
+            }
+
+            if (!_scb) {
+                _cb(req, res);
+            } else {
+                // bodies of HTTP/2 requests are read from memory
+                http_req_t* const r = *(http_req_t**)&req;
+                http_body_t m(r->buf->data() + r->body, r->body_size);
+                BodyReader b(r->stream ? r->stream : &m);
+                _scb(req, b, res);
+            }
+            if (sp.recording()) {
+                const uint32 st = (*(http_res_t**)&res)->status;
+                sp.set_status(st ? (int32)st : 200);
+            }
+        }
+        const uint64 us = (uint64)t.us();
+        _hist.record(us);
+        MET_co_http_requests_total.inc();
+        MET_co_http_request_us.record(us);
+    };
     atomic_store(&_started, true, mo_relaxed);
     _serv.on_connection(&ServerImpl::on_connection, this);
     _serv.on_exit([this]() { co::del(this); });
+    _serv.on_reject(&on_rejected);
+    if (FLG_http2) _serv.alpn("\x02h2\x08http/1.1");
     _serv.start(ip, port, key, ca);
 }
 
@@ -677,6 +1418,152 @@ inline int hex2int(char c) {
     return -1;
 }
 
+// whether a complete http header is in [p, p + n)
+inline bool has_header(const char* p, size_t n) {
+    return fast::memmem(p, n, "\r\n\r\n", 4) != 0;
+}
+
+http_body_t::http_body_t(tcp::Connection* c, tcp::Reader* r, http_req_t* q, uint64 n, bool chunked)
+    : conn(c), rd(r), req(q), p(0), left(n), chunked(chunked), err(false) {
+    done = !chunked && n == 0;
+    expect = !done && strcmp(q->header("Expect"), "100-continue") == 0;
+}
+
+// read the size line of the next chunk, and trailing headers after the last one
+bool http_body_t::next_chunk() {
+    int r;
+    size_t x, o, i, n;
+    while (true) {
+        r = rd->read_until("\r\n", FLG_http_max_header_size, FLG_http_recv_timeout);
+        if (r <= 0) goto recv_err;
+        x = r - 2;
+        if (x > 0) break;
+        rd->consume(2);
+    }
+
+    { /* chunked data:  1a[;xxx]\r\ndata\r\n */
+        const char* const s = rd->data();
+        for (o = 0; o < x && s[o] != ';'; ++o);
+        if (o == 0 || o > 15) goto chunk_err;
+        for (i = 0, n = 0; i < o; ++i) {
+            if ((r = hex2int(s[i])) < 0) goto chunk_err;
+            n = (n << 4) + r;
+        }
+        rd->consume(x + 2);
+    }
+    if (n > 0) { left = n; return true; }
+
+    { /* the last chunk */
+        r = rd->peek(2, FLG_http_recv_timeout);
+        if (r <= 0) goto recv_err;
+        if (rd->data()[0] == '\r' && rd->data()[1] == '\n') {
+            rd->consume(2);
+        } else { /* tailing headers \r\n\r\n */
+            r = rd->read_until("\r\n\r\n", FLG_http_max_header_size, FLG_http_recv_timeout);
+            if (r == -2) goto chunk_err;
+            if (r <= 0) goto recv_err;
+            fastring& b = *req->buf;
+            o = b.size();
+            b.append(rd->data(), r);
+            rd->consume(r);
+            if (parse_http_headers(&b, b.size() - 2, o, req) != 0) goto chunk_err;
+        }
+        done = true;
+        return false;
+    }
+
+  recv_err:
+    ELOG << "http recv body error: " << (r < 0 ? conn->strerror() : "connection closed");
+    err = true;
+    return false;
+  chunk_err:
+    ELOG << "http invalid chunked data..";
+    err = true;
+    return false;
+}
+
+int http_body_t::read(void* buf, size_t n) {
+    if (done) return 0;
+    if (err) return -1;
+    if (!rd) { /* in memory */
+        const size_t k = n < left ? n : (size_t)left;
+        memcpy(buf, p, k);
+        p += k;
+        left -= k;
+        done = left == 0;
+        return (int)k;
+    }
+
+    if (expect) {
+        expect = false;
+        static const char s[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (rd->empty() && conn->send(s, sizeof(s) - 1, FLG_http_send_timeout) <= 0) {
+            ELOG << "http send error: " << conn->strerror();
+            err = true;
+            return -1;
+        }
+    }
+
+    if (left == 0 && !this->next_chunk()) return err ? -1 : 0;
+
+    const size_t m = n < left ? n : (size_t)left;
+    int r;
+    if (!rd->empty()) {
+        r = (int)(m < rd->size() ? m : rd->size());
+        memcpy(buf, rd->data(), r);
+        rd->consume(r);
+    } else if (m >= 4096) {
+        r = conn->recv(buf, (int)(m < (1u << 30) ? m : (1u << 30)), FLG_http_recv_timeout);
+    } else {
+        r = rd->fill(FLG_http_recv_timeout);
+        if (r > 0) {
+            r = (int)(m < rd->size() ? m : rd->size());
+            memcpy(buf, rd->data(), r);
+            rd->consume(r);
+        }
+    }
+    if (r <= 0) {
+        ELOG << "http recv body error: " << (r < 0 ? conn->strerror() : "connection closed");
+        err = true;
+        return -1;
+    }
+
+    left -= r;
+    if (left == 0) {
+        if (!chunked) {
+            done = true;
+        } else { /* \r\n after the data */
+            const int k = rd->peek(2, FLG_http_recv_timeout);
+            if (k <= 0 || rd->data()[0] != '\r' || rd->data()[1] != '\n') {
+                ELOG << "http invalid chunked data..";
+                err = true;
+                return -1;
+            }
+            rd->consume(2);
+        }
+    }
+    return r;
+}
+
+// read and discard the rest of the body, at most @max bytes
+bool http_body_t::drain(size_t max) {
+    if (expect) return false; // the client is waiting for 100 Continue
+    char b[4096];
+    for (size_t n = 0; !done;) {
+        const int r = this->read(b, sizeof(b));
+        if (r < 0 || (n += r) > max) return false;
+    }
+    return true;
+}
+
+int BodyReader::read(void* buf, size_t n) {
+    return ((http_body_t*)_p)->read(buf, n);
+}
+
+bool BodyReader::done() const {
+    return ((http_body_t*)_p)->done;
+}
+
 void send_error_message(int err, http_res_t* res, void* conn) {
     fastring s(128);
     res->buf = &s;
@@ -687,22 +1574,85 @@ void send_error_message(int err, http_res_t* res, void* conn) {
     res->clear();
 }
 
+// send a file compressed on the fly, in chunked encoding
+int64 send_compressed_file(tcp::Connection& conn, http_res_t* res) {
+    const size_t block = 64 * 1024;
+    Compressor c(res->coding);
+    fastring b(block);
+    fastring z(block);
+    char x[24];
+
+    for (int64 off = 0; off < res->file_size;) {
+        const size_t k = (size_t)(res->file_size - off < (int64)block ? res->file_size - off : block);
+        if (res->file.read((void*)b.data(), k) != k) {
+            ELOG << "http read file error: " << res->file.path();
+            return -1;
+        }
+        off += k;
+        const bool end = off == res->file_size;
+
+        z.clear();
+        if (!c.update(b.data(), k, z, end)) {
+            ELOG << "http compress error: " << coding_name(res->coding);
+            return -1;
+        }
+
+        // a chunk of size 0 ends the body, empty output is not sent
+        co::iov_t iov[4];
+        int n = 0;
+        if (!z.empty()) {
+            const int m = snprintf(x, sizeof(x), "%x\r\n", (uint32)z.size());
+            iov[n++] = co::make_iov(x, m);
+            iov[n++] = co::make_iov(z.data(), z.size());
+            iov[n++] = co::make_iov("\r\n", 2);
+        }
+        if (end) iov[n++] = co::make_iov("0\r\n\r\n", 5);
+        if (n > 0 && conn.sendv(iov, n, FLG_http_send_timeout) <= 0) return -1;
+    }
+    return res->file_size;
+}
+
+int ServerImpl::wait_next(tcp::Connection& conn, tcp::Reader& rd) {
+    const uint32 ms = FLG_http_park_idle_ms;
+    if (ms > 0 && ms < FLG_http_conn_idle_sec * 1000) {
+        const int r = rd.fill(ms);
+        if (r >= 0 || !co::timeout()) return r;
+        if (!_stopped && _serv.park(conn, FLG_http_conn_idle_sec)) return -2;
+    }
+    return rd.fill(FLG_http_conn_idle_sec * 1000);
+}
+
 void ServerImpl::on_connection(tcp::Connection conn) {
-    char c;
     int r = 0;
-    size_t pos = 0, total_len = 0;
+    size_t pos = 0;
     fastring buf;
+    tcp::Reader rd(conn);
+    http_body_t body;
     Req req; Res res;
     auto& preq = *(http_req_t**) &req;
     auto& pres = *(http_res_t**) &res;
 
+    // Responses of pipelined requests are held in @out while the next request
+    // is already buffered, and they are sent together with a later response.
+    const size_t max_pending = 64 * 1024;
+    fastring out;
+    auto flush = [&]() {
+        if (out.empty()) return true;
+        const int n = conn.send(out.data(), (int)out.size(), FLG_http_send_timeout);
+        out.clear();
+        return n > 0;
+    };
+
     god::bless_no_bugs();
     while (true) {
         { /* recv http header and body */
           recv_beg:
-            if (buf.capacity() == 0) {
-                // try to recieve a single byte
-                r = conn.recv(&c, 1, FLG_http_conn_idle_sec * 1000);
+            if (rd.empty()) {
+                // wait for the next request, without holding any buffer
+                rd.release();
+                buf.reset();
+                r = this->wait_next(conn, rd);
+                if (r == -2) goto end; // parked
                 if (r == 0) goto recv_zero_err;
                 if (r < 0) {
                     if (!co::timeout()) goto recv_err;
@@ -710,36 +1660,42 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                     if (_serv.conn_num() > FLG_http_max_idle_conn) goto idle_err;
                     goto recv_beg;
                 }
-                buf.reserve(4096);
-                buf.append(c);
             }
 
             // recv until the entire http header was done. 
-            while ((pos = buf.find("\r\n\r\n")) == buf.npos) {
-                if (buf.size() > FLG_http_max_header_size) goto header_too_long_err;
-                buf.reserve(buf.size() + 1024);
-                r = conn.recv(
-                    (void*)(buf.data() + buf.size()), 
-                    (int)(buf.capacity() - buf.size()), FLG_http_recv_timeout
-                );
+            r = rd.read_until("\r\n\r\n", FLG_http_max_header_size, FLG_http_recv_timeout);
+            if (r == -2) goto header_too_long_err;
+            if (r == 0) goto recv_zero_err;
+            if (r < 0) {
+                if (co::timeout() && _serv.conn_num() > FLG_http_max_idle_conn) goto idle_err;
+                goto recv_err;
+            }
+
+            // "PRI * HTTP/2.0\r\n\r\n" is the beginning of the HTTP/2 preface
+            if (FLG_http2 && r == 18 && memcmp(rd.data(), kH2Preface, 18) == 0) {
+                r = rd.peek(24, FLG_http_recv_timeout);
                 if (r == 0) goto recv_zero_err;
-                if (r < 0) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_serv.conn_num() > FLG_http_max_idle_conn) goto idle_err;
-                    if (buf.empty()) { buf.reset(); goto recv_beg; }
-                    goto recv_err;
+                if (r < 0) goto recv_err;
+                if (memcmp(rd.data(), kH2Preface, 24) == 0) {
+                    rd.consume(24);
+                    HTTPLOG << "http2 connection: " << co::peer(conn.socket()) << ", connfd: " << conn.socket();
+                    serve_http2(std::move(conn), std::move(rd), _on_req, _stopped);
+                    goto end;
                 }
-                buf.resize(buf.size() + r);
             }
 
+            pos = r - 4;
+            if (buf.capacity() == 0) buf.reserve(4096);
+            buf.append(rd.data(), r);
+            rd.consume(r);
             buf[pos + 2] = '\0'; // make header null-terminated
             HTTPLOG << "http recv req: " << buf.data();
 
             // parse http header
-            if (preq == 0) preq = (http_req_t*) co::zalloc(sizeof(http_req_t));
-            if (pres == 0) pres = (http_res_t*) co::zalloc(sizeof(http_res_t));
+            if (preq == 0) preq = make_http_req();
+            if (pres == 0) pres = make_http_res();
 
-            r = parse_http_req(&buf, pos + 2, preq);
+            r = parse_http_req(&buf, pos + 2, preq, _scb != NULL);
             if (r != 0) { /* parse error */
                 pres->version = kHTTP11;
                 goto parse_err;
@@ -749,27 +1705,32 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
             // try to recv the remain part of http body
             preq->body = (uint32)(pos + 4); // beginning of http body
-            if (preq->body_size > 0) {
-                total_len = pos + 4 + preq->body_size;
-                if (buf.size() < total_len) {
-                    buf.reserve(total_len);
-                    r = conn.recvn(
-                        (void*)(buf.data() + buf.size()), 
-                        (int)(total_len - buf.size()), FLG_http_recv_timeout
-                    );
-                    if (r == 0) goto recv_zero_err;
-                    if (r < 0) goto recv_err;
-                    buf.resize(total_len);
+            if (_scb) { /* the body is read by the handler */
+                const char* const te = preq->header("Transfer-Encoding");
+                if (*te && strcmp(te, "chunked") != 0) {
+                    flush();
+                    send_error_message(501, pres, &conn);
+                    goto reset_conn;
                 }
+                const uint64 n = strtoull(preq->header("Content-Length"), 0, 10);
+                new (&body) http_body_t(&conn, &rd, preq, n, *te != '\0');
+                preq->stream = &body;
+                // responses pending are sent before the handler waits for the body
+                if (!body.done && !flush()) goto send_err;
+                goto handle_req;
+            }
+            if (preq->body_size > 0) {
+                buf.resize(pos + 4 + preq->body_size);
+                r = rd.read_exact((void*)(buf.data() + pos + 4), preq->body_size, FLG_http_recv_timeout);
+                if (r == 0) goto recv_zero_err;
+                if (r < 0) goto recv_err;
                 goto handle_req;
 
             } else {
                 const char* const te = preq->header("Transfer-Encoding");
-                if (!*te) {
-                    total_len = pos + 4;
-                    goto handle_req; // no Transfer-Encoding
-                }
+                if (!*te) goto handle_req; // no Transfer-Encoding
                 if (strcmp(te, "chunked") != 0) { /* Transfer-Encoding is not "chunked" */
+                    flush();
                     send_error_message(501, pres, &conn);
                     goto reset_conn;
                 }
@@ -780,74 +1741,60 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 const bool expect_100_continue = strcmp(preq->header("Expect"), "100-continue") == 0;
                 size_t x, o, i, n = 0;
                 const size_t hlen = pos + 4; // header length
-                fastring s(128);
 
-                if (buf.size() > hlen) {
-                    s.append(buf.data() + hlen, buf.size() - hlen);
-                    buf.resize(hlen);
+                if (expect_100_continue && rd.empty()) { /* send 100 continue */
+                    if (!flush()) goto send_err;
+                    send_error_message(100, pres, &conn);
                 }
 
                 while (true) { /* loop for recving chunked data */
-                    while ((x = s.find("\r\n")) == s.npos) {
-                        if (expect_100_continue) { /* send 100 continue */
-                            send_error_message(100, pres, &conn);
-                        }
-                        s.reserve(s.size() + 32);
-                        r = conn.recv((void*)(s.data() + s.size()), 32, FLG_http_recv_timeout);
-                        if (r == 0) goto recv_zero_err;
-                        if (r < 0) goto recv_err;
-                        s.resize(s.size() + r);
-                    }
+                    r = rd.read_until("\r\n", FLG_http_max_header_size, FLG_http_recv_timeout);
+                    if (r == -2) goto chunk_err;
+                    if (r == 0) goto recv_zero_err;
+                    if (r < 0) goto recv_err;
 
-                    if (x == 0) { s.lshift(2); continue; }
+                    x = r - 2;
+                    if (x == 0) { rd.consume(2); continue; }
 
                     // chunked data:  1a[;xxx]\r\ndata\r\n
-                    if ((o = s.find(';', 0, x)) == s.npos) o = x;
+                    const char* const s = rd.data();
+                    for (o = 0; o < x && s[o] != ';'; ++o);
                     for (i = 0, n = 0; i < o; ++i) {
                         if ((r = hex2int(s[i])) < 0) goto chunk_err;
                         n = (n << 4) + r;
                     }
+                    rd.consume(x + 2);
 
                     if (n > 0) {
                         if (unlikely(n > FLG_http_max_body_size)) goto body_too_long_err;
+                        if (buf.size() - hlen + n > FLG_http_max_body_size) goto body_too_long_err;
 
-                        o = s.size() - x - 2;
-                        if (o < n) {
-                            buf.append(s.data() + x + 2, o);
-                            buf.reserve(buf.size() + n - o + 2);
-                            r = conn.recvn((void*)(buf.data() + buf.size()), (int)(n - o + 2), FLG_http_recv_timeout);
-                            if (r == 0) goto recv_zero_err;
-                            if (r < 0) goto recv_err;
-                            buf.resize(buf.size() + r - 2);
-                            s.clear();
-                        } else {
-                            buf.append(s.data() + x + 2, n);
-                            s.lshift(s.size() >= x + 4 + n ? x + 4 + n : x + 2 + n);
-                        }
-
-                        if (buf.size() - hlen > FLG_http_max_body_size) goto body_too_long_err;
+                        // data and the tailing \r\n
+                        o = buf.size();
+                        buf.resize(o + n + 2);
+                        r = rd.read_exact((void*)(buf.data() + o), n + 2, FLG_http_recv_timeout);
+                        if (r == 0) goto recv_zero_err;
+                        if (r < 0) goto recv_err;
+                        buf.resize(o + n);
 
                     } else { /* n == 0, end of chunked data */
                         preq->body_size = (uint32)(buf.size() - hlen);
-                        s.lshift(x);
-                        while ((x = s.find("\r\n\r\n")) == s.npos) {
-                            s.reserve(s.size() + 32);
-                            r = conn.recv((void*)(s.data() + s.size()), 32, FLG_http_recv_timeout);
+                        r = rd.peek(2, FLG_http_recv_timeout);
+                        if (r == 0) goto recv_zero_err;
+                        if (r < 0) goto recv_err;
+
+                        if (rd.data()[0] == '\r' && rd.data()[1] == '\n') {
+                            rd.consume(2);
+                        } else { /* tailing headers \r\n\r\n */
+                            r = rd.read_until("\r\n\r\n", FLG_http_max_header_size, FLG_http_recv_timeout);
+                            if (r == -2) goto header_too_long_err;
                             if (r == 0) goto recv_zero_err;
                             if (r < 0) goto recv_err;
-                            s.resize(s.size() + r);
-                        }
 
-                        s[x + 2] = '\0';
-                        if (s.size() == 4) {
-                            total_len = buf.size();
-                        } else { /* \r\n tailing headers \r\n\r\n*/
-                            // there are some tailing headers following the chunked data
-                            total_len = buf.size() + x + 4;
                             o = buf.size();
-                            if (s[0] == '\r' && s[1] == '\n') o += 2;
-                            buf.append(s.data(), s.size());
-                            r = parse_http_headers(&buf, total_len - 2,  o, preq);
+                            buf.append(rd.data(), r);
+                            rd.consume(r);
+                            r = parse_http_headers(&buf, buf.size() - 2, o, preq);
                             if (r != 0) goto parse_err;
                         }
 
@@ -872,30 +1819,71 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
             s.clear();
             pres->buf = &s;
-            _on_req(req, res);
-            if (s.empty()) pres->set_body("", 0);
+            ResCache::miss_t miss;
+            co::shared_ptr<fastring> cached;
+            if (_cache) cached = _cache->get(preq, miss);
+            if (cached) { /* headers and the body from the cache */
+                s.append(*cached);
+                MET_co_http_cache_hits_total.inc();
+            } else {
+                _on_req(req, res);
+                if (s.empty()) pres->set_body("", 0);
+                compress_res(preq, pres);
+                if (preq->method == kHead) { /* headers only */
+                    if (pres->body_in_buf()) s.resize(s.size() - pres->body_size);
+                    pres->body = 0;
+                    pres->body_size = 0;
+                    pres->file_size = 0;
+                    pres->iob.clear();
+                }
+                if (_cache) _cache->done(miss, pres);
+                if (preq->stream && !body.drain(FLG_http_max_body_size)) {
+                    need_close = true; // the rest of the body is not read
+                    if (body.err) goto reset_conn;
+                }
+            }
 
-            r = conn.send(s.data(), (int)s.size(), FLG_http_send_timeout);
-            if (r <= 0) goto send_err;
+            if (!need_close && !_stopped && pres->body_in_buf() && pres->file_size <= 0 &&
+                out.size() + s.size() <= max_pending && has_header(rd.data(), rd.size())) {
+                out.append(s); // the next request is ready, send the response later
+            } else {
+                // pending responses, headers and the body referenced
+                co::iov_t iov[3];
+                int n = 0;
+                if (pres->iob.empty()) {
+                    if (!out.empty()) iov[n++] = co::make_iov(out.data(), out.size());
+                    iov[n++] = co::make_iov(s.data(), s.size());
+                    if (pres->body) iov[n++] = co::make_iov(pres->body, pres->body_size);
+                    if (conn.sendv(iov, n, FLG_http_send_timeout) <= 0) goto send_err;
+                } else {
+                    // headers are referenced before the body, sent in one go
+                    pres->iob.prepend_ref(s.data(), s.size());
+                    if (!out.empty()) pres->iob.prepend_ref(out.data(), out.size());
+                    if (conn.send(pres->iob, FLG_http_send_timeout) <= 0) goto send_err;
+                }
+                out.clear();
+
+                if (pres->file_size > 0) {
+                    const int64 x = pres->coding ? send_compressed_file(conn, pres) :
+                        conn.sendfile(pres->file, 0, pres->file_size, FLG_http_send_timeout);
+                    if (x <= 0) goto send_err;
+                }
+            }
+            if (pres->body_in_buf()) s.resize(s.size() - pres->body_size);
 
-            s.resize(s.size() - pres->body_size);
             HTTPLOG << "http send res: " << s;
             if (need_close) { conn.close(); goto end; }
         };
 
-        if (buf.size() == total_len) {
-            buf.clear();
-        } else {
-            buf.lshift(total_len);
-        }
-
+        // data of the next request, if any, is left in the reader
+        buf.clear();
         preq->clear();
         pres->clear();
-        total_len = 0;
         if (_stopped) goto reset_conn;
     }
 
   recv_zero_err:
+    flush();
     LOG << "http client close the connection: " << co::peer(conn.socket()) << ", connfd: " << conn.socket();
     conn.close();
     goto end;
@@ -907,10 +1895,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
     ELOG << "http recv error: header too long";
     goto reset_conn;
   body_too_long_err:
+    flush();
     send_error_message(413, pres, &conn);
     goto reset_conn;
   parse_err:
     ELOG << "http parse error: " << r;
+    flush();
     send_error_message(r, pres, &conn);
     goto reset_conn;
   recv_err:
@@ -932,13 +1922,94 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
 namespace so {
 
+// a static file cached by so::easy(), compressed forms are made on demand
+struct StaticFile {
+    int64 mtime;
+    fastring data[http::kCodings]; // data[kIdentity] is the file itself
+    uint8 made[http::kCodings];    // 1 if data[i] was made, 2 if it is not smaller
+};
+
+// Content-Type of text files by the extension, NULL for others
+inline const char* text_type(const fastring& path) {
+    static const char* kTypes[][2] = {
+        { ".html", "text/html; charset=utf-8" },
+        { ".htm",  "text/html; charset=utf-8" },
+        { ".css",  "text/css; charset=utf-8" },
+        { ".js",   "text/javascript; charset=utf-8" },
+        { ".json", "application/json" },
+        { ".txt",  "text/plain; charset=utf-8" },
+        { ".md",   "text/markdown; charset=utf-8" },
+        { ".csv",  "text/csv; charset=utf-8" },
+        { ".xml",  "application/xml" },
+        { ".svg",  "image/svg+xml" },
+        { ".wasm", "application/wasm" },
+    };
+    const fastring x = path::ext(path);
+    for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); ++i) {
+        if (x == kTypes[i][0]) return kTypes[i][1];
+    }
+    return 0;
+}
+
+// HTTP-date of a unix time, "Sun, 06 Nov 1994 08:49:37 GMT"
+inline fastring http_date(int64 t) {
+    static const char* kDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char* kMonths[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+    struct tm x;
+    const time_t v = (time_t)t;
+  #ifdef _WIN32
+    gmtime_s(&x, &v);
+  #else
+    gmtime_r(&v, &x);
+  #endif
+    char b[32];
+    snprintf(b, sizeof(b), "%s, %02d %s %d %02d:%02d:%02d GMT",
+        kDays[x.tm_wday], x.tm_mday, kMonths[x.tm_mon], x.tm_year + 1900,
+        x.tm_hour, x.tm_min, x.tm_sec
+    );
+    return fastring(b);
+}
+
+// whether the entity tag @e is in If-None-Match @s, by the weak comparison
+inline bool etag_match(const char* s, const char* e) {
+    if (e[0] == 'W' && e[1] == '/') e += 2;
+    const size_t n = strlen(e);
+    for (const char* p = s; *p;) {
+        while (*p == ' ' || *p == ',') ++p;
+        if (*p == '*') return true;
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+        if (strncmp(p, e, n) == 0 && (p[n] == '\0' || p[n] == ',' || p[n] == ' ')) return true;
+        while (*p && *p != ',') ++p;
+    }
+    return false;
+}
+
+// add ETag and Last-Modified of a file to @res, and check the conditional
+// headers of @req, return true if the client's copy is fresh, the status is
+// set to 304 then. If-None-Match takes precedence over If-Modified-Since, which
+// is compared exactly with the Last-Modified.
+inline bool not_modified(const http::Req& req, http::Res& res, int64 mtime, int64 size) {
+    char e[48];
+    snprintf(e, sizeof(e), "W/\"%llx-%llx\"", (unsigned long long)size, (unsigned long long)mtime);
+    const fastring date = http_date(mtime);
+    res.add_header("ETag", e);
+    res.add_header("Last-Modified", date.c_str());
+
+    const char* const inm = req.header("If-None-Match");
+    const bool fresh = *inm ? etag_match(inm, e) : date == req.header("If-Modified-Since");
+    if (fresh) res.set_status(304);
+    return fresh;
+}
+
 void easy(const char* root_dir, const char* ip, int port) {
     return so::easy(root_dir, ip, port, NULL, NULL);
 }
 
 void easy(const char* root_dir, const char* ip, int port, const char* key, const char* ca) {
     http::Server serv;
-    typedef LruMap<fastring, std::pair<fastring, int64>> Map;
+    typedef LruMap<fastring, StaticFile> Map;
     co::vector<Map> contents(co::scheduler_num());
     fastring root(path::clean(root_dir));
 
@@ -958,29 +2029,66 @@ void easy(const char* root_dir, const char* ip, int port, const char* key, const
             fastring path = path::join(root, url);
             if (fs::isdir(path)) path = path::join(path, "index.html");
 
+            // cached files are checked by the mtime, modified files are reloaded
+            const char* type = text_type(path);
+            const int64 mtime = fs::mtime(path);
+            const bool zip = FLG_http_compress && type;
             auto& map = contents[co::scheduler_id()];
             auto it = map.find(path);
-            if (it != map.end()) {
-                if (now::ms() < it->second.second + 300 * 1000) {
-                    res.set_status(200);
-                    auto& s = it->second.first;
-                    res.set_body(s.data(), s.size());
+            if (it != map.end() && it->second.mtime != mtime) {
+                map.erase(it);
+                it = map.end();
+            }
+
+            if (it == map.end()) {
+                // large files are sent by sendfile(), or compressed on the fly
+                // by the server, without caching them
+                const int64 size = fs::fsize(path);
+                if (size > 256 * 1024) {
+                    if (zip) res.add_header("Vary", "Accept-Encoding");
+                    if (not_modified(req, res, mtime, size)) return;
+                    if (type) res.add_header("Content-Type", type);
+                    if (!res.set_file(path)) res.set_status(404);
                     return;
-                } else {
-                    map.erase(it); // timeout
                 }
+
+                fs::file f(path.c_str(), 'r');
+                if (!f) {
+                    res.set_status(404);
+                    return;
+                }
+
+                StaticFile x;
+                x.mtime = mtime;
+                x.data[http::kIdentity] = f.read(f.size());
+                memset(x.made, 0, sizeof(x.made));
+                map.insert(path, std::move(x));
+                it = map.find(path);
             }
 
-            fs::file f(path.c_str(), 'r');
-            if (!f) {
-                res.set_status(404);
-                return;
+            // text files are precompressed with the best level, once for each
+            // coding, and the compressed forms are kept with the file
+            auto& x = it->second;
+            const fastring& s = x.data[http::kIdentity];
+            if (zip) res.add_header("Vary", "Accept-Encoding");
+            if (not_modified(req, res, x.mtime, (int64)s.size())) return;
+
+            int c = http::kIdentity;
+            if (zip && s.size() >= FLG_http_compress_min_size) {
+                c = http::pick_coding(req.header("Accept-Encoding"));
+                if (c != http::kIdentity && x.made[c] == 0) {
+                    fastring& z = x.data[c];
+                    const bool ok = http::compress(c, s.data(), s.size(), z, true);
+                    x.made[c] = (ok && z.size() < s.size()) ? 1 : 2;
+                    if (x.made[c] == 2) z.reset();
+                }
+                if (x.made[c] == 2) c = http::kIdentity;
             }
 
-            fastring s = f.read(f.size());
             res.set_status(200);
-            res.set_body(s.data(), s.size());
-            map.insert(path, std::make_pair(std::move(s), now::ms()));
+            if (type) res.add_header("Content-Type", type);
+            if (c != http::kIdentity) res.add_header("Content-Encoding", http::coding_name(c));
+            res.set_body(x.data[c].data(), x.data[c].size());
         }
     );
 
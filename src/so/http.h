@@ -1,14 +1,42 @@
 #pragma once
 
 #include "co/fastring.h"
+#include "co/fs.h"
+#include "co/iobuf.h"
+#include "co/object_pool.h"
+#include <string.h>
+#include <functional>
+
+namespace tcp {
+struct Connection;
+class Reader;
+} // tcp
 
 namespace http {
 
+class Req;
+class Res;
+
+// headers looked up by the server, their values are indexed when parsed
+enum {
+    kHost = 0,
+    kConnection,
+    kContentType,
+    kContentLength,
+    kTransferEncoding,
+    kExpect,
+    kKnownHeaders,
+};
+
+// max parameters captured by http::Router for a request
+const uint32 kMaxParams = 8;
+
 struct http_req_t {
     http_req_t() = delete;
     ~http_req_t() = delete;
 
-    void add_header(uint32 k, uint32 v);
+    // @k: key, @n: length of the key, @v: value
+    void add_header(uint32 k, uint32 n, uint32 v);
     const char* header(const char* key) const;
 
     void clear() {
@@ -16,6 +44,10 @@ struct http_req_t {
         url.clear();
         buf = 0;
         arr_size = 0;
+        memset(known, 0, sizeof(known));
+        route = 0;
+        param_num = 0;
+        stream = 0;
     }
 
     // DO NOT change orders of the members here.
@@ -28,6 +60,40 @@ struct http_req_t {
     uint32* arr;   // array of header index: [<k,v>]
     uint32 arr_size;
     uint32 arr_cap;
+    uint32 known[kKnownHeaders]; // value index of known headers, 0 if not present
+    const void* route;           // the route matched by http::Router
+    uint32 params[kMaxParams * 2]; // <offset, length> of params in url
+    uint32 param_num;
+    void* stream;                // http_body_t of a body read by the handler
+};
+
+// body of a request read by the handler, see http::BodyReader
+//   - It reads from the connection, or from memory if @rd is NULL (HTTP/2).
+//   - @left is bytes left in the body, or in the current chunk if @chunked.
+struct http_body_t {
+    http_body_t() : conn(0), rd(0), req(0), p(0), left(0), chunked(false),
+        done(true), expect(false), err(false) {
+    }
+
+    http_body_t(const char* s, size_t n) : conn(0), rd(0), req(0), p(s), left(n),
+        chunked(false), done(n == 0), expect(false), err(false) {
+    }
+
+    http_body_t(tcp::Connection* c, tcp::Reader* r, http_req_t* q, uint64 n, bool chunked);
+
+    int read(void* buf, size_t n);
+    bool next_chunk();
+    bool drain(size_t max);
+
+    tcp::Connection* conn;
+    tcp::Reader* rd;
+    http_req_t* req;
+    const char* p;
+    uint64 left;
+    bool chunked;
+    bool done;
+    bool expect; // 100 Continue is to be sent
+    bool err;
 };
 
 struct http_res_t {
@@ -44,13 +110,25 @@ struct http_res_t {
         header << k << ": " << v << "\r\n";
     }
 
+    // headers for a body of n bytes, or a chunked body if n < 0
+    void make_header(int64 n);
     void set_body(const void* s, size_t n);
+    void set_body_ref(const void* s, size_t n);
+    void set_body(co::iobuf&& b);
+    bool set_file(const char* path);
+
+    // the body is at the end of buf, not referenced or in an iobuf
+    bool body_in_buf() const { return !body && iob.empty(); }
 
     void clear() {
         status = 0;
         buf = 0;
         header.clear();
         body_size = 0;
+        body = 0;
+        coding = 0;
+        iob.clear();
+        if (file_size >= 0) { file.close(); file_size = -1; }
     }
 
     // DO NOT change orders of the members here.
@@ -59,9 +137,100 @@ struct http_res_t {
     fastring* buf;
     fastring header;
     size_t body_size;
+    fs::file file;    // the body is sent from the file if file_size >= 0
+    int64 file_size;
+    const char* body; // set by set_body_ref(), not copied to buf
+    int coding;       // the file is compressed on the fly with it if not 0
+    co::iobuf iob;    // set by set_body(iobuf), sent without copy
 };
 
-int parse_http_req(fastring* buf, size_t size, http_req_t* req);
+// http_req_t and http_res_t are taken from thread-local pools, as a server
+// creates them for each connection. They are zero-cleared when allocated.
+inline http_req_t* make_http_req() {
+    void* p = co::object_pool<http_req_t>::alloc();
+    return (http_req_t*) memset(p, 0, sizeof(http_req_t));
+}
+
+inline http_res_t* make_http_res() {
+    void* p = co::object_pool<http_res_t>::alloc();
+    http_res_t* r = (http_res_t*) memset(p, 0, sizeof(http_res_t));
+    r->file_size = -1;
+    return r;
+}
+
+inline void free_http_req(http_req_t* p) {
+    p->url.~fastring();
+    if (p->arr) co::free(p->arr, p->arr_cap << 2);
+    co::object_pool<http_req_t>::free(p);
+}
+
+inline void free_http_res(http_res_t* p) {
+    p->header.~fastring();
+    p->file.~file();
+    p->iob.~iobuf();
+    co::object_pool<http_res_t>::free(p);
+}
+
+// content codings of responses, negotiated by Accept-Encoding
+enum {
+    kIdentity = 0,
+    kGzip,
+    kBrotli,
+    kZstd,
+    kCodings,
+};
+
+const char* coding_name(int c);
+
+// the coding to use for a response, by q-values in @accept and the codings the
+// library was built with, kIdentity if none is acceptable
+int pick_coding(const char* accept);
+
+// whether a body of the Content-Type @type is worth compressing
+bool compressible(const char* type);
+
+// streaming compressor, @best for the best but slow compression
+class Compressor {
+  public:
+    explicit Compressor(int coding, bool best=false);
+    ~Compressor();
+
+    Compressor(const Compressor&) = delete;
+    void operator=(const Compressor&) = delete;
+
+    // compress n bytes, the output is appended to @out, @end for the last block
+    bool update(const void* s, size_t n, fastring& out, bool end);
+
+  private:
+    void* _p;
+    int _c;
+};
+
+// compress n bytes in one call, the output is appended to @out
+bool compress(int coding, const void* s, size_t n, fastring& out, bool best=false);
+
+// compress the body of @res for @req if it is enabled, acceptable and worth it.
+//   - A body in memory is replaced with the compressed one.
+//   - For a file, the header is rebuilt for a chunked body, and res->coding is
+//     set, the file is compressed on the fly when it is sent.
+// return the coding used, kIdentity if the body was not compressed
+int compress_res(const http_req_t* req, http_res_t* res);
+
+// @stream: the body is read by the handler, Content-Length is not limited
+int parse_http_req(fastring* buf, size_t size, http_req_t* req, bool stream=false);
+
+// parse headers in buf from @x to size, 0 on success, or 400
+int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req);
 void send_error_message(int err, http_res_t* res, void* conn);
 
+// connection preface of HTTP/2 clients
+const char* const kH2Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// serve a HTTP/2 connection, the client preface was consumed from rd
+//   - conn and rd are moved into the session, the connection is closed on return.
+void serve_http2(
+    tcp::Connection&& conn, tcp::Reader&& rd,
+    const std::function<void(const Req&, Res&)>& cb, const bool& stopped
+);
+
 } // http
@@ -0,0 +1,658 @@
+#include "./http.h"
+#include "./http2.h"
+#include "co/http.h"
+#include "co/tcp.h"
+#include "co/co.h"
+#include "co/log.h"
+#include "co/stl.h"
+
+DEF_uint32(http2_max_streams, 100, ">>#2 max concurrent streams of a HTTP/2 connection");
+
+DEC_uint32(http_max_header_size);
+DEC_uint32(http_max_body_size);
+DEC_uint32(http_recv_timeout);
+DEC_uint32(http_send_timeout);
+DEC_uint32(http_conn_idle_sec);
+DEC_bool(http_log);
+
+#define HTTPLOG LOG_IF(FLG_http_log)
+
+namespace http {
+namespace h2 {
+
+struct Stream {
+    Stream(uint32 id, int64 window)
+        : id(id), send_window(window), recv_unacked(0), req(make_http_req()),
+          headers_done(false), ended(false), running(false), reset(false) {
+        buf.reserve(512);
+        req->buf = &buf;
+    }
+
+    ~Stream() {
+        if (req) free_http_req(req);
+    }
+
+    uint32 id;
+    int64 send_window;
+    uint32 recv_unacked;
+    http_req_t* req;
+    fastring buf;      // | headers | body |, headers are null-terminated k/v pairs
+    bool headers_done; // the header block was received
+    bool ended;        // END_STREAM was received
+    bool running;      // the request is being handled
+    bool reset;        // reset by the client
+};
+
+inline int find_method(const char* s, size_t n) {
+    static const char* m[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+    for (int i = 0; i < 6; ++i) {
+        if (strlen(m[i]) == n && memcmp(m[i], s, n) == 0) return i;
+    }
+    return -1;
+}
+
+// headers that are not allowed in HTTP/2
+inline bool is_conn_header(const fastring& k) {
+    return k == "connection" || k == "keep-alive" || k == "proxy-connection" ||
+           k == "transfer-encoding" || k == "upgrade" || k == "content-length";
+}
+
+/**
+ * a HTTP/2 connection on the server side
+ *   - The connection coroutine reads and handles all frames. A request is
+ *     handled in a new coroutine in the same scheduler once the stream is
+ *     ended by the client, so the session state is accessed by one thread only.
+ *   - Frames are written under a co::Mutex, a response may wait for
+ *     WINDOW_UPDATE from the client before sending its DATA frames.
+ */
+class Session {
+  public:
+    Session(tcp::Connection&& conn, tcp::Reader&& rd, const std::function<void(const Req&, Res&)>& cb, const bool& stopped)
+        : _conn(std::move(conn)), _rd(_conn, std::move(rd)), _on_req(cb), _stopped(stopped),
+          _send_window(kDefaultWindow), _init_window(kDefaultWindow), _max_frame(16384),
+          _recv_unacked(0), _last_id(0), _cont_id(0), _cont_flags(0),
+          _closed(false), _goaway(false) {
+    }
+
+    ~Session();
+
+    void run();
+
+  private:
+    int on_frame(uint8 type, uint8 flags, uint32 id, const uint8* p, uint32 n);
+    int on_data(uint8 flags, uint32 id, const uint8* p, uint32 n);
+    int on_headers(uint8 flags, uint32 id, const uint8* p, uint32 n);
+    int on_settings(uint8 flags, const uint8* p, uint32 n);
+    int on_window_update(uint32 id, const uint8* p, uint32 n);
+    int end_headers(Stream* st, uint8 flags);
+
+    void dispatch(Stream* st);
+    void handle(Stream* st);
+    void respond(Stream* st, http_res_t* res, bool head);
+    void respond_error(Stream* st, int status);
+    void close_stream(Stream* st);
+
+    Stream* find(uint32 id) {
+        auto it = _streams.find(id);
+        return it != _streams.end() ? it->second : 0;
+    }
+
+    bool write_frame(uint8 type, uint8 flags, uint32 id, const void* p, size_t n);
+    bool send_frame(uint8 type, uint8 flags, uint32 id, const void* p, size_t n);
+    bool send_headers(uint32 id, const fastring& h, bool end);
+    bool send_window_update(uint32 id, uint32 n);
+    bool send_rst(uint32 id, uint32 err);
+    void send_goaway(uint32 err);
+    uint32 wait_window(Stream* st);
+
+  private:
+    tcp::Connection _conn;
+    tcp::Reader _rd;
+    const std::function<void(const Req&, Res&)>& _on_req;
+    const bool& _stopped;
+    co::Mutex _wmtx;       // lock for writing frames
+    co::Event _win_ev;     // signaled when the send window may be increased
+    co::WaitGroup _wg;     // running handlers
+    co::hash_map<uint32, Stream*> _streams;
+    HpackDecoder _hpack;
+    HpackEncoder _henc;    // headers of responses are not indexed
+    fastring _hblock;      // header block fragments of HEADERS and CONTINUATION
+    int64 _send_window;    // send window of the connection
+    int64 _init_window;    // initial send window of streams, set by the client
+    uint32 _max_frame;     // max frame size the client accepts
+    uint32 _recv_unacked;  // bytes received, not acknowledged by WINDOW_UPDATE
+    uint32 _last_id;       // last stream id opened by the client
+    uint32 _cont_id;       // stream id of the header block being continued
+    uint8 _cont_flags;     // flags of the HEADERS frame being continued
+    bool _closed;
+    bool _goaway;
+};
+
+Session::~Session() {
+    for (auto& x : _streams) co::del(x.second);
+}
+
+void Session::run() {
+    { /* server preface, SETTINGS and a larger connection window */
+        uint8 s[18];
+        s[0] = 0; s[1] = 3; put32(s + 2, FLG_http2_max_streams);  // MAX_CONCURRENT_STREAMS
+        s[6] = 0; s[7] = 4; put32(s + 8, kRecvWindow);            // INITIAL_WINDOW_SIZE
+        s[12] = 0; s[13] = 6; put32(s + 14, FLG_http_max_header_size); // MAX_HEADER_LIST_SIZE
+        if (!this->send_frame(kSettings, 0, 0, s, sizeof(s))) return;
+        if (!this->send_window_update(0, kRecvWindow - kDefaultWindow)) return;
+    }
+
+    int err = kNoError;
+    while (!_closed && !_goaway) {
+        int r = _rd.peek(9, FLG_http_conn_idle_sec * 1000);
+        if (r <= 0) {
+            if (r < 0 && co::timeout()) {
+                if (!_stopped && !_streams.empty()) continue;
+                this->send_goaway(kNoError); // idle, or the server stopped
+            } else {
+                if (r < 0) ELOG << "http2 recv error: " << _conn.strerror();
+                _closed = true;
+            }
+            break;
+        }
+
+        const uint32 n = get24((const uint8*)_rd.data());
+        if (n > kMaxFrameSize) { err = kFrameSizeError; break; }
+
+        r = _rd.peek(9 + n, FLG_http_recv_timeout);
+        if (r <= 0) {
+            ELOG << "http2 recv error: " << _conn.strerror();
+            _closed = true;
+            break;
+        }
+
+        const uint8* h = (const uint8*)_rd.data();
+        const uint8 type = h[3];
+        const uint32 id = get32(h + 5) & 0x7fffffff;
+
+        // CONTINUATION frames MUST follow the HEADERS frame directly
+        if (_cont_id && (type != kContinuation || id != _cont_id)) { err = kProtocolError; break; }
+
+        err = this->on_frame(type, h[4], id, h + 9, n);
+        _rd.consume(9 + n);
+        if (err != kNoError) break;
+    }
+
+    if (err != kNoError) {
+        ELOG << "http2 connection error: " << err << ", connfd: " << _conn.socket();
+        this->send_goaway(err);
+        _closed = true;
+    }
+
+    // wait for the running handlers, they stop writing if the connection is closed
+    if (_closed) _win_ev.signal();
+    _wg.wait();
+}
+
+int Session::on_frame(uint8 type, uint8 flags, uint32 id, const uint8* p, uint32 n) {
+    switch (type) {
+      case kData:
+        return this->on_data(flags, id, p, n);
+
+      case kHeaders:
+        return this->on_headers(flags, id, p, n);
+
+      case kContinuation:
+        if (_cont_id == 0) return kProtocolError;
+        if (_hblock.size() + n > kMaxHeaderBlock) return kProtocolError;
+        _hblock.append(p, n);
+        if (flags & kEndHeaders) {
+            _cont_id = 0;
+            return this->end_headers(this->find(id), _cont_flags);
+        }
+        return kNoError;
+
+      case kSettings:
+        if (id != 0) return kProtocolError;
+        return this->on_settings(flags, p, n);
+
+      case kWindowUpdate:
+        return this->on_window_update(id, p, n);
+
+      case kPing:
+        if (id != 0) return kProtocolError;
+        if (n != 8) return kFrameSizeError;
+        if (!(flags & kAck)) this->send_frame(kPing, kAck, 0, p, 8);
+        return kNoError;
+
+      case kRstStream:
+        if (id == 0) return kProtocolError;
+        if (n != 4) return kFrameSizeError;
+        {
+            Stream* st = this->find(id);
+            if (st) {
+                if (st->running) {
+                    st->reset = true; // the handler will close it
+                    _win_ev.signal();
+                } else {
+                    this->close_stream(st);
+                }
+            }
+        }
+        return kNoError;
+
+      case kGoaway:
+        _goaway = true; // finish the running streams and close the connection
+        return kNoError;
+
+      case kPushPromise:
+        return kProtocolError; // clients can't push
+
+      default: // PRIORITY and unknown frames are ignored
+        return kNoError;
+    }
+}
+
+int Session::on_data(uint8 flags, uint32 id, const uint8* p, uint32 n) {
+    if (id == 0) return kProtocolError;
+    const uint32 len = n;
+    if (flags & kPadded) {
+        if (n < 1 || p[0] >= n) return kProtocolError;
+        n -= p[0] + 1;
+        ++p;
+    }
+
+    _recv_unacked += len;
+    if (_recv_unacked >= (kRecvWindow >> 1)) {
+        if (!this->send_window_update(0, _recv_unacked)) return kNoError;
+        _recv_unacked = 0;
+    }
+
+    Stream* st = this->find(id);
+    if (!st || !st->headers_done || st->ended) {
+        if (!st && id > _last_id) return kProtocolError; // idle stream
+        this->send_rst(id, kStreamClosed);
+        return kNoError;
+    }
+
+    if (st->buf.size() - st->req->body + n > FLG_http_max_body_size) {
+        this->respond_error(st, 413);
+        this->send_rst(id, kNoError);
+        this->close_stream(st);
+        return kNoError;
+    }
+
+    st->buf.append(p, n);
+    if (flags & kEndStream) {
+        st->ended = true;
+        this->dispatch(st);
+        return kNoError;
+    }
+
+    st->recv_unacked += len;
+    if (st->recv_unacked >= (kRecvWindow >> 1)) {
+        this->send_window_update(id, st->recv_unacked);
+        st->recv_unacked = 0;
+    }
+    return kNoError;
+}
+
+int Session::on_headers(uint8 flags, uint32 id, const uint8* p, uint32 n) {
+    if (id == 0 || !(id & 1)) return kProtocolError;
+
+    uint32 pad = 0;
+    if (flags & kPadded) {
+        if (n < 1) return kProtocolError;
+        pad = p[0];
+        ++p; --n;
+    }
+    if (flags & kPriorityFlag) {
+        if (n < 5) return kProtocolError;
+        p += 5; n -= 5;
+    }
+    if (pad > n) return kProtocolError;
+    n -= pad;
+
+    Stream* st = this->find(id);
+    if (!st) {
+        if (id <= _last_id) return kProtocolError; // a closed stream
+        _last_id = id;
+        st = co::make<Stream>(id, _init_window);
+        _streams[id] = st;
+    } else if (!st->headers_done || st->ended) {
+        return kProtocolError;
+    }
+
+    _hblock.clear();
+    _hblock.append(p, n);
+    if (!(flags & kEndHeaders)) {
+        _cont_id = id;
+        _cont_flags = flags;
+        return kNoError;
+    }
+    return this->end_headers(st, flags);
+}
+
+int Session::end_headers(Stream* st, uint8 flags) {
+    const bool trailer = st->headers_done;
+    const uint32 max_size = FLG_http_max_header_size;
+    uint32 size = 0;
+    int method = -1;
+    http_req_t* const req = st->req;
+    fastring& buf = st->buf;
+
+    auto add = [&](const char* k, size_t kn, const char* v, size_t vn) {
+        const uint32 x = (uint32)buf.size();
+        buf.append(k, kn).append('\0');
+        const uint32 y = (uint32)buf.size();
+        buf.append(v, vn).append('\0');
+        req->add_header(x, (uint32)kn, y);
+    };
+
+    const uint8* b = (const uint8*)_hblock.data();
+    const bool ok = _hpack.decode(b, b + _hblock.size(),
+        [&](const char* k, size_t kn, const char* v, size_t vn) {
+            if (trailer) return; // trailers are dropped
+            size += (uint32)(kn + vn + 32);
+            if (size > max_size) return;
+
+            if (kn == 0 || k[0] != ':') return add(k, kn, v, vn);
+            if (kn == 7 && memcmp(k, ":method", 7) == 0) {
+                method = find_method(v, vn);
+            } else if (kn == 5 && memcmp(k, ":path", 5) == 0) {
+                req->url.clear();
+                req->url.append(v, vn);
+            } else if (kn == 10 && memcmp(k, ":authority", 10) == 0) {
+                add("host", 4, v, vn);
+            }
+        }
+    );
+    if (!ok) return kCompressionError;
+
+    if (trailer) {
+        if (!(flags & kEndStream)) return kProtocolError;
+        st->ended = true;
+        this->dispatch(st);
+        return kNoError;
+    }
+
+    st->headers_done = true;
+    req->body = (uint32)buf.size();
+    req->version = kHTTP20;
+    if (_streams.size() > FLG_http2_max_streams) {
+        this->send_rst(st->id, kRefusedStream);
+        this->close_stream(st);
+        return kNoError;
+    }
+
+    int status = 0;
+    if (size > max_size) {
+        status = 431;
+    } else if (method < 0) {
+        status = 405;
+    } else if (req->url.empty()) {
+        status = 400;
+    }
+    if (status) {
+        this->respond_error(st, status);
+        if (!(flags & kEndStream)) this->send_rst(st->id, kNoError);
+        this->close_stream(st);
+        return kNoError;
+    }
+
+    req->method = method;
+    if (flags & kEndStream) {
+        st->ended = true;
+        this->dispatch(st);
+    }
+    return kNoError;
+}
+
+int Session::on_settings(uint8 flags, const uint8* p, uint32 n) {
+    if (flags & kAck) return n == 0 ? kNoError : kFrameSizeError;
+    if (n % 6 != 0) return kFrameSizeError;
+
+    for (uint32 i = 0; i < n; i += 6) {
+        const uint32 k = ((uint32)p[i] << 8) | p[i + 1];
+        const uint32 v = get32(p + i + 2);
+        switch (k) {
+          case 2: // ENABLE_PUSH, the server never pushes
+            if (v > 1) return kProtocolError;
+            break;
+          case 4: // INITIAL_WINDOW_SIZE
+            if (v > 0x7fffffff) return kFlowControlError;
+            for (auto& x : _streams) x.second->send_window += (int64)v - _init_window;
+            _init_window = v;
+            break;
+          case 5: // MAX_FRAME_SIZE
+            if (v < 16384 || v > 16777215) return kProtocolError;
+            _max_frame = v;
+            break;
+          default: // HEADER_TABLE_SIZE is not used as no dynamic table is used in responses
+            break;
+        }
+    }
+
+    this->send_frame(kSettings, kAck, 0, 0, 0);
+    _win_ev.signal();
+    return kNoError;
+}
+
+int Session::on_window_update(uint32 id, const uint8* p, uint32 n) {
+    if (n != 4) return kFrameSizeError;
+    const uint32 x = get32(p) & 0x7fffffff;
+    if (id == 0) {
+        if (x == 0) return kProtocolError;
+        _send_window += x;
+        if (_send_window > 0x7fffffff) return kFlowControlError;
+    } else {
+        Stream* st = this->find(id);
+        if (st) {
+            if (x == 0 || st->send_window + x > 0x7fffffff) {
+                this->send_rst(id, x == 0 ? kProtocolError : kFlowControlError);
+                st->running ? (void)(st->reset = true) : this->close_stream(st);
+                return kNoError;
+            }
+            st->send_window += x;
+        }
+    }
+    _win_ev.signal();
+    return kNoError;
+}
+
+void Session::close_stream(Stream* st) {
+    _streams.erase(st->id);
+    co::del(st);
+}
+
+void Session::dispatch(Stream* st) {
+    st->running = true;
+    st->req->body_size = (uint32)(st->buf.size() - st->req->body);
+    _wg.add(1);
+    co::scheduler()->go(&Session::handle, this, st);
+}
+
+void Session::handle(Stream* st) {
+    {
+        Req req; Res res;
+        auto& preq = *(http_req_t**) &req;
+        auto& pres = *(http_res_t**) &res;
+        preq = st->req; // freed by Req
+        st->req = 0;
+        pres = make_http_res();
+        pres->version = kHTTP20;
+
+        fastring s(4096);
+        pres->buf = &s;
+        HTTPLOG << "http2 recv req, stream: " << st->id << ", url: " << preq->url;
+        _on_req(req, res);
+        if (s.empty()) pres->set_body("", 0);
+        if (!pres->iob.empty()) { /* DATA frames are built from a contiguous body */
+            const fastring b = pres->iob.str();
+            pres->set_body(b.data(), b.size());
+        }
+        compress_res(preq, pres);
+        this->respond(st, pres, preq->method == kHead);
+    }
+    this->close_stream(st);
+    _wg.done();
+}
+
+void Session::respond_error(Stream* st, int status) {
+    fastring h(32);
+    fastring x(8);
+    x << status;
+    _henc.encode(h, ":status", 7, x.data(), x.size());
+    _henc.encode(h, "content-length", 14, "0", 1);
+    this->send_headers(st->id, h, true);
+}
+
+void Session::respond(Stream* st, http_res_t* res, bool head) {
+    if (_closed || st->reset) return;
+
+    // the body, referenced by set_body_ref(), in a file, or at the end of buf
+    const fastring& s = *res->buf;
+    const char* body = res->body;
+    int64 n = (int64)res->body_size;
+    const bool use_file = res->file_size >= 0;
+    if (use_file) {
+        n = res->file_size;
+    } else if (!body) {
+        body = s.data() + s.size() - n;
+    }
+
+    fastring h(256);
+    fastring x(16);
+    { /* :status and content-length */
+        const int status = res->status ? res->status : 200;
+        x << status;
+        _henc.encode(h, ":status", 7, x.data(), x.size());
+        if (status != 204 && status != 304) {
+            x.clear();
+            x << n;
+            _henc.encode(h, "content-length", 14, x.data(), x.size());
+        }
+    }
+
+    // headers added by the user, "k: v\r\n", names are lower-cased for HTTP/2
+    const fastring& t = res->header;
+    for (size_t p = 0; p < t.size();) {
+        size_t e = t.find('\r', p);
+        if (e == t.npos) e = t.size();
+        const size_t c = t.find(':', p, e - p);
+        if (c != t.npos) {
+            size_t v = c + 1;
+            while (v < e && t[v] == ' ') ++v;
+            x.clear();
+            x.append(t.data() + p, c - p).tolower();
+            if (!is_conn_header(x)) _henc.encode(h, x.data(), x.size(), t.data() + v, e - v);
+        }
+        p = e + 2;
+    }
+
+    if (head) n = 0;
+    if (!this->send_headers(st->id, h, n == 0)) return;
+
+    fastring b;
+    for (int64 off = 0; off < n;) {
+        uint32 k = this->wait_window(st);
+        if (k == 0) {
+            if (!_closed) this->send_rst(st->id, kCancel);
+            return;
+        }
+        if (k > n - off) k = (uint32)(n - off);
+
+        const char* d = body + off;
+        if (use_file) {
+            b.reserve(k);
+            if (res->file.read((void*)b.data(), k) != k) {
+                ELOG << "http2 read file error, stream: " << st->id;
+                this->send_rst(st->id, kInternalError);
+                return;
+            }
+            d = b.data();
+        }
+
+        _send_window -= k;
+        st->send_window -= k;
+        off += k;
+        if (!this->send_frame(kData, off == n ? kEndStream : 0, st->id, d, k)) return;
+    }
+}
+
+// bytes can be sent on the stream, 0 if it was closed, reset or timed out
+uint32 Session::wait_window(Stream* st) {
+    for (;;) {
+        if (_closed || st->reset) return 0;
+        const int64 x = _send_window < st->send_window ? _send_window : st->send_window;
+        if (x > 0) return (uint32)(x < _max_frame ? x : _max_frame);
+        if (!_win_ev.wait(FLG_http_send_timeout)) return 0;
+    }
+}
+
+// the write lock MUST be held
+bool Session::write_frame(uint8 type, uint8 flags, uint32 id, const void* p, size_t n) {
+    if (_closed) return false;
+    uint8 h[9];
+    h[0] = (uint8)(n >> 16); h[1] = (uint8)(n >> 8); h[2] = (uint8)n;
+    h[3] = type;
+    h[4] = flags;
+    put32(h + 5, id);
+
+    co::iov_t iov[2] = { co::make_iov(h, 9), co::make_iov(p, n) };
+    if (_conn.sendv(iov, n > 0 ? 2 : 1, FLG_http_send_timeout) <= 0) {
+        ELOG << "http2 send error: " << _conn.strerror() << ", connfd: " << _conn.socket();
+        _closed = true;
+        _win_ev.signal();
+        return false;
+    }
+    return true;
+}
+
+bool Session::send_frame(uint8 type, uint8 flags, uint32 id, const void* p, size_t n) {
+    co::MutexGuard g(_wmtx);
+    return this->write_frame(type, flags, id, p, n);
+}
+
+// HEADERS and CONTINUATION frames of a header block MUST be sent together
+bool Session::send_headers(uint32 id, const fastring& h, bool end) {
+    co::MutexGuard g(_wmtx);
+    const uint8 es = end ? kEndStream : 0;
+    if (h.size() <= _max_frame) {
+        return this->write_frame(kHeaders, es | kEndHeaders, id, h.data(), h.size());
+    }
+
+    if (!this->write_frame(kHeaders, es, id, h.data(), _max_frame)) return false;
+    for (size_t p = _max_frame; p < h.size(); p += _max_frame) {
+        const size_t k = h.size() - p > _max_frame ? _max_frame : h.size() - p;
+        const uint8 f = p + k == h.size() ? kEndHeaders : 0;
+        if (!this->write_frame(kContinuation, f, id, h.data() + p, k)) return false;
+    }
+    return true;
+}
+
+bool Session::send_window_update(uint32 id, uint32 n) {
+    uint8 s[4];
+    put32(s, n);
+    return this->send_frame(kWindowUpdate, 0, id, s, 4);
+}
+
+bool Session::send_rst(uint32 id, uint32 err) {
+    uint8 s[4];
+    put32(s, err);
+    return this->send_frame(kRstStream, 0, id, s, 4);
+}
+
+void Session::send_goaway(uint32 err) {
+    uint8 s[8];
+    put32(s, _last_id);
+    put32(s + 4, err);
+    this->send_frame(kGoaway, 0, 0, s, 8);
+}
+
+} // h2
+
+void serve_http2(tcp::Connection&& conn, tcp::Reader&& rd, const std::function<void(const Req&, Res&)>& cb, const bool& stopped) {
+    // the session is shared with the coroutines handling its streams, it MUST
+    // NOT live on the stack, which may be a shared stack saved on switches.
+    auto s = co::make<h2::Session>(std::move(conn), std::move(rd), cb, stopped);
+    s->run();
+    co::del(s);
+}
+
+} // http
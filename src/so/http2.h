@@ -0,0 +1,460 @@
+#pragma once
+
+#include "co/fastring.h"
+#include "co/stl.h"
+#include <string.h>
+
+// definitions of HTTP/2 (RFC 7540) and HPACK (RFC 7541) used by http::Server
+namespace http {
+namespace h2 {
+
+// frame types
+enum {
+    kData = 0,
+    kHeaders,
+    kPriority,
+    kRstStream,
+    kSettings,
+    kPushPromise,
+    kPing,
+    kGoaway,
+    kWindowUpdate,
+    kContinuation,
+};
+
+// frame flags
+enum {
+    kEndStream = 0x01,
+    kAck = 0x01,
+    kEndHeaders = 0x04,
+    kPadded = 0x08,
+    kPriorityFlag = 0x20,
+};
+
+// error codes
+enum {
+    kNoError = 0,
+    kProtocolError = 1,
+    kInternalError = 2,
+    kFlowControlError = 3,
+    kStreamClosed = 5,
+    kFrameSizeError = 6,
+    kRefusedStream = 7,
+    kCancel = 8,
+    kCompressionError = 9,
+};
+
+const uint32 kMaxFrameSize = 16384;      // max frame size the server accepts
+const uint32 kDefaultWindow = 65535;     // initial window size defined by RFC 7540
+const uint32 kRecvWindow = 1 << 20;      // window size the server advertises
+const uint32 kTableSize = 4096;          // size of the HPACK dynamic table
+const uint32 kMaxHeaderBlock = 64 << 10; // max size of a compressed header block
+
+inline uint32 get24(const uint8* p) { return ((uint32)p[0] << 16) | ((uint32)p[1] << 8) | p[2]; }
+inline uint32 get32(const uint8* p) { return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3]; }
+
+inline void put32(uint8* p, uint32 v) {
+    p[0] = (uint8)(v >> 24); p[1] = (uint8)(v >> 16); p[2] = (uint8)(v >> 8); p[3] = (uint8)v;
+}
+
+/**
+ * huffman code of HPACK, see RFC 7541 appendix B
+ *   - The code is canonical, codes of the same length are consecutive in the
+ *     order of the symbols, so the code lengths are enough to decode it.
+ */
+static const uint8 kHuffLen[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// tables of the canonical huffman code
+struct Huffman {
+    Huffman() {
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < 257; ++i) ++count[kHuffLen[i]];
+
+        uint32 c = 0;
+        uint16 k = 0, pos[31];
+        for (int l = 0; l <= 30; ++l) {
+            first[l] = c;
+            offset[l] = pos[l] = k;
+            k += count[l];
+            c = (c + count[l]) << 1;
+        }
+        for (int i = 0; i < 257; ++i) sym[pos[kHuffLen[i]]++] = (uint16)i;
+        for (int l = 1; l <= 30; ++l) {
+            for (uint16 j = 0; j < count[l]; ++j) code[sym[offset[l] + j]] = first[l] + j;
+        }
+    }
+
+    uint32 first[31];  // the first code of each length
+    uint16 count[31];  // number of codes of each length
+    uint16 offset[31]; // index of the first symbol of each length in sym
+    uint16 sym[257];   // symbols ordered by their codes
+    uint32 code[257];  // code of each symbol
+};
+
+inline const Huffman& huffman() {
+    static const Huffman h;
+    return h;
+}
+
+inline bool huff_decode(const uint8* p, size_t n, fastring& out) {
+    const Huffman& h = huffman();
+    uint32 code = 0, len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            code = (code << 1) | ((p[i] >> b) & 1);
+            ++len;
+            const uint32 x = code - h.first[len];
+            if (x < h.count[len]) {
+                const uint16 s = h.sym[h.offset[len] + x];
+                if (s == 256) return false; // EOS in the string
+                out.append((char)s);
+                code = len = 0;
+            } else if (len == 30) {
+                return false;
+            }
+        }
+    }
+    // the padding is at most 7 bits of the EOS prefix (all ones)
+    return len <= 7 && code == (1u << len) - 1;
+}
+
+// size of the huffman coded string
+inline size_t huff_size(const char* p, size_t n) {
+    size_t bits = 0;
+    for (size_t i = 0; i < n; ++i) bits += kHuffLen[(uint8)p[i]];
+    return (bits + 7) >> 3;
+}
+
+inline void huff_encode(fastring& s, const char* p, size_t n) {
+    const Huffman& h = huffman();
+    uint64 x = 0;
+    uint32 bits = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const uint8 c = (uint8)p[i];
+        x = (x << kHuffLen[c]) | h.code[c];
+        bits += kHuffLen[c];
+        while (bits >= 8) {
+            bits -= 8;
+            s.append((char)(x >> bits));
+        }
+    }
+    // pad with the EOS prefix
+    if (bits > 0) s.append((char)((x << (8 - bits)) | (0xff >> bits)));
+}
+
+// static table of HPACK, see RFC 7541 appendix A
+static const char* const kStatic[62][2] = {
+    { "", "" },
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+/**
+ * integer with a prefix of n bits, see RFC 7541 5.1
+ *   - At most 4 bytes follow the prefix, a larger value is taken as an error,
+ *     it is far beyond any size allowed here.
+ */
+inline bool decode_int(const uint8*& p, const uint8* e, int n, uint32& v) {
+    const uint32 m = (1u << n) - 1;
+    v = *p++ & m;
+    if (v < m) return true;
+    for (int s = 0; s < 28; s += 7) {
+        if (p == e) return false;
+        const uint8 b = *p++;
+        v += (uint32)(b & 0x7f) << s;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline void encode_int(fastring& s, int n, uint32 v, uint8 prefix) {
+    const uint32 m = (1u << n) - 1;
+    if (v < m) { s.append((char)(prefix | v)); return; }
+    s.append((char)(prefix | m));
+    for (v -= m; v >= 128; v >>= 7) s.append((char)((v & 0x7f) | 0x80));
+    s.append((char)v);
+}
+
+// string literal, huffman coded if @huffman is true and it is shorter
+inline void encode_str(fastring& s, const char* p, size_t n, bool huffman=true) {
+    const size_t h = huffman ? huff_size(p, n) : n;
+    if (h < n) {
+        encode_int(s, 7, (uint32)h, 0x80);
+        huff_encode(s, p, n);
+    } else {
+        encode_int(s, 7, (uint32)n, 0);
+        s.append(p, n);
+    }
+}
+
+// the static table and a dynamic table of HPACK
+class HpackTable {
+  public:
+    explicit HpackTable(uint32 max) : _size(0), _max(max) {}
+
+    // entry at index @i, false if there is none
+    bool get(uint32 i, const char** k, size_t* kn, const char** v, size_t* vn) const;
+
+    // index of the entry matches @k and @v, or else index of the first entry
+    // matches @k with @full set to false, 0 if none matches
+    uint32 find(const char* k, size_t kn, const char* v, size_t vn, bool* full) const;
+
+    void add(const fastring& k, const fastring& v);
+
+    void set_max_size(uint32 n) { _max = n; this->evict(0); }
+
+    // size of the dynamic table, see RFC 7541 4.1
+    uint32 size() const { return _size; }
+
+  private:
+    void evict(uint32 n);
+
+    struct entry_t {
+        fastring k;
+        fastring v;
+    };
+
+    co::deque<entry_t> _t; // newest at the front
+    uint32 _size;
+    uint32 _max;
+};
+
+inline bool HpackTable::get(uint32 i, const char** k, size_t* kn, const char** v, size_t* vn) const {
+    if (i == 0) return false;
+    if (i < 62) {
+        *k = kStatic[i][0]; *kn = strlen(*k);
+        *v = kStatic[i][1]; *vn = strlen(*v);
+        return true;
+    }
+    i -= 62;
+    if (i >= _t.size()) return false;
+    const entry_t& x = _t[i];
+    *k = x.k.data(); *kn = x.k.size();
+    *v = x.v.data(); *vn = x.v.size();
+    return true;
+}
+
+inline uint32 HpackTable::find(const char* k, size_t kn, const char* v, size_t vn, bool* full) const {
+    uint32 r = 0;
+    for (uint32 i = 1; i < 62; ++i) {
+        const char* x = kStatic[i][0];
+        if (strlen(x) != kn || memcmp(x, k, kn) != 0) continue;
+        const char* y = kStatic[i][1];
+        if (strlen(y) == vn && memcmp(y, v, vn) == 0) { *full = true; return i; }
+        if (r == 0) r = i;
+    }
+    for (uint32 i = 0; i < _t.size(); ++i) {
+        const entry_t& x = _t[i];
+        if (x.k.size() != kn || memcmp(x.k.data(), k, kn) != 0) continue;
+        if (x.v.size() == vn && memcmp(x.v.data(), v, vn) == 0) { *full = true; return i + 62; }
+        if (r == 0) r = i + 62;
+    }
+    *full = false;
+    return r;
+}
+
+inline void HpackTable::evict(uint32 n) {
+    while (!_t.empty() && _size + n > _max) {
+        const entry_t& x = _t.back();
+        _size -= (uint32)(x.k.size() + x.v.size() + 32);
+        _t.pop_back();
+    }
+}
+
+inline void HpackTable::add(const fastring& k, const fastring& v) {
+    const uint32 n = (uint32)(k.size() + v.size() + 32);
+    this->evict(n);
+    if (n > _max) return; // the table is emptied, the entry is not added
+    _t.push_front(entry_t{ k, v });
+    _size += n;
+}
+
+/**
+ * HPACK decoder
+ *   - The dynamic table is limited to kTableSize, the size the server allows
+ *     by default.
+ */
+class HpackDecoder {
+  public:
+    HpackDecoder() : _t(kTableSize) {}
+
+    // decode a header block, f(k, kn, v, vn) is called for each header
+    // return false on compression error
+    template<typename F>
+    bool decode(const uint8* p, const uint8* e, F&& f);
+
+    const HpackTable& table() const { return _t; }
+
+  private:
+    bool decode_str(const uint8*& p, const uint8* e, fastring& s);
+
+    HpackTable _t;
+    fastring _k;
+    fastring _v;
+};
+
+inline bool HpackDecoder::decode_str(const uint8*& p, const uint8* e, fastring& s) {
+    if (p == e) return false;
+    const bool huffman = *p & 0x80;
+    uint32 n;
+    if (!decode_int(p, e, 7, n) || (uint32)(e - p) < n) return false;
+    s.clear();
+    if (huffman) {
+        if (!huff_decode(p, n, s)) return false;
+    } else {
+        s.append(p, n);
+    }
+    p += n;
+    return true;
+}
+
+template<typename F>
+bool HpackDecoder::decode(const uint8* p, const uint8* e, F&& f) {
+    const char* k; const char* v;
+    size_t kn, vn;
+    uint32 i;
+
+    while (p < e) {
+        const uint8 c = *p;
+        if (c & 0x80) { /* indexed header field */
+            if (!decode_int(p, e, 7, i) || !_t.get(i, &k, &kn, &v, &vn)) return false;
+            f(k, kn, v, vn);
+            continue;
+        }
+
+        if ((c & 0xe0) == 0x20) { /* dynamic table size update */
+            if (!decode_int(p, e, 5, i) || i > kTableSize) return false;
+            _t.set_max_size(i);
+            continue;
+        }
+
+        // literal header field, with incremental indexing (01), without
+        // indexing (0000) or never indexed (0001)
+        const bool indexing = c & 0x40;
+        if (!decode_int(p, e, indexing ? 6 : 4, i)) return false;
+        if (i == 0) {
+            if (!this->decode_str(p, e, _k)) return false;
+        } else {
+            if (!_t.get(i, &k, &kn, &v, &vn)) return false;
+            _k.clear();
+            _k.append(k, kn);
+        }
+        if (!this->decode_str(p, e, _v)) return false;
+        f(_k.data(), _k.size(), _v.data(), _v.size());
+        if (indexing) _t.add(_k, _v);
+    }
+    return true;
+}
+
+/**
+ * HPACK encoder
+ *   - A header in the static table or the dynamic table is encoded as an index,
+ *     others as literals with an indexed name if there is one.
+ *   - The server does not index headers of responses, so it has no dynamic
+ *     table to keep in sync with HEADER_TABLE_SIZE of the client.
+ */
+class HpackEncoder {
+  public:
+    explicit HpackEncoder(bool huffman=true) : _t(kTableSize), _huffman(huffman) {}
+
+    // encode a header to @s, it is added to the dynamic table if @index is true
+    void encode(fastring& s, const char* k, size_t kn, const char* v, size_t vn, bool index=false);
+
+    const HpackTable& table() const { return _t; }
+
+  private:
+    HpackTable _t;
+    bool _huffman;
+};
+
+inline void HpackEncoder::encode(fastring& s, const char* k, size_t kn, const char* v, size_t vn, bool index) {
+    bool full;
+    const uint32 i = _t.find(k, kn, v, vn, &full);
+    if (full) { encode_int(s, 7, i, 0x80); return; }
+
+    // literal with incremental indexing (01), or without indexing (0000)
+    index ? encode_int(s, 6, i, 0x40) : encode_int(s, 4, i, 0);
+    if (i == 0) encode_str(s, k, kn, _huffman);
+    encode_str(s, v, vn, _huffman);
+    if (index) _t.add(fastring(k, kn), fastring(v, vn));
+}
+
+} // h2
+} // http
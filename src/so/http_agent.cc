@@ -0,0 +1,423 @@
+#include "./http.h"
+#include "co/http.h"
+#include "co/tcp.h"
+#include "co/co.h"
+#include "co/log.h"
+#include "co/god.h"
+#include "co/tracing.h"
+
+DEF_uint32(http_agent_max_idle, 64, ">>#2 max idle connections of a http::Agent kept in each thread");
+DEF_uint32(http_agent_idle_ms, 30000, ">>#2 idle connections of http::Agent are closed after this many ms");
+
+DEC_uint32(http_timeout);
+DEC_uint32(http_conn_timeout);
+DEC_uint32(http_max_header_size);
+DEC_uint32(http_max_body_size);
+
+namespace http {
+
+// a pooled connection of an agent
+struct AgentConn {
+    AgentConn(const char* host, int port, bool ssl)
+        : cli(host, port, ssl), rd(cli) {
+    }
+
+    // drop the connection, a new one will be made for the next request
+    void reset() {
+        cli.disconnect();
+        rd.clear();
+    }
+
+    tcp::Client cli;
+    tcp::Reader rd;
+    fastring out; // requests to send, reused by requests on this connection
+};
+
+struct ResImpl {
+    ResImpl() : status(0) {
+        req = make_http_req();
+    }
+
+    ~ResImpl() {
+        free_http_req(req);
+    }
+
+    void clear() {
+        req->clear();
+        req->buf = &buf;
+        buf.clear();
+        status = 0;
+    }
+
+    int status;
+    http_req_t* req; // headers and body, parsed like a request
+    fastring buf;
+};
+
+inline ResImpl* res_impl(Response& res) {
+    auto& p = *(ResImpl**) &res;
+    if (!p) p = co::make<ResImpl>();
+    return p;
+}
+
+// results of receiving a response
+enum {
+    kOk = 0,
+    kClose,  // ok, but the connection can't be reused
+    kStale,  // the connection was closed before the response
+    kError,
+};
+
+class AgentImpl {
+  public:
+    explicit AgentImpl(const char* serv_url);
+    ~AgentImpl() = default;
+
+    bool perform(const Request* req, Response* res, size_t n);
+
+    void close() { _pool.clear(); }
+
+  private:
+    void make_req(fastring& out, const Request& req, const char* tp);
+    int recv_res(AgentConn* c, const Request& req, ResImpl* res);
+    int recv_body(AgentConn* c, ResImpl* res);
+    int recv_chunked(AgentConn* c, ResImpl* res);
+
+  private:
+    fastring _host; // value of the Host header
+    fastring _ip;
+    int _port;
+    bool _ssl;
+    co::Pool _pool;
+};
+
+AgentImpl::AgentImpl(const char* serv_url)
+    : _port(0), _ssl(false),
+      _pool(
+        [this]() { return (void*) co::make<AgentConn>(_ip.c_str(), _port, _ssl); },
+        [](void* p) { co::del((AgentConn*)p); },
+        FLG_http_agent_max_idle, FLG_http_agent_idle_ms
+      ) {
+    const char* s = serv_url;
+    if (strncmp(s, "https://", 8) == 0) {
+        _ssl = true;
+        s += 8;
+    } else if (strncmp(s, "http://", 7) == 0) {
+        s += 7;
+    }
+    // unix:/path or unix:@name, the whole path is the address
+    if (strncmp(s, "unix:", 5) == 0) {
+        _ip = s;
+        _host = "localhost";
+        return;
+    }
+
+    const char* e = strchr(s, '/');
+    _host.append(s, e ? e - s : strlen(s));
+
+    // host[:port], [ipv6][:port]
+    _port = _ssl ? 443 : 80;
+    size_t c = _host.rfind(':');
+    if (_host.starts_with('[')) {
+        const size_t x = _host.find(']');
+        CHECK(x != _host.npos) << "invalid http agent url: " << serv_url;
+        _ip.append(_host.data() + 1, x - 1);
+        if (c != _host.npos && c < x) c = _host.npos;
+    } else {
+        _ip.append(_host.data(), c == _host.npos ? _host.size() : c);
+    }
+    if (c != _host.npos) _port = atoi(_host.data() + c + 1);
+    CHECK(!_ip.empty() && _port > 0) << "invalid http agent url: " << serv_url;
+}
+
+inline const char* method_str(int m) {
+    static const char* s[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+    return s[m];
+}
+
+// @tp: traceparent of the current span, NULL if not traced
+void AgentImpl::make_req(fastring& out, const Request& req, const char* tp) {
+    out << method_str(req.method) << ' ';
+    if (req.url.empty() || req.url[0] != '/') out << '/';
+    out << req.url << " HTTP/1.1\r\n"
+        << "Host: " << _host << "\r\n"
+        << req.header;
+    if (tp) out << "traceparent: " << tp << "\r\n";
+    if (req.body_size > 0 || req.method == kPost || req.method == kPut) {
+        out << "Content-Length: " << req.body_size << "\r\n";
+    }
+    out << "\r\n";
+}
+
+int AgentImpl::recv_chunked(AgentConn* c, ResImpl* res) {
+    auto& rd = c->rd;
+    fastring& buf = res->buf;
+    const size_t hlen = buf.size();
+    while (true) {
+        int r = rd.read_until("\r\n", FLG_http_max_header_size, FLG_http_timeout);
+        if (r <= 0 || r == -2) return kError;
+
+        // chunk size:  1a[;xxx]\r\n
+        const char* const s = rd.data();
+        size_t n = 0, i = 0;
+        for (; i < (size_t)r - 2 && s[i] != ';'; ++i) {
+            const char h = s[i];
+            const int v = ('0' <= h && h <= '9') ? h - '0' :
+                          ('a' <= (h | 0x20) && (h | 0x20) <= 'f') ? (h | 0x20) - 'a' + 10 : -1;
+            if (v < 0) return kError;
+            n = (n << 4) + v;
+            if (n > FLG_http_max_body_size) return kError;
+        }
+        if (i == 0) return kError;
+        rd.consume(r);
+
+        if (n == 0) { /* the last chunk, skip the trailer */
+            while (true) {
+                r = rd.read_until("\r\n", FLG_http_max_header_size, FLG_http_timeout);
+                if (r <= 0 || r == -2) return kError;
+                rd.consume(r);
+                if (r == 2) break;
+            }
+            res->req->body_size = (uint32)(buf.size() - hlen);
+            return kOk;
+        }
+
+        if (buf.size() - hlen + n > FLG_http_max_body_size) return kError;
+        const size_t o = buf.size();
+        buf.resize(o + n + 2);
+        r = rd.read_exact((void*)(buf.data() + o), n + 2, FLG_http_timeout);
+        if (r <= 0) return kError;
+        buf.resize(o + n);
+    }
+}
+
+int AgentImpl::recv_body(AgentConn* c, ResImpl* res) {
+    http_req_t* const x = res->req;
+    fastring& buf = res->buf;
+    x->body = (uint32)buf.size();
+
+    const char* te = x->header("Transfer-Encoding");
+    if (*te) {
+        if (!strstr(te, "chunked")) return kError;
+        return this->recv_chunked(c, res);
+    }
+
+    const char* cl = x->header("Content-Length");
+    if (*cl) {
+        const int64 n = atoll(cl);
+        if (n < 0 || n > FLG_http_max_body_size) return kError;
+        x->body_size = (uint32)n;
+        if (n == 0) return kOk;
+        const size_t o = buf.size();
+        buf.resize(o + (size_t)n);
+        const int r = c->rd.read_exact((void*)(buf.data() + o), (size_t)n, FLG_http_timeout);
+        return r > 0 ? kOk : kError;
+    }
+
+    // no length, the body ends when the connection is closed
+    auto& rd = c->rd;
+    while (true) {
+        if (!rd.empty()) {
+            if (buf.size() - x->body + rd.size() > FLG_http_max_body_size) return kError;
+            buf.append(rd.data(), rd.size());
+            rd.consume(rd.size());
+        }
+        const int r = rd.fill(FLG_http_timeout);
+        if (r == 0) break;
+        if (r < 0) return kError;
+    }
+    x->body_size = (uint32)(buf.size() - x->body);
+    return kClose;
+}
+
+int AgentImpl::recv_res(AgentConn* c, const Request& req, ResImpl* res) {
+    auto& rd = c->rd;
+    fastring& buf = res->buf;
+    bool first = true;
+
+    while (true) {
+        res->clear();
+        const int r = rd.read_until("\r\n\r\n", FLG_http_max_header_size, FLG_http_timeout);
+        if (r == -2) {
+            ELOG << "http agent recv error: header too long";
+            return kError;
+        }
+        if (r <= 0) {
+            // nothing of the response was received on a pooled connection
+            return (first && rd.empty() && (r == 0 || !co::timeout())) ? kStale : kError;
+        }
+        first = false;
+
+        buf.append(rd.data(), r);
+        rd.consume(r);
+
+        // status line: HTTP/1.1 200 OK
+        const size_t x = buf.find('\r');
+        if (x < 12 || !buf.starts_with("HTTP/1.") || buf[8] != ' ') {
+            ELOG << "http agent invalid status line";
+            return kError;
+        }
+        const int status = atoi(buf.data() + 9);
+        buf[r - 2] = '\0'; // make headers null-terminated
+        if (parse_http_headers(&buf, r - 2, x + 2, res->req) != 0) {
+            ELOG << "http agent invalid response headers";
+            return kError;
+        }
+        res->status = status;
+        res->req->version = buf[7] == '1' ? kHTTP11 : kHTTP10;
+        if (status < 200) continue; // 1xx, the final response follows
+
+        // connection reuse
+        const char* const cs = res->req->header("Connection");
+        bool keep = res->req->version == kHTTP11;
+        if (*cs) {
+            fastring v(cs);
+            v.tolower();
+            if (v == "close") keep = false;
+            if (v == "keep-alive") keep = true;
+        }
+
+        int e = kOk;
+        if (req.method == kHead || status == 204 || status == 304) {
+            res->req->body = (uint32)buf.size();
+        } else {
+            e = this->recv_body(c, res);
+        }
+        if (e == kOk && !keep) e = kClose;
+        return e;
+    }
+}
+
+bool AgentImpl::perform(const Request* req, Response* res, size_t n) {
+    AgentConn* const c = (AgentConn*)_pool.pop();
+    bool retry = true;
+    for (size_t i = 0; i < n; ++i) {
+        if (req[i].method == kPost) retry = false;
+    }
+
+    // a span for the requests, its context is sent in each of them
+    tracing::Span sp("http", tracing::kClient);
+    char tp[tracing::kTraceparentSize + 1];
+    if (sp.recording()) {
+        fastring s(req[0].url.size() + 16);
+        s << "http " << method_str(req[0].method) << ' ' << req[0].url;
+        sp.set_name(s.data(), s.size());
+        tracing::format(sp.context(), tp);
+    }
+
+    bool ok = false;
+  again:
+    {
+        const bool reused = c->cli.connected();
+        if (!reused && !c->cli.connect(FLG_http_conn_timeout)) {
+            ELOG << "http agent connect to " << _host << " failed: " << c->cli.strerror();
+            c->reset();
+            goto end;
+        }
+
+        // requests and small bodies are sent together
+        fastring& out = c->out;
+        out.clear();
+        for (size_t i = 0; i < n; ++i) {
+            this->make_req(out, req[i], sp.recording() ? tp : 0);
+            if (req[i].body_size > 0) {
+                if (req[i].body_size <= 64 * 1024) {
+                    out.append(req[i].body, req[i].body_size);
+                } else {
+                    if (c->cli.send(out.data(), (int)out.size(), FLG_http_timeout) <= 0) goto send_err;
+                    out.clear();
+                    const int x = c->cli.send(req[i].body, (int)req[i].body_size, FLG_http_timeout);
+                    if (x <= 0) goto send_err;
+                }
+            }
+        }
+        if (!out.empty() && c->cli.send(out.data(), (int)out.size(), FLG_http_timeout) <= 0) {
+            goto send_err;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            const int r = this->recv_res(c, req[i], res_impl(res[i]));
+            if (r == kStale && i == 0 && reused && retry) {
+                c->reset();
+                retry = false;
+                goto again;
+            }
+            if (r == kStale || r == kError) {
+                ELOG << "http agent recv error: " << c->cli.strerror() << ", host: " << _host;
+                c->reset();
+                goto end;
+            }
+            if (r == kClose) {
+                c->reset();
+                ok = i + 1 == n;
+                goto end;
+            }
+        }
+        ok = true;
+        goto end;
+
+      send_err:
+        if (reused && retry) {
+            c->reset();
+            retry = false;
+            goto again;
+        }
+        ELOG << "http agent send error: " << c->cli.strerror() << ", host: " << _host;
+        c->reset();
+    }
+
+  end:
+    _pool.push(c);
+    if (sp.recording()) sp.set_status(ok ? res_impl(res[n - 1])->status : -1);
+    return ok;
+}
+
+Response::Response() : _p(0) {}
+
+Response::~Response() {
+    if (_p) {
+        co::del((ResImpl*)_p);
+        _p = 0;
+    }
+}
+
+int Response::status() const {
+    return _p ? ((ResImpl*)_p)->status : 0;
+}
+
+const char* Response::header(const char* key) const {
+    return _p ? ((ResImpl*)_p)->req->header(key) : "";
+}
+
+const char* Response::body() const {
+    return _p ? ((ResImpl*)_p)->buf.data() + ((ResImpl*)_p)->req->body : "";
+}
+
+size_t Response::body_size() const {
+    return _p ? ((ResImpl*)_p)->req->body_size : 0;
+}
+
+Agent::Agent(const char* serv_url) {
+    _p = co::make<AgentImpl>(serv_url);
+}
+
+Agent::~Agent() {
+    if (_p) {
+        co::del((AgentImpl*)_p);
+        _p = 0;
+    }
+}
+
+bool Agent::perform(const Request& req, Response& res) {
+    return ((AgentImpl*)_p)->perform(&req, &res, 1);
+}
+
+bool Agent::pipeline(const Request* req, Response* res, size_t n) {
+    return n == 0 || ((AgentImpl*)_p)->perform(req, res, n);
+}
+
+void Agent::close() {
+    ((AgentImpl*)_p)->close();
+}
+
+} // http
@@ -0,0 +1,310 @@
+#include "./http.h"
+#include "co/http.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/god.h"
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAS_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+DEF_bool(http_compress, false, ">>#2 compress bodies of http responses by Accept-Encoding of the requests, "
+    "with gzip, br or zstd, whichever the library was built with");
+DEF_uint32(http_compress_min_size, 1024, ">>#2 bodies smaller than this are not compressed");
+DEF_uint32(http_compress_max_size, 8 << 20, ">>#2 bodies in memory larger than this are not compressed, "
+    "files are compressed on the fly whatever the size is");
+
+namespace http {
+
+const char* coding_name(int c) {
+    switch (c) {
+      case kGzip:   return "gzip";
+      case kBrotli: return "br";
+      case kZstd:   return "zstd";
+      default:      return "identity";
+    }
+}
+
+inline bool has_coding(int c) {
+    switch (c) {
+  #ifdef HAS_ZLIB
+      case kGzip:   return true;
+  #endif
+  #ifdef HAS_BROTLI
+      case kBrotli: return true;
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd:   return true;
+  #endif
+      default:      return false;
+    }
+}
+
+// q-value of a coding in Accept-Encoding, "1", "0.5", "0.005", etc.
+inline int qvalue(const char* b, const char* e) {
+    while (b < e && *b == ' ') ++b;
+    if (e - b < 2 || (b[0] | 0x20) != 'q' || b[1] != '=') return 1000;
+    b += 2;
+    if (b == e) return 0;
+    int q = (*b++ == '1') ? 1000 : 0;
+    if (b < e && *b++ == '.') {
+        for (int m = 100; m > 0 && b < e && '0' <= *b && *b <= '9'; m /= 10) q += (*b++ - '0') * m;
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+int pick_coding(const char* accept) {
+    // preferred by the server if the client has no preference
+    static const int kPrefer[] = { kBrotli, kZstd, kGzip };
+    int q[kCodings] = { 0 };
+    int any = -1; // q-value of "*"
+
+    for (const char* p = accept; *p;) {
+        while (*p == ' ' || *p == ',') ++p;
+        const char* e = strchr(p, ',');
+        if (!e) e = p + strlen(p);
+        const char* s = (const char*) memchr(p, ';', e - p);
+        const char* n = s ? s : e; // end of the name
+        while (n > p && n[-1] == ' ') --n;
+        const int v = s ? qvalue(s + 1, e) : 1000;
+
+        const size_t k = n - p;
+        if (k == 4 && god::byte_eq<uint32>(p, "gzip")) {
+            q[kGzip] = v + 1;
+        } else if (k == 2 && p[0] == 'b' && p[1] == 'r') {
+            q[kBrotli] = v + 1;
+        } else if (k == 4 && god::byte_eq<uint32>(p, "zstd")) {
+            q[kZstd] = v + 1;
+        } else if (k == 1 && *p == '*') {
+            any = v;
+        }
+        p = e;
+    }
+
+    int c = kIdentity, best = 0;
+    for (int i = 0; i < kCodings - 1; ++i) {
+        const int x = kPrefer[i];
+        if (!has_coding(x)) continue;
+        const int v = q[x] ? q[x] - 1 : (any >= 0 ? any : 0);
+        if (v > best) { best = v; c = x; }
+    }
+    return c;
+}
+
+// types of bodies that are worth compressing, others are likely compressed already
+bool compressible(const char* type) {
+    if (strncmp(type, "text/", 5) == 0) return true;
+    return strstr(type, "json") || strstr(type, "javascript") || strstr(type, "xml") ||
+           strstr(type, "wasm") || strstr(type, "x-www-form-urlencoded");
+}
+
+Compressor::Compressor(int coding, bool best) : _p(0), _c(coding) {
+    switch (coding) {
+  #ifdef HAS_ZLIB
+      case kGzip: {
+        z_stream* z = (z_stream*) co::zalloc(sizeof(z_stream));
+        // 15 + 16: window bits of 15, with a gzip header and trailer
+        if (deflateInit2(z, best ? 9 : 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            co::free(z, sizeof(z_stream));
+            break;
+        }
+        _p = z;
+        break;
+      }
+  #endif
+  #ifdef HAS_BROTLI
+      case kBrotli: {
+        BrotliEncoderState* s = BrotliEncoderCreateInstance(0, 0, 0);
+        if (s) BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, best ? 11 : 5);
+        _p = s;
+        break;
+      }
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd: {
+        ZSTD_CCtx* x = ZSTD_createCCtx();
+        if (x) ZSTD_CCtx_setParameter(x, ZSTD_c_compressionLevel, best ? 19 : 3);
+        _p = x;
+        break;
+      }
+  #endif
+      default:
+        break;
+    }
+    if (!_p && coding != kIdentity) ELOG << "http create compressor failed: " << coding_name(coding);
+}
+
+Compressor::~Compressor() {
+    if (!_p) return;
+    switch (_c) {
+  #ifdef HAS_ZLIB
+      case kGzip:
+        deflateEnd((z_stream*)_p);
+        co::free(_p, sizeof(z_stream));
+        break;
+  #endif
+  #ifdef HAS_BROTLI
+      case kBrotli:
+        BrotliEncoderDestroyInstance((BrotliEncoderState*)_p);
+        break;
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd:
+        ZSTD_freeCCtx((ZSTD_CCtx*)_p);
+        break;
+  #endif
+      default:
+        break;
+    }
+    _p = 0;
+}
+
+bool Compressor::update(const void* s, size_t n, fastring& out, bool end) {
+    if (!_p) return false;
+    switch (_c) {
+  #ifdef HAS_ZLIB
+      case kGzip: {
+        z_stream* z = (z_stream*)_p;
+        z->next_in = (Bytef*)s;
+        z->avail_in = (uInt)n;
+        const int flush = end ? Z_FINISH : Z_NO_FLUSH;
+        int r;
+        do {
+            out.reserve(out.size() + (n >> 1) + 4096);
+            const size_t k = out.capacity() - out.size();
+            z->next_out = (Bytef*)(out.data() + out.size());
+            z->avail_out = (uInt)k;
+            r = deflate(z, flush);
+            if (r == Z_STREAM_ERROR) return false;
+            out.resize(out.size() + k - z->avail_out);
+        } while (z->avail_out == 0 || (end && r != Z_STREAM_END));
+        return true;
+      }
+  #endif
+  #ifdef HAS_BROTLI
+      case kBrotli: {
+        BrotliEncoderState* b = (BrotliEncoderState*)_p;
+        const uint8_t* in = (const uint8_t*)s;
+        size_t ai = n;
+        const BrotliEncoderOperation op = end ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+        while (true) {
+            out.reserve(out.size() + (n >> 1) + 4096);
+            size_t ao = out.capacity() - out.size();
+            const size_t k = ao;
+            uint8_t* o = (uint8_t*)(out.data() + out.size());
+            if (!BrotliEncoderCompressStream(b, op, &ai, &in, &ao, &o, 0)) return false;
+            out.resize(out.size() + k - ao);
+            if (ai == 0 && !BrotliEncoderHasMoreOutput(b) && (!end || BrotliEncoderIsFinished(b))) break;
+        }
+        return true;
+      }
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd: {
+        ZSTD_CCtx* x = (ZSTD_CCtx*)_p;
+        ZSTD_inBuffer in = { s, n, 0 };
+        const ZSTD_EndDirective op = end ? ZSTD_e_end : ZSTD_e_continue;
+        while (true) {
+            out.reserve(out.size() + (n >> 1) + 4096);
+            ZSTD_outBuffer o = { (void*)(out.data() + out.size()), out.capacity() - out.size(), 0 };
+            const size_t r = ZSTD_compressStream2(x, &o, &in, op);
+            if (ZSTD_isError(r)) return false;
+            out.resize(out.size() + o.pos);
+            if (end ? r == 0 : in.pos == in.size) break;
+        }
+        return true;
+      }
+  #endif
+      default:
+        return false;
+    }
+}
+
+bool compress(int coding, const void* s, size_t n, fastring& out, bool best) {
+    Compressor c(coding, best);
+    return c.update(s, n, out, true);
+}
+
+inline bool icase_eq(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i] && ::tolower((uint8)a[i]) != ::tolower((uint8)b[i])) return false;
+    }
+    return true;
+}
+
+// value of header @k added by the user, "k: v\r\n", NULL if not found
+inline const char* res_header(const fastring& h, const char* k, size_t n, size_t* len) {
+    for (size_t p = 0; p + n < h.size();) {
+        if (h[p + n] == ':' && icase_eq(h.data() + p, k, n)) {
+            size_t v = p + n + 1;
+            while (v < h.size() && h[v] == ' ') ++v;
+            const size_t e = h.find('\r', v);
+            *len = (e == h.npos ? h.size() : e) - v;
+            return h.data() + v;
+        }
+        p = h.find('\n', p);
+        if (p == h.npos) break;
+        ++p;
+    }
+    return 0;
+}
+
+int compress_res(const http_req_t* req, http_res_t* res) {
+    if (!FLG_http_compress || req->method == kHead) return kIdentity;
+    const uint32 status = res->status ? res->status : 200;
+    if (status < 200 || status == 204 || status == 206 || status == 304) return kIdentity;
+
+    // an iobuf body is sent as it is, without being copied for compression
+    if (!res->iob.empty()) return kIdentity;
+
+    const bool use_file = res->file_size >= 0;
+    const int64 n = use_file ? res->file_size : (int64)res->body_size;
+    if (n < FLG_http_compress_min_size) return kIdentity;
+    if (!use_file && n > FLG_http_compress_max_size) return kIdentity;
+
+    // bodies compressed or ranged by the user are left as they are
+    const fastring& h = res->header;
+    size_t k = 0;
+    if (res_header(h, "Content-Encoding", 16, &k) || res_header(h, "Content-Range", 13, &k)) {
+        return kIdentity;
+    }
+
+    // files are compressed only if they are known to be compressible
+    const char* t = res_header(h, "Content-Type", 12, &k);
+    if (use_file && !t) return kIdentity;
+    if (t && !compressible(fastring(t, k).c_str())) return kIdentity;
+
+    // chunked encoding is required to stream a file on HTTP/1.x
+    if (use_file && res->version != kHTTP11) return kIdentity;
+
+    const int c = pick_coding(req->header("Accept-Encoding"));
+    if (c == kIdentity) return kIdentity;
+
+    const bool vary = res_header(h, "Vary", 4, &k) == 0;
+    if (use_file) {
+        res->add_header("Content-Encoding", coding_name(c));
+        if (vary) res->add_header("Vary", "Accept-Encoding");
+        res->coding = c;
+        res->make_header(-1);
+        return c;
+    }
+
+    const char* body = res->body ? res->body : res->buf->data() + res->buf->size() - n;
+    fastring z(god::align_up<4096>((size_t)(n >> 1) + 256));
+    if (!compress(c, body, (size_t)n, z, false) || (int64)z.size() >= n) return kIdentity;
+
+    res->add_header("Content-Encoding", coding_name(c));
+    if (vary) res->add_header("Vary", "Accept-Encoding");
+    res->set_body(z.data(), z.size());
+    return c;
+}
+
+} // http
@@ -0,0 +1,231 @@
+#include "./http.h"
+#include "co/http.h"
+#include "co/log.h"
+#include "co/stl.h"
+
+namespace http {
+
+const int kMethods = kOptions + 1;
+
+inline const char* method_name(int m) {
+    static const char* s[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+    return s[m];
+}
+
+struct Route {
+    Router::F f;
+    co::vector<fastring> names; // names of params, in order of the path
+};
+
+// a node for a segment of paths
+struct Node {
+    Node() : param(0), wild(0) {
+        memset(routes, 0, sizeof(routes));
+    }
+
+    ~Node() {
+        for (size_t i = 0; i < children.size(); ++i) co::del(children[i]);
+        if (param) co::del(param);
+        if (wild) co::del(wild);
+        for (int i = 0; i < kMethods; ++i) if (routes[i]) co::del(routes[i]);
+    }
+
+    bool has_routes() const {
+        for (int i = 0; i < kMethods; ++i) if (routes[i]) return true;
+        return false;
+    }
+
+    fastring seg;               // literal segment
+    co::vector<Node*> children; // literal children
+    Node* param;                // child for ":name"
+    Node* wild;                 // child for "*name", it has no children
+    Route* routes[kMethods];    // routes ending at this node, by method
+};
+
+class RouterImpl {
+  public:
+    RouterImpl() = default;
+    ~RouterImpl() = default;
+
+    void add(Method m, const char* path, Router::F&& f);
+
+    // find the node for the path in [b, e), NULL if not found.
+    //   - @m: the method, -1 for any
+    //   - @p: captures of params, <offset, length> from @s
+    const Node* match(
+        const Node* n, const char* s, const char* b, const char* e,
+        int m, uint32* p, uint32& k
+    ) const;
+
+    const Node* root() const { return &_root; }
+
+  private:
+    Node _root;
+};
+
+void RouterImpl::add(Method m, const char* path, Router::F&& f) {
+    CHECK(path && *path == '/') << "http route must begin with '/': " << path;
+    CHECK(f != NULL) << "http route callback not set: " << path;
+
+    Node* n = &_root;
+    co::vector<fastring> names;
+    const char* p = path;
+    while (true) {
+        while (*p == '/') ++p;
+        if (!*p) break;
+        const char* q = strchr(p, '/');
+        if (!q) q = p + strlen(p);
+
+        if (*p == ':' || *p == '*') {
+            CHECK(q - p > 1) << "http route param without a name: " << path;
+            CHECK(names.size() < kMaxParams) << "too many params in http route: " << path;
+            names.push_back(fastring(p + 1, q - p - 1));
+            Node*& x = *p == ':' ? n->param : n->wild;
+            if (!x) x = co::make<Node>();
+            n = x;
+            if (*p == '*') {
+                CHECK(*q == '\0') << "http route wildcard must be at the end: " << path;
+                break;
+            }
+        } else {
+            Node* x = 0;
+            for (size_t i = 0; i < n->children.size(); ++i) {
+                Node* c = n->children[i];
+                if (c->seg.size() == (size_t)(q - p) && memcmp(c->seg.data(), p, q - p) == 0) {
+                    x = c;
+                    break;
+                }
+            }
+            if (!x) {
+                x = co::make<Node>();
+                x->seg.append(p, q - p);
+                n->children.push_back(x);
+            }
+            n = x;
+        }
+        p = q;
+    }
+
+    CHECK(n->routes[m] == 0) << "http route already exists: " << method_name(m) << ' ' << path;
+    Route* r = co::make<Route>();
+    r->f = std::move(f);
+    r->names.swap(names);
+    n->routes[m] = r;
+}
+
+const Node* RouterImpl::match(
+    const Node* n, const char* s, const char* b, const char* e,
+    int m, uint32* p, uint32& k
+) const {
+    while (b < e && *b == '/') ++b;
+    if (b == e) {
+        if (m < 0 ? n->has_routes() : n->routes[m] != 0) return n;
+        if (n->wild && (m < 0 || n->wild->routes[m])) {
+            p[k] = (uint32)(b - s); p[k + 1] = 0; k += 2;
+            return n->wild;
+        }
+        return 0;
+    }
+
+    const char* q = (const char*) memchr(b, '/', e - b);
+    if (!q) q = e;
+    const size_t l = q - b;
+
+    for (size_t i = 0; i < n->children.size(); ++i) {
+        const Node* c = n->children[i];
+        if (c->seg.size() == l && memcmp(c->seg.data(), b, l) == 0) {
+            const Node* x = this->match(c, s, q, e, m, p, k);
+            if (x) return x;
+            break;
+        }
+    }
+
+    if (n->param && k < kMaxParams * 2) {
+        p[k] = (uint32)(b - s); p[k + 1] = (uint32)l; k += 2;
+        const Node* x = this->match(n->param, s, q, e, m, p, k);
+        if (x) return x;
+        k -= 2;
+    }
+
+    if (n->wild && (m < 0 || n->wild->routes[m]) && k < kMaxParams * 2) {
+        p[k] = (uint32)(b - s); p[k + 1] = (uint32)(e - b); k += 2;
+        return n->wild;
+    }
+    return 0;
+}
+
+Router::Router() {
+    _p = co::make<RouterImpl>();
+}
+
+Router::~Router() {
+    if (_p) {
+        co::del((RouterImpl*)_p);
+        _p = 0;
+    }
+}
+
+Router& Router::on(Method m, const char* path, F&& f) {
+    ((RouterImpl*)_p)->add(m, path, std::move(f));
+    return *this;
+}
+
+void Router::operator()(const Req& req, Res& res) const {
+    const RouterImpl* const r = (const RouterImpl*)_p;
+    http_req_t* const x = *(http_req_t**)&req;
+    const fastring& url = x->url;
+    const char* const s = url.data();
+    const char* e = (const char*) memchr(s, '?', url.size());
+    if (!e) e = s + url.size();
+
+    int m = x->method;
+    uint32 k = 0;
+    const Node* n = r->match(r->root(), s, s, e, m, x->params, k);
+    if (!n && m == kHead) {
+        k = 0;
+        n = r->match(r->root(), s, s, e, (m = kGet), x->params, k);
+    }
+
+    if (n) {
+        const Route* const t = n->routes[m];
+        x->route = t;
+        x->param_num = k >> 1;
+        t->f(req, res);
+        return;
+    }
+
+    k = 0;
+    n = r->match(r->root(), s, s, e, -1, x->params, k);
+    if (!n) {
+        res.set_status(404);
+        return;
+    }
+
+    char allow[64];
+    size_t l = 0;
+    for (int i = 0; i < kMethods; ++i) {
+        if (!n->routes[i]) continue;
+        const char* v = method_name(i);
+        if (l > 0) { allow[l++] = ','; allow[l++] = ' '; }
+        const size_t z = strlen(v);
+        memcpy(allow + l, v, z);
+        l += z;
+    }
+    allow[l] = '\0';
+    res.set_status(405);
+    res.add_header("Allow", allow);
+}
+
+Param Req::param(const char* name) const {
+    const Route* const r = (const Route*)_p->route;
+    if (!r) return Param();
+    const size_t n = r->names.size() < _p->param_num ? r->names.size() : _p->param_num;
+    for (size_t i = 0; i < n; ++i) {
+        if (r->names[i] == name) {
+            return Param(_p->url.data() + _p->params[i * 2], _p->params[i * 2 + 1]);
+        }
+    }
+    return Param();
+}
+
+} // http
@@ -0,0 +1,817 @@
+#include "co/prefork.h"
+#include "co/log.h"
+#include "co/os.h"
+#include "co/str.h"
+#include "co/stl.h"
+#include "co/time.h"
+#include "co/thread.h"
+
+DEF_uint32(prefork_workers, 0, ">>#2 number of worker processes in prefork mode, see prefork::run(), "
+    "0 to run a single process");
+DEF_uint32(prefork_drain_ms, 30000, ">>#2 max time in ms a prefork worker waits for its connections to be "
+    "closed before it exits");
+DEF_uint32(prefork_ready_ms, 60000, ">>#2 max time in ms new prefork workers take to start listening in a "
+    "hot restart, or the restart is abandoned");
+
+#ifdef _WIN32
+namespace prefork {
+
+int run(int, char**) { return -1; }
+int worker_id() { return -1; }
+void on_drain(std::function<void()>&&) {}
+void hold() {}
+void release() {}
+
+namespace xx {
+sock_t listener(const char*, int) { return (sock_t)-1; }
+void keep(const char*, int, sock_t) {}
+} // xx
+
+} // prefork
+
+#else
+#include "../co/hook.h"
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+extern char** environ;
+
+DEC_string(log_file_name);
+
+namespace prefork {
+namespace xx {
+
+// Processes talk over SOCK_SEQPACKET unix sockets, a message starts with its
+// type, and a listener is passed as |type|idx (int32)|key| with the fd.
+//   worker -> master:  'G' logs, 'L' ask for a listener, 'K' keep a listener
+//   master -> worker:  'F' the listener, 'C' create it
+//   old -> new master: 'F' a listener, 'E' no more listeners
+//   new -> old master: 'R' the new workers are ready
+// Workers are asked to drain by a byte written to a pipe.
+//
+// The raw system calls are used, as a worker asks for listeners in coroutines,
+// and the hooks would turn the sockets to non-blocking.
+const size_t max_msg = 64 * 1024;
+
+inline void set_cloexec(int fd) {
+    __sys_api(fcntl)(fd, F_SETFD, FD_CLOEXEC);
+}
+
+inline void close_fd(int& fd) {
+    if (fd >= 0) { __sys_api(close)(fd); fd = -1; }
+}
+
+// send a message, with @sfd if it is not -1
+bool send_msg(int fd, const void* p, size_t n, int sfd=-1) {
+    struct iovec iov = { (void*)p, n };
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr h;
+        char b[CMSG_SPACE(sizeof(int))];
+    } c;
+    if (sfd >= 0) {
+        memset(&c, 0, sizeof(c));
+        m.msg_control = c.b;
+        m.msg_controllen = sizeof(c.b);
+        struct cmsghdr* h = CMSG_FIRSTHDR(&m);
+        h->cmsg_level = SOL_SOCKET;
+        h->cmsg_type = SCM_RIGHTS;
+        h->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(h), &sfd, sizeof(int));
+    }
+
+    ssize_t r;
+    do { r = __sys_api(sendmsg)(fd, &m, MSG_NOSIGNAL); } while (r == -1 && errno == EINTR);
+    return r == (ssize_t)n;
+}
+
+// receive a message, return its size, 0 on EOF or -1 on error. *rfd is the fd
+// passed with it, or -1.
+ssize_t recv_msg(int fd, void* p, size_t n, int* rfd) {
+    struct iovec iov = { p, n };
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr h;
+        char b[CMSG_SPACE(sizeof(int))];
+    } c;
+    m.msg_control = c.b;
+    m.msg_controllen = sizeof(c.b);
+
+    ssize_t r;
+    do { r = __sys_api(recvmsg)(fd, &m, 0); } while (r == -1 && errno == EINTR);
+
+    *rfd = -1;
+    struct cmsghdr* h = r > 0 ? CMSG_FIRSTHDR(&m) : 0;
+    if (h && h->cmsg_level == SOL_SOCKET && h->cmsg_type == SCM_RIGHTS) {
+        memcpy(rfd, CMSG_DATA(h), sizeof(int));
+        set_cloexec(*rfd);
+    }
+    return r;
+}
+
+inline fastring listener_msg(char type, const char* key, int idx) {
+    fastring s(16 + strlen(key));
+    int32 i = idx;
+    s.append(type).append(&i, sizeof(i)).append(key);
+    return s;
+}
+
+// parse a listener message of @n bytes, return false if it is invalid
+inline bool parse_listener(const char* p, size_t n, fastring& key, int& idx) {
+    if (n < 1 + sizeof(int32)) return false;
+    int32 i;
+    memcpy(&i, p + 1, sizeof(i));
+    idx = i;
+    key.clear();
+    key.append(p + 1 + sizeof(i), n - 1 - sizeof(i));
+    return true;
+}
+
+// environment of a child process, with @var added
+co::vector<char*> child_env(const fastring& var) {
+    co::vector<char*> v;
+    for (char** p = environ; p && *p; ++p) {
+        if (strncmp(*p, "CO_PREFORK_", 11) != 0) v.push_back(*p);
+    }
+    v.push_back((char*)var.c_str());
+    v.push_back(0);
+    return v;
+}
+
+// fork and exec @exe with @var in its environment, @a and @b are left open in
+// the child. A worker is put in its own process group if @pg is true, so that
+// ctrl-c on the terminal reaches the master only, which drains the workers.
+// Return pid of the child, or -1 on error.
+int exec_child(const char* exe, char** argv, const fastring& var, int a, int b, bool pg) {
+    co::vector<char*> env = child_env(var);
+    const int pid = ::fork();
+    if (pid == 0) {
+        // only async-signal-safe calls in the child
+        __sys_api(fcntl)(a, F_SETFD, 0);
+        if (b >= 0) __sys_api(fcntl)(b, F_SETFD, 0);
+        if (pg) ::setpgid(0, 0);
+        ::execve(exe, argv, env.data());
+        ::_exit(127);
+    }
+    return pid;
+}
+
+class Worker {
+  public:
+    Worker() : _id(-1), _ctl(-1), _drain(-1), _holds(0), _draining(false) {}
+
+    void start(int id, int ctl, int drain);
+    int id() const { return _id; }
+
+    void on_drain(std::function<void()>&& cb);
+    void hold() { atomic_inc(&_holds, mo_relaxed); }
+    void release() { atomic_dec(&_holds, mo_acq_rel); }
+
+    sock_t listener(const char* key, int idx);
+    void keep(const char* key, int idx, sock_t fd);
+
+  private:
+    void send_logs(const void* p, size_t n);
+    void wait_drain();
+
+    int _id;
+    int _ctl;   // socket to the master
+    int _drain; // read end of the drain pipe
+    uint32 _holds;
+    bool _draining;
+    ::Mutex _mtx;  // for requests to the master
+    ::Mutex _cmtx; // for _cbs and _draining
+    co::vector<std::function<void()>> _cbs;
+    fastring _buf; // for send_logs(), called by the logging thread only
+};
+
+inline Worker& worker() {
+    static auto w = co::static_new<Worker>();
+    return *w;
+}
+
+void Worker::start(int id, int ctl, int drain) {
+    _id = id;
+    _ctl = ctl;
+    _drain = drain;
+    set_cloexec(ctl);
+    set_cloexec(drain);
+
+    // level logs are merged by the master, other log files are per worker
+    fastring name = FLG_log_file_name.empty() ? os::exename() : FLG_log_file_name;
+    name << "_w" << id;
+    FLG_log_file_name = name;
+    FLG_cout = false; // the master writes the merged logs to stderr
+    log::set_write_cb([this](const void* p, size_t n) { this->send_logs(p, n); });
+
+    Thread(&Worker::wait_drain, this).detach();
+}
+
+// logs are split into messages at line breaks
+void Worker::send_logs(const void* p, size_t n) {
+    const char* s = (const char*)p;
+    const size_t max_len = max_msg - 1;
+    while (n > 0) {
+        size_t k = n;
+        if (k > max_len) {
+            k = max_len;
+            while (k > 0 && s[k - 1] != '\n') --k;
+            if (k == 0) k = max_len; // a single log is too long
+        }
+        _buf.clear();
+        _buf.append('G').append(s, k);
+        if (!send_msg(_ctl, _buf.data(), _buf.size())) return; // the master is gone
+        s += k;
+        n -= k;
+    }
+}
+
+sock_t Worker::listener(const char* key, int idx) {
+    fastring s = listener_msg('L', key, idx);
+    char c = 0;
+    int fd = -1;
+    ::MutexGuard g(_mtx);
+    if (!send_msg(_ctl, s.data(), s.size())) return (sock_t)-1;
+    const ssize_t r = recv_msg(_ctl, &c, 1, &fd);
+    if (r == 1 && c == 'F' && fd >= 0) return (sock_t)fd;
+    close_fd(fd);
+    return (sock_t)-1;
+}
+
+void Worker::keep(const char* key, int idx, sock_t fd) {
+    fastring s = listener_msg('K', key, idx);
+    ::MutexGuard g(_mtx);
+    if (!send_msg(_ctl, s.data(), s.size(), (int)fd)) {
+        WLOG << "prefork worker " << _id << " failed to pass listener " << key << " to the master";
+    }
+}
+
+void Worker::on_drain(std::function<void()>&& cb) {
+    {
+        ::MutexGuard g(_cmtx);
+        if (!_draining) { _cbs.push_back(std::move(cb)); return; }
+    }
+    cb();
+}
+
+// wait for the master to ask it to drain, or the master is gone
+void Worker::wait_drain() {
+    char c;
+    ssize_t r;
+    do { r = __sys_api(read)(_drain, &c, 1); } while (r == -1 && errno == EINTR);
+    LOG << "prefork worker " << _id << (r == 1 ? " draining" : " lost the master, draining");
+
+    co::vector<std::function<void()>> cbs;
+    {
+        ::MutexGuard g(_cmtx);
+        _draining = true;
+        cbs.swap(_cbs);
+    }
+    for (size_t i = 0; i < cbs.size(); ++i) cbs[i]();
+
+    const int64 deadline = now::ms() + FLG_prefork_drain_ms;
+    while (atomic_load(&_holds, mo_acquire) > 0 && now::ms() < deadline) sleep::ms(10);
+    LOG << "prefork worker " << _id << " exit, holds: " << atomic_load(&_holds, mo_relaxed);
+    log::exit();
+    ::_exit(0);
+}
+
+// a listener kept by the master
+struct Listener {
+    fastring key;
+    int idx;   // the worker it belongs to, or -1 if shared
+    int fd;
+    int owner; // the worker creating it, or -1
+    bool claimed;
+    co::vector<int> waiters; // workers waiting for it to be created
+};
+
+struct Proc {
+    int pid;
+    int ctl;
+    int drain;
+    bool ready;     // it asked for a listener
+    int64 spawn_ms; // time it was spawned, or to be respawned
+};
+
+int g_sig[2] = { -1, -1 }; // self-pipe for signals of the master
+
+void on_signal(int sig) {
+    const int e = errno;
+    const char c = (char)sig;
+    auto r = __sys_api(write)(g_sig[1], &c, 1); (void)r;
+    errno = e;
+}
+
+class Master {
+  public:
+    Master(int argc, char** argv);
+    void loop(); // never returns
+
+  private:
+    void inherit(int fd);
+    void spawn(int i);
+    void stop();
+    void upgrade();
+    void on_signals();
+    void on_message(int i);
+    void on_old_master();
+    void on_new_master();
+    void on_child_exit(int pid, int status);
+    void on_ask(int i, const fastring& key, int idx);
+    void on_keep(int i, const fastring& key, int idx, int fd);
+    void on_lost(int i);
+    void tick();
+    Listener* find(const fastring& key, int idx);
+    bool reply(int i, char c, int fd=-1);
+
+    char** _argv;
+    fastring _exe;        // the program file, maybe replaced by a new binary
+    const char* _wexe;    // the program of workers
+    co::vector<Proc> _ws;
+    co::vector<Listener> _ls;
+    char* _buf;
+    int64 _start_ms;
+    int64 _stop_ms;       // time it started stopping, or 0
+    int _old;             // socket to the old master in a hot restart, or -1
+    int _new;             // socket to the new master in a hot restart, or -1
+    int _new_pid;
+};
+
+Master::Master(int argc, char** argv)
+    : _argv(argv), _buf((char*)co::alloc(max_msg)), _start_ms(now::ms()), _stop_ms(0),
+      _old(-1), _new(-1), _new_pid(0) {
+    (void)argc;
+    _exe = os::exepath();
+  #ifdef __linux__
+    _wexe = "/proc/self/exe"; // workers run this binary, even if the file was replaced
+  #else
+    _wexe = _exe.c_str();
+  #endif
+
+    CHECK_EQ(::pipe(g_sig), 0) << "create pipe error: " << co::strerror();
+    set_cloexec(g_sig[0]);
+    set_cloexec(g_sig[1]);
+    os::signal(SIGTERM, on_signal);
+    os::signal(SIGINT, on_signal);
+    os::signal(SIGUSR2, on_signal);
+    os::signal(SIGCHLD, on_signal);
+
+    fastring s = os::env("CO_PREFORK_UPGRADE");
+    if (!s.empty()) {
+        ::unsetenv("CO_PREFORK_UPGRADE");
+        this->inherit(str::to_int32(s));
+    }
+
+    _ws.resize(FLG_prefork_workers);
+    for (size_t i = 0; i < _ws.size(); ++i) {
+        memset(&_ws[i], 0, sizeof(Proc));
+        _ws[i].ctl = _ws[i].drain = -1;
+        this->spawn((int)i);
+    }
+    LOG << "prefork master " << os::pid() << " started with " << _ws.size() << " workers"
+        << (_old >= 0 ? ", hot restart" : "");
+}
+
+// receive listeners from the old master
+void Master::inherit(int fd) {
+    set_cloexec(fd);
+    _old = fd;
+    fastring key;
+    int idx, sfd;
+    for (;;) {
+        const ssize_t r = recv_msg(fd, _buf, max_msg, &sfd);
+        if (r <= 0 || _buf[0] == 'E') { close_fd(sfd); break; }
+        if (_buf[0] == 'F' && sfd >= 0 && parse_listener(_buf, r, key, idx)) {
+            if (idx < (int)FLG_prefork_workers) {
+                Listener l;
+                l.key = key;
+                l.idx = idx;
+                l.fd = sfd;
+                l.owner = -1;
+                l.claimed = false;
+                _ls.push_back(std::move(l));
+                continue;
+            }
+        }
+        close_fd(sfd); // no worker for it
+    }
+    LOG << "prefork master inherited " << _ls.size() << " listeners";
+}
+
+void Master::spawn(int i) {
+    Proc& w = _ws[i];
+    int s[2], d[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, s) != 0) {
+        ELOG << "prefork create socket error: " << co::strerror();
+        w.spawn_ms = now::ms() + 1000;
+        return;
+    }
+    if (::pipe(d) != 0) {
+        ELOG << "prefork create pipe error: " << co::strerror();
+        __sys_api(close)(s[0]);
+        __sys_api(close)(s[1]);
+        w.spawn_ms = now::ms() + 1000;
+        return;
+    }
+    set_cloexec(s[0]);
+    set_cloexec(d[1]);
+
+    fastring var("CO_PREFORK_WORKER=");
+    var << i << ',' << s[1] << ',' << d[0];
+    const int pid = exec_child(_wexe, _argv, var, s[1], d[0], true);
+    __sys_api(close)(s[1]);
+    __sys_api(close)(d[0]);
+    if (pid < 0) {
+        ELOG << "prefork fork error: " << co::strerror();
+        __sys_api(close)(s[0]);
+        __sys_api(close)(d[1]);
+        w.spawn_ms = now::ms() + 1000;
+        return;
+    }
+
+    w.pid = pid;
+    w.ctl = s[0];
+    w.drain = d[1];
+    w.ready = false;
+    w.spawn_ms = now::ms();
+    LOG << "prefork worker " << i << " spawned, pid: " << pid;
+}
+
+// drain the workers, the master exits when they are gone
+void Master::stop() {
+    if (_stop_ms) return;
+    _stop_ms = now::ms();
+    for (size_t i = 0; i < _ws.size(); ++i) {
+        if (_ws[i].drain >= 0) {
+            auto r = __sys_api(write)(_ws[i].drain, "D", 1); (void)r;
+        }
+    }
+    LOG << "prefork master " << os::pid() << " stopping";
+}
+
+// execute the program file as a new master, and pass the listeners to it
+void Master::upgrade() {
+    if (_new >= 0 || _old >= 0 || _stop_ms) {
+        WLOG << "prefork hot restart ignored, it is in progress or the master is stopping";
+        return;
+    }
+
+    int u[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, u) != 0) {
+        ELOG << "prefork create socket error: " << co::strerror();
+        return;
+    }
+    set_cloexec(u[0]);
+
+    fastring var("CO_PREFORK_UPGRADE=");
+    var << u[1];
+    const int pid = exec_child(_exe.c_str(), _argv, var, u[1], -1, false);
+    __sys_api(close)(u[1]);
+    if (pid < 0) {
+        ELOG << "prefork fork error: " << co::strerror();
+        __sys_api(close)(u[0]);
+        return;
+    }
+
+    for (size_t i = 0; i < _ls.size(); ++i) {
+        if (_ls[i].fd < 0) continue;
+        fastring s = listener_msg('F', _ls[i].key.c_str(), _ls[i].idx);
+        send_msg(u[0], s.data(), s.size(), _ls[i].fd);
+    }
+    send_msg(u[0], "E", 1);
+    _new = u[0];
+    _new_pid = pid;
+    LOG << "prefork hot restart, new master: " << pid << ", exe: " << _exe;
+}
+
+Listener* Master::find(const fastring& key, int idx) {
+    for (size_t i = 0; i < _ls.size(); ++i) {
+        if (_ls[i].idx == idx && _ls[i].key == key) return &_ls[i];
+    }
+    return NULL;
+}
+
+bool Master::reply(int i, char c, int fd) {
+    return _ws[i].ctl >= 0 && send_msg(_ws[i].ctl, &c, 1, fd);
+}
+
+void Master::on_ask(int i, const fastring& key, int idx) {
+    _ws[i].ready = true;
+    Listener* l = this->find(key, idx);
+    if (!l) {
+        Listener x;
+        x.key = key;
+        x.idx = idx;
+        x.fd = -1;
+        x.owner = i;
+        x.claimed = true;
+        _ls.push_back(std::move(x));
+        this->reply(i, 'C');
+        return;
+    }
+
+    l->claimed = true;
+    if (l->fd >= 0) {
+        this->reply(i, 'F', l->fd);
+    } else if (l->owner >= 0 && l->owner != i) {
+        l->waiters.push_back(i);
+    } else {
+        l->owner = i;
+        this->reply(i, 'C');
+    }
+}
+
+void Master::on_keep(int i, const fastring& key, int idx, int fd) {
+    Listener* l = this->find(key, idx);
+    if (!l) {
+        Listener x;
+        x.key = key;
+        x.idx = idx;
+        x.fd = -1;
+        _ls.push_back(std::move(x));
+        l = &_ls.back();
+    }
+    if (l->fd >= 0) {
+        close_fd(fd); // created twice, the first one is kept
+    } else {
+        l->fd = fd;
+    }
+    l->owner = -1;
+    l->claimed = true;
+    for (size_t k = 0; k < l->waiters.size(); ++k) this->reply(l->waiters[k], 'F', l->fd);
+    l->waiters.clear();
+    DLOG << "prefork worker " << i << " created listener " << key << ", idx: " << idx;
+}
+
+// a worker is gone, pass the listeners it was creating to the waiters
+void Master::on_lost(int i) {
+    close_fd(_ws[i].ctl);
+    close_fd(_ws[i].drain);
+    for (size_t k = 0; k < _ls.size(); ++k) {
+        Listener& l = _ls[k];
+        for (size_t j = 0; j < l.waiters.size(); ++j) {
+            if (l.waiters[j] == i) { l.waiters.erase(l.waiters.begin() + j); break; }
+        }
+        if (l.owner == i && l.fd < 0) {
+            l.owner = -1;
+            if (!l.waiters.empty()) {
+                l.owner = l.waiters.front();
+                l.waiters.erase(l.waiters.begin());
+                this->reply(l.owner, 'C');
+            }
+        }
+    }
+}
+
+void Master::on_message(int i) {
+    Proc& w = _ws[i];
+    int fd = -1;
+    const ssize_t r = recv_msg(w.ctl, _buf, max_msg, &fd);
+    if (r <= 0) {
+        if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) this->on_lost(i);
+        return;
+    }
+
+    fastring key;
+    int idx;
+    switch (_buf[0]) {
+      case 'G':
+        log::merge(_buf + 1, r - 1);
+        break;
+      case 'L':
+        if (parse_listener(_buf, r, key, idx)) this->on_ask(i, key, idx);
+        break;
+      case 'K':
+        if (fd >= 0 && parse_listener(_buf, r, key, idx)) {
+            this->on_keep(i, key, idx, fd);
+            fd = -1;
+        }
+        break;
+    }
+    close_fd(fd);
+}
+
+// the old master is waiting for 'R', or gone
+void Master::on_old_master() {
+    char c;
+    int fd = -1;
+    const ssize_t r = recv_msg(_old, &c, 1, &fd);
+    close_fd(fd);
+    if (r <= 0) close_fd(_old);
+}
+
+void Master::on_new_master() {
+    char c;
+    int fd = -1;
+    const ssize_t r = recv_msg(_new, &c, 1, &fd);
+    close_fd(fd);
+    if (r == 1 && c == 'R') {
+        LOG << "prefork hot restart, new master " << _new_pid << " is ready";
+        close_fd(_new);
+        this->stop();
+    } else if (r <= 0) {
+        ELOG << "prefork hot restart failed, new master " << _new_pid << " is gone";
+        close_fd(_new);
+    }
+}
+
+void Master::on_child_exit(int pid, int status) {
+    for (size_t i = 0; i < _ws.size(); ++i) {
+        Proc& w = _ws[i];
+        if (w.pid != pid) continue;
+        w.pid = 0;
+        this->on_lost((int)i);
+        if (!_stop_ms) {
+            WLOG << "prefork worker " << i << " (pid " << pid << ") exited, status: " << status;
+            // respawn at once, or in a second if it crashed soon after start
+            const int64 t = w.spawn_ms + 1000;
+            w.spawn_ms = now::ms() < t ? t : 0;
+        } else {
+            LOG << "prefork worker " << i << " (pid " << pid << ") exited";
+        }
+        return;
+    }
+    if (pid == _new_pid) {
+        WLOG << "prefork new master " << pid << " exited, status: " << status;
+        _new_pid = 0;
+    }
+}
+
+void Master::on_signals() {
+    char s[64];
+    const ssize_t r = __sys_api(read)(g_sig[0], s, sizeof(s));
+    for (ssize_t i = 0; i < r; ++i) {
+        switch (s[i]) {
+          case SIGTERM:
+          case SIGINT:
+            this->stop();
+            break;
+          case SIGUSR2:
+            this->upgrade();
+            break;
+          case SIGCHLD:
+            for (;;) {
+                int st = 0;
+                const int pid = ::waitpid(-1, &st, WNOHANG);
+                if (pid <= 0) break;
+                this->on_child_exit(pid, st);
+            }
+            break;
+        }
+    }
+}
+
+void Master::tick() {
+    const int64 now_ms = now::ms();
+    if (!_stop_ms) {
+        for (size_t i = 0; i < _ws.size(); ++i) {
+            if (_ws[i].pid == 0 && now_ms >= _ws[i].spawn_ms) this->spawn((int)i);
+        }
+    }
+
+    // tell the old master that the new workers are ready
+    if (_old >= 0 && !_stop_ms) {
+        bool ready = true;
+        for (size_t i = 0; i < _ws.size(); ++i) {
+            if (!_ws[i].ready) { ready = false; break; }
+        }
+        if (ready) {
+            send_msg(_old, "R", 1);
+            close_fd(_old);
+            // listeners no worker asked for, the old workers still have them
+            for (size_t i = 0; i < _ls.size();) {
+                if (!_ls[i].claimed) {
+                    close_fd(_ls[i].fd);
+                    _ls.erase(_ls.begin() + i);
+                } else {
+                    ++i;
+                }
+            }
+            LOG << "prefork hot restart, the new workers are ready";
+        } else if (now_ms - _start_ms > (int64)FLG_prefork_ready_ms) {
+            ELOG << "prefork hot restart abandoned, the new workers are not ready in "
+                 << FLG_prefork_ready_ms << " ms";
+            close_fd(_old);
+            this->stop();
+        }
+    }
+
+    // kill the workers that did not exit in time
+    if (_stop_ms && now_ms - _stop_ms > (int64)FLG_prefork_drain_ms + 5000) {
+        for (size_t i = 0; i < _ws.size(); ++i) {
+            if (_ws[i].pid > 0) ::kill(_ws[i].pid, SIGKILL);
+        }
+    }
+}
+
+void Master::loop() {
+    co::vector<struct pollfd> fds;
+    co::vector<int> ids; // the worker of each fd, -1 for others
+    for (;;) {
+        if (_stop_ms) {
+            bool alive = false;
+            for (size_t i = 0; i < _ws.size(); ++i) {
+                if (_ws[i].pid > 0) { alive = true; break; }
+            }
+            if (!alive) break;
+        }
+
+        fds.clear();
+        ids.clear();
+        struct pollfd p;
+        p.events = POLLIN;
+        p.revents = 0;
+        p.fd = g_sig[0]; fds.push_back(p); ids.push_back(-1);
+        if (_old >= 0) { p.fd = _old; fds.push_back(p); ids.push_back(-1); }
+        if (_new >= 0) { p.fd = _new; fds.push_back(p); ids.push_back(-1); }
+        for (size_t i = 0; i < _ws.size(); ++i) {
+            if (_ws[i].ctl >= 0) { p.fd = _ws[i].ctl; fds.push_back(p); ids.push_back((int)i); }
+        }
+
+        const int r = __sys_api(poll)(fds.data(), (nfds_t)fds.size(), 100);
+        if (r > 0) {
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (fds[i].revents == 0) continue;
+                const int fd = fds[i].fd;
+                if (ids[i] >= 0) {
+                    if (_ws[ids[i]].ctl == fd) this->on_message(ids[i]);
+                } else if (fd == g_sig[0]) {
+                    this->on_signals();
+                } else if (fd == _old) {
+                    this->on_old_master();
+                } else if (fd == _new) {
+                    this->on_new_master();
+                }
+            }
+        }
+        this->tick();
+    }
+
+    LOG << "prefork master " << os::pid() << " exit";
+    ::exit(0);
+}
+
+} // xx
+
+int run(int argc, char** argv) {
+    // make sure the raw system calls are there
+    if (!__sys_api(sendmsg)) { auto r = ::sendmsg(-1, 0, 0); (void)r; }
+    if (!__sys_api(recvmsg)) { auto r = ::recvmsg(-1, 0, 0); (void)r; }
+    if (!__sys_api(read)) { auto r = ::read(-1, 0, 0); (void)r; }
+    if (!__sys_api(poll)) { auto r = ::poll(0, 0, 0); (void)r; }
+
+    fastring s = os::env("CO_PREFORK_WORKER");
+    if (!s.empty()) {
+        ::unsetenv("CO_PREFORK_WORKER");
+        auto v = str::split(s, ',');
+        CHECK_EQ(v.size(), (size_t)3) << "invalid CO_PREFORK_WORKER: " << s;
+        const int id = str::to_int32(v[0]);
+        xx::worker().start(id, str::to_int32(v[1]), str::to_int32(v[2]));
+        return id;
+    }
+    if (FLG_prefork_workers == 0) return -1;
+
+    xx::Master m(argc, argv);
+    m.loop();
+    return -1; // never here
+}
+
+int worker_id() {
+    return xx::worker().id();
+}
+
+void on_drain(std::function<void()>&& cb) {
+    if (xx::worker().id() >= 0) xx::worker().on_drain(std::move(cb));
+}
+
+void hold() { xx::worker().hold(); }
+void release() { xx::worker().release(); }
+
+namespace xx {
+
+sock_t listener(const char* key, int idx) {
+    return worker().id() >= 0 ? worker().listener(key, idx) : (sock_t)-1;
+}
+
+void keep(const char* key, int idx, sock_t fd) {
+    if (worker().id() >= 0) worker().keep(key, idx, fd);
+}
+
+} // xx
+} // prefork
+
+#endif
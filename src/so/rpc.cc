@@ -1,4 +1,5 @@
 #include "./http.h"
+#include "./rpc_shm.h"
 #include "co/http.h"
 #include "co/rpc.h"
 #include "co/tcp.h"
@@ -9,6 +10,21 @@
 #include "co/str.h"
 #include "co/time.h"
 #include "co/hash.h"
+#include "co/flat_hash_map.h"
+#include "co/random.h"
+#include "co/fs.h"
+#include "co/histogram.h"
+#include "co/metrics.h"
+#include "co/tracing.h"
+#include <mutex>
+
+#ifdef HAS_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
 
 DEF_int32(rpc_max_msg_size, 8 << 20, ">>#2 max size of rpc message, default: 8M");
 DEF_int32(rpc_recv_timeout, 3000, ">>#2 recv timeout in ms");
@@ -16,7 +32,54 @@ DEF_int32(rpc_send_timeout, 3000, ">>#2 send timeout in ms");
 DEF_int32(rpc_conn_timeout, 3000, ">>#2 connect timeout in ms");
 DEF_int32(rpc_conn_idle_sec, 180, ">>#2 connection may be closed if no data was recieved for n seconds");
 DEF_int32(rpc_max_idle_conn, 128, ">>#2 max idle connections");
+DEF_uint32(rpc_park_idle_ms, 0, ">>#2 if > 0, a connection idle for this many ms is parked in epoll without "
+    "a coroutine, until the next request arrives, or it is closed after rpc_conn_idle_sec, linux only");
+DEF_uint32(rpc_conn_concurrency, 1, ">>#2 max requests with ids (rpc::MuxClient) served at the same time on a connection of rpc::Server, "
+    "responses are sent as they are done, 1 to serve them one by one");
 DEF_bool(rpc_log, true, ">>#2 enable rpc log if true");
+DEF_bool(rpc_arena, false, ">>#2 parse requests into a per-connection arena which is reset for each request, "
+         "rpc methods MUST NOT keep any part of the request then");
+DEF_bool(rpc_parse_view, false, ">>#2 parse requests in situ, strings of the request refer to the receive buffer, "
+         "rpc methods MUST NOT keep any part of the request, or move it to the response then");
+DEF_bool(rpc_msgpack, false, ">>#2 rpc clients send messages in MessagePack instead of json text, "
+         "if the server supports it");
+DEF_uint32(rpc_pool_max_idle, 32, ">>#2 max idle connections to an endpoint of rpc::Channel, in each scheduler");
+DEF_uint32(rpc_pool_idle_ms, 60000, ">>#2 idle connections of rpc::Channel are closed after this many ms");
+DEF_uint32(rpc_eject_failures, 5, ">>#2 an endpoint of rpc::Channel is ejected after this many failed calls in a row");
+DEF_uint32(rpc_eject_ms, 10000, ">>#2 time in ms an endpoint of rpc::Channel is ejected, "
+    "multiplied by the times it was ejected in a row, up to 8");
+DEF_uint32(rpc_hedge_ms, 50, ">>#2 a hedged call of rpc::Channel is sent to another endpoint "
+    "if there is no response in this many ms");
+DEF_uint32(rpc_stream_window, 16, ">>#2 max messages of the peer in flight on a rpc stream");
+DEF_string(rpc_compress, "", ">>#2 compress rpc messages with lz4 or zstd, if the peer supports it, "
+    "clients accept compressed responses only if it is set");
+DEF_uint32(rpc_compress_min_size, 1024, ">>#2 rpc messages smaller than this are not compressed");
+DEF_string(rpc_zstd_dict, "", ">>#2 path of a zstd dictionary for rpc messages, e.g. made by zstd --train, "
+    "it helps small messages, peers MUST use the same one");
+DEF_bool(rpc_deadline, true, ">>#2 rpc clients send the time left of calls as deadlines of requests, if the server "
+         "supports it. The server drops requests that have expired before they are served, and calls made while "
+         "serving a request are bounded by its deadline, see rpc::time_left()");
+DEF_bool(rpc_checksum, false, ">>#2 rpc clients send messages with a crc32c checksum of the body "
+    "if the server supports it, and ask the server to do the same for responses");
+DEF_bool(rpc_shm, false, ">>#2 rpc::Client talks to rpc::Server on the same host over shared memory, "
+    "if both of them set it (linux only). Streams stay on tcp");
+DEF_uint32(rpc_shm_ring_size, 256 << 10, ">>#2 bytes of each ring of a shared memory connection of rpc::Server, "
+    "bodies larger than 1/8 of it are passed by offset out of the ring");
+
+// flags that can be changed at runtime by flag::update()
+static bool _mutable_flags = []() {
+    flag::set_mutable("rpc_recv_timeout");
+    flag::set_mutable("rpc_send_timeout");
+    flag::set_mutable("rpc_conn_timeout");
+    flag::set_mutable("rpc_max_idle_conn");
+    return true;
+}();
+
+DEF_counter(co_rpc_calls_total, "methods called on rpc::Server");
+DEF_histogram(co_rpc_call_us, "time in microseconds of methods called on rpc::Server");
+DEF_counter(co_rpc_expired_total, "requests dropped by rpc::Server as their deadlines had passed");
+DEF_counter(co_rpc_rejected_total, "requests rejected by concurrency limits of rpc::Server");
+DEF_counter(co_rpc_shm_conns_total, "connections of rpc::Server switched to shared memory");
 DEC_uint32(http_max_header_size);
 
 #define RPCLOG LOG_IF(FLG_rpc_log)
@@ -24,19 +87,732 @@ DEC_uint32(http_max_header_size);
 namespace rpc {
 
 struct Header {
-    uint16 flags; // reserved, 0
+    uint16 flags; // kMsgpack, kAcceptMsgpack, kMux, or 0 for json text
     uint16 magic; // 0x7777
     uint32 len;   // body len
 }; // 8 bytes
 
 static const uint16 kMagic = 0x7777;
 
-inline void set_header(const void* header, uint32 msg_len) {
-    ((Header*)header)->flags = 0;
+// The body is in MessagePack. Servers reply in MessagePack to requests with
+// either flag, so a client knows the server supports it from the response.
+// Old servers always reply with flags 0, and old clients always send it.
+static const uint16 kMsgpack = 1;
+
+// The body is json text, but the client accepts MessagePack in the response.
+static const uint16 kAcceptMsgpack = 2;
+
+// A 4-byte request id (network byte order) follows the header, and it is not
+// counted in len. The server replies with the same flag and id, so that many
+// calls can be in flight on one connection. See MuxClient.
+static const uint16 kMux = 4;
+
+// The body is a 4-byte method id (network byte order) followed by a message
+// in binary, see rpc::Message. The response body is a byte of the status
+// followed by the message. Old servers take it as json text and fail.
+static const uint16 kBinary = 8;
+
+// A frame of a stream, see rpc::Stream. The client opens a stream with a
+// request, and the body is a 4-byte window (network byte order) followed by
+// the request, in json text or in MessagePack as kMsgpack says. Then both
+// sides send messages in frames of kStream, until each of them sends a frame
+// of kStreamEnd. A side may send as many messages as the window of the peer
+// allows, frames of kStreamCredit grant more of them (a 4-byte count).
+//
+// The server sends kStreamEnd first, when the stream method returns, and the
+// client replies with its kStreamEnd if it has not, which is the last frame
+// of the stream. Credits are never granted by a side that has seen the end
+// of the peer, and the server skips those sent before it.
+static const uint16 kStream = 16;
+static const uint16 kStreamEnd = 32;
+static const uint16 kStreamCredit = 64;
+
+// The body, after the request id of kMux, is compressed with lz4 or zstd. It
+// begins with the size of the raw body (4 bytes, network byte order).
+static const uint16 kLz4 = 128;
+static const uint16 kZstd = 256;
+
+// Codecs the sender can decompress. Clients set them in requests if rpc_compress
+// is set, and the server replies with those it supports. A client compresses
+// requests only with codecs the server replied with, old servers reply with none.
+static const uint16 kAcceptLz4 = 512;
+static const uint16 kAcceptZstd = 1024;
+static const uint16 kAcceptMask = kAcceptLz4 | kAcceptZstd;
+
+// A 4-byte crc32c (network byte order) of the body, as it is sent, follows
+// the header and the request id of kMux, and it is not counted in len.
+// Clients set kAcceptCrc32c in requests if rpc_checksum is set, and the server
+// replies with kCrc32c, then clients send requests with kCrc32c. The server
+// checks requests with kCrc32c whatever rpc_checksum is.
+static const uint16 kCrc32c = 2048;
+static const uint16 kAcceptCrc32c = 4096;
+
+// A 4-byte timeout in ms (network byte order) follows the header, the request
+// id and the checksum, and it is not counted in len. The server drops the
+// request if it is not served in the time, as the client has given up. It is
+// measured from the time the server reads the request, so that clocks of the
+// two sides do not matter. The server sets it in responses, with no data, to
+// tell the client it supports deadlines, and then clients send them.
+static const uint16 kDeadline = 8192;
+
+// A trace context follows the deadline, and it is not counted in len: the
+// trace id (16 bytes), the id of the span of the caller (8 bytes), both in
+// network byte order, and the flags (1 byte). See co/tracing.h. Like
+// kDeadline, the server sets it in responses with no data, and then clients
+// send the context of sampled calls.
+static const uint16 kTrace = 16384;
+static const size_t kTraceSize = 25;
+
+// Shared memory with a server on the same host. The server sets it in responses
+// with no data if rpc_shm is true. A client that sees it, on a connection to the
+// same host, sends a header with only kShm and a len of 0. The server replies
+// with kShm and a json body {"addr": "@name", "token": n}, or without kShm if it
+// can not. The client gets the fds of the memory from the unix socket addr with
+// the token, and later calls on the connection go through the memory, as a head
+// (the header, the deadline and the trace context) and a body, see rpc_shm.h.
+// The tcp connection is kept, the memory is dropped when either side closes it.
+static const uint16 kShm = 32768;
+
+// the tcp connection is checked every this many ms while waiting on shared
+// memory, as the peer may be gone without closing the memory
+static const int kShmProbeMs = 1000;
+
+inline uint16 shm_flag() {
+  #ifdef __linux__
+    return FLG_rpc_shm ? kShm : 0;
+  #else
+    return 0;
+  #endif
+}
+
+inline void put_trace(char* p, const tracing::context_t& c) {
+    const uint64 x[3] = { hton64(c.trace_hi), hton64(c.trace_lo), hton64(c.span_id) };
+    memcpy(p, x, sizeof(x));
+    p[24] = (char)c.flags;
+}
+
+inline void get_trace(const char* p, tracing::context_t& c) {
+    uint64 x[3];
+    memcpy(x, p, sizeof(x));
+    c.trace_hi = ntoh64(x[0]);
+    c.trace_lo = ntoh64(x[1]);
+    c.span_id = ntoh64(x[2]);
+    c.flags = (uint8)p[24];
+}
+
+// name a span by the api of a json request
+inline void set_span_name(tracing::Span& s, const Json& req) {
+    auto& x = req.get("api");
+    if (x.is_string()) s.set_name(x.as_c_str());
+}
+
+// name a span by the method id of a request of kBinary
+inline void set_span_name(tracing::Span& s, const char* p, size_t n) {
+    if (n < sizeof(uint32)) return;
+    uint32 m;
+    memcpy(&m, p, sizeof(m));
+    fastring x(16);
+    x << "rpc method " << ntoh32(m);
+    s.set_name(x.data(), x.size());
+}
+
+// max bytes of responses held back while more requests are buffered
+static const size_t kMaxPendingRes = 64 * 1024;
+
+// whether a whole rpc request is buffered in rd
+inline bool has_rpc_req(const tcp::Reader& rd) {
+    if (rd.size() < sizeof(Header)) return false;
+    const Header* h = (const Header*)rd.data();
+    const size_t x = sizeof(Header) + ((h->flags & kMux) ? 4 : 0) + ((h->flags & kCrc32c) ? 4 : 0)
+                   + ((h->flags & kDeadline) ? 4 : 0) + ((h->flags & kTrace) ? kTraceSize : 0);
+    return rd.size() >= x + ntoh32(h->len);
+}
+
+// key of the coroutine-local deadline of the request being served, a pointer
+// to the time in ms by now::ms()
+inline int deadline_key() {
+    static int k = co::cls_key(0);
+    return k;
+}
+
+inline const int64* current_deadline() {
+    return co::scheduler() ? (const int64*) co::cls_get(deadline_key()) : 0;
+}
+
+// timeout of a call, bounded by the deadline of the request being served in
+// the current coroutine, <= 0 if it has expired
+inline int call_timeout() {
+    const int64* const d = current_deadline();
+    if (!d) return FLG_rpc_recv_timeout;
+    const int64 t = *d - now::ms();
+    return t < FLG_rpc_recv_timeout ? (int)t : FLG_rpc_recv_timeout;
+}
+
+int64 time_left() {
+    const int64* const d = current_deadline();
+    if (!d) return -1;
+    const int64 t = *d - now::ms();
+    return t > 0 ? t : 0;
+}
+
+inline void set_header(const void* header, uint32 msg_len, uint16 flags=0) {
+    ((Header*)header)->flags = flags;
     ((Header*)header)->magic = kMagic;
     ((Header*)header)->len = hton32(msg_len);
 }
 
+// codec set by rpc_compress, kLz4, kZstd, or 0 if it is not supported
+inline uint16 compress_codec() {
+    const fastring& s = FLG_rpc_compress;
+    if (s.empty()) return 0;
+  #ifdef HAS_LZ4
+    if (s == "lz4") return kLz4;
+  #endif
+  #ifdef HAS_ZSTD
+    if (s == "zstd") return kZstd;
+  #endif
+    return 0;
+}
+
+// codecs we can decompress, in kAccept bits
+inline uint16 accepted_codecs() {
+    uint16 r = 0;
+  #ifdef HAS_LZ4
+    r |= kAcceptLz4;
+  #endif
+  #ifdef HAS_ZSTD
+    r |= kAcceptZstd;
+  #endif
+    return r;
+}
+
+// kAccept bit of a codec
+inline uint16 accept_bit(uint16 c) { return (uint16)(c << 2); }
+
+#ifdef HAS_ZSTD
+struct ZstdDict {
+    ZstdDict() : c(0), d(0) {
+        const fastring& path = FLG_rpc_zstd_dict;
+        if (path.empty()) return;
+        fs::file f(path.c_str(), 'r');
+        if (!f) {
+            ELOG << "rpc open zstd dictionary failed: " << path;
+            return;
+        }
+        fastring s = f.read((size_t)f.size());
+        c = ZSTD_createCDict(s.data(), s.size(), 3);
+        d = ZSTD_createDDict(s.data(), s.size());
+        if (!c || !d) ELOG << "rpc bad zstd dictionary: " << path;
+    }
+
+    ZSTD_CDict* c;
+    ZSTD_DDict* d;
+};
+
+// the dictionary is loaded once, and shared by all threads
+inline ZstdDict& zstd_dict() {
+    static ZstdDict d;
+    return d;
+}
+
+struct Zstd {
+    Zstd() : c(ZSTD_createCCtx()), d(ZSTD_createDCtx()) {}
+    ~Zstd() { ZSTD_freeCCtx(c); ZSTD_freeDCtx(d); }
+    ZSTD_CCtx* c;
+    ZSTD_DCtx* d;
+};
+
+inline Zstd& zstd() {
+    static thread_local Zstd z;
+    return z;
+}
+#endif
+
+// compress [s, s + n) with codec c, the result is appended to out after the
+// raw size, false if it failed or it is not smaller
+bool compress(uint16 c, const char* s, size_t n, fastream& out) {
+    const size_t o = out.size();
+    const uint32 m = hton32((uint32)n);
+    out.append(&m, sizeof(m));
+    size_t r = 0;
+    switch (c) {
+  #ifdef HAS_LZ4
+      case kLz4: {
+        const int k = LZ4_compressBound((int)n);
+        out.ensure(k);
+        const int x = LZ4_compress_default(s, (char*)out.data() + out.size(), (int)n, k);
+        r = x > 0 ? (size_t)x : 0;
+        break;
+      }
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd: {
+        const size_t k = ZSTD_compressBound(n);
+        out.ensure(k);
+        char* const p = (char*)out.data() + out.size();
+        ZSTD_CDict* const d = zstd_dict().c;
+        const size_t x = d ? ZSTD_compress_usingCDict(zstd().c, p, k, s, n, d)
+                           : ZSTD_compressCCtx(zstd().c, p, k, s, n, 3);
+        r = ZSTD_isError(x) ? 0 : x;
+        break;
+      }
+  #endif
+      default:
+        break;
+    }
+    if (r == 0 || r + sizeof(m) >= n) {
+        out.resize(o);
+        return false;
+    }
+    out.resize(out.size() + r);
+    return true;
+}
+
+// size of the raw body of a compressed body, 0 if it is bad
+inline uint32 raw_size(const char* s, size_t n) {
+    uint32 m = 0;
+    if (n < sizeof(m)) return 0;
+    memcpy(&m, s, sizeof(m));
+    m = ntoh32(m);
+    return m <= (uint32)FLG_rpc_max_msg_size ? m : 0;
+}
+
+// decompress [s, s + n), with the raw size, to [d, d + m)
+bool decompress(uint16 c, const char* s, size_t n, char* d, size_t m) {
+    s += sizeof(uint32);
+    n -= sizeof(uint32);
+    switch (c) {
+  #ifdef HAS_LZ4
+      case kLz4:
+        return LZ4_decompress_safe(s, d, (int)n, (int)m) == (int)m;
+  #endif
+  #ifdef HAS_ZSTD
+      case kZstd: {
+        // frames compressed without a dictionary have no dictionary id
+        size_t r;
+        if (ZSTD_getDictID_fromFrame(s, n) != 0) {
+            ZSTD_DDict* const x = zstd_dict().d;
+            if (!x) return false;
+            r = ZSTD_decompress_usingDDict(zstd().d, d, m, s, n, x);
+        } else {
+            r = ZSTD_decompressDCtx(zstd().d, d, m, s, n);
+        }
+        return !ZSTD_isError(r) && r == m;
+      }
+  #endif
+      default:
+        return false;
+    }
+}
+
+class StreamImpl {
+  public:
+    // a stream served on a connection of the server
+    StreamImpl(tcp::Connection* conn, tcp::Reader* rd, uint32 credit, bool mp)
+        : _conn(conn), _cli(0), _rd(rd), _credit(credit), _read(0), _mp(mp),
+          _ended_in(false), _ended_out(false), _failed(false), _bad(false) {
+    }
+
+    // a stream opened by a client, the reader is owned by the stream
+    StreamImpl(tcp::Client* cli, bool mp)
+        : _conn(0), _cli(cli), _rd(co::make<tcp::Reader>(*cli)), _credit(0), _read(0),
+          _mp(mp), _ended_in(false), _ended_out(false), _failed(false), _bad(false) {
+    }
+
+    ~StreamImpl() {
+        if (_cli) co::del(_rd);
+    }
+
+    bool read(Json& msg, int ms);
+    bool write(const Json& msg);
+    bool finish();
+
+    // grant the peer n more messages
+    bool grant(uint32 n);
+
+    // read frames of the client to the end of it, after the server ended
+    bool drain();
+
+    // close a stream of the client, the connection is closed if the stream
+    // was not done with
+    void close();
+
+    bool ok() const { return !_failed; }
+    bool done() const { return _ended_in; }
+    bool is_client() const { return _cli != 0; }
+
+  private:
+    // recv a frame, false on error or timeout
+    bool recv_frame(int ms);
+    bool send_frame(uint16 flags);
+
+    int send(const void* s, int n) {
+        return _conn ? _conn->send(s, n, FLG_rpc_send_timeout) : _cli->send(s, n, FLG_rpc_send_timeout);
+    }
+
+    const char* strerror() const {
+        return _conn ? _conn->strerror() : _cli->strerror();
+    }
+
+    tcp::Connection* _conn;
+    tcp::Client* _cli;
+    tcp::Reader* _rd;
+    co::deque<Json> _msgs; // messages received but not read
+    fastream _fs;          // frames to send
+    fastring _buf;         // body of frames received
+    uint32 _credit;        // messages we can send
+    uint32 _read;          // messages read since the last grant
+    bool _mp;              // write messages in MessagePack
+    bool _ended_in;        // the peer has ended
+    bool _ended_out;       // we have ended
+    bool _failed;
+    bool _bad;             // an old server replied with a response
+};
+
+bool StreamImpl::recv_frame(int ms) {
+    Header h;
+    int r = _rd->peek(sizeof(h), ms);
+    if (r <= 0) {
+        if (r == 0 || !co::timeout()) {
+            ELOG << "rpc stream recv error: " << (r == 0 ? "connection closed" : this->strerror());
+            _failed = true;
+        }
+        return false;
+    }
+    memcpy(&h, _rd->data(), sizeof(h));
+    _rd->consume(sizeof(h));
+    if (unlikely(h.magic != kMagic)) {
+        ELOG << "rpc stream recv error: bad magic number: " << h.magic;
+        _failed = true;
+        return false;
+    }
+
+    const uint32 len = ntoh32(h.len);
+    if (unlikely(len > (uint32)FLG_rpc_max_msg_size)) {
+        ELOG << "rpc stream recv error: body too long: " << len;
+        _failed = true;
+        return false;
+    }
+    _buf.resize(len);
+    r = len > 0 ? _rd->read_exact((char*)_buf.data(), len, FLG_rpc_recv_timeout) : 1;
+    if (unlikely(r <= 0)) {
+        ELOG << "rpc stream recv error: " << (r == 0 ? "connection closed" : this->strerror());
+        _failed = true;
+        return false;
+    }
+
+    if (h.flags & kStreamCredit) {
+        uint32 n = 0;
+        if (len >= sizeof(n)) memcpy(&n, _buf.data(), sizeof(n));
+        _credit += ntoh32(n);
+        return true;
+    }
+
+    if (h.flags & kStreamEnd) {
+        _ended_in = true;
+        if (_cli && !_ended_out) return this->finish(); // the last frame
+        return true;
+    }
+
+    Json msg = (h.flags & kMsgpack) ? json::parse_msgpack(_buf.data(), len) : json::parse(_buf.data(), len);
+    if (unlikely(msg.is_null())) {
+        ELOG << "rpc stream json parse error: " << _buf;
+        _failed = true;
+        return false;
+    }
+
+    // an old server took the request as a call, there is nothing more
+    if (unlikely(!(h.flags & kStream))) {
+        _ended_in = true;
+        _bad = true;
+    }
+    if (!_ended_in || _bad) _msgs.push_back(std::move(msg));
+    return true;
+}
+
+bool StreamImpl::send_frame(uint16 flags) {
+    set_header(_fs.data(), (uint32)(_fs.size() - sizeof(Header)), flags);
+    const int r = this->send(_fs.data(), (int)_fs.size());
+    if (unlikely(r <= 0)) {
+        ELOG << "rpc stream send error: " << this->strerror();
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool StreamImpl::grant(uint32 n) {
+    _fs.resize(sizeof(Header));
+    const uint32 x = hton32(n);
+    _fs.append(&x, sizeof(x));
+    return this->send_frame(kStream | kStreamCredit);
+}
+
+bool StreamImpl::read(Json& msg, int ms) {
+    if (ms < 0) ms = FLG_rpc_recv_timeout;
+    while (_msgs.empty()) {
+        if (_ended_in || _failed || !this->recv_frame(ms)) return false;
+    }
+    msg = std::move(_msgs.front());
+    _msgs.pop_front();
+
+    if (!_ended_in) {
+        const uint32 w = FLG_rpc_stream_window;
+        if (++_read >= (w > 1 ? w >> 1 : 1)) {
+            if (!this->grant(_read)) return false;
+            _read = 0;
+        }
+    }
+    return true;
+}
+
+bool StreamImpl::write(const Json& msg) {
+    if (_failed || _ended_out || _bad) return false;
+    while (_credit == 0) {
+        if (!this->recv_frame(FLG_rpc_send_timeout)) {
+            if (!_failed) {
+                ELOG << "rpc stream send error: timeout waiting for the peer";
+                _failed = true;
+            }
+            return false;
+        }
+        if (_ended_out || _bad) return false; // the server ended
+    }
+
+    _fs.resize(sizeof(Header));
+    _mp ? msg.msgpack(_fs) : msg.str(_fs);
+    if (unlikely(_fs.size() - sizeof(Header) > (size_t)FLG_rpc_max_msg_size)) {
+        ELOG << "rpc stream message too long: " << (_fs.size() - sizeof(Header));
+        return false;
+    }
+    if (!this->send_frame(kStream | (_mp ? kMsgpack : 0))) return false;
+    --_credit;
+    return true;
+}
+
+bool StreamImpl::finish() {
+    if (_ended_out) return true;
+    if (_failed || _bad) return false;
+    _ended_out = true;
+    _fs.resize(sizeof(Header));
+    return this->send_frame(kStream | kStreamEnd);
+}
+
+bool StreamImpl::drain() {
+    while (!_ended_in) {
+        if (!this->recv_frame(FLG_rpc_recv_timeout)) {
+            if (!_failed) ELOG << "rpc stream recv error: timeout waiting for the end";
+            return false;
+        }
+        _msgs.clear();
+    }
+    return !_failed;
+}
+
+void StreamImpl::close() {
+    if (!_ended_in || _failed || _bad) _cli->disconnect();
+}
+
+// streams of the server are owned by the server
+Stream::~Stream() {
+    StreamImpl* const s = (StreamImpl*)_p;
+    if (s && s->is_client()) {
+        s->close();
+        co::del(s);
+    }
+}
+
+Stream& Stream::operator=(Stream&& s) noexcept {
+    if (&s != this) {
+        this->~Stream();
+        _p = s._p;
+        s._p = 0;
+    }
+    return *this;
+}
+
+bool Stream::read(Json& msg, int ms) {
+    return _p && ((StreamImpl*)_p)->read(msg, ms);
+}
+
+bool Stream::write(const Json& msg) {
+    return _p && ((StreamImpl*)_p)->write(msg);
+}
+
+bool Stream::finish() {
+    return _p && ((StreamImpl*)_p)->finish();
+}
+
+bool Stream::ok() const {
+    return _p && ((StreamImpl*)_p)->ok();
+}
+
+bool Stream::done() const {
+    return _p && ((StreamImpl*)_p)->done();
+}
+
+// state of a connection serving requests of kMux concurrently, shared by the
+// reader, the writer and the tasks, all of them run in the same scheduler, so
+// no lock is needed.
+struct ServMux {
+    ServMux(tcp::Connection* c, uint32 n) : conn(c), sem(n), closed(false), failed(false) {}
+
+    tcp::Connection* conn;
+    co::Semaphore sem; // requests in flight, up to rpc_conn_concurrency
+    co::Event ev;      // responses were queued, or it is closed
+    co::WaitGroup wg;  // the writer and the tasks
+    fastream q;        // responses to send
+    bool closed;       // the writer exits once q is empty
+    bool failed;       // the connection failed to send, responses are dropped
+};
+
+// a request of kMux served in its own coroutine
+struct ServMuxTask {
+    fastring body;
+    Json req;
+    uint16 flags;
+    uint32 id;
+    int64 deadline; // 0 if there is none
+    tracing::context_t trace; // valid if the request has kTrace
+};
+
+// set the header, the request id, codecs we support and the checksum for the
+// response in [d, d + n), x bytes of which are reserved for the header, and 
+// compress it if the client accepts. @d and @n may be set to zs then.
+void seal_res(uint16 req_flags, uint16 flags, uint32 id, size_t x, fastream& zs, const char*& d, size_t& n) {
+    set_header(d, (uint32)(n - x), flags | kDeadline | kTrace | shm_flag()); // what we support
+    if (flags & kMux) memcpy((char*)d + sizeof(Header), &id, sizeof(id));
+
+    // tell the client codecs we support, and compress the response
+    if (req_flags & kAcceptMask) {
+        Header* const h = (Header*)d;
+        h->flags |= accepted_codecs();
+        const uint16 c = compress_codec();
+        if (c && (req_flags & accept_bit(c)) && n - x >= FLG_rpc_compress_min_size) {
+            zs.clear();
+            zs.append(d, x);
+            if (compress(c, d + x, n - x, zs)) {
+                set_header(zs.data(), (uint32)(zs.size() - x), h->flags | c);
+                d = zs.data();
+                n = zs.size();
+            }
+        }
+    }
+
+    // checksum of the body, after it is compressed
+    if (flags & kCrc32c) {
+        const uint32 c = hton32(crc32c(d + x, n - x));
+        memcpy((char*)d + x - sizeof(c), &c, sizeof(c));
+    }
+}
+
+// limit of requests of a method or a service served at the same time, shared
+// by all schedulers, see Server::limit_calls()
+class Limiter {
+  public:
+    // latency of requests is sampled in windows of this many requests
+    static const uint32 kWindow = 64;
+
+    // the lowest latency is reset after this many windows, so that the limit
+    // follows changes of the method, e.g. a slower database
+    static const uint32 kBaseWindows = 32;
+
+    Limiter(const char* name, uint32 n, uint32 queue, bool adaptive)
+        : _name(name), _sem(n), _max(n), _limit(n), _queue(queue), _waiting(0),
+          _adaptive(adaptive), _saturated(false), _debt(0), _n(0), _sum(0),
+          _min_us(0), _windows(0), _base_us(0) {
+    }
+
+    const fastring& name() const { return _name; }
+
+    // wait up to ms for a permit, false if the queue is full or it timed out
+    bool acquire(int ms) {
+        if (_sem.try_acquire()) return true;
+        if (_adaptive) atomic_store(&_saturated, true, mo_relaxed);
+        if (ms <= 0 || atomic_inc(&_waiting, mo_relaxed) > _queue) {
+            if (ms > 0) atomic_dec(&_waiting, mo_relaxed);
+            return false;
+        }
+        const bool r = _sem.acquire(1, (uint32)ms);
+        atomic_dec(&_waiting, mo_relaxed);
+        return r;
+    }
+
+    // return a permit, @us is the time the request was served, or -1 if it
+    // was not called
+    void release(int64 us) {
+        if (!_adaptive) { _sem.release(); return; }
+        std::lock_guard<std::mutex> g(_m);
+        if (us >= 0) this->sample(us);
+        this->give();
+    }
+
+  private:
+    fastring _name;
+    co::Semaphore _sem;
+    uint32 _max;
+    uint32 _limit;   // permits, it is _max unless it is adaptive
+    uint32 _queue;   // max requests waiting
+    uint32 _waiting; // requests waiting
+    bool _adaptive;
+    bool _saturated; // the limit was reached in the window
+
+    // states of the adaptive limit, protected by _m
+    std::mutex _m;
+    uint32 _debt;    // permits to be withheld as the limit was cut
+    uint32 _n;       // requests sampled in the window
+    int64 _sum;      // latency of them
+    int64 _min_us;   // the lowest latency in the window
+    uint32 _windows;
+    int64 _base_us;  // the lowest latency seen recently
+
+    // AIMD on the latency: the limit is cut by 10% if the average latency of a
+    // window is over twice the lowest one seen recently (with 100us of slack for
+    // noise of fast methods), as requests queue up for something in the method.
+    // Otherwise it grows by 1 if it was reached.
+    void sample(int64 us) {
+        _sum += us;
+        if (_n == 0 || us < _min_us) _min_us = us;
+        if (++_n < kWindow) return;
+        const int64 avg = _sum / _n;
+        _n = 0;
+        _sum = 0;
+        if (_base_us == 0 || _min_us < _base_us || ++_windows >= kBaseWindows) {
+            _base_us = _min_us;
+            _windows = 0;
+        }
+
+        if (avg > _base_us * 2 + 100) {
+            const uint32 d = _limit >= 20 ? _limit / 10 : 1;
+            if (_limit > d) {
+                _limit -= d;
+                _debt += d;
+                WLOG << "rpc limit of " << _name << " cut to " << _limit << ", latency: " << avg << "us";
+            }
+        } else if (atomic_load(&_saturated, mo_relaxed) && _limit < _max) {
+            ++_limit;
+            this->give();
+        }
+        atomic_store(&_saturated, false, mo_relaxed);
+    }
+
+    // add a permit, or pay back one withheld
+    void give() {
+        if (_debt > 0) {
+            --_debt;
+        } else {
+            _sem.release();
+        }
+    }
+};
+
+// limiters of a method, the method itself and its service
+struct Limits {
+    Limits() : m(0), s(0) {}
+    Limiter* m;
+    Limiter* s;
+};
+
 class ServerImpl {
   public:
     static void ping(Json&, Json& res) {
@@ -49,13 +825,27 @@ class ServerImpl {
         _methods["ping"] = &ServerImpl::ping;
     }
 
-    ~ServerImpl() = default;
+    ~ServerImpl() {
+        for (auto& x : _limiters) co::del(x.second);
+    }
 
     void add_service(const std::shared_ptr<Service>& s) {
         _services[s->name()] = s;
         for (auto& x : s->methods()) {
             _methods[x.first] = x.second;
         }
+        auto m = s->bin_methods();
+        if (m) {
+            for (auto& x : *m) {
+                CHECK(_bin_methods.find(x.first) == _bin_methods.end())
+                    << "rpc method id conflicts: " << x.first << ", service: " << s->name();
+                _bin_methods[x.first] = x.second;
+            }
+        }
+        auto t = s->stream_methods();
+        if (t) {
+            for (auto& x : *t) _stream_methods[x.first] = x.second;
+        }
     }
 
     Service::Fun* find_method(const char* name) {
@@ -63,10 +853,70 @@ class ServerImpl {
         return it != _methods.end() ? &it->second : nullptr;
     }
 
+    void limit_calls(const char* name, uint32 n, uint32 queue, bool adaptive) {
+        CHECK(!_started) << "rpc limit_calls() MUST be called before start()";
+        CHECK_GT(n, 0) << "rpc limit of " << name << " MUST be > 0";
+        auto it = _limiters.find(name);
+        if (it != _limiters.end()) {
+            co::del(it->second);
+            _limiters.erase(it);
+        }
+        Limiter* const l = co::make<Limiter>(name, n, queue, adaptive);
+        _limiters[l->name().c_str()] = l;
+    }
+
+    // limiters of each method, by their names and names of their services
+    void resolve_limits() {
+        if (_limiters.empty()) return;
+        auto find = [this](const char* name) -> Limiter* {
+            auto it = _limiters.find(name);
+            return it != _limiters.end() ? it->second : nullptr;
+        };
+        for (auto& x : _services) {
+            Limiter* const s = find(x.first);
+            for (auto& m : x.second->methods()) {
+                Limits l;
+                l.m = find(m.first);
+                l.s = s;
+                if (l.m || l.s) _limits[m.first] = l;
+            }
+            auto b = x.second->bin_methods();
+            if (b && s) {
+                for (auto& m : *b) _bin_limits[m.first] = s;
+            }
+        }
+    }
+
+    // wait for permits of the limits, false if the request is rejected
+    bool admit(const Limits& l) {
+        const int ms = call_timeout(); // bounded by the deadline of the request
+        if (l.m && !l.m->acquire(ms)) return this->reject(l.m);
+        if (l.s && !l.s->acquire(ms)) {
+            if (l.m) l.m->release(-1);
+            return this->reject(l.s);
+        }
+        return true;
+    }
+
+    void release(const Limits& l, int64 us) {
+        if (l.s) l.s->release(us);
+        if (l.m) l.m->release(us);
+    }
+
+    bool reject(Limiter* l) {
+        MET_co_rpc_rejected_total.inc();
+        RPCLOG << "rpc reject request over the limit of " << l->name();
+        return false;
+    }
+
     void on_connection(tcp::Connection conn);
 
+    void limit(uint32 max_conn, uint32 accept_rate) { _tcp_serv.limit(max_conn, accept_rate); }
+    void on_admit(std::function<bool(sock_t)>&& f) { _tcp_serv.on_admit(std::move(f)); }
+
     void start(const char* ip, int port, const char* url, const char* key, const char* ca) {
         _url = url;
+        this->resolve_limits();
         atomic_store(&_started, true, mo_relaxed);
         _tcp_serv.on_connection(&ServerImpl::on_connection, this);
         _tcp_serv.on_exit([this]() { co::del(this); });
@@ -80,15 +930,67 @@ class ServerImpl {
         _tcp_serv.exit();
     }
 
+    const co::Histogram& histogram() const { return _hist; }
+
+    // time of a method called
+    void record(uint64 us) {
+        _hist.record(us);
+        MET_co_rpc_calls_total.inc();
+        MET_co_rpc_call_us.record(us);
+    }
+
     void process(Json& req, Json& res);
 
+    // a request expired before it was served, it is dropped without response,
+    // as the client has given up
+    void drop_expired() {
+        MET_co_rpc_expired_total.inc();
+        RPCLOG << "rpc drop expired request";
+    }
+
+    // process a request of kBinary in [p, p + n), the response is written to
+    // s after x bytes reserved for the header
+    void process_bin(const char* p, size_t n, fastream& s, size_t x);
+
+    // serve a stream opened with the body in buf, false if the connection
+    // can not be used any more
+    bool serve_stream(tcp::Connection& conn, tcp::Reader& rd, const fastring& buf, uint16 flags);
+
+    // reply to a request of kShm, and serve the client over shared memory until
+    // it is closed, false if the connection can not be used any more
+    bool serve_shm(tcp::Connection& conn);
+
+    // serve requests in shared memory
+    void shm_loop(tcp::Connection& conn, shm::Conn* c);
+
+    // wait for the next request on a connection, -2 if it was parked, -3 if
+    // responses of kMux failed to send
+    int wait_next(tcp::Connection& conn, tcp::Reader& rd, ServMux*& m);
+
+    // serve a request of kMux in a new coroutine of the current scheduler, the
+    // writer coroutine is started for the first one
+    void mux_go(ServMux*& m, tcp::Connection& conn, ServMuxTask* t);
+
+    // wait for the tasks and the writer to finish, then the reader owns the
+    // connection again, false if a response failed to send
+    bool mux_close(ServMux*& m);
+
+    // send responses queued by the tasks, until it is closed
+    void mux_write(ServMux* m);
+
   private:
     tcp::Server _tcp_serv;
     bool _started;
     bool _stopped;
     co::hash_map<const char*, std::shared_ptr<Service>> _services;
-    co::hash_map<const char*, Service::Fun> _methods;
+    co::flat_hash_map<const char*, Service::Fun> _methods;
+    co::flat_hash_map<uint32, Service::BinFun> _bin_methods;
+    co::flat_hash_map<const char*, Service::StreamFun> _stream_methods;
+    co::hash_map<const char*, Limiter*> _limiters; // by names of methods or services
+    co::flat_hash_map<const char*, Limits> _limits;
+    co::flat_hash_map<uint32, Limiter*> _bin_limits;
     fastring _url;
+    co::Histogram _hist;
 };
 
 Server::Server() {
@@ -108,6 +1010,21 @@ Server& Server::add_service(const std::shared_ptr<Service>& s) {
     return *this;
 }
 
+Server& Server::limit(uint32 max_conn, uint32 accept_rate) {
+    ((ServerImpl*)_p)->limit(max_conn, accept_rate);
+    return *this;
+}
+
+Server& Server::limit_calls(const char* name, uint32 max_concurrency, uint32 max_queue, bool adaptive) {
+    ((ServerImpl*)_p)->limit_calls(name, max_concurrency, max_queue, adaptive);
+    return *this;
+}
+
+Server& Server::on_admit(std::function<bool(sock_t)>&& f) {
+    ((ServerImpl*)_p)->on_admit(std::move(f));
+    return *this;
+}
+
 void Server::start(const char* ip, int port, const char* url, const char* key, const char* ca) {
     ((ServerImpl*)_p)->start(ip, port, url, key, ca);
 }
@@ -116,12 +1033,61 @@ void Server::exit() {
     ((ServerImpl*)_p)->exit();
 }
 
+const co::Histogram& Server::histogram() const {
+    return ((const ServerImpl*)_p)->histogram();
+}
+
+void ServerImpl::process_bin(const char* p, size_t n, fastream& s, size_t x) {
+    s.resize(x + 1); // the header and the status
+    uint32 m = 0;
+    int r = kBadRequest;
+    if (n >= sizeof(m)) {
+        memcpy(&m, p, sizeof(m));
+        m = ntoh32(m);
+        auto it = _bin_methods.find(m);
+        if (it != _bin_methods.end()) {
+            Limits l;
+            if (!_bin_limits.empty()) {
+                auto x = _bin_limits.find(m);
+                if (x != _bin_limits.end()) l.s = x->second;
+            }
+            if (!l.s || this->admit(l)) {
+                Timer t(true);
+                r = it->second(p + sizeof(m), n - sizeof(m), s);
+                const int64 us = t.us();
+                this->record((uint64)us);
+                if (l.s) this->release(l, us);
+            } else {
+                r = kOverloaded;
+            }
+        } else {
+            r = kNoMethod;
+        }
+    }
+    if (r != kOk) s.resize(x + 1);
+    ((char*)s.data())[x] = (char)r;
+    RPCLOG << "rpc call method: " << m << ", status: " << r;
+}
+
 void ServerImpl::process(Json& req, Json& res) {
     auto& x = req.get("api");
     if (x.is_string()) {
         auto m = this->find_method(x.as_c_str());
         if (m) {
+            const Limits* l = 0;
+            if (!_limits.empty()) {
+                auto it = _limits.find(x.as_c_str());
+                if (it != _limits.end()) l = &it->second;
+            }
+            if (l && !this->admit(*l)) {
+                res.add_member("error", "overloaded");
+                return;
+            }
+            Timer t(true);
             (*m)(req, res);
+            const int64 us = t.us();
+            this->record((uint64)us);
+            if (l) this->release(*l, us);
         } else {
             res.add_member("error", "api not found");
         }
@@ -130,54 +1096,363 @@ void ServerImpl::process(Json& req, Json& res) {
     }
 }
 
-using http::http_req_t;
-using http::http_res_t;
+bool ServerImpl::serve_stream(tcp::Connection& conn, tcp::Reader& rd, const fastring& buf, uint16 flags) {
+    uint32 w = 0;
+    if (buf.size() >= sizeof(w)) memcpy(&w, buf.data(), sizeof(w));
+    const char* const p = buf.data() + sizeof(w);
+    const size_t n = buf.size() > sizeof(w) ? buf.size() - sizeof(w) : 0;
+    Json req = (flags & kMsgpack) ? json::parse_msgpack(p, n) : json::parse(p, n);
+    if (req.is_null()) {
+        ELOG << "rpc stream json parse error: " << buf;
+        return false;
+    }
+    RPCLOG << "rpc open stream: " << req;
 
-void ServerImpl::on_connection(tcp::Connection conn) {
-    int kind = 0; // 0: init, 1: RPC, 2: HTTP
-    int r = 0, len = 0;
-    union {
-        Header header;
-        char c;
-    };
+    StreamImpl x(&conn, &rd, ntoh32(w), flags & (kMsgpack | kAcceptMsgpack));
+    if (!x.grant(FLG_rpc_stream_window)) return false;
+
+    auto& api = req.get("api");
+    auto it = api.is_string() ? _stream_methods.find(api.as_c_str()) : _stream_methods.end();
+    if (it != _stream_methods.end()) {
+        Stream s(&x);
+        it->second(req, s);
+    } else {
+        x.write(Json({{"error", "stream api not found"}}));
+    }
+
+    if (!x.finish() || !x.drain()) return false;
+    RPCLOG << "rpc close stream: " << req;
+    return true;
+}
+
+// parse a request, the previous request was done and can be freed now
+inline void parse_req(Json& req, co::Arena& a, char* s, size_t n, bool mp) {
+    req.reset();
+    if (mp) { req.parse_msgpack(s, n); return; } // nodes are not taken from the arena
+    if (!FLG_rpc_arena) {
+        FLG_rpc_parse_view ? req.parse_view(s, n) : req.parse_from(s, n);
+        return;
+    }
+    a.reset();
+    FLG_rpc_parse_view ? req.parse_view(s, n, a) : req.parse_from(s, n, a);
+}
+
+bool ServerImpl::serve_shm(tcp::Connection& conn) {
+    shm::Conn* const c = shm_flag() ? shm::Conn::create(FLG_rpc_shm_ring_size, FLG_rpc_max_msg_size) : 0;
+    const uint64 t = c ? shm::offer(c) : 0;
+    if (t) {
+        Json x;
+        x.add_member("addr", shm::addr().c_str());
+        x.add_member("token", (int64)t);
+        fastring s(64);
+        s.resize(sizeof(Header));
+        x.str(s);
+        set_header(s.data(), (uint32)(s.size() - sizeof(Header)), kShm);
+        if (conn.send(s.data(), (int)s.size(), FLG_rpc_send_timeout) > 0) {
+            MET_co_rpc_shm_conns_total.inc();
+            RPCLOG << "rpc switch to shared memory, connfd: " << conn.socket();
+            this->shm_loop(conn, c);
+        } else {
+            ELOG << "rpc send error: " << conn.strerror();
+        }
+        shm::withdraw(t);
+        c->close();
+        co::del(c);
+        return false;
+    }
+    if (c) co::del(c);
+
+    // no shared memory, the client goes on with tcp
+    Header h;
+    set_header(&h, 0, 0);
+    return conn.send(&h, sizeof(h), FLG_rpc_send_timeout) > 0;
+}
+
+void ServerImpl::shm_loop(tcp::Connection& conn, shm::Conn* c) {
+    int64 idle = 0; // in ms
+    int64 deadline = 0;
+    uint32 dl = 0;
+    tracing::context_t trace = {};
+    Header header;
     fastring buf;
+    fastream bs;
+    co::Arena arena; // MUST be destroyed after req
     Json req, res;
 
-    size_t pos = 0, total_len = 0;
-    http_req_t* preq = 0; 
-    http_res_t* pres = 0; 
-
     while (true) {
-        switch (kind) {
-          case 1:  goto rpc;
-          case 2:  goto http;
-          default: goto init;
+        const int r = c->read(kShmProbeMs);
+        if (r == 0) break; // closed by the client
+        if (unlikely(r == -2)) {
+            ELOG << "rpc shm recv error: bad message";
+            break;
+        }
+        if (r < 0) {
+            if (_stopped || shm::closed(conn.socket())) break;
+            idle += kShmProbeMs;
+            if (idle >= FLG_rpc_conn_idle_sec * 1000LL && _tcp_serv.conn_num() > FLG_rpc_max_idle_conn) {
+                ELOG << "rpc close idle connection, connfd: " << conn.socket();
+                break;
+            }
+            continue;
+        }
+        idle = 0;
+
+        // the head: header, deadline, trace context
+        const char* const h = c->head();
+        const size_t hn = c->head_size();
+        char* const body = (char*)c->body();
+        const size_t n = c->body_size();
+        size_t x = sizeof(Header);
+        if (unlikely(hn < x)) goto bad_msg_err;
+        memcpy(&header, h, sizeof(header));
+        if (unlikely(header.magic != kMagic || ntoh32(header.len) != n)) goto bad_msg_err;
+
+        deadline = 0;
+        if (header.flags & kDeadline) {
+            if (unlikely(hn < x + sizeof(dl))) goto bad_msg_err;
+            memcpy(&dl, h + x, sizeof(dl));
+            x += sizeof(dl);
+            deadline = now::ms() + ntoh32(dl);
+        }
+        if (header.flags & kTrace) {
+            if (unlikely(hn < x + kTraceSize)) goto bad_msg_err;
+            get_trace(h + x, trace);
         }
-    
-      init:
-        r = conn.recvn(&header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
-        if (unlikely(r == 0)) goto recv_zero_err;
-        if (unlikely(r < 0)) goto recv_err;
-        buf.reserve(4096);
 
-        // if the first 4 bytes is "POST", it is a HTTP request, otherwise it is a RPC request
-        if (*(uint32*)&header != *(uint32*)"POST") goto rpc;
-        goto http;
+        if (deadline && now::ms() >= deadline) {
+            this->drop_expired();
+            c->release();
+            if (_stopped) break;
+            continue;
+        }
+        if (deadline) co::cls_set(deadline_key(), &deadline);
+
+        {
+            tracing::Span sp((header.flags & kTrace) ? &trace : 0, "rpc", tracing::kServer);
+            const char* d;
+            size_t m;
+            if (header.flags & kBinary) {
+                if (sp.recording()) set_span_name(sp, body, n);
+                this->process_bin(body, n, bs, sizeof(Header));
+                sp.set_status((uint8)bs.data()[sizeof(Header)]);
+                set_header(bs.data(), (uint32)(bs.size() - sizeof(Header)), kBinary);
+                d = bs.data();
+                m = bs.size();
+            } else {
+                const bool mp = header.flags & (kMsgpack | kAcceptMsgpack);
+                parse_req(req, arena, body, n, header.flags & kMsgpack);
+                if (req.is_null()) {
+                    ELOG << "rpc json parse error: " << fastring(body, n);
+                    if (deadline) co::cls_set(deadline_key(), 0);
+                    break;
+                }
+                RPCLOG << "rpc recv req: " << req;
+                if (sp.recording()) set_span_name(sp, req);
+                res.reset();
+                this->process(req, res);
+
+                buf.clear();
+                buf.resize(sizeof(Header));
+                mp ? res.msgpack(buf) : res.str(buf);
+                set_header(buf.data(), (uint32)(buf.size() - sizeof(Header)), mp ? kMsgpack : 0);
+                d = buf.data();
+                m = buf.size();
+                RPCLOG << "rpc send res: " << res;
+            }
+            if (deadline) co::cls_set(deadline_key(), 0);
+
+            // the request may be referred to until the response is made
+            c->release();
+            if (!c->write(d, sizeof(Header), d + sizeof(Header), m - sizeof(Header), FLG_rpc_send_timeout)) {
+                ELOG << "rpc shm send error, body len: " << (m - sizeof(Header));
+                break;
+            }
+        }
+        if (_stopped) break;
+        continue;
+
+      bad_msg_err:
+        ELOG << "rpc shm recv error: bad request head";
+        break;
+    }
+}
+
+using http::http_req_t;
+using http::http_res_t;
+
+int ServerImpl::wait_next(tcp::Connection& conn, tcp::Reader& rd, ServMux*& m) {
+    const uint32 ms = FLG_rpc_park_idle_ms;
+    if (ms > 0 && ms < (uint32)FLG_rpc_conn_idle_sec * 1000) {
+        const int r = rd.fill(ms);
+        if (r >= 0 || !co::timeout()) return r;
+        if (m && !this->mux_close(m)) return -3;
+        if (!_stopped && _tcp_serv.park(conn, FLG_rpc_conn_idle_sec)) return -2;
+    }
+    return rd.fill(FLG_rpc_conn_idle_sec * 1000);
+}
+
+void ServerImpl::mux_go(ServMux*& m, tcp::Connection& conn, ServMuxTask* t) {
+    if (!m) {
+        m = co::make<ServMux>(&conn, FLG_rpc_conn_concurrency);
+        m->wg.add(1);
+        co::scheduler()->go(&ServerImpl::mux_write, this, m);
+    }
+    m->sem.acquire();
+    m->wg.add(1);
+
+    ServMux* const x = m;
+    co::scheduler()->go([this, x, t]() {
+        if (t->deadline && now::ms() >= t->deadline) {
+            this->drop_expired();
+            co::del(t);
+            x->sem.release();
+            x->wg.done();
+            return;
+        }
+        if (t->deadline) co::cls_set(deadline_key(), &t->deadline);
+
+        const uint16 f = t->flags;
+        const uint16 ck = (f & (kCrc32c | kAcceptCrc32c)) ? kCrc32c : 0;
+        const size_t n = sizeof(Header) + sizeof(uint32) + (ck ? sizeof(uint32) : 0);
+        fastream s(n + 256), zs;
+        uint16 flags = kMux | ck;
+        {
+            tracing::Span sp((f & kTrace) ? &t->trace : 0, "rpc", tracing::kServer);
+            if (f & kBinary) {
+                if (sp.recording()) set_span_name(sp, t->body.data(), t->body.size());
+                this->process_bin(t->body.data(), t->body.size(), s, n);
+                sp.set_status((uint8)s.data()[n]);
+                flags |= kBinary;
+            } else {
+                if (sp.recording()) set_span_name(sp, t->req);
+                Json res;
+                this->process(t->req, res);
+                const bool mp = f & (kMsgpack | kAcceptMsgpack);
+                s.resize(n);
+                mp ? res.msgpack(s) : res.str(s);
+                if (mp) flags |= kMsgpack;
+                RPCLOG << "rpc send res: " << res;
+            }
+        }
+
+        const char* d = s.data();
+        size_t k = s.size();
+        seal_res(f, flags, t->id, n, zs, d, k);
+        if (t->deadline) co::cls_set(deadline_key(), 0);
+        co::del(t);
+        if (!x->failed) {
+            x->q.append(d, k);
+            x->ev.signal();
+        }
+        x->sem.release();
+        x->wg.done();
+    });
+}
+
+void ServerImpl::mux_write(ServMux* m) {
+    fastream s;
+    while (true) {
+        if (m->q.empty()) {
+            if (m->closed) break;
+            m->ev.wait();
+            continue;
+        }
+        s.swap(m->q); // responses done while sending go to the next round
+        if (!m->failed) {
+            const int r = m->conn->send(s.data(), (int)s.size(), FLG_rpc_send_timeout);
+            if (unlikely(r <= 0)) {
+                ELOG << "rpc send error: " << m->conn->strerror();
+                m->failed = true;
+            }
+        }
+        s.clear();
+    }
+    m->wg.done();
+}
+
+bool ServerImpl::mux_close(ServMux*& m) {
+    // wait for the tasks first, the writer may still have responses to send
+    m->sem.acquire(FLG_rpc_conn_concurrency);
+    m->closed = true;
+    m->ev.signal();
+    m->wg.wait();
+    const bool ok = !m->failed;
+    co::del(m);
+    m = 0;
+    return ok;
+}
+
+// The connection is moved to the heap, as the writer and tasks of kMux refer to
+// it, and the stack of this coroutine may be shared and saved when it waits.
+void ServerImpl::on_connection(tcp::Connection c) {
+    tcp::Connection& conn = *co::make<tcp::Connection>(std::move(c));
+    ServMux* m = 0;  // see rpc_conn_concurrency
+    int kind = 0; // 0: init, 1: RPC, 2: HTTP
+    int r = 0, len = 0;
+    bool mp = false; // reply in MessagePack
+    uint32 id = 0;   // request id of kMux
+    uint32 crc = 0;  // checksum of kCrc32c
+    uint32 dl = 0;   // timeout of kDeadline
+    int64 deadline = 0;
+    char tb[kTraceSize]; // trace context of kTrace
+    tracing::context_t trace = {};
+    Header header;
+    fastring buf;
+    fastring out;    // responses held back, see kMaxPendingRes
+    fastream bs;     // responses of kBinary
+    fastream zs;     // compressed requests or responses
+    tcp::Reader rd(conn);
+    co::Arena arena; // MUST be destroyed after req
+    Json req, res;
+
+    size_t pos = 0;
+    http_req_t* preq = 0; 
+    http_res_t* pres = 0; 
+
+    while (true) {
+        switch (kind) {
+          case 1:  goto rpc;
+          case 2:  goto http;
+          default: goto init;
+        }
+    
+      init:
+        r = rd.peek(sizeof(header), FLG_rpc_conn_idle_sec * 1000);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+        buf.reserve(4096);
+
+        // if the first 4 bytes is "POST", it is a HTTP request, otherwise it is a RPC request
+        if (memcmp(rd.data(), "POST", 4) != 0) {
+            rd.read_exact(&header, sizeof(header));
+            goto rpc;
+        }
+        goto http;
 
       rpc:
         do {
           recv_rpc_beg:
             // recv req from the client
             if (kind == 1) {
-                r = conn.recvn(&header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
-                if (unlikely(r == 0)) goto recv_zero_err;
-                if (unlikely(r < 0)) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_stopped) { conn.reset(); goto end; } // server stopped
-                    if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
+                if (rd.empty()) {
+                    // wait for the next request, without holding any buffer
+                    rd.release();
                     buf.reset();
-                    goto recv_rpc_beg;
+                    r = this->wait_next(conn, rd, m);
+                    if (r == -2) goto end; // parked
+                    if (unlikely(r == 0)) goto recv_zero_err;
+                    if (unlikely(r == -3)) goto reset_conn;
+                    if (unlikely(r < 0)) {
+                        if (!co::timeout()) goto recv_err;
+                        if (_stopped) { if (m) this->mux_close(m); conn.reset(); goto end; } // server stopped
+                        if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
+                        buf.reset();
+                        goto recv_rpc_beg;
+                    }
                 }
+                r = rd.read_exact(&header, sizeof(header), FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
             } else {
                 kind = 1;
             }
@@ -187,27 +1462,173 @@ void ServerImpl::on_connection(tcp::Connection conn) {
             len = ntoh32(header.len);
             if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
 
+            if (unlikely(header.flags & kShm)) {
+                if (m && !this->mux_close(m)) goto reset_conn;
+                if (!out.empty()) {
+                    r = conn.send(out.data(), (int)out.size(), FLG_rpc_send_timeout);
+                    if (unlikely(r <= 0)) goto send_err;
+                    out.clear();
+                }
+                if (!this->serve_shm(conn)) { conn.close(); goto end; }
+                goto recv_rpc_beg;
+            }
+
+            if (header.flags & kMux) {
+                r = rd.read_exact(&id, sizeof(id), FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+            }
+
+            if (header.flags & kCrc32c) {
+                r = rd.read_exact(&crc, sizeof(crc), FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+            }
+
+            deadline = 0;
+            if (header.flags & kDeadline) {
+                r = rd.read_exact(&dl, sizeof(dl), FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+                deadline = now::ms() + ntoh32(dl);
+            }
+
+            if (header.flags & kTrace) {
+                r = rd.read_exact(tb, kTraceSize, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+                get_trace(tb, trace);
+            }
+
             if (buf.capacity() == 0) buf.reserve(4096);
-            buf.resize(len);
-            r = conn.recvn((char*)buf.data(), len, FLG_rpc_recv_timeout);
-            if (unlikely(r == 0)) goto recv_zero_err;
-            if (unlikely(r < 0)) goto recv_err;
-
-            req = json::parse(buf.data(), buf.size());
-            if (req.is_null()) goto json_parse_err;
-            RPCLOG << "rpc recv req: " << req;
-
-            // call rpc and send response to the client
-            res.reset();
-            this->process(req, res);
-
-            buf.resize(sizeof(Header));
-            res.str(buf);
-            set_header(buf.data(), (uint32)(buf.size() - sizeof(Header)));
-            
-            r = conn.send(buf.data(), (int)buf.size(), FLG_rpc_send_timeout);
-            if (unlikely(r <= 0)) goto send_err;
-            RPCLOG << "rpc send res: " << res;
+            if (header.flags & (kLz4 | kZstd)) {
+                // recv the compressed body, and decompress it to buf
+                zs.resize(len);
+                r = rd.read_exact((char*)zs.data(), len, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+                if ((header.flags & kCrc32c) && crc32c(zs.data(), len) != ntoh32(crc)) goto checksum_err;
+                const uint32 m = raw_size(zs.data(), len);
+                if (unlikely(m == 0)) goto decompress_err;
+                buf.resize(m);
+                if (!decompress(header.flags & (kLz4 | kZstd), zs.data(), len, (char*)buf.data(), m)) {
+                    goto decompress_err;
+                }
+            } else {
+                buf.resize(len);
+                r = rd.read_exact((char*)buf.data(), len, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+                if ((header.flags & kCrc32c) && crc32c(buf.data(), len) != ntoh32(crc)) goto checksum_err;
+            }
+
+            // requests with ids may be served concurrently, others wait for them
+            if ((header.flags & kMux) && !(header.flags & kStream) && FLG_rpc_conn_concurrency > 1) {
+                ServMuxTask* t = co::make<ServMuxTask>();
+                t->body.swap(buf);
+                t->flags = header.flags;
+                t->id = id;
+                t->deadline = deadline;
+                if (header.flags & kTrace) t->trace = trace;
+                if (!(header.flags & kBinary)) {
+                    if (header.flags & kMsgpack) {
+                        t->req.parse_msgpack(t->body.data(), t->body.size());
+                    } else {
+                        FLG_rpc_parse_view ? t->req.parse_view((char*)t->body.data(), t->body.size())
+                                           : t->req.parse_from(t->body.data(), t->body.size());
+                    }
+                    if (t->req.is_null()) { buf.swap(t->body); co::del(t); goto json_parse_err; }
+                    RPCLOG << "rpc recv req: " << t->req;
+                }
+                if (!m && !out.empty()) {
+                    r = conn.send(out.data(), (int)out.size(), FLG_rpc_send_timeout);
+                    if (unlikely(r <= 0)) goto send_err;
+                    out.clear();
+                }
+                this->mux_go(m, conn, t);
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+            if (m && !this->mux_close(m)) goto reset_conn;
+
+            if (header.flags & kStream) {
+                if (!out.empty()) {
+                    r = conn.send(out.data(), (int)out.size(), FLG_rpc_send_timeout);
+                    if (unlikely(r <= 0)) goto send_err;
+                    out.clear();
+                }
+                // credits left by a stream that was done
+                if (header.flags & (kStreamEnd | kStreamCredit)) goto recv_rpc_beg;
+                if (!this->serve_stream(conn, rd, buf, header.flags)) goto reset_conn;
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+
+            if (deadline && now::ms() >= deadline) {
+                this->drop_expired();
+                if (!out.empty() && !has_rpc_req(rd)) {
+                    r = conn.send(out.data(), (int)out.size(), FLG_rpc_send_timeout);
+                    if (unlikely(r <= 0)) goto send_err;
+                    out.clear();
+                }
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+            if (deadline) co::cls_set(deadline_key(), &deadline);
+
+            {
+                tracing::Span sp((header.flags & kTrace) ? &trace : 0, "rpc", tracing::kServer);
+                if (!(header.flags & kBinary)) {
+                    mp = header.flags & (kMsgpack | kAcceptMsgpack);
+                    parse_req(req, arena, (char*)buf.data(), buf.size(), header.flags & kMsgpack);
+                    if (req.is_null()) goto json_parse_err;
+                    RPCLOG << "rpc recv req: " << req;
+                    if (sp.recording()) set_span_name(sp, req);
+
+                    // call rpc and send response to the client
+                    res.reset();
+                    this->process(req, res);
+                }
+
+                {
+                    const uint16 mux = header.flags & kMux;
+                    const uint16 ck = (header.flags & (kCrc32c | kAcceptCrc32c)) ? kCrc32c : 0;
+                    const size_t x = sizeof(Header) + (mux ? sizeof(id) : 0) + (ck ? sizeof(crc) : 0);
+                    const char* d;
+                    size_t n;
+                    uint16 flags = mux | ck;
+                    if (header.flags & kBinary) {
+                        if (sp.recording()) set_span_name(sp, buf.data(), buf.size());
+                        this->process_bin(buf.data(), buf.size(), bs, x);
+                        sp.set_status((uint8)bs.data()[x]);
+                        flags |= kBinary;
+                        d = bs.data();
+                        n = bs.size();
+                    } else {
+                        buf.resize(x);
+                        mp ? res.msgpack(buf) : res.str(buf);
+                        if (mp) flags |= kMsgpack;
+                        d = buf.data();
+                        n = buf.size();
+                        RPCLOG << "rpc send res: " << res;
+                    }
+                    seal_res(header.flags, flags, id, x, zs, d, n);
+                    if (deadline) co::cls_set(deadline_key(), 0);
+
+                    // the next request is ready, send the response with it later
+                    if (!_stopped && out.size() + n <= kMaxPendingRes && has_rpc_req(rd)) {
+                        out.append(d, n);
+                    } else {
+                        co::iov_t iov[2];
+                        int k = 0;
+                        if (!out.empty()) iov[k++] = co::make_iov(out.data(), out.size());
+                        iov[k++] = co::make_iov(d, n);
+                        r = (int) conn.sendv(iov, k, FLG_rpc_send_timeout);
+                        if (unlikely(r <= 0)) goto send_err;
+                        out.clear();
+                    }
+                }
+            }
 
             if (_stopped) goto reset_conn;
             goto recv_rpc_beg;
@@ -217,9 +1638,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
         do {
           recv_http_beg:
             if (kind == 2) {
-                if (buf.capacity() == 0) {
-                    // try to recieve a single byte
-                    r = conn.recv(&c, 1, FLG_rpc_conn_idle_sec * 1000);
+                if (rd.empty()) {
+                    // wait for the next request, without holding any buffer
+                    rd.release();
+                    buf.reset();
+                    r = this->wait_next(conn, rd, m);
+                    if (r == -2) goto end; // parked
                     if (r == 0) goto recv_zero_err;
                     if (r < 0) {
                         if (!co::timeout()) goto recv_err;
@@ -227,38 +1651,30 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                         if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
                         goto recv_http_beg;
                     }
-                    buf.reserve(4096);
-                    buf.append(c);
                 }
             } else {
                 kind = 2;
-                buf.append(&header, sizeof(header));
             }
 
             // recv until the entire http header was done. 
-            while ((pos = buf.find("\r\n\r\n")) == buf.npos) {
-                if (buf.size() > FLG_http_max_header_size) goto header_too_long_err;
-                buf.reserve(buf.size() + 1024);
-                r = conn.recv(
-                    (void*)(buf.data() + buf.size()), 
-                    (int)(buf.capacity() - buf.size()), FLG_rpc_recv_timeout
-                );
-                if (r == 0) goto recv_zero_err;
-                if (r < 0) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
-                    if (buf.empty()) { buf.reset(); goto recv_http_beg; }
-                    goto recv_err;
-                }
-                buf.resize(buf.size() + r);
+            r = rd.read_until("\r\n\r\n", FLG_http_max_header_size, FLG_rpc_recv_timeout);
+            if (r == -2) goto header_too_long_err;
+            if (r == 0) goto recv_zero_err;
+            if (r < 0) {
+                if (co::timeout() && _tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
+                goto recv_err;
             }
 
+            pos = r - 4;
+            buf.append(rd.data(), r);
+            rd.consume(r);
+
             buf[pos + 2] = '\0'; // make header null-terminated
             RPCLOG << "rpc recv http header: " << buf.data();
 
             // parse http header
-            if (preq == 0) preq = (http_req_t*) co::zalloc(sizeof(http_req_t));
-            if (pres == 0) pres = (http_res_t*) co::zalloc(sizeof(http_res_t));
+            if (preq == 0) preq = http::make_http_req();
+            if (pres == 0) pres = http::make_http_res();
 
             r = http::parse_http_req(&buf, pos + 2, preq);
             if (r != 0) { /* parse error */
@@ -280,18 +1696,11 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
             // try to recv the remain part of http body
             preq->body = (uint32)(pos + 4); // beginning of http body
-            total_len = pos + 4 + preq->body_size;
             if (preq->body_size > 0) {
-                if (buf.size() < total_len) {
-                    buf.reserve(total_len);
-                    r = conn.recvn(
-                        (void*)(buf.data() + buf.size()), 
-                        (int)(total_len - buf.size()), FLG_rpc_recv_timeout
-                    );
-                    if (r == 0) goto recv_zero_err;
-                    if (r < 0) goto recv_err;
-                    buf.resize(total_len);
-                }
+                buf.resize(pos + 4 + preq->body_size);
+                r = rd.read_exact((void*)(buf.data() + pos + 4), preq->body_size, FLG_rpc_recv_timeout);
+                if (r == 0) goto recv_zero_err;
+                if (r < 0) goto recv_err;
             } else {
                 // 411 Content-Length required
                 send_error_message(411, pres, &conn);
@@ -314,12 +1723,18 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 s.clear();
                 pres->buf = &s;
 
-                req = json::parse(preq->buf->data() + preq->body, preq->body_size);
+                parse_req(req, arena, (char*)preq->buf->data() + preq->body, preq->body_size, false);
                 if (req.is_null()) goto json_parse_err;
                 RPCLOG << "rpc recv http body: " << req;
 
                 res.reset();
-                this->process(req, res);
+                {
+                    tracing::context_t tc;
+                    const bool has_tc = tracing::parse(preq->header("traceparent"), tc);
+                    tracing::Span sp(has_tc ? &tc : 0, "rpc", tracing::kServer);
+                    if (sp.recording()) set_span_name(sp, req);
+                    this->process(req, res);
+                }
 
                 x = res.str();
                 pres->status = 200;
@@ -333,15 +1748,10 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 if (need_close) { conn.close(); goto end; }
             }
 
-            if (buf.size() == total_len) {
-                buf.clear();
-            } else {
-                buf.lshift(total_len);
-            }
-
+            // data of the next request, if any, is left in the reader
+            buf.clear();
             preq->clear();
             pres->clear();
-            total_len = 0;
             if (_stopped) goto reset_conn;
             goto recv_http_beg;
         } while (0);
@@ -349,10 +1759,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
   recv_zero_err:
     LOG << "rpc client close the connection, connfd: " << conn.socket();
+    if (m) this->mux_close(m);
     conn.close();
     goto end;
   idle_err:
     ELOG << "rpc close idle connection, connfd: " << conn.socket();
+    if (m) this->mux_close(m);
     conn.reset();
     goto end;
   magic_err:
@@ -364,6 +1776,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
   msg_too_long_err:
     ELOG << "rpc recv error: body too long: " << len;
     goto reset_conn;
+  decompress_err:
+    ELOG << "rpc decompress request failed, flags: " << header.flags;
+    goto reset_conn;
+  checksum_err:
+    ELOG << "rpc recv error: checksum mismatch, body len: " << len;
+    goto reset_conn;
   recv_err:
     ELOG << "rpc recv error: " << conn.strerror();
     goto reset_conn;
@@ -378,35 +1796,91 @@ void ServerImpl::on_connection(tcp::Connection conn) {
     http::send_error_message(r, pres, &conn);
     goto reset_conn;
   reset_conn:
+    if (m) this->mux_close(m);
     conn.reset(3000);
   end:
-    if (preq) co::free(preq, sizeof(*preq));
-    if (pres) co::free(pres, sizeof(*pres));
+    if (preq) http::free_http_req(preq);
+    if (pres) http::free_http_res(pres);
+    co::del(&conn);
 }
 
 class ClientImpl {
   public:
+    // requests in _fs begin at kHeadSize, with room for the header, the
+    // checksum, the deadline and the trace context before them
+    static const size_t kHeadSize = sizeof(Header) + sizeof(uint32) * 2 + kTraceSize;
+
     ClientImpl(const char* ip, int port, bool use_ssl)
-        : _tcp_cli(ip, port, use_ssl) {
+        : _tcp_cli(ip, port, use_ssl), _mp(false), _crc(false), _dl(false), _tr(false), _accept(0),
+          _shm(0), _shm_ok(false), _shm_off(false) {
     }
 
     ClientImpl(const ClientImpl& c)
-        : _tcp_cli(c._tcp_cli) {
+        : _tcp_cli(c._tcp_cli), _mp(false), _crc(false), _dl(false), _tr(false), _accept(0),
+          _shm(0), _shm_ok(false), _shm_off(false) {
     }
 
-    ~ClientImpl() = default;
+    ~ClientImpl() { this->close_shm(); }
 
-    void call(const Json& req, Json& res);
+    // return false on error or timeout
+    bool call(const Json& req, Json& res);
+
+    // call with typed messages, return the status
+    int call(uint32 method, const Message& req, Message& res);
+
+    // open a stream, NULL on error
+    StreamImpl* stream(const Json& req);
 
     void close() {
+        this->close_shm();
         _tcp_cli.disconnect();
     }
 
   private:
     tcp::Client _tcp_cli;
     fastream _fs;
+    fastream _zs;   // compressed requests or responses
+    bool _mp;       // the server replied in MessagePack on this connection
+    bool _crc;      // the server replied with checksums on this connection
+    bool _dl;       // the server supports deadlines
+    bool _tr;       // the server supports trace contexts
+    uint16 _accept; // codecs the server supports, in kAccept bits
+    shm::Conn* _shm; // calls go through shared memory if it is not NULL, see kShm
+    bool _shm_ok;   // the server offers shared memory
+    bool _shm_off;  // do not try shared memory again, it failed or the server is not local
 
     bool connect();
+
+    // switch the connection to shared memory, false if it stays on tcp, the
+    // connection is closed on error
+    bool attach_shm(int ms);
+
+    void close_shm() {
+        if (_shm) {
+            _shm->close();
+            co::del(_shm);
+            _shm = 0;
+        }
+    }
+
+    // the header, the deadline and the trace context of a request in shared
+    // memory, return the size
+    size_t shm_head(char* p, uint16 flags, size_t len, int ms, const tracing::Span& sp);
+
+    // wait for a response in shared memory, see shm::Conn::read()
+    int shm_wait(int ms);
+
+    bool shm_call(const Json& req, Json& res, int ms, tracing::Span& sp);
+    int shm_call(uint32 method, const Message& req, Message& res, int ms, tracing::Span& sp);
+
+    // send the request in _fs, it is compressed if the server supports it,
+    // @ms is the timeout of the call, sent as the deadline, the context of
+    // @sp is sent if it is recording
+    int send_req(uint16 flags, int ms, const tracing::Span& sp);
+
+    // recv the body of a response into _fs, -2 if it can not be decompressed,
+    // -3 if the checksum does not match
+    int recv_res(const Header& h, int len, int ms);
 };
 
 Client::Client(const char* ip, int port, bool use_ssl) {
@@ -422,7 +1896,15 @@ Client::~Client() {
 }
 
 void Client::call(const Json& req, Json& res) {
-    return ((ClientImpl*)_p)->call(req, res);
+    ((ClientImpl*)_p)->call(req, res);
+}
+
+int Client::call(uint32 method, const Message& req, Message& res) {
+    return ((ClientImpl*)_p)->call(method, req, res);
+}
+
+Stream Client::stream(const Json& req) {
+    return Stream(((ClientImpl*)_p)->stream(req));
 }
 
 void Client::close() {
@@ -435,21 +1917,281 @@ void Client::ping() {
 }
 
 bool ClientImpl::connect() {
+    _mp = false; // it may be another server
+    _crc = false;
+    _dl = false;
+    _tr = false;
+    _accept = 0;
+    _shm_ok = false;
+    this->close_shm();
     return _tcp_cli.connect(FLG_rpc_conn_timeout);
 }
 
-void ClientImpl::call(const Json& req, Json& res) {
+bool ClientImpl::attach_shm(int ms) {
+    int r = 0, len = 0;
+    Header h;
+    _shm_ok = false;
+    if (!shm::same_host(_tcp_cli.socket())) {
+        _shm_off = true;
+        return false;
+    }
+
+    set_header(&h, 0, kShm);
+    r = _tcp_cli.send(&h, sizeof(h), FLG_rpc_send_timeout);
+    if (unlikely(r <= 0)) goto err;
+    r = _tcp_cli.recvn(&h, sizeof(h), ms);
+    if (unlikely(r <= 0 || h.magic != kMagic)) goto err;
+    len = ntoh32(h.len);
+    if (!(h.flags & kShm) || len == 0) { /* refused by the server */
+        _shm_off = true;
+        return false;
+    }
+    if (unlikely(len > 4096)) goto err;
+
+    _fs.resize(len);
+    r = _tcp_cli.recvn((char*)_fs.data(), len, ms);
+    if (unlikely(r <= 0)) goto err;
+    {
+        Json x = json::parse(_fs.data(), _fs.size());
+        const char* addr = x.get("addr").as_c_str();
+        _shm = shm::fetch(addr, (uint64)x.get("token").as_int64(), ms);
+    }
+    if (_shm) {
+        RPCLOG << "rpc switch to shared memory, connfd: " << _tcp_cli.socket();
+        return true;
+    }
+
+  err:
+    ELOG << "rpc switch to shared memory failed: " << _tcp_cli.strerror();
+    _shm_off = true;
+    _tcp_cli.disconnect(); // the server may be waiting on the memory
+    return false;
+}
+
+size_t ClientImpl::shm_head(char* p, uint16 flags, size_t len, int ms, const tracing::Span& sp) {
+    size_t n = sizeof(Header);
+    if (FLG_rpc_deadline) {
+        flags |= kDeadline;
+        const uint32 x = hton32((uint32)ms);
+        memcpy(p + n, &x, sizeof(x));
+        n += sizeof(x);
+    }
+    if (sp.recording()) {
+        flags |= kTrace;
+        put_trace(p + n, sp.context());
+        n += kTraceSize;
+    }
+    set_header(p, (uint32)len, flags);
+    return n;
+}
+
+int ClientImpl::shm_wait(int ms) {
+    const int64 end = now::ms() + ms;
+    while (true) {
+        const int64 t = end - now::ms();
+        const int r = _shm->read(t < kShmProbeMs ? (int)t : kShmProbeMs);
+        if (r != -1 || t <= kShmProbeMs) return r;
+        if (shm::closed(_tcp_cli.socket())) return 0;
+    }
+}
+
+bool ClientImpl::shm_call(const Json& req, Json& res, int ms, tracing::Span& sp) {
+    char head[sizeof(Header) + sizeof(uint32) + kTraceSize];
+    Header h;
+    uint16 flags = 0;
+    _fs.clear();
+    if (FLG_rpc_msgpack) {
+        req.msgpack(_fs);
+        flags = kMsgpack;
+    } else {
+        req.str(_fs);
+    }
+    const size_t hn = this->shm_head(head, flags, _fs.size(), ms, sp);
+    if (unlikely(!_shm->write(head, hn, _fs.data(), _fs.size(), FLG_rpc_send_timeout))) goto send_err;
+    RPCLOG << "rpc send req: " << req;
+
+    switch (this->shm_wait(ms)) {
+      case 1:  break;
+      case 0:  goto closed_err;
+      case -1: goto timeout_err;
+      default: goto bad_res_err;
+    }
+    if (unlikely(_shm->head_size() < sizeof(h))) goto bad_res_err;
+    memcpy(&h, _shm->head(), sizeof(h));
+    if (unlikely(h.magic != kMagic)) goto bad_res_err;
+    if (h.flags & kMsgpack) {
+        res = json::parse_msgpack(_shm->body(), _shm->body_size());
+    } else {
+        res = json::parse(_shm->body(), _shm->body_size());
+    }
+    _shm->release();
+    if (res.is_null()) goto bad_res_err;
+    RPCLOG << "rpc recv res: " << res;
+    return true;
+
+  send_err:
+    ELOG << "rpc shm send error, body len: " << _fs.size();
+    goto err_end;
+  closed_err:
+    ELOG << "rpc server close the connection..";
+    goto err_end;
+  timeout_err:
+    ELOG << "rpc shm recv error: timeout";
+    goto err_end;
+  bad_res_err:
+    ELOG << "rpc shm recv error: bad response";
+    goto err_end;
+  err_end:
+    this->close();
+    sp.set_status(kNetError);
+    return false;
+}
+
+int ClientImpl::shm_call(uint32 method, const Message& req, Message& res, int ms, tracing::Span& sp) {
+    char head[sizeof(Header) + sizeof(uint32) + kTraceSize];
+    Header h;
+    int status = kNetError;
+    const uint32 m = hton32(method);
+    _fs.clear();
+    _fs.append(&m, sizeof(m));
+    if (sp.recording()) set_span_name(sp, _fs.data(), sizeof(m));
+    req.encode(_fs);
+    const size_t hn = this->shm_head(head, kBinary, _fs.size(), ms, sp);
+    if (unlikely(!_shm->write(head, hn, _fs.data(), _fs.size(), FLG_rpc_send_timeout))) goto send_err;
+    RPCLOG << "rpc send req, method: " << method;
+
+    switch (this->shm_wait(ms)) {
+      case 1:  break;
+      case 0:  goto closed_err;
+      case -1: goto timeout_err;
+      default: goto bad_res_err;
+    }
+    if (unlikely(_shm->head_size() < sizeof(h))) goto bad_res_err;
+    memcpy(&h, _shm->head(), sizeof(h));
+    if (unlikely(h.magic != kMagic || !(h.flags & kBinary) || _shm->body_size() == 0)) goto bad_res_err;
+
+    // the message is decoded from the shared memory
+    status = (uint8)_shm->body()[0];
+    RPCLOG << "rpc recv res, method: " << method << ", status: " << status;
+    if (status == kOk && !res.decode(_shm->body() + 1, _shm->body_size() - 1)) {
+        ELOG << "rpc decode response failed, method: " << method;
+        status = kNetError;
+    }
+    _shm->release();
+    sp.set_status(status);
+    return status;
+
+  send_err:
+    ELOG << "rpc shm send error, body len: " << _fs.size();
+    goto err_end;
+  closed_err:
+    ELOG << "rpc server close the connection..";
+    goto err_end;
+  timeout_err:
+    ELOG << "rpc shm recv error: timeout, method: " << method;
+    goto err_end;
+  bad_res_err:
+    ELOG << "rpc bad response of method: " << method;
+    goto err_end;
+  err_end:
+    this->close();
+    sp.set_status(kNetError);
+    return kNetError;
+}
+
+int ClientImpl::send_req(uint16 flags, int ms, const tracing::Span& sp) {
+    if (!FLG_rpc_compress.empty()) flags |= accepted_codecs();
+    if (FLG_rpc_checksum) flags |= _crc ? kCrc32c : kAcceptCrc32c;
+    char* d = (char*)_fs.data();
+    size_t n = _fs.size();
+    const uint16 c = compress_codec();
+    if (c && (_accept & accept_bit(c)) && n - kHeadSize >= FLG_rpc_compress_min_size) {
+        _zs.resize(kHeadSize);
+        if (compress(c, d + kHeadSize, n - kHeadSize, _zs)) {
+            flags |= c;
+            d = (char*)_zs.data();
+            n = _zs.size();
+        }
+    }
+
+    // the trace context, the deadline, the checksum and the header are put
+    // right before the body
+    const uint32 len = (uint32)(n - kHeadSize);
+    char* p = d + kHeadSize;
+    if (_tr && sp.recording()) {
+        flags |= kTrace;
+        p -= kTraceSize;
+        put_trace(p, sp.context());
+    }
+    if (_dl && FLG_rpc_deadline) {
+        flags |= kDeadline;
+        p -= sizeof(uint32);
+        const uint32 x = hton32((uint32)ms);
+        memcpy(p, &x, sizeof(x));
+    }
+    if (flags & kCrc32c) {
+        p -= sizeof(uint32);
+        const uint32 x = hton32(crc32c(d + kHeadSize, len));
+        memcpy(p, &x, sizeof(x));
+    }
+    p -= sizeof(Header);
+    set_header(p, len, flags);
+    return _tcp_cli.send(p, (int)(d + n - p), FLG_rpc_send_timeout);
+}
+
+int ClientImpl::recv_res(const Header& h, int len, int ms) {
+    if (h.flags & kAcceptMask) _accept = h.flags & kAcceptMask;
+    if (h.flags & kDeadline) _dl = true;
+    if (h.flags & kTrace) _tr = true;
+    if ((h.flags & kShm) && !_shm && !_shm_off && FLG_rpc_shm) _shm_ok = true;
+    uint32 crc = 0;
+    if (h.flags & kCrc32c) {
+        const int r = _tcp_cli.recvn(&crc, sizeof(crc), ms);
+        if (r <= 0) return r;
+        _crc = FLG_rpc_checksum;
+    }
+
+    const uint16 c = h.flags & (kLz4 | kZstd);
+    if (!c) {
+        _fs.resize(len);
+        const int r = _tcp_cli.recvn((char*)_fs.data(), len, ms);
+        if (r > 0 && (h.flags & kCrc32c) && crc32c(_fs.data(), len) != ntoh32(crc)) return -3;
+        return r;
+    }
+
+    _zs.resize(len);
+    const int r = _tcp_cli.recvn((char*)_zs.data(), len, ms);
+    if (r <= 0) return r;
+    if ((h.flags & kCrc32c) && crc32c(_zs.data(), len) != ntoh32(crc)) return -3;
+    const uint32 m = raw_size(_zs.data(), len);
+    if (m == 0) return -2;
+    _fs.resize(m);
+    return decompress(c, _zs.data(), len, (char*)_fs.data(), m) ? r : -2;
+}
+
+bool ClientImpl::call(const Json& req, Json& res) {
     int r = 0, len = 0;
     Header header;
-    if (!_tcp_cli.connected() && !this->connect()) return;
+    tracing::Span sp("rpc", tracing::kClient);
+    if (sp.recording()) set_span_name(sp, req);
+    const int ms = call_timeout();
+    if (unlikely(ms <= 0)) goto deadline_err;
+    if (!_tcp_cli.connected() && !this->connect()) return false;
+    if (unlikely(_shm_ok) && !this->attach_shm(ms) && !_tcp_cli.connected() && !this->connect()) return false;
+    if (_shm) return this->shm_call(req, res, ms, sp);
 
     // send request
     do {
-        _fs.resize(sizeof(Header));
-        req.str(_fs);
-        set_header((void*)_fs.data(), (uint32)(_fs.size() - sizeof(Header)));
-
-        r = _tcp_cli.send(_fs.data(), (int)_fs.size(), FLG_rpc_send_timeout);
+        _fs.resize(kHeadSize);
+        uint16 flags = 0;
+        if (_mp) {
+            req.msgpack(_fs);
+            flags = kMsgpack;
+        } else {
+            req.str(_fs);
+            if (FLG_rpc_msgpack) flags = kAcceptMsgpack;
+        }
+        r = this->send_req(flags, ms, sp);
         if (unlikely(r <= 0)) goto send_err;
 
         RPCLOG << "rpc send req: " << req;
@@ -457,7 +2199,7 @@ void ClientImpl::call(const Json& req, Json& res) {
 
     // wait for response
     do {
-        r = _tcp_cli.recvn(&header, sizeof(header), FLG_rpc_recv_timeout);
+        r = _tcp_cli.recvn(&header, sizeof(header), ms);
         if (unlikely(r == 0)) goto recv_zero_err;
         if (unlikely(r < 0)) goto recv_err;
         if (unlikely(header.magic != kMagic)) goto magic_err;
@@ -465,17 +2207,27 @@ void ClientImpl::call(const Json& req, Json& res) {
         len = ntoh32(header.len);
         if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
 
-        _fs.resize(len);
-        r = _tcp_cli.recvn((char*)_fs.data(), len, FLG_rpc_recv_timeout);
+        r = this->recv_res(header, len, ms);
+        if (unlikely(r == -2)) goto decompress_err;
+        if (unlikely(r == -3)) goto checksum_err;
         if (unlikely(r == 0)) goto recv_zero_err;
         if (unlikely(r < 0)) goto recv_err;
 
-        res = json::parse(_fs.c_str(), _fs.size());
+        if (header.flags & kMsgpack) {
+            res = json::parse_msgpack(_fs.data(), _fs.size());
+            _mp = FLG_rpc_msgpack;
+        } else {
+            res = json::parse(_fs.c_str(), _fs.size());
+        }
         if (res.is_null()) goto json_parse_err;
         RPCLOG << "rpc recv res: " << res;
-        return;
+        return true;
     } while (0);
 
+  deadline_err:
+    ELOG << "rpc call error: deadline exceeded";
+    sp.set_status(kNetError);
+    return false;
   magic_err:
     ELOG << "rpc recv error: bad magic number: " << header.magic;
     goto err_end;
@@ -491,11 +2243,632 @@ void ClientImpl::call(const Json& req, Json& res) {
   send_err:
     ELOG << "rpc send error: " << _tcp_cli.strerror();
     goto err_end;
+  decompress_err:
+    ELOG << "rpc decompress response failed, flags: " << header.flags;
+    goto err_end;
+  checksum_err:
+    ELOG << "rpc recv error: checksum mismatch, body len: " << len;
+    goto err_end;
   json_parse_err:
     ELOG << "rpc json parse error: " << _fs;
     goto err_end;
   err_end:
     _tcp_cli.disconnect();
+    sp.set_status(kNetError);
+    return false;
+}
+
+int ClientImpl::call(uint32 method, const Message& req, Message& res) {
+    int r = 0, len = 0;
+    Header header;
+    tracing::Span sp("rpc", tracing::kClient);
+    const int ms = call_timeout();
+    if (unlikely(ms <= 0)) goto deadline_err;
+    if (!_tcp_cli.connected() && !this->connect()) return kNetError;
+    if (unlikely(_shm_ok) && !this->attach_shm(ms) && !_tcp_cli.connected() && !this->connect()) return kNetError;
+    if (_shm) return this->shm_call(method, req, res, ms, sp);
+
+    // send request: header, method id, message
+    do {
+        _fs.resize(kHeadSize + sizeof(method));
+        const uint32 m = hton32(method);
+        memcpy((char*)_fs.data() + kHeadSize, &m, sizeof(m));
+        if (sp.recording()) set_span_name(sp, _fs.data() + kHeadSize, sizeof(m));
+        req.encode(_fs);
+        r = this->send_req(kBinary, ms, sp);
+        if (unlikely(r <= 0)) goto send_err;
+        RPCLOG << "rpc send req, method: " << method;
+    } while (0);
+
+    // wait for response: header, status, message
+    do {
+        r = _tcp_cli.recvn(&header, sizeof(header), ms);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+        if (unlikely(header.magic != kMagic)) goto magic_err;
+
+        len = ntoh32(header.len);
+        if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
+
+        r = this->recv_res(header, len, ms);
+        if (unlikely(r == -2)) goto decompress_err;
+        if (unlikely(r == -3)) goto checksum_err;
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+
+        // an old server replies in json for errors
+        if (unlikely(!(header.flags & kBinary) || _fs.empty())) goto bad_res_err;
+        const int status = (uint8)_fs[0];
+        RPCLOG << "rpc recv res, method: " << method << ", status: " << status;
+        sp.set_status(status);
+        if (status != kOk) return status;
+        if (!res.decode(_fs.data() + 1, _fs.size() - 1)) {
+            ELOG << "rpc decode response failed, method: " << method;
+            sp.set_status(kNetError);
+            return kNetError;
+        }
+        return kOk;
+    } while (0);
+
+  deadline_err:
+    ELOG << "rpc call error: deadline exceeded, method: " << method;
+    sp.set_status(kNetError);
+    return kNetError;
+  magic_err:
+    ELOG << "rpc recv error: bad magic number: " << header.magic;
+    goto err_end;
+  msg_too_long_err:
+    ELOG << "rpc recv error: body too long: " << len;
+    goto err_end;
+  recv_zero_err:
+    ELOG << "rpc server close the connection..";
+    goto err_end;
+  recv_err:
+    ELOG << "rpc recv error: " << _tcp_cli.strerror();
+    goto err_end;
+  send_err:
+    ELOG << "rpc send error: " << _tcp_cli.strerror();
+    goto err_end;
+  bad_res_err:
+    ELOG << "rpc bad response of method: " << method;
+    goto err_end;
+  decompress_err:
+    ELOG << "rpc decompress response failed, flags: " << header.flags;
+    goto err_end;
+  checksum_err:
+    ELOG << "rpc recv error: checksum mismatch, body len: " << len;
+    goto err_end;
+  err_end:
+    _tcp_cli.disconnect();
+    sp.set_status(kNetError);
+    return kNetError;
+}
+
+StreamImpl* ClientImpl::stream(const Json& req) {
+    if (_shm) this->close(); // streams go over tcp
+    if (!_tcp_cli.connected() && !this->connect()) return 0;
+
+    // the open frame: header, window, request
+    _fs.resize(sizeof(Header));
+    const uint32 w = hton32(FLG_rpc_stream_window);
+    _fs.append(&w, sizeof(w));
+    uint16 flags = kStream;
+    if (_mp) {
+        req.msgpack(_fs);
+        flags |= kMsgpack;
+    } else {
+        req.str(_fs);
+        if (FLG_rpc_msgpack) flags |= kAcceptMsgpack;
+    }
+    set_header((void*)_fs.data(), (uint32)(_fs.size() - sizeof(Header)), flags);
+
+    const int r = _tcp_cli.send(_fs.data(), (int)_fs.size(), FLG_rpc_send_timeout);
+    if (unlikely(r <= 0)) {
+        ELOG << "rpc send error: " << _tcp_cli.strerror();
+        _tcp_cli.disconnect();
+        return 0;
+    }
+    RPCLOG << "rpc open stream: " << req;
+    return co::make<StreamImpl>(&_tcp_cli, _mp);
+}
+
+// a call in flight on a MuxConn
+struct MuxCall {
+    MuxCall() : state(0) {}
+    co::Event ev;
+    Json res;
+    int state; // 0: waiting, 1: done, 2: failed
+};
+
+// connection of a scheduler, shared by coroutines in it
+class MuxConn {
+  public:
+    static const size_t kHeaderSize = sizeof(Header) + sizeof(uint32);
+
+    MuxConn(const char* ip, int port, bool use_ssl)
+        : _tcp_cli(ip, port, use_ssl), _rd(_tcp_cli), _id(0),
+          _writing(false), _reading(false), _mp(false), _dl(false), _tr(false) {
+    }
+
+    ~MuxConn() = default;
+
+    void call(const Json& req, Json& res);
+
+    // the reader, if any, closes the connection when it wakes up
+    void close() {
+        this->fail_all();
+        if (!_tcp_cli.connected()) return;
+        if (_reading) {
+            co::shutdown(_tcp_cli.socket());
+        } else {
+            _tcp_cli.disconnect();
+            _rd.clear();
+        }
+    }
+
+  private:
+    tcp::Client _tcp_cli;
+    tcp::Reader _rd;
+    co::Mutex _mtx; // for connecting
+    co::hash_map<uint32, MuxCall*> _calls;
+    fastream _out;  // requests to be sent
+    fastream _wbuf; // requests being sent
+    uint32 _id;
+    bool _writing;
+    bool _reading;
+    bool _mp; // the server replied in MessagePack on this connection
+    bool _dl; // the server supports deadlines
+    bool _tr; // the server supports trace contexts
+
+    bool connect();
+    void flush();
+    void read_loop();
+    void fail_all();
+};
+
+bool MuxConn::connect() {
+    co::MutexGuard g(_mtx);
+    if (_tcp_cli.connected()) return true;
+    _mp = false;
+    _dl = false;
+    _tr = false;
+    _rd.clear();
+    return _tcp_cli.connect(FLG_rpc_conn_timeout);
+}
+
+// wake up all callers with an error, the connection will be closed by the reader
+void MuxConn::fail_all() {
+    for (auto it = _calls.begin(); it != _calls.end(); ++it) {
+        it->second->state = 2;
+        it->second->ev.signal();
+    }
+    _calls.clear();
+}
+
+// only one coroutine sends at a time, requests added by others in the mean
+// time are sent by it in the next round
+void MuxConn::flush() {
+    _writing = true;
+    while (!_out.empty()) {
+        _wbuf.swap(_out);
+        const int r = _tcp_cli.send(_wbuf.data(), (int)_wbuf.size(), FLG_rpc_send_timeout);
+        _wbuf.clear();
+        if (unlikely(r <= 0)) {
+            ELOG << "rpc send error: " << _tcp_cli.strerror();
+            _out.clear();
+            this->fail_all();
+            if (_tcp_cli.connected()) co::shutdown(_tcp_cli.socket());
+            break;
+        }
+    }
+    _writing = false;
+}
+
+void MuxConn::read_loop() {
+    Header header;
+    uint32 id = 0;
+    int r = 0, len = 0;
+    fastring s;
+
+    while (!_calls.empty()) {
+        // wait for a response, calls that timed out have been removed
+        r = _rd.peek(kHeaderSize, FLG_rpc_recv_timeout);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) {
+            if (co::timeout()) continue;
+            goto recv_err;
+        }
+
+        memcpy(&header, _rd.data(), sizeof(header));
+        memcpy(&id, _rd.data() + sizeof(header), sizeof(id));
+        if (unlikely(header.magic != kMagic || !(header.flags & kMux))) goto magic_err;
+
+        len = ntoh32(header.len);
+        if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
+        if (header.flags & kDeadline) _dl = true;
+        if (header.flags & kTrace) _tr = true;
+        _rd.consume(kHeaderSize);
+
+        s.resize(len);
+        r = _rd.read_exact((void*)s.data(), len, FLG_rpc_recv_timeout);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+
+        {
+            auto it = _calls.find(id);
+            if (it == _calls.end()) continue; // the call has timed out
+            MuxCall* const c = it->second;
+            _calls.erase(it);
+
+            if (header.flags & kMsgpack) {
+                c->res = json::parse_msgpack(s.data(), s.size());
+                _mp = FLG_rpc_msgpack;
+            } else {
+                c->res = json::parse(s.data(), s.size());
+            }
+            if (c->res.is_null()) ELOG << "rpc json parse error: " << s;
+            c->state = 1;
+            c->ev.signal();
+        }
+    }
+    _reading = false;
+    return;
+
+  magic_err:
+    ELOG << "rpc recv error: bad magic number: " << header.magic;
+    goto err_end;
+  msg_too_long_err:
+    ELOG << "rpc recv error: body too long: " << len;
+    goto err_end;
+  recv_zero_err:
+    ELOG << "rpc server close the connection..";
+    goto err_end;
+  recv_err:
+    ELOG << "rpc recv error: " << _tcp_cli.strerror();
+    goto err_end;
+  err_end:
+    this->fail_all();
+    _tcp_cli.disconnect();
+    _rd.clear();
+    _reading = false;
+}
+
+void MuxConn::call(const Json& req, Json& res) {
+    res.reset();
+    tracing::Span sp("rpc", tracing::kClient);
+    if (sp.recording()) set_span_name(sp, req);
+    sp.set_status(kNetError); // until a response is received
+    const int ms = call_timeout();
+    if (unlikely(ms <= 0)) {
+        ELOG << "rpc call error: deadline exceeded";
+        return;
+    }
+    if (!_tcp_cli.connected() && !this->connect()) return;
+
+    uint32 id = ++_id;
+    if (id == 0) id = ++_id;
+    MuxCall* const c = co::make<MuxCall>();
+    _calls.insert(std::make_pair(id, c));
+
+    // add the request to the send buffer, the deadline and the trace context
+    // follow the request id
+    const bool dl = _dl && FLG_rpc_deadline;
+    const bool tr = _tr && sp.recording();
+    const size_t h = kHeaderSize + (dl ? sizeof(uint32) : 0) + (tr ? kTraceSize : 0);
+    const size_t o = _out.size();
+    _out.resize(o + h);
+    uint16 flags = kMux | (dl ? kDeadline : 0) | (tr ? kTrace : 0);
+    if (_mp) {
+        req.msgpack(_out);
+        flags |= kMsgpack;
+    } else {
+        req.str(_out);
+        if (FLG_rpc_msgpack) flags |= kAcceptMsgpack;
+    }
+    set_header(_out.data() + o, (uint32)(_out.size() - o - h), flags);
+    const uint32 x = id;
+    memcpy((char*)_out.data() + o + sizeof(Header), &x, sizeof(x));
+    if (dl) {
+        const uint32 t = hton32((uint32)ms);
+        memcpy((char*)_out.data() + o + kHeaderSize, &t, sizeof(t));
+    }
+    if (tr) put_trace((char*)_out.data() + o + h - kTraceSize, sp.context());
+    RPCLOG << "rpc send req: " << req;
+
+    if (!_reading) {
+        _reading = true;
+        co::scheduler()->go([this]() { this->read_loop(); });
+    }
+    if (!_writing) this->flush();
+
+    // the event is not reused, as it may be left signaled
+    c->ev.wait(ms);
+    if (c->state == 0) {
+        _calls.erase(id);
+        ELOG << "rpc recv error: timeout";
+    } else if (c->state == 1) {
+        res = std::move(c->res);
+        sp.set_status(0);
+        RPCLOG << "rpc recv res: " << res;
+    }
+    co::del(c);
+}
+
+class MuxClientImpl {
+  public:
+    MuxClientImpl(const char* ip, int port, bool use_ssl)
+        : _ip(ip), _port(port), _ssl(use_ssl), _conns(co::scheduler_num(), 0) {
+    }
+
+    ~MuxClientImpl() {
+        for (size_t i = 0; i < _conns.size(); ++i) {
+            if (_conns[i]) co::del(_conns[i]);
+        }
+    }
+
+    // the connection of the current scheduler, created on the first call
+    MuxConn* conn() {
+        const int i = co::scheduler_id();
+        CHECK(i >= 0) << "rpc::MuxClient MUST be used in coroutines";
+        MuxConn*& c = _conns[i];
+        if (!c) c = co::make<MuxConn>(_ip.c_str(), _port, _ssl);
+        return c;
+    }
+
+  private:
+    fastring _ip;
+    int _port;
+    bool _ssl;
+    co::vector<MuxConn*> _conns;
+};
+
+MuxClient::MuxClient(const char* ip, int port, bool use_ssl) {
+    _p = co::make<MuxClientImpl>(ip, port, use_ssl);
+}
+
+MuxClient::~MuxClient() {
+    co::del((MuxClientImpl*)_p);
+}
+
+void MuxClient::call(const Json& req, Json& res) {
+    ((MuxClientImpl*)_p)->conn()->call(req, res);
+}
+
+void MuxClient::ping() {
+    Json req({{"api", "ping"}}), res;
+    this->call(req, res);
+}
+
+void MuxClient::close() {
+    ((MuxClientImpl*)_p)->conn()->close();
+}
+
+// an endpoint of a Channel, counters may be updated in any scheduler
+struct Endpoint {
+    Endpoint(const fastring& ip, int port, bool use_ssl)
+        : ip(ip), port(port), inflight(0), failures(0), ejections(0), eject_until(0),
+          pool(
+            [this, use_ssl]() { return (void*) co::make<ClientImpl>(this->ip.c_str(), this->port, use_ssl); },
+            [](void* p) { co::del((ClientImpl*)p); },
+            FLG_rpc_pool_max_idle, FLG_rpc_pool_idle_ms
+          ) {
+    }
+
+    bool ejected(int64 now) const {
+        return atomic_load(&eject_until, mo_relaxed) > now;
+    }
+
+    fastring ip;
+    int port;
+    int32 inflight;    // outstanding requests
+    uint32 failures;   // failed calls in a row
+    uint32 ejections;  // ejections in a row
+    int64 eject_until; // in ms, by co::now_ms()
+    co::Pool pool;     // pool of ClientImpl
+};
+
+// state of a hedged call, shared by the caller and its attempts in a scheduler
+struct HedgedCall {
+    HedgedCall() : deadline(0), trace(), refn(1), started(0), finished(0), done(false) {}
+    co::Event ev;
+    Json req;
+    Json res;
+    int64 deadline; // of the request being served by the caller, 0 if none
+    tracing::context_t trace; // of the current span of the caller, if any
+    int refn;
+    int started;
+    int finished;
+    bool done;
+};
+
+class ChannelImpl {
+  public:
+    ChannelImpl(const char* endpoints, bool use_ssl);
+
+    ~ChannelImpl() {
+        for (size_t i = 0; i < _eps.size(); ++i) co::del(_eps[i]);
+    }
+
+    void call(const Json& req, Json& res, bool hedge);
+
+    size_t size() const { return _eps.size(); }
+
+  private:
+    co::vector<Endpoint*> _eps;
+    co::vector<Random> _rand; // for each scheduler
+
+    // pick an endpoint other than @exclude, -1 if there is none
+    int pick(int exclude);
+
+    // call on the endpoint @i, return false on error or timeout
+    bool call(int i, const Json& req, Json& res);
+    void attempt(HedgedCall* h, int i);
+    void on_failure(Endpoint* e);
+};
+
+ChannelImpl::ChannelImpl(const char* endpoints, bool use_ssl) {
+    const int64 seed = now::us();
+    for (int i = 0; i < co::scheduler_num(); ++i) {
+        _rand.push_back(Random((uint32)(seed + i * 7919)));
+    }
+
+    for (const char* p = endpoints; *p;) {
+        while (*p == ' ' || *p == ',') ++p;
+        if (!*p) break;
+        const char* e = strchr(p, ',');
+        if (!e) e = p + strlen(p);
+        const char* b = p;
+        const char* c = 0;
+        if (*b == '[') { /* [ipv6]:port */
+            const char* x = (const char*) memchr(b, ']', e - b);
+            CHECK(x && x + 1 < e && x[1] == ':') << "rpc channel bad endpoint: " << fastring(p, e - p);
+            c = x + 1;
+            ++b;
+        } else {
+            for (const char* x = e; x > b;) if (*--x == ':') { c = x; break; }
+            CHECK(c) << "rpc channel bad endpoint: " << fastring(p, e - p);
+        }
+        const fastring ip(b, (*p == '[' ? c - 1 : c) - b);
+        const int port = atoi(c + 1);
+        CHECK(0 < port && port < 65536) << "rpc channel bad endpoint: " << fastring(p, e - p);
+        _eps.push_back(co::make<Endpoint>(ip, port, use_ssl));
+        p = e;
+    }
+    CHECK(!_eps.empty()) << "rpc channel without endpoints: " << endpoints;
+}
+
+int ChannelImpl::pick(int exclude) {
+    const int n = (int)_eps.size();
+    if (n == 1) return exclude == 0 ? -1 : 0;
+
+    // two endpoints not ejected, drawn at random. At most half of them are
+    // ejected, so a few draws are enough in general.
+    Random& r = _rand[co::scheduler_id()];
+    const int64 now = co::now_ms();
+    int c[2], k = 0;
+    for (int t = 0; k < 2 && t < n * 2; ++t) {
+        const int x = (int)(r.next() % n);
+        if (x == exclude || (k == 1 && x == c[0]) || _eps[x]->ejected(now)) continue;
+        c[k++] = x;
+    }
+
+    if (k == 2) {
+        const int32 a = atomic_load(&_eps[c[0]]->inflight, mo_relaxed);
+        const int32 b = atomic_load(&_eps[c[1]]->inflight, mo_relaxed);
+        return b < a ? c[1] : c[0];
+    }
+    if (k == 1) return c[0];
+
+    // the rest are all ejected, use one of them anyway
+    const int x = (int)(r.next() % n);
+    return x != exclude ? x : (x + 1) % n;
+}
+
+void ChannelImpl::on_failure(Endpoint* e) {
+    if (atomic_inc(&e->failures, mo_relaxed) < FLG_rpc_eject_failures) return;
+
+    const int64 now = co::now_ms();
+    if (e->ejected(now)) return;
+    size_t m = 0;
+    for (size_t i = 0; i < _eps.size(); ++i) {
+        if (_eps[i]->ejected(now)) ++m;
+    }
+    if ((m + 1) * 2 > _eps.size()) return; // at most half of the endpoints
+
+    atomic_store(&e->failures, 0, mo_relaxed);
+    const uint32 k = atomic_inc(&e->ejections, mo_relaxed);
+    const int64 ms = (int64)FLG_rpc_eject_ms * (k < 8 ? k : 8);
+    atomic_store(&e->eject_until, now + ms, mo_relaxed);
+    WLOG << "rpc channel eject endpoint " << e->ip << ':' << e->port << " for " << ms << " ms";
+}
+
+bool ChannelImpl::call(int i, const Json& req, Json& res) {
+    Endpoint* const e = _eps[i];
+    atomic_inc(&e->inflight, mo_relaxed);
+    ClientImpl* const c = (ClientImpl*) e->pool.pop();
+    const bool ok = c->call(req, res);
+    e->pool.push(c); // it will reconnect on the next call if it was disconnected
+    atomic_dec(&e->inflight, mo_relaxed);
+
+    if (!ok) {
+        this->on_failure(e);
+    } else {
+        if (atomic_load(&e->failures, mo_relaxed)) atomic_store(&e->failures, 0, mo_relaxed);
+        if (atomic_load(&e->ejections, mo_relaxed)) atomic_store(&e->ejections, 0, mo_relaxed);
+    }
+    return ok;
+}
+
+void ChannelImpl::attempt(HedgedCall* h, int i) {
+    if (h->deadline) co::cls_set(deadline_key(), &h->deadline);
+    Json res;
+    bool ok;
+    if (h->trace.valid()) {
+        // the call is traced as a child of the span of the caller
+        tracing::Span sp(&h->trace, "rpc attempt", tracing::kInternal);
+        ok = this->call(i, h->req, res);
+    } else {
+        ok = this->call(i, h->req, res);
+    }
+    ++h->finished;
+    if (ok && !h->done) {
+        h->done = true;
+        h->res = std::move(res);
+    }
+    if (ok || h->finished == h->started) h->ev.signal();
+    if (--h->refn == 0) co::del(h);
+}
+
+void ChannelImpl::call(const Json& req, Json& res, bool hedge) {
+    res.reset();
+    const int i = this->pick(-1);
+    if (!hedge || _eps.size() < 2) {
+        if (!this->call(i, req, res)) res.reset();
+        return;
+    }
+
+    // attempts run in coroutines of this scheduler, the request is copied
+    // as they may not access the stack of the caller
+    HedgedCall* const h = co::make<HedgedCall>();
+    h->req = req.dup();
+    const int64* const d = current_deadline();
+    if (d) h->deadline = *d;
+    const tracing::Span* const sp = tracing::current();
+    if (sp) h->trace = sp->context();
+    auto s = co::scheduler();
+    ++h->refn;
+    ++h->started;
+    s->go([this, h, i]() { this->attempt(h, i); });
+
+    h->ev.wait(FLG_rpc_hedge_ms);
+    if (!h->done) { /* no response yet, or the first endpoint failed */
+        const int j = this->pick(i);
+        if (j >= 0) {
+            ++h->refn;
+            ++h->started;
+            s->go([this, h, j]() { this->attempt(h, j); });
+        }
+        while (!h->done && h->finished < h->started) h->ev.wait();
+    }
+
+    if (h->done) res = std::move(h->res);
+    if (--h->refn == 0) co::del(h);
+}
+
+Channel::Channel(const char* endpoints, bool use_ssl) {
+    _p = co::make<ChannelImpl>(endpoints, use_ssl);
+}
+
+Channel::~Channel() {
+    co::del((ChannelImpl*)_p);
+}
+
+void Channel::call(const Json& req, Json& res, bool hedge) {
+    ((ChannelImpl*)_p)->call(req, res, hedge);
+}
+
+size_t Channel::size() const {
+    return ((ChannelImpl*)_p)->size();
 }
 
 } // rpc
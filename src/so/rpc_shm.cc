@@ -0,0 +1,552 @@
+#include "./rpc_shm.h"
+
+#ifndef __linux__
+namespace rpc {
+namespace shm {
+
+Conn* Conn::create(uint32, uint32) { return 0; }
+Conn* Conn::attach(int, int, int) { return 0; }
+Conn::~Conn() {}
+bool Conn::write(const void*, size_t, const void*, size_t, int) { return false; }
+int Conn::read(int) { return -1; }
+const char* Conn::head() const { return 0; }
+size_t Conn::head_size() const { return 0; }
+const char* Conn::body() const { return 0; }
+size_t Conn::body_size() const { return 0; }
+void Conn::release() {}
+void Conn::close() {}
+uint64 offer(Conn*) { return 0; }
+void withdraw(uint64) {}
+const fastring& addr() { static fastring s; return s; }
+Conn* fetch(const char*, uint64, int) { return 0; }
+bool same_host(sock_t) { return false; }
+bool closed(sock_t) { return true; }
+
+} // shm
+} // rpc
+
+#else
+#include "../co/hook.h"
+#include "co/co.h"
+#include "co/log.h"
+#include "co/atomic.h"
+#include "co/byte_order.h"
+#include "co/random.h"
+#include "co/stl.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+namespace rpc {
+namespace shm {
+
+static const uint32 kMagic = 0x636f7368; // "cosh"
+static const uint32 kVersion = 2;
+static const uint32 kInline = (uint32)-1; // the body follows the head in the ring
+static const uint32 kWrap = (uint32)-1;   // skip to the beginning of the ring
+
+// the first page: the header at 0, controls of the two rings at 1024 and 2048
+struct Conn::hdr_t {
+    uint32 magic;
+    uint32 version;
+    uint32 ring_size;
+    uint32 large_size;
+    uint32 closed; // set by either side
+};
+
+// control of a ring, the producer and the consumer write to different lines
+struct Conn::ctl_t {
+    uint64 tail;       // by the producer
+    char pad0[56];
+    uint64 head;       // by the consumer
+    char pad1[56];
+    uint32 waiting;    // the consumer is going to sleep on its eventfd
+    uint32 large_busy; // the large area holds a message not released yet
+    uint32 full;       // the producer is going to sleep on its eventfd for space
+};
+
+// a message in a ring, aligned to 8 bytes
+struct Conn::rec_t {
+    uint32 size; // bytes of the record with this struct, or kWrap
+    uint32 hn;   // bytes of the head following this struct
+    uint32 n;    // bytes of the body
+    uint32 off;  // offset of the body in the large area, or kInline
+};
+
+inline Conn::hdr_t* Conn::hdr() const { return (hdr_t*)_p; }
+inline Conn::ctl_t* Conn::ctl(int i) const { return (ctl_t*)(_p + 1024 * (i + 1)); }
+inline char* Conn::ring(int i) const { return _p + 4096 + (size_t)_ring_size * i; }
+
+inline char* Conn::large(int i) const {
+    return _p + 4096 + (size_t)_ring_size * 2 + (size_t)_large_size * i;
+}
+
+inline size_t mem_size(uint32 ring_size, uint32 large_size) {
+    return 4096 + (size_t)ring_size * 2 + (size_t)large_size * 2;
+}
+
+Conn::Conn(char* p, size_t n, int mfd, int efd0, int efd1, bool server)
+    : _p(p), _n(n), _mfd(mfd), _w(server ? 1 : 0),
+      _head(0), _body(0), _hn(0), _bn(0), _size(0), _large(false) {
+    _efd[0] = efd0;
+    _efd[1] = efd1;
+    _ring_size = this->hdr()->ring_size;
+    _large_size = this->hdr()->large_size;
+}
+
+Conn::~Conn() {
+    ::munmap(_p, _n);
+    if (_mfd >= 0) __sys_api(close)(_mfd);
+    co::close(_efd[0]);
+    co::close(_efd[1]);
+}
+
+Conn* Conn::create(uint32 ring_size, uint32 max_body_size) {
+  #ifdef SYS_memfd_create
+    uint32 r = 4096;
+    while (r < ring_size && r < (1u << 30)) r <<= 1;
+    const uint32 l = (max_body_size + 4095) & ~4095u;
+    const size_t n = mem_size(r, l);
+
+    const int mfd = (int) ::syscall(SYS_memfd_create, "co_rpc_shm", 1u /* MFD_CLOEXEC */);
+    if (mfd < 0) {
+        ELOG << "rpc shm memfd_create error: " << co::strerror();
+        return 0;
+    }
+    // pages are allocated when they are written
+    void* p = ::ftruncate(mfd, (off_t)n) == 0
+        ? ::mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0) : MAP_FAILED;
+    if (p == MAP_FAILED) {
+        ELOG << "rpc shm map " << n << " bytes error: " << co::strerror();
+        __sys_api(close)(mfd);
+        return 0;
+    }
+    const int e0 = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    const int e1 = e0 >= 0 ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+    if (e1 < 0) {
+        ELOG << "rpc shm eventfd error: " << co::strerror();
+        if (e0 >= 0) __sys_api(close)(e0);
+        ::munmap(p, n);
+        __sys_api(close)(mfd);
+        return 0;
+    }
+
+    hdr_t* const h = (hdr_t*)p;
+    h->magic = kMagic;
+    h->version = kVersion;
+    h->ring_size = r;
+    h->large_size = l;
+    return co::make<Conn>((char*)p, n, mfd, e0, e1, true);
+  #else
+    (void)ring_size; (void)max_body_size;
+    return 0;
+  #endif
+}
+
+Conn* Conn::attach(int mfd, int efd0, int efd1) {
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (::fstat(mfd, &st) == 0 && st.st_size > 4096) {
+        p = ::mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+    }
+    __sys_api(close)(mfd);
+    if (p != MAP_FAILED) {
+        const hdr_t* const h = (const hdr_t*)p;
+        const uint32 r = h->ring_size;
+        if (h->magic == kMagic && h->version == kVersion && r >= 4096 && (r & (r - 1)) == 0 &&
+            mem_size(r, h->large_size) == (size_t)st.st_size) {
+            co::set_nonblock(efd0);
+            co::set_nonblock(efd1);
+            return co::make<Conn>((char*)p, (size_t)st.st_size, -1, efd0, efd1, false);
+        }
+        ::munmap(p, (size_t)st.st_size);
+    }
+    ELOG << "rpc shm invalid memory passed by the server";
+    __sys_api(close)(efd0);
+    __sys_api(close)(efd1);
+    return 0;
+}
+
+bool Conn::write(const void* h, size_t hn, const void* p, size_t n, int ms) {
+    const bool inl = n <= _ring_size / 8;
+    if (!inl && n > _large_size) return false;
+    const uint32 mask = _ring_size - 1;
+    const uint32 size = (uint32)((sizeof(rec_t) + hn + (inl ? n : 0) + 7) & ~(size_t)7);
+    ctl_t* const c = this->ctl(_w);
+    uint64 t = c->tail;
+    const uint32 pos = (uint32)(t & mask);
+    const uint32 wrap = _ring_size - pos < size ? _ring_size - pos : 0;
+
+    // the consumer frees the space, it is rarely full as calls are made one
+    // by one on a connection. The consumer sets head before it checks full,
+    // and we set full before we check head again, see release().
+    auto no_room = [&]() {
+        return _ring_size - (t - atomic_load(&c->head, mo_seq_cst)) < (uint64)wrap + size ||
+               (!inl && atomic_load(&c->large_busy, mo_seq_cst));
+    };
+    const int x = 1 - _w; // our eventfd, the peer writes to it
+    int64 end = 0;
+    while (no_room()) {
+        if (atomic_load(&this->hdr()->closed, mo_acquire)) return false;
+        if (end == 0) end = now::ms() + ms;
+
+        atomic_store(&c->full, 1u, mo_seq_cst);
+        if (!no_room() || atomic_load(&this->hdr()->closed, mo_seq_cst)) {
+            atomic_store(&c->full, 0u, mo_relaxed);
+            continue;
+        }
+        const int64 left = end - now::ms();
+        bool ok = false;
+        if (left > 0) {
+            co::IoEvent ev(_efd[x], co::ev_read);
+            ok = ev.wait((uint32)left);
+        }
+        atomic_store(&c->full, 0u, mo_relaxed);
+        if (!ok) return false;
+        uint64 v;
+        __sys_api(read)(_efd[x], &v, sizeof(v));
+    }
+
+    if (wrap) {
+        ((rec_t*)(this->ring(_w) + pos))->size = kWrap;
+        t += wrap;
+    }
+    rec_t* const r = (rec_t*)(this->ring(_w) + (t & mask));
+    r->size = size;
+    r->hn = (uint32)hn;
+    r->n = (uint32)n;
+    memcpy(r + 1, h, hn);
+    if (inl) {
+        r->off = kInline;
+        memcpy((char*)(r + 1) + hn, p, n);
+    } else {
+        r->off = 0;
+        memcpy(this->large(_w), p, n);
+        c->large_busy = 1;
+    }
+
+    // publish the message, and wake up the consumer if it is going to sleep,
+    // the consumer sets waiting before it checks tail again
+    atomic_store(&c->tail, t + size, mo_seq_cst);
+    if (atomic_load(&c->waiting, mo_seq_cst)) {
+        const uint64 v = 1;
+        __sys_api(write)(_efd[_w], &v, sizeof(v));
+    }
+    return true;
+}
+
+int Conn::read(int ms) {
+    const int x = 1 - _w;
+    const uint32 mask = _ring_size - 1;
+    ctl_t* const c = this->ctl(x);
+    const int64 end = now::ms() + ms;
+
+    while (true) {
+        const uint64 h = c->head;
+        if (atomic_load(&c->tail, mo_acquire) != h) {
+            const uint32 pos = (uint32)(h & mask);
+            rec_t* const p = (rec_t*)(this->ring(x) + pos);
+            rec_t r;
+            r.size = atomic_load(&p->size, mo_relaxed);
+            if (r.size == kWrap) {
+                atomic_store(&c->head, h + (_ring_size - pos), mo_release);
+                continue;
+            }
+
+            // the peer may be buggy or hostile, each field is read once, and
+            // only the copy checked is used then
+            r.hn = atomic_load(&p->hn, mo_relaxed);
+            r.n = atomic_load(&p->n, mo_relaxed);
+            r.off = atomic_load(&p->off, mo_relaxed);
+            if (r.size < sizeof(rec_t) || (r.size & 7) || r.size > _ring_size - pos ||
+                r.hn > r.size - sizeof(rec_t) ||
+                (r.off == kInline ? r.n > r.size - sizeof(rec_t) - r.hn
+                                  : r.off > _large_size || r.n > _large_size - r.off)) {
+                return -2;
+            }
+            _head = (const char*)(p + 1);
+            _large = r.off != kInline;
+            _body = _large ? this->large(x) + r.off : _head + r.hn;
+            _hn = r.hn;
+            _bn = r.n;
+            _size = r.size;
+            return 1;
+        }
+        if (atomic_load(&this->hdr()->closed, mo_acquire)) return 0;
+
+        atomic_store(&c->waiting, 1u, mo_seq_cst);
+        if (atomic_load(&c->tail, mo_seq_cst) != h || atomic_load(&this->hdr()->closed, mo_seq_cst)) {
+            atomic_store(&c->waiting, 0u, mo_relaxed);
+            continue;
+        }
+        const int64 left = end - now::ms();
+        bool ok = false;
+        if (left > 0) {
+            co::IoEvent ev(_efd[x], co::ev_read);
+            ok = ev.wait((uint32)left);
+        }
+        atomic_store(&c->waiting, 0u, mo_relaxed);
+        if (!ok) return -1;
+        uint64 v;
+        __sys_api(read)(_efd[x], &v, sizeof(v));
+    }
+}
+
+const char* Conn::head() const {
+    return _head;
+}
+
+size_t Conn::head_size() const {
+    return _hn;
+}
+
+size_t Conn::body_size() const {
+    return _bn;
+}
+
+const char* Conn::body() const {
+    return _body;
+}
+
+void Conn::release() {
+    ctl_t* const c = this->ctl(1 - _w);
+    if (_large) atomic_store(&c->large_busy, 0u, mo_release);
+    atomic_store(&c->head, c->head + _size, mo_seq_cst);
+    _size = 0;
+
+    // wake up the producer if it is waiting for space, see write()
+    if (atomic_load(&c->full, mo_seq_cst)) {
+        const uint64 v = 1;
+        __sys_api(write)(_efd[_w], &v, sizeof(v));
+    }
+}
+
+void Conn::close() {
+    atomic_store(&this->hdr()->closed, 1u, mo_seq_cst);
+    const uint64 v = 1;
+    __sys_api(write)(_efd[_w], &v, sizeof(v));
+}
+
+// send a message with fds over a unix socket
+inline bool send_fds(int fd, const void* p, size_t n, const int* fds, int k) {
+    struct iovec iov = { (void*)p, n };
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr h;
+        char b[CMSG_SPACE(sizeof(int) * 3)];
+    } c;
+    memset(&c, 0, sizeof(c));
+    m.msg_control = c.b;
+    m.msg_controllen = CMSG_SPACE(sizeof(int) * k);
+    struct cmsghdr* h = CMSG_FIRSTHDR(&m);
+    h->cmsg_level = SOL_SOCKET;
+    h->cmsg_type = SCM_RIGHTS;
+    h->cmsg_len = CMSG_LEN(sizeof(int) * k);
+    memcpy(CMSG_DATA(h), fds, sizeof(int) * k);
+    return __sys_api(sendmsg)(fd, &m, MSG_NOSIGNAL) == (ssize_t)n;
+}
+
+// receive a message with 3 fds over a non-blocking unix socket, false on error
+inline bool recv_fds(int fd, int* fds, int ms) {
+    char x;
+    struct iovec iov = { &x, 1 };
+    struct msghdr m;
+    union {
+        struct cmsghdr h;
+        char b[CMSG_SPACE(sizeof(int) * 3)];
+    } c;
+
+    co::IoEvent ev(fd, co::ev_read);
+    while (true) {
+        memset(&m, 0, sizeof(m));
+        m.msg_iov = &iov;
+        m.msg_iovlen = 1;
+        m.msg_control = c.b;
+        m.msg_controllen = sizeof(c.b);
+        const ssize_t r = __sys_api(recvmsg)(fd, &m, MSG_CMSG_CLOEXEC);
+        if (r > 0) break;
+        if (r == 0) return false;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!ev.wait(ms)) return false;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    struct cmsghdr* h = CMSG_FIRSTHDR(&m);
+    if (!h || h->cmsg_level != SOL_SOCKET || h->cmsg_type != SCM_RIGHTS) return false;
+    const size_t k = (h->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (k != 3) {
+        for (size_t i = 0; i < k; ++i) {
+            int f;
+            memcpy(&f, CMSG_DATA(h) + sizeof(int) * i, sizeof(int));
+            __sys_api(close)(f);
+        }
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(h), sizeof(int) * 3);
+    return true;
+}
+
+// "@name" to an abstract unix address, return its length
+inline int init_addr(struct sockaddr_un* a, const char* s) {
+    const size_t n = strlen(s);
+    if (n < 2 || s[0] != '@' || n > sizeof(a->sun_path)) return 0;
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    memcpy(a->sun_path + 1, s + 1, n - 1);
+    return (int)(offsetof(struct sockaddr_un, sun_path) + n);
+}
+
+// connections offered to clients, and the socket clients get their fds from
+class Offers {
+  public:
+    Offers();
+    ~Offers() = delete;
+
+    bool ok() const { return _fd >= 0; }
+    const fastring& addr() const { return _addr; }
+
+    // the token is all a client needs to map the memory, it must not be guessed
+    uint64 add(Conn* c) {
+        uint64 t = 0;
+        while (t == 0) {
+            if (!co::secure_random_bytes(&t, sizeof(t))) {
+                ELOG << "rpc shm make token error: " << co::strerror();
+                return 0;
+            }
+        }
+        ::MutexGuard g(_mtx);
+        _conns[t] = c;
+        return t;
+    }
+
+    void remove(uint64 t) {
+        ::MutexGuard g(_mtx);
+        _conns.erase(t);
+    }
+
+  private:
+    // a client sends a token, and gets the fds of the connection
+    void serve(sock_t fd);
+
+    sock_t _fd;
+    fastring _addr;
+    ::Mutex _mtx;
+    co::hash_map<uint64, Conn*> _conns;
+};
+
+Offers::Offers() : _fd(-1) {
+    _addr << "@co_rpc_shm." << ::getpid();
+    struct sockaddr_un a;
+    const int n = init_addr(&a, _addr.c_str());
+    sock_t fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || co::bind(fd, &a, n) != 0 || co::listen(fd, 64) != 0) {
+        ELOG << "rpc shm listen on " << _addr << " error: " << co::strerror();
+        if (fd >= 0) co::close(fd);
+        return;
+    }
+    _fd = fd;
+    go([this]() {
+        while (true) {
+            struct sockaddr_un a;
+            int n = sizeof(a);
+            const sock_t c = co::accept(_fd, &a, &n);
+            if (c < 0) {
+                ELOG << "rpc shm accept error: " << co::strerror();
+                co::sleep(100);
+                continue;
+            }
+            go([this, c]() { this->serve(c); });
+        }
+    });
+}
+
+void Offers::serve(sock_t fd) {
+    uint64 t = 0;
+    if (co::recvn(fd, &t, sizeof(t), 1000) == (int)sizeof(t)) {
+        // the connection is alive while the lock is held, see withdraw()
+        ::MutexGuard g(_mtx);
+        auto it = _conns.find(t);
+        if (it != _conns.end()) {
+            const Conn* const c = it->second;
+            const int fds[3] = { c->mfd(), c->efd(0), c->efd(1) };
+            if (!send_fds(fd, "s", 1, fds, 3)) ELOG << "rpc shm send fds error: " << co::strerror();
+            _conns.erase(it);
+        }
+    }
+    co::close(fd);
+}
+
+inline Offers& offers() {
+    static auto o = co::static_new<Offers>();
+    return *o;
+}
+
+uint64 offer(Conn* c) {
+    Offers& o = offers();
+    return o.ok() ? o.add(c) : 0;
+}
+
+void withdraw(uint64 token) {
+    offers().remove(token);
+}
+
+const fastring& addr() {
+    return offers().addr();
+}
+
+Conn* fetch(const char* addr, uint64 token, int ms) {
+    struct sockaddr_un a;
+    const int n = init_addr(&a, addr);
+    if (n == 0) return 0;
+    sock_t fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+
+    int fds[3];
+    const bool ok = co::connect(fd, &a, n, ms) == 0 &&
+                    co::send(fd, &token, sizeof(token), ms) == (int)sizeof(token) &&
+                    recv_fds(fd, fds, ms);
+    if (!ok) ELOG << "rpc shm get fds from " << addr << " error: " << co::strerror();
+    co::close(fd);
+    return ok ? Conn::attach(fds[0], fds[1], fds[2]) : 0;
+}
+
+bool closed(sock_t fd) {
+    char c;
+    const ssize_t r = __sys_api(recv)(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+bool same_host(sock_t fd) {
+    struct sockaddr_storage a, b;
+    socklen_t n = sizeof(a), m = sizeof(b);
+    if (::getsockname(fd, (sockaddr*)&a, &n) != 0 || ::getpeername(fd, (sockaddr*)&b, &m) != 0) {
+        return false;
+    }
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_UNIX) return true;
+    if (a.ss_family == AF_INET) {
+        const uint32 x = ntoh32(((sockaddr_in*)&a)->sin_addr.s_addr);
+        const uint32 y = ntoh32(((sockaddr_in*)&b)->sin_addr.s_addr);
+        return x == y || ((x >> 24) == 127 && (y >> 24) == 127);
+    }
+    if (a.ss_family == AF_INET6) {
+        return memcmp(&((sockaddr_in6*)&a)->sin6_addr, &((sockaddr_in6*)&b)->sin6_addr, 16) == 0;
+    }
+    return false;
+}
+
+} // shm
+} // rpc
+#endif
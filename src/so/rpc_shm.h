@@ -0,0 +1,127 @@
+#pragma once
+
+#include "co/def.h"
+#include "co/fastring.h"
+#include "co/co/sock.h"
+
+namespace rpc {
+namespace shm {
+
+/**
+ * a connection over shared memory between a rpc client and a server on the
+ * same host (linux only, create() and fetch() return NULL elsewhere)
+ *   - The memory (a memfd) holds a ring for each direction, 0 for requests of
+ *     the client, 1 for responses of the server. A ring has one producer and
+ *     one consumer, messages are written and read without any syscall.
+ *   - A body larger than 1/8 of the ring is put in the large area of the
+ *     direction, and only its offset goes in the ring. The large area holds one
+ *     message at a time, as calls on a connection are made one by one.
+ *   - Each side waits on its own eventfd in the epoll of the scheduler, for a
+ *     message or for space in a full ring. The peer writes to it only when
+ *     the side is going to sleep.
+ */
+class Conn {
+  public:
+    // create the memory on the server, NULL on error
+    static Conn* create(uint32 ring_size, uint32 max_body_size);
+
+    // map the memory passed to the client, it owns the fds then, NULL if the
+    // memory is not valid
+    static Conn* attach(int mfd, int efd0, int efd1);
+
+    ~Conn();
+
+    /**
+     * write a message, the head @h of @hn bytes (a rpc header and its fields),
+     * and the body [p, p + n)
+     *   - It waits for the peer to free the space if the ring is full.
+     *
+     * @return  false on timeout, if the peer has closed, or the body is larger
+     *          than max_body_size().
+     */
+    bool write(const void* h, size_t hn, const void* p, size_t n, int ms);
+
+    /**
+     * wait for a message of the peer
+     *   - head() and body() are valid until release() is called, it MUST be
+     *     called before the next read().
+     *
+     * @return  1 if a message is ready, 0 if the peer has closed, -1 on timeout
+     *          or error, -2 if the memory was corrupted.
+     */
+    int read(int ms);
+
+    const char* head() const;
+    size_t head_size() const;
+    const char* body() const;
+    size_t body_size() const;
+    void release();
+
+    // tell the peer the connection was closed
+    void close();
+
+    size_t max_body_size() const { return _large_size; }
+
+    // fds to pass to the client: the memfd and the eventfds of the two sides
+    int mfd() const { return _mfd; }
+    int efd(int i) const { return _efd[i]; }
+
+    // made by create() or attach()
+    Conn(char* p, size_t n, int mfd, int efd0, int efd1, bool server);
+
+  private:
+    struct hdr_t;
+    struct ctl_t;
+    struct rec_t;
+
+    hdr_t* hdr() const;
+    ctl_t* ctl(int i) const;
+    char* ring(int i) const;
+    char* large(int i) const;
+
+    char* _p;       // the mapped memory
+    size_t _n;
+    int _mfd;
+    int _efd[2];
+    int _w;         // the ring we write to, we read the other one
+    uint32 _ring_size;
+    uint32 _large_size;
+
+    // the message being read, its record is copied out of the memory as the
+    // peer may change it after it was checked
+    const char* _head;
+    const char* _body;
+    uint32 _hn;
+    uint32 _bn;
+    uint32 _size;   // bytes of the record in the ring, 0 if no message
+    bool _large;    // the body is in the large area
+
+    DISALLOW_COPY_AND_ASSIGN(Conn);
+};
+
+/**
+ * offer a connection to a client, the client connects to addr() and sends the
+ * token, the fds of the connection are sent back then
+ *
+ * @return  a token, or 0 if the fds can not be passed in this process.
+ */
+uint64 offer(Conn* c);
+
+// withdraw an offer before the connection is deleted, whether the fds were
+// sent or not
+void withdraw(uint64 token);
+
+// name of the abstract unix socket fds are passed through, "@co_rpc_shm.<pid>"
+const fastring& addr();
+
+// get the connection offered by a server at @addr with @token, NULL on error
+Conn* fetch(const char* addr, uint64 token, int ms);
+
+// whether the two ends of a connected socket are on the same host
+bool same_host(sock_t fd);
+
+// whether the peer has closed a connected socket, it does not block
+bool closed(sock_t fd);
+
+} // shm
+} // rpc
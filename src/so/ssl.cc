@@ -4,10 +4,101 @@
 #include "co/log.h"
 #include "co/fastream.h"
 #include "co/thread.h"
+#include "co/flag.h"
+#include "co/stl.h"
+#include "co/time.h"
+#include "co/defer.h"
+#include "co/metrics.h"
+#include <mutex>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+// kTLS is supported by openssl 3.0+, if it was built with it
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+#define CO_SSL_KTLS
+#endif
+
+DEF_uint32(ssl_session_cache_size, 20480, ">>#2 max sessions cached by a ssl server, 0 to disable the cache");
+DEF_uint32(ssl_session_timeout, 7200, ">>#2 lifetime of ssl sessions in seconds");
+DEF_uint32(ssl_ticket_key_rotation, 3600, ">>#2 keys of session tickets are rotated in this interval "
+    "in seconds, and a key is accepted for two intervals, 0 to disable session tickets");
+DEF_uint32(ssl_client_session_cache_size, 1024, ">>#2 max sessions cached by ssl clients, by ip:port, "
+    "0 to disable session reuse of clients");
+DEF_bool(ssl_release_buffers, true, ">>#2 free the read and write buffers of a ssl connection when they are empty, "
+    "so that an idle connection holds no buffers");
+DEF_bool(ssl_co_alloc, true, ">>#2 allocate memory of openssl by co::alloc(), so that it is counted in co_ssl_mem_bytes, "
+    "it takes effect only if it is set before openssl allocates any memory");
+DEF_gauge(co_ssl_connections, "ssl connections alive, made by ssl::new_ssl()");
 
 namespace ssl {
+namespace xx {
+
+// bytes allocated and freed by openssl, with ssl_co_alloc
+static metrics::Counter* g_alloc_bytes;
+static metrics::Counter* g_free_bytes;
+
+inline int64 mem_bytes() {
+    return (int64)(g_alloc_bytes->value() - g_free_bytes->value());
+}
+
+// co::free() needs the size, it is stored in a header of 16 bytes before the
+// memory, which keeps the memory aligned to 16 bytes.
+static void* mem_alloc(size_t n, const char*, int) {
+    char* const x = (char*) co::alloc(n + 16);
+    if (!x) return 0;
+    *(size_t*)x = n;
+    g_alloc_bytes->inc(n);
+    return x + 16;
+}
+
+static void mem_free(void* p, const char*, int) {
+    if (p) {
+        char* const x = (char*)p - 16;
+        const size_t n = *(size_t*)x;
+        g_free_bytes->inc(n);
+        co::free(x, n + 16);
+    }
+}
+
+// memory is not shrunk, the size in the header is kept for co::free()
+static void* mem_realloc(void* p, size_t n, const char* file, int line) {
+    if (!p) return mem_alloc(n, file, line);
+    if (n == 0) { mem_free(p, file, line); return 0; }
+    char* x = (char*)p - 16;
+    const size_t o = *(size_t*)x;
+    if (n <= o) return p;
+    x = (char*) co::realloc(x, o + 16, n + 16);
+    if (!x) return 0;
+    *(size_t*)x = n;
+    g_alloc_bytes->inc(n - o);
+    return x + 16;
+}
+
+// called before openssl is initialized, openssl refuses to change the memory 
+// functions once it has allocated any memory.
+static void init_mem() {
+    g_alloc_bytes = co::static_new<metrics::Counter>();
+    g_free_bytes = co::static_new<metrics::Counter>();
+    if (FLG_ssl_co_alloc && !CRYPTO_set_mem_functions(mem_alloc, mem_realloc, mem_free)) {
+        WLOG << "ssl_co_alloc ignored, openssl has allocated memory before";
+    }
+    metrics::gauge("co_ssl_mem_bytes", "bytes allocated by openssl and not freed, with ssl_co_alloc", []() {
+        return (double) mem_bytes();
+    });
+    metrics::gauge("co_ssl_conn_mem_bytes", "co_ssl_mem_bytes per ssl connection, memory of contexts and "
+        "sessions is included", []() {
+        const int64 n = MET_co_ssl_connections.value();
+        return n > 0 ? (double) mem_bytes() / n : 0.0;
+    });
+}
+
+} // xx
 
 static int errcb(const char* p, size_t n, void* u) {
     fastream* s = (fastream*) u;
@@ -36,13 +127,16 @@ const char* strerror(S* s) {
 
 C* new_ctx(char c) {
     static bool x = []() {
+        xx::init_mem();
         (void) SSL_library_init();
         OpenSSL_add_all_algorithms();
         SSL_load_error_strings();
         return true;
     }();
     (void)x;
-    return (C*) SSL_CTX_new(c == 's' ? TLS_server_method(): TLS_client_method());
+    SSL_CTX* const ctx = SSL_CTX_new(c == 's' ? TLS_server_method(): TLS_client_method());
+    if (ctx && FLG_ssl_release_buffers) SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+    return (C*) ctx;
 }
 
 void free_ctx(C* c) {
@@ -50,11 +144,16 @@ void free_ctx(C* c) {
 }
 
 void* new_ssl(C* c) {
-    return (void*) SSL_new((SSL_CTX*)c);
+    SSL* const s = SSL_new((SSL_CTX*)c);
+    if (s) MET_co_ssl_connections.add(1);
+    return (void*) s;
 }
 
 void free_ssl(S* s) {
-    SSL_free((SSL*)s);
+    if (s) {
+        SSL_free((SSL*)s);
+        MET_co_ssl_connections.sub(1);
+    }
 }
 
 int set_fd(S* s, int fd) {
@@ -77,6 +176,305 @@ int check_private_key(const C* c) {
     return SSL_CTX_check_private_key((const SSL_CTX*)c);
 }
 
+static int alpn_cb(
+    SSL*, const unsigned char** out, unsigned char* outlen,
+    const unsigned char* in, unsigned int inlen, void* arg) {
+    const char* protos = (const char*) arg;
+    const int r = SSL_select_next_proto(
+        (unsigned char**)out, outlen,
+        (const unsigned char*)protos, (unsigned int)strlen(protos), in, inlen
+    );
+    return r == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+}
+
+int set_alpn_protos(C* c, const char* protos) {
+    if (!protos || !*protos) return 0;
+    SSL_CTX_set_alpn_select_cb((SSL_CTX*)c, alpn_cb, (void*)protos);
+    return 1;
+}
+
+// keys of session tickets, shared by all server contexts. A new key is made
+// every FLG_ssl_ticket_key_rotation seconds, and tickets of the previous key
+// are still accepted, with new tickets issued.
+class TicketKeys {
+  public:
+    struct Key {
+        unsigned char name[16];
+        unsigned char aes[32];
+        unsigned char hmac[32];
+    };
+
+    TicketKeys() : _t(0), _n(0) {}
+
+    // the current key for new tickets
+    bool current(Key& k) {
+        std::lock_guard<std::mutex> g(_m);
+        if (!this->rotate()) return false;
+        k = _k[0];
+        return true;
+    }
+
+    // find the key by name, 1 for the current key, 2 for the previous one, 0 if not found
+    int find(const unsigned char* name, Key& k) {
+        std::lock_guard<std::mutex> g(_m);
+        if (!this->rotate()) return 0;
+        for (int i = 0; i < _n; ++i) {
+            if (memcmp(_k[i].name, name, 16) == 0) {
+                k = _k[i];
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+  private:
+    bool rotate() {
+        const int64 now = now::ms();
+        const int64 t = (int64)FLG_ssl_ticket_key_rotation * 1000;
+        if (_n > 0 && now - _t < t) return true;
+        Key k;
+        if (RAND_bytes((unsigned char*)&k, sizeof(k)) != 1) return _n > 0;
+        // the previous key is dropped too if it is out of date
+        _k[1] = _k[0];
+        _k[0] = k;
+        _n = (_n > 0 && now - _t < t * 2) ? 2 : 1;
+        _t = now;
+        return true;
+    }
+
+    std::mutex _m;
+    Key _k[2];
+    int64 _t; // when the current key was made
+    int _n;
+};
+
+inline TicketKeys& ticket_keys() {
+    static auto k = co::static_new<TicketKeys>();
+    return *k;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_key_cb(
+    SSL*, unsigned char* name, unsigned char* iv,
+    EVP_CIPHER_CTX* ctx, EVP_MAC_CTX* hctx, int enc) {
+#else
+static int ticket_key_cb(
+    SSL*, unsigned char* name, unsigned char* iv,
+    EVP_CIPHER_CTX* ctx, HMAC_CTX* hctx, int enc) {
+#endif
+    TicketKeys::Key k;
+    int r = 1;
+    if (enc) {
+        if (!ticket_keys().current(k)) return -1;
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) return -1;
+        memcpy(name, k.name, 16);
+        if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, k.aes, iv) != 1) return -1;
+    } else {
+        if ((r = ticket_keys().find(name, k)) == 0) return 0; // full handshake
+        if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, k.aes, iv) != 1) return -1;
+    }
+
+  #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, k.hmac, sizeof(k.hmac));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"sha256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    if (EVP_MAC_CTX_set_params(hctx, params) != 1) return -1;
+  #else
+    if (HMAC_Init_ex(hctx, k.hmac, sizeof(k.hmac), EVP_sha256(), NULL) != 1) return -1;
+  #endif
+    return r; // 2: the ticket is ok, but a new one should be issued
+}
+
+int enable_session_cache(C* c) {
+    SSL_CTX* x = (SSL_CTX*)c;
+    static const unsigned char kId[] = "co";
+    if (SSL_CTX_set_session_id_context(x, kId, sizeof(kId) - 1) != 1) return 0;
+
+    if (FLG_ssl_session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(x, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(x, FLG_ssl_session_cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(x, SSL_SESS_CACHE_OFF);
+    }
+    SSL_CTX_set_timeout(x, FLG_ssl_session_timeout);
+
+    if (FLG_ssl_ticket_key_rotation > 0) {
+      #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_num_tickets(x, 1); // clients keep only the last one
+      #endif
+      #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        if (SSL_CTX_set_tlsext_ticket_key_evp_cb(x, ticket_key_cb) != 1) return 0;
+      #else
+        if (SSL_CTX_set_tlsext_ticket_key_cb(x, ticket_key_cb) != 1) return 0;
+      #endif
+    } else {
+        SSL_CTX_set_options(x, SSL_OP_NO_TICKET);
+    }
+    return 1;
+}
+
+// sessions of clients by ip:port. The cache keeps its own copies, so that a
+// session is not made unresumable by a connection closed without shutdown.
+class ClientSessions {
+  public:
+    ClientSessions() = default;
+    ~ClientSessions() = delete;
+
+    void add(const char* key, SSL_SESSION* s) {
+      #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        if (!SSL_SESSION_is_resumable(s)) return;
+      #endif
+        SSL_SESSION* x = dup(s);
+        if (!x) return;
+        std::lock_guard<std::mutex> g(_m);
+        auto it = _map.find(key);
+        if (it == _map.end()) {
+            if (_map.size() >= FLG_ssl_client_session_cache_size) {
+                SSL_SESSION_free(_map.begin()->second);
+                _map.erase(_map.begin());
+            }
+            _map.emplace(fastring(key), x);
+        } else {
+            SSL_SESSION_free(it->second);
+            it->second = x;
+        }
+    }
+
+    // a copy of the session for ip:port, NULL if not found or expired
+    SSL_SESSION* get(const char* key) {
+        std::lock_guard<std::mutex> g(_m);
+        auto it = _map.find(key);
+        if (it == _map.end()) return 0;
+        SSL_SESSION* s = it->second;
+        const int64 t = (int64)SSL_SESSION_get_time(s) + (int64)SSL_SESSION_get_timeout(s);
+        if (t <= (int64)time(0)) {
+            SSL_SESSION_free(s);
+            _map.erase(it);
+            return 0;
+        }
+        return dup(s);
+    }
+
+  private:
+    static SSL_SESSION* dup(SSL_SESSION* s) {
+      #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        return SSL_SESSION_dup(s);
+      #else
+        SSL_SESSION_up_ref(s);
+        return s;
+      #endif
+    }
+
+    std::mutex _m;
+    co::hash_map<fastring, SSL_SESSION*> _map;
+};
+
+inline ClientSessions& client_sessions() {
+    static auto s = co::static_new<ClientSessions>();
+    return *s;
+}
+
+// index of ip:port in ex data of SSL
+static int session_key_index() {
+    static int i = SSL_get_ex_new_index(0, 0, 0, 0,
+        [](void*, void* p, CRYPTO_EX_DATA*, int, long, void*) {
+            if (p) ::free(p);
+        }
+    );
+    return i;
+}
+
+// a session ticket arrived, it may come with the handshake (TLS 1.2) or after it (TLS 1.3)
+static int new_session_cb(SSL* s, SSL_SESSION* sess) {
+    const char* key = (const char*) SSL_get_ex_data(s, session_key_index());
+    if (key) client_sessions().add(key, sess);
+    return 0; // the session is not kept by us
+}
+
+C* shared_client_ctx() {
+    static SSL_CTX* c = []() {
+        SSL_CTX* x = (SSL_CTX*) new_ctx('c');
+        if (x) {
+            SSL_CTX_set_session_cache_mode(x, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(x, new_session_cb);
+        }
+        return x;
+    }();
+    if (c) SSL_CTX_up_ref(c);
+    return (C*)c;
+}
+
+int set_session(S* s, const char* key) {
+    if (FLG_ssl_client_session_cache_size == 0 || !key || !*key) return 0;
+    const int i = session_key_index();
+    if (i < 0) return 0;
+    if (SSL_get_ex_data((SSL*)s, i) == 0) {
+        const size_t n = strlen(key) + 1;
+        char* p = (char*) ::malloc(n);
+        memcpy(p, key, n);
+        if (SSL_set_ex_data((SSL*)s, i, p) != 1) { ::free(p); return 0; }
+    }
+
+    SSL_SESSION* x = client_sessions().get(key);
+    if (!x) return 0;
+    const int r = SSL_set_session((SSL*)s, x);
+    SSL_SESSION_free(x);
+    return r == 1 ? 1 : 0;
+}
+
+bool session_reused(const S* s) {
+    return SSL_session_reused((SSL*)s) == 1;
+}
+
+int enable_ktls(C* c) {
+  #ifdef CO_SSL_KTLS
+    SSL_CTX_set_options((SSL_CTX*)c, SSL_OP_ENABLE_KTLS);
+    return 1;
+  #else
+    (void)c;
+    return 0;
+  #endif
+}
+
+bool ktls_send(const S* s) {
+  #ifdef CO_SSL_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio((const SSL*)s));
+  #else
+    (void)s;
+    return false;
+  #endif
+}
+
+int64 sendfile(S* s, int fd, int64 off, int64 n, int ms) {
+  #ifdef CO_SSL_KTLS
+    CHECK(co::scheduler()) << "must be called in coroutine..";
+    const int sock = SSL_get_fd((SSL*)s);
+    if (sock < 0 || !BIO_get_ktls_send(SSL_get_wbio((SSL*)s))) return -1;
+
+    for (int64 remain = n; remain > 0;) {
+        ERR_clear_error();
+        const ossl_ssize_t r = SSL_sendfile((SSL*)s, fd, (off_t)off, (size_t)remain, 0);
+        if (r > 0) {
+            off += r;
+            remain -= r;
+            continue;
+        }
+        const int e = SSL_get_error((SSL*)s, (int)r);
+        if (e == SSL_ERROR_WANT_WRITE) {
+            co::IoEvent ev(sock, co::ev_write);
+            if (!ev.wait(ms)) return -1;
+        } else {
+            return r < 0 ? r : -1;
+        }
+    }
+    return n;
+  #else
+    (void)s; (void)fd; (void)off; (void)n; (void)ms;
+    return -1;
+  #endif
+}
+
 int shutdown(S* s, int ms) {
     CHECK(co::scheduler()) << "must be called in coroutine..";
     int r, e;
@@ -112,22 +510,38 @@ int shutdown(S* s, int ms) {
     } while (true);
 }
 
-int accept(S* s, int ms) {
+int accept(S* s, int ms, bool offload) {
     CHECK(co::scheduler()) << "must be called in coroutine..";
     int r, e;
     int fd = SSL_get_fd((SSL*)s);
     if (fd < 0) return -1;
 
+    // results of the thread pool, not on the stack which may be shared by other coroutines
+    int* const re = offload ? (int*) co::alloc(sizeof(int) * 2) : 0;
+    defer(if (re) co::free(re, sizeof(int) * 2));
+
     do {
-        ERR_clear_error();
-        r = SSL_accept((SSL*)s);
+        if (offload) {
+            // the error queue belongs to the thread of the pool, take the error code only
+            co::offload([s, re]() {
+                ERR_clear_error();
+                re[0] = SSL_accept((SSL*)s);
+                re[1] = re[0] < 0 ? SSL_get_error((SSL*)s, re[0]) : 0;
+                ERR_clear_error();
+            });
+            r = re[0];
+            e = re[1];
+        } else {
+            ERR_clear_error();
+            r = SSL_accept((SSL*)s);
+        }
         if (r == 1) return 1; // success
         if (r == 0) {
             //DLOG << "SSL_accept return 0, error: " << SSL_get_error(s, 0);
             return 0; // ssl connection shut down
         }
 
-        e = SSL_get_error((SSL*)s, r);
+        if (!offload) e = SSL_get_error((SSL*)s, r);
         if (e == SSL_ERROR_WANT_READ) {
             co::IoEvent ev(fd, co::ev_read);
             if (!ev.wait(ms)) return -1;
@@ -302,8 +716,16 @@ int get_fd(const S*) { return 0; }
 int use_private_key_file(C*, const char*) { return 0; }
 int use_certificate_file(C*, const char*) { return 0; }
 int check_private_key(const C*) { return 0; }
+int set_alpn_protos(C*, const char*) { return 0; }
+int enable_session_cache(C*) { return 0; }
+C* shared_client_ctx() { return new_ctx('c'); }
+int set_session(S*, const char*) { return 0; }
+bool session_reused(const S*) { return false; }
+int enable_ktls(C*) { return 0; }
+bool ktls_send(const S*) { return false; }
+int64 sendfile(S*, int, int64, int64, int) { return -1; }
 int shutdown(S*, int) { return 0; }
-int accept(S*, int) { return 0; }
+int accept(S*, int, bool) { return 0; }
 int connect(S*, int) { return 0; }
 int recv(S*, void*, int, int) { return 0; }
 int recvn(S*, void*, int, int) { return 0; }
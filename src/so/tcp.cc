@@ -1,16 +1,76 @@
 #include "co/co.h"
+#include "co/fs.h"
 #include "co/god.h"
 #include "co/mem.h"
 #include "co/tcp.h"
 #include "co/ssl.h"
+#include "co/dns.h"
 #include "co/log.h"
 #include "co/str.h"
+#include "co/thread.h"
 #include "co/time.h"
+#include "co/iobuf.h"
+#include "co/metrics.h"
+#include "co/prefork.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/un.h>
+#include <poll.h>
+#endif
 
 DEF_int32(ssl_handshake_timeout, 3000, ">>#2 ssl handshake timeout in ms");
+DEF_uint32(ssl_handshake_concurrency, 0, ">>#2 max ssl handshakes in progress for a tcp::Server, "
+    "others wait in order up to ssl_handshake_timeout, 0 for no limit");
+DEF_bool(ssl_handshake_offload, false, ">>#2 run ssl handshakes of tcp::Server in the thread pool of "
+    "co::offload(), so that they do not delay requests served by the schedulers");
+DEF_bool(ssl_ktls, false, ">>#2 offload TLS records of tcp::Server to the kernel (kTLS) if supported, "
+    "so that files are sent by sendfile() on ssl connections");
+DEF_uint32(tcp_max_conn, 0, ">>#2 max connections of a tcp::Server, new ones beyond it are rejected, 0 for no limit");
+DEF_uint32(tcp_accept_rate, 0, ">>#2 max connections a tcp::Server accepts per second, others wait in "
+    "the backlog, 0 for no limit");
+DEF_uint32(tcp_buf_pool_size, 256, ">>#2 max idle receive buffers of tcp::Reader cached in each scheduler, "
+    "connections hold one only while a read is in progress");
+DEF_uint32(tcp_accept_ex_num, 16, ">>#2 AcceptEx operations kept posted on the listener of tcp::Server "
+    "by as many accept coroutines, windows only");
+DEF_bool(tcp_reuse_port, false, ">>#2 if true, tcp::Server listens with SO_REUSEPORT in every scheduler, "
+    "and connections are served in the scheduler that accepted them");
+DEF_bool(tcp_incoming_cpu, false, ">>#2 if true, tcp::Server serves a connection in the scheduler bound to "
+    "the cpu that received its packets (SO_INCOMING_CPU), schedulers are bound by co_sched_cpus, linux only");
+DEF_bool(tcp_fastopen, false, ">>#2 enable TCP Fast Open on tcp::Server and tcp::Client if the OS supports it, "
+    "the first data is sent in the SYN on reconnects");
+DEF_uint32(tcp_warm_conn, 0, ">>#2 connected sockets kept in each scheduler for every destination of "
+    "tcp::Client, refilled in the background as they are taken, 0 to disable, not on windows");
+
+DEF_counter(co_tcp_accepted_total, "connections accepted by tcp::Server");
+DEF_counter(co_tcp_rejected_total, "connections rejected by tcp::Server, see limit() and on_admit()");
 
 namespace tcp {
 
+// "unix:/path" or "unix:@name" is the address of a unix domain socket
+inline bool is_unix_addr(const char* s) {
+    return strncmp(s, "unix:", 5) == 0;
+}
+
+#ifndef _WIN32
+// "@name" is in the abstract namespace of linux, return length of the address,
+// or 0 if the path is empty or too long.
+inline int init_unix_addr(struct sockaddr_un* addr, const char* s) {
+    const char* const path = s + 5;
+    const size_t n = strlen(path);
+    if (n == 0 || n >= sizeof(addr->sun_path)) return 0;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, n);
+    if (*path != '@') return (int)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+    addr->sun_path[0] = '\0';
+    return (int)(offsetof(struct sockaddr_un, sun_path) + n);
+}
+#endif
+
 class Conn {
   public:
     Conn() = default;
@@ -19,12 +79,17 @@ class Conn {
     virtual int recv(void* buf, int n, int ms) = 0;
     virtual int recvn(void* buf, int n, int ms) = 0;
     virtual int send(const void* buf, int n, int ms) = 0;
+    virtual int64 sendfile(fs::file& f, int64 off, int64 n, int ms) = 0;
+    virtual int64 sendv(co::iov_t* iov, int n, int ms) = 0;
 
     virtual int close(int ms) = 0;
     virtual int reset(int ms) = 0;
 
     virtual int socket() = 0;
     virtual const char* strerror() = 0;
+
+    // wait until there is data to read, 1 if it is ready, -1 on timeout or error
+    virtual int wait(int ms) = 0;
 };
 
 class TcpConn : public Conn {
@@ -44,6 +109,14 @@ class TcpConn : public Conn {
         return co::send(_sock, buf, n, ms);
     }
 
+    virtual int64 sendfile(fs::file& f, int64 off, int64 n, int ms) {
+        return co::sendfile(_sock, f.fd(), off, n, ms);
+    }
+
+    virtual int64 sendv(co::iov_t* iov, int n, int ms) {
+        return co::sendv(_sock, iov, n, ms);
+    }
+
     virtual int close(int ms) {
         const int sock = god::swap(&_sock, -1);
         return sock != -1 ? co::close(sock, ms) : 0;
@@ -62,13 +135,22 @@ class TcpConn : public Conn {
         return co::strerror();
     }
 
+    virtual int wait(int ms) {
+      #ifdef _WIN32
+        return 1; // IoEvent of windows reads with a buffer, just recv
+      #else
+        co::IoEvent ev(_sock, co::ev_read);
+        return ev.wait(ms) ? 1 : -1;
+      #endif
+    }
+
   private:
     int _sock;
 };
 
 class SSLConn : public Conn {
   public:
-    SSLConn(ssl::S* s) : _s(s) {}
+    SSLConn(ssl::S* s) : _s(s), _ktls(ssl::ktls_send(s)) {}
     virtual ~SSLConn() { this->close(0); }
 
     virtual int recv(void* buf, int n, int ms) {
@@ -83,6 +165,40 @@ class SSLConn : public Conn {
         return ssl::send(_s, buf, n, ms);
     }
 
+    // without kTLS, data must be encrypted in the user space, just read and send it
+    virtual int64 sendfile(fs::file& f, int64 off, int64 n, int ms) {
+        if (_ktls) return ssl::sendfile(_s, f.fd(), off, n, ms);
+        const size_t cap = n < 64 * 1024 ? (size_t)n : 64 * 1024;
+        fastring buf(cap);
+        f.seek(off);
+        for (int64 remain = n; remain > 0;) {
+            const size_t k = f.read((void*)buf.data(), remain < (int64)cap ? (size_t)remain : cap);
+            if (k == 0) return -1;
+            const int r = ssl::send(_s, buf.data(), (int)k, ms);
+            if (r <= 0) return r;
+            remain -= k;
+        }
+        return n;
+    }
+
+    virtual int64 sendv(co::iov_t* iov, int n, int ms) {
+        // records are made by the kernel, write to the socket in one call
+        if (_ktls) return co::sendv(ssl::get_fd(_s), iov, n, ms);
+        int64 total = 0;
+        for (int i = 0; i < n; ++i) {
+          #ifdef _WIN32
+            const char* p = iov[i].buf; const int k = (int)iov[i].len;
+          #else
+            const char* p = (const char*)iov[i].iov_base; const int k = (int)iov[i].iov_len;
+          #endif
+            if (k == 0) continue;
+            const int r = ssl::send(_s, p, k, ms);
+            if (r <= 0) return r;
+            total += k;
+        }
+        return total;
+    }
+
     virtual int close(int ms) {
         ssl::S* s = god::swap(&_s, nullptr);
         if (s) {
@@ -112,8 +228,14 @@ class SSLConn : public Conn {
         return ssl::strerror(_s);
     }
 
+    // decrypted data may be pending in the ssl, just recv
+    virtual int wait(int) {
+        return 1;
+    }
+
   private:
     ssl::S* _s;
+    bool _ktls; // records are sent by kTLS
 };
 
 Connection::Connection(int sock) {
@@ -140,6 +262,25 @@ int Connection::send(const void* buf, int n, int ms) {
     return ((Conn*)_p)->send(buf, n, ms);
 }
 
+int64 Connection::sendfile(fs::file& f, int64 off, int64 n, int ms) {
+    return ((Conn*)_p)->sendfile(f, off, n, ms);
+}
+
+int64 Connection::sendv(co::iov_t* iov, int n, int ms) {
+    return ((Conn*)_p)->sendv(iov, n, ms);
+}
+
+int64 Connection::send(const co::iobuf& b, int ms) {
+    co::iov_t iov[64];
+    for (uint32 i = 0; i < b.ref_num();) {
+        const int n = b.to_iov(iov, 64, i);
+        const int64 r = ((Conn*)_p)->sendv(iov, n, ms);
+        if (r <= 0) return r;
+        i += n;
+    }
+    return (int64)b.size();
+}
+
 int Connection::close(int ms) {
     Conn* p = (Conn*) god::swap(&_p, nullptr);
     if (p) {
@@ -164,16 +305,182 @@ const char* Connection::strerror() const {
     return ((Conn*)_p)->strerror();
 }
 
+static const size_t kBufSize = 4096;
+
+// idle receive buffers of a scheduler, only used in the scheduler thread
+class BufPool {
+  public:
+    BufPool() = default;
+    ~BufPool() {
+        for (size_t i = 0; i < _v.size(); ++i) co::free(_v[i], kBufSize);
+    }
+
+    char* pop() {
+        if (_v.empty()) return (char*) co::alloc(kBufSize);
+        return _v.pop_back();
+    }
+
+    void push(char* p) {
+        if (_v.size() < FLG_tcp_buf_pool_size) return _v.push_back(p);
+        co::free(p, kBufSize);
+    }
+
+  private:
+    co::array<char*> _v;
+};
+
+// null if it is not called in a scheduler
+inline BufPool* buf_pool() {
+    static auto v = co::static_new<co::vector<BufPool>>(co::scheduler_num());
+    const int i = co::scheduler_id();
+    return i >= 0 ? &(*v)[i] : 0;
+}
+
+Reader::Reader(Connection& conn, uint32 cap)
+    : _conn(&conn), _cli(0), _buf(0), _cap(cap > 0 ? cap : kBufSize), _init_cap(_cap),
+      _beg(0), _end(0), _scan(0) {
+}
+
+Reader::Reader(Client& cli, uint32 cap)
+    : _conn(0), _cli(&cli), _buf(0), _cap(cap > 0 ? cap : kBufSize), _init_cap(_cap),
+      _beg(0), _end(0), _scan(0) {
+}
+
+Reader::Reader(Connection& conn, Reader&& r)
+    : _conn(&conn), _cli(0), _buf(r._buf), _cap(r._cap), _init_cap(r._init_cap),
+      _beg(r._beg), _end(r._end), _scan(r._scan) {
+    r._buf = 0;
+    r._cap = r._beg = r._end = r._scan = 0;
+}
+
+Reader::~Reader() {
+    if (_buf) this->_free();
+}
+
+inline void Reader::_alloc() {
+    BufPool* const p = _cap == kBufSize ? buf_pool() : 0;
+    _buf = p ? p->pop() : (char*) co::alloc(_cap);
+}
+
+inline void Reader::_free() {
+    BufPool* const p = _cap == kBufSize ? buf_pool() : 0;
+    p ? p->push(_buf) : co::free(_buf, _cap);
+    _buf = 0;
+}
+
+void Reader::release() {
+    if (_buf && this->empty()) {
+        this->_free();
+        _cap = _init_cap;
+        _beg = _end = _scan = 0;
+    }
+}
+
+inline int Reader::_recv(void* buf, int n, int ms) {
+    return _conn ? _conn->recv(buf, n, ms) : _cli->recv(buf, n, ms);
+}
+
+inline int Reader::_recvn(void* buf, int n, int ms) {
+    return _conn ? _conn->recvn(buf, n, ms) : _cli->recvn(buf, n, ms);
+}
+
+void Reader::consume(size_t n) {
+    if (n >= this->size()) {
+        _beg = _end = _scan = 0;
+    } else {
+        _beg += n;
+        _scan = _scan > n ? _scan - n : 0;
+    }
+}
+
+int Reader::fill(int ms) {
+    if (!_buf) {
+        // wait for data without a buffer, idle connections do not hold one
+        if (_conn && ((Conn*)_conn->_p)->wait(ms) < 0) return -1;
+        this->_alloc();
+    }
+
+    if (_end == _cap) {
+        const size_t n = this->size();
+        if (_beg > 0 && n <= (_cap >> 1)) {
+            memmove(_buf, _buf + _beg, n);
+        } else {
+            _buf = (char*) co::realloc(_buf, _cap, _cap << 1);
+            _cap <<= 1;
+            if (_beg > 0) memmove(_buf, _buf + _beg, n);
+        }
+        _beg = 0;
+        _end = n;
+    }
+
+    const int r = this->_recv(_buf + _end, (int)(_cap - _end), ms);
+    if (r > 0) _end += r;
+    return r;
+}
+
+int Reader::peek(size_t n, int ms) {
+    while (this->size() < n) {
+        const int r = this->fill(ms);
+        if (r <= 0) return r;
+    }
+    return (int)n;
+}
+
+int Reader::read_until(const char* delim, size_t max, int ms) {
+    const size_t m = strlen(delim);
+    for (;;) {
+        const size_t n = this->size();
+        if (n >= m) {
+            const char* const b = this->data();
+            const char* const p = fast::memmem(b + _scan, n - _scan, delim, m);
+            if (p) {
+                _scan = 0;
+                return (int)(p - b + m);
+            }
+            _scan = n - m + 1;
+        }
+        if (n >= max) return -2;
+
+        const int r = this->fill(ms);
+        if (r <= 0) return r;
+    }
+}
+
+int Reader::read_exact(void* buf, size_t n, int ms) {
+    const size_t k = this->size() < n ? this->size() : n;
+    if (k > 0) {
+        memcpy(buf, this->data(), k);
+        this->consume(k);
+    }
+    if (k == n) return (int)n;
+
+    // recv the rest directly into buf if it is large, no copy
+    char* const p = (char*)buf + k;
+    const size_t x = n - k;
+    if (x >= (_cap >> 1)) {
+        const int r = this->_recvn(p, (int)x, ms);
+        return r > 0 ? (int)n : r;
+    }
+
+    const int r = this->peek(x, ms);
+    if (r <= 0) return r;
+    memcpy(p, this->data(), x);
+    this->consume(x);
+    return (int)n;
+}
+
 class ServerImpl {
   public:
     ServerImpl()
-        : _started(false), _count(0), _fd((sock_t)-1), _connfd((sock_t)-1),
-          _ssl_ctx(0), _status(0) {
+        : _unix(false), _started(false), _prefork(false), _count(0), _loops(0), _ssl_ctx(0), _handshakes(0),
+          _alpn(0), _status(0), _max_conn((uint32)-1), _accept_rate((uint32)-1), _rejected(0), _policy(-1) {
     }
 
     ~ServerImpl() {
-        if (_fd != (sock_t)-1) this->exit();
+        if (atomic_load(&_loops, mo_relaxed) > 0) this->exit();
         if (_ssl_ctx) { ssl::free_ctx(_ssl_ctx); _ssl_ctx = 0; }
+        if (_handshakes) { co::del(_handshakes); _handshakes = 0; }
+        if (_prefork) this->prefork_remove();
     }
 
     void on_connection(std::function<void(Connection)>&& cb) {
@@ -184,8 +491,24 @@ class ServerImpl {
         _exit_cb = std::move(cb);
     }
 
+    void alpn(const char* protos) { _alpn = protos; }
+
+    void limit(uint32 max_conn, uint32 accept_rate) {
+        _max_conn = max_conn;
+        _accept_rate = accept_rate;
+    }
+
+    void on_admit(std::function<bool(sock_t)>&& f) { _admit_cb = std::move(f); }
+    void sched_policy(co::sched_policy_t p) { _policy = (int)p; }
+    void on_reject(std::function<void(Connection)>&& f) { _reject_cb = std::move(f); }
+    uint64 rejected_num() const { return atomic_load(&_rejected, mo_relaxed); }
+
+    bool park(Connection& c, uint32 sec);
+    void on_unpark(void* p);
+
     void start(const char* ip, int port, const char* key, const char* ca);
     void exit();
+    void drain();
     bool started() const { return _started; }
 
     uint32 conn_num() const { return atomic_load(&_count, mo_relaxed) - 1; }
@@ -199,34 +522,231 @@ class ServerImpl {
     }
 
   private:
-    void loop();
+    sock_t listen(bool reuse_port);
+    sock_t listen_tcp(bool reuse_port);
+    sock_t listen_unix();
+    void prefork_add();
+    void prefork_remove();
+    void loop(bool reuse_port);
+    void accept_loop(sock_t fd, bool reuse_port);
     void stop();
     void on_tcp_connection(sock_t sock);
     void on_ssl_connection(sock_t sock);
+    void on_rejected(sock_t sock);
+    bool admit(sock_t sock);
+    co::Scheduler* incoming_sched(sock_t sock) const;
 
   private:
     fastring _ip;
     uint16 _port;
+    bool _unix;     // listen on a unix domain socket
+    fastring _addr; // ip:port, or the unix address, for logs
     bool _started;
+    bool _prefork;  // started in a prefork worker
     uint32 _count; // refcount
-    sock_t _fd;
-    sock_t _connfd;
+    uint32 _loops; // number of running accept loops
     std::function<void(Connection)> _conn_cb;
     std::function<void()> _exit_cb;
     std::function<void(sock_t)> _on_sock;
     void* _ssl_ctx;
+    co::Semaphore* _handshakes; // limit of ssl handshakes in progress
+    const char* _alpn;
     int _status;
-    int _addrlen;
-    union {
-        struct sockaddr_in  v4;
-        struct sockaddr_in6 v6;
-    } _addr;
+    uint32 _max_conn;
+    uint32 _accept_rate;
+    uint64 _rejected;
+    std::function<bool(sock_t)> _admit_cb;
+    std::function<void(Connection)> _reject_cb;
+    std::function<void(sock_t)> _on_reject;
+    int _policy; // a co::sched_policy_t, or -1 to use co_sched_policy
+    co::vector<co::Scheduler*> _cpu_scheds; // schedulers indexed by the cpu bound to
+};
+
+#ifdef __linux__
+// an idle connection parked in the ParkingLot
+struct Parked {
+    Parked(Connection&& c, ServerImpl* s)
+        : prev(0), next(0), serv(s), sched(co::scheduler()), conn(std::move(c)),
+          slot(0), rounds(0) {
+    }
+
+    Parked* prev;
+    Parked* next;
+    ServerImpl* serv;
+    co::Scheduler* sched; // the connection is served in this scheduler again
+    Connection conn;
+    uint32 slot;
+    uint32 rounds;
+};
+
+/**
+ * idle connections parked as bare fds, without coroutines 
+ *   - The sockets are watched by an epoll of its own, with EPOLLONESHOT. It 
+ *     is waited by a single coroutine. When data arrives, the connection is 
+ *     handed to the connection callback in a new coroutine. 
+ *   - Idle timeouts are kept in a timing wheel of 1 second per slot, the 
+ *     connection is closed if it was parked for the given seconds. 
+ */
+class ParkingLot {
+  public:
+    static const uint32 kSlots = 256;
+
+    ParkingLot() : _cur(0) {
+        memset(_slots, 0, sizeof(_slots));
+        _ep = epoll_create1(EPOLL_CLOEXEC);
+        CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
+        go(&ParkingLot::loop, this);
+    }
+
+    void park(Parked* p, uint32 sec);
+
+  private:
+    void loop();
+    void tick();
+
+    void link(Parked* p, uint32 sec) {
+        const uint32 t = sec > 0 ? sec : 1;
+        p->slot = (_cur + t) % kSlots;
+        p->rounds = (t - 1) / kSlots;
+        p->prev = 0;
+        p->next = _slots[p->slot];
+        if (p->next) p->next->prev = p;
+        _slots[p->slot] = p;
+    }
+
+    void unlink(Parked* p) {
+        if (p->prev) {
+            p->prev->next = p->next;
+        } else {
+            _slots[p->slot] = p->next;
+        }
+        if (p->next) p->next->prev = p->prev;
+    }
+
+  private:
+    ::Mutex _mtx;
+    int _ep;
+    uint32 _cur;
+    Parked* _slots[kSlots];
 };
 
+inline ParkingLot* parking_lot() {
+    static ParkingLot* lot = co::static_new<ParkingLot>();
+    return lot;
+}
+
+void ParkingLot::park(Parked* p, uint32 sec) {
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = p;
+
+    // link it before it is added to epoll, as it may be woken up at once
+    {
+        ::MutexGuard g(_mtx);
+        this->link(p, sec);
+        if (epoll_ctl(_ep, EPOLL_CTL_ADD, p->conn.socket(), &ev) == 0) return;
+        this->unlink(p);
+    }
+
+    ELOG << "park connection error: " << co::strerror() << ", connfd: " << p->conn.socket();
+    ServerImpl* const s = p->serv;
+    p->conn.close();
+    co::del(p);
+    s->unref();
+}
+
+void ParkingLot::loop() {
+    const int N = 256;
+    epoll_event evs[N];
+    co::IoEvent ev(_ep, co::ev_read);
+    int64 next = now::ms() + 1000;
+
+    while (true) {
+        const int64 t = now::ms();
+        if (t < next) ev.wait((uint32)(next - t));
+
+        // the epoll is edge-triggered in the scheduler, drain it
+        for (;;) {
+            const int n = epoll_wait(_ep, evs, N, 0);
+            for (int i = 0; i < n; ++i) {
+                Parked* p = (Parked*) evs[i].data.ptr;
+                {
+                    ::MutexGuard g(_mtx);
+                    this->unlink(p);
+                }
+                epoll_ctl(_ep, EPOLL_CTL_DEL, p->conn.socket(), evs + i);
+                p->sched->go(&ServerImpl::on_unpark, p->serv, (void*)p);
+            }
+            if (n < N) break;
+        }
+
+        while (now::ms() >= next) { this->tick(); next += 1000; }
+    }
+}
+
+// move to the next slot, close connections that have been idle for too long
+void ParkingLot::tick() {
+    Parked* x = 0;
+    {
+        ::MutexGuard g(_mtx);
+        _cur = (_cur + 1) % kSlots;
+        for (Parked* p = _slots[_cur]; p;) {
+            Parked* const next = p->next;
+            if (p->rounds == 0) {
+                this->unlink(p);
+                epoll_ctl(_ep, EPOLL_CTL_DEL, p->conn.socket(), (epoll_event*)8);
+                p->next = x;
+                x = p;
+            } else {
+                --p->rounds;
+            }
+            p = next;
+        }
+    }
+
+    while (x) {
+        Parked* const p = x;
+        x = x->next;
+        DLOG << "close parked connection, connfd: " << p->conn.socket();
+        ServerImpl* const s = p->serv;
+        p->conn.close();
+        co::del(p);
+        s->unref();
+    }
+}
+
+bool ServerImpl::park(Connection& c, uint32 sec) {
+    if (_ssl_ctx) return false; // ssl may have buffered data not seen by epoll
+    this->ref(); // released by on_unpark(), or when the connection is closed
+    parking_lot()->park(co::make<Parked>(std::move(c), this), sec);
+    return true;
+}
+
+void ServerImpl::on_unpark(void* x) {
+    Parked* p = (Parked*)x;
+    Connection c(std::move(p->conn));
+    co::del(p);
+    _conn_cb(std::move(c));
+    this->unref();
+}
+
+#else
+bool ServerImpl::park(Connection&, uint32) { return false; }
+void ServerImpl::on_unpark(void*) {}
+#endif
+
 void ServerImpl::start(const char* ip, int port, const char* key, const char* ca) {
     CHECK(_conn_cb != NULL) << "connection callback not set..";
     _ip = (ip && *ip) ? ip : "0.0.0.0";
-    _port = (uint16)port;
+    _unix = is_unix_addr(_ip.c_str());
+    _port = _unix ? 0 : (uint16)port;
+    _addr = _ip;
+    if (!_unix) _addr << ':' << _port;
+  #ifdef _WIN32
+    CHECK(!_unix) << "unix domain socket is not supported on windows: " << _ip;
+  #endif
+    if (_max_conn == (uint32)-1) _max_conn = FLG_tcp_max_conn;
+    if (_accept_rate == (uint32)-1) _accept_rate = FLG_tcp_accept_rate;
 
     if (key && *key && ca && *ca) {
         _ssl_ctx = ssl::new_server_ctx();
@@ -242,15 +762,57 @@ void ServerImpl::start(const char* ip, int port, const char* key, const char* ca
         r = ssl::check_private_key(_ssl_ctx);
         CHECK_EQ(r, 1) << "ssl check private key error: " << ssl::strerror();
 
+        r = ssl::enable_session_cache(_ssl_ctx);
+        CHECK_EQ(r, 1) << "ssl enable session cache error: " << ssl::strerror();
+
+        if (FLG_ssl_handshake_concurrency > 0) {
+            _handshakes = co::make<co::Semaphore>(FLG_ssl_handshake_concurrency);
+        }
+
+        if (FLG_ssl_ktls && ssl::enable_ktls(_ssl_ctx) != 1) {
+            WLOG << "kTLS is not supported by openssl, records are encrypted in the user space";
+        }
+
+        if (_alpn) {
+            r = ssl::set_alpn_protos(_ssl_ctx, _alpn);
+            CHECK_EQ(r, 1) << "ssl set alpn protos error: " << ssl::strerror();
+        }
+
         _on_sock = std::bind(&ServerImpl::on_ssl_connection, this, std::placeholders::_1);
-        this->ref();
-        atomic_store(&_started, true, mo_relaxed);
-        go(&ServerImpl::loop, this);
     } else {
         _on_sock = std::bind(&ServerImpl::on_tcp_connection, this, std::placeholders::_1);
-        this->ref();
-        atomic_store(&_started, true, mo_relaxed);
-        go(&ServerImpl::loop, this);
+        if (_reject_cb) _on_reject = std::bind(&ServerImpl::on_rejected, this, std::placeholders::_1);
+    }
+
+  #ifdef SO_REUSEPORT
+    const bool reuse_port = FLG_tcp_reuse_port && !_unix;
+  #else
+    const bool reuse_port = false;
+  #endif
+
+  #ifdef SO_INCOMING_CPU
+    if (FLG_tcp_incoming_cpu && !_unix) {
+        for (auto s : co::schedulers()) {
+            const int cpu = s->cpu();
+            if (cpu < 0) continue;
+            if (_cpu_scheds.size() <= (size_t)cpu) _cpu_scheds.resize(cpu + 1, 0);
+            _cpu_scheds[cpu] = s;
+        }
+        WLOG_IF(_cpu_scheds.empty()) << "tcp_incoming_cpu ignored, schedulers are not bound to cpus";
+    }
+  #endif
+
+    // the accept loops share one reference, it is released by the last one
+    this->ref();
+    atomic_store(&_started, true, mo_relaxed);
+    if (prefork::worker_id() >= 0) this->prefork_add();
+    if (reuse_port) {
+        auto& s = co::schedulers();
+        atomic_store(&_loops, (uint32)s.size(), mo_relaxed);
+        for (size_t i = 0; i < s.size(); ++i) s[i]->go(&ServerImpl::loop, this, true);
+    } else {
+        atomic_store(&_loops, 1u, mo_relaxed);
+        go(&ServerImpl::loop, this, false);
     }
 }
 
@@ -266,93 +828,377 @@ void ServerImpl::exit() {
     while (_status != 2) sleep::ms(1);
 }
 
+// stop accepting without waiting for it, when a prefork worker drains
+void ServerImpl::drain() {
+    if (atomic_cas(&_status, 0, 1) == 0) {
+        this->ref();
+        go([this]() { this->stop(); this->unref(); });
+    }
+}
+
+// servers started in a prefork worker, they stop accepting when it drains, and
+// the worker exits once they are all gone
+struct PreforkServers {
+    ::Mutex mtx;
+    co::vector<ServerImpl*> v;
+};
+
+inline PreforkServers& prefork_servers() {
+    static PreforkServers* x = []() {
+        auto s = co::static_new<PreforkServers>();
+        prefork::on_drain([s]() {
+            ::MutexGuard g(s->mtx);
+            for (size_t i = 0; i < s->v.size(); ++i) s->v[i]->drain();
+        });
+        return s;
+    }();
+    return *x;
+}
+
+void ServerImpl::prefork_add() {
+    auto& x = prefork_servers();
+    ::MutexGuard g(x.mtx);
+    x.v.push_back(this);
+    _prefork = true;
+    prefork::hold();
+}
+
+void ServerImpl::prefork_remove() {
+    auto& x = prefork_servers();
+    {
+        ::MutexGuard g(x.mtx);
+        for (size_t i = 0; i < x.v.size(); ++i) {
+            if (x.v[i] == this) { x.v.erase(x.v.begin() + i); break; }
+        }
+    }
+    prefork::release();
+}
+
+// wake up the accept loops by connecting to the server. With SO_REUSEPORT, a
+// connection wakes up only one of the listeners, so connect until all exited.
 void ServerImpl::stop() {
     const char* ip = (_ip == "0.0.0.0" || _ip == "::") ? "127.0.0.1" : _ip.c_str();
-    tcp::Client c(ip, _port);
-    c.connect(-1);
+    while (atomic_load(&_status) != 2) {
+        tcp::Client c(ip, _port);
+        c.connect(-1);
+        if (atomic_load(&_status) != 2) co::sleep(1);
+    }
+}
+
+// In a prefork worker, the listener is kept by the master, so that it is there
+// for a respawned worker, or new workers of a hot restart. On linux, each worker
+// has its own SO_REUSEPORT listener, others share one.
+sock_t ServerImpl::listen(bool reuse_port) {
+    const int w = prefork::worker_id();
+    if (w < 0) return _unix ? this->listen_unix() : this->listen_tcp(reuse_port);
+
+    fastring key(_addr);
+    key << '#' << (reuse_port ? co::scheduler_id() : 0);
+    int idx = -1;
+  #if defined(__linux__) && defined(SO_REUSEPORT)
+    if (!_unix) { idx = w; reuse_port = true; }
+  #endif
+    sock_t fd = prefork::xx::listener(key.c_str(), idx);
+    if (fd != (sock_t)-1) return fd;
+
+    fd = _unix ? this->listen_unix() : this->listen_tcp(reuse_port);
+    prefork::xx::keep(key.c_str(), idx, fd);
+    return fd;
+}
+
+sock_t ServerImpl::listen_tcp(bool reuse_port) {
+    fastring port = str::from(_port);
+    struct addrinfo* info = 0;
+    int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
+    CHECK_EQ(r, 0) << "invalid ip address: " << _addr;
+    CHECK(info != NULL);
+
+    sock_t fd = co::tcp_socket(info->ai_family);
+    CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+    co::set_reuseaddr(fd);
+    if (reuse_port) {
+        CHECK(co::set_reuseport(fd)) << "set SO_REUSEPORT error: " << co::strerror();
+    }
+
+    // turn off IPV6_V6ONLY
+    if (info->ai_family == AF_INET6) {
+        int on = 0;
+        co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+
+    r = co::bind(fd, info->ai_addr, (int)info->ai_addrlen);
+    CHECK_EQ(r, 0) << "bind " << _addr << " failed: " << co::strerror();
+
+    r = co::listen(fd, 64 * 1024);
+    CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+
+  #ifdef SO_INCOMING_CPU
+    // the kernel prefers the listener with the cpu that received the SYN
+    if (reuse_port && !_cpu_scheds.empty()) {
+        int cpu = co::scheduler()->cpu();
+        if (cpu >= 0 && co::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) != 0) {
+            WLOG << "set SO_INCOMING_CPU error: " << co::strerror();
+        }
+    }
+  #endif
+
+  #ifdef TCP_FASTOPEN
+    if (FLG_tcp_fastopen) {
+      #ifdef __APPLE__
+        int qlen = 1; // on or off on mac
+      #else
+        int qlen = 256; // max pending fast open requests
+      #endif
+        if (co::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) != 0) {
+            WLOG << "set TCP_FASTOPEN error: " << co::strerror();
+        }
+    }
+  #endif
+
+    freeaddrinfo(info);
+    return fd;
+}
+
+#ifndef _WIN32
+sock_t ServerImpl::listen_unix() {
+    struct sockaddr_un addr;
+    const int len = init_unix_addr(&addr, _ip.c_str());
+    CHECK_GT(len, 0) << "invalid unix socket address: " << _ip;
+
+    sock_t fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+
+    // remove the socket file left by the last run
+    if (addr.sun_path[0]) ::unlink(addr.sun_path);
+
+    int r = co::bind(fd, &addr, len);
+    CHECK_EQ(r, 0) << "bind " << _ip << " failed: " << co::strerror();
+
+    r = co::listen(fd, 64 * 1024);
+    CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+    return fd;
 }
+#else
+sock_t ServerImpl::listen_unix() { return (sock_t)-1; }
+#endif
 
 /**
  * the server loop 
  *   - It listens on a port and waits for connections. 
  *   - When a connection is accepted, it will start a new coroutine and call 
  *     the connection callback to handle the connection. 
+ *   - If reuse_port is true, there is a loop with its own listener in each 
+ *     scheduler, and the connection is served in the same scheduler. 
+ *   - On windows, co::accept() posts one AcceptEx and waits for it. There are 
+ *     tcp_accept_ex_num accept loops on the listener in this scheduler, so that 
+ *     as many sockets are ready for a burst of connections. 
  */
-void ServerImpl::loop() {
-    do {
-        fastring port = str::from(_port);
-        struct addrinfo* info = 0;
-        int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
-        CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
-        CHECK(info != NULL);
-
-        _fd = co::tcp_socket(info->ai_family);
-        CHECK_NE(_fd, (sock_t)-1) << "create socket error: " << co::strerror();
-        co::set_reuseaddr(_fd);
-
-        // turn off IPV6_V6ONLY
-        if (info->ai_family == AF_INET6) {
-            int on = 0;
-            co::setsockopt(_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
-        }
-
-        r = co::bind(_fd, info->ai_addr, (int)info->ai_addrlen);
-        CHECK_EQ(r, 0) << "bind " << _ip << ':' << _port << " failed: " << co::strerror();
-
-        r = co::listen(_fd, 64 * 1024);
-        CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+void ServerImpl::loop(bool reuse_port) {
+    const sock_t fd = this->listen(reuse_port);
+    if (!reuse_port || co::scheduler_id() == 0) {
+        LOG << "server start: " << _addr << (reuse_port ? " (reuse port)" : "");
+    }
 
-        freeaddrinfo(info);
-    } while (0);
+  #ifdef _WIN32
+    const uint32 n = FLG_tcp_accept_ex_num > 0 ? FLG_tcp_accept_ex_num : 1;
+    atomic_add(&_loops, n - 1, mo_relaxed);
+    for (uint32 i = 1; i < n; ++i) {
+        co::scheduler()->go(&ServerImpl::accept_loop, this, fd, reuse_port);
+    }
+  #endif
+    this->accept_loop(fd, reuse_port);
+}
 
-    LOG << "server start: " << _ip << ':' << _port;
-    while (true) {
-        _addrlen = sizeof(_addr);
-        _connfd = co::accept(_fd, &_addr, &_addrlen);
+void ServerImpl::accept_loop(sock_t fd, bool reuse_port) {
+    sock_t connfd;
+    int addrlen;
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+      #ifndef _WIN32
+        struct sockaddr_un  un;
+      #endif
+    } addr;
+
+    // connections accepted in one wakeup, dispatched to the schedulers at once
+    const size_t max_batch = 64;
+    co::vector<co::Closure*> conns;
+    co::vector<sock_t> fds; // sockets of the conns, if routed by the incoming cpu
+    conns.reserve(max_batch);
+    const bool by_cpu = !reuse_port && !_cpu_scheds.empty();
+    bool stopped = false;
+
+    // a token bucket for the accept rate, the loops share the rate evenly
+    uint32 rate = _accept_rate;
+    if (rate > 0) {
+        rate /= atomic_load(&_loops, mo_relaxed);
+        if (rate == 0) rate = 1;
+    }
+    const double burst = rate >= 10 ? rate / 10.0 : 1.0; // 100ms worth
+    double tokens = burst;
+    int64 last = now::ms();
+
+    while (!stopped) {
+        if (rate > 0) {
+            const int64 t = now::ms();
+            tokens += (t - last) * rate / 1000.0;
+            if (tokens > burst) tokens = burst;
+            last = t;
+            if (tokens < 1) {
+                co::sleep((uint32)((1 - tokens) * 1000 / rate) + 1);
+                continue;
+            }
+        }
 
-        if (unlikely(_status == 1)) {
-            co::reset_tcp_socket(_connfd);
+        addrlen = sizeof(addr);
+        connfd = co::accept(fd, &addr, &addrlen);
+
+        while (true) {
+            if (unlikely(atomic_load(&_status, mo_relaxed) == 1)) {
+                co::reset_tcp_socket(connfd);
+                stopped = true;
+                break;
+            }
+
+            if (unlikely(connfd == (sock_t)-1)) {
+                if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                    WLOG << "server " << _addr << " accept error: " << co::strerror();
+                }
+                break;
+            }
+
+            if (this->admit(connfd)) {
+                const uint32 n = this->ref() - 1;
+                MET_co_tcp_accepted_total.inc();
+                DLOG << "server " << _addr
+                     << " accept connection: " << co::to_string(&addr, addrlen)
+                     << ", connfd: " << connfd << ", conn num: " << n;
+                conns.push_back(co::new_closure(&_on_sock, connfd));
+            } else {
+                atomic_inc(&_rejected, mo_relaxed);
+                MET_co_tcp_rejected_total.inc();
+                DLOG << "server " << _addr
+                     << " reject connection: " << co::to_string(&addr, addrlen)
+                     << ", connfd: " << connfd << ", conn num: " << this->conn_num();
+                if (_on_reject) {
+                    this->ref();
+                    conns.push_back(co::new_closure(&_on_reject, connfd));
+                } else {
+                    co::reset_tcp_socket(connfd);
+                }
+            }
+            if (by_cpu && fds.size() < conns.size()) fds.push_back(connfd);
+            if (rate > 0) tokens -= 1;
+
+          #ifndef _WIN32
+            // drain the accept queue, until EAGAIN
+            if (conns.size() == max_batch) break;
+            if (rate > 0 && tokens < 1) break;
+            addrlen = sizeof(addr);
+            connfd = co::try_accept(fd, &addr, &addrlen);
+          #else
             break;
+          #endif
         }
 
-        if (unlikely(_connfd == (sock_t)-1)) {
-            WLOG << "server " << _ip << ':' << _port << " accept error: " << co::strerror();
-            continue;
+        if (!conns.empty()) {
+            if (reuse_port) {
+                co::scheduler()->go_n(conns);
+            } else if (by_cpu) {
+                for (size_t i = 0; i < conns.size(); ++i) {
+                    co::Scheduler* s = this->incoming_sched(fds[i]);
+                    if (!s) s = _policy >= 0 ? co::next_scheduler((co::sched_policy_t)_policy) : co::next_scheduler();
+                    s->go(conns[i]);
+                }
+                fds.clear();
+            } else if (_policy >= 0) {
+                for (size_t i = 0; i < conns.size(); ++i) {
+                    co::next_scheduler((co::sched_policy_t)_policy)->go(conns[i]);
+                }
+            } else {
+                co::go_batch(conns);
+            }
+            conns.clear();
         }
+    }
 
-        const uint32 n = this->ref() - 1;
-        DLOG << "server " << _ip << ':' << _port
-             << " accept connection: " << co::to_string(&_addr, _addrlen)
-             << ", connfd: " << _connfd << ", conn num: " << n;
-        go(&_on_sock, _connfd);
+  #ifndef _WIN32
+    co::close(fd);
+  #endif
+    if (atomic_dec(&_loops, mo_acq_rel) == 0) {
+      #ifdef _WIN32
+        co::close(fd); // shared by the accept loops
+      #else
+        // in prefork mode, the socket may be still used by other workers
+        if (_unix && _ip[5] != '@' && !_prefork) ::unlink(_ip.c_str() + 5);
+      #endif
+        LOG << "server stopped: " << _addr;
+        atomic_store(&_status, 2);
+        this->unref();
     }
+}
 
-    LOG << "server stopped: " << _ip << ':' << _port;
-    co::close(_fd); _fd = (sock_t)-1;
-    atomic_store(&_status, 2);
+// the scheduler bound to the cpu that received packets of the connection, 
+// NULL if it is unknown
+co::Scheduler* ServerImpl::incoming_sched(sock_t sock) const {
+  #ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    int n = sizeof(cpu);
+    if (co::getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &n) == 0 &&
+        cpu >= 0 && (size_t)cpu < _cpu_scheds.size()) {
+        return _cpu_scheds[cpu];
+    }
+  #else
+    (void)sock;
+  #endif
+    return 0;
+}
+
+// check the limit of connections and the load-shedding callback
+inline bool ServerImpl::admit(sock_t fd) {
+    if (_max_conn > 0 && this->conn_num() >= _max_conn) return false;
+    return !_admit_cb || _admit_cb(fd);
+}
+
+void ServerImpl::on_rejected(sock_t fd) {
+    _reject_cb(tcp::Connection((int)fd));
     this->unref();
 }
 
 void ServerImpl::on_tcp_connection(sock_t fd) {
-    co::set_tcp_keepalive(fd);
-    co::set_tcp_nodelay(fd);
+    if (!_unix) {
+        co::set_tcp_keepalive(fd);
+        co::set_tcp_nodelay(fd);
+    }
     _conn_cb(tcp::Connection((int)fd));
     this->unref();
 }
 
 void ServerImpl::on_ssl_connection(sock_t fd) {
-    co::set_tcp_keepalive(fd);
-    co::set_tcp_nodelay(fd);
+    if (!_unix) {
+        co::set_tcp_keepalive(fd);
+        co::set_tcp_nodelay(fd);
+    }
 
+    int r;
     ssl::S* s = ssl::new_ssl((ssl::C*)_ssl_ctx);
     if (s == NULL) goto new_ssl_err;
     if (ssl::set_fd(s, (int)fd) != 1) goto set_fd_err;
-    if (ssl::accept(s, FLG_ssl_handshake_timeout) <= 0) goto accept_err;
+
+    // handshakes over the limit wait here, they do not take cpu from others
+    if (_handshakes && !_handshakes->acquire(1, FLG_ssl_handshake_timeout)) goto busy_err;
+    r = ssl::accept(s, FLG_ssl_handshake_timeout, FLG_ssl_handshake_offload);
+    if (_handshakes) _handshakes->release();
+    if (r <= 0) goto accept_err;
 
     _conn_cb(tcp::Connection((void*)s));
     this->unref();
     return;
 
+  busy_err:
+    WLOG << "ssl handshake of fd " << fd << " not started in "
+         << FLG_ssl_handshake_timeout << " ms, too many handshakes in progress";
+    goto end;
   new_ssl_err:
     ELOG << "new SSL failed: " << ssl::strerror();
     goto end;
@@ -390,10 +1236,43 @@ Server& Server::on_exit(std::function<void()>&& cb) {
     return *this;
 }
 
+Server& Server::alpn(const char* protos) {
+    ((ServerImpl*)_p)->alpn(protos);
+    return *this;
+}
+
+bool Server::park(Connection& c, uint32 sec) {
+    return ((ServerImpl*)_p)->park(c, sec);
+}
+
+Server& Server::limit(uint32 max_conn, uint32 accept_rate) {
+    ((ServerImpl*)_p)->limit(max_conn, accept_rate);
+    return *this;
+}
+
+Server& Server::on_admit(std::function<bool(sock_t)>&& f) {
+    ((ServerImpl*)_p)->on_admit(std::move(f));
+    return *this;
+}
+
+Server& Server::sched_policy(co::sched_policy_t p) {
+    ((ServerImpl*)_p)->sched_policy(p);
+    return *this;
+}
+
+Server& Server::on_reject(std::function<void(Connection)>&& f) {
+    ((ServerImpl*)_p)->on_reject(std::move(f));
+    return *this;
+}
+
 uint32 Server::conn_num() const {
     return ((ServerImpl*)_p)->conn_num();
 }
 
+uint64 Server::rejected_num() const {
+    return ((ServerImpl*)_p)->rejected_num();
+}
+
 void Server::start(const char* ip, int port, const char* key, const char* ca) {
     ((ServerImpl*)_p)->start(ip, port, key, ca);
 }
@@ -442,36 +1321,176 @@ int Client::send(const void* buf, int n, int ms) {
     return ssl::send(_s[-1], buf, n, ms);
 }
 
-bool Client::connect(int ms) {
-    if (this->connected()) return true;
+// try the addresses of the host in order, until one is connected
+//   - With @fastopen, connect() returns at once if the kernel has a cookie of 
+//     the server, and the SYN is sent with the first data (linux 4.11+). 
+static int connect_ip(const char* ip, int port, int ms, bool fastopen) {
+    co::vector<fastring> ips;
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+    } addr;
 
-    fastring port = str::from(_port);
-    struct addrinfo* info = 0;
-    int r = getaddrinfo(_ip, port.c_str(), NULL, &info);
-    if (r != 0) goto end;
+    if (!dns::resolve(ip, ips, ms)) {
+        ELOG << "connect to " << ip << ':' << port << " failed: can't resolve the host";
+        return -1;
+    }
+
+    int fd = -1;
+    for (size_t i = 0; i < ips.size(); ++i) {
+        const bool v4 = co::init_ip_addr(&addr.v4, ips[i].c_str(), port);
+        if (!v4 && !co::init_ip_addr(&addr.v6, ips[i].c_str(), port)) continue;
+        fd = (int) co::tcp_socket(v4 ? AF_INET : AF_INET6);
+        if (fd == -1) break;
+      #ifdef TCP_FASTOPEN_CONNECT
+        if (fastopen) {
+            int on = 1;
+            co::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+        }
+      #else
+        (void)fastopen;
+      #endif
+        if (co::connect(fd, &addr, v4 ? sizeof(addr.v4) : sizeof(addr.v6), ms) == 0) break;
+        const int e = co::error();
+        co::close(fd); fd = -1;
+        co::error() = e;
+    }
+    if (fd == -1) {
+        ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+        return -1;
+    }
+
+    co::set_tcp_nodelay(fd);
+    return fd;
+}
+
+#ifndef _WIN32
+// connected sockets to the destinations of tcp::Client in a scheduler
+//   - Sockets are taken by Client::connect(), and a coroutine in the same 
+//     scheduler connects new ones, so that tcp_warm_conn of them are kept. 
+//   - Sockets closed by the server while idle are dropped when taken. 
+class WarmPool {
+  public:
+    struct dest_t {
+        dest_t() : port(0), pending(0) {}
+        fastring ip;
+        int port;
+        uint32 pending; // sockets being connected
+        co::vector<int> fds;
+    };
+
+    WarmPool() = default;
+    ~WarmPool() = delete;
+
+    // take a connected socket to ip:port, or -1 if there is none
+    int take(const char* ip, int port);
+
+  private:
+    void refill(dest_t* d);
+
+  private:
+    co::hash_map<fastring, dest_t> _dests;
+};
 
-    CHECK_NOTNULL(info);
-    _fd = (int) co::tcp_socket(info->ai_family);
-    if (_fd == -1) {
-        ELOG << "connect to " << _ip << ':' << _port << " failed: " << co::strerror();
-        goto end;
+// the peer has not closed the socket, and nothing is unexpectedly received,
+// poll() with a zero timeout is not waited by the hook
+inline bool is_idle_alive(int fd) {
+    struct pollfd x;
+    x.fd = fd;
+    x.events = POLLIN;
+    x.revents = 0;
+    return ::poll(&x, 1, 0) == 0;
+}
+
+int WarmPool::take(const char* ip, int port) {
+    fastring key(ip);
+    key << ':' << port;
+    dest_t& d = _dests[key];
+    if (d.ip.empty()) { d.ip = ip; d.port = port; }
+
+    int fd = -1;
+    while (!d.fds.empty()) {
+        const int x = d.fds.back();
+        d.fds.pop_back();
+        if (is_idle_alive(x)) { fd = x; break; }
+        co::close(x);
     }
+    this->refill(&d);
+    return fd;
+}
 
-    r = co::connect(_fd, info->ai_addr, (int)info->ai_addrlen, ms);
-    if (r != 0) {
-        ELOG << "connect to " << _ip << ':' << _port << " failed: " << co::strerror();
-        goto end;
+// entries of the map are never removed, so @d stays valid in the coroutine
+void WarmPool::refill(dest_t* d) {
+    const uint32 n = (uint32)d->fds.size() + d->pending;
+    if (n >= FLG_tcp_warm_conn) return;
+    const uint32 k = FLG_tcp_warm_conn - n;
+    d->pending += k;
+    co::scheduler()->go([d, k]() {
+        for (uint32 i = 0; i < k; ++i) {
+            const int fd = connect_ip(d->ip.c_str(), d->port, 3000, false);
+            if (fd == -1) { d->pending -= k - i; return; }
+            --d->pending;
+            d->fds.push_back(fd);
+        }
+    });
+}
+
+inline WarmPool* warm_pool() {
+    static auto v = co::static_new<co::vector<WarmPool*>>(co::scheduler_num(), (WarmPool*)0);
+    const int i = co::scheduler_id();
+    if (i < 0) return 0;
+    WarmPool*& p = (*v)[i];
+    if (!p) p = co::static_new<WarmPool>();
+    return p;
+}
+#endif
+
+static int connect_unix(const char* ip, int ms) {
+  #ifndef _WIN32
+    struct sockaddr_un addr;
+    const int len = init_unix_addr(&addr, ip);
+    if (len == 0) {
+        ELOG << "connect to " << ip << " failed: invalid unix socket address";
+        return -1;
     }
 
-    co::set_tcp_nodelay(_fd);
+    int fd = (int) co::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && co::connect(fd, &addr, len, ms) != 0) {
+        const int e = co::error();
+        co::close(fd); fd = -1;
+        co::error() = e;
+    }
+    if (fd == -1) ELOG << "connect to " << ip << " failed: " << co::strerror();
+    return fd;
+  #else
+    (void)ms;
+    ELOG << "connect to " << ip << " failed: unix domain socket is not supported on windows";
+    return -1;
+  #endif
+}
+
+bool Client::connect(int ms) {
+    if (this->connected()) return true;
+
+    if (is_unix_addr(_ip)) {
+        _fd = connect_unix(_ip, ms);
+    } else {
+      #ifndef _WIN32
+        WarmPool* const p = FLG_tcp_warm_conn > 0 ? warm_pool() : 0;
+        if (p) _fd = p->take(_ip, _port);
+      #endif
+        if (_fd == -1) _fd = connect_ip(_ip, _port, ms, FLG_tcp_fastopen);
+    }
+    if (_fd == -1) return false;
+
     if (_use_ssl) {
-        if ((_s[-2] = ssl::new_client_ctx()) == NULL) goto new_ctx_err;
+        if ((_s[-2] = ssl::shared_client_ctx()) == NULL) goto new_ctx_err;
         if ((_s[-1] = ssl::new_ssl(_s[-2])) == NULL) goto new_ssl_err;
         if (ssl::set_fd(_s[-1], _fd) != 1) goto set_fd_err;
+        // reuse the session of the last connection to ip:port at best
+        ssl::set_session(_s[-1], (fastring(_ip) << ':' << _port).c_str());
         if (ssl::connect(_s[-1], ms) != 1) goto connect_err;
     }
-
-    if (info) freeaddrinfo(info);
     return true;
 
   new_ctx_err:
@@ -488,7 +1507,6 @@ bool Client::connect(int ms) {
     goto end;
   end:
     this->disconnect();
-    if (info) freeaddrinfo(info);
     return false;
 }
 
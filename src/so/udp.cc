@@ -0,0 +1,256 @@
+#include "co/udp.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/mem.h"
+#include "co/str.h"
+#include "co/time.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+DEF_uint32(udp_batch_size, 32, ">>#2 max datagrams received with one recvmmsg() by udp::Server");
+DEF_uint32(udp_max_datagram_size, 2048, ">>#2 max size of datagrams received by udp::Server, "
+    "larger ones are truncated");
+
+namespace udp {
+
+union Addr {
+    struct sockaddr_in  v4;
+    struct sockaddr_in6 v6;
+};
+
+class ServerImpl {
+  public:
+    ServerImpl() : _port(0), _started(false), _status(0), _loops(0), _recv(0) {}
+    ~ServerImpl() = default;
+
+    void on_datagram(std::function<void(const Datagram&)>&& f) { _cb = std::move(f); }
+    uint64 recv_num() const { return atomic_load(&_recv, mo_relaxed); }
+
+    // the server can be deleted if it was not started or has been stopped
+    bool deletable() const { return !_started || atomic_load(&_status) == 2; }
+
+    void start(const char* ip, int port);
+    void exit();
+
+  private:
+    sock_t bind(bool reuse_port);
+    void loop(sock_t fd);
+    void wake();
+
+  private:
+    fastring _ip;
+    uint16 _port;
+    bool _started;
+    int _status;   // 0: running, 1: exiting, 2: stopped
+    uint32 _loops; // number of running receive loops
+    uint64 _recv;
+    co::vector<sock_t> _socks;
+    std::function<void(const Datagram&)> _cb;
+};
+
+void ServerImpl::start(const char* ip, int port) {
+    CHECK(_cb != NULL) << "datagram handler not set..";
+    CHECK(!_started) << "udp server already started..";
+    _ip = (ip && *ip) ? ip : "0.0.0.0";
+    _port = (uint16)port;
+
+    // sockets are bound here, so that the port is ready when start() returns
+  #ifdef __linux__
+    auto& s = co::schedulers();
+    for (size_t i = 0; i < s.size(); ++i) _socks.push_back(this->bind(s.size() > 1));
+  #else
+    _socks.push_back(this->bind(false));
+  #endif
+
+    _started = true;
+    atomic_store(&_loops, (uint32)_socks.size(), mo_relaxed);
+    LOG << "udp server start: " << _ip << ':' << _port << ", sockets: " << _socks.size();
+  #ifdef __linux__
+    for (size_t i = 0; i < s.size(); ++i) s[i]->go(&ServerImpl::loop, this, _socks[i]);
+  #else
+    go(&ServerImpl::loop, this, _socks[0]);
+  #endif
+}
+
+sock_t ServerImpl::bind(bool reuse_port) {
+    fastring port = str::from(_port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* info = 0;
+    int r = getaddrinfo(_ip.c_str(), port.c_str(), &hints, &info);
+    CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
+    CHECK(info != NULL);
+
+    sock_t fd = co::udp_socket(info->ai_family);
+    CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+    if (reuse_port) {
+        CHECK(co::set_reuseport(fd)) << "set SO_REUSEPORT error: " << co::strerror();
+    }
+
+    // turn off IPV6_V6ONLY
+    if (info->ai_family == AF_INET6) {
+        int on = 0;
+        co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+
+    r = co::bind(fd, info->ai_addr, (int)info->ai_addrlen);
+    CHECK_EQ(r, 0) << "bind " << _ip << ':' << _port << " failed: " << co::strerror();
+    freeaddrinfo(info);
+
+    // the other sockets are bound to the port the system picked
+    if (_port == 0) {
+        Addr a;
+        int len = sizeof(a);
+        getsockname(fd, (sockaddr*)&a, (socklen_t*)&len);
+        _port = ntoh16(a.v4.sin_port); // sin6_port is at the same offset
+    }
+    return fd;
+}
+
+/**
+ * the receive loop of a socket
+ *   - On linux, datagrams are received in batches by recvmmsg(), and the
+ *     buffers are on the heap, as the coroutine may run on a shared stack.
+ *   - The handler is called for each datagram in the loop.
+ */
+void ServerImpl::loop(sock_t fd) {
+    const uint32 n = FLG_udp_batch_size > 0 ? FLG_udp_batch_size : 1;
+    const uint32 size = FLG_udp_max_datagram_size > 0 ? FLG_udp_max_datagram_size : 2048;
+    char* const buf = (char*) co::alloc(n * size);
+    Addr* const addrs = (Addr*) co::alloc(n * sizeof(Addr));
+    Datagram d;
+    d.sock = fd;
+
+  #ifdef __linux__
+    struct mmsghdr* const msgs = (struct mmsghdr*) co::zalloc(n * sizeof(struct mmsghdr));
+    struct iovec* const iov = (struct iovec*) co::alloc(n * sizeof(struct iovec));
+    for (uint32 i = 0; i < n; ++i) {
+        iov[i].iov_base = buf + i * size;
+        iov[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
+
+    {
+        // wait here rather than in co::recvmmsg(), to check the status once woken up
+        co::IoEvent ev(fd, co::ev_read);
+        while (true) {
+            for (uint32 i = 0; i < n; ++i) msgs[i].msg_hdr.msg_namelen = sizeof(Addr);
+            const int r = ::recvmmsg(fd, msgs, n, 0, NULL);
+            if (atomic_load(&_status, mo_relaxed) != 0) break;
+            if (r < 0) {
+                if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                    ev.wait();
+                } else if (errno != EINTR) {
+                    WLOG << "udp server " << _ip << ':' << _port << " recv error: " << co::strerror();
+                }
+                continue;
+            }
+
+            atomic_add(&_recv, (uint64)r, mo_relaxed);
+            for (int i = 0; i < r; ++i) {
+                d.data = (const char*) iov[i].iov_base;
+                d.size = (int) msgs[i].msg_len;
+                d.addr = &addrs[i];
+                d.addrlen = (int) msgs[i].msg_hdr.msg_namelen;
+                _cb(d);
+            }
+        }
+    }
+
+    co::free(iov, n * sizeof(struct iovec));
+    co::free(msgs, n * sizeof(struct mmsghdr));
+  #else
+    while (true) {
+        int len = sizeof(Addr);
+        const int r = co::recvfrom(fd, buf, (int)size, addrs, &len);
+        if (atomic_load(&_status, mo_relaxed) != 0) break;
+        if (unlikely(r < 0)) {
+            WLOG << "udp server " << _ip << ':' << _port << " recv error: " << co::strerror();
+            continue;
+        }
+
+        atomic_inc(&_recv, mo_relaxed);
+        d.data = buf;
+        d.size = r;
+        d.addr = addrs;
+        d.addrlen = len;
+        _cb(d);
+    }
+  #endif
+
+    co::free(addrs, n * sizeof(Addr));
+    co::free(buf, n * size);
+    co::close(fd);
+    if (atomic_dec(&_loops, mo_acq_rel) == 0) {
+        LOG << "udp server stopped: " << _ip << ':' << _port;
+        atomic_store(&_status, 2);
+    }
+}
+
+// wake up the receive loops. On linux, shutdown() wakes up the waiting loops,
+// though recvmmsg() still returns EAGAIN. It is called by syscall(), as the
+// hooked shutdown() removes the read event, and the loops would not wake up.
+// Otherwise, there is one socket, send a datagram to it.
+void ServerImpl::wake() {
+  #ifdef __linux__
+    for (size_t i = 0; i < _socks.size(); ++i) syscall(SYS_shutdown, _socks[i], SHUT_RD);
+  #else
+    const char* ip = _ip.c_str();
+    if (_ip == "0.0.0.0") ip = "127.0.0.1";
+    if (_ip == "::") ip = "::1";
+    Addr a;
+    const bool v4 = co::init_ip_addr(&a.v4, ip, _port);
+    if (!v4 && !co::init_ip_addr(&a.v6, ip, _port)) return;
+    sock_t fd = co::udp_socket(v4 ? AF_INET : AF_INET6);
+    if (fd == (sock_t)-1) return;
+    co::sendto(fd, "", 0, &a, v4 ? sizeof(a.v4) : sizeof(a.v6), 1000);
+    co::close(fd);
+  #endif
+}
+
+void ServerImpl::exit() {
+    if (!_started || atomic_cas(&_status, 0, 1) != 0) return;
+    go(&ServerImpl::wake, this);
+
+    // do not block the scheduler if it is called in a coroutine
+    while (atomic_load(&_status) != 2) {
+        co::scheduler() ? co::sleep(1) : sleep::ms(1);
+    }
+}
+
+Server::Server() {
+    _p = co::make<ServerImpl>();
+}
+
+Server::~Server() {
+    if (_p) {
+        auto p = (ServerImpl*)_p;
+        if (p->deletable()) co::del(p); // or it keeps running
+        _p = 0;
+    }
+}
+
+Server& Server::on_datagram(std::function<void(const Datagram&)>&& f) {
+    ((ServerImpl*)_p)->on_datagram(std::move(f));
+    return *this;
+}
+
+uint64 Server::recv_num() const {
+    return ((ServerImpl*)_p)->recv_num();
+}
+
+void Server::start(const char* ip, int port) {
+    ((ServerImpl*)_p)->start(ip, port);
+}
+
+void Server::exit() {
+    ((ServerImpl*)_p)->exit();
+}
+
+} // udp
@@ -1,4 +1,5 @@
 #include "co/str.h"
+#include "co/fast.h"
 #include <math.h>
 #include <algorithm>
 
@@ -29,18 +30,14 @@ co::vector<fastring> split(const char* s, char c, uint32 maxsplit) {
 co::vector<fastring> split(const fastring& s, char c, uint32 maxsplit) {
     co::vector<fastring> v;
     v.reserve(8);
+    split_each(s, c, [&v](const char* p, size_t n) { v.push_back(fastring(p, n)); }, maxsplit);
+    return v;
+}
 
-    const char* p;
-    const char* from = s.data();
-    const char* end = from + s.size();
-
-    while ((p = (const char*) memchr(from, c, end - from))) {
-        v.push_back(fastring(from, p - from));
-        from = p + 1;
-        if (v.size() == maxsplit) break;
-    }
-
-    if (from < end) v.push_back(fastring(from, end - from));
+co::vector<fastring> split(const fastring& s, const char* c, uint32 maxsplit) {
+    co::vector<fastring> v;
+    v.reserve(8);
+    split_each(s, c, [&v](const char* p, size_t n) { v.push_back(fastring(p, n)); }, maxsplit);
     return v;
 }
 
@@ -82,11 +79,13 @@ fastring replace(const char* s, const char* sub, const char* to, uint32 maxrepla
 }
 
 fastring replace(const fastring& s, const char* sub, const char* to, uint32 maxreplace) {
-    const char* from = s.c_str();
-    const char* p = strstr(from, sub);
+    const size_t n = strlen(sub);
+    if (n == 0) return s;
+    const char* from = s.data();
+    const char* const end = from + s.size();
+    const char* p = fast::memmem(from, s.size(), sub, n);
     if (!p) return s;
 
-    size_t n = strlen(sub);
     size_t m = strlen(to);
     fastring x(s.size());
 
@@ -94,9 +93,9 @@ fastring replace(const fastring& s, const char* sub, const char* to, uint32 maxr
         x.append(from, p - from).append(to, m);
         from = p + n;
         if (--maxreplace == 0) break;
-    } while ((p = strstr(from, sub)));
+    } while ((p = fast::memmem(from, end - from, sub, n)));
 
-    if (from < s.data() + s.size()) x.append(from);
+    if (from < end) x.append(from, end - from);
     return x;
 }
 
@@ -275,18 +274,37 @@ inline int _Shift(char c) {
     }
 }
 
+// read a decimal of 18 digits at most, which never overflows, at the beginning
+// of [s, e), return the end of it, or NULL for others, which are left to
+// strtoll(), as it takes spaces, '+', hex and octal (beginning with '0').
+inline const char* _read_dec(const char* s, const char* e, uint64& v) {
+    if (*s == '0' && s + 1 == e) { v = 0; return e; }
+    if (*s < '1' || *s > '9') return 0;
+    const char* p = fast::read_digits(s, e, v);
+    return p - s <= 18 ? p : 0;
+}
+
 int64 to_int64(const char* s) {
     _co_reset_error();
     if (!*s) return 0;
 
-    char* end = 0;
-    int64 x = strtoll(s, &end, 0);
-    if (errno != 0) {
-        _co_set_error(errno);
-        return 0;
+    const size_t n = strlen(s);
+    const bool neg = *s == '-';
+    const char* end;
+    int64 x;
+    uint64 v;
+    if ((end = _read_dec(s + neg, s + n, v))) {
+        x = neg ? -(int64)v : (int64)v;
+    } else {
+        char* t = 0;
+        x = strtoll(s, &t, 0);
+        if (errno != 0) {
+            _co_set_error(errno);
+            return 0;
+        }
+        end = t;
     }
 
-    size_t n = strlen(s);
     if (end == s + n) return x;
 
     if (end == s + n - 1) {
@@ -309,14 +327,19 @@ uint64 to_uint64(const char* s) {
     _co_reset_error();
     if (!*s) return 0;
 
-    char* end = 0;
-    uint64 x = strtoull(s, &end, 0);
-    if (errno != 0) {
-        _co_set_error(errno);
-        return 0;
+    const size_t n = strlen(s);
+    const char* end;
+    uint64 x;
+    if (!(end = _read_dec(s, s + n, x))) {
+        char* t = 0;
+        x = strtoull(s, &t, 0);
+        if (errno != 0) {
+            _co_set_error(errno);
+            return 0;
+        }
+        end = t;
     }
 
-    size_t n = strlen(s);
     if (end == s + n) return x;
 
     if (end == s + n - 1) {
@@ -1,61 +1,152 @@
 #include "co/tasked.h"
 #include "co/array.h"
+#include "co/co.h"
+#include "co/small_array.h"
 #include "co/time.h"
 #include "co/thread.h"
+#include <condition_variable>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return r;
+}
+#else
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    return __builtin_ctz(x);
+}
+#endif
 
 class TaskedImpl {
   public:
     typedef std::function<void()> F;
+    typedef Tasked::stats_t stats_t;
 
     struct Task {
-        Task(F&& f, int p, int c)
-            : fun(f), period(p), count(c) {
+        Task(F&& f, int64 p, int64 e)
+            : fun(std::move(f)), period(p), expire(e), next(0), running(false) {
         }
 
         F fun;
-        int period; // in seconds
-        int count;
+        int64 period; // in milliseconds, 0 for tasks run only once
+        int64 expire; // time in ms the task is due
+        Task* next;   // next task in the same slot
+        bool running; // the last run is not done, for tasks run by workers
+    };
+
+    struct Job {
+        Task* task;
+        int64 due;
     };
 
-    TaskedImpl()
-        : _stop(0), _mtx(), _ev(), _t(&TaskedImpl::loop, this) {
+    explicit TaskedImpl(int workers)
+        : _stop(0), _workers(workers), _mtx(), _ev(), _slots(), _bits(), _n(0),
+          _tick(now::ms()), _stats(), _latency(0), _duration(0), _inflight(0),
+          _pool_stop(false), _t(&TaskedImpl::loop, this) {
+        for (int i = 0; i < workers; ++i) {
+            _pool.push_back(co::make<Thread>(&TaskedImpl::work, this));
+        }
     }
 
     ~TaskedImpl() {
         this->stop();
     }
 
-    void run_in(F&& f, int sec) {
-        MutexGuard g(_mtx);
-        _tmp.push_back(co::make<Task>(std::move(f), 0, sec));
-        if (sec <= 0) _ev.signal();
-    }
-
-    void run_every(F&& f, int sec) {
-        MutexGuard g(_mtx);
-        _tmp.push_back(co::make<Task>(std::move(f), sec, sec));
+    void add(F&& f, int64 period, int64 ms) {
+        Task* t = co::make<Task>(std::move(f), period, now::ms() + ms);
+        {
+            MutexGuard g(_mtx);
+            _tmp.push_back(t);
+        }
+        _ev.signal();
     }
 
     void run_at(F&& f, int hour, int minute, int second, bool daily);
 
+    stats_t stats() const;
+
     void stop();
 
   private:
+    enum {
+        kBits = 10,
+        kSlots = 1 << kBits, // slots of 1 ms
+        kMask = kSlots - 1,
+    };
+
     void loop();
 
-    void clear(co::array<Task*>& v) {
-        for (size_t i = 0; i < v.size(); ++i) co::del(v[i]);
-        v.clear();
+    // put the task into the slot of its expiry time
+    void add_task(Task* t) {
+        const uint32 i = (uint32)((t->expire > _tick ? t->expire : _tick) & kMask);
+        t->next = _slots[i];
+        _slots[i] = t;
+        _bits[i >> 5] |= 1u << (i & 31);
+        ++_n;
+    }
+
+    // offset from slot @i to the next non-empty slot, kSlots if none
+    uint32 next_slot(uint32 i) const;
+
+    // run tasks due before or at @now
+    void advance(int64 now);
+
+    // run the task, or pass it to the workers
+    void fire(Task* t, int64 now);
+
+    // run the task and update the statistics
+    void run(Task* t, int64 due);
+
+    // the task is done in a worker, free it if it runs only once
+    void done(Task* t) {
+        if (t->period > 0) {
+            atomic_store(&t->running, false, mo_release);
+        } else {
+            co::del(t);
+        }
+        atomic_dec(&_inflight, mo_acq_rel);
+    }
+
+    // thread of the pool
+    void work();
+
+    static void update_max(int64* p, int64 v) {
+        int64 x = atomic_load(p, mo_relaxed);
+        while (v > x && !atomic_bool_cas(p, x, v, mo_relaxed, mo_relaxed)) {
+            x = atomic_load(p, mo_relaxed);
+        }
     }
 
   private:
-    bool _stop;
+    int _stop;
+    const int _workers;
     Mutex _mtx;
     SyncEvent _ev;
-    Thread _t;
+    co::small_array<Task*, 8> _tmp; // tasks added, moved to the wheel by loop()
+
+    // the timing wheel, only accessed in the timer thread
+    Task* _slots[kSlots];
+    uint32 _bits[kSlots / 32]; // bitmap of non-empty slots
+    size_t _n;                 // number of tasks in the wheel
+    int64 _tick;               // time in ms of the next slot to check
+
+    stats_t _stats;
+    int64 _latency; // sum of latency in us
+    int64 _duration;
+    int _inflight;  // tasks passed to the workers and not done
 
-    co::array<Task*> _tasks;
-    co::array<Task*> _tmp;
+    // jobs for the pool
+    std::mutex _pmtx;
+    std::condition_variable _pcv;
+    co::deque<Job> _jobs;
+    co::array<Thread*> _pool;
+    bool _pool_stop;
+
+    Thread _t;
 };
 
 // if @daily is false, run f() only once, otherwise run f() every day at hour:minute:second
@@ -74,69 +165,181 @@ void TaskedImpl::run_at(F&& f, int hour, int minute, int second, bool daily) {
     if (seconds < now_seconds) seconds += 86400;
     int diff = seconds - now_seconds;
 
-    MutexGuard g(_mtx);
-    _tmp.push_back(co::make<Task>(std::move(f), (daily ? 86400 : 0), diff));
+    this->add(std::move(f), (daily ? 86400 * 1000 : 0), diff * 1000LL);
+}
+
+uint32 TaskedImpl::next_slot(uint32 i) const {
+    uint32 w = i >> 5;
+    uint32 x = _bits[w] & (~0u << (i & 31));
+    for (uint32 k = 0; k <= kSlots / 32; ++k) {
+        if (x) return (((w << 5) + _find_lsb(x)) - i) & kMask;
+        w = (w + 1) & (kSlots / 32 - 1);
+        x = _bits[w];
+    }
+    return kSlots;
+}
+
+void TaskedImpl::advance(int64 now) {
+    while (_tick <= now) {
+        if (_n == 0) { _tick = now + 1; return; }
+        const uint32 d = this->next_slot((uint32)(_tick & kMask));
+        if (_tick + d > now) { _tick = now + 1; return; }
+        _tick += d;
+
+        // tasks in the slot due later are put back
+        const uint32 i = (uint32)(_tick & kMask);
+        Task* t = _slots[i];
+        _slots[i] = 0;
+        _bits[i >> 5] &= ~(1u << (i & 31));
+        while (t) {
+            Task* const next = t->next;
+            --_n;
+            if (t->expire <= _tick) {
+                this->fire(t, now);
+            } else {
+                this->add_task(t);
+            }
+            t = next;
+        }
+        ++_tick;
+    }
+}
+
+void TaskedImpl::fire(Task* t, int64 now) {
+    const int64 due = t->expire;
+    const int64 period = t->period;
+    if (_workers == 0) {
+        this->run(t, due);
+        if (period == 0) { co::del(t); return; }
+        now = now::ms(); // the task may take a while
+    } else if (period > 0 && atomic_load(&t->running, mo_acquire)) {
+        atomic_inc(&_stats.overruns, mo_relaxed);
+    } else {
+        if (period > 0) atomic_store(&t->running, true, mo_relaxed);
+        atomic_inc(&_inflight, mo_relaxed);
+        if (_workers == Tasked::in_go) {
+            go([this, t, due]() {
+                this->run(t, due);
+                this->done(t);
+            });
+        } else {
+            {
+                std::lock_guard<std::mutex> g(_pmtx);
+                _jobs.push_back(Job{ t, due });
+            }
+            _pcv.notify_one();
+        }
+        if (period == 0) return; // freed by done()
+    }
+
+    // runs missed are skipped and counted as overruns
+    t->expire = due + period;
+    if (t->expire <= now) {
+        const int64 n = (now - t->expire) / period + 1;
+        atomic_add(&_stats.overruns, (uint64)n, mo_relaxed);
+        t->expire += n * period;
+    }
+    this->add_task(t);
+}
+
+void TaskedImpl::run(Task* t, int64 due) {
+    const int64 beg = now::us();
+    t->fun();
+    const int64 dur = now::us() - beg;
+    const int64 lat = beg - due * 1000;
+    atomic_inc(&_stats.runs, mo_relaxed);
+    atomic_add(&_latency, lat > 0 ? lat : 0, mo_relaxed);
+    atomic_add(&_duration, dur, mo_relaxed);
+    update_max(&_stats.max_latency_us, lat);
+    update_max(&_stats.max_duration_us, dur);
+}
+
+void TaskedImpl::work() {
+    std::unique_lock<std::mutex> g(_pmtx);
+    while (true) {
+        while (_jobs.empty() && !_pool_stop) _pcv.wait(g);
+        if (_jobs.empty()) break; // stopped, and jobs are all done
+        const Job j = _jobs.front();
+        _jobs.pop_front();
+        g.unlock();
+        this->run(j.task, j.due);
+        this->done(j.task);
+        g.lock();
+    }
 }
 
 void TaskedImpl::loop() {
-    int64 ms = 0;
-    int sec = 0;
-    Timer t;
-    co::array<Task*> tmp;
+    co::small_array<Task*, 8> tmp;
 
     while (!_stop) {
-        t.restart();
         {
             MutexGuard g(_mtx);
             if (!_tmp.empty()) _tmp.swap(tmp);
         }
 
         if (!tmp.empty()) {
-            _tasks.push_back(tmp.data(), tmp.size());
+            for (size_t i = 0; i < tmp.size(); ++i) this->add_task(tmp[i]);
             tmp.clear();
         }
 
-        if (ms >= 1000) {
-            sec = (int) (ms / 1000);
-            ms -= sec * 1000;
-        }
+        const int64 now = now::ms();
+        this->advance(now);
 
-        for (size_t i = 0; i < _tasks.size();) {
-            Task* task = _tasks[i];
-            if ((task->count -= sec) <= 0) {
-                task->fun();
-                if (task->period > 0) {
-                    task->count = task->period;
-                    ++i;
-                } else {
-                    co::del(task);
-                    if (i != _tasks.size() - 1) _tasks[i] = _tasks.back();
-                    // remove the tail task, don't ++i here.
-                    _tasks.pop_back();
-                }
-            } else {
-                ++i;
-            }
+        // sleep until the next non-empty slot, or a task is added
+        uint32 ms = 1000;
+        if (_n > 0) {
+            const uint32 d = this->next_slot((uint32)(_tick & kMask));
+            const int64 x = _tick + d - now::ms();
+            ms = x <= 0 ? 0 : (x < 1000 ? (uint32)x : 1000);
         }
-
-        _ev.wait(1000);
-        if (_stop) return;
-        ms += t.ms();
+        if (ms > 0) _ev.wait(ms);
     }
 }
 
+TaskedImpl::stats_t TaskedImpl::stats() const {
+    stats_t s;
+    s.runs = atomic_load(&_stats.runs, mo_relaxed);
+    s.overruns = atomic_load(&_stats.overruns, mo_relaxed);
+    s.max_latency_us = atomic_load(&_stats.max_latency_us, mo_relaxed);
+    s.max_duration_us = atomic_load(&_stats.max_duration_us, mo_relaxed);
+    s.avg_latency_us = s.runs ? atomic_load(&_latency, mo_relaxed) / (int64)s.runs : 0;
+    s.avg_duration_us = s.runs ? atomic_load(&_duration, mo_relaxed) / (int64)s.runs : 0;
+    return s;
+}
+
 void TaskedImpl::stop() {
     if (atomic_swap(&_stop, 1) == 0) {
         _ev.signal();
         _t.join();
+
+        // jobs queued are done before the threads exit
+        {
+            std::lock_guard<std::mutex> g(_pmtx);
+            _pool_stop = true;
+        }
+        _pcv.notify_all();
+        for (size_t i = 0; i < _pool.size(); ++i) co::del(_pool[i]);
+        _pool.clear();
+        while (atomic_load(&_inflight, mo_acquire) > 0) sleep::ms(1);
+
+        for (uint32 i = 0; i < kSlots; ++i) {
+            for (Task* t = _slots[i]; t;) {
+                Task* const next = t->next;
+                co::del(t);
+                t = next;
+            }
+            _slots[i] = 0;
+        }
+        _n = 0;
+
         MutexGuard g(_mtx);
-        this->clear(_tasks);
-        this->clear(_tmp);
+        for (size_t i = 0; i < _tmp.size(); ++i) co::del(_tmp[i]);
+        _tmp.clear();
     }
 }
 
-Tasked::Tasked() {
-    _p = co::make<TaskedImpl>();
+Tasked::Tasked(int workers) {
+    _p = co::make<TaskedImpl>(workers);
 }
 
 Tasked::~Tasked() {
@@ -147,11 +350,19 @@ Tasked::~Tasked() {
 }
 
 void Tasked::run_in(F&& f, int sec) {
-    ((TaskedImpl*)_p)->run_in(std::move(f), sec);
+    ((TaskedImpl*)_p)->add(std::move(f), 0, sec * 1000LL);
 }
 
 void Tasked::run_every(F&& f, int sec) {
-    ((TaskedImpl*)_p)->run_every(std::move(f), sec);
+    ((TaskedImpl*)_p)->add(std::move(f), sec * 1000LL, sec * 1000LL);
+}
+
+void Tasked::run_in_ms(F&& f, int64 ms) {
+    ((TaskedImpl*)_p)->add(std::move(f), 0, ms);
+}
+
+void Tasked::run_every_ms(F&& f, int64 ms) {
+    ((TaskedImpl*)_p)->add(std::move(f), ms, ms);
 }
 
 void Tasked::run_at(F&& f, int hour, int minute, int second) {
@@ -162,6 +373,10 @@ void Tasked::run_daily(F&& f, int hour, int minute, int second) {
     ((TaskedImpl*)_p)->run_at(std::move(f), hour, minute, second, true);
 }
 
+Tasked::stats_t Tasked::stats() const {
+    return ((TaskedImpl*)_p)->stats();
+}
+
 void Tasked::stop() {
     ((TaskedImpl*)_p)->stop();
 }
@@ -20,6 +20,12 @@ inline int64 us() {
     return static_cast<int64>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
 }
 
+inline int64 ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<int64>(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
 #else
 inline int64 ms() {
     return epoch::ms();
@@ -28,6 +34,10 @@ inline int64 ms() {
 inline int64 us() {
     return epoch::us();
 }
+
+inline int64 ns() {
+    return epoch::us() * 1000;
+}
 #endif
 
 } // _Mono
@@ -40,6 +50,10 @@ int64 us() {
     return _Mono::us();
 }
 
+int64 ns() {
+    return _Mono::ns();
+}
+
 fastring str(const char* fm) {
     time_t x = time(0);
     struct tm t;
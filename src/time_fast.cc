@@ -0,0 +1,175 @@
+#include "co/time.h"
+#include "co/atomic.h"
+#include <atomic>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define _CO_TSC_X86
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#include <cpuid.h>
+#define _CO_TSC_X86
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define _CO_TSC_ARM
+#endif
+
+namespace now {
+namespace _Tsc {
+
+#if defined(_CO_TSC_X86)
+inline uint64 ticks() { return __rdtsc(); }
+
+// the TSC runs at a constant rate in all P/C states, cpuid 0x80000007 edx:8
+inline bool supported() {
+  #ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0x80000000);
+    if ((unsigned)r[0] < 0x80000007u) return false;
+    __cpuid(r, 0x80000007);
+    return (r[3] >> 8) & 1;
+  #else
+    unsigned a, b, c, d;
+    if (__get_cpuid_max(0x80000000u, 0) < 0x80000007u) return false;
+    __cpuid(0x80000007u, a, b, c, d);
+    return (d >> 8) & 1;
+  #endif
+}
+
+#elif defined(_CO_TSC_ARM)
+inline uint64 ticks() {
+    uint64 v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+}
+
+// the generic timer is always there and runs at a constant rate
+inline bool supported() { return true; }
+
+#else
+inline uint64 ticks() { return 0; }
+inline bool supported() { return false; }
+#endif
+
+/**
+ * ns = base_ns + ((ticks - base_ticks) * mult >> 32)
+ *   - The parameters are updated by a seqlock, in recalibrate(), once ticks
+ *     are more than a period past base_ticks, so the product never overflows.
+ *   - The new base is the estimate at that time, not now::ns(), and mult is
+ *     set to cover the error between them in the next period, thus the
+ *     result is continuous.
+ */
+class Clock {
+  public:
+    static const int64 kPeriodNs = 100 * 1000 * 1000;
+    static const int64 kMaxSlewNs = kPeriodNs / 100;
+
+    Clock() : _seq(0), _base_ticks(0), _base_ns(0), _mult(0), _period(0) {
+        _native = supported();
+        if (_native) this->calibrate();
+    }
+
+    bool native() const { return _native; }
+
+    int64 ns() {
+        if (!_native) return now::ns();
+        for (;;) {
+            const uint32 s = atomic_load(&_seq, mo_acquire);
+            if (s & 1) return now::ns(); // being recalibrated
+            const uint64 bt = atomic_load(&_base_ticks, mo_relaxed);
+            const int64 bn = atomic_load(&_base_ns, mo_relaxed);
+            const uint64 m = atomic_load(&_mult, mo_relaxed);
+            const uint64 p = atomic_load(&_period, mo_relaxed);
+            const uint64 t = ticks();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (atomic_load(&_seq, mo_relaxed) != s) continue;
+
+            const uint64 d = t - bt;
+            if (d <= p && (int64)d >= 0) return bn + (int64)((d * m) >> 32);
+            return this->recalibrate(s);
+        }
+    }
+
+  private:
+    // a pair of now::ns() and ticks read at about the same time
+    void sample(uint64& t, int64& n) {
+        const uint64 t0 = ticks();
+        n = now::ns();
+        const uint64 t1 = ticks();
+        t = t0 + (t1 - t0) / 2;
+    }
+
+    // the first rate is measured for 1 ms
+    void calibrate() {
+        this->sample(_t0, _n0);
+        uint64 t;
+        int64 n;
+        do { this->sample(t, n); } while (n - _n0 < 1000000);
+        const double r = (double)(n - _n0) / (double)(t - _t0); // ns per tick
+        if (!(r > 0)) { _native = false; return; }
+        _base_ticks = t;
+        _base_ns = n;
+        _mult = (uint64)(r * 4294967296.0);
+        _period = (uint64)(kPeriodNs / r);
+    }
+
+    int64 recalibrate(uint32 s) {
+        if (!atomic_bool_cas(&_seq, s, s + 1, mo_acquire, mo_relaxed)) {
+            return now::ns();
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64 t;
+        int64 n;
+        this->sample(t, n);
+        const uint64 d = t - _base_ticks;
+        const double r = (double)(n - _n0) / (double)(t - _t0);
+        int64 est = _base_ns + (int64)((double)d * (double)_mult / 4294967296.0);
+
+        // slew the error out in the next period, jump forward if it is too
+        // large, e.g. after the system is suspended
+        int64 err = n - est;
+        if (err > kMaxSlewNs * 100) { est = n; err = 0; }
+        if (err > kMaxSlewNs) err = kMaxSlewNs;
+        if (err < -kMaxSlewNs) err = -kMaxSlewNs;
+
+        if (r > 0 && (int64)d >= 0) {
+            const double k = (double)(kPeriodNs + err) / kPeriodNs;
+            atomic_store(&_base_ticks, t, mo_relaxed);
+            atomic_store(&_base_ns, est, mo_relaxed);
+            atomic_store(&_mult, (uint64)(r * k * 4294967296.0), mo_relaxed);
+            atomic_store(&_period, (uint64)(kPeriodNs / r), mo_relaxed);
+        } else { // the counter went backwards, start over from now::ns()
+            est = n;
+            atomic_store(&_base_ticks, t, mo_relaxed);
+            atomic_store(&_base_ns, n, mo_relaxed);
+        }
+        atomic_store(&_seq, s + 2, mo_release);
+        return est;
+    }
+
+    uint32 _seq;
+    uint64 _base_ticks;
+    int64 _base_ns;
+    uint64 _mult;   // ns per tick << 32
+    uint64 _period; // ticks of kPeriodNs
+    uint64 _t0;     // the first sample, to measure the rate
+    int64 _n0;
+    bool _native;
+};
+
+inline Clock& tsc_clock() {
+    static Clock c;
+    return c;
+}
+
+} // _Tsc
+
+int64 fast_ns() {
+    return _Tsc::tsc_clock().ns();
+}
+
+bool fast_ns_native() {
+    return _Tsc::tsc_clock().native();
+}
+
+} // now
@@ -41,6 +41,12 @@ inline int64 us() {
     return (count / freq) * 1000000 + (count % freq * 1000000 / freq);
 }
 
+inline int64 ns() {
+    int64 count = _QueryCounter();
+    const int64& freq = _Frequency();
+    return (count / freq) * 1000000000 + (count % freq * 1000000000 / freq);
+}
+
 } // _Mono
 
 int64 ms() {
@@ -51,6 +57,10 @@ int64 us() {
     return _Mono::us();
 }
 
+int64 ns() {
+    return _Mono::ns();
+}
+
 fastring str(const char* fm) {
     int64 x = time(0);
     struct tm t;
@@ -0,0 +1,280 @@
+#include "co/tracing.h"
+#include "co/atomic.h"
+#include "co/co.h"
+#include "co/json.h"
+#include "co/log.h"
+#include "co/mem.h"
+#include "co/metrics.h"
+#include "co/random.h"
+#include "co/thread.h"
+#include "co/time.h"
+
+DEF_double(trace_sample_rate, 0, ">>#0 rate of requests without a trace context that start a new trace, 0 to 1, "
+    "requests with a context are sampled as the caller says");
+DEF_uint32(trace_flush_ms, 1000, ">>#0 finished spans are passed to the exporter every this many ms");
+DEF_uint32(trace_buffer_size, 8192, ">>#0 max finished spans kept in each thread before they are exported, "
+    "spans are dropped beyond it");
+
+DEF_counter(co_trace_spans_total, "spans recorded");
+DEF_counter(co_trace_dropped_total, "spans dropped as the buffer of the thread was full");
+
+namespace tracing {
+namespace xx {
+
+static const char kHex[] = "0123456789abcdef";
+
+inline int hex(char c) {
+    if ('0' <= c && c <= '9') return c - '0';
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    return -1; // upper case is not allowed
+}
+
+inline bool get_hex(const char* s, size_t n, uint64& v) {
+    uint64 x = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const int h = hex(s[i]);
+        if (h < 0) return false;
+        x = (x << 4) | (uint64)h;
+    }
+    v = x;
+    return true;
+}
+
+inline void put_hex(char* s, uint64 v, size_t n) {
+    for (size_t i = n; i > 0; --i, v >>= 4) s[i - 1] = kHex[v & 15];
+}
+
+// a random id that is not zero
+inline uint64 new_id() {
+    uint64 x;
+    do { x = co::thread_rand().next(); } while (x == 0);
+    return x;
+}
+
+inline int cls_key() {
+    static int k = co::cls_key(0);
+    return k;
+}
+
+// spans finished in a thread, buffers of exited threads are reused
+struct Buffer {
+    Buffer* next;
+    uint32 busy;
+    ::Mutex mtx;
+    co::vector<span_t> spans;
+};
+
+struct BufferRef {
+    BufferRef() : p(0) {}
+    ~BufferRef() { if (p) atomic_store(&p->busy, 0u, mo_release); }
+    Buffer* p;
+};
+
+class Tracer {
+  public:
+    Tracer() : _head(0), _started(false) {
+        _exporter = [](const span_t* s, size_t n) { Tracer::write_log(s, n); };
+    }
+    ~Tracer() = delete;
+
+    void push(const span_t& s);
+    void flush();
+
+    void set_exporter(std::function<void(const span_t*, size_t)>&& f) {
+        ::MutexGuard g(_mtx);
+        _exporter = std::move(f);
+    }
+
+  private:
+    Buffer* thread_buffer();
+    static void write_log(const span_t* s, size_t n);
+
+    Buffer* _head;
+    bool _started; // the coroutine draining the buffers was started
+    ::Mutex _mtx;  // for the exporter
+    co::vector<span_t> _spans;
+    std::function<void(const span_t*, size_t)> _exporter;
+};
+
+inline Tracer& tracer() {
+    static auto t = co::static_new<Tracer>();
+    return *t;
+}
+
+Buffer* Tracer::thread_buffer() {
+    static __thread Buffer* p = 0;
+    if (p) return p;
+    static thread_local BufferRef r;
+
+    Buffer* x = atomic_load(&_head, mo_acquire);
+    for (; x; x = x->next) {
+        if (atomic_load(&x->busy, mo_relaxed) == 0 && atomic_bool_cas(&x->busy, 0u, 1u)) break;
+    }
+    if (!x) {
+        x = co::static_new<Buffer>();
+        x->busy = 1;
+        do {
+            x->next = atomic_load(&_head, mo_relaxed);
+        } while (!atomic_bool_cas(&_head, x->next, x, mo_release, mo_relaxed));
+    }
+    return p = r.p = x;
+}
+
+void Tracer::push(const span_t& s) {
+    Buffer* const b = this->thread_buffer();
+    bool ok;
+    {
+        ::MutexGuard g(b->mtx);
+        ok = b->spans.size() < FLG_trace_buffer_size;
+        if (ok) b->spans.push_back(s);
+    }
+    ok ? MET_co_trace_spans_total.inc() : MET_co_trace_dropped_total.inc();
+
+    if (unlikely(!atomic_load(&_started, mo_relaxed)) && atomic_bool_cas(&_started, false, true)) {
+        go([this]() {
+            while (true) {
+                co::sleep(FLG_trace_flush_ms > 0 ? FLG_trace_flush_ms : 1);
+                this->flush();
+            }
+        });
+    }
+}
+
+void Tracer::flush() {
+    ::MutexGuard g(_mtx);
+    for (Buffer* b = atomic_load(&_head, mo_acquire); b; b = b->next) {
+        ::MutexGuard m(b->mtx);
+        if (!b->spans.empty()) {
+            _spans.insert(_spans.end(), b->spans.begin(), b->spans.end());
+            b->spans.clear();
+        }
+    }
+    if (_spans.empty()) return;
+
+    // times were taken by now::fast_ns(), the monotonic clock
+    const int64 off = epoch::us() * 1000 - now::fast_ns();
+    for (size_t i = 0; i < _spans.size(); ++i) {
+        _spans[i].beg_ns += off;
+        _spans[i].end_ns += off;
+    }
+    if (_exporter) _exporter(_spans.data(), _spans.size());
+    _spans.clear();
+}
+
+void Tracer::write_log(const span_t* s, size_t n) {
+    static const char* kinds[] = { "internal", "server", "client" };
+    char id[33];
+    for (size_t i = 0; i < n; ++i) {
+        const span_t& x = s[i];
+        Json j;
+        put_hex(id, x.trace_hi, 16);
+        put_hex(id + 16, x.trace_lo, 16);
+        id[32] = '\0';
+        j.add_member("trace", id);
+        put_hex(id, x.id, 16);
+        id[16] = '\0';
+        j.add_member("id", id);
+        if (x.parent_id) {
+            put_hex(id, x.parent_id, 16);
+            j.add_member("parent", id);
+        }
+        j.add_member("name", x.name);
+        j.add_member("kind", kinds[x.kind < 3 ? x.kind : 0]);
+        j.add_member("beg_ns", x.beg_ns);
+        j.add_member("dur_ns", x.end_ns - x.beg_ns);
+        j.add_member("status", x.status);
+        TLOG("trace") << j;
+    }
+}
+
+} // xx
+
+bool parse(const char* s, size_t n, context_t& c) {
+    // version 00 has exactly 55 bytes, later versions may append fields
+    if (n < kTraceparentSize || s[2] != '-' || s[35] != '-' || s[52] != '-') return false;
+    if (n > kTraceparentSize && ((s[0] == '0' && s[1] == '0') || s[55] != '-')) return false;
+    uint64 v, f;
+    if (!xx::get_hex(s, 2, v) || v == 0xff) return false;
+    if (!xx::get_hex(s + 3, 16, c.trace_hi) || !xx::get_hex(s + 19, 16, c.trace_lo)) return false;
+    if (!xx::get_hex(s + 36, 16, c.span_id) || !xx::get_hex(s + 53, 2, f)) return false;
+    c.flags = (uint8)f;
+    return c.valid();
+}
+
+void format(const context_t& c, char* buf) {
+    buf[0] = '0'; buf[1] = '0'; buf[2] = '-';
+    xx::put_hex(buf + 3, c.trace_hi, 16);
+    xx::put_hex(buf + 19, c.trace_lo, 16);
+    buf[35] = '-';
+    xx::put_hex(buf + 36, c.span_id, 16);
+    buf[52] = '-';
+    xx::put_hex(buf + 53, c.flags, 2);
+    buf[55] = '\0';
+}
+
+Span::Span(const char* name, int kind) : _rec(false), _cur(false) {
+    const Span* const p = current();
+    if (!p) return;
+    _s.trace_hi = p->_s.trace_hi;
+    _s.trace_lo = p->_s.trace_lo;
+    _s.parent_id = p->_s.id;
+    this->start(name, kind);
+}
+
+Span::Span(const context_t* parent, const char* name, int kind) : _rec(false), _cur(false) {
+    if (parent && parent->valid()) {
+        if (!parent->sampled()) return;
+        _s.trace_hi = parent->trace_hi;
+        _s.trace_lo = parent->trace_lo;
+        _s.parent_id = parent->span_id;
+    } else {
+        const double r = FLG_trace_sample_rate;
+        if (r <= 0) return;
+        if (r < 1 && (double)co::thread_rand().next() >= r * 18446744073709551616.0) return;
+        _s.trace_hi = co::thread_rand().next();
+        _s.trace_lo = xx::new_id();
+        _s.parent_id = 0;
+    }
+    this->start(name, kind);
+}
+
+void Span::start(const char* name, int kind) {
+    _rec = true;
+    _s.id = xx::new_id();
+    _s.status = 0;
+    _s.kind = (uint8)kind;
+    this->set_name(name, strlen(name));
+    if (co::scheduler()) {
+        _prev = co::cls_get(xx::cls_key());
+        co::cls_set(xx::cls_key(), this);
+        _cur = true;
+    }
+    _s.beg_ns = now::fast_ns();
+}
+
+Span::~Span() {
+    if (!_rec) return;
+    _s.end_ns = now::fast_ns();
+    if (_cur) co::cls_set(xx::cls_key(), _prev);
+    xx::tracer().push(_s);
+}
+
+void Span::set_name(const char* s, size_t n) {
+    if (n >= sizeof(_s.name)) n = sizeof(_s.name) - 1;
+    memcpy(_s.name, s, n);
+    _s.name[n] = '\0';
+}
+
+const Span* current() {
+    return co::scheduler() ? (const Span*) co::cls_get(xx::cls_key()) : 0;
+}
+
+void set_exporter(std::function<void(const span_t* s, size_t n)>&& f) {
+    xx::tracer().set_exporter(std::move(f));
+}
+
+void flush() {
+    xx::tracer().flush();
+}
+
+} // tracing
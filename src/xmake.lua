@@ -13,9 +13,14 @@ target("libco")
     add_files("**.cc")
     add_options("with_openssl")
     add_options("with_libcurl")
+    add_options("with_zlib")
+    add_options("with_brotli")
+    add_options("with_zstd")
+    add_options("with_lz4")
     if not is_plat("windows") then
         add_options("fpic")
     end
+    add_options("override_malloc")
 
     if has_config("with_libcurl") then
         add_defines("HAS_LIBCURL")
@@ -27,6 +32,26 @@ target("libco")
         add_packages("openssl")
     end 
 
+    if has_config("with_zlib") then
+        add_defines("HAS_ZLIB")
+        add_packages("zlib")
+    end
+
+    if has_config("with_brotli") then
+        add_defines("HAS_BROTLI")
+        add_packages("brotli")
+    end
+
+    if has_config("with_zstd") then
+        add_defines("HAS_ZSTD")
+        add_packages("zstd")
+    end
+
+    if has_config("with_lz4") then
+        add_defines("HAS_LZ4")
+        add_packages("lz4")
+    end
+
     if is_kind("shared") then
         set_symbols("debug", "hidden")
         add_defines("BUILDING_CO_SHARED")
@@ -75,3 +100,7 @@ target("libco")
     if is_plat("macosx", "iphoneos") then
         add_files("co/fishhook/fishhook.c")
     end
+
+    if is_plat("linux") and has_config("override_malloc") then
+        add_defines("CO_OVERRIDE_MALLOC")
+    end
@@ -0,0 +1,216 @@
+// micro benchmarks of coroutine primitives
+//   ./benchmark                  # human readable
+//   ./benchmark -json            # one json object per line, for comparing releases
+//   ./benchmark -n 1000000 -co_sched_num 4
+//   ./benchmark -live 0          # skip the benchmark with 1M live coroutines
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 100000, "number of operations of each benchmark");
+DEF_bool(json, false, "print results as json, one object per line");
+DEF_uint32(live, 1000000, "number of live coroutines in the resume benchmark, 0 to skip it");
+DEC_uint32(co_shared_stack_num);
+
+// print result of a benchmark, @ops operations done in @us microseconds
+void report(const char* name, int scheds, int64 ops, int64 us, const char* extra="") {
+    if (us <= 0) us = 1;
+    const double ns = us * 1000.0 / ops;
+    const double qps = ops * 1000000.0 / us;
+    if (FLG_json) {
+        COUT << "{\"name\":\"" << name << "\",\"scheds\":" << scheds << ",\"ops\":" << ops
+             << ",\"ns_per_op\":" << ns << ",\"ops_per_sec\":" << (int64)qps << extra << '}';
+    } else {
+        COUT << name << "  scheds: " << scheds << "  " << ns << " ns/op  " << (int64)qps << " ops/s";
+    }
+}
+
+// co::sleep(0) in @c coroutines on each of @k schedulers, each sleep is a switch
+// to the scheduler and back. When there are more coroutines than shared stacks,
+// stacks are saved and restored on switches.
+void bench_switch(const char* name, int k, int c) {
+    auto& s = co::schedulers();
+    const uint32 n = FLG_n / (k * c) + 1;
+    uint64 copied = 0;
+    for (int i = 0; i < k; ++i) copied += s[i]->stats().bytes_copied;
+
+    co::WaitGroup wg;
+    wg.add(k * c);
+    Timer t;
+    for (int i = 0; i < k; ++i) {
+        for (int j = 0; j < c; ++j) {
+            s[i]->go([wg, n]() {
+                for (uint32 x = 0; x < n; ++x) co::sleep(0);
+                wg.done();
+            });
+        }
+    }
+    wg.wait();
+    const int64 us = t.us();
+
+    uint64 x = 0;
+    for (int i = 0; i < k; ++i) x += s[i]->stats().bytes_copied;
+    copied = x - copied;
+    const int64 ops = (int64)n * k * c;
+    fastring extra;
+    if (FLG_json) extra << ",\"bytes_copied_per_op\":" << (copied / ops);
+    report(name, k, ops, us, extra.c_str());
+}
+
+// @c live coroutines on one scheduler are woken up in rounds, each coroutine 
+// is resumed once a round, in the order they are woken up. With so many of 
+// them, the control blocks of the coroutines are not in the cache, and the 
+// cost of a resume depends on the cache lines of a Coroutine it touches.
+void bench_resume_live(uint32 c) {
+    auto s = co::schedulers()[0];
+    const int rounds = 4;
+    co::vector<co::Event> evs;
+    evs.reserve(c);
+    for (uint32 i = 0; i < c; ++i) evs.push_back(co::Event());
+    co::WaitGroup wg, started;
+    wg.add(c);
+    started.add(c);
+    for (uint32 i = 0; i < c; ++i) {
+        co::Event* ev = &evs[i];
+        s->go([ev, wg, started, rounds]() {
+            started.done();
+            for (int r = 0; r < rounds; ++r) ev->wait();
+            wg.done();
+        });
+    }
+    started.wait();
+
+    Timer t;
+    wg.add(1);
+    s->go([&evs, wg, c, rounds]() {
+        for (int r = 0; r < rounds; ++r) {
+            for (uint32 i = 0; i < c; ++i) evs[i].signal();
+            co::sleep(0); // let all of them run before the next round
+        }
+        wg.done();
+    });
+    wg.wait();
+    report("resume_live", 1, (int64)c * rounds, t.us());
+}
+
+// create coroutines with go() from a non-scheduler thread
+void bench_go(int k) {
+    auto& s = co::schedulers();
+    co::WaitGroup wg;
+    wg.add(FLG_n);
+    Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        s[i % k]->go([wg]() { wg.done(); });
+    }
+    wg.wait();
+    report("go", k, FLG_n, t.us());
+}
+
+// round trip of signal/wait between two coroutines, in the same scheduler if k
+// is 1, or in two schedulers
+void bench_event(int k) {
+    auto& s = co::schedulers();
+    co::Event a, b;
+    co::WaitGroup wg;
+    wg.add(2);
+    Timer t;
+    s[0]->go([a, b, wg]() {
+        for (uint32 i = 0; i < FLG_n; ++i) { a.signal(); b.wait(); }
+        wg.done();
+    });
+    s[k - 1]->go([a, b, wg]() {
+        for (uint32 i = 0; i < FLG_n; ++i) { a.wait(); b.signal(); }
+        wg.done();
+    });
+    wg.wait();
+    report("event_round_trip", k, FLG_n, t.us());
+}
+
+// ping-pong between two coroutines with two channels
+void bench_chan(int k) {
+    auto& s = co::schedulers();
+    co::Chan<int> a(1), b(1);
+    co::WaitGroup wg;
+    wg.add(2);
+    Timer t;
+    s[0]->go([a, b, wg]() {
+        int v = 0;
+        for (uint32 i = 0; i < FLG_n; ++i) { a << i; b >> v; }
+        wg.done();
+    });
+    s[k - 1]->go([a, b, wg]() {
+        int v = 0;
+        for (uint32 i = 0; i < FLG_n; ++i) { a >> v; b << v; }
+        wg.done();
+    });
+    wg.wait();
+    report("chan_ping_pong", k, FLG_n, t.us());
+}
+
+// lock/unlock by 4 coroutines in each of k schedulers
+void bench_mutex(int k) {
+    auto& s = co::schedulers();
+    const int c = 4 * k;
+    const uint32 n = FLG_n / c + 1;
+    co::Mutex m;
+    int64 v = 0;
+    co::WaitGroup wg;
+    wg.add(c);
+    Timer t;
+    for (int i = 0; i < c; ++i) {
+        s[i % k]->go([m, wg, n, &v]() {
+            for (uint32 x = 0; x < n; ++x) {
+                m.lock();
+                ++v;
+                m.unlock();
+            }
+            wg.done();
+        });
+    }
+    wg.wait();
+    report("mutex_contended", k, v, t.us());
+}
+
+// pop/push of a pool in each of k schedulers
+void bench_pool(int k) {
+    auto& s = co::schedulers();
+    const uint32 n = FLG_n / k + 1;
+    co::Pool p(
+        []() { return (void*) new int(0); },
+        [](void* p) { delete (int*)p; }
+    );
+    co::WaitGroup wg;
+    wg.add(k);
+    Timer t;
+    for (int i = 0; i < k; ++i) {
+        s[i]->go([p, wg, n]() {
+            for (uint32 x = 0; x < n; ++x) p.push(p.pop());
+            wg.done();
+        });
+    }
+    wg.wait();
+    report("pool_pop_push", k, (int64)n * k, t.us());
+    p.clear();
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    // 1, 2, 4, ... up to the number of schedulers
+    const int N = co::scheduler_num();
+    co::vector<int> ks;
+    for (int k = 1; k < N; k <<= 1) ks.push_back(k);
+    ks.push_back(N);
+
+    for (auto k : ks) bench_switch("switch", k, 1);
+    for (auto k : ks) bench_switch("switch_stack_copy", k, FLG_co_shared_stack_num * 2);
+    for (auto k : ks) bench_go(k);
+    bench_event(1);
+    if (N > 1) bench_event(2);
+    bench_chan(1);
+    if (N > 1) bench_chan(2);
+    for (auto k : ks) bench_mutex(k);
+    for (auto k : ks) bench_pool(k);
+    if (FLG_live > 0) bench_resume_live(FLG_live);
+    return 0;
+}
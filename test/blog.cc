@@ -0,0 +1,100 @@
+// decode binary logs written by BLOG with -log_binary
+//   ./blog logs/xx.blog > xx.log
+#include "co/log.h"
+#include "co/fs.h"
+#include "co/cout.h"
+#include "co/hash/crc32c.h"
+
+// site records: |'S'|id|level|line|n|file|n|fmt|
+// log records:  |'L'|id|tid|time|n|args|
+// checksums:    |'C'|n|crc32c of the n bytes before|, with -log_checksum
+struct Site {
+    fastring file;
+    fastring fmt;
+    log::xx::BlogSite s;
+};
+
+static const char* read_u32(const char* p, const char* e, uint32* v) {
+    if (e - p < 4) return NULL;
+    memcpy(v, p, 4);
+    return p + 4;
+}
+
+static const char* read_str(const char* p, const char* e, fastring* s) {
+    uint32 n;
+    if (!(p = read_u32(p, e, &n)) || (size_t)(e - p) < n) return NULL;
+    s->append(p, n);
+    return p + n;
+}
+
+int main(int argc, char** argv) {
+    auto v = flag::init(argc, argv);
+    if (v.empty()) {
+        COUT << "usage: " << argv[0] << " xx.blog";
+        return 0;
+    }
+
+    fs::file f(v[0], 'r');
+    if (!f) {
+        CLOG << "failed to open " << v[0];
+        return 1;
+    }
+
+    const fastring d = f.read((size_t)f.size());
+    const char* p = d.data();
+    const char* const e = p + d.size();
+    co::hash_map<uint32, Site> sites;
+    fastream out(64 * 1024);
+    const char* r = p;
+    uint32 id, tid, n;
+
+    while (p < e) {
+        r = p;
+        const char c = *p++;
+        if (c == 'S') {
+            if (!(p = read_u32(p, e, &id)) || p >= e) { p = NULL; break; }
+            Site& x = sites[id];
+            x.file.clear();
+            x.fmt.clear();
+            x.s.level = *p++;
+            if (!(p = read_u32(p, e, &x.s.line))) break;
+            if (!(p = read_str(p, e, &x.file)) || !(p = read_str(p, e, &x.fmt))) break;
+            x.s.file = x.file.c_str();
+            x.s.fmt = x.fmt.c_str();
+            x.s.id = id;
+        } else if (c == 'L') {
+            if (!(p = read_u32(p, e, &id)) || !(p = read_u32(p, e, &tid))) break;
+            if (e - p < 17) { p = NULL; break; }
+            const char* const t = p;
+            if (!(p = read_u32(p + 17, e, &n)) || (size_t)(e - p) < n) break;
+            auto it = sites.find(id);
+            if (it == sites.end()) {
+                CLOG << "unknown site id " << id << " at offset " << (r - d.data());
+                return 1;
+            }
+            log::xx::blog_format(out, it->second.s, tid, t, p, n);
+            p += n;
+            if (out.size() >= 32 * 1024) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+        } else if (c == 'C') {
+            uint32 crc;
+            if (!(p = read_u32(p, e, &n)) || !(p = read_u32(p, e, &crc))) break;
+            if ((size_t)(r - d.data()) < n || crc32c(r - n, n) != crc) {
+                CLOG << "checksum mismatch at offset " << (r - d.data());
+                return 1;
+            }
+        } else {
+            p = NULL;
+            break;
+        }
+    }
+
+    if (!out.empty()) fwrite(out.data(), 1, out.size(), stdout);
+    if (p != e) { // NULL on errors
+        CLOG << "bad record at offset " << (r - d.data());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// throughput of hash functions and base64 on keys of different sizes
+//   ./hash                  # human readable
+//   ./hash -json            # one json object per line, for comparing releases
+#include "co/hash.h"
+#include "co/cout.h"
+#include "co/flag.h"
+#include "co/time.h"
+
+DEF_uint32(ms, 200, "run each benchmark for about n ms");
+DEF_bool(json, false, "print results as json, one object per line");
+
+// print result of a benchmark, @n hashes of @size bytes done in @us microseconds
+void report(const char* name, size_t size, int64 n, int64 us) {
+    if (us <= 0) us = 1;
+    const double ns = us * 1000.0 / n;
+    const double mbps = (double)size * n / us;
+    if (FLG_json) {
+        COUT << "{\"name\":\"" << name << "\",\"bytes\":" << size << ",\"ns_per_op\":" << ns
+             << ",\"mb_per_sec\":" << mbps << '}';
+    } else {
+        COUT << name << "  " << size << " bytes  " << ns << " ns/op  " << mbps << " MB/s";
+    }
+}
+
+// hash keys of @size bytes at different offsets for about FLG_ms, @m is
+// number of keys hashed by each call of @f
+template <typename F>
+void bench(const char* name, const char* buf, size_t size, F&& f, int m=1) {
+    uint64 x = 0;
+    int64 n = 0;
+    Timer t;
+    do {
+        for (int i = 0; i < 1024; ++i) x += f(buf + (i & 63), size);
+        n += 1024;
+    } while (t.ms() < FLG_ms);
+    const int64 us = t.us();
+    if (x == 7) COUT << x; // do not optimize it out
+    report(name, size, n * m, us);
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    static char buf[32768 + 64];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (char)(i * 131 + 7);
+
+    const size_t sizes[] = { 8, 16, 24, 32, 48, 64, 256, 4096, 32768 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        const size_t n = sizes[i];
+        bench("murmur_hash64", buf, n, [](const char* p, size_t k) { return murmur_hash64(p, k, 0); });
+        bench("wyhash64", buf, n, [](const char* p, size_t k) { return wyhash64(p, k); });
+        bench("crc32c", buf, n, [](const char* p, size_t k) { return crc32c(p, k); });
+        bench("sha256", buf, n, [](const char* p, size_t k) {
+            char r[32];
+            sha256digest(p, k, r);
+            return (uint64)(uint8)r[0];
+        });
+        bench("md5", buf, n, [](const char* p, size_t k) {
+            char r[16];
+            md5digest(p, k, r);
+            return (uint64)(uint8)r[0];
+        });
+        bench("md5_multi/8", buf, n, [](const char* p, size_t k) {
+            const void* s[8] = { p, p + 1, p + 2, p + 3, p + 4, p + 5, p + 6, p + 7 };
+            const size_t m[8] = { k, k, k, k, k, k, k, k };
+            char r[128];
+            md5digest_multi(s, m, 8, r);
+            return (uint64)(uint8)r[0];
+        }, 8);
+    }
+
+    static char out[65536];
+    static fastring enc = base64_encode(buf, 32768);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        const size_t n = sizes[i];
+        bench("base64_encode", buf, n, [](const char* p, size_t k) { return base64_encode(p, k, out); });
+        bench("base64_decode", enc.data(), n, [](const char* p, size_t k) {
+            return base64_decode(p, k & ~(size_t)3, out);
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+// throughput of json::parse() and Json::str()
+//   ./json_bench                       # generated documents
+//   ./json_bench -dir data             # also data/twitter.json, data/citm_catalog.json, data/canada.json
+//   ./json_bench -json                 # one json object per line, for comparing releases
+#include "co/json.h"
+#include "co/cout.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/mem.h"
+#include "co/time.h"
+
+DEF_string(dir, "", "directory of the standard corpora: twitter.json, citm_catalog.json, canada.json");
+DEF_uint32(ms, 300, "run each benchmark for about n ms");
+DEF_bool(json, false, "print results as json, one object per line");
+
+// print result of a benchmark, @n documents of @size bytes done in @us microseconds
+void report(const char* doc, const char* op, size_t size, int64 n, int64 us, uint64 allocs) {
+    if (us <= 0) us = 1;
+    const double mbps = (double)size * n / us; // bytes per us is MB/s
+    const double apd = (double)allocs / n;
+    if (FLG_json) {
+        COUT << "{\"doc\":\"" << doc << "\",\"op\":\"" << op << "\",\"bytes\":" << size
+             << ",\"docs\":" << n << ",\"mb_per_sec\":" << mbps << ",\"allocs_per_doc\":" << apd << '}';
+    } else {
+        COUT << doc << "  " << op << "  " << mbps << " MB/s  " << apd << " allocs/doc";
+    }
+}
+
+// run @f for about FLG_ms, return number of calls
+template <typename F>
+int64 run(F&& f, int64& us, uint64& allocs) {
+    f(); // warm up, free lists of the json allocator are filled
+    int64 n = 0;
+    const uint64 a = co::thread_mem_stats().allocs;
+    Timer t;
+    do {
+        for (int i = 0; i < 8; ++i) f();
+        n += 8;
+    } while (t.ms() < FLG_ms);
+    us = t.us();
+    allocs = co::thread_mem_stats().allocs - a;
+    return n;
+}
+
+void bench(const char* doc, const fastring& s) {
+    int64 us, n;
+    uint64 allocs;
+    {
+        Json v;
+        n = run([&]() { v.parse_from(s); }, us, allocs);
+        report(doc, "parse", s.size(), n, us, allocs);
+    }
+    {
+        json::Document d;
+        n = run([&]() { d.parse(s); }, us, allocs);
+        report(doc, "parse_arena", s.size(), n, us, allocs);
+    }
+    {
+        Json v;
+        n = run([&]() { v.parse_lazy(s); }, us, allocs);
+        report(doc, "parse_lazy", s.size(), n, us, allocs);
+    }
+    {
+        Json v = json::parse(s);
+        fastring r(s.size() * 2);
+        const size_t size = v.str().size();
+        n = run([&]() { r.clear(); v.str(r); }, us, allocs);
+        report(doc, "str", size, n, us, allocs);
+        n = run([&]() { r.clear(); v.msgpack(r); }, us, allocs);
+        report(doc, "msgpack", v.msgpack().size(), n, us, allocs);
+    }
+}
+
+// documents of the same shapes as the standard corpora, in case they are not there
+fastring gen_twitter() {
+    fastring s(1 << 20);
+    s << "{\"statuses\":[";
+    for (int i = 0; i < 100; ++i) {
+        s << "{\"created_at\":\"Sun Aug 31 00:29:15 +0000 2014\",\"id\":" << (505874924095815681LL + i)
+          << ",\"text\":\"@aym0566x \\n\\n\\u540d\\u524d:\\u524d\\u7530\\u3042\\u3086\\u307f " << fastring(60, 'x') << "\""
+          << ",\"truncated\":false,\"in_reply_to_status_id\":null,\"user\":{\"id\":" << (1186275104 + i)
+          << ",\"name\":\"AYUMI\",\"screen_name\":\"ayuu0123\",\"location\":\"\",\"description\":\""
+          << fastring(100, 'd') << "\",\"followers_count\":262,\"friends_count\":252,\"verified\":false,"
+          << "\"profile_image_url\":\"http://pbs.twimg.com/profile_images/497760886795153410/LDjAwR_y_normal.jpeg\"},"
+          << "\"entities\":{\"hashtags\":[],\"user_mentions\":[{\"screen_name\":\"aym0566x\",\"indices\":[0,9]}]},"
+          << "\"retweet_count\":0,\"favorited\":false,\"lang\":\"ja\"},";
+    }
+    s.back() = ']';
+    s << '}';
+    return s;
+}
+
+fastring gen_canada() {
+    fastring s(1 << 20);
+    s << "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+    double x = -65.613616999999977, y = 43.420273000000009;
+    for (int i = 0; i < 200; ++i) {
+        s << '[';
+        for (int j = 0; j < 100; ++j) {
+            x += 0.0001234567890123 * ((i * 7 + j) % 13 - 6);
+            y += 0.0000987654321987 * ((i * 3 + j) % 11 - 5);
+            s << '[';
+            s.maxdp(15) << x;
+            s << ',';
+            s.maxdp(15) << y;
+            s << "],";
+        }
+        s.back() = ']';
+        s << ',';
+    }
+    s.back() = ']';
+    s << "}}]}";
+    return s;
+}
+
+fastring gen_citm() {
+    fastring s(1 << 20);
+    s << "{\"areaNames\":{";
+    for (int i = 0; i < 20; ++i) s << "\"" << (205705993 + i) << "\":\"Arri\\u00e8re-sc\\u00e8ne central\",";
+    s.back() = '}';
+    s << ",\"performances\":[";
+    for (int i = 0; i < 200; ++i) {
+        s << "{\"eventId\":" << (138586341 + i) << ",\"id\":" << (339887544 + i)
+          << ",\"logo\":null,\"name\":null,\"prices\":[{\"amount\":90250,\"audienceSubCategoryId\":337100890,"
+          << "\"seatCategoryId\":338937295},{\"amount\":66500,\"audienceSubCategoryId\":337100890,"
+          << "\"seatCategoryId\":338937296}],\"seatCategories\":[{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]},"
+          << "{\"areaId\":205705998,\"blockIds\":[]}],\"seatCategoryId\":338937295}],\"seatMapImage\":null,"
+          << "\"start\":1372701600000,\"venueCode\":\"PLEYEL_PLEYEL\"},";
+    }
+    s.back() = ']';
+    s << '}';
+    return s;
+}
+
+fastring gen_rpc() {
+    return fastring(
+        "{\"api\":\"HelloWorld.hello\",\"req_id\":12345678,\"token\":\"d41d8cd98f00b204e9800998ecf8427e\","
+        "\"params\":{\"uid\":10086,\"name\":\"hello\",\"ids\":[1,2,3,4,5,6,7,8],\"score\":3.14}}"
+    );
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    const char* corpora[] = { "twitter.json", "citm_catalog.json", "canada.json" };
+    bool found[3] = { false, false, false };
+    if (!FLG_dir.empty()) {
+        for (int i = 0; i < 3; ++i) {
+            fastring path = FLG_dir + "/" + corpora[i];
+            fs::file f;
+            if (!f.open(path, 'r')) { COUT << "not found: " << path; continue; }
+            fastring s = f.read((size_t)f.size());
+            found[i] = true;
+            bench(corpora[i], s);
+        }
+    }
+
+    if (!found[0]) bench("twitter (generated)", gen_twitter());
+    if (!found[1]) bench("citm_catalog (generated)", gen_citm());
+    if (!found[2]) bench("canada (generated)", gen_canada());
+    bench("rpc", gen_rpc());
+    return 0;
+}
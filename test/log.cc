@@ -3,6 +3,7 @@
 #include "co/time.h"
 
 DEF_bool(perf, false, "performance testing");
+DEF_bool(binary, false, "use BLOG in performance testing");
 
 bool static_log() {
     DLOG << "hello static";
@@ -12,6 +13,8 @@ bool static_log() {
 
 bool __ = static_log();
 
+DEF_TLOG_TOPIC(access);
+
 int nested_log() {
     DLOG << ">>>> nested log..";
     return 123;
@@ -25,8 +28,15 @@ int main(int argc, char** argv) {
         COUT << "print 100W logs, every log is about 50 bytes";
 
         Timer t;
-        for (int k = 0; k < 1000000; k++) {
-            LOG << "hello world " << 3;
+        if (!FLG_binary) {
+            for (int k = 0; k < 1000000; k++) {
+                LOG << "hello world " << 3;
+            }
+        } else {
+            // arguments are formatted later by the logging thread
+            for (int k = 0; k < 1000000; k++) {
+                BLOG("hello world {}", 3);
+            }
         }
         int64 write_to_cache = t.us();
 
@@ -46,6 +56,18 @@ int main(int argc, char** argv) {
         LOG << "hello " << nested_log() << "  " << nested_log();
         TLOG("co") << "hello co";
         TLOG("bob") << "hello bob";
+        TLOG(TOPIC_access) << "GET /index.html 200";
+        BLOG("hello {}, {} {} {}", "binary log", 23, 3.14, true);
+        WBLOG("binary warning, {}", fastring("xx"));
+
+        // about 10 logs are written in each round, others are counted
+        for (int k = 0; k < 2; ++k) {
+            for (int i = 0; i < 1000; ++i) {
+                WLOG_RATE_LIMITED(10) << "rate limited " << i;
+                ELOG_EVERY_MS(100) << "every 100ms " << i;
+            }
+            sleep::ms(200);
+        }
     }
 
     return 0;
@@ -0,0 +1,38 @@
+// a cpu-heavy coroutine calls co::preempt_point(), other coroutines in the same
+// scheduler should still run in time
+//   ./preempt                     # the ticker waits until the loop is done
+//   ./preempt -co_preempt_ms=10   # the ticker runs every ~10 ms
+#include "co/co.h"
+#include "co/time.h"
+
+DEF_uint32(ms, 500, "time in ms the coroutine runs without blocking");
+
+DEF_main(argc, argv) {
+    FLG_cout = true;
+
+    co::WaitGroup wg;
+    wg.add(2);
+    auto s = co::next_scheduler();
+    s->go([wg]() {
+        int64 max_late = 0;
+        const int64 t = now::ms();
+        while (now::ms() - t < FLG_ms) {
+            const int64 x = now::ms();
+            co::sleep(1);
+            const int64 late = now::ms() - x - 1;
+            if (max_late < late) max_late = late;
+        }
+        LOG << "max delay of a 1 ms sleep: " << max_late << " ms";
+        wg.done();
+    });
+
+    s->go([wg]() {
+        const int64 t = now::ms();
+        while (now::ms() - t < FLG_ms) co::preempt_point(); // cpu-heavy work
+        wg.done();
+    });
+
+    wg.wait();
+    LOG << "preempts of scheduler " << ((co::Scheduler*)s)->stats().preempts;
+    return 0;
+}
@@ -0,0 +1,45 @@
+// debug handlers on a separate admin port
+//
+// build:
+//   xmake -b admin
+//
+// start the server:
+//   xmake r admin -co_profile -mem_profile_rate 65536
+//
+// try it:
+//   curl 127.0.0.1:6060/debug/
+//   curl 127.0.0.1:6060/debug/sched
+//   curl 127.0.0.1:6060/debug/heap?n=8
+//   curl 127.0.0.1:6060/debug/trace?ms=200 > co.trace.json
+//   curl -X POST -d 2 127.0.0.1:6060/debug/flags/min_log_level
+
+#include "co/admin.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/time.h"
+
+DEF_string(ip, "127.0.0.1", "admin server ip");
+DEF_int32(port, 6060, "admin server port");
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    FLG_cout = true;
+
+    admin::start(FLG_ip.c_str(), FLG_port);
+
+    // some work to look at
+    for (int i = 0; i < 8; ++i) {
+        go([]() {
+            fastring s;
+            while (true) {
+                for (int k = 0; k < 1000; ++k) s.append("hello");
+                s.clear();
+                co::sleep(10);
+            }
+        });
+    }
+
+    while (true) sleep::sec(1024);
+    return 0;
+}
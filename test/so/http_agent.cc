@@ -0,0 +1,63 @@
+#include "co/all.h"
+
+DEF_string(s, "127.0.0.1:80", "server url");
+DEF_string(url, "/", "url of http request");
+DEF_int32(c, 16, "number of coroutines");
+DEF_int32(n, 1000, "number of requests per coroutine");
+DEF_int32(p, 1, "pipeline depth, requests sent together on a connection");
+
+co::WaitGroup wg;
+http::Agent* agent;
+int fails = 0;
+
+void fa() {
+    const int p = FLG_p > 0 ? FLG_p : 1;
+    co::vector<http::Request> req;
+    req.reserve(p);
+    http::Response* res = new http::Response[p];
+    for (int i = 0; i < p; ++i) {
+        req.push_back(http::Request(http::kGet, FLG_url.c_str()));
+    }
+
+    for (int i = 0; i < FLG_n; i += p) {
+        if (!agent->pipeline(req.data(), res, p)) atomic_inc(&fails, mo_relaxed);
+    }
+
+    delete[] res;
+    wg.done();
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    FLG_cout = true;
+
+    agent = new http::Agent(FLG_s.c_str());
+    bool ok = false;
+    wg.add();
+    go([&ok]() {
+        http::Response res;
+        ok = agent->get(FLG_url.c_str(), res);
+        LOG << "response code: " << res.status();
+        LOG << "Content-Type: " << res.header("Content-Type");
+        LOG << "body size: " << res.body_size();
+        wg.done();
+    });
+    wg.wait();
+    if (!ok) {
+        LOG << "get " << FLG_url << " failed";
+        return 0;
+    }
+
+    const int64 t = now::us();
+    wg.add(FLG_c);
+    for (int i = 0; i < FLG_c; ++i) go(fa);
+    wg.wait();
+
+    const int64 us = now::us() - t;
+    const int64 total = (int64)FLG_c * ((FLG_n + FLG_p - 1) / FLG_p * FLG_p);
+    LOG << total << " requests in " << (us / 1000) << " ms, failed: " << fails
+        << ", qps: " << (us > 0 ? total * 1000000 / us : 0);
+
+    delete agent;
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "co/all.h"
+
+// load generator for rpc and http servers, it reports throughput and a
+// latency histogram in json, in one line.
+// usage:
+//   ./load -c 64 -d 10                                    # rpc ping on 127.0.0.1:7788
+//   ./load -s 127.0.0.1:7788 -api HelloWorld.hello -qps 20000 -size 128
+//   ./load -mode http -s http://127.0.0.1:8080 -url /hello -c 64 -o res.json
+
+DEF_string(mode, "rpc", "rpc or http");
+DEF_string(s, "127.0.0.1:7788", "server, ip:port for rpc, or url of the server for http");
+DEF_string(api, "ping", "api of rpc requests");
+DEF_string(url, "/", "url of http requests");
+DEF_int32(c, 16, "concurrency, number of coroutines sending requests");
+DEF_int32(d, 10, "duration in seconds");
+DEF_int32(w, 1, "warm-up in seconds, requests are not measured");
+DEF_int32(qps, 0, "target requests per second, 0 for as fast as possible");
+DEF_int32(size, 0, "bytes of the payload, it is the body of POST for http");
+DEF_string(o, "", "write the report to this file, or to stdout if empty");
+
+// latency histogram in us, with 6 significant bits (about 1.5% error), like
+// HdrHistogram. Values below 128 are exact, larger ones share a bucket with
+// those of the same top 7 bits.
+class Histogram {
+  public:
+    static const int kBuckets = 64 * 40;
+
+    Histogram() : _n(0), _sum(0), _min(-1), _max(0), _counts(kBuckets, 0) {}
+
+    void record(int64 v) {
+        if (v < 0) v = 0;
+        ++_n;
+        _sum += v;
+        if (_min < 0 || v < _min) _min = v;
+        if (v > _max) _max = v;
+        ++_counts[index_of(v)];
+    }
+
+    void merge(const Histogram& h) {
+        if (h._n == 0) return;
+        _n += h._n;
+        _sum += h._sum;
+        if (_min < 0 || h._min < _min) _min = h._min;
+        if (h._max > _max) _max = h._max;
+        for (int i = 0; i < kBuckets; ++i) _counts[i] += h._counts[i];
+    }
+
+    // the value at percentile p, e.g. 99.9
+    int64 percentile(double p) const {
+        if (_n == 0) return 0;
+        int64 k = (int64)(p / 100 * _n + 0.5);
+        if (k < 1) k = 1;
+        int64 x = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            x += _counts[i];
+            if (x >= k) {
+                const int64 v = value_of(i);
+                return v < _max ? v : _max;
+            }
+        }
+        return _max;
+    }
+
+    int64 count() const { return _n; }
+    int64 min() const { return _min < 0 ? 0 : _min; }
+    int64 max() const { return _max; }
+    double mean() const { return _n ? (double)_sum / _n : 0; }
+
+    // non-empty buckets, [[max value of the bucket, count], ...]
+    Json buckets() const {
+        Json a = json::array();
+        for (int i = 0; i < kBuckets; ++i) {
+            if (_counts[i]) a.push_back(Json({ value_of(i), _counts[i] }));
+        }
+        return a;
+    }
+
+  private:
+    static int index_of(int64 v) {
+        if (v < 128) return (int)v;
+        int m = 7; // the top bit
+        while (m < 45 && (v >> (m + 1)) != 0) ++m;
+        if (m >= 45) return kBuckets - 1;
+        return (m - 5) * 64 + (int)((v >> (m - 6)) & 63);
+    }
+
+    // the largest value of bucket i
+    static int64 value_of(int i) {
+        if (i < 128) return i;
+        const int m = i / 64 + 5;
+        return ((int64)(64 + i % 64) << (m - 6)) + ((int64)1 << (m - 6)) - 1;
+    }
+
+    int64 _n;
+    int64 _sum;
+    int64 _min;
+    int64 _max;
+    co::vector<int64> _counts;
+};
+
+// histograms and counters of each scheduler, no lock is needed
+struct Stats {
+    Stats() : errors(0) {}
+    Histogram hist;
+    int64 errors;
+};
+
+co::vector<Stats>* stats;
+co::WaitGroup wg;
+http::Agent* agent;
+fastring payload;
+int64 t_beg; // when requests are measured
+int64 t_end; // when coroutines stop
+
+// send requests until t_end, at the rate of qps / c if qps > 0. A request
+// behind the schedule is measured from the time it was due, rather than when
+// it was sent, so that a slow server can not hide the requests it delayed.
+// Requests on time are measured from when they were sent, as the timer is in
+// milliseconds.
+template<typename F>
+void run(int id, F&& f) {
+    const double interval = FLG_qps > 0 ? 1e6 * FLG_c / FLG_qps : 0;
+    const int64 base = t_beg - FLG_w * 1000000LL;
+    Stats& st = (*stats)[co::scheduler_id()];
+
+    for (int64 k = 0; ; ++k) {
+        int64 t = now::us();
+        if (interval > 0) {
+            const int64 due = base + (int64)(interval * (k + (double)id / FLG_c));
+            if (due > t) {
+                co::sleep((uint32)((due - t + 999) / 1000));
+                t = now::us();
+            } else {
+                t = due;
+            }
+        }
+        if (t >= t_end) break;
+
+        const bool ok = f();
+        const int64 e = now::us();
+        if (t >= t_beg) {
+            st.hist.record(e - t);
+            if (!ok) ++st.errors;
+        }
+    }
+    wg.done();
+}
+
+void rpc_fun(int id) {
+    const size_t p = FLG_s.rfind(':');
+    const fastring ip = FLG_s.substr(0, p);
+    rpc::Client c(ip.c_str(), p != fastring::npos ? str::to_int32(FLG_s.substr(p + 1)) : 7788);
+    Json req({{ "api", FLG_api.c_str() }});
+    if (!payload.empty()) req.add_member("data", payload.c_str());
+
+    run(id, [&]() {
+        Json res;
+        c.call(req, res);
+        return !res.is_null() && !res.has_member("error");
+    });
+    c.close();
+}
+
+void http_fun(int id) {
+    http::Request req(payload.empty() ? http::kGet : http::kPost, FLG_url.c_str());
+    if (!payload.empty()) req.set_body(payload);
+
+    run(id, [&]() {
+        http::Response res;
+        return agent->perform(req, res) && res.status() < 400;
+    });
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    const bool use_http = FLG_mode == "http";
+    if (!use_http && FLG_mode != "rpc") {
+        COUT << "unknown mode: " << FLG_mode;
+        return 1;
+    }
+    if (FLG_c <= 0) FLG_c = 1;
+
+    stats = new co::vector<Stats>(co::scheduler_num());
+    payload.resize(FLG_size > 0 ? FLG_size : 0);
+    for (size_t i = 0; i < payload.size(); ++i) payload[i] = (char)('a' + i % 26);
+    if (use_http) agent = new http::Agent(FLG_s.c_str());
+
+    t_beg = now::us() + FLG_w * 1000000LL;
+    t_end = t_beg + FLG_d * 1000000LL;
+    wg.add(FLG_c);
+    for (int i = 0; i < FLG_c; ++i) {
+        use_http ? go(http_fun, i) : go(rpc_fun, i);
+    }
+    wg.wait();
+
+    Histogram h;
+    int64 errors = 0;
+    for (auto& x : *stats) {
+        h.merge(x.hist);
+        errors += x.errors;
+    }
+
+    const double sec = FLG_d > 0 ? FLG_d : 1;
+    Json r = {
+        { "mode", FLG_mode.c_str() },
+        { "server", FLG_s.c_str() },
+        { "target", use_http ? FLG_url.c_str() : FLG_api.c_str() },
+        { "concurrency", FLG_c },
+        { "duration_sec", FLG_d },
+        { "target_qps", FLG_qps },
+        { "payload_size", (int)payload.size() },
+        { "requests", h.count() },
+        { "errors", errors },
+        { "qps", (int64)(h.count() / sec) },
+        { "latency_us", {
+            { "min", h.min() },
+            { "mean", (int64)h.mean() },
+            { "p50", h.percentile(50) },
+            { "p90", h.percentile(90) },
+            { "p99", h.percentile(99) },
+            { "p999", h.percentile(99.9) },
+            { "max", h.max() },
+        }},
+    };
+    r.add_member("histogram", h.buckets());
+
+    const fastring s = r.str();
+    if (FLG_o.empty()) {
+        fwrite(s.data(), 1, s.size(), stdout);
+        fputc('\n', stdout);
+    } else {
+        fs::file f(FLG_o.c_str(), 'w');
+        if (!f || f.write(s) != s.size()) {
+            COUT << "write to " << FLG_o << " failed";
+            return 1;
+        }
+    }
+
+    delete agent;
+    return 0;
+}
@@ -0,0 +1,42 @@
+// http server in prefork mode
+//
+// build:
+//   xmake -b prefork
+//
+// start 4 workers on port 7777:
+//   xmake r prefork -prefork_workers 4 -port 7777
+//   curl 127.0.0.1:7777/hello    # hello from worker x
+//
+// hot restart, with the new binary if it was rebuilt, and stop:
+//   kill -USR2 <pid of the master>
+//   kill <pid of the master>
+
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/http.h"
+#include "co/prefork.h"
+#include "co/time.h"
+
+DEF_string(ip, "0.0.0.0", "http server ip");
+DEF_int32(port, 80, "http server port");
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    const int id = prefork::run(argc, argv); // returns in the workers
+    LOG << "worker " << id << " started";
+
+    http::Server().on_req(
+        [id](const http::Req& req, http::Res& res) {
+            if (req.is_method_get() && req.url() == "/hello") {
+                res.set_status(200);
+                res.set_body(fastring("hello from worker ") << id);
+            } else {
+                res.set_status(404);
+            }
+        }
+    ).start(FLG_ip.c_str(), FLG_port);
+
+    while (true) sleep::sec(1024);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// http server with http::Router
+//
+// build:
+//   xmake -b router
+//
+// start the server:
+//   xmake r router -port 7777
+//
+// try it:
+//   curl 127.0.0.1:7777/users/7
+//   curl 127.0.0.1:7777/users/7/files/a/b.txt
+//   curl -X POST 127.0.0.1:7777/users
+//   curl -X DELETE 127.0.0.1:7777/users/7   # 405, Allow: GET
+
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/http.h"
+#include "co/time.h"
+
+DEF_string(ip, "0.0.0.0", "http server ip");
+DEF_int32(port, 80, "http server port");
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    FLG_cout = true;
+
+    static http::Router r;
+    r.get("/hello", [](const http::Req&, http::Res& res) {
+        res.set_status(200);
+        res.set_body("hello");
+    });
+
+    r.get("/users/:id", [](const http::Req& req, http::Res& res) {
+        fastring s;
+        s << "user " << req.param("id").str();
+        res.set_status(200);
+        res.set_body(s);
+    });
+
+    r.post("/users", [](const http::Req& req, http::Res& res) {
+        res.set_status(201);
+        res.set_body(req.body(), req.body_size());
+    });
+
+    r.get("/users/:id/files/*path", [](const http::Req& req, http::Res& res) {
+        fastring s;
+        s << "user " << req.param("id").str() << ", file " << req.param("path").str();
+        res.set_status(200);
+        res.set_body(s);
+    });
+
+    http::Server().on_req(r).start(FLG_ip.c_str(), FLG_port);
+
+    while (true) sleep::sec(1024);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "rpc/hello_world.h"
 #include "rpc/hello_again.h"
+#include "rpc/greeter.h"
 #include "co/co.h"
 #include "co/time.h"
 
@@ -12,6 +13,10 @@ DEF_bool(ping, false, "test rpc ping");
 DEF_string(key, "", "private key file");
 DEF_string(ca, "", "certificate file");
 DEF_bool(ssl, false, "use ssl if true");
+DEF_bool(typed, false, "call Greeter.greet with typed messages in binary");
+DEF_bool(mux, false, "share one connection per scheduler with rpc::MuxClient");
+DEF_string(endpoints, "", "call replicas with rpc::Channel, e.g. 127.0.0.1:7788,127.0.0.1:7789");
+DEF_bool(stream, false, "test streams of Numbers.range and Numbers.sum");
 
 namespace xx {
 
@@ -55,6 +60,57 @@ class HelloAgainImpl : public HelloAgain {
     }
 };
 
+class GreeterImpl : public Greeter {
+  public:
+    GreeterImpl() = default;
+    virtual ~GreeterImpl() = default;
+
+    virtual void greet(const Greeting& req, Reply& res) {
+        res.msg << "hello " << req.name;
+        for (size_t i = 0; i < req.ids.size(); ++i) res.sum += req.ids[i];
+        res.path = req.path;
+    }
+
+    virtual void ping(Json& req, Json& res) {
+        res.add_member("res", "pong");
+    }
+};
+
+// a service with stream methods only
+class NumbersImpl : public rpc::Service {
+  public:
+    NumbersImpl() {
+        // the server streams {"n":0}, {"n":1}, ... {"n":count-1}
+        _streams["Numbers.range"] = [](Json& req, rpc::Stream& s) {
+            const int n = req.get("count").as_int();
+            for (int i = 0; i < n; ++i) {
+                if (!s.write(Json({{"n", i}}))) return;
+            }
+        };
+
+        // the client streams numbers and the server replies with the sum
+        _streams["Numbers.sum"] = [](Json& req, rpc::Stream& s) {
+            int64 sum = 0;
+            Json m;
+            while (s.read(m)) sum += m.get("n").as_int64();
+            if (s.ok()) s.write(Json({{"sum", sum}}));
+        };
+    }
+
+    virtual ~NumbersImpl() = default;
+
+    virtual const char* name() const { return "Numbers"; }
+    virtual const co::map<const char*, Fun>& methods() const { return _methods; }
+
+    virtual const co::map<const char*, StreamFun>* stream_methods() const {
+        return &_streams;
+    }
+
+  private:
+    co::map<const char*, Fun> _methods;
+    co::map<const char*, StreamFun> _streams;
+};
+
 } // xx
 
 // proto client
@@ -79,6 +135,72 @@ void test_rpc_client() {
     c.close();
 }
 
+// calls of all coroutines in a scheduler share a connection
+std::unique_ptr<rpc::MuxClient> mux;
+
+void test_mux_client() {
+    for (int i = 0; i < FLG_n; ++i) {
+        Json req, res;
+        req.add_member("api", "HelloWorld.hello");
+        mux->call(req, res);
+    }
+}
+
+// calls balanced across the endpoints
+std::unique_ptr<rpc::Channel> channel;
+
+void test_channel() {
+    for (int i = 0; i < FLG_n; ++i) {
+        Json req, res;
+        req.add_member("api", "HelloWorld.hello");
+        channel->call(req, res);
+    }
+}
+
+// perform RPC request with typed messages
+void test_typed_client() {
+    rpc::Client c(*proto);
+    xx::GreeterClient g(c);
+    xx::Greeting req;
+    xx::Reply res;
+    req.name = "co";
+    req.ids = { 1, 2, 3 };
+
+    for (int i = 0; i < FLG_n; ++i) {
+        const int r = g.greet(req, res);
+        if (r != rpc::kOk) LOG << "greet failed: " << r;
+    }
+    c.close();
+}
+
+// read a stream of the server, then write a stream to it
+void test_stream() {
+    rpc::Client c(*proto);
+    Json m;
+    int64 x = 0, count = 0;
+    {
+        rpc::Stream s = c.stream(Json({{"api", "Numbers.range"}, {"count", FLG_n}}));
+        while (s.read(m)) { x += m.get("n").as_int64(); ++count; }
+        LOG << "range: " << count << " messages, sum: " << x << ", ok: " << s.ok();
+    }
+    {
+        rpc::Stream s = c.stream(Json({{"api", "Numbers.sum"}}));
+        for (int i = 0; i < FLG_n; ++i) {
+            if (!s.write(Json({{"n", i}}))) break;
+        }
+        s.finish();
+        if (s.read(m)) LOG << "sum: " << m;
+        while (s.read(m));
+        LOG << "sum done: " << s.done() << ", ok: " << s.ok();
+    }
+
+    // the connection is still there for calls
+    Json req({{"api", "HelloWorld.hello"}}), res;
+    c.call(req, res);
+    LOG << "call after streams: " << res;
+    c.close();
+}
+
 co::Pool pool(
     []() { return (void*) new rpc::Client(*proto); },
     [](void* p) { delete (rpc::Client*) p; }
@@ -105,11 +227,31 @@ int main(int argc, char** argv) {
         rpc::Server()
             .add_service(new xx::HelloWorldImpl)
             .add_service(new xx::HelloAgainImpl)
+            .add_service(new xx::GreeterImpl)
+            .add_service(new xx::NumbersImpl)
             .start("0.0.0.0", FLG_serv_port, "/hello", FLG_key.c_str(), FLG_ca.c_str());
     } else {
         if (FLG_ping) {
             go(test_ping);
             go(test_ping);
+        } else if (FLG_stream) {
+            for (int i = 0; i < FLG_conn; ++i) {
+                go(test_stream);
+            }
+        } else if (FLG_typed) {
+            for (int i = 0; i < FLG_conn; ++i) {
+                go(test_typed_client);
+            }
+        } else if (!FLG_endpoints.empty()) {
+            channel.reset(new rpc::Channel(FLG_endpoints.c_str(), FLG_ssl));
+            for (int i = 0; i < FLG_conn; ++i) {
+                go(test_channel);
+            }
+        } else if (FLG_mux) {
+            mux.reset(new rpc::MuxClient(FLG_serv_ip.c_str(), FLG_serv_port, FLG_ssl));
+            for (int i = 0; i < FLG_conn; ++i) {
+                go(test_mux_client);
+            }
         } else {
             for (int i = 0; i < FLG_conn; ++i) {
                 go(test_rpc_client);
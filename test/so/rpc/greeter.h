@@ -0,0 +1,206 @@
+// Autogenerated.
+// DO NOT EDIT. All changes will be undone.
+#pragma once
+
+#include "co/rpc.h"
+
+namespace xx {
+
+struct Point : public rpc::Message {
+    Point() : x(0), y(0) {}
+
+    virtual ~Point() {}
+
+    virtual void encode(fastream& s) const {
+        rpc::wire::write(s, 1, x);
+        rpc::wire::write(s, 2, y);
+    }
+
+    virtual bool decode(const char* p, size_t n) {
+        this->clear();
+        const char* const e = p + n;
+        uint64 k;
+        while (p < e) {
+            if (!rpc::wire::get_varint(p, e, k)) return false;
+            const int t = (int)(k & 7);
+            bool r;
+            switch (k >> 3) {
+              case 1:  r = rpc::wire::read(p, e, t, x); break;
+              case 2:  r = rpc::wire::read(p, e, t, y); break;
+              default: r = rpc::wire::skip(p, e, t); break;
+            }
+            if (!r) return false;
+        }
+        return true;
+    }
+
+    void clear() {
+        x = 0;
+        y = 0;
+    }
+
+    int32 x;
+    int32 y;
+};
+
+struct Greeting : public rpc::Message {
+    Greeting() : count(0), flag(false), score(0) {}
+
+    virtual ~Greeting() {}
+
+    virtual void encode(fastream& s) const {
+        rpc::wire::write(s, 1, name);
+        rpc::wire::write(s, 2, count);
+        rpc::wire::write(s, 3, ids);
+        rpc::wire::write(s, 4, tags);
+        rpc::wire::write(s, 5, pos);
+        rpc::wire::write(s, 6, path);
+        rpc::wire::write(s, 7, flag);
+        rpc::wire::write(s, 8, score);
+    }
+
+    virtual bool decode(const char* p, size_t n) {
+        this->clear();
+        const char* const e = p + n;
+        uint64 k;
+        while (p < e) {
+            if (!rpc::wire::get_varint(p, e, k)) return false;
+            const int t = (int)(k & 7);
+            bool r;
+            switch (k >> 3) {
+              case 1:  r = rpc::wire::read(p, e, t, name); break;
+              case 2:  r = rpc::wire::read(p, e, t, count); break;
+              case 3:  r = rpc::wire::read(p, e, t, ids); break;
+              case 4:  r = rpc::wire::read(p, e, t, tags); break;
+              case 5:  r = rpc::wire::read(p, e, t, pos); break;
+              case 6:  r = rpc::wire::read(p, e, t, path); break;
+              case 7:  r = rpc::wire::read(p, e, t, flag); break;
+              case 8:  r = rpc::wire::read(p, e, t, score); break;
+              default: r = rpc::wire::skip(p, e, t); break;
+            }
+            if (!r) return false;
+        }
+        return true;
+    }
+
+    void clear() {
+        name.clear();
+        count = 0;
+        ids.clear();
+        tags.clear();
+        pos.clear();
+        path.clear();
+        flag = false;
+        score = 0;
+    }
+
+    fastring name;
+    int64 count;
+    co::vector<int32> ids;
+    co::vector<fastring> tags;
+    Point pos;
+    co::vector<Point> path;
+    bool flag;
+    double score;
+};
+
+struct Reply : public rpc::Message {
+    Reply() : sum(0) {}
+
+    virtual ~Reply() {}
+
+    virtual void encode(fastream& s) const {
+        rpc::wire::write(s, 1, msg);
+        rpc::wire::write(s, 2, sum);
+        rpc::wire::write(s, 3, path);
+    }
+
+    virtual bool decode(const char* p, size_t n) {
+        this->clear();
+        const char* const e = p + n;
+        uint64 k;
+        while (p < e) {
+            if (!rpc::wire::get_varint(p, e, k)) return false;
+            const int t = (int)(k & 7);
+            bool r;
+            switch (k >> 3) {
+              case 1:  r = rpc::wire::read(p, e, t, msg); break;
+              case 2:  r = rpc::wire::read(p, e, t, sum); break;
+              case 3:  r = rpc::wire::read(p, e, t, path); break;
+              default: r = rpc::wire::skip(p, e, t); break;
+            }
+            if (!r) return false;
+        }
+        return true;
+    }
+
+    void clear() {
+        msg.clear();
+        sum = 0;
+        path.clear();
+    }
+
+    fastring msg;
+    uint64 sum;
+    co::vector<Point> path;
+};
+
+class Greeter : public rpc::Service {
+  public:
+    typedef std::function<void(Json&, Json&)> Fun;
+
+    enum : uint32 {
+        kGreet = 2063059772u,
+    };
+
+    Greeter() {
+        using std::placeholders::_1;
+        using std::placeholders::_2;
+        _methods["Greeter.ping"] = std::bind(&Greeter::ping, this, _1, _2);
+        _bin_methods[kGreet] = [this](const char* p, size_t n, fastream& s) {
+            Greeting req;
+            Reply res;
+            if (!req.decode(p, n)) return (int)rpc::kBadRequest;
+            this->greet(req, res);
+            res.encode(s);
+            return (int)rpc::kOk;
+        };
+    }
+
+    virtual ~Greeter() {}
+
+    virtual const char* name() const {
+        return "Greeter";
+    }
+
+    virtual const co::map<const char*, Fun>& methods() const {
+        return _methods;
+    }
+
+    virtual const co::map<uint32, BinFun>* bin_methods() const {
+        return &_bin_methods;
+    }
+
+    virtual void greet(const Greeting& req, Reply& res) = 0;
+
+    virtual void ping(Json& req, Json& res) = 0;
+
+  private:
+    co::map<const char*, Fun> _methods;
+    co::map<uint32, BinFun> _bin_methods;
+};
+
+class GreeterClient {
+  public:
+    explicit GreeterClient(rpc::Client& c) : _c(c) {}
+
+    // return rpc::kOk on success, see rpc::Client::call()
+    int greet(const Greeting& req, Reply& res) {
+        return _c.call(Greeter::kGreet, req, res);
+    }
+
+  private:
+    rpc::Client& _c;
+};
+
+} // xx
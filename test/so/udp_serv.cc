@@ -0,0 +1,52 @@
+#include "co/all.h"
+
+// an echo server with udp::Server, there is a socket in each scheduler on linux.
+// usage:
+//   ./udp_serv -port 6688
+//   ./udp_serv -port 6688 -c 64 -n 10000   # and send 10000 datagrams with 64 clients
+
+DEF_string(ip, "0.0.0.0", "ip");
+DEF_int32(port, 6688, "port");
+DEF_int32(c, 0, "number of client coroutines, 0 for server only");
+DEF_int32(n, 10000, "datagrams sent by each client");
+
+co::WaitGroup wg;
+int64 echoed = 0;
+
+void client_fun() {
+    sock_t fd = co::udp_socket();
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip == "0.0.0.0" ? "127.0.0.1" : FLG_ip.c_str(), FLG_port);
+
+    char buf[64];
+    for (int i = 0; i < FLG_n; ++i) {
+        if (co::sendto(fd, "ping", 4, &addr, sizeof(addr)) != 4) break;
+        if (co::recvfrom(fd, buf, sizeof(buf), NULL, NULL, 1000) == 4) atomic_inc(&echoed);
+    }
+    co::close(fd);
+    wg.done();
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    udp::Server serv;
+    serv.on_datagram([](const udp::Datagram& d) {
+        d.reply(d.data, d.size);
+    });
+    serv.start(FLG_ip.c_str(), FLG_port);
+
+    if (FLG_c <= 0) {
+        while (true) sleep::sec(1024);
+    }
+
+    const int64 beg = now::ms();
+    wg.add(FLG_c);
+    for (int i = 0; i < FLG_c; ++i) go(client_fun);
+    wg.wait();
+
+    const int64 ms = now::ms() - beg;
+    COUT << "echoed " << echoed << " datagrams in " << ms << " ms, recv num: " << serv.recv_num();
+    serv.exit();
+    return 0;
+}
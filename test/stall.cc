@@ -0,0 +1,25 @@
+// a coroutine blocks its scheduler, the watchdog should report it
+//   ./stall -co_stall_ms=100
+//   ./stall -co_stall_ms=100 -co_steal -co_stall_move_tasks
+#include "co/co.h"
+#include "co/time.h"
+
+DEF_uint32(ms, 500, "time in ms the coroutine runs without yielding");
+
+DEF_main(argc, argv) {
+    FLG_cout = true;
+
+    co::WaitGroup wg;
+    wg.add(1);
+    auto s = co::next_scheduler();
+    s->go([wg]() {
+        const int64 t = now::ms();
+        while (now::ms() - t < FLG_ms); // cpu-heavy work
+        wg.done();
+    });
+
+    wg.wait();
+    co::sleep(FLG_ms / 4 + 10); // let the watchdog finish its report
+    LOG << "stalls of scheduler " << ((co::Scheduler*)s)->stats().stalls;
+    return 0;
+}
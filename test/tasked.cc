@@ -22,6 +22,17 @@ int main(int argc, char** argv) {
     s.run_at(f, 17, 12, 59);
     s.run_daily(f, 5, 18, 0);
 
+    // tasks in a pool of 2 threads, a slow one does not delay the others
+    Tasked p(2);
+    p.run_every_ms([]() { sleep::ms(300); }, 100);
+    p.run_every_ms(g, 500);
+    p.run_every([&p]() {
+        auto s = p.stats();
+        COUT << "runs: " << s.runs << " overruns: " << s.overruns
+             << " latency: " << s.avg_latency_us << "/" << s.max_latency_us << " us"
+             << " duration: " << s.avg_duration_us << "/" << s.max_duration_us << " us";
+    }, 5);
+
     while (1) sleep::sec(1024);
     return 0;
 }
@@ -0,0 +1,98 @@
+// benchmark for task lists of the schedulers
+//   ./tasks                          # lock-free lists
+//   ./tasks -co_lockfree_tasks=false # lists protected by a mutex
+#include "co/all.h"
+
+DEC_bool(co_lockfree_tasks);
+DEF_int32(n, 100000, "number of tasks created by each thread");
+DEF_int32(t, 4, "thread num");
+
+// t threads create coroutines with go() at the same time.
+void bench_go() {
+    co::WaitGroup wg;
+    wg.add(FLG_n * FLG_t);
+
+    Timer t;
+    for (int i = 0; i < FLG_t; ++i) {
+        Thread([wg]() {
+            for (int k = 0; k < FLG_n; ++k) go([wg]() { wg.done(); });
+        }).detach();
+    }
+    wg.wait();
+
+    const int64 us = t.us();
+    COUT << "go:\t" << (us * 1000.0 / (FLG_n * FLG_t)) << " ns per task";
+}
+
+// t threads create coroutines with go_batch() at the same time.
+void bench_go_batch() {
+    co::WaitGroup wg;
+    wg.add(FLG_n * FLG_t);
+
+    Timer t;
+    for (int i = 0; i < FLG_t; ++i) {
+        Thread([wg]() {
+            co::vector<co::Closure*> cbs;
+            cbs.reserve(500);
+            for (int k = 0; k < FLG_n; ++k) {
+                cbs.push_back(co::new_closure([wg]() { wg.done(); }));
+                if (cbs.size() == 500) { co::go_batch(cbs); cbs.clear(); }
+            }
+            co::go_batch(cbs);
+        }).detach();
+    }
+    wg.wait();
+
+    const int64 us = t.us();
+    COUT << "go_batch:\t" << (us * 1000.0 / (FLG_n * FLG_t)) << " ns per task";
+}
+
+// a coroutine creates coroutines in its own scheduler.
+void bench_local_go() {
+    co::WaitGroup wg;
+    wg.add(FLG_n);
+
+    Timer t;
+    go([wg]() {
+        auto s = co::scheduler();
+        for (int k = 0; k < FLG_n; ++k) s->go([wg]() { wg.done(); });
+    });
+    wg.wait();
+
+    const int64 us = t.us();
+    COUT << "local go:\t" << (us * 1000.0 / FLG_n) << " ns per task";
+}
+
+// t threads wake up coroutines waiting for co::Event.
+void bench_wakeup() {
+    const int m = FLG_n * FLG_t / 100;
+    co::vector<co::Event> evs(m);
+    co::WaitGroup wg;
+    wg.add(m);
+
+    for (int i = 0; i < m; ++i) {
+        go([&evs, wg, i]() { evs[i].wait(); wg.done(); });
+    }
+    co::sleep(100); // wait for all coroutines to be suspended
+
+    Timer t;
+    for (int i = 0; i < FLG_t; ++i) {
+        Thread([&evs, m, i]() {
+            for (int k = i; k < m; k += FLG_t) evs[k].signal();
+        }).detach();
+    }
+    wg.wait();
+
+    const int64 us = t.us();
+    COUT << "wakeup:\t" << (us * 1000.0 / m) << " ns per coroutine";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    COUT << "co_lockfree_tasks: " << FLG_co_lockfree_tasks;
+    bench_go();
+    bench_go_batch();
+    bench_local_go();
+    bench_wakeup();
+    return 0;
+}
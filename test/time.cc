@@ -22,6 +22,9 @@ int main(int argc, char** argv) {
     int64 v; (void)v;
     def_case(v = now::ms());
     def_case(v = now::us());
+    def_case(v = now::ns());
+    def_case(v = now::fast_ns());
+    COUT << "fast_ns() reads the cpu counter: " << now::fast_ns_native();
     
     // on linux: time(0) is fast, on mac: time(0) is slow
     def_case(v = time(0));
@@ -0,0 +1,98 @@
+#include "co/unitest.h"
+#include "co/benchmark.h"
+#include "co/json.h"
+#include "co/atomic.h"
+
+DEC_uint32(bench_min_ms);
+DEC_uint32(bench_warmup_ms);
+DEC_uint32(bench_runs);
+
+namespace test {
+
+static uint64 g_sum = 0;
+static uint32 g_mask = 0;
+
+DEF_bench(ut_bench_sum) {
+    uint64 x = 0;
+    for (uint64 i = 0; i < bench.n; ++i) {
+        x += i;
+        bench::do_not_optimize(x);
+    }
+    g_sum = x;
+    bench.set_bytes(8);
+}
+
+DEF_bench_threads(ut_bench_threads, 3) {
+    atomic_or(&g_mask, 1u << bench.index, mo_relaxed);
+    uint64 x = 0;
+    for (uint64 i = 0; i < bench.n; ++i) bench::do_not_optimize(x += i);
+}
+
+DEF_bench_co(ut_bench_co, 5) {
+    atomic_or(&g_mask, 1u << bench.index, mo_relaxed);
+    uint64 x = 0;
+    for (uint64 i = 0; i < bench.n; ++i) bench::do_not_optimize(x += i);
+}
+
+DEF_test(benchmark) {
+    const uint32 min_ms = FLG_bench_min_ms;
+    const uint32 warmup_ms = FLG_bench_warmup_ms;
+    const uint32 runs = FLG_bench_runs;
+    FLG_bench_min_ms = 5;
+    FLG_bench_warmup_ms = 1;
+    FLG_bench_runs = 3;
+
+    DEF_case(run) {
+        bench::Result r;
+        EXPECT(!bench::run("ut_bench_none", r));
+        EXPECT(bench::run("ut_bench_sum", r));
+        EXPECT_EQ(r.name, "ut_bench_sum");
+        EXPECT_EQ(r.threads, 1u);
+        EXPECT_EQ(r.co, false);
+        EXPECT_EQ(r.runs, 3u);
+        EXPECT_GT(r.n, 1000u);
+        EXPECT_EQ(g_sum, r.n * (r.n - 1) / 2);
+        EXPECT_GT(r.median, 0.0);
+        EXPECT_LE(r.min, r.median);
+        EXPECT_LE(r.median, r.max);
+        EXPECT_GT(r.ops, 0.0);
+        EXPECT_GT(r.bytes, 0.0);
+    }
+
+    DEF_case(parallel) {
+        bench::Result r;
+        g_mask = 0;
+        EXPECT(bench::run("ut_bench_threads", r));
+        EXPECT_EQ(r.threads, 3u);
+        EXPECT_EQ(r.co, false);
+        EXPECT_EQ(g_mask, 7u);
+
+        g_mask = 0;
+        EXPECT(bench::run("ut_bench_co", r));
+        EXPECT_EQ(r.threads, 5u);
+        EXPECT_EQ(r.co, true);
+        EXPECT_EQ(g_mask, 31u);
+    }
+
+    DEF_case(output) {
+        co::vector<bench::Result> v(1);
+        EXPECT(bench::run("ut_bench_sum", v[0]));
+        Json x = json::parse(bench::to_json(v));
+        EXPECT(x.is_array());
+        EXPECT_EQ(x.array_size(), 1u);
+        EXPECT_EQ(fastring(x[0].get("name").as_c_str()), "ut_bench_sum");
+        EXPECT_EQ(x[0].get("iterations").as_int64(), (int64)v[0].n);
+        EXPECT(x[0].has_member("median"));
+        EXPECT(!x[0].has_member("baseline"));
+
+        fastring s = bench::to_csv(v);
+        EXPECT(s.starts_with("name,threads,co,iterations,"));
+        EXPECT(s.find("\nut_bench_sum,1,0,") != s.npos);
+    }
+
+    FLG_bench_min_ms = min_ms;
+    FLG_bench_warmup_ms = warmup_ms;
+    FLG_bench_runs = runs;
+}
+
+} // namespace test
@@ -0,0 +1,53 @@
+#include "co/unitest.h"
+#include "co/closure.h"
+
+namespace test {
+
+struct Big {
+    Big() { memset(v, 1, sizeof(v)); }
+    void operator()() {}
+    char v[256];
+};
+
+DEF_test(closure) {
+    DEF_case(small) {
+        int n = 0;
+        int* p = &n;
+        co::Closure* c = co::new_closure([p]() { ++*p; });
+        c->run();
+        EXPECT_EQ(n, 1);
+
+        // the block freed by run() is reused in this thread
+        co::Closure* d = co::new_closure([p]() { *p += 2; });
+        EXPECT_EQ((void*)c, (void*)d);
+        d->run();
+        EXPECT_EQ(n, 3);
+
+        co::new_closure([p](int v) { *p += v; }, 4)->run();
+        EXPECT_EQ(n, 7);
+    }
+
+    DEF_case(large) {
+        int n = 0;
+        int* p = &n;
+        Big b;
+        EXPECT(!co::xx::closure_in_block<co::xx::Function0<Big>>::value);
+        co::Closure* c = co::new_closure([p, b]() { *p += b.v[255]; });
+        c->run();
+        EXPECT_EQ(n, 1);
+    }
+
+    DEF_case(method) {
+        struct X {
+            X() : n(0) {}
+            void f() { ++n; }
+            void g(int v) { n += v; }
+            int n;
+        } x;
+        co::new_closure(&X::f, &x)->run();
+        co::new_closure(&X::g, &x, 5)->run();
+        EXPECT_EQ(x.n, 6);
+    }
+}
+
+} // namespace test
@@ -1,5 +1,28 @@
 #include "co/unitest.h"
 #include "co/co.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include "co/fs.h"
+#include "co/json.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/select.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#endif
+
+DEC_bool(co_steal);
+DEC_bool(co_dedicated_stack);
+DEC_bool(co_profile);
+DEC_uint32(co_profile_stack_us);
+DEC_uint32(co_pool_idle_ms);
+DEC_bool(co_io_uring);
 
 namespace test {
 
@@ -21,6 +44,124 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(go_batch) {
+        co::WaitGroup wg;
+        wg.add(200);
+        co::vector<co::Closure*> cbs;
+        for (int i = 0; i < 100; ++i) {
+            cbs.push_back(co::new_closure([wg, &v]() { atomic_inc(&v); wg.done(); }));
+        }
+        co::go_batch(cbs);
+
+        cbs.clear();
+        for (int i = 0; i < 100; ++i) {
+            cbs.push_back(co::new_closure([wg, &v]() { atomic_inc(&v); wg.done(); }));
+        }
+        co::next_scheduler()->go_n(cbs);
+
+        wg.wait();
+        EXPECT_EQ(v, 200);
+        v = 0;
+    }
+
+    DEF_case(steal) {
+        FLG_co_steal = true;
+        co::WaitGroup wg;
+        wg.add(64);
+        for (int i = 0; i < 64; ++i) {
+            go([wg, &v]() {
+                atomic_inc(&v);
+                wg.done();
+            });
+        }
+
+        wg.wait();
+        EXPECT_EQ(v, 64);
+        FLG_co_steal = false;
+        v = 0;
+    }
+
+    DEF_case(local_tasks) {
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, &v]() {
+            auto s = co::scheduler();
+            co::Event ev;
+            co::WaitGroup x;
+            x.add(32);
+            for (int i = 0; i < 32; ++i) {
+                s->go([x, &v, &ev, s, i]() {
+                    if (co::scheduler() == s) atomic_inc(&v);
+                    if (i == 31) ev.signal();
+                    x.done();
+                });
+            }
+            ev.wait();
+            x.wait();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_EQ(v, 32);
+        v = 0;
+    }
+
+    DEF_case(sched_policy) {
+        auto& scheds = co::schedulers();
+        co::Event ev;
+        co::WaitGroup wg;
+        wg.add(32);
+        for (int i = 0; i < 32; ++i) {
+            scheds[0]->go([ev, wg]() { ev.wait(); wg.done(); });
+        }
+        co::sleep(20);
+        EXPECT_GE(scheds[0]->stats().coroutines, 32);
+
+        const co::sched_policy_t ps[] = {
+            co::sched_round_robin, co::sched_least_queued,
+            co::sched_least_coroutines, co::sched_two_choices
+        };
+        for (auto p : ps) {
+            for (int i = 0; i < 8; ++i) {
+                auto s = co::next_scheduler(p);
+                EXPECT(std::find(scheds.begin(), scheds.end(), s) != scheds.end());
+                if (scheds.size() > 1 && p == co::sched_least_coroutines) EXPECT_NE(s, scheds[0]);
+            }
+        }
+
+        ev.signal();
+        wg.wait();
+    }
+
+    DEF_case(prio) {
+        co::vector<int> x;
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, &x]() {
+            auto s = co::scheduler();
+            co::WaitGroup w;
+            w.add(24);
+            for (int i = 0; i < 8; ++i) {
+                s->go(co::prio_low, [w, &x]() { x.push_back(co::prio_low); w.done(); });
+                s->go([w, &x]() { x.push_back(co::prio_normal); w.done(); });
+                s->go(co::prio_high, [w, &x]() { x.push_back(co::prio_high); w.done(); });
+            }
+            w.wait();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_EQ(x.size(), 24);
+        if (x.size() == 24) {
+            EXPECT_EQ(x[0], (int)co::prio_high);
+            EXPECT_EQ(x[7], (int)co::prio_high);
+            EXPECT_EQ(x[8], (int)co::prio_normal);
+            EXPECT_EQ(x[15], (int)co::prio_normal);
+            EXPECT_EQ(x[16], (int)co::prio_low);
+            EXPECT_EQ(x[23], (int)co::prio_low);
+        }
+    }
+
     DEF_case(event) {
         co::Event ev;
         co::WaitGroup wg;
@@ -45,6 +186,334 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(event_timeout) {
+        co::Event ev;
+        co::WaitGroup wg;
+        int r[4] = { -1, -1, -1, -1 };
+        wg.add(4);
+
+        // waiters timed out are removed from the wait list, the others are woken up
+        for (int i = 0; i < 4; ++i) {
+            go([wg, ev, i, &r]() {
+                r[i] = ev.wait(i % 2 == 0 ? 1 : 3000) ? 1 : 0;
+                wg.done();
+            });
+        }
+        co::sleep(50);
+        ev.signal();
+        wg.wait();
+        EXPECT_EQ(r[0], 0);
+        EXPECT_EQ(r[1], 1);
+        EXPECT_EQ(r[2], 0);
+        EXPECT_EQ(r[3], 1);
+    }
+
+    DEF_case(shared_stack) {
+        co::WaitGroup wg;
+        wg.add(32);
+        for (int i = 0; i < 32; ++i) {
+            go([wg, &v, i]() {
+                char buf[4096];
+                memset(buf, i, sizeof(buf));
+                for (int k = 0; k < 4; ++k) co::sleep(k);
+                if (co::on_stack(buf) && buf[0] == i && buf[4095] == i) atomic_inc(&v);
+                wg.done();
+            });
+        }
+
+        wg.wait();
+        EXPECT_EQ(v, 32);
+        v = 0;
+    }
+
+    DEF_case(stats) {
+        auto& scheds = co::schedulers();
+        uint64 resumes = 0;
+        for (size_t i = 0; i < scheds.size(); ++i) resumes += scheds[i]->stats().resumes;
+
+        co::WaitGroup wg;
+        wg.add(16);
+        for (int i = 0; i < 16; ++i) {
+            go([wg]() { co::sleep(1); wg.done(); });
+        }
+        wg.wait();
+
+        uint64 x = 0;
+        for (size_t i = 0; i < scheds.size(); ++i) {
+            auto st = scheds[i]->stats();
+            EXPECT_LE(st.max_stack_size, st.bytes_copied);
+            x += st.resumes;
+        }
+        EXPECT_GE(x, resumes + 32);
+    }
+
+    DEF_case(dedicated_stack) {
+        FLG_co_dedicated_stack = true;
+        co::WaitGroup wg;
+        wg.add(32);
+        for (int i = 0; i < 32; ++i) {
+            go([wg, &v, i]() {
+                char buf[4096];
+                memset(buf, i, sizeof(buf));
+                co::sleep(1);
+                if (co::on_stack(buf) && buf[0] == i && buf[4095] == i) atomic_inc(&v);
+                wg.done();
+            });
+        }
+
+        wg.wait();
+        EXPECT_EQ(v, 32);
+        FLG_co_dedicated_stack = false;
+        v = 0;
+    }
+
+    DEF_case(pool_trim) {
+        auto& scheds = co::schedulers();
+        co::WaitGroup wg;
+        wg.add(32);
+        for (int i = 0; i < 32; ++i) {
+            scheds[0]->go([wg]() {
+                char buf[8192];
+                memset(buf, 1, sizeof(buf));
+                co::sleep(1); // stack saved as there are only 8 shared stacks
+                if (buf[8191] == 1) wg.done();
+            });
+        }
+        wg.wait();
+        co::sleep(1);
+        const size_t bytes = scheds[0]->stats().pool_bytes;
+        EXPECT_GT(bytes, 32 * 8192);
+
+        FLG_co_pool_idle_ms = 5;
+        for (int i = 0; i < 8; ++i) {
+            wg.add(1);
+            scheds[0]->go([wg]() { wg.done(); }); // wake up the scheduler
+            wg.wait();
+            co::sleep(5);
+        }
+        // the coroutine on top of the pool is reused, and may keep its memory
+        EXPECT_LT(scheds[0]->stats().pool_bytes, bytes - 24 * 8192);
+        FLG_co_pool_idle_ms = 10000;
+    }
+
+    DEF_case(cls) {
+        static int n = 0;
+        static int k = co::cls_key([](void* p) { atomic_inc(&n); delete (int*)p; });
+        co::WaitGroup wg;
+        wg.add(8);
+        for (int i = 0; i < 8; ++i) {
+            go([wg, &v, i]() {
+                if (co::cls_get(k) == NULL) co::cls_set(k, new int(i));
+                co::sleep(1);
+                if (*(int*)co::cls_get(k) == i) atomic_inc(&v);
+                wg.done();
+            });
+        }
+        wg.wait();
+        co::sleep(1); // wait for the coroutines to be recycled
+        EXPECT_EQ(v, 8);
+        EXPECT_EQ(n, 8);
+        v = 0;
+    }
+
+    DEF_case(migrate) {
+        auto& scheds = co::schedulers();
+        auto to = scheds[scheds.size() - 1];
+        bool r = false;
+        int x = -1;
+        co::WaitGroup wg;
+        FLG_co_dedicated_stack = true;
+        wg.add(1);
+        scheds[0]->go([&, wg]() {
+            char buf[64];
+            memset(buf, 7, sizeof(buf));
+            r = co::migrate(to);
+            co::sleep(1);
+            if (co::scheduler() == to && buf[0] == 7 && buf[63] == 7) x = 0;
+            wg.done();
+        });
+        wg.wait();
+        FLG_co_dedicated_stack = false;
+
+        EXPECT_EQ(r, true);
+        EXPECT_EQ(x, 0);
+    }
+
+    DEF_case(timer) {
+        co::Event ev;
+        co::WaitGroup wg;
+        wg.add(3);
+
+        int64 t0 = 0, t1 = 0;
+        bool r0 = true, r1 = false;
+        go([&]() {
+            Timer t;
+            co::sleep(300); // on level 1 of the timing wheel
+            t0 = t.ms();
+            wg.done();
+        });
+
+        go([&]() {
+            Timer t;
+            r0 = ev.wait(16);
+            t1 = t.ms();
+            r1 = ev.wait(3000);
+            wg.done();
+        });
+
+        go([&, wg, ev]() {
+            co::sleep(100);
+            ev.signal();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_GE(t0, 299);
+        EXPECT_EQ(r0, false);
+        EXPECT_GE(t1, 15);
+        EXPECT_EQ(r1, true);
+    }
+
+    DEF_case(now_ms) {
+        int64 x = 0, y = 0;
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, &x, &y]() {
+            co::sleep(10);
+            x = co::now_ms();
+            y = now::ms();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_LE(x, y);
+        EXPECT_LT(y - x, 100);
+        EXPECT_LE(co::now_ms(), now::ms());
+    }
+
+    DEF_case(trace) {
+        co::trace_start();
+        co::Event ev;
+        co::WaitGroup wg;
+        wg.add(2);
+        auto s = co::schedulers()[0];
+        s->go([ev, wg]() {
+            co::sleep(1);
+            ev.signal();
+            wg.done();
+        });
+        s->go([ev, wg]() {
+            ev.wait();
+            wg.done();
+        });
+        wg.wait();
+
+        // the end of a coroutine is recorded by its scheduler before it runs
+        // the next one, so both have ended once a new one runs there
+        co::WaitGroup w;
+        w.add(1);
+        s->go([w]() { w.done(); });
+        w.wait();
+        co::trace_stop();
+
+        Json x = json::parse(co::trace_dump());
+        EXPECT(x.is_object());
+        const Json& v = x.get("traceEvents");
+        EXPECT(v.is_array());
+        int runs = 0, timers = 0, ends = 0, meta = 0;
+        for (uint32 i = 0; i < v.array_size(); ++i) {
+            const Json& e = v[i];
+            const fastring ph(e.get("ph").as_c_str());
+            const fastring name(e.get("name").as_c_str());
+            if (ph == "M") ++meta;
+            if (ph == "X" && name.starts_with("co ")) {
+                ++runs;
+                EXPECT_GE(e.get("dur").as_double(), 0.0);
+                const Json& a = e.get("args");
+                if (a.has_member("waited") && fastring(a.get("waited").as_c_str()) == "wait timer") ++timers;
+                if (a.has_member("end")) ++ends;
+            }
+        }
+        EXPECT_EQ(meta, co::scheduler_num());
+        EXPECT_GE(runs, 4);
+        EXPECT_GE(timers, 1);
+        EXPECT_GE(ends, 2);
+    }
+
+    DEF_case(profile) {
+        FLG_co_profile = true;
+        FLG_co_profile_stack_us = 1000;
+        co::profile_reset();
+
+        co::WaitGroup wg;
+        wg.add(4);
+        for (int i = 0; i < 4; ++i) {
+            go([wg]() {
+                const int64 t = now::us();
+                while (now::us() - t < 2000); // run 2ms without yielding
+                co::sleep(1);
+                wg.done();
+            });
+        }
+        wg.wait();
+
+        FLG_co_profile = false;
+        FLG_co_profile_stack_us = 0;
+        fastring r = co::profile_report(4);
+        EXPECT_NE(r.find("resumes: "), r.npos);
+        EXPECT_NE(r.find("slow: 4"), r.npos);
+        EXPECT_NE(r.find("    #0  in "), r.npos); // pcs symbolized in the report
+        co::profile_reset();
+        EXPECT_EQ(co::profile_report().find("resumes: "), r.npos);
+    }
+
+    // this case also works with io_uring:  ./unitest co -co_io_uring
+    DEF_case(tcp) {
+        int r0 = -2, r1 = -2, r2 = -2;
+        co::WaitGroup wg;
+        wg.add(2);
+
+        sock_t lfd = co::tcp_socket();
+        co::set_reuseaddr(lfd);
+        struct sockaddr_in addr;
+        co::init_ip_addr(&addr, "127.0.0.1", 30123);
+        EXPECT_EQ(co::bind(lfd, &addr, sizeof(addr)), 0);
+        EXPECT_EQ(co::listen(lfd, 64), 0);
+
+        go([wg, lfd, &r0]() {
+            struct sockaddr_in peer;
+            int len = sizeof(peer);
+            sock_t fd = co::accept(lfd, &peer, &len);
+            if (fd != (sock_t)-1) {
+                char buf[8] = { 0 };
+                r0 = co::recvn(fd, buf, 5);
+                if (r0 == 5) co::send(fd, buf, 5);
+                co::recv(fd, buf, 8, 1000); // wait until the client closed
+                co::close(fd);
+            }
+            wg.done();
+        });
+
+        go([wg, addr, &r1, &r2]() {
+            sock_t fd = co::tcp_socket();
+            if (co::connect(fd, &addr, sizeof(addr), 1000) == 0) {
+                char buf[8] = { 0 };
+                co::send(fd, "hello", 5);
+                r1 = co::recv(fd, buf, 8, 1000);
+                if (r1 == 5 && memcmp(buf, "hello", 5) != 0) r1 = -3;
+                r2 = co::recv(fd, buf, 8, 16); // timeout
+            }
+            co::close(fd);
+            wg.done();
+        });
+
+        wg.wait();
+        co::close(lfd);
+        EXPECT_EQ(r0, 5);
+        EXPECT_EQ(r1, 5);
+        EXPECT_EQ(r2, -1);
+    }
+
     DEF_case(channel) {
         co::Chan<int> ch;
         co::WaitGroup wg;
@@ -65,6 +534,171 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(channel_batch) {
+        co::Chan<int> ch(4);
+        co::WaitGroup wg;
+        wg.add(2);
+
+        // a waiting reader gets more than one element at once
+        uint32 r = 0;
+        int a[10];
+        go([wg, ch, &r]() {
+            int b[8];
+            r = ch.read_up_to(b, 8);
+            wg.done();
+        });
+        go([wg, ch, &a]() {
+            co::sleep(1);
+            for (int i = 0; i < 10; ++i) a[i] = i;
+            ch.write_n(a, 10);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, 8);
+
+        // elements left in the buffer: 8, 9
+        wg.add(2);
+        bool ok = true;
+        int n = 0;
+        go([wg, ch, &n, &ok]() {
+            int b[16];
+            while (n < 102) {
+                const uint32 k = ch.read_up_to(b, 16);
+                for (uint32 i = 0; i < k; ++i) {
+                    const int v = n < 2 ? n + 8 : n - 2;
+                    if (b[i] != v) ok = false;
+                    ++n;
+                }
+            }
+            wg.done();
+        });
+        go([wg, ch]() {
+            int x[100];
+            for (int i = 0; i < 100; ++i) x[i] = i;
+            ch.write_n(x, 100);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(ok);
+        EXPECT_EQ(n, 102);
+    }
+
+    DEF_case(select) {
+        co::Chan<int> a, b;
+        co::WaitGroup wg;
+        int x = 0, y = 0, r = -2;
+
+        // nothing is ready
+        wg.add(1);
+        go([wg, a, b, &x, &y, &r]() {
+            r = co::select({ a.read_case(x), b.read_case(y) }, 0);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, -1);
+
+        wg.add(1);
+        go([wg, a, b, &x, &y, &r]() {
+            r = co::select({ a.read_case(x), b.read_case(y) }, 10);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, -1);
+
+        // the second channel is written later
+        wg.add(2);
+        go([wg, a, b, &x, &y, &r]() {
+            r = co::select({ a.read_case(x), b.read_case(y) });
+            wg.done();
+        });
+        go([wg, b]() {
+            co::sleep(1);
+            b << 7;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, 1);
+        EXPECT_EQ(y, 7);
+
+        // write case, the buffer of a is empty
+        wg.add(1);
+        go([wg, a, b, &x, &y, &r]() {
+            const int v = 3;
+            r = co::select({ b.read_case(y), a.write_case(v) }, 10);
+            a >> x;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, 1);
+        EXPECT_EQ(x, 3);
+
+        // the queued case of a is removed after b was done
+        wg.add(2);
+        go([wg, a, b, &x, &y, &r]() {
+            r = co::select({ a.read_case(x), b.read_case(y) });
+            wg.done();
+        });
+        go([wg, a, b, &x]() {
+            co::sleep(1);
+            b << 8;
+            a << 9;
+            a >> x;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, 1);
+        EXPECT_EQ(y, 8);
+        EXPECT_EQ(x, 9);
+    }
+
+    DEF_case(ring_channel) {
+        co::RingChan<fastring> ch(3);
+        EXPECT_EQ(ch.capacity(), 4);
+
+        fastring x;
+        EXPECT(!ch.try_read(x));
+        EXPECT(ch.try_write(fastring("hello")));
+        EXPECT(ch.try_read(x));
+        EXPECT_EQ(x, "hello");
+        for (int i = 0; i < 4; ++i) EXPECT(ch.try_write(fastring("x")));
+        EXPECT(!ch.try_write(fastring("x")));
+        EXPECT(!ch.write(fastring("x"), 1));
+        for (int i = 0; i < 4; ++i) EXPECT(ch.read(x, 1));
+        EXPECT(!ch.read(x, 1));
+
+        // readers and writers park when the channel is empty or full
+        co::RingChan<int> rc(2);
+        co::WaitGroup wg;
+        const int N = 1000;
+        wg.add(8);
+        int sum = 0;
+        for (int i = 0; i < 4; ++i) {
+            go([wg, rc, N]() {
+                for (int k = 1; k <= N; ++k) rc << k;
+                wg.done();
+            });
+            go([wg, rc, N, &sum]() {
+                int k = 0;
+                for (int j = 0; j < N; ++j) { rc >> k; atomic_add(&sum, k, mo_relaxed); }
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(sum, 4 * N * (N + 1) / 2);
+
+        co::RingChan<int, true> sc(8);
+        wg.add(1);
+        int last = 0;
+        go([wg, sc, N, &last]() {
+            int k = 0;
+            for (int j = 0; j < N; ++j) { sc >> k; if (k != last + 1) break; last = k; }
+            wg.done();
+        });
+        for (int k = 1; k <= N; ++k) sc << k;
+        wg.wait();
+        EXPECT_EQ(last, N);
+    }
+
     DEF_case(mutex) {
         co::Mutex m;
         co::WaitGroup wg;
@@ -83,6 +717,226 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(cond_var) {
+        co::Mutex m;
+        co::CondVar cv;
+        co::WaitGroup wg;
+        int n = 0, got = 0;
+        bool r = true;
+
+        wg.add(1);
+        go([wg, m, cv, &r]() {
+            co::MutexGuard g(m);
+            r = cv.wait(m, 1);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(!r);
+
+        // consumers wait until the producer puts something
+        wg.add(5);
+        for (int i = 0; i < 4; ++i) {
+            go([wg, m, cv, &n, &got]() {
+                co::MutexGuard g(m);
+                cv.wait(m, [&]() { return n > 0; });
+                --n;
+                ++got;
+                wg.done();
+            });
+        }
+        go([wg, m, cv, &n]() {
+            for (int i = 0; i < 4; ++i) {
+                co::sleep(1);
+                co::MutexGuard g(m);
+                ++n;
+                cv.notify_one();
+            }
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(got, 4);
+        EXPECT_EQ(n, 0);
+
+        r = true;
+        wg.add(1);
+        go([wg, m, cv, &n, &r]() {
+            co::MutexGuard g(m);
+            r = cv.wait(m, [&]() { return n > 0; }, 5);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(!r);
+    }
+
+    DEF_case(shared_mutex) {
+        co::SharedMutex m;
+        co::WaitGroup wg;
+
+        // readers share the lock
+        EXPECT(m.try_lock_shared());
+        EXPECT(m.try_lock_shared());
+        EXPECT(!m.try_lock());
+        m.unlock_shared();
+        m.unlock_shared();
+        EXPECT(m.try_lock());
+        EXPECT(!m.try_lock_shared());
+        m.unlock();
+
+        // a waiting writer blocks new readers
+        co::vector<int> seq;
+        EXPECT(m.try_lock_shared());
+        wg.add(2);
+        go([wg, m, &seq]() {
+            co::WriteLockGuard g(m);
+            seq.push_back(1);
+            wg.done();
+        });
+        co::sleep(1);
+        EXPECT(!m.try_lock_shared());
+        go([wg, m, &seq]() {
+            co::ReadLockGuard g(m);
+            seq.push_back(2);
+            wg.done();
+        });
+        co::sleep(1);
+        m.unlock_shared();
+        wg.wait();
+        EXPECT_EQ(seq.size(), 2);
+        if (seq.size() == 2) {
+            EXPECT_EQ(seq[0], 1);
+            EXPECT_EQ(seq[1], 2);
+        }
+
+        int n = 0;
+        wg.add(16);
+        for (int i = 0; i < 16; ++i) {
+            go([wg, m, i, &n]() {
+                if (i % 4 == 0) {
+                    co::WriteLockGuard g(m);
+                    ++n;
+                } else {
+                    co::ReadLockGuard g(m);
+                    co::sleep(1);
+                }
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(n, 4);
+    }
+
+    DEF_case(semaphore) {
+        co::Semaphore sem(2);
+        co::WaitGroup wg;
+        EXPECT(sem.try_acquire(2));
+        EXPECT(!sem.try_acquire());
+        sem.release(2);
+        EXPECT_EQ(sem.count(), 2);
+
+        // at most 2 coroutines run at the same time
+        int running = 0, max = 0, n = 0;
+        wg.add(8);
+        for (int i = 0; i < 8; ++i) {
+            go([wg, sem, &running, &max, &n]() {
+                if (sem.acquire()) {
+                    if (++running > max) max = running;
+                    co::sleep(1);
+                    --running;
+                    ++n;
+                    sem.release();
+                }
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(n, 8);
+        EXPECT_EQ(max, 2);
+        EXPECT_EQ(sem.count(), 2);
+
+        // timeout, the permits are not taken
+        bool r = true;
+        wg.add(1);
+        go([wg, sem, &r]() {
+            r = sem.acquire(3, 1);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(!r);
+        EXPECT_EQ(sem.count(), 2);
+    }
+
+    DEF_case(latch) {
+        co::Latch l(3);
+        EXPECT(!l.try_wait());
+        EXPECT(!l.wait(1));
+
+        co::WaitGroup wg;
+        int n = 0;
+        wg.add(4);
+        for (int i = 0; i < 4; ++i) {
+            go([wg, l, &n]() {
+                if (l.wait()) atomic_inc(&n, mo_relaxed);
+                wg.done();
+            });
+        }
+        go([l]() { l.count_down(2); co::sleep(1); l.count_down(); });
+        wg.wait();
+        EXPECT_EQ(n, 4);
+        EXPECT(l.try_wait());
+        EXPECT(l.wait(0));
+    }
+
+    DEF_case(task_group) {
+        co::Event ev;
+        int r0 = 0, r1 = 0, e1 = 0, r2 = 1;
+        bool c2 = false;
+        const int64 t = now::ms();
+        {
+            co::TaskGroup g;
+            g.go([&r0]() { r0 = 1; });
+            g.go([&r1, &e1]() {
+                sock_t fd = co::udp_socket();
+                struct sockaddr_in addr;
+                co::init_ip_addr(&addr, "127.0.0.1", 30125);
+                co::bind(fd, &addr, sizeof(addr));
+                char buf[8];
+                r1 = co::recv(fd, buf, 8);
+                e1 = co::error();
+                co::close(fd);
+            });
+            g.go([ev, &r2, &c2]() {
+                r2 = ev.wait((uint32)-1) ? 1 : 0;
+                c2 = co::cancelled();
+                co::sleep(10000); // returns at once as it was cancelled
+            });
+            g.go([]() { co::sleep(10000); });
+
+            EXPECT_EQ(g.size(), 4u);
+            EXPECT_GE(g.wait_any(), 1u);
+            EXPECT_EQ(g.wait(4, 16), 1u);
+            g.cancel();
+            EXPECT_EQ(g.wait(), 4u);
+            EXPECT_EQ(g.finished(), 4u);
+        }
+        EXPECT_LT(now::ms() - t, 3000);
+        EXPECT_EQ(r0, 1);
+        EXPECT_EQ(r1, -1);
+        EXPECT_EQ(e1, ECANCELED);
+        EXPECT_EQ(r2, 0);
+        EXPECT(c2);
+        EXPECT(!co::cancelled());
+
+        // tasks left are cancelled by the destructor
+        int n = 0;
+        {
+            co::TaskGroup g;
+            for (int i = 0; i < 3; ++i) {
+                g.go([&n]() { co::sleep(10000); if (co::cancelled()) atomic_inc(&n); });
+            }
+        }
+        EXPECT_EQ(n, 3);
+    }
+
     DEF_case(pool) {
         co::Pool p(
             []() { return (void*) new int(0); },
@@ -123,6 +977,291 @@ DEF_test(co) {
 
         p.clear();
     }
+
+    DEF_case(pool_ttl) {
+        int* const d = new int(0);
+        co::Pool p(
+            []() { return (void*) new int(0); },
+            [d](void* p) { atomic_inc(d); delete (int*)p; },
+            8192, 10, true
+        );
+
+        co::WaitGroup wg;
+        wg.add(1);
+        size_t n0 = 0, n1 = 0;
+        co::next_scheduler()->go([wg, p, &n0, &n1]() {
+            int* x[4];
+            for (int i = 0; i < 4; ++i) x[i] = (int*) p.pop();
+            for (int i = 0; i < 4; ++i) p.push(x[i]);
+            n0 = p.size();
+            co::sleep(64);
+            n1 = p.size();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_EQ(n0, 4);
+        EXPECT_EQ(n1, 0);
+        co::sleep(8); // let the coroutine destroying the elements finish
+        EXPECT_EQ(atomic_load(d), 4);
+        p.clear();
+        delete d;
+    }
+
+    DEF_case(future) {
+        co::Promise<fastring> pr;
+        co::Future<fastring> f = pr.get_future();
+        fastring s;
+        EXPECT(!f.ready());
+        EXPECT(!f.get(s, 0));
+        EXPECT(!f.wait(1));
+
+        Thread([&pr]() { co::sleep(4); pr.set_value("hello"); }).detach();
+        EXPECT_EQ(f.get(), "hello");
+        EXPECT(f.ready());
+        EXPECT(f.get(s, 0));
+        EXPECT_EQ(s, "hello");
+
+        // get() in coroutines
+        co::Promise<int> pi;
+        co::Future<int> fi = pi.get_future();
+        co::WaitGroup wg;
+        wg.add(2);
+        int r[2] = { 0, 0 };
+        for (int i = 0; i < 2; ++i) {
+            go([wg, fi, i, &r]() { r[i] = fi.get(); wg.done(); });
+        }
+        go([&pi]() { co::sleep(4); pi.set_value(7); });
+        wg.wait();
+        EXPECT_EQ(r[0], 7);
+        EXPECT_EQ(r[1], 7);
+    }
+
+    DEF_case(when_all_any) {
+        co::vector<co::Promise<int>> ps(3);
+        co::vector<co::Future<int>> fs;
+        for (auto& p : ps) fs.push_back(p.get_future());
+
+        EXPECT_EQ(co::when_any(fs, 0), -1);
+        EXPECT(!co::when_all(fs, 1));
+
+        ps[1].set_value(1);
+        EXPECT_EQ(co::when_any(fs), 1);
+        EXPECT(!co::when_all(fs, 0));
+
+        Thread([&ps]() {
+            co::sleep(2); ps[2].set_value(2);
+            co::sleep(2); ps[0].set_value(0);
+        }).detach();
+        EXPECT(co::when_all(fs));
+        for (int i = 0; i < 3; ++i) EXPECT_EQ(fs[i].get(), i);
+    }
+
+    DEF_case(offload) {
+        co::WaitGroup wg;
+        wg.add(4);
+        int v[4] = { 0 };
+        bool other = false;
+        auto s = co::next_scheduler();
+        for (int i = 0; i < 4; ++i) {
+            s->go([wg, i, &v]() {
+                const int id = co::scheduler_id();
+                int x = 0;
+                co::offload([&]() { sleep::ms(8); x = co::scheduler_id(); });
+                v[i] = x == -1 && co::scheduler_id() == id ? 1 : 0;
+                wg.done();
+            });
+        }
+        // the scheduler is not blocked by the sleeping tasks
+        wg.add(1);
+        s->go([wg, &other]() { other = true; wg.done(); });
+        wg.wait();
+
+        for (int i = 0; i < 4; ++i) EXPECT_EQ(v[i], 1);
+        EXPECT(other);
+        const auto st = co::offload_stats();
+        EXPECT_GE(st.tasks, 4);
+        EXPECT_GE(st.threads, 1);
+        EXPECT_EQ(st.queued, 0);
+    }
+
+#ifndef _WIN32
+    DEF_case(file_io) {
+        const char* path = "xx_co_file_io.txt";
+        const uint64 n0 = co::offload_stats().tasks;
+        int v[6] = { 0 };
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, path, &v]() {
+            fs::file f(path, 'w');
+            v[0] = f.write("hello world", 11) == 11;
+            f.close();
+
+            char buf[16] = { 0 }; // on the stack
+            const int fd = ::open(path, O_RDONLY);
+            v[1] = ::read(fd, buf, 5) == 5 && memcmp(buf, "hello", 5) == 0;
+            v[2] = ::pread(fd, buf, 5, 6) == 5 && memcmp(buf, "world", 5) == 0;
+
+            char a[3] = { 0 }, b[3] = { 0 };
+            struct iovec iov[2] = { { a, 3 }, { b, 3 } };
+            v[3] = ::readv(fd, iov, 2) == 6 && memcmp(a, " wo", 3) == 0 && memcmp(b, "rld", 3) == 0;
+            v[4] = ::read(fd, buf, 8) == 0;
+            ::close(fd);
+
+            fs::file g(path, 'r');
+            v[5] = g.read(6) == "hello ";
+            wg.done();
+        });
+        wg.wait();
+        fs::remove(path);
+
+        for (int i = 0; i < 6; ++i) EXPECT_EQ(v[i], 1);
+        if (!FLG_co_io_uring) EXPECT_GE(co::offload_stats().tasks, n0 + 6);
+    }
+
+    DEF_case(poll) {
+        static int fds[64][2];
+        for (int i = 0; i < 64; ++i) EXPECT_EQ(::pipe(fds[i]), 0);
+
+        int v[4] = { 0 };
+        co::WaitGroup wg;
+        wg.add(2);
+        auto s = co::next_scheduler();
+        s->go([wg, &v]() {
+            struct pollfd p[64];
+            for (int i = 0; i < 64; ++i) { p[i].fd = fds[i][0]; p[i].events = POLLIN; }
+            int64 t = now::ms();
+            v[0] = ::poll(p, 64, 3000) == 1 && p[37].revents == POLLIN && p[36].revents == 0;
+            v[1] = now::ms() - t < 1000;
+
+            fd_set rs;
+            FD_ZERO(&rs);
+            int n = 0;
+            for (int i = 0; i < 64; ++i) {
+                if (i != 37) { FD_SET(fds[i][0], &rs); if (n <= fds[i][0]) n = fds[i][0] + 1; }
+            }
+            struct timeval tv = { 0, 50000 };
+            t = now::ms();
+            v[2] = ::select(n, &rs, 0, 0, &tv) == 0;
+            v[3] = now::ms() - t >= 40;
+            wg.done();
+        });
+        // runs on the same scheduler, while the poller is parked
+        s->go([wg]() {
+            co::sleep(20);
+            auto r = ::write(fds[37][1], "x", 1); (void)r;
+            wg.done();
+        });
+        wg.wait();
+
+        for (int i = 0; i < 4; ++i) EXPECT_EQ(v[i], 1);
+        for (int i = 0; i < 64; ++i) { ::close(fds[i][0]); ::close(fds[i][1]); }
+    }
+
+    DEF_case(many_events) {
+        // more events at once than the initial event buffer of a scheduler
+        static int fds[200][2];
+        for (int i = 0; i < 200; ++i) EXPECT_EQ(::pipe(fds[i]), 0);
+
+        static int v[200];
+        memset(v, 0, sizeof(v));
+        co::WaitGroup wg;
+        wg.add(200);
+        auto s = co::next_scheduler();
+        for (int i = 0; i < 200; ++i) {
+            s->go([wg, i]() {
+                char c = 0;
+                v[i] = ::read(fds[i][0], &c, 1) == 1 && c == (char)i;
+                wg.done();
+            });
+        }
+        s->go([]() {
+            co::sleep(20);
+            for (int i = 0; i < 200; ++i) {
+                const char c = (char)i;
+                auto r = ::write(fds[i][1], &c, 1); (void)r;
+            }
+        });
+        wg.wait();
+
+        int n = 0;
+        for (int i = 0; i < 200; ++i) n += v[i];
+        EXPECT_EQ(n, 200);
+        for (int i = 0; i < 200; ++i) { ::close(fds[i][0]); ::close(fds[i][1]); }
+    }
+
+  #ifdef __linux__
+    DEF_case(zero_copy) {
+        const char* path = "xx_co_zero_copy.txt";
+        { fs::file f(path, 'w'); f.write("hello world", 11); }
+
+        static int a[2], b[2], u[2];
+        EXPECT_EQ(::pipe(a), 0);
+        EXPECT_EQ(::pipe(b), 0);
+        EXPECT_EQ(::socketpair(AF_UNIX, SOCK_DGRAM, 0, u), 0);
+
+        int v[7] = { 0 };
+        co::WaitGroup wg;
+        wg.add(2);
+        auto s = co::next_scheduler();
+        s->go([wg, path, &v]() {
+            char buf[16] = { 0 };
+            // a is empty, splice() parks the coroutine
+            v[0] = ::splice(a[0], 0, b[1], 0, 5, 0) == 5;
+            v[1] = ::read(b[0], buf, 16) == 5 && memcmp(buf, "hello", 5) == 0;
+
+            auto r = ::write(a[1], "xyz", 3); (void)r;
+            v[2] = ::tee(a[0], b[1], 3, 0) == 3 && ::read(a[0], buf, 16) == 3 && ::read(b[0], buf + 3, sizeof(buf) - 3) == 3;
+
+            const int fd = ::open(path, O_RDONLY);
+            off_t off = 6;
+            v[3] = ::sendfile(b[1], fd, &off, 5) == 5 && off == 11 && ::read(b[0], buf, 16) == 5 && memcmp(buf, "world", 5) == 0;
+            ::close(fd);
+
+            const int fi = ::open(path, O_RDONLY);
+            const int fo = ::open("xx_co_zero_copy.bak", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            loff_t oi = 6;
+            v[6] = ::copy_file_range(fi, &oi, fo, 0, 5, 0) == 5 && oi == 11;
+            ::close(fi); ::close(fo);
+
+            // u[0] is empty, recvmmsg() parks the coroutine
+            char x[4][8];
+            struct iovec iov[4];
+            struct mmsghdr m[4];
+            memset(m, 0, sizeof(m));
+            for (int i = 0; i < 4; ++i) {
+                iov[i].iov_base = x[i];
+                iov[i].iov_len = 8;
+                m[i].msg_hdr.msg_iov = &iov[i];
+                m[i].msg_hdr.msg_iovlen = 1;
+            }
+            v[4] = ::recvmmsg(u[0], m, 4, 0, 0) == 2 && m[0].msg_len == 3 && m[1].msg_len == 2;
+            v[5] = memcmp(x[0], "foo", 3) == 0 && memcmp(x[1], "go", 2) == 0;
+            wg.done();
+        });
+        // runs on the same scheduler, while the other one is parked
+        s->go([wg]() {
+            co::sleep(20);
+            auto r = ::write(a[1], "hello", 5); (void)r;
+            co::sleep(20);
+            struct iovec iov[2] = { { (void*)"foo", 3 }, { (void*)"go", 2 } };
+            struct mmsghdr m[2];
+            memset(m, 0, sizeof(m));
+            for (int i = 0; i < 2; ++i) { m[i].msg_hdr.msg_iov = &iov[i]; m[i].msg_hdr.msg_iovlen = 1; }
+            r = ::sendmmsg(u[1], m, 2, 0); (void)r;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(fs::fsize("xx_co_zero_copy.bak"), 5);
+        fs::remove(path);
+        fs::remove("xx_co_zero_copy.bak");
+
+        for (int i = 0; i < 7; ++i) EXPECT_EQ(v[i], 1);
+        ::close(a[0]); ::close(a[1]); ::close(b[0]); ::close(b[1]);
+        ::close(u[0]); ::close(u[1]);
+    }
+  #endif
+#endif
 }
 
 } // test
@@ -0,0 +1,93 @@
+#include "co/unitest.h"
+#include "co/concurrent_lru.h"
+#include "co/fastring.h"
+#include "co/str.h"
+#include "co/time.h"
+#include <thread>
+
+namespace test {
+
+DEF_test(concurrent_lru) {
+    DEF_case(basic) {
+        co::ConcurrentLru<fastring, int> c(64, 4);
+        int v = 0;
+        EXPECT(!c.get("a", v));
+        c.set("a", 1);
+        c.set(fastring("b"), 2);
+        EXPECT(c.get("a", v));
+        EXPECT_EQ(v, 1);
+        c.set("a", 3);
+        EXPECT(c.get("a", v));
+        EXPECT_EQ(v, 3);
+        EXPECT_EQ(c.size(), 2);
+
+        EXPECT(c.erase("b"));
+        EXPECT(!c.erase("b"));
+        EXPECT(!c.get("b", v));
+
+        auto s = c.stats();
+        EXPECT_EQ(s.hits, 2);
+        EXPECT_EQ(s.misses, 2);
+
+        c.clear();
+        EXPECT_EQ(c.size(), 0);
+    }
+
+    DEF_case(evict) {
+        // one shard, so that the order of eviction is known
+        co::ConcurrentLru<int, int> c(4, 1);
+        for (int i = 0; i < 4; ++i) c.set(i, i);
+        int v = 0;
+        EXPECT(c.get(0, v));
+        EXPECT(c.get(2, v));
+        c.set(4, 4); // 1 is the first entry not referenced
+        EXPECT_EQ(c.size(), 4);
+        EXPECT(!c.get(1, v));
+        EXPECT(c.get(0, v));
+        EXPECT(c.get(4, v));
+        EXPECT_EQ(c.stats().evictions, 1);
+
+        for (int i = 5; i < 100; ++i) c.set(i, i);
+        EXPECT_EQ(c.size(), 4);
+        EXPECT(c.get(99, v));
+        EXPECT_EQ(v, 99);
+    }
+
+    DEF_case(ttl) {
+        co::ConcurrentLru<int, int> c(16, 2, 20);
+        c.set(1, 1);
+        c.set(2, 2, 0); // no TTL
+        int v = 0;
+        EXPECT(c.get(1, v));
+        sleep::ms(40);
+        EXPECT(!c.get(1, v));
+        EXPECT(c.get(2, v));
+        EXPECT_EQ(c.stats().expirations, 1);
+    }
+
+    DEF_case(threads) {
+        co::ConcurrentLru<fastring, int> c(1024);
+        co::vector<std::thread> t;
+        for (int i = 0; i < 4; ++i) {
+            t.push_back(std::thread([&c]() {
+                int v;
+                for (int k = 0; k < 10000; ++k) {
+                    fastring key = str::cat("k", k % 2000);
+                    if (!c.get(key, v)) c.set(key, k % 2000);
+                }
+            }));
+        }
+        for (auto& x : t) x.join();
+        EXPECT(c.size() <= 1024 + 16);
+        int v = -1;
+        bool ok = true;
+        for (int k = 0; k < 2000; ++k) {
+            if (c.get(str::cat("k", k), v) && v != k) ok = false;
+        }
+        EXPECT(ok);
+        auto s = c.stats();
+        EXPECT_EQ(s.hits + s.misses, 40000 + 2000);
+    }
+}
+
+} // namespace test
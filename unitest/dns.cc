@@ -0,0 +1,105 @@
+#include "co/unitest.h"
+#include "co/dns.h"
+#include "co/co.h"
+#include "co/flag.h"
+
+DEC_string(dns_servers);
+
+namespace test {
+
+static uint32 g_queries = 0;
+
+// a name server for A records, NXDOMAIN for names beginning with "nx"
+static void fake_dns(sock_t fd) {
+    char buf[512];
+    while (true) {
+        struct sockaddr_in a;
+        int len = sizeof(a);
+        const int n = co::recvfrom(fd, buf, 400, &a, &len);
+        if (n < 17) break;
+        atomic_inc(&g_queries);
+        co::sleep(20); // so that concurrent lookups meet
+
+        const bool nx = buf[13] == 'n' && buf[14] == 'x';
+        buf[2] = (char)0x81;
+        buf[3] = nx ? (char)0x83 : (char)0x80;
+        buf[7] = nx ? 0 : 1;
+        int k = n;
+        if (!nx) {
+            const char rr[] = "\xc0\x0c\x00\x01\x00\x01\x00\x00\x00\x64\x00\x04\x0a\x01\x02\x03";
+            memcpy(buf + k, rr, 16);
+            k += 16;
+        }
+        co::sendto(fd, buf, k, &a, len);
+    }
+    co::close(fd);
+}
+
+DEF_test(dns) {
+    DEF_case(ip) {
+        co::vector<fastring> v;
+        EXPECT(dns::resolve("10.0.0.1", v));
+        EXPECT(dns::resolve("::1", v));
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0], "10.0.0.1");
+        EXPECT_EQ(v[1], "::1");
+        EXPECT(!dns::resolve("", v));
+    }
+
+    DEF_case(query) {
+        sock_t fd = co::udp_socket();
+        struct sockaddr_in a;
+        co::init_ip_addr(&a, "127.0.0.1", 0);
+        EXPECT_EQ(co::bind(fd, &a, sizeof(a)), 0);
+        int len = sizeof(a);
+        getsockname(fd, (sockaddr*)&a, (socklen_t*)&len);
+        FLG_dns_servers = fastring("127.0.0.1:") << ntoh16(a.sin_port);
+        go(fake_dns, fd);
+
+        co::WaitGroup wg;
+        int ok[8] = { 0 };
+        fastring ip[8];
+        wg.add(8);
+        for (int i = 0; i < 8; ++i) {
+            go([wg, i, &ok, &ip]() {
+                co::vector<fastring> v;
+                ok[i] = dns::resolve("x.co.test", v) ? 1 : 0;
+                if (!v.empty()) ip[i] = v[0];
+                wg.done();
+            });
+        }
+        wg.wait();
+        for (int i = 0; i < 8; ++i) {
+            EXPECT_EQ(ok[i], 1);
+            EXPECT_EQ(ip[i], "10.1.2.3");
+        }
+        EXPECT_EQ(atomic_load(&g_queries), 1); // one query for all, and cached
+
+        bool r[3] = { false, false, true };
+        wg.add(1);
+        go([wg, &r]() {
+            co::vector<fastring> v;
+            r[0] = dns::resolve("X.co.test.", v);
+            r[1] = dns::resolve("nx.co.test.", v);
+            r[2] = dns::resolve("nx.co.test.", v);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(r[0]);
+        EXPECT(!r[1]);
+        EXPECT(!r[2]);
+        EXPECT_EQ(atomic_load(&g_queries), 3); // "x.co.test." and "nx.co.test." once
+
+        dns::clear_cache();
+        wg.add(1);
+        go([wg, a]() {
+            sock_t c = co::udp_socket();
+            co::sendto(c, "quit", 4, &a, sizeof(a));
+            co::close(c);
+            wg.done();
+        });
+        wg.wait();
+    }
+}
+
+} // test
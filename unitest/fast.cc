@@ -169,6 +169,147 @@ DEF_test(fast) {
         EXPECT_EQ(fastring(buf, fast::dtoa(123000e30, buf, 1)), "1.2e35");
         EXPECT_EQ(fastring(buf, fast::dtoa(12345e-8, buf, 4)), "1.2345e-4");
         EXPECT_EQ(fastring(buf, fast::dtoa(12345e-8, buf, 2)), "1.23e-4");
+
+        // the shortest digits, Grisu2 gives one more for them
+        EXPECT_EQ(fastring(buf, fast::dtoa(-59759.64441918179, buf)), "-59759.64441918179");
+        EXPECT_EQ(fastring(buf, fast::dtoa(-48298647240.20541, buf)), "-48298647240.20541");
+        EXPECT_EQ(fastring(buf, fast::dtoa(2.615660566062332e216, buf)), "2.615660566062332e216");
+        EXPECT_EQ(fastring(buf, fast::dtoa(0.3, buf)), "0.3");
+        EXPECT_EQ(fastring(buf, fast::dtoa(1e23, buf)), "1e23");
+        EXPECT_EQ(fastring(buf, fast::dtoa(9007199254740992.0, buf)), "9007199254740992.0");
+        EXPECT_EQ(fastring(buf, fast::dtoa(123456789012345678.0, buf)), "123456789012345680.0");
+        EXPECT_EQ(fastring(buf, fast::dtoa(1e21, buf)), "1e21");
+
+        const double inf = HUGE_VAL;
+        EXPECT_EQ(fastring(buf, fast::dtoa(inf, buf)), "inf");
+        EXPECT_EQ(fastring(buf, fast::dtoa(-inf, buf)), "-inf");
+        EXPECT_EQ(fastring(buf, fast::dtoa(inf - inf, buf)), "nan");
+
+        // random doubles round trip, with digits no more than %.17g needs
+        bool ok = true;
+        uint64 x = 88172645463325252ull;
+        char s[32];
+        for (int i = 0; i < 10000 && ok; ++i) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            double d;
+            memcpy(&d, &x, sizeof(d));
+            if (d != d || d == HUGE_VAL || d == -HUGE_VAL) continue;
+            const int n = fast::dtoa(d, buf);
+            buf[n] = '\0';
+            int p = 1;
+            for (; p < 17; ++p) {
+                snprintf(s, sizeof(s), "%.*g", p, d);
+                if (strtod(s, 0) == d) break;
+            }
+            const char* e = strchr(buf, 'e');
+            int m = 0; // significant digits
+            for (const char* q = buf; q < (e ? e : buf + n); ++q) {
+                if ('0' <= *q && *q <= '9' && (m > 0 || *q != '0')) ++m;
+            }
+            if (!e && n > 2 && buf[n - 1] == '0' && buf[n - 2] == '.') { /* 12300.0 */
+                --m;
+                for (const char* q = buf + n - 3; q >= buf && *q == '0'; --q) --m;
+            }
+            ok = strtod(buf, 0) == d && m <= p;
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(atod) {
+        auto atod = [](const char* s, double& v) { return fast::atod(s, strlen(s), v); };
+        double v = 0;
+        EXPECT(atod("0", v) && v == 0.0);
+        EXPECT(atod("-0", v) && v == 0.0 && signbit(v));
+        EXPECT(atod("3.14", v) && v == 3.14);
+        EXPECT(atod("-79.39773355813419", v) && v == -79.39773355813419);
+        EXPECT(atod("1e23", v) && v == 1e23);
+        EXPECT(atod("9007199254740993", v) && v == 9007199254740992.0);
+        EXPECT(atod("1.7976931348623157e308", v) && v == 1.7976931348623157e308);
+        EXPECT(atod("2.2250738585072014e-308", v) && v == 2.2250738585072014e-308);
+        EXPECT(atod("5e-324", v) && v == 5e-324);
+        EXPECT(atod("1e-400", v) && v == 0.0);
+        EXPECT(atod("123456789012345678901234567890", v) && v == 123456789012345678901234567890.0);
+        EXPECT(atod("0.1000000000000000055511151231257827", v) && v == 0.1);
+        EXPECT(atod("1.00000000000000011102230246251565404236316680908203125", v) && v == 1.0);
+        EXPECT(atod("1.00000000000000011102230246251565404236316680908203126", v) && v == 1.0000000000000002);
+
+        // the same as strtod for random doubles
+        bool same = true;
+        uint64 x = 88172645463325252ull;
+        char s[32];
+        for (int i = 0; i < 10000 && same; ++i) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            double d;
+            memcpy(&d, &x, sizeof(d));
+            if (d != d || d == HUGE_VAL || d == -HUGE_VAL) continue;
+            snprintf(s, sizeof(s), "%.17g", d);
+            same = atod(s, v) && v == strtod(s, 0);
+        }
+        EXPECT(same);
+
+        EXPECT(!atod("1e400", v));
+        EXPECT(!atod("-1e400", v));
+        EXPECT(!atod("", v));
+        EXPECT(!atod("-", v));
+        EXPECT(!atod("1.", v));
+        EXPECT(!atod("1e", v));
+        EXPECT(!atod("1x", v));
+    }
+
+    DEF_case(read_digits) {
+        auto rd = [](const char* s, uint64& v) { return fast::read_digits(s, s + strlen(s), v) - s; };
+        uint64 v = 1;
+        EXPECT_EQ(rd("", v), 0);
+        EXPECT_EQ(v, 0);
+        EXPECT_EQ(rd("x1", v), 0);
+        EXPECT_EQ(rd("7", v), 1);
+        EXPECT_EQ(v, 7);
+        EXPECT_EQ(rd("1234567", v), 7);
+        EXPECT_EQ(v, 1234567);
+        EXPECT_EQ(rd("12345678", v), 8);
+        EXPECT_EQ(v, 12345678);
+        EXPECT_EQ(rd("1234567:9", v), 7);
+        EXPECT_EQ(v, 1234567);
+        EXPECT_EQ(rd("123456789/", v), 9);
+        EXPECT_EQ(v, 123456789);
+        EXPECT_EQ(rd("09876543210987654321.5", v), 20);
+        EXPECT_EQ(v, 987654321098765432ull);
+        EXPECT_EQ(rd("18446744073709551615", v), 20);
+        EXPECT_EQ(v, 1844674407370955161ull);
+
+        bool same = true;
+        char s[32];
+        for (uint64 x = 1; x < MAX_UINT64 / 10 && same; x = x * 10 + x % 7) {
+            const int n = fast::u64toa(x, s);
+            s[n] = '\0';
+            same = rd(s, v) == n && v == x;
+        }
+        EXPECT(same);
+    }
+
+    DEF_case(memmem) {
+        const char* s = "hello world, hello co";
+        const size_t n = strlen(s);
+        EXPECT_EQ(fast::memmem(s, n, "hello", 5), s);
+        EXPECT_EQ(fast::memmem(s + 1, n - 1, "hello", 5), s + 13);
+        EXPECT_EQ(fast::memmem(s, n, "co", 2), s + 19);
+        EXPECT_EQ(fast::memmem(s, n, "d", 1), s + 10);
+        EXPECT_EQ(fast::memmem(s, n, "", 0), s);
+        EXPECT(fast::memmem(s, n, "cox", 3) == NULL);
+        EXPECT(fast::memmem(s, 3, "hello", 5) == NULL);
+
+        // binary data, and matches around the 16-byte blocks
+        fastring x(100, 'a');
+        x[40] = '\0';
+        x.append("\0\r\n\r\n", 5);
+        EXPECT_EQ(fast::memmem(x.data(), x.size(), "\r\n\r\n", 4), x.data() + 101);
+        EXPECT_EQ(fast::memmem(x.data(), x.size(), "a\0a", 3), x.data() + 39);
+        for (size_t i = 0; i + 3 <= 64; ++i) {
+            fastring y(64, 'x');
+            memcpy(&y[i], "abc", 3);
+            EXPECT_EQ(fast::memmem(y.data(), y.size(), "abc", 3), y.data() + i);
+            EXPECT(fast::memmem(y.data(), y.size(), "abd", 3) == NULL);
+        }
     }
 }
 
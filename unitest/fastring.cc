@@ -1,5 +1,7 @@
 #include "co/unitest.h"
 #include "co/fastring.h"
+#include "co/str.h"
+#include "co/fastream.h"
 
 namespace test {
 
@@ -219,6 +221,47 @@ DEF_test(fastring) {
         EXPECT_LE(s, "9999999");
     }
 
+    DEF_case(format) {
+        fastring s;
+        s.format("{}:{}", "127.0.0.1", 7777);
+        EXPECT_EQ(s, "127.0.0.1:7777");
+
+        s.clear();
+        s.format("{} {} {} {} {}", true, 'c', -3, 3.5, (uint64)-1);
+        EXPECT_EQ(s, "true c -3 3.5 18446744073709551615");
+
+        s.clear();
+        s.format("{ {}{} }", fastring("x"), std::string("y"));
+        EXPECT_EQ(s, "{ xy }");
+
+        // extra args are ignored, extra "{}" are left as they are
+        s.clear();
+        s.format("{}", 1, 2);
+        EXPECT_EQ(s, "1");
+        s.clear();
+        s.format("{}-{}", 1);
+        EXPECT_EQ(s, "1-{}");
+        s.clear();
+        s.format("abcdefgh{}abcdefgh{", 1);
+        EXPECT_EQ(s, "abcdefgh1abcdefgh{");
+
+        // types without a known size are written by operator<<
+        s.clear();
+        const char* p = 0;
+        const char* x = "x";
+        s.format("{} {} {}", (void*)p, x, fastring(64, 'a'));
+        EXPECT_EQ(s, fastring("0x0 x ") + fastring(64, 'a'));
+
+        s.clear();
+        s.format(fastring("<{}>"), 8);
+        EXPECT_EQ(s, "<8>");
+        EXPECT_EQ(str::format("{}+{}", 1, 2), "1+2");
+
+        fastream fs;
+        fs.format("a{}c", 'b');
+        EXPECT_EQ(fs.str(), "abc");
+    }
+
     DEF_case(find) {
         fastring s("xxxyyyzzz");
         EXPECT_EQ(s.find('a'), s.npos);
@@ -248,6 +291,14 @@ DEF_test(fastring) {
         EXPECT_EQ(s.find("xy"), 2);
         EXPECT_EQ(s.find("yy"), 3);
         EXPECT_EQ(s.find("yy", 4), 4);
+        EXPECT_EQ(s.find("zzzz"), s.npos);
+
+        fastring b("xx\0yy\0zz", 8);
+        EXPECT_EQ(b.find("zz"), 6);
+        EXPECT_EQ(b.find(fastring("y\0z", 3)), 4);
+        EXPECT_EQ(b.rfind('x'), 1);
+        EXPECT_EQ(b.find_first_of("zy"), 3);
+        EXPECT_EQ(b.find_first_not_of("xy"), 2);
 
         EXPECT_EQ(s.find_first_of("xy"), 0);
         EXPECT_EQ(s.find_first_of("yz"), 3);
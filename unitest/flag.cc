@@ -117,6 +117,45 @@ DEF_test(flag) {
             fs::remove("ut_xxx.conf");
         }
     }
+
+    DEF_case(values) {
+        flag::set_value("ut_string", "xx");
+        auto v = flag::values();
+        fastring s, prev;
+        bool sorted = true;
+        for (auto& x : v) {
+            if (x.first == "ut_string") s = x.second;
+            if (!prev.empty() && x.first < prev) sorted = false;
+            prev = x.first;
+        }
+        EXPECT_EQ(s, "xx");
+        EXPECT(sorted);
+    }
+
+    DEF_case(update) {
+        EXPECT(!flag::set_mutable("ut_string"));
+        EXPECT(!flag::set_mutable("ut_xxx"));
+        EXPECT(flag::set_mutable("ut_int32"));
+        EXPECT(flag::set_mutable("ut_double"));
+        EXPECT(flag::is_mutable("ut_int32"));
+        EXPECT(!flag::is_mutable("ut_int64"));
+        EXPECT(!flag::update("ut_int64", "1").empty());
+
+        int n = 0;
+        EXPECT(flag::watch("ut_int32", [&n]() { ++n; }));
+        EXPECT(!flag::watch("ut_int64", [&n]() { ++n; }));
+        EXPECT(flag::update("ut_int32", "4k").empty());
+        EXPECT_EQ(FLG_ut_int32, 4096);
+        EXPECT_EQ(n, 1);
+
+        // a bad value changes nothing
+        EXPECT(!flag::update("ut_int32", "xx").empty());
+        EXPECT_EQ(FLG_ut_int32, 4096);
+        EXPECT_EQ(n, 1);
+
+        EXPECT(flag::update("ut_double", "3.5").empty());
+        EXPECT_EQ(FLG_ut_double, 3.5);
+    }
 }
 
 } // test
@@ -0,0 +1,123 @@
+#include "co/unitest.h"
+#include "co/flat_hash_map.h"
+#include "co/fastring.h"
+#include "co/str.h"
+
+namespace test {
+
+DEF_test(flat_hash_map) {
+    DEF_case(map) {
+        co::flat_hash_map<int, int> m;
+        EXPECT(m.empty());
+        EXPECT(m.find(1) == m.end());
+        EXPECT(m.begin() == m.end());
+
+        EXPECT(m.insert(1, 1).second);
+        EXPECT(!m.insert(1, 2).second);
+        EXPECT(m.insert(std::make_pair(2, 2)).second);
+        m[3] = 3;
+        m.emplace(4, 4);
+        EXPECT_EQ(m.size(), 4);
+        EXPECT_EQ(m.find(1)->second, 1);
+        EXPECT_EQ(m[3], 3);
+        EXPECT_EQ(m.count(4), 1);
+        EXPECT_EQ(m.count(5), 0);
+        EXPECT(m.contains(2));
+
+        EXPECT_EQ(m.erase(2), 1);
+        EXPECT_EQ(m.erase(2), 0);
+        EXPECT(m.find(2) == m.end());
+        EXPECT_EQ(m.size(), 3);
+
+        int sum = 0;
+        for (auto& x : m) sum += x.second;
+        EXPECT_EQ(sum, 8);
+
+        const auto& c = m;
+        EXPECT_EQ(c.find(4)->second, 4);
+
+        co::flat_hash_map<int, int> n(m);
+        EXPECT_EQ(n.size(), 3);
+        EXPECT_EQ(n[1], 1);
+        co::flat_hash_map<int, int> k(std::move(n));
+        EXPECT(n.empty());
+        EXPECT_EQ(k.size(), 3);
+        k = m;
+        EXPECT_EQ(k.size(), 3);
+
+        m.clear();
+        EXPECT(m.empty());
+        EXPECT(m.find(1) == m.end());
+    }
+
+    DEF_case(string) {
+        co::flat_hash_map<fastring, fastring> m = { {"a", "x"}, {"b", "y"} };
+        EXPECT_EQ(m.size(), 2);
+        EXPECT_EQ(m.find("a")->second, "x");
+        m.try_emplace("c", 3, 'z');
+        EXPECT_EQ(m["c"], "zzz");
+
+        co::flat_hash_map<const char*, int> s;
+        s["GET"] = 1;
+        s["POST"] = 2;
+        fastring x("POST");
+        EXPECT_EQ(s.find(x.c_str())->second, 2);
+    }
+
+    DEF_case(many) {
+        co::flat_hash_map<int, int> m;
+        const int N = 100000;
+        for (int i = 0; i < N; ++i) m[i * 1024] = i;
+        EXPECT_EQ(m.size(), N);
+        bool ok = true;
+        for (int i = 0; i < N; ++i) {
+            auto it = m.find(i * 1024);
+            if (it == m.end() || it->second != i) { ok = false; break; }
+        }
+        EXPECT(ok);
+
+        // erase half of them, the others are still found
+        for (int i = 0; i < N; i += 2) m.erase(i * 1024);
+        EXPECT_EQ(m.size(), N / 2);
+        ok = true;
+        for (int i = 0; i < N; ++i) {
+            if ((m.find(i * 1024) != m.end()) != (i & 1)) { ok = false; break; }
+        }
+        EXPECT(ok);
+
+        // deleted slots are reused
+        const size_t cap = m.bucket_count();
+        for (int k = 0; k < 10; ++k) {
+            for (int i = 0; i < N; i += 2) m[i * 1024 + 1] = i;
+            for (int i = 0; i < N; i += 2) m.erase(i * 1024 + 1);
+        }
+        EXPECT_EQ(m.size(), N / 2);
+        EXPECT_EQ(m.bucket_count(), cap);
+
+        // erase while iterating
+        for (auto it = m.begin(); it != m.end();) {
+            if (it->second % 4 == 1) {
+                it = m.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        EXPECT_EQ(m.size(), N / 4);
+    }
+
+    DEF_case(set) {
+        co::flat_hash_set<fastring> s = { "a", "b" };
+        EXPECT(s.insert("c").second);
+        EXPECT(!s.insert("a").second);
+        EXPECT(s.emplace(3, 'x').second);
+        EXPECT_EQ(s.size(), 4);
+        EXPECT(s.contains("xxx"));
+        EXPECT_EQ(s.erase("b"), 1);
+        EXPECT(!s.contains("b"));
+        size_t n = 0;
+        for (auto& x : s) n += x.size();
+        EXPECT_EQ(n, 5);
+    }
+}
+
+} // namespace test
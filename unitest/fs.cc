@@ -1,5 +1,7 @@
 #include "co/unitest.h"
 #include "co/fs.h"
+#include "co/str.h"
+#include <mutex>
 
 namespace test {
 
@@ -91,6 +93,150 @@ DEF_test(fs) {
         //EXPECT(fs::exists("xxx.lnk"));
     }
 
+    DEF_case(fstream_flags) {
+        fastring s;
+        for (int i = 0; i < 3000; ++i) s << i << ',';
+        const fastring big(20000, 'b');
+
+        const int flags[] = {
+            fs::fstream::async, fs::fstream::direct, fs::fstream::async | fs::fstream::direct
+        };
+        for (int f : flags) {
+            fs::fstream x("xxs", 'w', 4096, f);
+            EXPECT(x);
+            for (int i = 0; i < 3000; ++i) x << i << ',';
+            x.append(big.data(), big.size());
+            x << "end";
+            x.close();
+            EXPECT(!x);
+            EXPECT_EQ(fs::fsize("xxs"), (int64)(s.size() + big.size() + 3));
+
+            fs::file r("xxs", 'r');
+            fastring v = r.read(fs::fsize("xxs"));
+            EXPECT(v.starts_with(s));
+            EXPECT_EQ(v.substr(s.size(), big.size()), big);
+            EXPECT(v.ends_with("bend"));
+        }
+
+        fs::fstream x("xxs", 'a', 64);
+        x.sync_every(100);
+        for (int i = 0; i < 100; ++i) x << "0123456789";
+        fs::fstream y(std::move(x));
+        EXPECT(!x);
+        EXPECT(y);
+        y.close();
+        EXPECT_EQ(fs::fsize("xxs"), (int64)(s.size() + big.size() + 3 + 1000));
+        EXPECT(fs::remove("xxs"));
+    }
+
+    DEF_case(walk) {
+        fs::remove("xxw", true);
+        EXPECT(fs::mkdir("xxw/a/b", true));
+        EXPECT(fs::mkdir("xxw/c", true));
+        fs::file("xxw/x", 'w').write("12345");
+        fs::file("xxw/a/y", 'w').write("123");
+        fs::file("xxw/a/b/z", 'w').write("");
+        for (int i = 0; i < 100; ++i) fs::file(fastring("xxw/c/").append(str::from(i)), 'w').write("x");
+
+        co::hash_map<fastring, fs::entry> m;
+        size_t batches = 0;
+        EXPECT(fs::walk("xxw", [&](const fs::entry* v, size_t n) {
+            ++batches;
+            for (size_t i = 0; i < n; ++i) m[v[i].path] = v[i];
+            return true;
+        }, fs::walk_recursive | fs::walk_size, 1, 16));
+
+        EXPECT_EQ(m.size(), 106);
+        EXPECT_GE(batches, 7);
+        EXPECT_EQ(m["xxw/a"].type, 'd');
+        EXPECT_EQ(m["xxw/a/b"].type, 'd');
+        EXPECT_EQ(m["xxw/x"].type, 'f');
+        EXPECT_EQ(m["xxw/x"].size, 5);
+        EXPECT_EQ(m["xxw/a/y"].size, 3);
+        EXPECT_EQ(m["xxw/a/b/z"].size, 0);
+        EXPECT_EQ(m["xxw/c/99"].type, 'f');
+
+        // not recursive, and without sizes
+        m.clear();
+        EXPECT(fs::walk("xxw/", [&](const fs::entry* v, size_t n) {
+            for (size_t i = 0; i < n; ++i) m[v[i].path] = v[i];
+            return true;
+        }, 0));
+        EXPECT_EQ(m.size(), 3);
+        EXPECT_EQ(m["xxw/c"].type, 'd');
+        EXPECT_EQ(m["xxw/x"].type, 'f');
+
+        // parallel
+        std::mutex mtx;
+        m.clear();
+        EXPECT(fs::walk("xxw", [&](const fs::entry* v, size_t n) {
+            std::lock_guard<std::mutex> g(mtx);
+            for (size_t i = 0; i < n; ++i) m[v[i].path] = v[i];
+            return true;
+        }, fs::walk_recursive, 4, 8));
+        EXPECT_EQ(m.size(), 106);
+
+        // stop
+        size_t k = 0;
+        EXPECT(!fs::walk("xxw", [&](const fs::entry*, size_t n) {
+            k += n;
+            return false;
+        }, fs::walk_recursive, 1, 4));
+        EXPECT_EQ(k, 3); // the first batch, entries of xxw
+
+        EXPECT(!fs::walk("xxw.none", [](const fs::entry*, size_t) { return true; }));
+        EXPECT(fs::remove("xxw", true));
+    }
+
+    DEF_case(mmap) {
+        {
+            fs::file f("xxm", 'w');
+            f.write(fastring(10000, 'x'));
+            f.write("{\"a\":23}");
+        }
+
+        fs::mmap_file m("xxm");
+        EXPECT(m);
+        EXPECT_EQ(m.size(), 10008);
+        EXPECT_EQ(fastring(m.data(), 3), "xxx");
+        EXPECT_EQ(fastring(m.data() + 10000, 8), "{\"a\":23}");
+        EXPECT(m.advise(fs::mapped_view::sequential));
+        EXPECT(m.advise(fs::mapped_view::willneed));
+        m.advise(fs::mapped_view::hugepage); // not supported everywhere
+
+        // unaligned offset, and n beyond the end of the file
+        fs::file f("xxm", 'r');
+        fs::mapped_view v(f, 'r', 10000, 100);
+        EXPECT(v);
+        EXPECT_EQ(fastring(v.data(), v.size()), "{\"a\":23}");
+        EXPECT(!fs::mapped_view(f, 'r', 20000));
+        EXPECT(fs::mapped_view(f, 'r', 10008));
+        EXPECT_EQ(fs::mapped_view(f, 'r', 10008).size(), 0);
+
+        fs::mapped_view u(std::move(v));
+        EXPECT(!v);
+        EXPECT_EQ(u.size(), 8);
+        v = std::move(u);
+        EXPECT_EQ(v.data()[0], '{');
+        v.unmap();
+        EXPECT(!v);
+        f.close();
+
+        fs::mmap_file w("xxm", 'w');
+        EXPECT(w);
+        w.data()[0] = 'y';
+        EXPECT(w.sync());
+        w.close();
+        EXPECT(!w);
+
+        f.open("xxm", 'r');
+        EXPECT_EQ(f.read(2), "yx");
+        f.close();
+
+        EXPECT(!fs::mmap_file("xxm.none"));
+        EXPECT(fs::remove("xxm"));
+    }
+
     DEF_case(remove) {
         EXPECT(fs::remove("xxx"));
         EXPECT(fs::remove("xxx.lnk"));
@@ -2,6 +2,7 @@
 #include "co/hash.h"
 #include "co/time.h"
 #include "co/str.h"
+#include "co/stl.h"
 
 namespace test {
 
@@ -18,11 +19,184 @@ DEF_test(hash) {
 
         auto s = str::from(now::us());
         EXPECT_EQ(base64_decode(base64_encode(s)), s);
+
+        // long inputs go through the SIMD code if it is available, compare
+        // it with the scalar code working on 3 bytes at a time
+        fastring b;
+        for (int i = 0; i < 1024; ++i) b.append((char)(i * 131 + (i >> 3)));
+        for (size_t n = 0; n <= b.size(); n += (n < 200 ? 1 : 37)) {
+            fastring e;
+            for (size_t i = 0; i < n; i += 3) {
+                e.append(base64_encode(b.data() + i, n - i < 3 ? n - i : 3));
+            }
+            fastring x = base64_encode(b.data(), n);
+            EXPECT_EQ(x, e);
+            EXPECT_EQ(base64_decode(x), fastring(b.data(), n));
+        }
+
+        fastring x = base64_encode(b);
+        x[700] = '*';
+        EXPECT_EQ(base64_decode(x), "");
+        x[700] = '=';
+        EXPECT_EQ(base64_decode(x), "");
+
+        // "\r\n" in the middle of long inputs
+        x = base64_encode(b);
+        fastring y;
+        for (size_t i = 0; i < x.size(); i += 76) {
+            y.append(x.data() + i, x.size() - i < 76 ? x.size() - i : 76).append("\r\n");
+        }
+        EXPECT_EQ(base64_decode(y), b);
+    }
+
+    DEF_case(base64_buf) {
+        char buf[32];
+        EXPECT_EQ(base64_encode("", 0, buf), 0);
+        EXPECT_EQ(base64_decode("", 0, buf), 0);
+        EXPECT_EQ(base64_encode_size(11), 16);
+        size_t r = base64_encode("hello world", 11, buf);
+        EXPECT_EQ(fastring(buf, r), "aGVsbG8gd29ybGQ=");
+        r = base64_decode("aGVsbG8gd29ybGQ=", 16, buf);
+        EXPECT_EQ(fastring(buf, r), "hello world");
+        EXPECT_EQ(base64_decode("aGVsbG8*d29ybGQ=", 16, buf), (size_t)-1);
+        EXPECT_EQ(base64_decode("aGV", 3, buf), (size_t)-1);
+        EXPECT_LE(r, base64_decode_size(16));
+    }
+
+    DEF_case(base64url) {
+        EXPECT_EQ(base64url_encode(""), "");
+        EXPECT_EQ(base64url_decode(""), "");
+        EXPECT_EQ(base64url_encode("hello world"), "aGVsbG8gd29ybGQ");
+        EXPECT_EQ(base64url_decode("aGVsbG8gd29ybGQ"), "hello world");
+        EXPECT_EQ(base64url_decode("aGVsbG8gd29ybGQ="), "hello world");
+        EXPECT_EQ(base64url_encode("\xfb\xff"), "-_8");
+        EXPECT_EQ(base64url_decode("-_8"), "\xfb\xff");
+        EXPECT_EQ(base64url_decode("+/8="), "");
+        EXPECT_EQ(base64_decode("-_8="), "");
+        EXPECT_EQ(base64url_decode("a"), "");
+        EXPECT_EQ(base64url_decode("aGVsb"), "");
+
+        fastring b;
+        for (int i = 0; i < 1024; ++i) b.append((char)(i * 131 + (i >> 3)));
+        for (size_t n = 0; n <= b.size(); n += (n < 200 ? 1 : 37)) {
+            fastring x = base64url_encode(b.data(), n);
+            fastring y = base64_encode(b.data(), n);
+            y.replace("+", "-").replace("/", "_");
+            while (!y.empty() && y.back() == '=') y.resize(y.size() - 1);
+            EXPECT_EQ(x, y);
+            EXPECT_EQ(base64url_decode(x), fastring(b.data(), n));
+        }
+
+        fastring x = base64url_encode(b);
+        x[500] = '+';
+        EXPECT_EQ(base64url_decode(x), "");
+    }
+
+    DEF_case(crc32c) {
+        EXPECT_EQ(crc32c(""), 0);
+        EXPECT_EQ(crc32c("123456789"), 0xe3069283u);
+        char z[32] = { 0 };
+        EXPECT_EQ(crc32c(z, 32), 0x8a9136aau);
+
+        // compare with the bitwise crc, on sizes that go through the 3-way
+        // parallel code, at different offsets
+        fastring b;
+        for (int i = 0; i < 64 * 1024; ++i) b.append((char)(i * 131 + (i >> 5)));
+        const size_t sizes[] = { 1, 7, 8, 100, 767, 768, 1000, 24575, 24576, 40000, 64000 };
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            for (size_t o = 0; o < 3; ++o) {
+                const size_t n = sizes[i];
+                uint32 c = 0xffffffff;
+                for (size_t k = 0; k < n; ++k) {
+                    c ^= (uint8)b[o + k];
+                    for (int j = 0; j < 8; ++j) c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                }
+                EXPECT_EQ(crc32c(b.data() + o, n), ~c);
+            }
+        }
+
+        // crc of the whole equals crc done in parts
+        uint32 c = 0;
+        for (size_t i = 0; i < b.size(); i += 5000) {
+            c = crc32c(b.data() + i, b.size() - i < 5000 ? b.size() - i : 5000, c);
+        }
+        EXPECT_EQ(c, crc32c(b));
+    }
+
+    DEF_case(nanoid) {
+        const fastring k("_-0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+        fastring s = nanoid();
+        EXPECT_EQ(s.size(), 15);
+        EXPECT_EQ(s.find_first_not_of(k.c_str()), s.npos);
+        EXPECT_NE(nanoid(), s);
+        EXPECT_EQ(nanoid(0).size(), 15);
+        EXPECT_EQ(nanoid(300).size(), 300);
+
+        s = nanoid("abc", 500);
+        EXPECT_EQ(s.size(), 500);
+        EXPECT_EQ(s.find_first_not_of("abc"), s.npos);
+        EXPECT_NE(s.find('c'), s.npos);
+        EXPECT_EQ(nanoid("a", 3), "");
+
+        s = secure_nanoid();
+        EXPECT_EQ(s.size(), 15);
+        EXPECT_EQ(s.find_first_not_of(k.c_str()), s.npos);
+        s = secure_nanoid("0123456789", 32);
+        EXPECT_EQ(s.size(), 32);
+        EXPECT_EQ(s.find_first_not_of("0123456789"), s.npos);
     }
 
     DEF_case(md5sum) {
         EXPECT_EQ(md5sum(""), "d41d8cd98f00b204e9800998ecf8427e");
         EXPECT_EQ(md5sum("hello world"), "5eb63bbbe01eeed093cb22bb8f5acdc3");
+
+        fastring b;
+        for (int i = 0; i < 64 * 1024; ++i) b.append((char)(i * 131 + (i >> 5)));
+        EXPECT_EQ(md5sum(b), "4e7053c2c72cf7d2b83bcdb2459fd539");
+    }
+
+    DEF_case(md5digest_multi) {
+        fastring b;
+        for (int i = 0; i < 64 * 1024; ++i) b.append((char)(i * 131 + (i >> 5)));
+
+        // messages of different sizes, around the padding boundaries
+        co::vector<const void*> s;
+        co::vector<size_t> n;
+        for (size_t i = 0; i < 300; ++i) {
+            s.push_back(b.data() + i);
+            n.push_back(i < 200 ? i : i * 211);
+        }
+        fastring res(16 * s.size());
+        res.resize(16 * s.size());
+        for (size_t k = 0; k <= s.size(); k += (k < 20 ? 1 : 97)) {
+            md5digest_multi(s.data(), n.data(), k, &res[0]);
+            bool ok = true;
+            for (size_t i = 0; i < k; ++i) {
+                if (fastring(res.data() + i * 16, 16) != md5digest(s[i], n[i])) ok = false;
+            }
+            EXPECT(ok);
+        }
+    }
+
+    DEF_case(sha256) {
+        EXPECT_EQ(sha256sum(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        EXPECT_EQ(sha256sum("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        EXPECT_EQ(sha256sum("hello world"), "b94d27b9934d3e08a52e52d7da7dabfac484efe37a5380ee9088f7ace2efcde9");
+
+        fastring b;
+        for (int i = 0; i < 64 * 1024; ++i) b.append((char)(i * 131 + (i >> 5)));
+        EXPECT_EQ(sha256sum(b.data(), 1000), "cdd30c5af333122338511d65c285ff063144cb8465021aaf72e6499afbe679f1");
+        EXPECT_EQ(sha256sum(b), "94b8648fb0422bd84acdff2eba5a7a21ba1d1a51bced500bcd683f6104b03641");
+
+        // update in pieces of different sizes
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        for (size_t i = 0, k = 1; i < b.size(); i += k, k = k * 3 % 1000 + 1) {
+            sha256_update(&ctx, b.data() + i, b.size() - i < k ? b.size() - i : k);
+        }
+        uint8 res[32];
+        sha256_final(&ctx, res);
+        EXPECT_EQ(fastring(res, 32), sha256digest(b));
     }
 
     DEF_case(url_code) {
@@ -51,6 +225,30 @@ DEF_test(hash) {
 
         EXPECT_NE(crc16("hello"), 0);
     }
+
+    DEF_case(wyhash) {
+        EXPECT_EQ(wyhash32("hello", 5), (uint32)wyhash64("hello", 5));
+        EXPECT_NE(wyhash64("hello", 5), wyhash64("hellp", 5));
+        EXPECT_NE(wyhash64("hello", 5, 1), wyhash64("hello", 5));
+        EXPECT_NE(wyhash64("", 0), wyhash64("", 0, 1));
+
+        // unaligned data, and the streaming hash gives the same result
+        char buf[256];
+        for (int i = 0; i < 256; ++i) buf[i] = (char)(i * 7 + 1);
+        bool ok = true, diff = true;
+        for (size_t n = 0; n < 200 && ok; ++n) {
+            const uint64 h = wyhash64(buf + 1, n, 7);
+            if (n > 0 && h == wyhash64(buf + 1, n - 1, 7)) diff = false;
+            for (size_t k = 1; k <= 64; k = k * 2 + 1) {
+                wyhash_ctx_t c;
+                wyhash_init(&c, 7);
+                for (size_t i = 0; i < n; i += k) wyhash_update(&c, buf + 1 + i, n - i < k ? n - i : k);
+                if (wyhash_final(&c) != h) { ok = false; break; }
+            }
+        }
+        EXPECT(ok);
+        EXPECT(diff);
+    }
 }
 
 } // test
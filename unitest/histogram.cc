@@ -0,0 +1,98 @@
+#include "co/unitest.h"
+#include "co/histogram.h"
+#include "co/co.h"
+#include "co/thread.h"
+
+namespace test {
+
+DEF_test(histogram) {
+    DEF_case(bucket) {
+        EXPECT_EQ(co::Histogram::bucket_of(0), 0u);
+        EXPECT_EQ(co::Histogram::bucket_of(31), 31u);
+        EXPECT_EQ(co::Histogram::bucket_of(63), 63u);
+        EXPECT_EQ(co::Histogram::bucket_of((uint64)-1), (uint32)co::Histogram::buckets - 1);
+
+        bool ok = true;
+        for (uint32 i = 0; i < co::Histogram::buckets; ++i) {
+            const uint64 lo = co::Histogram::bucket_low(i);
+            const uint64 hi = co::Histogram::bucket_high(i);
+            ok = ok && lo <= hi && co::Histogram::bucket_of(lo) == i && co::Histogram::bucket_of(hi) == i;
+            if (i > 0) ok = ok && co::Histogram::bucket_high(i - 1) + 1 == lo;
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(percentile) {
+        co::Histogram h;
+        EXPECT_EQ(h.count(), 0u);
+        EXPECT_EQ(h.percentile(50), 0u);
+
+        for (uint64 i = 1; i <= 10000; ++i) h.record(i);
+        EXPECT_EQ(h.count(), 10000u);
+        EXPECT_EQ(h.sum(), 10000u * 10001 / 2);
+        EXPECT_EQ(h.min(), 1u);
+        EXPECT_EQ(h.max(), 10000u);
+        EXPECT_EQ(h.percentile(0), 1u);
+        EXPECT_EQ(h.percentile(100), 10000u);
+
+        // the error is below 1/32
+        const uint64 p50 = h.percentile(50);
+        const uint64 p99 = h.percentile(99);
+        EXPECT(p50 >= 5000 && p50 <= 5000 + 5000 / 32);
+        EXPECT(p99 >= 9900 && p99 <= 10000);
+
+        h.reset();
+        EXPECT_EQ(h.count(), 0u);
+        EXPECT_EQ(h.max(), 0u);
+    }
+
+    DEF_case(threads) {
+        co::Histogram h(4);
+        co::vector<Thread*> v;
+        for (int k = 0; k < 8; ++k) {
+            v.push_back(co::make<Thread>([&h]() {
+                for (int i = 0; i < 10000; ++i) h.record(i % 100, 2);
+            }));
+        }
+        for (auto& t : v) co::del(t);
+        EXPECT_EQ(h.count(), 8u * 10000 * 2);
+        EXPECT_EQ(h.max(), 99u);
+    }
+
+    DEF_case(merge_json) {
+        co::Histogram a, b;
+        for (uint64 i = 1; i <= 100; ++i) a.record(i * 1000);
+        b.record(7, 3);
+        b.merge(a);
+        EXPECT_EQ(b.count(), 103u);
+        EXPECT_EQ(b.min(), 7u);
+        EXPECT_EQ(b.max(), 100000u);
+
+        Json x = b.to_json();
+        EXPECT_EQ(x.get("count").as_int64(), 103);
+        EXPECT_EQ(x.get("max").as_int64(), 100000);
+        EXPECT(x.get("buckets").is_array());
+
+        co::Histogram c;
+        EXPECT(c.from_json(x));
+        EXPECT_EQ(c.count(), 103u);
+        EXPECT_EQ(c.sum(), b.sum());
+        EXPECT_EQ(c.percentile(90), b.percentile(90));
+        EXPECT(!c.from_json(Json({{"buckets", 3}})));
+        EXPECT(!b.to_json(false).has_member("buckets"));
+    }
+
+    DEF_case(scheduler) {
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg]() { wg.done(); });
+        wg.wait();
+        sleep::ms(10);
+        uint64 n = 0;
+        auto& s = co::schedulers();
+        for (size_t i = 0; i < s.size(); ++i) n += s[i]->loop_histogram().count();
+        EXPECT_GT(n, 0u);
+    }
+}
+
+} // namespace test
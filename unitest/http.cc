@@ -0,0 +1,88 @@
+#include "co/unitest.h"
+#include "co/co.h"
+#include "co/http.h"
+#include "co/tcp.h"
+
+DEC_uint32(http_timeout);
+
+namespace test {
+
+#ifdef HAS_LIBCURL
+DEF_test(http_client) {
+    // requests of http::Clients in a scheduler share its curl multi handle
+    DEF_case(multi) {
+        const int port = 39019;
+        co::Event ev;       // the slow request waits for it
+        co::WaitGroup slow; // done when the slow request returns
+        slow.add(1);
+        http::Server serv;
+        serv.on_req([ev, slow](const http::Req& req, http::Res& res) {
+            if (req.url() == "/slow") {
+                ev.wait(3000);
+                slow.done();
+            }
+            res.set_body(req.url());
+        }).start("127.0.0.1", port);
+
+        static fastring r[10];
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, port]() { /* the server starts listening in a coroutine */
+            tcp::Client c("127.0.0.1", port);
+            for (int i = 0; i < 100 && !c.connect(1000); ++i) co::sleep(10);
+            wg.done();
+        });
+        wg.wait();
+
+        auto s = co::schedulers()[0];
+        wg.add(10);
+        for (int i = 0; i < 8; ++i) {
+            s->go([wg, port, i]() {
+                fastring u("http://127.0.0.1:");
+                u << port;
+                http::Client c(u.c_str());
+                u.clear();
+                u << "/x/" << i;
+                c.get(u.c_str());
+                r[i] << c.status() << ' ' << c.body();
+                wg.done();
+            });
+        }
+
+        // a timeout and a connection failure wake up their callers
+        s->go([wg, ev, port]() {
+            fastring u("http://127.0.0.1:");
+            u << port;
+            const uint32 t = FLG_http_timeout;
+            FLG_http_timeout = 100;
+            http::Client c(u.c_str());
+            FLG_http_timeout = t;
+            c.get("/slow");
+            r[8] << c.status() << ' ' << (strstr(c.strerror(), "timed out") != 0);
+            ev.signal();
+            wg.done();
+        });
+        s->go([wg, port]() {
+            fastring u("http://127.0.0.1:");
+            u << (port + 1);
+            http::Client c(u.c_str());
+            c.get("/");
+            r[9] << c.status();
+            wg.done();
+        });
+        wg.wait();
+        slow.wait();
+        serv.exit();
+
+        for (int i = 0; i < 8; ++i) {
+            fastring x;
+            x << "200 /x/" << i;
+            EXPECT_EQ(r[i], x);
+        }
+        EXPECT_EQ(r[8], "0 true");
+        EXPECT_EQ(r[9], "0");
+    }
+}
+#endif
+
+} // test
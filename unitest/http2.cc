@@ -0,0 +1,295 @@
+#include "co/unitest.h"
+#include "co/co.h"
+#include "co/http.h"
+#include "co/tcp.h"
+#include "../src/so/http2.h"
+
+namespace test {
+namespace h2 = http::h2;
+
+// bytes of a hex string, spaces are ignored
+static fastring unhex(const char* s) {
+    fastring r;
+    int h = -1;
+    for (; *s; ++s) {
+        const char c = *s;
+        if (c == ' ') continue;
+        const int x = c <= '9' ? c - '0' : c - 'a' + 10;
+        if (h < 0) { h = x; continue; }
+        r.append((char)((h << 4) | x));
+        h = -1;
+    }
+    return r;
+}
+
+// decode a header block to "k: v\n" lines, "error" on failure
+static fastring decode(h2::HpackDecoder& d, const fastring& b) {
+    fastring r;
+    const uint8* p = (const uint8*)b.data();
+    const bool ok = d.decode(p, p + b.size(), [&r](const char* k, size_t kn, const char* v, size_t vn) {
+        r.append(k, kn).append(": ").append(v, vn).append('\n');
+    });
+    return ok ? r : fastring("error");
+}
+
+static bool decode_int(const fastring& b, int n, uint32& v) {
+    const uint8* p = (const uint8*)b.data();
+    return h2::decode_int(p, p + b.size(), n, v) && p == (const uint8*)b.data() + b.size();
+}
+
+// requests of RFC 7541 appendix C.3 and C.4, the same headers in the same order
+static const char* kReqHeaders[3][5][2] = {
+    {
+        { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+        { ":authority", "www.example.com" }, { 0, 0 },
+    },
+    {
+        { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+        { ":authority", "www.example.com" }, { "cache-control", "no-cache" },
+    },
+    {
+        { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+        { ":authority", "www.example.com" }, { "custom-key", "custom-value" },
+    },
+};
+
+static const uint32 kReqTableSize[3] = { 57, 110, 164 };
+
+DEF_test(hpack) {
+    // decode the header blocks in order, and encode the headers back to them
+    auto check_requests = [&](const char* const (&blocks)[3], bool huffman) {
+        h2::HpackDecoder d;
+        h2::HpackEncoder e(huffman);
+        for (int i = 0; i < 3; ++i) {
+            fastring expected;
+            for (int j = 0; j < 5 && kReqHeaders[i][j][0]; ++j) {
+                expected.append(kReqHeaders[i][j][0]).append(": ").append(kReqHeaders[i][j][1]).append('\n');
+            }
+            const fastring b = unhex(blocks[i]);
+            EXPECT_EQ(decode(d, b), expected);
+            EXPECT_EQ(d.table().size(), kReqTableSize[i]);
+
+            fastring s;
+            for (int j = 0; j < 5 && kReqHeaders[i][j][0]; ++j) {
+                const char* k = kReqHeaders[i][j][0];
+                const char* v = kReqHeaders[i][j][1];
+                e.encode(s, k, strlen(k), v, strlen(v), true);
+            }
+            EXPECT_EQ(s, b);
+            EXPECT_EQ(e.table().size(), kReqTableSize[i]);
+        }
+    };
+
+    DEF_case(integer) {
+        // RFC 7541 C.1
+        fastring s;
+        h2::encode_int(s, 5, 10, 0);
+        EXPECT_EQ(s, unhex("0a"));
+        s.clear();
+        h2::encode_int(s, 5, 1337, 0);
+        EXPECT_EQ(s, unhex("1f 9a 0a"));
+        s.clear();
+        h2::encode_int(s, 8, 42, 0);
+        EXPECT_EQ(s, unhex("2a"));
+
+        uint32 v = 0;
+        EXPECT(decode_int(unhex("0a"), 5, v));
+        EXPECT_EQ(v, 10);
+        EXPECT(decode_int(unhex("1f 9a 0a"), 5, v));
+        EXPECT_EQ(v, 1337);
+        EXPECT(decode_int(unhex("2a"), 8, v));
+        EXPECT_EQ(v, 42);
+        EXPECT(decode_int(unhex("1f ff ff ff 7f"), 5, v));
+        EXPECT_EQ(v, 31 + (1u << 28) - 1);
+
+        // truncated, or too many bytes after the prefix
+        EXPECT(!decode_int(unhex("1f 9a"), 5, v));
+        EXPECT(!decode_int(unhex("1f ff ff ff ff 0f"), 5, v));
+        EXPECT(!decode_int(unhex("1f 80 80 80 80 00"), 5, v));
+    }
+
+    DEF_case(huffman) {
+        // RFC 7541 C.4.1
+        fastring s;
+        h2::huff_encode(s, "www.example.com", 15);
+        EXPECT_EQ(s, unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+        EXPECT_EQ(h2::huff_size("www.example.com", 15), s.size());
+
+        fastring x;
+        for (int i = 0; i < 256; ++i) x.append((char)i);
+        s.clear();
+        h2::huff_encode(s, x.data(), x.size());
+        EXPECT_EQ(h2::huff_size(x.data(), x.size()), s.size());
+        fastring r;
+        EXPECT(h2::huff_decode((const uint8*)s.data(), s.size(), r));
+        EXPECT_EQ(r, x);
+
+        // EOS in the string, padding that is not the EOS prefix, padding longer than 7 bits
+        r.clear();
+        EXPECT(!h2::huff_decode((const uint8*)"\xff\xff\xff\xff", 4, r));
+        EXPECT(!h2::huff_decode((const uint8*)"\x18", 1, r));
+        EXPECT(!h2::huff_decode((const uint8*)"\x1f\xff", 2, r));
+    }
+
+    DEF_case(requests) {
+        const char* const plain[3] = {
+            "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+            "8286 84be 5808 6e6f 2d63 6163 6865",
+            "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+        };
+        check_requests(plain, false);
+    }
+
+    DEF_case(requests_huffman) {
+        const char* const huff[3] = {
+            "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+            "8286 84be 5886 a8eb 1064 9cbf",
+            "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+        };
+        check_requests(huff, true);
+    }
+
+    DEF_case(reject) {
+        h2::HpackDecoder d;
+        EXPECT_EQ(decode(d, unhex("80")), "error");        // index 0
+        EXPECT_EQ(decode(d, unhex("bf")), "error");        // index 63, not in the table
+        EXPECT_EQ(decode(d, unhex("3f e2 1f")), "error");  // table size 4097
+        EXPECT_EQ(decode(d, unhex("40 05 6162")), "error"); // name longer than the block
+        EXPECT_EQ(decode(d, unhex("00 7f ff ff ff 7f")), "error"); // a huge name
+        EXPECT_EQ(decode(d, unhex("01 7f ff ff ff ff 0f")), "error"); // length overflow
+        EXPECT_EQ(decode(d, unhex("3f e1 1f")), "");       // table size 4096
+        EXPECT_EQ(d.table().size(), 0);
+    }
+
+    DEF_case(not_indexed) {
+        // headers of responses, literals without indexing
+        h2::HpackEncoder e;
+        fastring s;
+        e.encode(s, ":status", 7, "200", 3);
+        e.encode(s, ":status", 7, "431", 3);
+        e.encode(s, "content-type", 12, "text/plain", 10);
+        e.encode(s, "x-id", 4, "7", 1);
+        EXPECT_EQ(e.table().size(), 0);
+        EXPECT_EQ(s.substr(0, 2), unhex("88 08"));
+
+        h2::HpackDecoder d;
+        EXPECT_EQ(decode(d, s), ":status: 200\n:status: 431\ncontent-type: text/plain\nx-id: 7\n");
+        EXPECT_EQ(d.table().size(), 0);
+    }
+}
+
+struct frame_t {
+    uint8 type;
+    uint8 flags;
+    uint32 id;
+    fastring p;
+};
+
+static bool send_frame(tcp::Client& c, uint8 type, uint8 flags, uint32 id, const void* p, size_t n) {
+    uint8 h[9];
+    h[0] = (uint8)(n >> 16); h[1] = (uint8)(n >> 8); h[2] = (uint8)n;
+    h[3] = type;
+    h[4] = flags;
+    h2::put32(h + 5, id);
+    fastring s(9 + n);
+    s.append(h, 9).append(p, n);
+    return c.send(s.data(), (int)s.size(), 3000) == (int)s.size();
+}
+
+static bool send_frame(tcp::Client& c, uint8 type, uint8 flags, uint32 id, const fastring& s) {
+    return send_frame(c, type, flags, id, s.data(), s.size());
+}
+
+// read frames until one of @type on stream @id
+static bool recv_frame(tcp::Client& c, uint8 type, uint32 id, frame_t& f) {
+    uint8 h[9];
+    while (c.recvn(h, 9, 3000) == 9) {
+        const uint32 n = h2::get24(h);
+        f.type = h[3];
+        f.flags = h[4];
+        f.id = h2::get32(h + 5) & 0x7fffffff;
+        f.p.resize(n);
+        if (n > 0 && c.recvn((void*)f.p.data(), (int)n, 3000) != (int)n) return false;
+        if (f.type == type && f.id == id) return true;
+    }
+    return false;
+}
+
+static fastring headers(h2::HpackEncoder& e, const char* method, const char* path) {
+    fastring s;
+    e.encode(s, ":method", 7, method, strlen(method), true);
+    e.encode(s, ":scheme", 7, "http", 4, true);
+    e.encode(s, ":path", 5, path, strlen(path), true);
+    e.encode(s, ":authority", 10, "127.0.0.1", 9, true);
+    return s;
+}
+
+DEF_test(h2c) {
+    DEF_case(frames) {
+        const int port = 39017;
+        http::Server serv;
+        serv.on_req([](const http::Req& req, http::Res& res) {
+            if (req.is_method_post()) {
+                res.set_body(req.body(), req.body_size());
+            } else if (req.url() == "/hello") {
+                res.set_body("hello");
+            } else {
+                res.set_status(404);
+            }
+        }).start("127.0.0.1", port);
+
+        static fastring s[8];
+        co::WaitGroup wg;
+        wg.add(1);
+        go([wg, port]() {
+            tcp::Client c("127.0.0.1", port);
+            // the server starts listening in a coroutine
+            for (int i = 0; i < 100 && !c.connect(1000); ++i) co::sleep(10);
+            h2::HpackEncoder e;
+            h2::HpackDecoder d;
+            frame_t f;
+
+            c.send("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24, 3000);
+            send_frame(c, h2::kSettings, 0, 0, "", 0);
+            if (recv_frame(c, h2::kSettings, 0, f)) s[0] << (int)f.flags << ' ' << f.p.size();
+            if (recv_frame(c, h2::kSettings, 0, f)) s[0] << ' ' << (int)f.flags; // ACK
+
+            // GET
+            send_frame(c, h2::kHeaders, h2::kEndStream | h2::kEndHeaders, 1, headers(e, "GET", "/hello"));
+            if (recv_frame(c, h2::kHeaders, 1, f)) s[1] = decode(d, f.p);
+            if (recv_frame(c, h2::kData, 1, f)) s[2] << (int)f.flags << ' ' << f.p;
+
+            // POST with a DATA frame
+            send_frame(c, h2::kHeaders, h2::kEndHeaders, 3, headers(e, "POST", "/echo"));
+            send_frame(c, h2::kData, h2::kEndStream, 3, "abc", 3);
+            if (recv_frame(c, h2::kHeaders, 3, f)) s[3] = decode(d, f.p);
+            if (recv_frame(c, h2::kData, 3, f)) s[4] << (int)f.flags << ' ' << f.p;
+
+            // a stream reset by the client is closed, DATA on it is answered by RST_STREAM
+            uint8 x[4];
+            h2::put32(x, h2::kCancel);
+            send_frame(c, h2::kHeaders, h2::kEndHeaders, 5, headers(e, "POST", "/echo"));
+            send_frame(c, h2::kRstStream, 0, 5, x, 4);
+            send_frame(c, h2::kData, h2::kEndStream, 5, "abc", 3);
+            if (recv_frame(c, h2::kRstStream, 5, f) && f.p.size() == 4) s[5] << h2::get32((const uint8*)f.p.data());
+
+            // the connection still works
+            send_frame(c, h2::kHeaders, h2::kEndStream | h2::kEndHeaders, 7, headers(e, "GET", "/none"));
+            if (recv_frame(c, h2::kHeaders, 7, f)) s[6] << (int)f.flags << ' ' << decode(d, f.p);
+            c.close();
+            wg.done();
+        });
+        wg.wait();
+        serv.exit();
+
+        EXPECT_EQ(s[0], "0 18 1");
+        EXPECT_EQ(s[1], ":status: 200\ncontent-length: 5\n");
+        EXPECT_EQ(s[2], "1 hello");
+        EXPECT_EQ(s[3], ":status: 200\ncontent-length: 3\n");
+        EXPECT_EQ(s[4], "1 abc");
+        EXPECT_EQ(s[5], "5");
+        EXPECT_EQ(s[6], "5 :status: 404\ncontent-length: 0\n");
+    }
+}
+
+} // test
@@ -0,0 +1,67 @@
+#include "co/unitest.h"
+#include "co/intern.h"
+#include "co/hash.h"
+#include "co/stl.h"
+#include "co/str.h"
+#include <thread>
+
+namespace test {
+
+DEF_test(intern) {
+    DEF_case(basic) {
+        const char* a = co::intern("hello");
+        EXPECT_EQ(fastring(a), "hello");
+        EXPECT_EQ(co::intern_size(a), 5);
+        EXPECT_EQ(co::intern_hash(a), wyhash32("hello", 5));
+
+        fastring s("hello");
+        EXPECT_EQ(co::intern(s), a);
+        EXPECT_EQ(co::intern("hello world", 5), a);
+        EXPECT_NE(co::intern("hello!"), a);
+
+        // strings with '\0' inside, and the empty string
+        const char* b = co::intern("x\0y", 3);
+        EXPECT_EQ(co::intern_size(b), 3);
+        EXPECT_NE(b, co::intern("x"));
+        EXPECT_EQ(co::intern(""), co::intern("", 0));
+        EXPECT_EQ(*co::intern(""), '\0');
+
+        const size_t n = co::intern_num();
+        co::intern("hello");
+        EXPECT_EQ(co::intern_num(), n);
+    }
+
+    DEF_case(many) {
+        co::vector<const char*> v;
+        for (int i = 0; i < 20000; ++i) v.push_back(co::intern(str::cat("key_", i)));
+        bool ok = true;
+        for (int i = 0; i < 20000; ++i) {
+            if (co::intern(str::cat("key_", i)) != v[i]) ok = false;
+        }
+        EXPECT(ok);
+        EXPECT_EQ(fastring(v[777]), "key_777");
+
+        fastring big(3000, 'x');
+        const char* p = co::intern(big);
+        EXPECT_EQ(co::intern(big), p);
+        EXPECT_EQ(co::intern_size(p), 3000);
+    }
+
+    DEF_case(threads) {
+        const char* r[4] = { 0 };
+        co::vector<std::thread> t;
+        for (int i = 0; i < 4; ++i) {
+            t.push_back(std::thread([&r, i]() {
+                for (int k = 0; k < 1000; ++k) co::intern(str::cat("t_", k));
+                r[i] = co::intern("t_500");
+            }));
+        }
+        for (auto& x : t) x.join();
+        EXPECT_EQ(r[0], co::intern("t_500"));
+        EXPECT_EQ(r[1], r[0]);
+        EXPECT_EQ(r[2], r[0]);
+        EXPECT_EQ(r[3], r[0]);
+    }
+}
+
+} // namespace test
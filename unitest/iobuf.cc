@@ -0,0 +1,110 @@
+#include "co/unitest.h"
+#include "co/iobuf.h"
+
+namespace test {
+
+DEF_test(iobuf) {
+    DEF_case(append) {
+        co::iobuf b;
+        EXPECT(b.empty());
+        EXPECT_EQ(b.ref_num(), 0);
+
+        b.append("hello").append(' ').append(fastring("world"));
+        EXPECT_EQ(b.size(), 11);
+        EXPECT_EQ(b.ref_num(), 1); // the block is filled
+        EXPECT_EQ(b.str(), "hello world");
+
+        static const char r[] = " of co";
+        b.append_ref(r, 6);
+        EXPECT_EQ(b.ref_num(), 2);
+        EXPECT_EQ(b.ref(1).p, r);
+        b.append("!");
+        EXPECT_EQ(b.ref_num(), 3);
+        EXPECT_EQ(b.str(), "hello world of co!");
+
+        // a large fastring is moved in without copy
+        fastring s(1024, 'x');
+        const char* p = s.data();
+        b.append(std::move(s));
+        EXPECT(s.empty());
+        EXPECT_EQ(b.ref(b.ref_num() - 1).p, p);
+        EXPECT_EQ(b.size(), 18 + 1024);
+
+        // data larger than a block
+        co::iobuf c;
+        c.append(fastring(20000, 'y'));
+        EXPECT_EQ(c.size(), 20000);
+        EXPECT_EQ(c.str(), fastring(20000, 'y'));
+    }
+
+    DEF_case(share) {
+        co::iobuf a;
+        a.append("hello");
+        co::iobuf b(a);
+        EXPECT_EQ(b.ref(0).p, a.ref(0).p);
+
+        // the shared block is not written
+        a.append(" a");
+        b.append(" b");
+        EXPECT_EQ(a.str(), "hello a");
+        EXPECT_EQ(b.str(), "hello b");
+
+        a.append(b);
+        EXPECT_EQ(a.str(), "hello ahello b");
+        a.append(a);
+        EXPECT_EQ(a.str(), "hello ahello bhello ahello b");
+
+        co::iobuf c;
+        c.append(std::move(a));
+        EXPECT(a.empty());
+        EXPECT_EQ(c.size(), 28);
+        c = b;
+        EXPECT_EQ(c.str(), "hello b");
+    }
+
+    DEF_case(prepend) {
+        co::iobuf b;
+        b.append("body");
+        b.prepend("len:4\n", 6);
+        b.prepend_ref("v1 ", 3);
+        EXPECT_EQ(b.ref_num(), 3);
+        EXPECT_EQ(b.str(), "v1 len:4\nbody");
+    }
+
+    DEF_case(consume_cut) {
+        co::iobuf b;
+        b.append("0123").append_ref("4567", 4).append_ref("89", 2);
+        b.consume(2);
+        EXPECT_EQ(b.str(), "23456789");
+        b.consume(2);
+        EXPECT_EQ(b.ref_num(), 2);
+        EXPECT_EQ(b.str(), "456789");
+
+        co::iobuf x;
+        EXPECT_EQ(b.cut(x, 5), 5);
+        EXPECT_EQ(x.str(), "45678");
+        EXPECT_EQ(b.str(), "9");
+        EXPECT_EQ(b.cut(x, 8), 1);
+        EXPECT(b.empty());
+        EXPECT_EQ(x.str(), "456789");
+
+        char buf[8] = { 0 };
+        EXPECT_EQ(x.copy_to(buf, 3, 2), 3);
+        EXPECT_EQ(fastring(buf), "678");
+        EXPECT_EQ(x.copy_to(buf, 8, 5), 1);
+
+        x.consume(100);
+        EXPECT(x.empty());
+        EXPECT_EQ(x.ref_num(), 0);
+    }
+
+    DEF_case(iov) {
+        co::iobuf b;
+        b.append("ab").append_ref("cd", 2).append_ref("ef", 2);
+        co::iov_t iov[2];
+        EXPECT_EQ(b.to_iov(iov, 2), 2);
+        EXPECT_EQ(b.to_iov(iov, 2, 2), 1);
+    }
+}
+
+} // namespace test
@@ -1,9 +1,63 @@
 ﻿#include "co/unitest.h"
 #include "co/json.h"
+#include "co/json_fields.h"
+#include "co/json_lines.h"
+#include "co/intern.h"
 #include "co/str.h"
+#include <thread>
 
 namespace test {
 
+struct Point {
+    int x;
+    double y;
+};
+
+CO_JSON_FIELDS(Point, x, y)
+
+struct Shape {
+    Shape() : id(0), closed(false), u8(0) {}
+    uint64 id;
+    bool closed;
+    uint8 u8;
+    fastring name;
+    std::string tag;
+    co::vector<Point> points;
+    co::vector<int> ids;
+    Json extra;
+};
+
+CO_JSON_FIELDS(Shape, id, closed, u8, name, tag, points, ids, extra)
+
+// rebuild the json from SAX events
+struct SaxPrinter : json::Handler {
+    bool on_null() override { this->sep(); s << "null"; return true; }
+    bool on_bool(bool v) override { this->sep(); s << v; return true; }
+    bool on_int(int64 v) override { this->sep(); s << v; return true; }
+    bool on_double(double v) override { this->sep(); s << v; return true; }
+    bool on_string(const char* p, size_t n) override {
+        this->sep(); s << '"'; s.append(p, n); s << '"'; return true;
+    }
+    bool on_key(const char* p, size_t n) override {
+        this->sep(); s << '"'; s.append(p, n); s << "\":"; k = true; return true;
+    }
+    bool on_object_begin() override { this->sep(); s << '{'; f = true; return true; }
+    bool on_object_end() override { s << '}'; f = false; return true; }
+    bool on_array_begin() override { this->sep(); s << '['; f = true; return true; }
+    bool on_array_end() override { s << ']'; f = false; return true; }
+    bool on_end() override { s << '\n'; f = true; ++n; return true; }
+
+    void sep() {
+        if (!f && !k) s << ',';
+        f = k = false;
+    }
+
+    fastring s;
+    bool f = true; // first in a container
+    bool k = false; // after a key
+    int n = 0;
+};
+
 DEF_test(json) {
     DEF_case(null) {
         Json n;
@@ -333,6 +387,41 @@ DEF_test(json) {
         EXPECT(o.get("z", 3).is_null());
     }
 
+    DEF_case(index) {
+        Json o;
+        for (int i = 0; i < 1000; ++i) {
+            o[str::from(i).c_str()] = i;
+        }
+        EXPECT_EQ(o.object_size(), 1000);
+        EXPECT_EQ(o.get("0").as_int(), 0);
+        EXPECT_EQ(o.get("999").as_int(), 999);
+        EXPECT(o.get("1000").is_null());
+        EXPECT(o.has_member("500"));
+        EXPECT(!o.has_member("x"));
+
+        // members added after the index was built
+        o.add_member("x", 1);
+        o.add_member("x", 2);
+        EXPECT(o.has_member("x"));
+        EXPECT_EQ(o.get("x").as_int(), 1);
+        EXPECT_EQ(o.object_size(), 1002);
+
+        // insertion order is kept
+        int i = 0;
+        bool ordered = true;
+        for (auto it = o.begin(); it != o.end() && i < 1000; ++it, ++i) {
+            if (str::from(i) != it.key()) ordered = false;
+        }
+        EXPECT(ordered);
+        EXPECT_EQ(i, 1000);
+
+        Json x = o.dup();
+        EXPECT_EQ(x.str(), o.str());
+        EXPECT_EQ(x.get("777").as_int(), 777);
+        o.reset();
+        EXPECT(o.is_null());
+    }
+
     DEF_case(set) {
         // {"a":1,"b":[0,1,2],"c":{"d":["oo"]}}
         Json x;
@@ -556,6 +645,386 @@ DEF_test(json) {
         EXPECT_EQ(v["key"].as_string(), s);
     }
 
+    DEF_case(parse_long_string) {
+        // escapes and white spaces at different offsets, to cover both the
+        // vectorized and the byte-by-byte scanning
+        bool ok = true;
+        for (int n = 0; n < 100 && ok; ++n) {
+            fastring x(n, 'x');
+            fastring w(n, ' ');
+            fastring js;
+            js << '{' << w << "\"k\":" << w << '"' << x << "\\n" << x << "\\\"" << x << '"' << w << '}';
+            Json v;
+            if (!v.parse_from(js)) { ok = false; break; }
+            fastring s;
+            s << x << '\n' << x << '"' << x;
+            ok = v.get("k").as_string() == s;
+        }
+        EXPECT(ok);
+
+        // the same on output, \x01 is not escaped, and UTF-8 is kept as is
+        ok = true;
+        for (int n = 0; n < 100 && ok; ++n) {
+            fastring x(n, 'x');
+            fastring s, r;
+            s << x << '\n' << x << "\x01\"" << x << "\xe4\xb8\xad\\" << x;
+            r << '"' << x << "\\n" << x << "\x01\\\"" << x << "\xe4\xb8\xad\\\\" << x << '"';
+            ok = Json(s).str() == r;
+        }
+        EXPECT(ok);
+
+        fastring js;
+        js << "{\"k\":\"" << fastring(100, 'x');
+        EXPECT(json::parse(js).is_null());
+    }
+
+    DEF_case(parse_strict) {
+        Json v;
+        EXPECT(v.parse_strict("{\"k\":\"\xe4\xb8\xad\xf0\x9f\x98\x80\xc3\xa9\"}"));
+        EXPECT_EQ(v.get("k").as_string(), "\xe4\xb8\xad\xf0\x9f\x98\x80\xc3\xa9");
+        EXPECT(v.parse_strict(fastring("[\"\\u4e2d\"]")));
+
+        // invalid bytes before and after 16 bytes of ASCII
+        const char* bad[] = {
+            "\x80", "\xc0\xaf", "\xc3", "\xe0\x80\xaf", "\xed\xa0\x80",
+            "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xe4\xb8x", "\xff",
+        };
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+            fastring s, t;
+            s << "[\"" << bad[i] << "\"]";
+            t << "[\"" << fastring(20, 'x') << bad[i] << "\"]";
+            EXPECT(!v.parse_strict(s));
+            EXPECT(!v.parse_strict(t));
+            EXPECT(v.is_null());
+            EXPECT(json::parse(s).is_array());
+        }
+        EXPECT(!v.parse_strict("[1,", 3));
+    }
+
+    DEF_case(parse_lazy) {
+        fastring s("{\"a\":{\"b\":[1,{\"c\":\"}]\\\"\"}],\"d\":{ }},\"e\":[],\"f\":[1,2\"x\"],\"g\":2}");
+        Json v = json::parse_lazy(s);
+        EXPECT(v.is_object());
+        EXPECT_EQ(v.get("g").as_int(), 2);
+        EXPECT(v.get("a").is_object());
+        EXPECT_EQ(v.get("a", "b").array_size(), 2);
+        EXPECT_EQ(v.get("a", "b", 1, "c").as_string(), "}]\"");
+        EXPECT(v.get("a", "d").is_object());
+        EXPECT_EQ(v.get("a", "d").object_size(), 0);
+        EXPECT_EQ(v.get("e").array_size(), 0);
+
+        // the error is found when it is accessed
+        EXPECT(v.get("f").is_array());
+        EXPECT_EQ(v.get("f").array_size(), 0);
+
+        Json u = v.dup();
+        EXPECT_EQ(u.str(), "{\"a\":{\"b\":[1,{\"c\":\"}]\\\"\"}],\"d\":{}},\"e\":[],\"f\":[],\"g\":2}");
+
+        fastring t("{\"a\":{\"b\":1},\"c\":[{}]}");
+        Json x = json::parse_lazy(t);
+        Json y = x.dup();
+        x.reset();
+        EXPECT_EQ(y.str(), "{\"a\":{\"b\":1},\"c\":[{}]}");
+        EXPECT(json::parse_lazy(fastring("{\"a\":{\"b\":1}")).is_null());
+    }
+
+    DEF_case(msgpack) {
+        Json v = json::parse(
+            "{\"a\":[0,127,128,255,256,65535,65536,4294967295,4294967296,-1,-32,-33,-128,"
+            "-129,-32768,-32769,-2147483648,-2147483649,-9223372036854775808,9223372036854775807],"
+            "\"b\":{\"x\":3.14,\"y\":true,\"z\":null,\"w\":false},\"c\":[],\"d\":{},\"e\":\"hello\"}"
+        );
+        fastring s = v.msgpack();
+        EXPECT_EQ(s.substr(0, 4), fastring("\x85\xa1" "a\xdc", 4));
+        Json u = json::parse_msgpack(s);
+        EXPECT_EQ(u.str(), v.str());
+
+        // nested, long strings, maps and arrays with >= 16 members
+        Json x = json::array();
+        Json o = json::object();
+        for (int i = 0; i < 20; ++i) o.add_member(fastring(i + 1, 'k').c_str(), i);
+        x.push_back(o);
+        x.push_back(fastring(40, 'x'));
+        x.push_back(fastring(300, 'y'));
+        x.push_back(fastring(70000, 'z'));
+        x.push_back(json::array({json::array({json::array({1})})}));
+        u = json::parse_msgpack(x.msgpack());
+        EXPECT_EQ(u.str(), x.str());
+        EXPECT_EQ(json::parse_msgpack(Json().msgpack()).is_null(), true);
+        EXPECT_EQ(json::parse_msgpack(Json(7).msgpack()).as_int(), 7);
+
+        // float 32 and bin
+        u = json::parse_msgpack(fastring("\x92\xca\x3f\xc0\x00\x00\xc4\x02xy", 10));
+        EXPECT_EQ(u[0].as_double(), 1.5);
+        EXPECT_EQ(u[1].as_string(), "xy");
+
+        // errors: truncated, trailing bytes, non-string keys, ext, huge sizes
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (json::parse_msgpack(s.data(), i).is_null()) continue;
+            EXPECT_EQ(i, s.size());
+        }
+        EXPECT(json::parse_msgpack(fastring("\x01\x02", 2)).is_null());
+        EXPECT(json::parse_msgpack(fastring("\x81\x01\x02", 3)).is_null());
+        EXPECT(json::parse_msgpack(fastring("\x82\xa1" "a\x01\x02", 5)).is_null());
+        EXPECT(json::parse_msgpack(fastring("\xd4\x01\x02", 3)).is_null());
+        EXPECT(json::parse_msgpack(fastring("\xdd\xff\xff\xff\xff\x01", 6)).is_null());
+        EXPECT(json::parse_msgpack(fastring("\xdf\x00\x01\x00\x00\xa1" "a", 7)).is_null());
+    }
+
+    DEF_case(fields) {
+        Shape a;
+        a.id = 7;
+        a.closed = true;
+        a.u8 = 200;
+        a.name = "x\"y";
+        a.tag = "t";
+        a.points.push_back({1, 2.5});
+        a.points.push_back({-3, 0});
+        a.ids = {1, 2, 3};
+        a.extra = json::parse("{\"k\":[1,2]}");
+
+        fastring s = json::dump(a);
+        EXPECT_EQ(s, "{\"id\":7,\"closed\":true,\"u8\":200,\"name\":\"x\\\"y\",\"tag\":\"t\","
+                     "\"points\":[{\"x\":1,\"y\":2.5},{\"x\":-3,\"y\":0.0}],\"ids\":[1,2,3],"
+                     "\"extra\":{\"k\":[1,2]}}");
+        EXPECT_EQ(json::parse(s).str(), s);
+
+        Shape b;
+        EXPECT(json::load(s, b));
+        EXPECT_EQ(json::dump(b), s);
+
+        // unknown keys are skipped, null or missing fields are unchanged
+        Shape c;
+        c.name = "old";
+        EXPECT(json::load(fastring(
+            " { \"q\" : {\"a\":[1,\"]\"]} , \"id\":3.0, \"name\":null, \"z\":[], \"points\":[ {\"y\":1e2,\"x\":2} ],"
+            "\"tag\":\"\\u4e2d\\n\", \"n\":null,\"b\":false } "), c));
+        EXPECT_EQ(c.id, 3);
+        EXPECT_EQ(c.name, "old");
+        EXPECT_EQ(c.tag, "中\n");
+        EXPECT_EQ(c.points.size(), 1);
+        EXPECT_EQ(c.points[0].x, 2);
+        EXPECT_EQ(c.points[0].y, 100.0);
+        EXPECT(c.extra.is_null());
+        EXPECT_EQ(json::dump(Shape()), "{\"id\":0,\"closed\":false,\"u8\":0,\"name\":\"\",\"tag\":\"\",\"points\":[],\"ids\":[],\"extra\":null}");
+
+        Point p;
+        EXPECT(!json::load(fastring("{\"x\":1,}"), p));
+        EXPECT(!json::load(fastring("{\"x\":\"1\"}"), p));
+        EXPECT(!json::load(fastring("{\"x\":1} 2"), p));
+        EXPECT(!json::load(fastring("{\"x\":1"), p));
+        EXPECT(!json::load(fastring("[{\"x\":1}]"), p));
+        EXPECT(!json::load(fastring("{\"q\":[1,\"]\",\"x\":1}"), p));
+        co::vector<Point> v;
+        EXPECT(json::load(fastring("[{\"x\":1},{\"y\":2}, {}]"), v));
+        EXPECT_EQ(v.size(), 3);
+        EXPECT(!json::load(fastring("[{\"x\":1},]"), v));
+    }
+
+    DEF_case(document) {
+        json::Document d(256);
+        fastring s("{\"a\":[1,2,3],\"b\":{\"c\":\"xx\"},\"d\":[]}");
+        for (int i = 0; i < 3; ++i) {
+            EXPECT(d.parse(s));
+            EXPECT_EQ(d.value().str(), s);
+        }
+
+        // arrays from the arena are copied to the heap when they grow
+        Json& v = d.value();
+        v["a"].push_back(4);
+        v["b"].add_member("e", 5);
+        v["b"]["f"] = 6;
+        v["d"].push_back(json::object());
+        v.add_member("g", json::array({1, 2}));
+        EXPECT_EQ(v.str(), "{\"a\":[1,2,3,4],\"b\":{\"c\":\"xx\",\"e\":5,\"f\":6},\"d\":[{}],\"g\":[1,2]}");
+
+        fastring t;
+        t << '{';
+        for (int i = 0; i < 64; ++i) t << "\"k" << i << "\":" << i << ',';
+        t.back() = '}';
+        EXPECT(d.parse(t));
+        EXPECT_EQ(d.value().get("k63").as_int(), 63);
+        d.value()["k64"] = 64;
+        EXPECT_EQ(d.value().get("k64").as_int(), 64);
+        EXPECT_EQ(d.value().object_size(), 65);
+
+        EXPECT(!d.parse(fastring("{\"a\":[1,2")));
+        EXPECT(d.value().is_null());
+        fastring w("{\"x\":\"yz\"}");
+        EXPECT(d.parse_view(w));
+        EXPECT_EQ(d.value().get("x").as_string(), "yz");
+        d.clear();
+        EXPECT(d.value().is_null());
+    }
+
+    DEF_case(path) {
+        Json v = json::parse("{\"a\":{\"b\":[0,1,2,{\"c\":\"x\"}],\"\":1,\"m~n\":2,\"p/q\":3,\"7\":4},\"e\":[]}");
+        const fastring s = v.str();
+        EXPECT_EQ(v.find(json::path("/a/b/3/c")).as_string(), "x");
+        EXPECT_EQ(v.find(json::path("/a/b/1")).as_int(), 1);
+        EXPECT_EQ(v.find(json::path("/a/")).as_int(), 1);
+        EXPECT_EQ(v.find(json::path("/a/m~0n")).as_int(), 2);
+        EXPECT_EQ(v.find(json::path("/a/p~1q")).as_int(), 3);
+        EXPECT_EQ(v.find(json::path("/a/7")).as_int(), 4);
+        EXPECT_EQ(v.find(json::path("")).str(), s);
+
+        EXPECT(v.find(json::path("/a/b/4")).is_null());
+        EXPECT(v.find(json::path("/a/b/01")).is_null());
+        EXPECT(v.find(json::path("/a/b/-")).is_null());
+        EXPECT(v.find(json::path("/a/b/3/c/d")).is_null());
+        EXPECT(v.find(json::path("/a/x/y")).is_null());
+        EXPECT(v.find(json::path("/e/0")).is_null());
+        EXPECT(v.find(json::path("/a/b/99999999999")).is_null());
+        EXPECT(!json::path("a/b").valid());
+        EXPECT(!json::path("/a~2").valid());
+        EXPECT(v.find(json::path("a")).is_null());
+        EXPECT_EQ(json::path("/a/b/3/c").size(), 4);
+        EXPECT_EQ(v.str(), s); // not modified
+
+        // only objects and arrays on the path are parsed
+        fastring t("{\"a\":{\"b\":[1,{\"c\":true}]},\"d\":{\"e\":[1,2]}}");
+        Json u = json::parse_lazy(t);
+        json::Path p("/a/b/1/c");
+        EXPECT_EQ(u.find(p).as_bool(), true);
+        EXPECT_EQ(u.find(p).as_bool(), true);
+        EXPECT_EQ(u.find(json::path("/d/e/1")).as_int(), 2);
+    }
+
+    DEF_case(write) {
+        Json v = json::parse("{\"a\":[1,2.5,\"x\\\"y\",{},[],null,true],\"b\":{\"c\":{\"d\":[{\"e\":1}]}},\"f\":\"\"}");
+        for (size_t k = 1; k <= 64; k *= 4) {
+            fastring s, t;
+            size_t n = 0;
+            bool bounded = true;
+            EXPECT(v.write([&](const char* p, size_t m) {
+                s.append(p, m);
+                if (m > k + 16) bounded = false;
+                return ++n > 0;
+            }, k));
+            EXPECT(bounded);
+            EXPECT_EQ(s, v.str());
+            EXPECT(v.write_pretty([&](const char* p, size_t m) { t.append(p, m); return true; }, k));
+            EXPECT_EQ(t, v.pretty());
+        }
+
+        fastring s;
+        EXPECT(Json().write([&](const char* p, size_t m) { s.append(p, m); return true; }));
+        EXPECT_EQ(s, "null");
+
+        // stop when the sink returns false
+        Json x = json::array();
+        for (int i = 0; i < 10000; ++i) x.push_back(i);
+        int n = 0;
+        EXPECT(!x.write([&](const char*, size_t) { return ++n < 3; }, 1024));
+        EXPECT_EQ(n, 3);
+    }
+
+    DEF_case(parse_lines) {
+        fastring s;
+        for (int i = 0; i < 20000; ++i) {
+            if (i % 1000 == 7) s << "{\"bad\":\n";
+            if (i % 1000 == 9) s << " \r\n";
+            s << "{\"i\":" << i << ",\"s\":\"" << fastring(i % 50, 'x') << "\"}\n";
+        }
+        s << "[" << 20000 << "]"; // no newline at the end
+
+        co::vector<Json> v;
+        EXPECT_EQ(json::parse_lines(s, v, 4), 20);
+        EXPECT_EQ(v.size(), 20021);
+        bool ordered = true;
+        for (size_t i = 0, k = 0; i < v.size() - 1; ++i) {
+            if (v[i].is_null()) continue;
+            if (v[i].get("i").as_int() != (int)k++) ordered = false;
+        }
+        EXPECT(ordered);
+        EXPECT_EQ(v.back()[0].as_int(), 20000);
+
+        // small inputs
+        v.clear();
+        EXPECT_EQ(json::parse_lines(fastring("1\n\n[2]\nx\n"), v), 1);
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[1][0].as_int(), 2);
+        EXPECT(v[2].is_null());
+        v.clear();
+        EXPECT_EQ(json::parse_lines(fastring(), v), 0);
+        EXPECT(v.empty());
+
+        // from a file, in small batches, so lines are split across reads
+        {
+            fs::file f("json_lines.tmp", 'w');
+            f.write(s);
+        }
+        {
+            fs::file f("json_lines.tmp", 'r');
+            int64 k = 0, last = -1;
+            bool ok = true;
+            const size_t err = json::parse_lines(f, [&](Json& x) {
+                if (x.is_object()) {
+                    if (x.get("i").as_int() != k++) ok = false;
+                } else if (x.is_array()) {
+                    last = x[0].as_int();
+                }
+                return true;
+            }, 4096, 3);
+            EXPECT_EQ(err, 20);
+            EXPECT(ok);
+            EXPECT_EQ(k, 20000);
+            EXPECT_EQ(last, 20000);
+        }
+        {
+            fs::file f("json_lines.tmp", 'r');
+            int n = 0;
+            json::parse_lines(f, [&](Json&) { return ++n < 100; }, 4096);
+            EXPECT_EQ(n, 100);
+        }
+        fs::remove("json_lines.tmp");
+    }
+
+    DEF_case(sax) {
+        const char* s = "{\"a\":[1,-2.5,\"x\\ny\",true,false,null],\"b\":{},\"c\":[],\"d\":{\"e\":\"\\u4e2d\"}} 3 \"s\"";
+        const fastring r("{\"a\":[1,-2.5,\"x\ny\",true,false,null],\"b\":{},\"c\":[],\"d\":{\"e\":\"中\"}}\n3\n\"s\"\n");
+        {
+            SaxPrinter h;
+            json::SaxParser p(h);
+            EXPECT(p.parse(s, strlen(s)));
+            EXPECT_EQ(h.s, r);
+            EXPECT_EQ(h.n, 3);
+        }
+
+        // feed byte by byte, and in pieces of 3 bytes
+        for (size_t k = 1; k <= 3; k += 2) {
+            SaxPrinter h;
+            json::SaxParser p(h);
+            bool ok = true;
+            for (size_t i = 0; i < strlen(s) && ok; i += k) {
+                ok = p.feed(s + i, std::min(k, strlen(s) - i));
+            }
+            EXPECT(ok && p.finish());
+            EXPECT_EQ(h.s, r);
+        }
+
+        // stopped by the handler
+        struct Stop : json::Handler {
+            bool on_key(const char* p, size_t n) override { return fastring(p, n) != "b"; }
+        } st;
+        json::SaxParser p(st);
+        EXPECT(!p.parse(s, strlen(s)));
+
+        SaxPrinter h;
+        json::SaxParser q(h);
+        EXPECT(!q.parse("{\"a\":1", 6));
+        q.reset();
+        EXPECT(!q.parse("{\"a\" 1}", 8));
+        q.reset();
+        EXPECT(!q.parse("[1,]x", 5));
+        q.reset();
+        EXPECT(!q.parse("[tru]", 5));
+        q.reset();
+        EXPECT(!q.feed("]", 1));
+        q.reset();
+        EXPECT(q.parse("  ", 2));
+    }
+
     DEF_case(parse_error) {
         Json v;
         v.parse_from("");
@@ -574,6 +1043,155 @@ DEF_test(json) {
         EXPECT(json::parse("{ \"key\" : null88 }").is_null());
         EXPECT(json::parse("{ \"key\" : abcc }").is_null());
     }
+
+    DEF_case(parse_arena) {
+        co::Arena a;
+        for (int i = 0; i < 3; ++i) {
+            Json v = json::parse("{\"a\":[1,2.5,\"x\\ny\"],\"b\":{\"c\":true,\"d\":null}}", a);
+            EXPECT(v.is_object());
+            EXPECT_EQ(v["a"][0].as_int(), 1);
+            EXPECT_EQ(v["a"][1].as_double(), 2.5);
+            EXPECT_EQ(fastring(v["a"][2].as_c_str()), "x\ny");
+            EXPECT_EQ(v["b"]["c"].as_bool(), true);
+            EXPECT(v["b"]["d"].is_null());
+            EXPECT_GT(a.size(), 0);
+
+            // nodes of the arena and the heap can be mixed
+            v["e"] = 3;
+            v["a"].push_back("z");
+            v["b"]["c"] = "s";
+            EXPECT_EQ(v.str(), "{\"a\":[1,2.5,\"x\\ny\",\"z\"],\"b\":{\"c\":\"s\",\"d\":null},\"e\":3}");
+
+            Json u = v.dup();
+            Json w = json::object({ {v["a"][2], 1} });
+            v.reset();
+            a.reset();
+            EXPECT_EQ(u["a"][2].as_string(), "x\ny");
+            EXPECT_EQ(w.get("x\ny").as_int(), 1);
+        }
+
+        EXPECT(json::parse("{\"a\":", a).is_null());
+    }
+
+    DEF_case(parse_view) {
+        fastring s("{\"a\":[1,\"xy\",\"x\\ny\"],\"b\":{\"c\":\"s\"}}");
+        Json v = json::parse_view(s);
+        EXPECT(v.is_object());
+        EXPECT_EQ(v["a"][0].as_int(), 1);
+        EXPECT_EQ(fastring(v["a"][1].as_c_str()), "xy");
+        EXPECT_EQ(v["a"][1].string_size(), 2);
+        EXPECT_EQ(fastring(v["a"][2].as_c_str()), "x\ny");
+        EXPECT_EQ(v["b"]["c"].as_string(), "s");
+
+        // keys and strings without escapes refer to the input
+        const char* p = s.data();
+        EXPECT(v["a"][1].as_c_str() > p && v["a"][1].as_c_str() < p + s.size());
+        EXPECT(v.begin().key() > p && v.begin().key() < p + s.size());
+        EXPECT(!(v["a"][2].as_c_str() > p && v["a"][2].as_c_str() < p + s.size()));
+
+        // members added later are owned by the Json
+        v["e"] = "z";
+        v["b"]["d"] = 3;
+        EXPECT_EQ(v.str(), "{\"a\":[1,\"xy\",\"x\\ny\"],\"b\":{\"c\":\"s\",\"d\":3},\"e\":\"z\"}");
+
+        Json u = v.dup();
+        Json w = json::object({ {v["a"][1], 1} });
+        v.reset();
+        s.clear();
+        EXPECT_EQ(u["a"][1].as_string(), "xy");
+        EXPECT_EQ(w.get("xy").as_int(), 1);
+
+        co::Arena a;
+        fastring t("{\"k\":\"v\",\"n\":[\"m\"]}");
+        EXPECT(v.parse_view((char*)t.data(), t.size(), a));
+        EXPECT_EQ(v.get("n", 0).as_string(), "m");
+        v.reset();
+
+        fastring x("{\"k\":\"v\",\"n\":");
+        EXPECT(json::parse_view(x).is_null());
+    }
+
+    DEF_case(shared) {
+        json::Shared a;
+        EXPECT_EQ(a.use_count(), 0);
+        EXPECT(a->is_null());
+
+        fastring s("{\"x\":1,\"o\":{");
+        for (int i = 0; i < 40; ++i) s << (i ? "," : "") << "\"k" << i << "\":" << i;
+        s << "},\"l\":[1,2]}";
+        json::Shared b(json::parse_lazy(s));
+        EXPECT_EQ(b.use_count(), 1);
+
+        // copies refer to the same tree
+        json::Shared c(b);
+        a = c;
+        EXPECT_EQ(b.use_count(), 3);
+        EXPECT_EQ(&*a, &*b);
+        EXPECT_EQ(a->get("o", "k39").as_int(), 39);
+        EXPECT_EQ(c->get("l", 1).as_int(), 2);
+
+        // copy on write
+        a.mut()["x"] = 2;
+        EXPECT_EQ(a.use_count(), 1);
+        EXPECT_EQ(b.use_count(), 2);
+        EXPECT_EQ(a->get("x").as_int(), 2);
+        EXPECT_EQ(b->get("x").as_int(), 1);
+        EXPECT_EQ(a->get("o", "k7").as_int(), 7);
+
+        // the only copy is modified in place
+        const Json* p = &*a;
+        a.mut()["y"] = 3;
+        EXPECT_EQ(&*a, p);
+        json::Shared d(std::move(a));
+        EXPECT_EQ(a.use_count(), 0);
+        EXPECT_EQ(d->str(), b->str().replace("\"x\":1", "\"x\":2").replace("[1,2]}", "[1,2],\"y\":3}"));
+
+        // read and released by other threads
+        int r[4] = { 0 };
+        co::vector<std::thread> t;
+        for (int i = 0; i < 4; ++i) {
+            json::Shared x(b);
+            t.push_back(std::thread([x, &r, i]() {
+                for (int k = 0; k < 40; ++k) {
+                    r[i] += (int)x->get("o").get(str::cat("k", k).c_str()).as_int();
+                }
+            }));
+        }
+        for (auto& x : t) x.join();
+        EXPECT_EQ(b.use_count(), 2);
+        EXPECT(r[0] == 780 && r[1] == 780 && r[2] == 780 && r[3] == 780);
+
+        b.reset();
+        c.reset();
+        EXPECT(b->is_null());
+        EXPECT_EQ(c.use_count(), 0);
+    }
+
+    DEF_case(parse_intern) {
+        const char* s = "{\"id\":1,\"name\":\"x\",\"sub\":{\"id\":2}}";
+        Json u, v;
+        EXPECT(u.parse_intern(s, strlen(s)));
+        EXPECT(v.parse_intern(fastring(s)));
+        EXPECT_EQ(v.str(), s);
+
+        // keys are shared by documents
+        const char* id = co::intern("id");
+        EXPECT_EQ(u.begin().key(), id);
+        EXPECT_EQ(v.begin().key(), id);
+        EXPECT_EQ(v["sub"].begin().key(), id);
+        EXPECT_EQ(v.get(id).as_int(), 1);
+        EXPECT_EQ(v.get("sub", "id").as_int(), 2);
+
+        // members added later are owned by the Json
+        v["e"] = 3;
+        EXPECT_EQ(v.get("e").as_int(), 3);
+        Json w = v.dup();
+        v.reset();
+        u.reset();
+        EXPECT_EQ(w.get("name").as_string(), "x");
+        EXPECT_EQ(fastring(id), "id");
+        EXPECT(!w.parse_intern("{\"id\":", 6));
+    }
 }
 
 } // namespace test
@@ -1,5 +1,6 @@
 #include "co/unitest.h"
 #include "co/lru_map.h"
+#include "co/fastring.h"
 
 namespace test {
 
@@ -27,6 +28,60 @@ DEF_test(lru_map) {
 
     m.clear();
     EXPECT(m.empty());
+
+    // insert an existing key moves it to the front, the value is not changed
+    m.insert(1, 1);
+    m.insert(2, 2);
+    m.insert(3, 3);
+    EXPECT_EQ(m.insert(1, 8)->second, 1);
+    EXPECT_EQ(m.begin()->first, 1);
+    m.insert(4, 4);
+    m.insert(5, 5);
+    EXPECT(m.find(2) == m.end());
+    EXPECT_EQ(m.size(), 4);
+
+    // iteration is from the most recently used to the least
+    int r[4], i = 0;
+    for (auto it = m.begin(); it != m.end(); ++it) r[i++] = it->first;
+    EXPECT_EQ(i, 4);
+    EXPECT_EQ(r[0], 5);
+    EXPECT_EQ(r[1], 4);
+    EXPECT_EQ(r[2], 1);
+    EXPECT_EQ(r[3], 3);
+
+    // eviction callback
+    int ek = 0, ev = 0;
+    m.on_evict([&](const int& k, int& v) { ek = k; ev = v; });
+    m.insert(6, 6);
+    EXPECT_EQ(ek, 3);
+    EXPECT_EQ(ev, 3);
+    m.erase(6);
+    EXPECT_EQ(ek, 3);
+
+    LruMap<fastring, fastring> s(2);
+    s.get_or_insert("a", "xx");
+    EXPECT_EQ(s.get_or_insert(fastring("a"), "yy"), "xx");
+    s.get_or_insert("b", 3, 'y');
+    EXPECT_EQ(s.find("b")->second, "yyy");
+    s.get_or_insert("c") = "z";
+    EXPECT(s.find("a") == s.end());
+    EXPECT_EQ(s.find("c")->second, "z");
+
+    // many entries, the buckets grow
+    LruMap<int, int> x(100000);
+    for (int k = 0; k < 100000; ++k) x.insert(k, k * 2);
+    bool ok = true;
+    for (int k = 0; k < 100000; ++k) {
+        auto it = x.find(k);
+        if (it == x.end() || it->second != k * 2) { ok = false; break; }
+    }
+    EXPECT(ok);
+
+    LruMap<int, int> y(std::move(x));
+    EXPECT_EQ(y.size(), 100000);
+    EXPECT(x.empty());
+    y.swap(x);
+    EXPECT_EQ(x.size(), 100000);
 }
 
 } // namespace test
@@ -1,5 +1,12 @@
 #include "co/unitest.h"
 #include "co/mem.h"
+#include "co/arena.h"
+#include "co/object_pool.h"
+#include "co/thread.h"
+#include "co/fastring.h"
+#include <vector>
+
+DEC_uint32(mem_profile_rate);
 
 namespace test {
 namespace mem {
@@ -252,6 +259,199 @@ DEF_test(mem) {
         EXPECT_EQ(q.use_count(), 1);
         EXPECT_EQ(*q, 3);
     }
+
+    DEF_case(arena) {
+        co::Arena a(256);
+        EXPECT_EQ(a.size(), 0);
+
+        char* p = (char*) a.alloc(3, 1);
+        int64* q = (int64*) a.alloc(8, 8);
+        EXPECT_EQ((size_t)q & 7, 0);
+        EXPECT_GE((char*)q, p + 3);
+        *q = 7;
+
+        // larger than a chunk
+        char* x = (char*) a.alloc(1000);
+        memset(x, 'x', 1000);
+        EXPECT_GE(a.size(), 1011);
+        EXPECT_EQ(*q, 7);
+
+        for (int i = 0; i < 100; ++i) a.alloc(32);
+        int* v = a.make<int>(3);
+        EXPECT_EQ(*v, 3);
+
+        a.reset();
+        EXPECT_EQ(a.size(), 0);
+        a.alloc(16);
+        EXPECT_EQ(a.size(), 16);
+
+        std::vector<int, co::arena_allocator<int>> u{co::arena_allocator<int>(a)};
+        for (int i = 0; i < 100; ++i) u.push_back(i);
+        EXPECT_EQ(u.size(), 100);
+        EXPECT_EQ(u[99], 99);
+        EXPECT(u.get_allocator() == co::arena_allocator<char>(a));
+    }
+
+    DEF_case(object_pool) {
+        struct X { X(int v) : v(v), s(0) {} int v; char* s; };
+        typedef co::object_pool<X, 20, 8> pool;
+
+        X* x = pool::make(3);
+        EXPECT_EQ(x->v, 3);
+        EXPECT_EQ(pool::size(), 7);
+        pool::del(x);
+        EXPECT_EQ(pool::size(), 8);
+
+        // the memory is reused
+        X* y = pool::make(7);
+        EXPECT_EQ(y, x);
+        pool::del(y);
+
+        // at most 20 blocks are cached
+        X* v[32];
+        for (int i = 0; i < 32; ++i) v[i] = pool::make(i);
+        EXPECT_EQ(v[31]->v, 31);
+        for (int i = 0; i < 32; ++i) pool::del(v[i]);
+        EXPECT_EQ(pool::size(), 20);
+
+        // free in another thread
+        for (int i = 0; i < 8; ++i) v[i] = pool::make(i);
+        uint32 n = 0;
+        Thread([&]() {
+            for (int i = 0; i < 8; ++i) pool::del(v[i]);
+            n = pool::size();
+        }).join();
+        EXPECT_EQ(n, 8);
+    }
+
+  #ifndef CO_USE_SYS_MALLOC
+    DEF_case(stats) {
+        const co::mem_stats_t a = co::thread_mem_stats();
+        void* p = co::alloc(24);
+        void* q = co::alloc(8192);
+        co::mem_stats_t b = co::thread_mem_stats();
+        EXPECT_EQ(b.allocs - a.allocs, 2);
+        EXPECT_EQ(b.bytes - a.bytes, 24 + 8192);
+        EXPECT_EQ(b.small_bytes - a.small_bytes, 32);
+        EXPECT_EQ(b.large_bytes - a.large_bytes, 8192);
+
+        q = co::realloc(q, 8192, 9000);
+        b = co::thread_mem_stats();
+        EXPECT_EQ(b.bytes - a.bytes, 24 + 9000);
+        EXPECT_EQ(b.large_bytes - a.large_bytes, 3 * 4096);
+
+        co::free(p, 24);
+        co::free(q, 9000);
+        b = co::thread_mem_stats();
+        EXPECT_EQ(b.frees - a.frees, 2);
+        EXPECT_EQ(b.bytes, a.bytes);
+
+        const co::mem_stats_t g = co::mem_stats();
+        EXPECT_GE(g.allocs, b.allocs);
+        EXPECT_GT(g.reserved_bytes, 0);
+        EXPECT_GE(g.committed_bytes, (uint64)(g.small_bytes + g.large_bytes));
+        EXPECT_LE(g.huge_page_blocks << 21, g.committed_bytes);
+    }
+
+    DEF_case(span) {
+        const co::mem_stats_t a = co::thread_mem_stats();
+        char* p = (char*) co::alloc(200 * 1024);
+        memset(p, 'x', 200 * 1024);
+        co::mem_stats_t b = co::thread_mem_stats();
+        EXPECT_EQ(b.span_bytes - a.span_bytes, 224 * 1024);
+        EXPECT_EQ(b.sys_bytes, a.sys_bytes);
+
+        // in place in the same size class
+        char* q = (char*) co::realloc(p, 200 * 1024, 220 * 1024);
+        EXPECT_EQ(q, p);
+        q = (char*) co::realloc(q, 220 * 1024, 1 << 20);
+        EXPECT_EQ(q[200 * 1024 - 1], 'x');
+        b = co::thread_mem_stats();
+        EXPECT_EQ(b.span_bytes - a.span_bytes, 1 << 20);
+        co::free(q, 1 << 20);
+
+        // freed spans are cached and reused
+        p = (char*) co::alloc((1 << 20) - 4096);
+        EXPECT_EQ(p, q);
+        co::free(p, (1 << 20) - 4096);
+        b = co::thread_mem_stats();
+        EXPECT_EQ(b.span_bytes, a.span_bytes);
+
+        (void) co::mem_trim(0);
+        EXPECT_GE(co::mem_trim(0), 1 << 20);
+        p = (char*) co::alloc(32 << 20);
+        p[(32 << 20) - 1] = 'x';
+        co::free(p, 32 << 20);
+    }
+
+    DEF_case(span_grow) {
+        const co::mem_stats_t a = co::thread_mem_stats();
+        size_t n = 200 * 1024;
+        char* p = (char*) co::alloc(n);
+        memset(p, 'x', n);
+        p[n - 1] = 'y';
+
+        // spans grow to the next size class, and then beyond 32M
+        while (n < (48 << 20)) {
+            const size_t m = n + (n >> 1);
+            p = (char*) co::realloc(p, n, m);
+            if (!p) break;
+            EXPECT_EQ(p[0], 'x');
+            EXPECT_EQ(p[n - 1], 'y');
+            p[n - 1] = 'x';
+            p[m - 1] = 'y';
+            n = m;
+        }
+        EXPECT(p != NULL);
+
+        co::mem_stats_t b = co::thread_mem_stats();
+        EXPECT_EQ(b.bytes - a.bytes, (int64)n);
+        EXPECT_EQ(b.span_bytes, a.span_bytes);
+        EXPECT_EQ(b.sys_bytes - a.sys_bytes, (int64)n);
+        co::free(p, n);
+        b = co::thread_mem_stats();
+        EXPECT_EQ(b.bytes, a.bytes);
+        EXPECT_EQ(b.sys_bytes, a.sys_bytes);
+    }
+
+    DEF_case(heap_profile) {
+        void* v[8];
+        FLG_mem_profile_rate = 1; // sample all
+
+        // the flag is checked again after 1M bytes allocated since it was 0
+        co::free(co::alloc(2 << 20), 2 << 20);
+        for (int i = 0; i < 8; ++i) v[i] = co::alloc(1000);
+        FLG_mem_profile_rate = 0;
+
+        fastring s = co::heap_profile();
+        EXPECT(s.starts_with("heap profile"));
+        EXPECT_NE(s.find("in use: ~8000 bytes, 8 sampled blocks"), s.npos);
+
+        s = co::heap_profile_pprof();
+        EXPECT(s.starts_with("heap profile: 8: 8000 ["));
+
+        for (int i = 0; i < 8; ++i) co::free(v[i], 1000);
+        s = co::heap_profile_pprof();
+        EXPECT(s.starts_with("heap profile: 0: 0 ["));
+    }
+
+    DEF_case(trim) {
+        void* v[64];
+        (void) co::mem_trim(0);
+        for (int i = 0; i < 64; ++i) { v[i] = co::alloc(8192); memset(v[i], 7, 8192); }
+        for (int i = 63; i >= 0; --i) co::free(v[i], 8192);
+
+        // pages were used before the first trim
+        (void) co::mem_trim(0);
+        EXPECT_GE(co::mem_trim(0), 32 * 8192);
+        EXPECT_EQ(co::mem_trim(0), 0);
+
+        // decommitted pages are committed again on reuse
+        for (int i = 0; i < 64; ++i) { v[i] = co::alloc(8192); memset(v[i], 7, 8192); }
+        EXPECT_EQ(*(char*)v[63], 7);
+        for (int i = 63; i >= 0; --i) co::free(v[i], 8192);
+    }
+  #endif
 }
 
 } // namespace test
@@ -0,0 +1,58 @@
+#include "co/unitest.h"
+#include "co/metrics.h"
+#include "co/thread.h"
+
+DEF_counter(test_jobs_total, "jobs done");
+DEF_gauge(test_queue_size, "jobs waiting");
+DEF_histogram(test_job_us, "time of jobs");
+
+namespace test {
+
+DEF_test(metrics) {
+    DEF_case(counter) {
+        co::vector<Thread*> v;
+        for (int k = 0; k < 4; ++k) {
+            v.push_back(co::make<Thread>([]() {
+                for (int i = 0; i < 1000; ++i) MET_test_jobs_total.inc();
+            }));
+        }
+        for (auto& t : v) co::del(t);
+        EXPECT_EQ(MET_test_jobs_total.value(), 4000u);
+
+        // the same name gives the same metric
+        EXPECT_EQ(&metrics::counter("test_jobs_total", ""), &MET_test_jobs_total);
+    }
+
+    DEF_case(gauge) {
+        MET_test_queue_size.set(7);
+        MET_test_queue_size.add(3);
+        MET_test_queue_size.sub(2);
+        EXPECT_EQ(MET_test_queue_size.value(), 8);
+    }
+
+    DEF_case(render) {
+        MET_test_job_us.record(100);
+        MET_test_job_us.record(300);
+        metrics::gauge("test_temperature", "a gauge by a function", []() { return 36.5; });
+        metrics::add_collector([](fastream& s) {
+            metrics::write_header(s, "test_labeled", "a collector", "gauge");
+            metrics::write_value(s, "test_labeled", "k=\"a\"", (int64)1);
+        });
+
+        fastream s;
+        metrics::render(s);
+        fastring r(s.data(), s.size());
+        EXPECT(r.find("# TYPE test_jobs_total counter\ntest_jobs_total 4000\n") != r.npos);
+        EXPECT(r.find("test_queue_size 8\n") != r.npos);
+        EXPECT(r.find("# TYPE test_job_us summary\n") != r.npos);
+        EXPECT(r.find("test_job_us{quantile=\"0.99\"} 300\n") != r.npos);
+        EXPECT(r.find("test_job_us_sum 400\ntest_job_us_count 2\n") != r.npos);
+        EXPECT(r.find("test_temperature 36.5\n") != r.npos);
+        EXPECT(r.find("test_labeled{k=\"a\"} 1\n") != r.npos);
+        EXPECT(r.find("co_sched_resumes_total{sched=\"0\"}") != r.npos);
+        EXPECT(r.find("co_mem_allocs_total ") != r.npos);
+        EXPECT(r.find("co_log_flush_us_count ") != r.npos);
+    }
+}
+
+} // namespace test
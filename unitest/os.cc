@@ -36,6 +36,45 @@ DEF_test(os) {
     DEF_case(cpunum) {
         EXPECT_GT(os::cpunum(), 0);
     }
+
+    DEF_case(numa) {
+        EXPECT_GT(os::numa_num(), 0);
+        for (int i = 0; i < os::cpunum(); ++i) {
+            EXPECT_LT(os::numa_node(i), os::numa_num());
+        }
+    }
+
+    DEF_case(topology) {
+        const os::topology_t& t = os::topology();
+        EXPECT_EQ(t.cpus, (int)t.cpu.size());
+        EXPECT_GT(t.cores, 0);
+        EXPECT_LE(t.cores, t.cpus);
+        EXPECT_GE(t.smt, 1);
+        EXPECT_GE(t.cores * t.smt, t.cpus);
+        EXPECT_GT(t.packages, 0);
+        EXPECT_LE(t.packages, t.cores);
+        EXPECT_EQ(t.numa_nodes, os::numa_num());
+        EXPECT_GT(t.line_size, 0);
+        EXPECT_EQ(t.line_size & (t.line_size - 1), 0);
+
+        bool ok = true;
+        for (size_t i = 0; i < t.cpu.size(); ++i) {
+            const os::cpu_info_t& x = t.cpu[i];
+            if (i > 0 && x.cpu <= t.cpu[i - 1].cpu) ok = false;
+            if (x.core < 0 || x.core >= t.cores) ok = false;
+            if (x.package < 0 || x.package >= t.packages) ok = false;
+            if (x.node < 0 || x.node >= t.numa_nodes) ok = false;
+        }
+        EXPECT(ok);
+        EXPECT_EQ(&t, &os::topology());
+
+      #ifdef __linux__
+        co::vector<int> v;
+        for (auto& x : t.cpu) v.push_back(x.cpu);
+        EXPECT(os::set_affinity(v));
+        EXPECT(!os::set_affinity(co::vector<int>()));
+      #endif
+    }
 }
 
 } // namespace test
@@ -0,0 +1,100 @@
+#include "co/unitest.h"
+#include "co/parallel.h"
+#include "co/co.h"
+
+namespace test {
+
+DEF_test(parallel) {
+    DEF_case(for) {
+        co::array<int> v(10000, 0);
+        co::parallel_for(v.size(), [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) v[i] += (int)i;
+        });
+        bool ok = true;
+        for (size_t i = 0; i < v.size(); ++i) ok = ok && v[i] == (int)i;
+        EXPECT(ok);
+
+        int n = 0;
+        co::parallel_for(0, [&](size_t, size_t) { ++n; });
+        co::parallel_for(3, [&](size_t b, size_t e) { n += (int)(e - b); }, 8);
+        EXPECT_EQ(n, 3);
+    }
+
+    DEF_case(reduce) {
+        const int64 s = co::parallel_reduce((size_t)100000, (int64)0,
+            [](size_t b, size_t e) { int64 x = 0; for (; b < e; ++b) x += b; return x; },
+            [](int64 x, int64 y) { return x + y; }
+        );
+        EXPECT_EQ(s, 100000LL * 99999 / 2);
+
+        // subranges are reduced in order
+        const fastring r = co::parallel_reduce((size_t)10, fastring(),
+            [](size_t b, size_t e) { fastring x; for (; b < e; ++b) x.append((char)('0' + b)); return x; },
+            [](const fastring& x, const fastring& y) { return x + y; }, 3
+        );
+        EXPECT_EQ(r, "0123456789");
+    }
+
+    DEF_case(nested) {
+        co::array<int> v(64 * 64, 0);
+        co::parallel_for(64, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                co::parallel_for(64, [&](size_t x, size_t y) {
+                    for (size_t j = x; j < y; ++j) v[i * 64 + j] = 1;
+                }, 4);
+            }
+        }, 1);
+        int n = 0;
+        for (size_t i = 0; i < v.size(); ++i) n += v[i];
+        EXPECT_EQ(n, 64 * 64);
+    }
+
+    DEF_case(coroutine) {
+        int64 s[4] = { 0 };
+        co::WaitGroup wg;
+        wg.add(4);
+        for (int k = 0; k < 4; ++k) {
+            go([wg, &s, k]() {
+                s[k] = co::parallel_reduce((size_t)1000, (int64)0,
+                    [k](size_t b, size_t e) { int64 x = 0; for (; b < e; ++b) x += b * k; return x; },
+                    [](int64 x, int64 y) { return x + y; }
+                );
+                wg.done();
+            });
+        }
+        wg.wait();
+        for (int k = 0; k < 4; ++k) EXPECT_EQ(s[k], 999LL * 1000 / 2 * k);
+    }
+
+    DEF_case(shared_stack) {
+        // 64 callers in one scheduler, they share its stacks, the stack of a
+        // caller is reused by others while it is suspended
+        static int64 s[64];
+        static int v[64][256];
+        co::WaitGroup wg;
+        wg.add(64);
+        auto sched = co::schedulers()[0];
+        for (int k = 0; k < 64; ++k) {
+            sched->go([wg, k]() {
+                s[k] = co::parallel_reduce((size_t)4096, (int64)0,
+                    [k](size_t b, size_t e) { int64 x = 0; for (; b < e; ++b) x += b * k; return x; },
+                    [](int64 x, int64 y) { return x + y; }, 16
+                );
+                int* const p = v[k];
+                co::parallel_for(256, [p, k](size_t b, size_t e) {
+                    for (size_t i = b; i < e; ++i) p[i] = (int)i + k;
+                }, 4);
+                wg.done();
+            });
+        }
+        wg.wait();
+        bool ok = true;
+        for (int k = 0; k < 64; ++k) {
+            ok = ok && s[k] == 4095LL * 4096 / 2 * k;
+            for (int i = 0; i < 256; ++i) ok = ok && v[k][i] == i + k;
+        }
+        EXPECT(ok);
+    }
+}
+
+} // namespace test
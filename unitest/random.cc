@@ -14,4 +14,59 @@ DEF_test(random) {
     EXPECT_EQ((x - y + 100) * 10 / 10000, 2);
 }
 
+DEF_test(wyrand) {
+    DEF_case(next) {
+        co::Wyrand a(7), b(7);
+        bool eq = true;
+        for (int i = 0; i < 100; ++i) if (a.next() != b.next()) eq = false;
+        EXPECT(eq);
+
+        // values in range, and roughly uniform
+        int c[10] = { 0 };
+        bool in = true;
+        for (int i = 0; i < 100000; ++i) {
+            const uint64 v = a.next(10);
+            if (v >= 10) { in = false; break; }
+            ++c[v];
+        }
+        EXPECT(in);
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_GT(c[i], 9000);
+            EXPECT_LT(c[i], 11000);
+        }
+    }
+
+    DEF_case(fill) {
+        co::Wyrand a(3), b(3);
+        char x[19] = { 0 }, y[24];
+        a.fill(x, 19);
+        b.fill(y, 24);
+        EXPECT_EQ(memcmp(x, y, 19), 0);
+
+        // the bits are balanced
+        uint8 buf[4096];
+        co::random_bytes(buf, sizeof(buf));
+        int ones = 0;
+        for (size_t i = 0; i < sizeof(buf); ++i) {
+            for (int k = 0; k < 8; ++k) ones += (buf[i] >> k) & 1;
+        }
+        EXPECT_GT(ones, 16384 - 600);
+        EXPECT_LT(ones, 16384 + 600);
+    }
+
+    DEF_case(thread_rand) {
+        EXPECT_EQ(&co::thread_rand(), &co::thread_rand());
+        EXPECT_NE(co::rand64(), co::rand64());
+    }
+
+    DEF_case(secure) {
+        uint64 x = 0, y = 0;
+        EXPECT(co::secure_random_bytes(&x, sizeof(x)));
+        EXPECT(co::secure_random_bytes(&y, sizeof(y)));
+        EXPECT_NE(x, y);
+        char buf[1000];
+        EXPECT(co::secure_random_bytes(buf, sizeof(buf)));
+    }
+}
+
 } // namespace test
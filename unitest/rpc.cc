@@ -0,0 +1,144 @@
+#include "co/unitest.h"
+#include "co/rpc.h"
+
+namespace test {
+
+struct Pt : public rpc::Message {
+    Pt() : x(0), y(0) {}
+
+    virtual void encode(fastream& s) const {
+        rpc::wire::write(s, 1, x);
+        rpc::wire::write(s, 2, y);
+    }
+
+    virtual bool decode(const char* p, size_t n) {
+        x = y = 0;
+        const char* const e = p + n;
+        uint64 k;
+        while (p < e) {
+            if (!rpc::wire::get_varint(p, e, k)) return false;
+            const int t = (int)(k & 7);
+            bool r;
+            switch (k >> 3) {
+              case 1:  r = rpc::wire::read(p, e, t, x); break;
+              case 2:  r = rpc::wire::read(p, e, t, y); break;
+              default: r = rpc::wire::skip(p, e, t); break;
+            }
+            if (!r) return false;
+        }
+        return true;
+    }
+
+    int32 x;
+    int64 y;
+};
+
+DEF_test(rpc_wire) {
+    DEF_case(varint) {
+        fastream s;
+        rpc::wire::put_varint(s, 0);
+        rpc::wire::put_varint(s, 127);
+        rpc::wire::put_varint(s, 128);
+        rpc::wire::put_varint(s, MAX_UINT64);
+        EXPECT_EQ(s.size(), 1 + 1 + 2 + 10);
+
+        const char* p = s.data();
+        const char* e = p + s.size();
+        uint64 v = 7;
+        EXPECT(rpc::wire::get_varint(p, e, v));
+        EXPECT_EQ(v, 0);
+        EXPECT(rpc::wire::get_varint(p, e, v));
+        EXPECT_EQ(v, 127);
+        EXPECT(rpc::wire::get_varint(p, e, v));
+        EXPECT_EQ(v, 128);
+        EXPECT(rpc::wire::get_varint(p, e, v));
+        EXPECT_EQ(v, MAX_UINT64);
+        EXPECT_EQ(p, e);
+        EXPECT(!rpc::wire::get_varint(p, e, v));
+
+        // truncated
+        const char x[] = { (char)0x80, (char)0x80 };
+        p = x;
+        EXPECT(!rpc::wire::get_varint(p, x + 2, v));
+    }
+
+    DEF_case(zigzag) {
+        EXPECT_EQ(rpc::wire::zigzag(0), 0);
+        EXPECT_EQ(rpc::wire::zigzag(-1), 1);
+        EXPECT_EQ(rpc::wire::zigzag(1), 2);
+        EXPECT_EQ(rpc::wire::unzigzag(rpc::wire::zigzag(MIN_INT64)), MIN_INT64);
+        EXPECT_EQ(rpc::wire::unzigzag(rpc::wire::zigzag(MAX_INT64)), MAX_INT64);
+    }
+
+    DEF_case(fields) {
+        fastream s;
+        rpc::wire::write(s, 1, 0);
+        rpc::wire::write(s, 2, false);
+        rpc::wire::write(s, 3, fastring());
+        EXPECT_EQ(s.size(), 0); // zero values are not written
+
+        co::vector<int32> a = { 1, -1, 1 << 20 };
+        co::vector<fastring> b = { "x", "", fastring(200, 'y') };
+        co::vector<Pt> c(2);
+        c[0].x = -3;
+        c[1].y = 1LL << 40;
+        rpc::wire::write(s, 1, a);
+        rpc::wire::write(s, 2, b);
+        rpc::wire::write(s, 3, c);
+        rpc::wire::write(s, 4, 3.25);
+        rpc::wire::write(s, 5, fastring(300, 'z')); // 2 bytes of length
+
+        co::vector<int32> ra;
+        co::vector<fastring> rb;
+        co::vector<Pt> rc;
+        double rd = 0;
+        fastring re;
+        const char* p = s.data();
+        const char* const e = p + s.size();
+        uint64 k = 0;
+        while (p < e) {
+            EXPECT(rpc::wire::get_varint(p, e, k));
+            const int t = (int)(k & 7);
+            bool r = false;
+            switch (k >> 3) {
+              case 1:  r = rpc::wire::read(p, e, t, ra); break;
+              case 2:  r = rpc::wire::read(p, e, t, rb); break;
+              case 3:  r = rpc::wire::read(p, e, t, rc); break;
+              case 4:  r = rpc::wire::read(p, e, t, rd); break;
+              case 5:  r = rpc::wire::read(p, e, t, re); break;
+            }
+            EXPECT(r);
+            if (!r) break;
+        }
+        EXPECT_EQ(k, (5 << 3) | 2); // the last field, a length-delimited string
+        EXPECT(ra == a);
+        EXPECT(rb == b);
+        EXPECT_EQ(rc.size(), 2);
+        if (rc.size() == 2) {
+            EXPECT_EQ(rc[0].x, -3);
+            EXPECT_EQ(rc[0].y, 0);
+            EXPECT_EQ(rc[1].y, 1LL << 40);
+        }
+        EXPECT_EQ(rd, 3.25);
+        EXPECT_EQ(re, fastring(300, 'z'));
+    }
+
+    DEF_case(skip) {
+        // unknown fields and fields of unexpected types are skipped
+        fastream s;
+        rpc::wire::write(s, 9, fastring("unknown"));
+        rpc::wire::write(s, 1, fastring("bad type"));
+        rpc::wire::write(s, 8, 1.5);
+        rpc::wire::write(s, 2, (int64)-9);
+        Pt x;
+        x.x = 5;
+        EXPECT(x.decode(s.data(), s.size()));
+        EXPECT_EQ(x.x, 0);
+        EXPECT_EQ(x.y, -9);
+
+        // truncated data
+        EXPECT(!x.decode(s.data(), s.size() - 1));
+    }
+}
+
+} // namespace test
@@ -0,0 +1,217 @@
+#include "co/unitest.h"
+#include "co/co.h"
+#include "co/time.h"
+#include "../src/so/rpc_shm.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace test {
+namespace shm = rpc::shm;
+
+// the client of @s in this process, attach() owns the fds, they are dup()ed
+static shm::Conn* attach(shm::Conn* s) {
+    return shm::Conn::attach(::dup(s->mfd()), ::dup(s->efd(0)), ::dup(s->efd(1)));
+}
+
+// read a message into @h and @b, and release it
+static int recv(shm::Conn* c, fastring& h, fastring& b, int ms) {
+    const int r = c->read(ms);
+    if (r == 1) {
+        h.clear();
+        h.append(c->head(), c->head_size());
+        b.clear();
+        b.append(c->body(), c->body_size());
+        c->release();
+    }
+    return r;
+}
+
+// the i-th message, bodies of 17 to 511 bytes are in the ring of 4096 bytes
+static void make_msg(int i, fastring& h, fastring& b) {
+    h.clear();
+    h << "msg " << i;
+    b.clear();
+    b.resize(17 + (i * 131) % 495);
+    memset(&b[0], 'a' + i % 26, b.size());
+}
+
+DEF_test(shm_conn) {
+    // run @f in a coroutine and wait for it
+    auto run = [](std::function<void()>&& f) {
+        co::WaitGroup wg;
+        wg.add(1);
+        go([&f, wg]() { f(); wg.done(); });
+        wg.wait();
+    };
+
+    DEF_case(create_attach) {
+        shm::Conn* s = shm::Conn::create(4096, 8192);
+        EXPECT(s != NULL);
+        if (!s) return;
+        EXPECT_EQ(s->max_body_size(), 8192);
+
+        shm::Conn* c = attach(s);
+        EXPECT(c != NULL);
+        if (!c) return;
+        EXPECT_EQ(c->max_body_size(), 8192);
+
+        const fastring large(4000, 'x'); // put in the large area
+        const fastring huge(8193, 'x');
+        bool w0 = false, w1 = false, w2 = true;
+        int r0 = 0, r1 = 0, r2 = -1;
+        fastring h0, b0, h1, b1;
+        run([&]() {
+            w0 = c->write("req", 3, "hello", 5, 1000);
+            r0 = recv(s, h0, b0, 1000);
+            w1 = s->write("res", 3, large.data(), large.size(), 1000);
+            r1 = recv(c, h1, b1, 1000);
+            w2 = s->write("res", 3, huge.data(), huge.size(), 1000);
+            s->close();
+            r2 = c->read(1000);
+        });
+        EXPECT_EQ(w0, true);
+        EXPECT_EQ(r0, 1);
+        EXPECT_EQ(h0, "req");
+        EXPECT_EQ(b0, "hello");
+        EXPECT_EQ(w1, true);
+        EXPECT_EQ(r1, 1);
+        EXPECT_EQ(h1, "res");
+        EXPECT_EQ(b1, large);
+        EXPECT_EQ(w2, false);
+        EXPECT_EQ(r2, 0);
+        co::del(c);
+        co::del(s);
+
+        // the memory of an eventfd is not made by create()
+        shm::Conn* x = shm::Conn::attach(eventfd(0, 0), eventfd(0, 0), eventfd(0, 0));
+        EXPECT(x == NULL);
+    }
+
+    // messages go round the rings many times, requests and responses
+    DEF_case(wraparound) {
+        shm::Conn* s = shm::Conn::create(4096, 8192);
+        shm::Conn* c = s ? attach(s) : NULL;
+        EXPECT(c != NULL);
+        if (!c) return;
+
+        int n = 0, bad = 0;
+        run([&]() {
+            fastring h, b, x, y;
+            for (int i = 0; i < 300; ++i) {
+                make_msg(i, h, b);
+                if (!c->write(h.data(), h.size(), b.data(), b.size(), 1000)) break;
+                if (recv(s, x, y, 1000) != 1) break;
+                if (x != h || y != b) ++bad;
+                if (!s->write(y.data(), y.size(), x.data(), x.size(), 1000)) break;
+                if (recv(c, x, y, 1000) != 1) break;
+                if (x != b || y != h) ++bad;
+                ++n;
+            }
+        });
+        EXPECT_EQ(n, 300);
+        EXPECT_EQ(bad, 0);
+        co::del(c);
+        co::del(s);
+    }
+
+    // the writer waits on a full ring until the reader frees the space
+    DEF_case(backpressure) {
+        shm::Conn* s = shm::Conn::create(4096, 8192);
+        shm::Conn* c = s ? attach(s) : NULL;
+        EXPECT(c != NULL);
+        if (!c) return;
+
+        const int N = 64;
+        int written = 0, blocked = 0, got = 0, bad = 0;
+        int64 t = now::ms();
+        co::WaitGroup wg;
+        wg.add(2);
+        go([&, wg]() {
+            fastring h, b;
+            for (int i = 0; i < N; ++i) {
+                make_msg(i, h, b);
+                if (!c->write(h.data(), h.size(), b.data(), b.size(), 3000)) break;
+                ++written;
+            }
+            wg.done();
+        });
+        go([&, wg]() {
+            co::sleep(50);
+            blocked = written;
+            fastring h, b, x, y;
+            for (int i = 0; i < N; ++i) {
+                if (recv(s, x, y, 3000) != 1) break;
+                make_msg(i, h, b);
+                if (x != h || y != b) ++bad;
+                ++got;
+            }
+            wg.done();
+        });
+        wg.wait();
+        t = now::ms() - t;
+        EXPECT_LT(blocked, N);
+        EXPECT_EQ(written, N);
+        EXPECT_EQ(got, N);
+        EXPECT_EQ(bad, 0);
+        EXPECT_LT(t, 2000);
+
+        // a full ring, the writer times out, or wakes up when the peer closes
+        bool w0 = true, w1 = true;
+        int64 t0 = 0, t1 = 0;
+        run([&]() {
+            fastring h, b;
+            make_msg(1, h, b);
+            while (c->write(h.data(), h.size(), b.data(), b.size(), 0));
+            int64 x = now::ms();
+            w0 = c->write(h.data(), h.size(), b.data(), b.size(), 50);
+            t0 = now::ms() - x;
+
+            co::WaitGroup g;
+            g.add(1);
+            go([s, g]() { co::sleep(50); s->close(); g.done(); });
+            x = now::ms();
+            w1 = c->write(h.data(), h.size(), b.data(), b.size(), 3000);
+            t1 = now::ms() - x;
+            g.wait();
+        });
+        EXPECT_EQ(w0, false);
+        EXPECT_GE(t0, 45); // the deadline is from the time cached by the scheduler
+        EXPECT_EQ(w1, false);
+        EXPECT_LT(t1, 2000);
+        co::del(c);
+        co::del(s);
+    }
+
+    // a connection is passed once, to the client with its token
+    DEF_case(token) {
+        shm::Conn* s = shm::Conn::create(4096, 8192);
+        EXPECT(s != NULL);
+        if (!s) return;
+        const uint64 t = shm::offer(s);
+        EXPECT_NE(t, 0);
+
+        shm::Conn *x = 0, *c = 0, *y = 0;
+        int r = 0;
+        fastring h, b;
+        run([&]() {
+            const char* addr = shm::addr().c_str();
+            x = shm::fetch(addr, t ^ 1, 1000);
+            c = shm::fetch(addr, t, 1000);
+            y = shm::fetch(addr, t, 1000);
+            if (c && c->write("req", 3, "hello", 5, 1000)) r = recv(s, h, b, 1000);
+        });
+        shm::withdraw(t);
+        EXPECT(x == NULL);
+        EXPECT(c != NULL);
+        EXPECT(y == NULL);
+        EXPECT_EQ(r, 1);
+        EXPECT_EQ(b, "hello");
+        if (c) co::del(c);
+        co::del(s);
+    }
+}
+
+} // test
+#endif
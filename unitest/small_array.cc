@@ -0,0 +1,123 @@
+#include "co/unitest.h"
+#include "co/small_array.h"
+#include "co/fastring.h"
+
+namespace test {
+
+DEF_test(small_array) {
+    DEF_case(base) {
+        co::small_array<int, 4> v;
+        EXPECT(v.empty());
+        EXPECT(v.is_inline());
+        EXPECT_EQ(v.capacity(), 4);
+        EXPECT_NE(v.data(), (int*)0);
+
+        for (int i = 0; i < 4; ++i) v.push_back(i);
+        EXPECT(v.is_inline());
+        EXPECT_EQ(v.size(), 4);
+
+        v.push_back(4);
+        EXPECT(!v.is_inline());
+        EXPECT_EQ(v.size(), 5);
+        EXPECT_GT(v.capacity(), 4);
+        for (int i = 0; i < 5; ++i) EXPECT_EQ(v[i], i);
+
+        v.clear();
+        EXPECT_EQ(v.size(), 0);
+        EXPECT(!v.is_inline());
+
+        v.reset();
+        EXPECT(v.is_inline());
+        EXPECT_EQ(v.capacity(), 4);
+
+        co::small_array<int, 4> u(2);
+        EXPECT(u.is_inline());
+        co::small_array<int, 4> w(8);
+        EXPECT(!w.is_inline());
+        EXPECT_EQ(w.capacity(), 8);
+        EXPECT_EQ(w.size(), 0);
+    }
+
+    DEF_case(construct) {
+        co::small_array<int, 4> v(3, 7);
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v.back(), 7);
+
+        co::small_array<int, 4> u = { 1, 2, 3, 4, 5 };
+        EXPECT_EQ(u.size(), 5);
+        EXPECT(!u.is_inline());
+        EXPECT_EQ(u.front(), 1);
+        EXPECT_EQ(u.back(), 5);
+
+        co::small_array<int, 4> x(u);
+        EXPECT_EQ(x.size(), 5);
+        EXPECT_EQ(x[4], 5);
+
+        int a[3] = { 3, 2, 1 };
+        co::small_array<int, 4> y(a, 3);
+        EXPECT(y.is_inline());
+        EXPECT_EQ(y[0], 3);
+
+        co::small_array<int, 4> z(u.begin(), u.end());
+        EXPECT_EQ(z.size(), 5);
+        EXPECT_EQ(z[2], 3);
+
+        v = u;
+        EXPECT_EQ(v.size(), 5);
+        v = { 9 };
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(v[0], 9);
+    }
+
+    DEF_case(move) {
+        co::small_array<fastring, 2> v;
+        v.push_back("hello");
+        co::small_array<fastring, 2> u(std::move(v));
+        EXPECT(u.is_inline());
+        EXPECT_EQ(u.size(), 1);
+        EXPECT_EQ(u[0], "hello");
+        EXPECT(v.empty());
+
+        u.push_back("world");
+        u.push_back("again");
+        EXPECT(!u.is_inline());
+        const fastring* p = u.data();
+        v = std::move(u);
+        EXPECT_EQ(v.data(), p);
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[2], "again");
+        EXPECT(u.empty());
+        EXPECT(u.is_inline());
+
+        u.push_back("x");
+        u.swap(v);
+        EXPECT_EQ(u.size(), 3);
+        EXPECT_EQ(u[0], "hello");
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(v[0], "x");
+        EXPECT(v.is_inline());
+    }
+
+    DEF_case(remove) {
+        co::small_array<fastring, 4> v = { "a", "b", "c" };
+        v.remove(0);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0], "c");
+        v.remove_back();
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(v.pop_back(), "c");
+        EXPECT(v.empty());
+
+        v.push_back(6, fastring("x"));
+        EXPECT_EQ(v.size(), 6);
+        v.resize(2);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[1], "x");
+
+        int n = 0;
+        for (auto& s : v) n += (int)s.size();
+        EXPECT_EQ(n, 2);
+    }
+}
+
+} // namespace test
@@ -0,0 +1,142 @@
+#include "co/unitest.h"
+#include "co/small_string.h"
+#include <unordered_map>
+
+namespace test {
+
+DEF_test(small_string) {
+    DEF_case(base) {
+        EXPECT_EQ(sizeof(co::small_string), 24);
+
+        co::small_string s;
+        EXPECT(s.empty());
+        EXPECT(s.is_inline());
+        EXPECT_EQ(s.size(), 0);
+        EXPECT_EQ(s.capacity(), co::small_string::kInline);
+        EXPECT_EQ(s.c_str()[0], '\0');
+
+        s = "xxx";
+        EXPECT_EQ(s, "xxx");
+        EXPECT(s.is_inline());
+
+        co::small_string x(std::string("888"));
+        co::small_string y = std::move(x);
+        EXPECT_EQ(y, "888");
+        EXPECT_EQ(x, "");
+
+        co::small_string z(22, 'x');
+        EXPECT(z.is_inline());
+        co::small_string w(23, 'x');
+        EXPECT(!w.is_inline());
+        EXPECT_EQ(w.size(), 23);
+        EXPECT_EQ(strlen(w.c_str()), 23);
+
+        co::small_string v = std::move(w);
+        EXPECT(!v.is_inline());
+        EXPECT_EQ(v, fastring(23, 'x'));
+        EXPECT(w.empty());
+        EXPECT(w.is_inline());
+
+        v = z;
+        EXPECT_EQ(v, z);
+        v.reset();
+        EXPECT(v.empty());
+        EXPECT(v.is_inline());
+    }
+
+    DEF_case(append) {
+        co::small_string s;
+        s.append(s);
+        EXPECT_EQ(s, "");
+
+        s.append("hello");
+        s.append(s);
+        EXPECT_EQ(s, "hellohello");
+        EXPECT(s.is_inline());
+
+        s.append(s.data() + 5, 5).append(s);
+        EXPECT_EQ(s, "hellohellohellohellohellohello");
+        EXPECT(!s.is_inline());
+        EXPECT_EQ(strlen(s.c_str()), s.size());
+
+        s.clear();
+        s << 32 << ' ' << -7 << ' ' << true << ' ' << 'c' << ' ' << 1.5;
+        EXPECT_EQ(s, "32 -7 true c 1.5");
+
+        s.resize(2);
+        EXPECT_EQ(s, "32");
+        s.resize(4, 'x');
+        EXPECT_EQ(s, "32xx");
+        s.append(30, 'y');
+        EXPECT_EQ(s.size(), 34);
+        EXPECT_EQ(s.back(), 'y');
+        s += 'z';
+        EXPECT_EQ(s.back(), 'z');
+
+        co::small_string t;
+        t.reserve(100);
+        EXPECT(!t.is_inline());
+        EXPECT_GE(t.capacity(), 100);
+        EXPECT(t.empty());
+    }
+
+    DEF_case(fastring) {
+        fastring f(64, 'x');
+        const char* p = f.data();
+        co::small_string s(std::move(f));
+        EXPECT_EQ(s.data(), p);
+        EXPECT_EQ(s.size(), 64);
+        EXPECT(f.empty());
+
+        fastring g = std::move(s).str();
+        EXPECT_EQ(g.data(), p);
+        EXPECT_EQ(g, fastring(64, 'x'));
+        EXPECT(s.empty());
+
+        co::small_string x(fastring("hello"));
+        EXPECT(x.is_inline());
+        EXPECT_EQ(x.str(), "hello");
+
+        fastring h("x=");
+        h << x;
+        EXPECT_EQ(h, "x=hello");
+        fastream fs;
+        fs << x;
+        EXPECT_EQ(fs.str(), "hello");
+    }
+
+    DEF_case(find) {
+        co::small_string s("hello world");
+        EXPECT_EQ(s.find('o'), 4);
+        EXPECT_EQ(s.find('o', 5), 7);
+        EXPECT_EQ(s.find('x'), s.npos);
+        EXPECT_EQ(s.find("wor"), 6);
+        EXPECT_EQ(s.find("wox"), s.npos);
+        EXPECT_EQ(s.rfind('o'), 7);
+        EXPECT(s.starts_with("hello"));
+        EXPECT(s.ends_with("world"));
+        EXPECT(s.starts_with('h'));
+        EXPECT(!s.ends_with('x'));
+        EXPECT_EQ(s.substr(6), "world");
+        EXPECT_EQ(s.substr(6, 2), "wo");
+        EXPECT_EQ(s.substr(32), "");
+    }
+
+    DEF_case(compare) {
+        co::small_string a("abc"), b("abd"), c("ab");
+        EXPECT(a < b);
+        EXPECT(c < a);
+        EXPECT(b > c);
+        EXPECT(a != b);
+        EXPECT(a == fastring("abc"));
+        EXPECT(fastring("abc") == a);
+
+        std::unordered_map<co::small_string, int> m;
+        m[a] = 1;
+        m[co::small_string(30, 'x')] = 2;
+        EXPECT_EQ(m[co::small_string("abc")], 1);
+        EXPECT_EQ(m[co::small_string(30, 'x')], 2);
+    }
+}
+
+} // namespace test
@@ -48,6 +48,37 @@ DEF_test(str) {
         EXPECT_EQ(v[0], "");
         EXPECT_EQ(v[1], "x");
         EXPECT_EQ(v[2], "y||");
+
+        v = str::split(fastring("||x||y||"), "||");
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[1], "x");
+        EXPECT_EQ(v[2], "y");
+    }
+
+    DEF_case(split_each) {
+        fastring s("x,,y\0z,", 7);
+        co::vector<fastring> v;
+        auto f = [&v](const char* p, size_t n) { v.push_back(fastring(p, n)); };
+        str::split_each(s, ',', f);
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[0], "x");
+        EXPECT_EQ(v[1], "");
+        EXPECT_EQ(v[2], fastring("y\0z", 3));
+
+        v.clear();
+        str::split_each(s, ',', f, 1);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[1], fastring(",y\0z,", 5));
+
+        v.clear();
+        str::split_each("a\r\nb\r\n", 6, "\r\n", f);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0], "a");
+        EXPECT_EQ(v[1], "b");
+
+        v.clear();
+        str::split_each("ab", 2, "", f);
+        EXPECT_EQ(v.size(), 1);
     }
 
     DEF_case(replace) {
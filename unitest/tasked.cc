@@ -0,0 +1,70 @@
+#include "co/unitest.h"
+#include "co/tasked.h"
+#include "co/atomic.h"
+#include "co/time.h"
+
+namespace test {
+
+DEF_test(tasked) {
+    DEF_case(ms) {
+        Tasked s;
+        int n = 0, m = 0;
+        s.run_in_ms([&]() { atomic_inc(&n); }, 0);
+        s.run_in_ms([&]() { atomic_inc(&n); }, 20);
+        s.run_every_ms([&]() { atomic_inc(&m); }, 10);
+        sleep::ms(105);
+        s.stop();
+        EXPECT_EQ(n, 2);
+        EXPECT_GE(m, 5);
+        EXPECT_LE(m, 11);
+
+        const Tasked::stats_t st = s.stats();
+        EXPECT_EQ(st.runs, (uint64)(n + m));
+        EXPECT_GE(st.max_latency_us, st.avg_latency_us);
+        EXPECT_GE(st.max_duration_us, st.avg_duration_us);
+    }
+
+    DEF_case(pool) {
+        Tasked s(2);
+        int n = 0;
+        // a slow task does not delay the others
+        s.run_in_ms([&]() { sleep::ms(100); atomic_inc(&n); }, 0);
+        s.run_in_ms([&]() { atomic_inc(&n); }, 10);
+        sleep::ms(50);
+        EXPECT_EQ(atomic_load(&n), 1);
+
+        // runs of a periodic task are skipped while the last one is running
+        int m = 0;
+        s.run_every_ms([&]() { atomic_inc(&m); sleep::ms(30); }, 5);
+        sleep::ms(100);
+        s.stop();
+        EXPECT_EQ(n, 2);
+        EXPECT_GE(m, 1);
+        EXPECT_LE(m, 5);
+        EXPECT_GT(s.stats().overruns, 0);
+        EXPECT_EQ(s.stats().runs, (uint64)(n + m));
+    }
+
+    DEF_case(go) {
+        Tasked s(Tasked::in_go);
+        int n = 0;
+        s.run_in_ms([&]() { atomic_inc(&n); }, 1);
+        s.run_every_ms([&]() { atomic_inc(&n); }, 20);
+        sleep::ms(50);
+        s.stop();
+        EXPECT_GE(atomic_load(&n), 2);
+    }
+
+    DEF_case(in_place_overrun) {
+        Tasked s;
+        int m = 0;
+        s.run_every_ms([&]() { ++m; sleep::ms(25); }, 10);
+        sleep::ms(100);
+        s.stop();
+        EXPECT_GE(m, 2);
+        EXPECT_LE(m, 5);
+        EXPECT_GT(s.stats().overruns, 0);
+    }
+}
+
+} // namespace test
@@ -35,6 +35,31 @@ DEF_test(time) {
         sleep::ms(1);
         int64 t = timer.us();
         EXPECT_GE(t, 1000);
+
+        Timer fast(true);
+        sleep::ms(1);
+        EXPECT_GE(fast.ns(), 1000000);
+    }
+
+    DEF_case(fast_ns) {
+        int64 x = now::fast_ns();
+        int64 n = now::ns();
+        EXPECT_LT(x - n < 0 ? n - x : x - n, 1000000);
+
+        // it goes on across recalibrations
+        bool ok = true;
+        int64 last = now::fast_ns();
+        for (int i = 0; i < 30; ++i) {
+            sleep::ms(10);
+            for (int k = 0; k < 1000; ++k) {
+                x = now::fast_ns();
+                ok = ok && x >= last;
+                last = x;
+            }
+        }
+        EXPECT(ok);
+        n = now::ns();
+        EXPECT_LT(x - n < 0 ? n - x : x - n, 1000000);
     }
 }
 
@@ -0,0 +1,103 @@
+#include "co/unitest.h"
+#include "co/tracing.h"
+#include "co/co.h"
+
+namespace test {
+
+DEF_test(tracing) {
+    DEF_case(traceparent) {
+        tracing::context_t c;
+        const char* s = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+        EXPECT(tracing::parse(s, c));
+        EXPECT_EQ(c.trace_hi, 0x4bf92f3577b34da6ull);
+        EXPECT_EQ(c.trace_lo, 0xa3ce929d0e0e4736ull);
+        EXPECT_EQ(c.span_id, 0x00f067aa0ba902b7ull);
+        EXPECT(c.sampled());
+
+        char buf[tracing::kTraceparentSize + 1];
+        tracing::format(c, buf);
+        EXPECT_EQ(fastring(buf), s);
+
+        // fields appended by later versions
+        EXPECT(tracing::parse("01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00-xx", c));
+        EXPECT(!c.sampled());
+
+        EXPECT(!tracing::parse("", c));
+        EXPECT(!tracing::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7", c));
+        EXPECT(!tracing::parse("00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01", c));
+        EXPECT(!tracing::parse("00-00000000000000000000000000000000-00f067aa0ba902b7-01", c));
+        EXPECT(!tracing::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01", c));
+        EXPECT(!tracing::parse("ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01", c));
+        EXPECT(!tracing::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-xx", c));
+    }
+
+    DEF_case(span) {
+        co::vector<tracing::span_t> v;
+        tracing::set_exporter([&v](const tracing::span_t* s, size_t n) {
+            v.insert(v.end(), s, s + n);
+        });
+
+        tracing::context_t p;
+        EXPECT(tracing::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01", p));
+        tracing::context_t u = p;
+        u.flags = 0;
+
+        co::WaitGroup wg;
+        wg.add(1);
+        uint64 sid = 0, cid = 0;
+        bool leaked = true;
+        go([&]() {
+            {
+                tracing::Span s(&p, "serve");
+                EXPECT(s.recording());
+                EXPECT_EQ(tracing::current(), &s);
+                sid = s.context().span_id;
+                {
+                    tracing::Span c("query", tracing::kClient);
+                    EXPECT(c.recording());
+                    EXPECT_EQ(tracing::current(), &c);
+                    c.set_status(3);
+                    cid = c.context().span_id;
+                }
+                EXPECT_EQ(tracing::current(), &s);
+            }
+            {
+                // not sampled by the caller, nothing is recorded
+                tracing::Span s(&u, "serve");
+                EXPECT(!s.recording());
+                tracing::Span c("query");
+                EXPECT(!c.recording());
+            }
+            leaked = tracing::current() != NULL;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(!leaked);
+
+        tracing::flush();
+        tracing::set_exporter([](const tracing::span_t*, size_t) {});
+        EXPECT_EQ(v.size(), 2u);
+        if (v.size() == 2) {
+            // the child is finished first
+            EXPECT_EQ(fastring(v[0].name), "query");
+            EXPECT_EQ(v[0].id, cid);
+            EXPECT_EQ(v[0].parent_id, sid);
+            EXPECT_EQ(v[0].status, 3);
+            EXPECT_EQ(v[0].kind, (uint8)tracing::kClient);
+            EXPECT_EQ(fastring(v[1].name), "serve");
+            EXPECT_EQ(v[1].parent_id, p.span_id);
+            EXPECT_EQ(v[1].trace_lo, p.trace_lo);
+            EXPECT_EQ(v[1].kind, (uint8)tracing::kServer);
+            EXPECT(v[1].beg_ns <= v[0].beg_ns && v[0].end_ns <= v[1].end_ns);
+        }
+    }
+
+    DEF_case(sample_rate) {
+        // no parent and a zero rate, nothing is recorded
+        tracing::Span s((const tracing::context_t*)0, "root");
+        EXPECT(!s.recording());
+        EXPECT(tracing::current() == NULL);
+    }
+}
+
+} // namespace test
@@ -3,4 +3,7 @@ target("unitest")
     set_default(false)
     add_deps("libco")
     add_files("*.cc")
+    if has_config("with_libcurl") then
+        add_defines("HAS_LIBCURL")
+    end
 
@@ -48,6 +48,34 @@ option("with_libcurl")
     set_description("build with libcurl, required by http::Client")
 option_end()
 
+-- build with zlib, log files can be compressed on the fly
+option("with_zlib")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with zlib, compress log files on the fly")
+option_end()
+
+-- build with brotli, http responses can be compressed with it
+option("with_brotli")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with brotli, compress http responses")
+option_end()
+
+-- build with zstd, http responses and rpc messages can be compressed with it
+option("with_zstd")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with zstd, compress http responses and rpc messages")
+option_end()
+
+-- build with lz4, rpc messages can be compressed with it
+option("with_lz4")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with lz4, compress rpc messages")
+option_end()
+
 -- build with -fPIC
 option("fpic")
     set_default(false)
@@ -56,6 +84,13 @@ option("fpic")
     add_cxflags("-fPIC")
 option_end()
 
+-- replace malloc/free and new/delete with co::alloc (linux only)
+option("override_malloc")
+    set_default(false)
+    set_showmenu(true)
+    set_description("replace malloc and operator new with co::alloc")
+option_end()
+
 if has_config("with_libcurl") then
     add_requires("openssl >=1.1.0")
     add_requires("libcurl", {configs = {openssl = true, zlib = true}})
@@ -63,6 +98,22 @@ elseif has_config("with_openssl") then
     add_requires("openssl >=1.1.0")
 end 
 
+if has_config("with_zlib") then
+    add_requires("zlib")
+end
+
+if has_config("with_brotli") then
+    add_requires("brotli")
+end
+
+if has_config("with_zstd") then
+    add_requires("zstd")
+end
+
+if has_config("with_lz4") then
+    add_requires("lz4")
+end
+
 
 -- include dir
 add_includedirs("include")